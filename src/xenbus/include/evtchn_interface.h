@@ -51,6 +51,19 @@ typedef enum _XENBUS_EVTCHN_TYPE {
     XENBUS_EVTCHN_TYPE_VIRQ             /*!< VIRQ */
 } XENBUS_EVTCHN_TYPE, *PXENBUS_EVTCHN_TYPE;
 
+/*! \enum _XENBUS_EVTCHN_PRIORITY
+    \brief Event channel priority
+
+    Only honoured by the FIFO event channel ABI. Pending events on
+    higher priority channels are always serviced before those on lower
+    priority channels bound to the same CPU.
+*/
+typedef enum _XENBUS_EVTCHN_PRIORITY {
+    XENBUS_EVTCHN_PRIORITY_HIGH = 4,    /*!< Latency sensitive */
+    XENBUS_EVTCHN_PRIORITY_DEFAULT = 7, /*!< Default */
+    XENBUS_EVTCHN_PRIORITY_LOW = 10     /*!< Bulk */
+} XENBUS_EVTCHN_PRIORITY, *PXENBUS_EVTCHN_PRIORITY;
+
 /*! \typedef XENBUS_EVTCHN_CHANNEL
     \brief Event channel handle
 */  
@@ -128,6 +141,24 @@ typedef NTSTATUS
     IN  UCHAR                   Number
     );
 
+/*! \typedef XENBUS_EVTCHN_SET_PRIORITY
+    \brief Set the priority at which events on a channel are serviced
+
+    The priority is lost if the channel is closed (including across
+    suspend/resume) so it must be set again whenever the channel is
+    re-opened.
+
+    \param Interface The interface header
+    \param Channel The channel handle
+    \param Priority The priority
+*/
+typedef NTSTATUS
+(*XENBUS_EVTCHN_SET_PRIORITY)(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel,
+    IN  XENBUS_EVTCHN_PRIORITY  Priority
+    );
+
 typedef VOID
 (*XENBUS_EVTCHN_UNMASK_V4)(
     IN  PINTERFACE              Interface,
@@ -340,7 +371,31 @@ struct _XENBUS_EVTCHN_INTERFACE_V8 {
     XENBUS_EVTCHN_CLOSE     EvtchnClose;
 };
 
-typedef struct _XENBUS_EVTCHN_INTERFACE_V8 XENBUS_EVTCHN_INTERFACE, *PXENBUS_EVTCHN_INTERFACE;
+/*! \struct _XENBUS_EVTCHN_INTERFACE_V9
+    \brief EVTCHN interface version 9
+    \ingroup interfaces
+
+    Version 8 with EvtchnSetPriority appended, so a client that
+    only uses priorities when they are available can fall back to
+    querying version 8 into the same structure.
+*/
+struct _XENBUS_EVTCHN_INTERFACE_V9 {
+    INTERFACE                   Interface;
+    XENBUS_EVTCHN_ACQUIRE       EvtchnAcquire;
+    XENBUS_EVTCHN_RELEASE       EvtchnRelease;
+    XENBUS_EVTCHN_OPEN          EvtchnOpen;
+    XENBUS_EVTCHN_BIND          EvtchnBind;
+    XENBUS_EVTCHN_UNMASK        EvtchnUnmask;
+    XENBUS_EVTCHN_SEND          EvtchnSend;
+    XENBUS_EVTCHN_TRIGGER       EvtchnTrigger;
+    XENBUS_EVTCHN_GET_COUNT     EvtchnGetCount;
+    XENBUS_EVTCHN_WAIT          EvtchnWait;
+    XENBUS_EVTCHN_GET_PORT      EvtchnGetPort;
+    XENBUS_EVTCHN_CLOSE         EvtchnClose;
+    XENBUS_EVTCHN_SET_PRIORITY  EvtchnSetPriority;
+};
+
+typedef struct _XENBUS_EVTCHN_INTERFACE_V9 XENBUS_EVTCHN_INTERFACE, *PXENBUS_EVTCHN_INTERFACE;
 
 /*! \def XENBUS_EVTCHN
     \brief Macro at assist in method invocation
@@ -351,7 +406,7 @@ typedef struct _XENBUS_EVTCHN_INTERFACE_V8 XENBUS_EVTCHN_INTERFACE, *PXENBUS_EVT
 #endif  // _WINDLL
 
 #define XENBUS_EVTCHN_INTERFACE_VERSION_MIN 4
-#define XENBUS_EVTCHN_INTERFACE_VERSION_MAX 8
+#define XENBUS_EVTCHN_INTERFACE_VERSION_MAX 9
 
 #endif  // _XENBUS_EVTCHN_INTERFACE_H
 
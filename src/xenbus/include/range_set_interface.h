@@ -66,18 +66,36 @@ typedef VOID
     IN  PINTERFACE  Interface
     );
 
+typedef NTSTATUS
+(*XENBUS_RANGE_SET_CREATE_V1)(
+    IN  PINTERFACE          Interface,
+    IN  const CHAR          *Name,
+    OUT PXENBUS_RANGE_SET   *RangeSet
+    );
+
+/*! \enum _XENBUS_RANGE_SET_TYPE
+    \brief Range-set implementation
+*/
+typedef enum _XENBUS_RANGE_SET_TYPE {
+    XENBUS_RANGE_SET_TYPE_INVALID = 0,
+    XENBUS_RANGE_SET_TYPE_LIST,     /*!< Sorted list with a cursor; cheap for sets that stay contiguous */
+    XENBUS_RANGE_SET_TYPE_TREE      /*!< Balanced tree; O(log n) operations however fragmented the set becomes */
+} XENBUS_RANGE_SET_TYPE, *PXENBUS_RANGE_SET_TYPE;
+
 /*! \typedef XENBUS_RANGE_SET_CREATE
     \brief Create a new empty range-set
 
     \param Interface The interface header
     \param Name A name for the ramge-set which will be used in debug output
+    \param Type The implementation to use
     \param RangeSet A pointer to a range-set handle to be initialized
 */  
 typedef NTSTATUS
 (*XENBUS_RANGE_SET_CREATE)(
-    IN  PINTERFACE          Interface,
-    IN  const CHAR          *Name,
-    OUT PXENBUS_RANGE_SET   *RangeSet
+    IN  PINTERFACE              Interface,
+    IN  const CHAR              *Name,
+    IN  XENBUS_RANGE_SET_TYPE   Type,
+    OUT PXENBUS_RANGE_SET       *RangeSet
     );
 
 /*! \typedef XENBUS_RANGE_SET_PUT
@@ -152,6 +170,21 @@ DEFINE_GUID(GUID_XENBUS_RANGE_SET_INTERFACE,
     \ingroup interfaces
 */
 struct _XENBUS_RANGE_SET_INTERFACE_V1 {
+    INTERFACE                   Interface;
+    XENBUS_RANGE_SET_ACQUIRE    RangeSetAcquire;
+    XENBUS_RANGE_SET_RELEASE    RangeSetRelease;
+    XENBUS_RANGE_SET_CREATE_V1  RangeSetCreateVersion1;
+    XENBUS_RANGE_SET_PUT        RangeSetPut;
+    XENBUS_RANGE_SET_POP        RangeSetPop;
+    XENBUS_RANGE_SET_GET        RangeSetGet;
+    XENBUS_RANGE_SET_DESTROY    RangeSetDestroy;
+};
+
+/*! \struct _XENBUS_RANGE_SET_INTERFACE_V2
+    \brief RANGE_SET interface version 2
+    \ingroup interfaces
+*/
+struct _XENBUS_RANGE_SET_INTERFACE_V2 {
     INTERFACE                   Interface;
     XENBUS_RANGE_SET_ACQUIRE    RangeSetAcquire;
     XENBUS_RANGE_SET_RELEASE    RangeSetRelease;
@@ -162,7 +195,7 @@ struct _XENBUS_RANGE_SET_INTERFACE_V1 {
     XENBUS_RANGE_SET_DESTROY    RangeSetDestroy;
 };
 
-typedef struct _XENBUS_RANGE_SET_INTERFACE_V1 XENBUS_RANGE_SET_INTERFACE, *PXENBUS_RANGE_SET_INTERFACE;
+typedef struct _XENBUS_RANGE_SET_INTERFACE_V2 XENBUS_RANGE_SET_INTERFACE, *PXENBUS_RANGE_SET_INTERFACE;
 
 /*! \def XENBUS_RANGE_SET
     \brief Macro at assist in method invocation
@@ -173,7 +206,7 @@ typedef struct _XENBUS_RANGE_SET_INTERFACE_V1 XENBUS_RANGE_SET_INTERFACE, *PXENB
 #endif  // _WINDLL
 
 #define XENBUS_RANGE_SET_INTERFACE_VERSION_MIN 1
-#define XENBUS_RANGE_SET_INTERFACE_VERSION_MAX 1
+#define XENBUS_RANGE_SET_INTERFACE_VERSION_MAX 2
 
 #endif  // _XENBUS_RANGE_SET_INTERFACE_H
 
@@ -54,6 +54,10 @@
     DEFINE_REVISION(0x09000001,  1,  2,  6,  1,  2,  1,  1,  2,  1,  1,  1), \
     DEFINE_REVISION(0x09000002,  1,  2,  7,  1,  2,  1,  1,  2,  1,  1,  1), \
     DEFINE_REVISION(0x09000003,  1,  2,  8,  1,  2,  1,  1,  2,  1,  1,  1), \
-    DEFINE_REVISION(0x09000004,  1,  2,  8,  1,  2,  1,  1,  3,  1,  1,  1)
+    DEFINE_REVISION(0x09000004,  1,  2,  8,  1,  2,  1,  1,  3,  1,  1,  1), \
+    DEFINE_REVISION(0x09000005,  1,  2,  8,  1,  2,  2,  1,  3,  1,  1,  1), \
+    DEFINE_REVISION(0x09000006,  1,  2,  9,  1,  2,  2,  1,  3,  1,  1,  1), \
+    DEFINE_REVISION(0x09000007,  1,  3,  9,  1,  2,  2,  1,  3,  1,  1,  1), \
+    DEFINE_REVISION(0x09000008,  2,  3,  9,  1,  2,  2,  1,  3,  1,  1,  1)
 
 #endif  // _REVISION_H
@@ -82,6 +82,81 @@ HypercallPopulate(
     VOID
     );
 
+// HYPERCALL PROFILE
+
+// Profiling is enabled by setting the HypercallProfile DWORD under the
+// XEN service Parameters key. Ordinals are the __HYPERVISOR_* values;
+// STATUS_NO_MORE_ENTRIES is returned once Ordinal (or Index) is out of
+// range and STATUS_NOT_SUPPORTED if profiling is not enabled.
+// Per-module totals are only collected if the HypercallProfileCallers
+// DWORD is also set, since finding the caller means a stack walk on
+// every hypercall.
+__checkReturn
+XEN_API
+NTSTATUS
+HypercallQueryProfile(
+    IN  ULONG       Ordinal,
+    OUT const CHAR  **Name OPTIONAL,
+    OUT PULONG64    Count,
+    OUT PULONG64    Cycles
+    );
+
+__checkReturn
+XEN_API
+NTSTATUS
+HypercallQueryModuleProfile(
+    IN  ULONG       Index,
+    OUT const CHAR  **Name,
+    OUT PULONG64    Count,
+    OUT PULONG64    Cycles
+    );
+
+// MULTICALL
+
+#define XEN_MULTICALL_MAXIMUM_ENTRIES   16
+
+typedef struct _XEN_MULTICALL {
+    ULONG               Count;
+    ULONG               ArgumentCount[XEN_MULTICALL_MAXIMUM_ENTRIES];
+    multicall_entry_t   Entry[XEN_MULTICALL_MAXIMUM_ENTRIES];
+} XEN_MULTICALL, *PXEN_MULTICALL;
+
+XEN_API
+VOID
+MulticallInitialize(
+    OUT PXEN_MULTICALL  Multicall
+    );
+
+__checkReturn
+XEN_API
+NTSTATUS
+MulticallAdd(
+    IN  PXEN_MULTICALL  Multicall,
+    IN  ULONG           Ordinal,
+    IN  ULONG           Count,
+    ...
+    );
+
+#define MULTICALL_ADD(_Multicall, _Name, _Count, ...) \
+        MulticallAdd((_Multicall), __HYPERVISOR_##_Name, (_Count), __VA_ARGS__)
+
+// Issue all accumulated hypercalls in a single trap. The per-entry
+// results are then available from MulticallResult(). Failure is
+// returned only if the batch itself could not be issued.
+__checkReturn
+XEN_API
+NTSTATUS
+MulticallFlush(
+    IN  PXEN_MULTICALL  Multicall
+    );
+
+XEN_API
+LONG_PTR
+MulticallResult(
+    IN  PXEN_MULTICALL  Multicall,
+    IN  ULONG           Index
+    );
+
 // HVM
 
 __checkReturn
@@ -130,6 +205,7 @@ __checkReturn
 XEN_API
 ULONG
 MemoryDecreaseReservation(
+    IN  ULONG       Order,
     IN  ULONG       Count,
     IN  PPFN_NUMBER PfnArray
     );
@@ -138,6 +214,7 @@ __checkReturn
 XEN_API
 ULONG
 MemoryPopulatePhysmap(
+    IN  ULONG       Order,
     IN  ULONG       Count,
     IN  PPFN_NUMBER PfnArray
     );
@@ -222,6 +299,14 @@ EventChannelBindVirtualCpu(
     IN  unsigned int        vcpu_id
     );
 
+__checkReturn
+XEN_API
+NTSTATUS
+EventChannelSetPriority(
+    IN  ULONG   LocalPort,
+    IN  ULONG   Priority
+    );
+
 __checkReturn
 XEN_API
 NTSTATUS
@@ -272,6 +357,27 @@ GrantTableUnmapForeignPage(
     IN  PHYSICAL_ADDRESS        Address
     );
 
+__checkReturn
+XEN_API
+NTSTATUS
+GrantTableMapForeignPages(
+    IN  USHORT                  Domain,
+    IN  ULONG                   NumberPages,
+    IN  PULONG                  GrantRef,
+    IN  PHYSICAL_ADDRESS        Address,
+    IN  BOOLEAN                 ReadOnly,
+    OUT PULONG                  Handle
+    );
+
+__checkReturn
+XEN_API
+NTSTATUS
+GrantTableUnmapForeignPages(
+    IN  ULONG                   NumberPages,
+    IN  PULONG                  Handle,
+    IN  PHYSICAL_ADDRESS        Address
+    );
+
 __checkReturn
 XEN_API
 NTSTATUS
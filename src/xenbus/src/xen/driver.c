@@ -169,6 +169,8 @@ DllInitialize(
     HANDLE              UnplugKey;
     HANDLE              ParametersKey;
     LOG_LEVEL           LogLevel;
+    ULONG               HypercallProfile;
+    ULONG               HypercallProfileCallers;
     NTSTATUS            status;
 
     ExInitializeDriverRuntime(DrvRtPoolNxOptIn);
@@ -270,6 +272,28 @@ DllInitialize(
     if (!NT_SUCCESS(status))
         goto fail12;
 
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "HypercallProfile",
+                                     &HypercallProfile);
+    if (!NT_SUCCESS(status))
+        HypercallProfile = 0;
+
+    //
+    // Attributing each hypercall to the calling module means capturing
+    // a stack trace and looking up every frame in the module list on
+    // each call. That can cost more than a cheap hypercall such as an
+    // event channel send, so it is enabled separately from the TSC
+    // counters.
+    //
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "HypercallProfileCallers",
+                                     &HypercallProfileCallers);
+    if (!NT_SUCCESS(status))
+        HypercallProfileCallers = 0;
+
+    if (HypercallProfile != 0)
+        HypercallProfileEnable((HypercallProfileCallers != 0) ? TRUE : FALSE);
+
     RegistryCloseKey(ParametersKey);
 
     RegistryCloseKey(ServiceKey);
@@ -357,6 +381,8 @@ DllUnload(
 
     Trace("====>\n");
 
+    HypercallProfileDisable();
+
     UnplugTeardown();
 
     ProcessTeardown();
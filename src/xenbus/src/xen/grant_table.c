@@ -263,6 +263,163 @@ fail1:
     return status;
 }
 
+// Number of map or unmap operations handed to the hypervisor per hypercall
+#define GRANT_TABLE_BATCH_SIZE  32
+
+__checkReturn
+XEN_API
+NTSTATUS
+GrantTableUnmapForeignPages(
+    IN  ULONG                       NumberPages,
+    IN  PULONG                      Handle,
+    IN  PHYSICAL_ADDRESS            Address
+    )
+{
+    struct gnttab_unmap_grant_ref   op[GRANT_TABLE_BATCH_SIZE];
+    ULONG                           Done;
+    ULONG                           Count;
+    ULONG                           Index;
+    LONG_PTR                        rc;
+    NTSTATUS                        status;
+
+    // Carry on past failures so that as much as possible is unmapped;
+    // the first failure is the one reported.
+    status = STATUS_SUCCESS;
+
+    for (Done = 0; Done < NumberPages; Done += Count) {
+        Count = __min(NumberPages - Done, GRANT_TABLE_BATCH_SIZE);
+
+        RtlZeroMemory(op, Count * sizeof (op[0]));
+
+        for (Index = 0; Index < Count; Index++) {
+            op[Index].handle = Handle[Done + Index];
+            op[Index].host_addr = Address.QuadPart +
+                                  ((ULONG64)(Done + Index) << PAGE_SHIFT);
+        }
+
+        rc = GrantTableOp(GNTTABOP_unmap_grant_ref, &op[0], Count);
+
+        if (rc < 0) {
+            if (NT_SUCCESS(status))
+                ERRNO_TO_STATUS(-rc, status);
+
+            Error("%u.%u (+%u) failed (%08x)\n",
+                  Address.HighPart,
+                  Address.LowPart,
+                  Done,
+                  status);
+            continue;
+        }
+
+        for (Index = 0; Index < Count; Index++) {
+            if (op[Index].status == GNTST_okay)
+                continue;
+
+            Warning("%u.%u (+%u) failed (%d)\n",
+                    Address.HighPart,
+                    Address.LowPart,
+                    Done + Index,
+                    op[Index].status);
+
+            if (NT_SUCCESS(status))
+                GNTST_TO_STATUS(op[Index].status, status);
+        }
+    }
+
+    return status;
+}
+
+__checkReturn
+XEN_API
+NTSTATUS
+GrantTableMapForeignPages(
+    IN  USHORT                      Domain,
+    IN  ULONG                       NumberPages,
+    IN  PULONG                      GrantRef,
+    IN  PHYSICAL_ADDRESS            Address,
+    IN  BOOLEAN                     ReadOnly,
+    OUT PULONG                      Handle
+    )
+{
+    struct gnttab_map_grant_ref     op[GRANT_TABLE_BATCH_SIZE];
+    PHYSICAL_ADDRESS                PageAddress;
+    ULONG                           Done;
+    ULONG                           Count;
+    ULONG                           Index;
+    LONG_PTR                        rc;
+    NTSTATUS                        status;
+
+    for (Done = 0; Done < NumberPages; Done += Count) {
+        Count = __min(NumberPages - Done, GRANT_TABLE_BATCH_SIZE);
+
+        RtlZeroMemory(op, Count * sizeof (op[0]));
+
+        for (Index = 0; Index < Count; Index++) {
+            op[Index].dom = Domain;
+            op[Index].ref = GrantRef[Done + Index];
+            op[Index].flags = GNTMAP_host_map;
+            if (ReadOnly)
+                op[Index].flags |= GNTMAP_readonly;
+            op[Index].host_addr = Address.QuadPart +
+                                  ((ULONG64)(Done + Index) << PAGE_SHIFT);
+        }
+
+        rc = GrantTableOp(GNTTABOP_map_grant_ref, &op[0], Count);
+
+        if (rc < 0) {
+            ERRNO_TO_STATUS(-rc, status);
+            goto fail1;
+        }
+
+        status = STATUS_SUCCESS;
+
+        for (Index = 0; Index < Count; Index++) {
+            if (op[Index].status == GNTST_okay) {
+                Handle[Done + Index] = op[Index].handle;
+                continue;
+            }
+
+            Warning("%u:%u -> %u.%u (+%u) failed (%d)\n",
+                    op[Index].dom,
+                    op[Index].ref,
+                    Address.HighPart,
+                    Address.LowPart,
+                    Done + Index,
+                    op[Index].status);
+
+            if (NT_SUCCESS(status))
+                GNTST_TO_STATUS(op[Index].status, status);
+        }
+
+        if (!NT_SUCCESS(status))
+            goto fail2;
+    }
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+    // Undo whatever part of the failed batch did get mapped
+    for (Index = 0; Index < Count; Index++) {
+        if (op[Index].status != GNTST_okay)
+            continue;
+
+        PageAddress.QuadPart = Address.QuadPart +
+                               ((ULONG64)(Done + Index) << PAGE_SHIFT);
+
+        (VOID) GrantTableUnmapForeignPage(op[Index].handle, PageAddress);
+    }
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    if (Done != 0)
+        (VOID) GrantTableUnmapForeignPages(Done, Handle, Address);
+
+    return status;
+}
+
 __checkReturn
 XEN_API
 NTSTATUS
@@ -33,6 +33,7 @@
 #define XEN_API __declspec(dllexport)
 
 #include <ntddk.h>
+#include <procgrp.h>
 #include <xen.h>
 
 #include "hypercall.h"
@@ -42,6 +43,33 @@
 
 #define MAXIMUM_HYPERCALL_PAGE_COUNT 2
 
+#define HYPERCALL_PROFILE_TAG   'FORP'
+
+#define HYPERCALL_PROFILE_ORDINALS      64
+#define HYPERCALL_PROFILE_MODULES       16
+#define HYPERCALL_PROFILE_FRAMES        8
+#define HYPERCALL_PROFILE_NAME_LENGTH   32
+
+typedef struct _HYPERCALL_PROFILE_CPU {
+    LONG64  Count[HYPERCALL_PROFILE_ORDINALS];
+    LONG64  Cycles[HYPERCALL_PROFILE_ORDINALS];
+} HYPERCALL_PROFILE_CPU, *PHYPERCALL_PROFILE_CPU;
+
+typedef struct _HYPERCALL_PROFILE_MODULE {
+    PVOID   Base;
+    CHAR    Name[HYPERCALL_PROFILE_NAME_LENGTH];
+    LONG64  Count;
+    LONG64  Cycles;
+} HYPERCALL_PROFILE_MODULE, *PHYPERCALL_PROFILE_MODULE;
+
+typedef struct _HYPERCALL_PROFILE {
+    BOOLEAN                     Callers;
+    ULONG_PTR                   Base;
+    HYPERCALL_PROFILE_MODULE    Module[HYPERCALL_PROFILE_MODULES];
+    ULONG                       ProcessorCount;
+    HYPERCALL_PROFILE_CPU       Cpu[1];
+} HYPERCALL_PROFILE, *PHYPERCALL_PROFILE;
+
 #pragma code_seg("hypercall")
 __declspec(allocate("hypercall"))
 static UCHAR        __Section[(MAXIMUM_HYPERCALL_PAGE_COUNT + 1) * PAGE_SIZE];
@@ -57,6 +85,8 @@ typedef HYPERCALL_GATE  *PHYPERCALL_GATE;
 PHYPERCALL_GATE     Hypercall;
 ULONG               HypercallMsr;
 
+static PHYPERCALL_PROFILE   HypercallProfile;
+
 XEN_API
 VOID
 HypercallPopulate(
@@ -140,6 +170,309 @@ fail1:
 extern uintptr_t __stdcall hypercall2(uint32_t ord, uintptr_t arg1, uintptr_t arg2);
 extern uintptr_t __stdcall hypercall3(uint32_t ord, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
 
+static FORCEINLINE PVOID
+__HypercallProfileAllocate(
+    IN  ULONG   Length
+    )
+{
+    return __AllocatePoolWithTag(NonPagedPool, Length, HYPERCALL_PROFILE_TAG);
+}
+
+static FORCEINLINE VOID
+__HypercallProfileFree(
+    IN  PVOID   Buffer
+    )
+{
+    __FreePoolWithTag(Buffer, HYPERCALL_PROFILE_TAG);
+}
+
+static FORCEINLINE const CHAR *
+__HypercallOrdinalName(
+    IN  ULONG   Ordinal
+    )
+{
+#define HYPERCALL_NAME(_Name)           \
+        case __HYPERVISOR_ ## _Name:    \
+            return #_Name;
+
+    switch (Ordinal) {
+    HYPERCALL_NAME(set_trap_table);
+    HYPERCALL_NAME(mmu_update);
+    HYPERCALL_NAME(set_gdt);
+    HYPERCALL_NAME(stack_switch);
+    HYPERCALL_NAME(set_callbacks);
+    HYPERCALL_NAME(fpu_taskswitch);
+    HYPERCALL_NAME(platform_op);
+    HYPERCALL_NAME(set_debugreg);
+    HYPERCALL_NAME(get_debugreg);
+    HYPERCALL_NAME(update_descriptor);
+    HYPERCALL_NAME(memory_op);
+    HYPERCALL_NAME(multicall);
+    HYPERCALL_NAME(update_va_mapping);
+    HYPERCALL_NAME(set_timer_op);
+    HYPERCALL_NAME(xen_version);
+    HYPERCALL_NAME(console_io);
+    HYPERCALL_NAME(grant_table_op);
+    HYPERCALL_NAME(vm_assist);
+    HYPERCALL_NAME(update_va_mapping_otherdomain);
+    HYPERCALL_NAME(iret);
+    HYPERCALL_NAME(vcpu_op);
+    HYPERCALL_NAME(set_segment_base);
+    HYPERCALL_NAME(mmuext_op);
+    HYPERCALL_NAME(xsm_op);
+    HYPERCALL_NAME(nmi_op);
+    HYPERCALL_NAME(sched_op);
+    HYPERCALL_NAME(callback_op);
+    HYPERCALL_NAME(xenoprof_op);
+    HYPERCALL_NAME(event_channel_op);
+    HYPERCALL_NAME(physdev_op);
+    HYPERCALL_NAME(hvm_op);
+    HYPERCALL_NAME(sysctl);
+    HYPERCALL_NAME(domctl);
+    HYPERCALL_NAME(kexec_op);
+    HYPERCALL_NAME(tmem_op);
+    default:
+        break;
+    }
+
+    return "UNKNOWN";
+#undef  HYPERCALL_NAME
+}
+
+static VOID
+HypercallProfileAttribute(
+    IN  PHYPERCALL_PROFILE  Profile,
+    IN  ULONG64             Cycles
+    )
+{
+    PVOID                   Frame[HYPERCALL_PROFILE_FRAMES];
+    ULONG                   Count;
+    ULONG                   Index;
+    PCHAR                   Name;
+    ULONG_PTR               Offset;
+    ULONG_PTR               Base;
+
+    // Unwinding may touch pageable data so only attribute calls made
+    // at or below DISPATCH_LEVEL
+    if (KeGetCurrentIrql() > DISPATCH_LEVEL)
+        return;
+
+    Count = RtlCaptureStackBackTrace(1, HYPERCALL_PROFILE_FRAMES, Frame, NULL);
+
+    // The caller is the first frame that does not belong to XEN.SYS
+    Name = NULL;
+    Base = 0;
+    for (Index = 0; Index < Count; Index++) {
+        ModuleLookup((ULONG_PTR)Frame[Index], &Name, &Offset);
+        if (Name == NULL)
+            continue;
+
+        Base = (ULONG_PTR)Frame[Index] - Offset;
+        if (Base != Profile->Base)
+            break;
+    }
+
+    if (Index == Count)
+        return;
+
+    for (Index = 0; Index < HYPERCALL_PROFILE_MODULES; Index++) {
+        PHYPERCALL_PROFILE_MODULE   Module = &Profile->Module[Index];
+
+        if (Module->Base == NULL) {
+            PCHAR   Cursor;
+            ULONG   Length;
+
+            if (InterlockedCompareExchangePointer(&Module->Base,
+                                                  (PVOID)Base,
+                                                  NULL) != NULL)
+                goto check;
+
+            // Strip any path from the module name
+            for (Cursor = Name; *Cursor != '\0'; Cursor++)
+                if (*Cursor == '\\')
+                    Name = Cursor + 1;
+
+            for (Length = 0;
+                 Length < HYPERCALL_PROFILE_NAME_LENGTH - 1 && Name[Length] != '\0';
+                 Length++)
+                Module->Name[Length] = Name[Length];
+        }
+
+check:
+        if ((ULONG_PTR)Module->Base != Base)
+            continue;
+
+        (VOID) InterlockedIncrement64(&Module->Count);
+        (VOID) InterlockedAdd64(&Module->Cycles, (LONG64)Cycles);
+        break;
+    }
+}
+
+static VOID
+HypercallProfileRecord(
+    IN  PHYPERCALL_PROFILE  Profile,
+    IN  ULONG               Ordinal,
+    IN  ULONG64             Cycles
+    )
+{
+    PHYPERCALL_PROFILE_CPU  Cpu;
+    ULONG                   Index;
+
+    if (Ordinal >= HYPERCALL_PROFILE_ORDINALS)
+        return;
+
+    // The counters are updated atomically so it does not matter if we
+    // are rescheduled onto another CPU before they are bumped
+    Index = KeGetCurrentProcessorNumberEx(NULL);
+    if (Index >= Profile->ProcessorCount)
+        return;
+
+    Cpu = &Profile->Cpu[Index];
+
+    (VOID) InterlockedIncrement64(&Cpu->Count[Ordinal]);
+    (VOID) InterlockedAdd64(&Cpu->Cycles[Ordinal], (LONG64)Cycles);
+
+    if (Profile->Callers)
+        HypercallProfileAttribute(Profile, Cycles);
+}
+
+VOID
+HypercallProfileEnable(
+    IN  BOOLEAN         Callers
+    )
+{
+    PHYPERCALL_PROFILE  Profile;
+    ULONG               ProcessorCount;
+    PCHAR               Name;
+    ULONG_PTR           Offset;
+
+    ASSERT3P(HypercallProfile, ==, NULL);
+
+    ProcessorCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    Profile = __HypercallProfileAllocate(FIELD_OFFSET(HYPERCALL_PROFILE, Cpu) +
+                                         (sizeof (HYPERCALL_PROFILE_CPU) *
+                                          ProcessorCount));
+    if (Profile == NULL) {
+        Warning("failed to allocate profile\n");
+        return;
+    }
+
+    Profile->Callers = Callers;
+    Profile->ProcessorCount = ProcessorCount;
+
+    ModuleLookup((ULONG_PTR)HypercallProfileEnable, &Name, &Offset);
+    Profile->Base = (Name != NULL) ?
+                    (ULONG_PTR)HypercallProfileEnable - Offset :
+                    0;
+
+    LogPrintf(LOG_LEVEL_INFO,
+              "XEN: HYPERCALL PROFILING ENABLED (%u CPUs%s)\n",
+              ProcessorCount,
+              (Callers) ? ", CALLERS" : "");
+
+    KeMemoryBarrier();
+
+    HypercallProfile = Profile;
+}
+
+VOID
+HypercallProfileDisable(
+    VOID
+    )
+{
+    PHYPERCALL_PROFILE  Profile;
+
+    Profile = HypercallProfile;
+    if (Profile == NULL)
+        return;
+
+    HypercallProfile = NULL;
+    KeMemoryBarrier();
+
+    __HypercallProfileFree(Profile);
+}
+
+__checkReturn
+XEN_API
+NTSTATUS
+HypercallQueryProfile(
+    IN  ULONG       Ordinal,
+    OUT const CHAR  **Name OPTIONAL,
+    OUT PULONG64    Count,
+    OUT PULONG64    Cycles
+    )
+{
+    PHYPERCALL_PROFILE  Profile = HypercallProfile;
+    ULONG               Index;
+    NTSTATUS            status;
+
+    status = STATUS_NOT_SUPPORTED;
+    if (Profile == NULL)
+        goto fail1;
+
+    status = STATUS_NO_MORE_ENTRIES;
+    if (Ordinal >= HYPERCALL_PROFILE_ORDINALS)
+        goto fail2;
+
+    if (Name != NULL)
+        *Name = __HypercallOrdinalName(Ordinal);
+
+    *Count = 0;
+    *Cycles = 0;
+
+    for (Index = 0; Index < Profile->ProcessorCount; Index++) {
+        PHYPERCALL_PROFILE_CPU  Cpu = &Profile->Cpu[Index];
+
+        *Count += Cpu->Count[Ordinal];
+        *Cycles += Cpu->Cycles[Ordinal];
+    }
+
+    return STATUS_SUCCESS;
+
+fail2:
+fail1:
+    return status;
+}
+
+__checkReturn
+XEN_API
+NTSTATUS
+HypercallQueryModuleProfile(
+    IN  ULONG       Index,
+    OUT const CHAR  **Name,
+    OUT PULONG64    Count,
+    OUT PULONG64    Cycles
+    )
+{
+    PHYPERCALL_PROFILE          Profile = HypercallProfile;
+    PHYPERCALL_PROFILE_MODULE   Module;
+    NTSTATUS                    status;
+
+    status = STATUS_NOT_SUPPORTED;
+    if (Profile == NULL)
+        goto fail1;
+
+    status = STATUS_NO_MORE_ENTRIES;
+    if (Index >= HYPERCALL_PROFILE_MODULES)
+        goto fail2;
+
+    Module = &Profile->Module[Index];
+    if (Module->Base == NULL)
+        goto fail3;
+
+    *Name = Module->Name;
+    *Count = Module->Count;
+    *Cycles = Module->Cycles;
+
+    return STATUS_SUCCESS;
+
+fail3:
+fail2:
+fail1:
+    return status;
+}
+
 ULONG_PTR
 __Hypercall(
     ULONG       Ordinal,
@@ -147,8 +480,13 @@ __Hypercall(
     ...
     )
 {
-    va_list     Arguments;
-    ULONG_PTR   Value;
+    PHYPERCALL_PROFILE  Profile;
+    ULONG64             Start;
+    va_list             Arguments;
+    ULONG_PTR           Value;
+
+    Profile = HypercallProfile;
+    Start = (Profile != NULL) ? __rdtsc() : 0;
 
     va_start(Arguments, Count);
     switch (Count) {
@@ -175,9 +513,170 @@ __Hypercall(
     }
     va_end(Arguments);
 
+    if (Profile != NULL)
+        HypercallProfileRecord(Profile, Ordinal, __rdtsc() - Start);
+
     return Value;
 }
 
+static ULONG_PTR
+__HypercallArguments(
+    IN  ULONG       Ordinal,
+    IN  ULONG       Count,
+    IN  ULONG_PTR   Argument[]
+    )
+{
+    PHYPERCALL_PROFILE  Profile;
+    ULONG64             Start;
+    ULONG_PTR           Value;
+
+    Profile = HypercallProfile;
+    Start = (Profile != NULL) ? __rdtsc() : 0;
+
+    switch (Count) {
+    case 2:
+        Value = hypercall2(Ordinal, Argument[0], Argument[1]);
+        break;
+
+    case 3:
+        Value = hypercall3(Ordinal, Argument[0], Argument[1], Argument[2]);
+        break;
+
+    default:
+        ASSERT(FALSE);
+        Value = 0;
+    }
+
+    if (Profile != NULL)
+        HypercallProfileRecord(Profile, Ordinal, __rdtsc() - Start);
+
+    return Value;
+}
+
+static LONG     MulticallUnsupported;
+
+XEN_API
+VOID
+MulticallInitialize(
+    OUT PXEN_MULTICALL  Multicall
+    )
+{
+    Multicall->Count = 0;
+}
+
+__checkReturn
+XEN_API
+NTSTATUS
+MulticallAdd(
+    IN  PXEN_MULTICALL  Multicall,
+    IN  ULONG           Ordinal,
+    IN  ULONG           Count,
+    ...
+    )
+{
+    multicall_entry_t   *Entry;
+    va_list             Arguments;
+    ULONG               Index;
+    NTSTATUS            status;
+
+    status = STATUS_BUFFER_OVERFLOW;
+    if (Multicall->Count == XEN_MULTICALL_MAXIMUM_ENTRIES)
+        goto fail1;
+
+    // Only 2 and 3 argument hypercalls can be issued singly if the
+    // hypervisor turns out not to support multicall
+    status = STATUS_INVALID_PARAMETER;
+    if (Count != 2 && Count != 3)
+        goto fail2;
+
+    Multicall->ArgumentCount[Multicall->Count] = Count;
+
+    Entry = &Multicall->Entry[Multicall->Count++];
+    RtlZeroMemory(Entry, sizeof (multicall_entry_t));
+
+    Entry->op = Ordinal;
+
+    va_start(Arguments, Count);
+    for (Index = 0; Index < Count; Index++)
+        Entry->args[Index] = va_arg(Arguments, ULONG_PTR);
+    va_end(Arguments);
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+__checkReturn
+XEN_API
+NTSTATUS
+MulticallFlush(
+    IN  PXEN_MULTICALL  Multicall
+    )
+{
+    ULONG               Index;
+    LONG_PTR            rc;
+    NTSTATUS            status;
+
+    if (Multicall->Count == 0)
+        goto done;
+
+    if (Multicall->Count == 1 || MulticallUnsupported != 0)
+        goto singly;
+
+    rc = HYPERCALL(LONG_PTR, multicall, 2, Multicall->Entry, Multicall->Count);
+
+    if (rc == -ENOSYS) {
+        // Older hypervisors do not support multicall from HVM guests
+        if (InterlockedExchange(&MulticallUnsupported, 1) == 0)
+            LogPrintf(LOG_LEVEL_INFO,
+                      "XEN: MULTICALL NOT SUPPORTED\n");
+
+        goto singly;
+    }
+
+    if (rc < 0) {
+        ERRNO_TO_STATUS(-rc, status);
+        goto fail1;
+    }
+
+done:
+    return STATUS_SUCCESS;
+
+singly:
+    for (Index = 0; Index < Multicall->Count; Index++) {
+        multicall_entry_t   *Entry = &Multicall->Entry[Index];
+
+        Entry->result = __HypercallArguments((ULONG)Entry->op,
+                                             Multicall->ArgumentCount[Index],
+                                             Entry->args);
+    }
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+XEN_API
+LONG_PTR
+MulticallResult(
+    IN  PXEN_MULTICALL  Multicall,
+    IN  ULONG           Index
+    )
+{
+    ASSERT3U(Index, <, Multicall->Count);
+
+    return (LONG_PTR)Multicall->Entry[Index].result;
+}
+
 VOID
 HypercallTeardown(
     VOID
@@ -191,4 +690,6 @@ HypercallTeardown(
         HypercallPage[Index].QuadPart = 0;
 
     HypercallPageCount = 0;
+
+    MulticallUnsupported = 0;
 }
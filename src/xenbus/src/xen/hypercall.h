@@ -54,6 +54,16 @@ __Hypercall(
 #define HYPERCALL(_Type, _Name, _Count, ...) \
         (_Type)__Hypercall(__HYPERVISOR_##_Name, (_Count), __VA_ARGS__)
 
+extern VOID
+HypercallProfileEnable(
+    IN  BOOLEAN Callers
+    );
+
+extern VOID
+HypercallProfileDisable(
+    VOID
+    );
+
 extern VOID
 HypercallTeardown(
     VOID
@@ -35,7 +35,6 @@
 #include <ntstrsafe.h>
 #include <aux_klib.h>
 
-#include "high.h"
 #include "module.h"
 #include "dbg_print.h"
 #include "assert.h"
@@ -44,17 +43,23 @@
 #define MODULE_TAG   'UDOM'
 
 typedef struct _MODULE {
-    LIST_ENTRY  ListEntry;
     ULONG_PTR   Start;
     ULONG_PTR   End;
     CHAR        Name[AUX_KLIB_MODULE_PATH_LEN];
 } MODULE, *PMODULE;
 
+// Lookups never modify a table: a new one, sorted by Start, is built
+// and published for each load and the old one is freed once no
+// processor can still be searching it.
+typedef struct _MODULE_TABLE {
+    ULONG       Count;
+    PMODULE     Module[ANYSIZE_ARRAY];
+} MODULE_TABLE, *PMODULE_TABLE;
+
 typedef struct _MODULE_CONTEXT {
-    LONG        References;
-    LIST_ENTRY  List;
-    PLIST_ENTRY Cursor;
-    HIGH_LOCK   Lock;
+    LONG            References;
+    FAST_MUTEX      Mutex;
+    PMODULE_TABLE   Table;
 } MODULE_CONTEXT, *PMODULE_CONTEXT;
 
 static MODULE_CONTEXT   ModuleContext;
@@ -75,187 +80,194 @@ __ModuleFree(
     __FreePoolWithTag(Buffer, MODULE_TAG);
 }
 
-static VOID
-ModuleSearchForwards(
-    IN  PMODULE_CONTEXT Context,
-    IN  ULONG_PTR       Address
+static FORCEINLINE BOOLEAN
+__ModuleOverlap(
+    IN  PMODULE Module,
+    IN  PMODULE New
     )
 {
-    while (Context->Cursor != &Context->List) {
-        PMODULE Module;
-
-        Module = CONTAINING_RECORD(Context->Cursor, MODULE, ListEntry);
-
-        if (Address <= Module->End)
-            break;
-
-        Context->Cursor = Context->Cursor->Flink;
-    }
+    return (New->Start <= Module->End && New->End >= Module->Start) ?
+           TRUE :
+           FALSE;
 }
 
-static VOID
-ModuleSearchBackwards(
-    IN  PMODULE_CONTEXT Context,
-    IN  ULONG_PTR       Address
+static PMODULE
+ModuleCreate(
+    IN  PCHAR       Name,
+    IN  ULONG_PTR   Start,
+    IN  ULONG_PTR   Size
     )
 {
-    while (Context->Cursor != &Context->List) {
-        PMODULE Module;
+    PMODULE         Module;
+    ULONG           Index;
 
-        Module = CONTAINING_RECORD(Context->Cursor, MODULE, ListEntry);
+    Module = __ModuleAllocate(sizeof (MODULE));
+    if (Module == NULL)
+        return NULL;
 
-        if (Address >= Module->Start)
+    for (Index = 0; Index < AUX_KLIB_MODULE_PATH_LEN - 1; Index++) {
+        if (Name[Index] == '\0')
             break;
 
-        Context->Cursor = Context->Cursor->Blink;
+        Module->Name[Index] = __tolower(Name[Index]);
     }
+
+    Module->Start = Start;
+    Module->End = Start + Size - 1;
+
+    return Module;
 }
 
-static NTSTATUS
-ModuleAdd(
-    IN  PMODULE_CONTEXT Context,
-    IN  PCHAR           Name,
-    IN  ULONG_PTR       Start,
-    IN  ULONG_PTR       Size
+// Build a copy of Table with New inserted in order. Any module that New
+// overlaps must have been unloaded, so it is left out of the copy (but
+// not freed; see ModuleTableRetire()).
+static PMODULE_TABLE
+ModuleTableInsert(
+    IN  PMODULE_TABLE   Table OPTIONAL,
+    IN  PMODULE         New
     )
 {
-#define INSERT_AFTER(_Cursor, _New)             \
-        do {                                    \
-            (_New)->Flink = (_Cursor)->Flink;   \
-            (_Cursor)->Flink->Blink = (_New);   \
-                                                \
-            (_Cursor)->Flink = (_New);          \
-            (_New)->Blink = (_Cursor);          \
-        } while (FALSE)
-
-#define INSERT_BEFORE(_Cursor, _New)            \
-        do {                                    \
-            (_New)->Blink = (_Cursor)->Blink;   \
-            (_Cursor)->Blink->Flink = (_New);   \
-                                                \
-            (_Cursor)->Blink = (_New);          \
-            (_New)->Flink = (_Cursor);          \
-        } while (FALSE)
-
-    PMODULE             New;
+    PMODULE_TABLE       NewTable;
+    ULONG               Count;
     ULONG               Index;
-    PMODULE             Module;
-    KIRQL               Irql;
-    LIST_ENTRY          List;
-    BOOLEAN             After;
-    NTSTATUS            status;
+    BOOLEAN             Inserted;
 
-    New = __ModuleAllocate(sizeof (MODULE));
+    Count = (Table != NULL) ? Table->Count : 0;
 
-    status = STATUS_NO_MEMORY;
-    if (New == NULL)
-        goto fail1;
+    NewTable = __ModuleAllocate(FIELD_OFFSET(MODULE_TABLE, Module) +
+                                (sizeof (PMODULE) * (Count + 1)));
+    if (NewTable == NULL)
+        return NULL;
 
-    for (Index = 0; Index < AUX_KLIB_MODULE_PATH_LEN; Index++) {
-        if (Name[Index] == '\0')
-            break;
+    Inserted = FALSE;
+
+    for (Index = 0; Index < Count; Index++) {
+        PMODULE Module = Table->Module[Index];
+
+        if (__ModuleOverlap(Module, New))
+            continue;
+
+        if (!Inserted && New->End < Module->Start) {
+            NewTable->Module[NewTable->Count++] = New;
+            Inserted = TRUE;
+        }
 
-        New->Name[Index] = __tolower(Name[Index]);
+        NewTable->Module[NewTable->Count++] = Module;
     }
 
-    New->Start = Start;
-    New->End = Start + Size - 1;
+    if (!Inserted)
+        NewTable->Module[NewTable->Count++] = New;
 
-    InitializeListHead(&List);
+    return NewTable;
+}
 
-    AcquireHighLock(&Context->Lock, &Irql);
+// Free a table that has been replaced by one containing New, along with
+// the modules that New displaced.
+static VOID
+ModuleTableRetire(
+    IN  PMODULE_TABLE   Table,
+    IN  PMODULE         New
+    )
+{
+    ULONG               Index;
 
-again:
-    After = TRUE;
+    for (Index = 0; Index < Table->Count; Index++) {
+        PMODULE Module = Table->Module[Index];
 
-    if (Context->Cursor == &Context->List) {
-        ASSERT(IsListEmpty(&Context->List));
-        goto done;
+        if (__ModuleOverlap(Module, New))
+            __ModuleFree(Module);
     }
 
-    Module = CONTAINING_RECORD(Context->Cursor, MODULE, ListEntry);
-
-    if (New->Start > Module->End) {
-        ModuleSearchForwards(Context, New->Start);
+    __ModuleFree(Table);
+}
 
-        After = FALSE;
+static VOID
+ModuleTableDestroy(
+    IN  PMODULE_TABLE   Table
+    )
+{
+    ULONG               Index;
 
-        if (Context->Cursor == &Context->List)    // End of list
-            goto done;
+    for (Index = 0; Index < Table->Count; Index++)
+        __ModuleFree(Table->Module[Index]);
 
-        Module = CONTAINING_RECORD(Context->Cursor, MODULE, ListEntry);
+    __ModuleFree(Table);
+}
 
-        if (New->End >= Module->Start) {    // Overlap
-            PLIST_ENTRY Cursor = Context->Cursor->Blink;
+static ULONG_PTR
+ModuleSynchronize(
+    IN  ULONG_PTR   Argument
+    )
+{
+    UNREFERENCED_PARAMETER(Argument);
 
-            RemoveEntryList(Context->Cursor);
-            InsertTailList(&List, &Module->ListEntry);
+    return 0;
+}
 
-            Context->Cursor = Cursor;
-            goto again;
-        }
-    } else if (New->End < Module->Start) {
-        ModuleSearchBackwards(Context, New->End);
+// ModuleLookup() searches the table at HIGH_LEVEL, so once every
+// processor has taken an IPI none of them can still hold a reference
+// to a table that is no longer published.
+static VOID
+ModuleWaitForLookups(
+    VOID
+    )
+{
+    (VOID) KeIpiGenericCall(ModuleSynchronize, 0);
+}
 
-        After = TRUE;
+static NTSTATUS
+ModuleAdd(
+    IN  PMODULE_CONTEXT Context,
+    IN  PCHAR           Name,
+    IN  ULONG_PTR       Start,
+    IN  ULONG_PTR       Size
+    )
+{
+    PMODULE             New;
+    PMODULE_TABLE       Table;
+    PMODULE_TABLE       Old;
+    NTSTATUS            status;
 
-        if (Context->Cursor == &Context->List)    // Start of list
-            goto done;
+    New = ModuleCreate(Name, Start, Size);
 
-        Module = CONTAINING_RECORD(Context->Cursor, MODULE, ListEntry);
+    status = STATUS_NO_MEMORY;
+    if (New == NULL)
+        goto fail1;
 
-        if (New->Start <= Module->End) {    // Overlap
-            PLIST_ENTRY Cursor = Context->Cursor->Flink;
+    ExAcquireFastMutex(&Context->Mutex);
 
-            RemoveEntryList(Context->Cursor);
-            InsertTailList(&List, &Module->ListEntry);
+    Old = Context->Table;
 
-            Context->Cursor = Cursor;
-            goto again;
-        }
-    } else {
-        PLIST_ENTRY Cursor;
-        
-        Cursor = (Context->Cursor->Flink != &Context->List) ?
-                 Context->Cursor->Flink :
-                 Context->Cursor->Blink;
+    Table = ModuleTableInsert(Old, New);
 
-        RemoveEntryList(Context->Cursor);
-        InsertTailList(&List, &Module->ListEntry);
+    status = STATUS_NO_MEMORY;
+    if (Table == NULL)
+        goto fail2;
 
-        Context->Cursor = Cursor;
-        goto again;
-    }
+    (VOID) InterlockedExchangePointer(&Context->Table, Table);
 
-done:
-    if (After)
-        INSERT_AFTER(Context->Cursor, &New->ListEntry);
-    else
-        INSERT_BEFORE(Context->Cursor, &New->ListEntry);
+    // Kernel images are loaded rarely and lookups never take the mutex,
+    // so waiting here only holds up another image load
+    ModuleWaitForLookups();
 
-    Context->Cursor = &New->ListEntry;
+    if (Old != NULL)
+        ModuleTableRetire(Old, New);
 
-    ReleaseHighLock(&Context->Lock, Irql);
+    ExReleaseFastMutex(&Context->Mutex);
 
-    while (!IsListEmpty(&List)) {
-        PLIST_ENTRY     ListEntry;
+    return STATUS_SUCCESS;
 
-        ListEntry = RemoveHeadList(&List);
-        ASSERT(ListEntry != &List);
+fail2:
+    Error("fail2\n");
 
-        Module = CONTAINING_RECORD(ListEntry, MODULE, ListEntry);
-        __ModuleFree(Module);
-    }
+    ExReleaseFastMutex(&Context->Mutex);
 
-    return STATUS_SUCCESS;
+    __ModuleFree(New);
 
 fail1:
     Error("fail1 (%08x)\n", status);
 
     return status;
-
-#undef  INSERT_AFTER
-#undef  INSERT_BEFORE
 }
 
 __drv_requiresIRQL(PASSIVE_LEVEL)
@@ -330,30 +342,42 @@ ModuleLookup(
     )
 {
     PMODULE_CONTEXT Context = &ModuleContext;
-    PLIST_ENTRY     ListEntry;
+    PMODULE_TABLE   Table;
+    ULONG           Low;
+    ULONG           High;
     KIRQL           Irql;
 
     *Name = NULL;
     *Offset = 0;
 
-    AcquireHighLock(&Context->Lock, &Irql);
+    // No lock is taken, but the table must not be freed under us (see
+    // ModuleWaitForLookups())
+    KeRaiseIrql(HIGH_LEVEL, &Irql);
+
+    Table = *(volatile PMODULE_TABLE *)&Context->Table;
+    if (Table == NULL)
+        goto done;
 
-    for (ListEntry = Context->List.Flink;
-         ListEntry != &Context->List;
-         ListEntry = ListEntry->Flink) {
-        PMODULE Module;
+    Low = 0;
+    High = Table->Count;
 
-        Module = CONTAINING_RECORD(ListEntry, MODULE, ListEntry);
+    while (Low < High) {
+        ULONG   Index = Low + ((High - Low) / 2);
+        PMODULE Module = Table->Module[Index];
 
-        if (Address >= Module->Start &&
-            Address <= Module->End) {
+        if (Address < Module->Start) {
+            High = Index;
+        } else if (Address > Module->End) {
+            Low = Index + 1;
+        } else {
             *Name = Module->Name;
             *Offset = Address - Module->Start;
             break;
         }
     }
 
-    ReleaseHighLock(&Context->Lock, Irql);
+done:
+    KeLowerIrql(Irql);
 }
 
 VOID
@@ -362,25 +386,18 @@ ModuleTeardown(
     )
 {
     PMODULE_CONTEXT Context = &ModuleContext;
+    PMODULE_TABLE   Table;
 
     (VOID) PsRemoveLoadImageNotifyRoutine(ModuleLoad);
 
-    Context->Cursor = NULL;
-
-    while (!IsListEmpty(&Context->List)) {
-        PLIST_ENTRY ListEntry;
-        PMODULE     Module;
-
-        ListEntry = RemoveHeadList(&Context->List);
-        ASSERT(ListEntry != &Context->List);
+    Table = InterlockedExchangePointer(&Context->Table, NULL);
 
-        Module = CONTAINING_RECORD(ListEntry, MODULE, ListEntry);
-        __ModuleFree(Module);
-    }
+    ModuleWaitForLookups();
 
-    RtlZeroMemory(&Context->List, sizeof (LIST_ENTRY));
+    if (Table != NULL)
+        ModuleTableDestroy(Table);
 
-    RtlZeroMemory(&Context->Lock, sizeof (HIGH_LOCK));
+    RtlZeroMemory(&Context->Mutex, sizeof (FAST_MUTEX));
 
     (VOID) InterlockedDecrement(&Context->References);
 
@@ -396,6 +413,7 @@ ModuleInitialize(
     ULONG                       BufferSize;
     ULONG                       Count;
     PAUX_MODULE_EXTENDED_INFO   QueryInfo;
+    PMODULE_TABLE               Table;
     ULONG                       Index;
     NTSTATUS                    status;
 
@@ -405,7 +423,7 @@ ModuleInitialize(
     if (References != 1)
         goto fail1;
 
-    InitializeHighLock(&Context->Lock);
+    ExInitializeFastMutex(&Context->Mutex);
 
     (VOID) AuxKlibInitialize();
 
@@ -438,23 +456,40 @@ again:
         goto again;
     }
 
-    InitializeListHead(&Context->List);
-    Context->Cursor = &Context->List;
+    // Nothing can look the table up until it is published, so it can be
+    // built without waiting for lookups after each insertion
+    Table = NULL;
 
     for (Index = 0; Index < Count; Index++) {
-        PCHAR   Name;
+        PCHAR           Name;
+        PMODULE         Module;
+        PMODULE_TABLE   NewTable;
 
         Name = strrchr((const CHAR *)QueryInfo[Index].FullPathName, '\\');
         Name = (Name == NULL) ? (PCHAR)QueryInfo[Index].FullPathName : (Name + 1);
 
-        status = ModuleAdd(Context,
-                           Name,
-                           (ULONG_PTR)QueryInfo[Index].BasicInfo.ImageBase,
-                           (ULONG_PTR)QueryInfo[Index].ImageSize);
-        if (!NT_SUCCESS(status))
+        Module = ModuleCreate(Name,
+                              (ULONG_PTR)QueryInfo[Index].BasicInfo.ImageBase,
+                              (ULONG_PTR)QueryInfo[Index].ImageSize);
+
+        status = STATUS_NO_MEMORY;
+        if (Module == NULL)
             goto fail6;
+
+        NewTable = ModuleTableInsert(Table, Module);
+        if (NewTable == NULL) {
+            __ModuleFree(Module);
+            goto fail6;
+        }
+
+        if (Table != NULL)
+            ModuleTableRetire(Table, Module);
+
+        Table = NewTable;
     }
 
+    (VOID) InterlockedExchangePointer(&Context->Table, Table);
+
     status = PsSetLoadImageNotifyRoutine(ModuleLoad);
     if (!NT_SUCCESS(status))
         goto fail7;
@@ -466,21 +501,15 @@ again:
 fail7:
     Error("fail7\n");
 
-fail6:
-    Error("fail6\n");
-
-    while (!IsListEmpty(&Context->List)) {
-        PLIST_ENTRY ListEntry;
-        PMODULE     Module;
+    Table = InterlockedExchangePointer(&Context->Table, NULL);
 
-        ListEntry = RemoveHeadList(&Context->List);
-        ASSERT(ListEntry != &Context->List);
+    ModuleWaitForLookups();
 
-        Module = CONTAINING_RECORD(ListEntry, MODULE, ListEntry);
-        __ModuleFree(Module);
-    }
+fail6:
+    Error("fail6\n");
 
-    RtlZeroMemory(&Context->List, sizeof (LIST_ENTRY));
+    if (Table != NULL)
+        ModuleTableDestroy(Table);
 
 fail5:
     Error("fail5\n");
@@ -496,6 +525,8 @@ fail3:
 fail2:
     Error("fail2\n");
 
+    RtlZeroMemory(&Context->Mutex, sizeof (FAST_MUTEX));
+
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -36,6 +36,7 @@
 #include "mutex.h"
 #include "balloon.h"
 #include "range_set.h"
+#include "thread.h"
 #include "dbg_print.h"
 #include "assert.h"
 #include "util.h"
@@ -43,13 +44,36 @@
 #define MDL_SIZE_MAX        ((1 << (RTL_FIELD_SIZE(MDL, Size) * 8)) - 1)
 #define MAX_PAGES_PER_MDL   ((MDL_SIZE_MAX - sizeof(MDL)) / sizeof(PFN_NUMBER))
 
-#define XENBUS_BALLOON_PFN_ARRAY_SIZE  (MAX_PAGES_PER_MDL)
+#define XENBUS_BALLOON_PFN_ARRAY_SIZE  (MAX_PAGES_PER_MDL * 4)
+
+// Whenever we find (or can reclaim) a naturally aligned 2MB run of
+// pages it is handed to Xen as a single extent. This saves hypercall
+// work and stops the host from having to shatter its superpages.
+#define XENBUS_BALLOON_EXTENT_ORDER         9
+#define XENBUS_BALLOON_EXTENT_PAGES         (1ul << XENBUS_BALLOON_EXTENT_ORDER)
+#define XENBUS_BALLOON_EXTENT_ARRAY_SIZE    (XENBUS_BALLOON_PFN_ARRAY_SIZE / XENBUS_BALLOON_EXTENT_PAGES)
+
+// Adjustments of 1GB or more are split across several threads
+#define XENBUS_BALLOON_MAX_WORKERS          4
+#define XENBUS_BALLOON_PARALLEL_THRESHOLD   (1ull << (30 - PAGE_SHIFT))
 
 typedef struct _XENBUS_BALLOON_FIST {
     BOOLEAN Inflation;
     BOOLEAN Deflation;
 } XENBUS_BALLOON_FIST, *PXENBUS_BALLOON_FIST;
 
+typedef struct _XENBUS_BALLOON_WORKER {
+    PXENBUS_BALLOON_CONTEXT Context;
+    PXENBUS_THREAD          Thread;
+    BOOLEAN                 Inflate;
+    ULONGLONG               Requested;
+    ULONGLONG               Count;
+    NTSTATUS                Status;
+    PFN_NUMBER              ExtentArray[XENBUS_BALLOON_EXTENT_ARRAY_SIZE];
+    MDL                     Mdl;
+    PFN_NUMBER              PfnArray[XENBUS_BALLOON_PFN_ARRAY_SIZE];
+} XENBUS_BALLOON_WORKER, *PXENBUS_BALLOON_WORKER;
+
 struct _XENBUS_BALLOON_CONTEXT {
     PXENBUS_FDO                 Fdo;
     KSPIN_LOCK                  Lock;
@@ -57,12 +81,12 @@ struct _XENBUS_BALLOON_CONTEXT {
     PKEVENT                     LowMemoryEvent;
     HANDLE                      LowMemoryHandle;
     ULONGLONG                   Size;
-    MDL                         Mdl;
-    PFN_NUMBER                  PfnArray[XENBUS_BALLOON_PFN_ARRAY_SIZE];
     XENBUS_RANGE_SET_INTERFACE  RangeSetInterface;
     PXENBUS_RANGE_SET           RangeSet;
+    PXENBUS_RANGE_SET           ExtentRangeSet;
     XENBUS_STORE_INTERFACE      StoreInterface;
     XENBUS_BALLOON_FIST         FIST;
+    XENBUS_BALLOON_WORKER       Worker;
 };
 
 #define XENBUS_BALLOON_TAG   'LLAB'
@@ -171,7 +195,7 @@ BalloonCreateHeap(
 
 static VOID
 BalloonSort(
-    IN  PXENBUS_BALLOON_CONTEXT Context,
+    IN  PXENBUS_BALLOON_WORKER  Worker,
     IN  ULONG                   Count
     )
 {
@@ -179,7 +203,7 @@ BalloonSort(
     ULONG                       Unsorted;
     ULONG                       Index;
 
-    PfnArray = Context->PfnArray;
+    PfnArray = Worker->PfnArray;
 
     // Heap sort to keep stack usage down
     BalloonCreateHeap(PfnArray, Count);
@@ -208,13 +232,16 @@ BalloonAllocatePagesForMdl(
     HighAddress.QuadPart = ~0ull;
     SkipBytes.QuadPart = 0ull;
     TotalBytes = (SIZE_T)Count << PAGE_SHIFT;
-    
+
+    // Asking for contiguous memory improves the odds of finding whole
+    // extents in the allocation.
     Mdl = MmAllocatePagesForMdlEx(LowAddress,
                                   HighAddress,
                                   SkipBytes,
                                   TotalBytes,
                                   MmCached,
-                                  MM_DONT_ZERO_ALLOCATION);
+                                  MM_DONT_ZERO_ALLOCATION |
+                                  MM_ALLOCATE_PREFER_CONTIGUOUS);
     if (Mdl == NULL)
         goto done;
 
@@ -286,7 +313,7 @@ done:
 
 static ULONG
 BalloonAllocatePfnArray(
-    IN      PXENBUS_BALLOON_CONTEXT Context,
+    IN      PXENBUS_BALLOON_WORKER  Worker,
     IN      ULONG                   Requested,
     IN OUT  PBOOLEAN                Slow
     )
@@ -295,35 +322,50 @@ BalloonAllocatePfnArray(
     LARGE_INTEGER                   End;
     ULONGLONG                       TimeDelta;
     ULONGLONG                       Rate;
-    PMDL                            Mdl;
-    PPFN_NUMBER                     PfnArray;
     ULONG                           Count;
 
     ASSERT(Requested != 0);
     ASSERT3U(Requested, <=, XENBUS_BALLOON_PFN_ARRAY_SIZE);
-    ASSERT(IsZeroMemory(Context->PfnArray, Requested * sizeof (PFN_NUMBER)));
+    ASSERT(IsZeroMemory(Worker->PfnArray, Requested * sizeof (PFN_NUMBER)));
 
     KeQuerySystemTime(&Start);
     Count = 0;
 
-    Mdl = BalloonAllocatePagesForMdl(Requested);
-    if (Mdl == NULL)
-        goto done;
+    // A single MDL cannot describe the whole array so fill it in
+    // chunks, stopping as soon as Windows starts to come up short.
+    while (Count < Requested) {
+        ULONG       ThisTime = (ULONG)__min(Requested - Count, MAX_PAGES_PER_MDL);
+        PMDL        Mdl;
+        PPFN_NUMBER PfnArray;
+        ULONG       Allocated;
 
-    ASSERT(Mdl->ByteOffset == 0);
-    ASSERT((Mdl->ByteCount & (PAGE_SIZE - 1)) == 0);
-    ASSERT(Mdl->MdlFlags & MDL_PAGES_LOCKED);
+        Mdl = BalloonAllocatePagesForMdl(ThisTime);
+        if (Mdl == NULL)
+            break;
 
-    Count = Mdl->ByteCount >> PAGE_SHIFT;
+        ASSERT(Mdl->ByteOffset == 0);
+        ASSERT((Mdl->ByteCount & (PAGE_SIZE - 1)) == 0);
+        ASSERT(Mdl->MdlFlags & MDL_PAGES_LOCKED);
 
-    PfnArray = MmGetMdlPfnArray(Mdl);
-    RtlCopyMemory(Context->PfnArray, PfnArray, Count * sizeof (PFN_NUMBER));
+        Allocated = Mdl->ByteCount >> PAGE_SHIFT;
+        ASSERT3U(Allocated, <=, ThisTime);
 
-    BalloonSort(Context, Count);
+        PfnArray = MmGetMdlPfnArray(Mdl);
+        RtlCopyMemory(&Worker->PfnArray[Count],
+                      PfnArray,
+                      Allocated * sizeof (PFN_NUMBER));
 
-    ExFreePool(Mdl);
+        ExFreePool(Mdl);
+
+        Count += Allocated;
+
+        if (Allocated < ThisTime)
+            break;
+    }
+
+    if (Count != 0)
+        BalloonSort(Worker, Count);
 
-done:
     KeQuerySystemTime(&End);
     TimeDelta = __max(((End.QuadPart - Start.QuadPart) / 10000ull), 1);
 
@@ -336,6 +378,7 @@ done:
 
 static ULONG
 BalloonPopulatePhysmap(
+    IN  ULONG       Order,
     IN  ULONG       Requested,
     IN  PPFN_NUMBER PfnArray
     )
@@ -350,68 +393,166 @@ BalloonPopulatePhysmap(
 
     KeQuerySystemTime(&Start);
 
-    Count = MemoryPopulatePhysmap(Requested, PfnArray);
+    Count = MemoryPopulatePhysmap(Order, Requested, PfnArray);
 
     KeQuerySystemTime(&End);
     TimeDelta = __max(((End.QuadPart - Start.QuadPart) / 10000ull), 1);
 
-    Rate = (ULONGLONG)(Count * 1000) / TimeDelta;
+    Rate = ((ULONGLONG)Count << Order) * 1000 / TimeDelta;
 
-    Info("%u page(s) at %llu pages/s\n", Count, Rate);
+    Info("%u extent(s) of order %u at %llu pages/s\n", Count, Order, Rate);
     return Count;
 }
 
+static NTSTATUS
+BalloonPopPfn(
+    IN  PXENBUS_BALLOON_WORKER  Worker,
+    OUT PPFN_NUMBER             Pfn
+    )
+{
+    PXENBUS_BALLOON_CONTEXT     Context = Worker->Context;
+    LONGLONG                    Start;
+    NTSTATUS                    status;
+
+    for (;;) {
+        status = XENBUS_RANGE_SET(Pop,
+                                  &Context->RangeSetInterface,
+                                  Context->RangeSet,
+                                  1,
+                                  &Start);
+        if (NT_SUCCESS(status))
+            break;
+
+        // No single pages left so break up an extent
+        status = XENBUS_RANGE_SET(Pop,
+                                  &Context->RangeSetInterface,
+                                  Context->ExtentRangeSet,
+                                  1,
+                                  &Start);
+        if (!NT_SUCCESS(status))
+            goto fail1;
+
+        status = XENBUS_RANGE_SET(Put,
+                                  &Context->RangeSetInterface,
+                                  Context->RangeSet,
+                                  Start << XENBUS_BALLOON_EXTENT_ORDER,
+                                  XENBUS_BALLOON_EXTENT_PAGES);
+        ASSERT(NT_SUCCESS(status));
+    }
+
+    *Pfn = (PFN_NUMBER)Start;
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
 static ULONG
 BalloonPopulatePfnArray(
-    IN      PXENBUS_BALLOON_CONTEXT Context,
+    IN      PXENBUS_BALLOON_WORKER  Worker,
     IN      ULONG                   Requested
     )
 {
+    PXENBUS_BALLOON_CONTEXT         Context = Worker->Context;
     LARGE_INTEGER                   Start;
     LARGE_INTEGER                   End;
     ULONGLONG                       TimeDelta;
     ULONGLONG                       Rate;
+    ULONG                           Extents;
+    ULONG                           Populated;
+    ULONG                           Singles;
     ULONG                           Index;
     ULONG                           Count;
 
     ASSERT(Requested != 0);
     ASSERT3U(Requested, <=, XENBUS_BALLOON_PFN_ARRAY_SIZE);
-    ASSERT(IsZeroMemory(Context->PfnArray, Requested * sizeof (PFN_NUMBER)));
+    ASSERT(IsZeroMemory(Worker->PfnArray, Requested * sizeof (PFN_NUMBER)));
+    ASSERT(IsZeroMemory(Worker->ExtentArray, sizeof (Worker->ExtentArray)));
 
     KeQuerySystemTime(&Start);
 
-    for (Index = 0; Index < Requested; Index++) {
-        LONGLONG    Pfn;
+    // Reclaim whole extents first
+    Extents = 0;
+    while ((Extents + 1) * XENBUS_BALLOON_EXTENT_PAGES <= Requested) {
+        LONGLONG    Extent;
         NTSTATUS    status;
 
         status = XENBUS_RANGE_SET(Pop,
                                   &Context->RangeSetInterface,
-                                  Context->RangeSet,
+                                  Context->ExtentRangeSet,
                                   1,
-                                  &Pfn);
+                                  &Extent);
+        if (!NT_SUCCESS(status))
+            break;
+
+        Worker->ExtentArray[Extents++] =
+            (PFN_NUMBER)Extent << XENBUS_BALLOON_EXTENT_ORDER;
+    }
+
+    Populated = (Extents != 0) ?
+                BalloonPopulatePhysmap(XENBUS_BALLOON_EXTENT_ORDER,
+                                       Extents,
+                                       Worker->ExtentArray) :
+                0;
+
+    // Xen may not be able to back the remainder with superpages so
+    // hand them over to be reclaimed a page at a time.
+    for (Index = Populated; Index < Extents; Index++) {
+        NTSTATUS    status;
+
+        status = XENBUS_RANGE_SET(Put,
+                                  &Context->RangeSetInterface,
+                                  Context->RangeSet,
+                                  (LONGLONG)Worker->ExtentArray[Index],
+                                  XENBUS_BALLOON_EXTENT_PAGES);
         ASSERT(NT_SUCCESS(status));
 
-        Context->PfnArray[Index] = (PFN_NUMBER)Pfn;
+        Worker->ExtentArray[Index] = 0;
     }
 
-    Count = BalloonPopulatePhysmap(Requested, Context->PfnArray);
+    Count = 0;
+    for (Index = 0; Index < Populated; Index++) {
+        ULONG   Page;
 
-    Index = Count;
-    while (Index < Requested) {
+        for (Page = 0; Page < XENBUS_BALLOON_EXTENT_PAGES; Page++)
+            Worker->PfnArray[Count++] = Worker->ExtentArray[Index] + Page;
+
+        Worker->ExtentArray[Index] = 0;
+    }
+
+    Singles = Requested - Count;
+    if (Singles == 0)
+        goto done;
+
+    for (Index = 0; Index < Singles; Index++) {
+        NTSTATUS    status;
+
+        status = BalloonPopPfn(Worker, &Worker->PfnArray[Count + Index]);
+        ASSERT(NT_SUCCESS(status));
+    }
+
+    Populated = BalloonPopulatePhysmap(0,
+                                       Singles,
+                                       &Worker->PfnArray[Count]);
+
+    for (Index = Populated; Index < Singles; Index++) {
         NTSTATUS    status;
 
         status = XENBUS_RANGE_SET(Put,
                                   &Context->RangeSetInterface,
                                   Context->RangeSet,
-                                  (LONGLONG)Context->PfnArray[Index],
+                                  (LONGLONG)Worker->PfnArray[Count + Index],
                                   1);
-
         ASSERT(NT_SUCCESS(status));
 
-        Context->PfnArray[Index] = 0;
-        Index++;
+        Worker->PfnArray[Count + Index] = 0;
     }
 
+    Count += Populated;
+
+done:
     KeQuerySystemTime(&End);
     TimeDelta = __max(((End.QuadPart - Start.QuadPart) / 10000ull), 1);
 
@@ -423,6 +564,7 @@ BalloonPopulatePfnArray(
 
 static ULONG
 BalloonDecreaseReservation(
+    IN  ULONG       Order,
     IN  ULONG       Requested,
     IN  PPFN_NUMBER PfnArray
     )
@@ -437,31 +579,126 @@ BalloonDecreaseReservation(
 
     KeQuerySystemTime(&Start);
 
-    Count = MemoryDecreaseReservation(Requested, PfnArray);
+    Count = MemoryDecreaseReservation(Order, Requested, PfnArray);
 
     KeQuerySystemTime(&End);
     TimeDelta = __max(((End.QuadPart - Start.QuadPart) / 10000ull), 1);
 
-    Rate = (ULONGLONG)(Count * 1000) / TimeDelta;
+    Rate = ((ULONGLONG)Count << Order) * 1000 / TimeDelta;
+
+    Info("%u extent(s) of order %u at %llu pages/s\n", Count, Order, Rate);
+    return Count;
+}
+
+// Move every naturally aligned and complete extent out of the (sorted)
+// PFN array and into the extent array, packing the remaining pages at
+// the front of the PFN array.
+static ULONG
+BalloonExtractExtents(
+    IN  PXENBUS_BALLOON_WORKER  Worker,
+    IN  ULONG                   Count
+    )
+{
+    PPFN_NUMBER                 PfnArray = Worker->PfnArray;
+    ULONG                       Extents;
+    ULONG                       Singles;
+    ULONG                       Index;
+
+    Extents = 0;
+    Singles = 0;
+
+    Index = 0;
+    while (Index < Count) {
+        PFN_NUMBER  Pfn = PfnArray[Index];
+
+        // The array is sorted and has no duplicates so if the last
+        // page is where we expect it then so is everything in between.
+        if ((Pfn & (XENBUS_BALLOON_EXTENT_PAGES - 1)) == 0 &&
+            Index + XENBUS_BALLOON_EXTENT_PAGES <= Count &&
+            PfnArray[Index + XENBUS_BALLOON_EXTENT_PAGES - 1] ==
+            Pfn + XENBUS_BALLOON_EXTENT_PAGES - 1) {
+            ASSERT3U(Extents, <, XENBUS_BALLOON_EXTENT_ARRAY_SIZE);
+            Worker->ExtentArray[Extents++] = Pfn;
+
+            Index += XENBUS_BALLOON_EXTENT_PAGES;
+            continue;
+        }
+
+        PfnArray[Singles++] = Pfn;
+        Index++;
+    }
+
+    RtlZeroMemory(&PfnArray[Singles], (Count - Singles) * sizeof (PFN_NUMBER));
+
+    return Extents;
+}
+
+static ULONG
+BalloonReleaseExtentArray(
+    IN      PXENBUS_BALLOON_WORKER  Worker,
+    IN      ULONG                   Requested
+    )
+{
+    PXENBUS_BALLOON_CONTEXT         Context = Worker->Context;
+    ULONG                           Index;
+    ULONG                           Count;
+
+    Index = 0;
+    while (Index < Requested) {
+        NTSTATUS    status;
+
+        status = XENBUS_RANGE_SET(Put,
+                                  &Context->RangeSetInterface,
+                                  Context->ExtentRangeSet,
+                                  (LONGLONG)(Worker->ExtentArray[Index] >> XENBUS_BALLOON_EXTENT_ORDER),
+                                  1);
+        if (!NT_SUCCESS(status))
+            break;
+
+        Index++;
+    }
+
+    Count = (Index != 0) ?
+            BalloonDecreaseReservation(XENBUS_BALLOON_EXTENT_ORDER,
+                                       Index,
+                                       Worker->ExtentArray) :
+            0;
+
+    while (Index > Count) {
+        NTSTATUS    status;
+
+        --Index;
+
+        status = XENBUS_RANGE_SET(Get,
+                                  &Context->RangeSetInterface,
+                                  Context->ExtentRangeSet,
+                                  (LONGLONG)(Worker->ExtentArray[Index] >> XENBUS_BALLOON_EXTENT_ORDER),
+                                  1);
+        ASSERT(NT_SUCCESS(status));
+    }
 
-    Info("%u page(s) at %llu pages/s\n", Count, Rate);
     return Count;
 }
 
 static ULONG
 BalloonReleasePfnArray(
-    IN      PXENBUS_BALLOON_CONTEXT Context,
+    IN      PXENBUS_BALLOON_WORKER  Worker,
     IN      ULONG                   Requested
     )
 {
+    PXENBUS_BALLOON_CONTEXT         Context = Worker->Context;
     LARGE_INTEGER                   Start;
     LARGE_INTEGER                   End;
     ULONGLONG                       TimeDelta;
     ULONGLONG                       Rate;
+    ULONG                           Extents;
+    ULONG                           Released;
+    ULONG                           Singles;
     ULONG                           Index;
     ULONG                           Count;
 
     ASSERT3U(Requested, <=, XENBUS_BALLOON_PFN_ARRAY_SIZE);
+    ASSERT(IsZeroMemory(Worker->ExtentArray, sizeof (Worker->ExtentArray)));
 
     KeQuerySystemTime(&Start);
     Count = 0;
@@ -469,41 +706,71 @@ BalloonReleasePfnArray(
     if (Requested == 0)
         goto done;
 
+    Extents = BalloonExtractExtents(Worker, Requested);
+    Singles = Requested - (Extents * XENBUS_BALLOON_EXTENT_PAGES);
+
+    Released = BalloonReleaseExtentArray(Worker, Extents);
+    Count = Released * XENBUS_BALLOON_EXTENT_PAGES;
+
+    // Anything Xen would not take as an extent goes back in as pages
+    for (Index = 0; Index < Extents; Index++) {
+        if (Index >= Released) {
+            ULONG   Page;
+
+            for (Page = 0; Page < XENBUS_BALLOON_EXTENT_PAGES; Page++)
+                Worker->PfnArray[Singles++] = Worker->ExtentArray[Index] + Page;
+        }
+
+        Worker->ExtentArray[Index] = 0;
+    }
+
+    if (Singles == 0)
+        goto done;
+
     Index = 0;
-    while (Index < Requested) {
+    while (Index < Singles) {
         NTSTATUS    status;
 
         status = XENBUS_RANGE_SET(Put,
                                   &Context->RangeSetInterface,
                                   Context->RangeSet,
-                                  (LONGLONG)Context->PfnArray[Index],
+                                  (LONGLONG)Worker->PfnArray[Index],
                                   1);
         if (!NT_SUCCESS(status))
             break;
 
         Index++;
     }
-    Requested = Index;
-
-    Count = BalloonDecreaseReservation(Requested, Context->PfnArray);
 
-    RtlZeroMemory(Context->PfnArray, Count * sizeof (PFN_NUMBER));
+    Released = (Index != 0) ?
+               BalloonDecreaseReservation(0, Index, Worker->PfnArray) :
+               0;
 
-    for (Index = Count; Index < Requested; Index++) {
+    while (Index > Released) {
         NTSTATUS    status;
 
+        --Index;
+
         status = XENBUS_RANGE_SET(Get,
                                   &Context->RangeSetInterface,
                                   Context->RangeSet,
-                                  1,
-                                  (LONGLONG)Context->PfnArray[Index]);
+                                  (LONGLONG)Worker->PfnArray[Index],
+                                  1);
         ASSERT(NT_SUCCESS(status));
-
-        Context->PfnArray[Index] = 0;
     }
 
+    // Leave the pages we still own at the front of the array
+    RtlMoveMemory(&Worker->PfnArray[0],
+                  &Worker->PfnArray[Released],
+                  (Singles - Released) * sizeof (PFN_NUMBER));
+    RtlZeroMemory(&Worker->PfnArray[Singles - Released],
+                  Released * sizeof (PFN_NUMBER));
+
+    Count += Released;
+
 done:
-    ASSERT(IsZeroMemory(Context->PfnArray, Requested * sizeof (PFN_NUMBER)));
+    ASSERT(IsZeroMemory(&Worker->PfnArray[Requested - Count],
+                        Count * sizeof (PFN_NUMBER)));
 
     KeQuerySystemTime(&End);
     TimeDelta = __max(((End.QuadPart - Start.QuadPart) / 10000ull), 1);
@@ -516,7 +783,7 @@ done:
 
 static ULONG
 BalloonFreePfnArray(
-    IN      PXENBUS_BALLOON_CONTEXT Context,
+    IN      PXENBUS_BALLOON_WORKER  Worker,
     IN      ULONG                   Requested,
     IN      BOOLEAN                 Check
     )
@@ -527,7 +794,6 @@ BalloonFreePfnArray(
     ULONGLONG                       Rate;
     ULONG                           Index;
     ULONG                           Count;
-    PMDL                            Mdl;
 
     ASSERT3U(Requested, <=, XENBUS_BALLOON_PFN_ARRAY_SIZE);
 
@@ -537,36 +803,48 @@ BalloonFreePfnArray(
     if (Requested == 0)
         goto done;
 
-    ASSERT(IsZeroMemory(&Context->Mdl, sizeof (MDL)));
+    ASSERT(IsZeroMemory(&Worker->Mdl, sizeof (MDL)));
 
     for (Index = 0; Index < Requested; Index++)
-        ASSERT(Context->PfnArray[Index] != 0);
+        ASSERT(Worker->PfnArray[Index] != 0);
 
-    Mdl = &Context->Mdl;
+    // The MDL header sits immediately in front of the PFN array so
+    // free from the front, shuffling the remaining pages down after
+    // each chunk.
+    while (Count < Requested) {
+        ULONG   ThisTime = (ULONG)__min(Requested - Count, MAX_PAGES_PER_MDL);
+        PMDL    Mdl;
+
+        Mdl = &Worker->Mdl;
 
 #pragma warning(push)
 #pragma warning(disable:28145)  // The opaque MDL structure should not be modified by a driver
 
-    Mdl->Next = NULL;
-    Mdl->Size = (SHORT)(sizeof(MDL) + (sizeof(PFN_NUMBER) * Requested));
-    Mdl->MdlFlags = MDL_PAGES_LOCKED;
-    Mdl->Process = NULL;
-    Mdl->MappedSystemVa = NULL;
-    Mdl->StartVa = NULL;
-    Mdl->ByteCount = Requested << PAGE_SHIFT;
-    Mdl->ByteOffset = 0;
+        Mdl->Next = NULL;
+        Mdl->Size = (SHORT)(sizeof(MDL) + (sizeof(PFN_NUMBER) * ThisTime));
+        Mdl->MdlFlags = MDL_PAGES_LOCKED;
+        Mdl->Process = NULL;
+        Mdl->MappedSystemVa = NULL;
+        Mdl->StartVa = NULL;
+        Mdl->ByteCount = ThisTime << PAGE_SHIFT;
+        Mdl->ByteOffset = 0;
 
 #pragma warning(pop)
 
-    BalloonFreePagesFromMdl(Mdl, Check);
-    Count = Requested;
+        BalloonFreePagesFromMdl(Mdl, Check);
+        Count += ThisTime;
 
-    RtlZeroMemory(&Context->Mdl, sizeof (MDL));
+        RtlZeroMemory(&Worker->Mdl, sizeof (MDL));
 
-    RtlZeroMemory(Context->PfnArray, Count * sizeof (PFN_NUMBER));
+        RtlMoveMemory(&Worker->PfnArray[0],
+                      &Worker->PfnArray[ThisTime],
+                      (Requested - Count) * sizeof (PFN_NUMBER));
+        RtlZeroMemory(&Worker->PfnArray[Requested - Count],
+                      ThisTime * sizeof (PFN_NUMBER));
+    }
 
 done:
-    ASSERT(IsZeroMemory(Context->PfnArray, Requested * sizeof (PFN_NUMBER)));
+    ASSERT(IsZeroMemory(Worker->PfnArray, Requested * sizeof (PFN_NUMBER)));
 
     KeQuerySystemTime(&End);
     TimeDelta = __max(((End.QuadPart - Start.QuadPart) / 10000ull), 1);
@@ -596,26 +874,15 @@ BalloonLowMemory(
     return (status == STATUS_SUCCESS) ? TRUE : FALSE;
 }
 
-static NTSTATUS
-BalloonDeflate(
-    IN  PXENBUS_BALLOON_CONTEXT Context,
-    IN  ULONGLONG               Requested
+static VOID
+BalloonWorkerDeflate(
+    IN  PXENBUS_BALLOON_WORKER  Worker
     )
 {
-    LARGE_INTEGER               Start;
-    LARGE_INTEGER               End;
+    ULONGLONG                   Requested = Worker->Requested;
     ULONGLONG                   Count;
-    ULONGLONG                   TimeDelta;
     NTSTATUS                    status;
 
-    status = STATUS_UNSUCCESSFUL;
-    if (Context->FIST.Deflation)
-        goto done;
-
-    Info("====> %llu page(s)\n", Requested);
-
-    KeQuerySystemTime(&Start);
-
     Count = 0;
     status = STATUS_SUCCESS;
 
@@ -624,16 +891,210 @@ BalloonDeflate(
         ULONG   Populated;
         ULONG   Freed;
 
-        Populated = BalloonPopulatePfnArray(Context, ThisTime);
+        Populated = BalloonPopulatePfnArray(Worker, ThisTime);
         if (Populated < ThisTime)
             status = STATUS_RETRY;
 
-        Freed = BalloonFreePfnArray(Context, Populated, TRUE);
+        Freed = BalloonFreePfnArray(Worker, Populated, TRUE);
         ASSERT(Freed == Populated);
 
         Count += Freed;
     }
 
+    Worker->Count = Count;
+    Worker->Status = status;
+}
+
+static VOID
+BalloonWorkerInflate(
+    IN  PXENBUS_BALLOON_WORKER  Worker
+    )
+{
+    ULONGLONG                   Requested = Worker->Requested;
+    ULONGLONG                   Count;
+    NTSTATUS                    status;
+
+    Count = 0;
+    status = STATUS_SUCCESS;
+
+    while (Count < Requested && NT_SUCCESS(status)) {
+        ULONG   ThisTime = (ULONG)__min(Requested - Count, XENBUS_BALLOON_PFN_ARRAY_SIZE);
+        ULONG   Allocated;
+        BOOLEAN Slow;
+        ULONG   Released;
+
+        Allocated = BalloonAllocatePfnArray(Worker, ThisTime, &Slow);
+        if (Allocated < ThisTime || Slow)
+            status = STATUS_RETRY;
+
+        Released = BalloonReleasePfnArray(Worker, Allocated);
+
+        if (Released < Allocated) {
+            ULONG   Freed;
+
+            Freed = BalloonFreePfnArray(Worker, Allocated - Released, FALSE);
+            ASSERT3U(Freed, ==, Allocated - Released);
+        }
+
+        if (Released == 0)
+            status = STATUS_RETRY;
+
+        Count += Released;
+    }
+
+    Worker->Count = Count;
+    Worker->Status = status;
+}
+
+static FORCEINLINE VOID
+__BalloonWorkerRun(
+    IN  PXENBUS_BALLOON_WORKER  Worker
+    )
+{
+    Worker->Count = 0;
+    Worker->Status = STATUS_SUCCESS;
+
+    if (Worker->Requested == 0)
+        return;
+
+    if (Worker->Inflate)
+        BalloonWorkerInflate(Worker);
+    else
+        BalloonWorkerDeflate(Worker);
+}
+
+static NTSTATUS
+BalloonWorker(
+    IN  PXENBUS_THREAD  Self,
+    IN  PVOID           Context
+    )
+{
+    PXENBUS_BALLOON_WORKER  Worker = Context;
+
+    UNREFERENCED_PARAMETER(Self);
+
+    __BalloonWorkerRun(Worker);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+BalloonRun(
+    IN  PXENBUS_BALLOON_CONTEXT Context,
+    IN  BOOLEAN                 Inflate,
+    IN  ULONGLONG               Requested,
+    OUT PULONGLONG              Count
+    )
+{
+    PXENBUS_BALLOON_WORKER      Worker[XENBUS_BALLOON_MAX_WORKERS];
+    ULONG                       Workers;
+    ULONGLONG                   Share;
+    ULONG                       Index;
+    NTSTATUS                    status;
+
+    RtlZeroMemory(Worker, sizeof (Worker));
+
+    // The embedded worker is always available, so we can still
+    // deflate when we are too short of memory to allocate any more.
+    Worker[0] = &Context->Worker;
+    Workers = 1;
+
+    if (Requested >= XENBUS_BALLOON_PARALLEL_THRESHOLD &&
+        KeGetCurrentIrql() == PASSIVE_LEVEL) {
+        ULONG   Maximum;
+
+        Maximum = __min(KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS),
+                        XENBUS_BALLOON_MAX_WORKERS);
+
+        while (Workers < Maximum) {
+            Worker[Workers] = __BalloonAllocate(sizeof (XENBUS_BALLOON_WORKER));
+            if (Worker[Workers] == NULL)
+                break;
+
+            Worker[Workers]->Context = Context;
+            Workers++;
+        }
+    }
+
+    Share = Requested / Workers;
+
+    for (Index = 0; Index < Workers; Index++) {
+        Worker[Index]->Inflate = Inflate;
+        Worker[Index]->Requested = (Index == 0) ?
+                                   Requested - (Share * (Workers - 1)) :
+                                   Share;
+    }
+
+    for (Index = 1; Index < Workers; Index++) {
+        status = ThreadCreate(BalloonWorker,
+                              Worker[Index],
+                              &Worker[Index]->Thread);
+        if (!NT_SUCCESS(status)) {
+            // Pick up the slack on this thread
+            Worker[0]->Requested += Worker[Index]->Requested;
+            Worker[Index]->Requested = 0;
+        }
+    }
+
+    if (Workers > 1)
+        Info("%llu page(s) across %u worker(s)\n", Requested, Workers);
+
+    __BalloonWorkerRun(Worker[0]);
+
+    *Count = 0;
+    status = STATUS_SUCCESS;
+
+    for (Index = 0; Index < Workers; Index++) {
+        if (Worker[Index]->Thread != NULL) {
+            ThreadJoin(Worker[Index]->Thread);
+            Worker[Index]->Thread = NULL;
+        }
+
+        *Count += Worker[Index]->Count;
+
+        // Report the first failure
+        if (NT_SUCCESS(status))
+            status = Worker[Index]->Status;
+
+        Worker[Index]->Inflate = FALSE;
+        Worker[Index]->Requested = 0;
+        Worker[Index]->Count = 0;
+        Worker[Index]->Status = STATUS_SUCCESS;
+
+        if (Index == 0)
+            continue;
+
+        Worker[Index]->Context = NULL;
+
+        ASSERT(IsZeroMemory(Worker[Index], sizeof (XENBUS_BALLOON_WORKER)));
+        __BalloonFree(Worker[Index]);
+    }
+
+    return status;
+}
+
+static NTSTATUS
+BalloonDeflate(
+    IN  PXENBUS_BALLOON_CONTEXT Context,
+    IN  ULONGLONG               Requested
+    )
+{
+    LARGE_INTEGER               Start;
+    LARGE_INTEGER               End;
+    ULONGLONG                   Count;
+    ULONGLONG                   TimeDelta;
+    NTSTATUS                    status;
+
+    status = STATUS_UNSUCCESSFUL;
+    if (Context->FIST.Deflation)
+        goto done;
+
+    Info("====> %llu page(s)\n", Requested);
+
+    KeQuerySystemTime(&Start);
+
+    status = BalloonRun(Context, FALSE, Requested, &Count);
+
     KeQuerySystemTime(&End);
 
     TimeDelta = (End.QuadPart - Start.QuadPart) / 10000ull;
@@ -669,37 +1130,7 @@ BalloonInflate(
 
     KeQuerySystemTime(&Start);
 
-    Count = 0;
-    status = STATUS_SUCCESS;
-
-    while (Count < Requested && NT_SUCCESS(status)) {
-        ULONG   ThisTime = (ULONG)__min(Requested - Count, XENBUS_BALLOON_PFN_ARRAY_SIZE);
-        ULONG   Allocated;
-        BOOLEAN Slow;
-        ULONG   Released;
-
-        Allocated = BalloonAllocatePfnArray(Context, ThisTime, &Slow);
-        if (Allocated < ThisTime || Slow)
-            status = STATUS_RETRY;
-
-        Released = BalloonReleasePfnArray(Context, Allocated);
-
-        if (Released < Allocated) {
-            ULONG   Freed;
-
-            RtlMoveMemory(&(Context->PfnArray[0]),
-                          &(Context->PfnArray[Released]),
-                          (Allocated - Released) * sizeof (PFN_NUMBER));
-
-            Freed = BalloonFreePfnArray(Context, Allocated - Released, FALSE);
-            ASSERT3U(Freed, ==, Allocated - Released);
-        }
-
-        if (Released == 0)
-            status = STATUS_RETRY;
-
-        Count += Released;
-    }
+    status = BalloonRun(Context, TRUE, Requested, &Count);
 
     KeQuerySystemTime(&End);
 
@@ -844,14 +1275,23 @@ BalloonAcquire(
     status = XENBUS_RANGE_SET(Create,
                               &Context->RangeSetInterface,
                               "balloon",
+                              XENBUS_RANGE_SET_TYPE_TREE,
                               &Context->RangeSet);
     if (!NT_SUCCESS(status))
         goto fail2;
 
-    status = XENBUS_STORE(Acquire, &Context->StoreInterface);
+    status = XENBUS_RANGE_SET(Create,
+                              &Context->RangeSetInterface,
+                              "balloon_extent",
+                              XENBUS_RANGE_SET_TYPE_TREE,
+                              &Context->ExtentRangeSet);
     if (!NT_SUCCESS(status))
         goto fail3;
 
+    status = XENBUS_STORE(Acquire, &Context->StoreInterface);
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
     Trace("<====\n");
 
 done:
@@ -859,6 +1299,14 @@ done:
 
     return STATUS_SUCCESS;
 
+fail4:
+    Error("fail4\n");
+
+    XENBUS_RANGE_SET(Destroy,
+                     &Context->RangeSetInterface,
+                     Context->ExtentRangeSet);
+    Context->ExtentRangeSet = NULL;
+
 fail3:
     Error("fail3\n");
 
@@ -904,6 +1352,11 @@ BalloonRelease(
 
     XENBUS_STORE(Release, &Context->StoreInterface);
 
+    XENBUS_RANGE_SET(Destroy,
+                     &Context->RangeSetInterface,
+                     Context->ExtentRangeSet);
+    Context->ExtentRangeSet = NULL;
+
     XENBUS_RANGE_SET(Destroy,
                      &Context->RangeSetInterface,
                      Context->RangeSet);
@@ -963,6 +1416,7 @@ BalloonInitialize(
     if ((*Context)->LowMemoryEvent == NULL)
         goto fail2;
 
+    (*Context)->Worker.Context = *Context;
     (*Context)->Fdo = Fdo;
 
     Trace("<====\n");
@@ -1041,6 +1495,7 @@ BalloonTeardown(
     Trace("====>\n");
 
     Context->Fdo = NULL;
+    Context->Worker.Context = NULL;
 
     ZwClose(Context->LowMemoryHandle);
     Context->LowMemoryHandle = NULL;
@@ -149,7 +149,6 @@ typedef struct _XENBUS_DMA_LIST_CONTROL XENBUS_DMA_LIST_CONTROL, *PXENBUS_DMA_LI
 typedef struct _XENBUS_DMA_CONTEXT      XENBUS_DMA_CONTEXT, *PXENBUS_DMA_CONTEXT;
 
 struct _XENBUS_DMA_CONTEXT {
-    PXENBUS_DMA_CONTEXT         Next;
     PVOID                       Key;
     ULONG                       Version;
     KSPIN_LOCK                  Lock;
@@ -273,114 +272,24 @@ DmaDestroyContext(
    __DmaFree(Context);
 }
 
-#define NR_CONTEXT_BUCKETS  8
-
-static KSPIN_LOCK           DmaContextLock;
-static PXENBUS_DMA_CONTEXT  DmaContext[NR_CONTEXT_BUCKETS];
-
-//
-// Hash on the basis that multiple DMA_ADAPTER structures are unlikely
-// to appear in the same 256 byte block of memory
-//
-#define DMA_CONTEXT_BUCKET(_Key)    \
-    (((ULONG_PTR)(_Key) >> 8) % NR_CONTEXT_BUCKETS)
-
-#pragma warning(suppress: 28167) // changes the IRQL and does not restore the IRQL before it exits
-static KIRQL
-DmaAcquireLock(
-    IN  PKSPIN_LOCK         Lock
-    )
-{
-    KIRQL       Irql;
-    
-    Irql = KeGetCurrentIrql();
-    if (Irql > DISPATCH_LEVEL)
-        return Irql;
-
-    KeAcquireSpinLock(Lock, &Irql);
-    return Irql;
-}
-
-#pragma warning(suppress: 28167) // changes the IRQL and does not restore the IRQL before it exits
-static VOID
-DmaReleaseLock(
-    IN  PKSPIN_LOCK         Lock,
-    IN  KIRQL               Irql
-    )
-{
-    if (Irql > DISPATCH_LEVEL)
-        return;
-
-#pragma warning(suppress: 26110) // caller failing to hold lock
-    KeReleaseSpinLock(Lock, Irql);
-}
-
-static VOID
-DmaAddContext(
-    IN  PVOID               Key,
-    IN  PXENBUS_DMA_CONTEXT Context
-    )
-{
-    KIRQL                   Irql;
-    ULONG_PTR               Bucket;
-
-    Context->Key = Key;
-
-    Irql = DmaAcquireLock(&DmaContextLock);
-    Bucket = DMA_CONTEXT_BUCKET(Key);
-    Context->Next = DmaContext[Bucket];
-    DmaContext[Bucket] = Context;
-    DmaReleaseLock(&DmaContextLock, Irql);
-}
-
-static VOID
-DmaRemoveContext(
-    IN  PXENBUS_DMA_CONTEXT Context
-    )
-{
-    PVOID                   Key;
-    KIRQL                   Irql;
-    ULONG_PTR               Bucket;
-    PXENBUS_DMA_CONTEXT     *Entry;
-
-    ASSERT(Context != NULL);
-    Key = Context->Key;
-
-    Irql = DmaAcquireLock(&DmaContextLock);
-    Bucket = DMA_CONTEXT_BUCKET(Key);
-    Entry = &DmaContext[Bucket];
-    while (*Entry != NULL) {
-        if (*Entry == Context) {
-            *Entry = Context->Next;
-            break;
-        }
-        Entry = &(*Entry)->Next;
-    }
-    DmaReleaseLock(&DmaContextLock, Irql);
-
-    ASSERT(Context != NULL);
-    Context->Key = 0;
-}
-
-static PXENBUS_DMA_CONTEXT
+static FORCEINLINE PXENBUS_DMA_CONTEXT
 DmaFindContext(
     IN  PVOID           Key
     )
 {
-    KIRQL               Irql;
-    ULONG_PTR           Bucket;
+    PDMA_ADAPTER        Adapter = Key;
     PXENBUS_DMA_CONTEXT Context;
 
-    Irql = DmaAcquireLock(&DmaContextLock);
-    Bucket = DMA_CONTEXT_BUCKET(Key);
-    for (Context = DmaContext[Bucket];
-         Context != NULL;
-         Context = Context->Next)
-        if (Context->Key == Key)
-            break;
-    DmaReleaseLock(&DmaContextLock, Irql);
+    //
+    // Whether substituted or passed through, every adapter we intercept
+    // has its DMA_OPERATIONS pointer aimed at the copy embedded in its
+    // context, so the context can be found from the adapter alone
+    //
+    Context = CONTAINING_RECORD(Adapter->DmaOperations,
+                                XENBUS_DMA_CONTEXT,
+                                Operations);
 
-    ASSERT(Context != NULL);
+    ASSERT3P(Context->Key, ==, Key);
     return Context;
 }
 
@@ -397,7 +306,6 @@ DmaPutAdapter(
     Operations = Context->LowerOperations;
     Operations->PutDmaAdapter(Context->LowerAdapter);
 
-    DmaRemoveContext(Context);
     DmaDestroyContext(Context);
 }
 
@@ -723,7 +631,6 @@ DmaFreeMapRegisters(
                                  NumberOfMapRegisters);
 
     if (Context->Freed) {
-        DmaRemoveContext(Context);
         DmaDestroyContext(Context);
     }
 }
@@ -1511,7 +1418,6 @@ DmaFreeAdapterObject(
 
     switch (AllocationAction) {
     case DeallocateObject:
-        DmaRemoveContext(Context);
         DmaDestroyContext(Context);
         break;
 
@@ -1681,7 +1587,7 @@ DmaGetAdapter(
         Adapter = Context->LowerAdapter;
     }
 
-    DmaAddContext(Adapter, Context);
+    Context->Key = Adapter;
 
 done:
     return Adapter;
@@ -87,6 +87,7 @@ struct _XENBUS_EVTCHN_CHANNEL {
     BOOLEAN                     Mask;
     ULONG                       LocalPort;
     PROCESSOR_NUMBER            ProcNumber;
+    XENBUS_EVTCHN_PRIORITY      Priority;
     BOOLEAN                     Closed;
 };
 
@@ -412,6 +413,7 @@ EvtchnReap(
     RtlZeroMemory(&Channel->ListEntry, sizeof (LIST_ENTRY));
 
     RtlZeroMemory(&Channel->ProcNumber, sizeof (PROCESSOR_NUMBER));
+    Channel->Priority = 0;
 
     ASSERT(IsListEmpty(&Channel->PendingListEntry));
     RtlZeroMemory(&Channel->PendingListEntry, sizeof (LIST_ENTRY));
@@ -727,6 +729,60 @@ fail1:
     return status;
 }
 
+static NTSTATUS
+EvtchnSetPriority(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel,
+    IN  XENBUS_EVTCHN_PRIORITY  Priority
+    )
+{
+    ULONG                       LocalPort;
+    KIRQL                       Irql;
+    NTSTATUS                    status;
+
+    UNREFERENCED_PARAMETER(Interface);
+
+    ASSERT3U(Channel->Magic, ==, XENBUS_EVTCHN_CHANNEL_MAGIC);
+
+    status = STATUS_INVALID_PARAMETER;
+    if ((ULONG)Priority > EVTCHN_FIFO_PRIORITY_MIN)
+        goto fail1;
+
+    KeAcquireSpinLock(&Channel->Lock, &Irql);
+
+    if (!Channel->Active)
+        goto done;
+
+    if (Channel->Priority == Priority)
+        goto done;
+
+    LocalPort = Channel->LocalPort;
+
+    // This will fail with the two-level ABI, which has no priorities
+    status = EventChannelSetPriority(LocalPort, Priority);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+    Channel->Priority = Priority;
+
+    Info("[%u]: PRIORITY %u\n", LocalPort, Priority);
+
+done:
+    KeReleaseSpinLock(&Channel->Lock, Irql);
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+    KeReleaseSpinLock(&Channel->Lock, Irql);
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
 static BOOLEAN
 EvtchnUnmask(
     IN  PINTERFACE              Interface,
@@ -1419,6 +1475,12 @@ EvtchnDebugCallback(
                          &Context->DebugInterface,
                          "Count = %lu\n",
                          Channel->Count);
+
+            if (Channel->Priority != 0)
+                XENBUS_DEBUG(Printf,
+                             &Context->DebugInterface,
+                             "Priority = %u\n",
+                             Channel->Priority);
         }
     }
 }
@@ -1752,6 +1814,22 @@ static struct _XENBUS_EVTCHN_INTERFACE_V8 EvtchnInterfaceVersion8 = {
     EvtchnClose,
 };
 
+static struct _XENBUS_EVTCHN_INTERFACE_V9 EvtchnInterfaceVersion9 = {
+    { sizeof (struct _XENBUS_EVTCHN_INTERFACE_V9), 9, NULL, NULL, NULL },
+    EvtchnAcquire,
+    EvtchnRelease,
+    EvtchnOpen,
+    EvtchnBind,
+    EvtchnUnmask,
+    EvtchnSend,
+    EvtchnTrigger,
+    EvtchnGetCount,
+    EvtchnWait,
+    EvtchnGetPort,
+    EvtchnClose,
+    EvtchnSetPriority,
+};
+
 NTSTATUS
 EvtchnInitialize(
     IN  PXENBUS_FDO             Fdo,
@@ -1945,6 +2023,23 @@ EvtchnGetInterface(
         status = STATUS_SUCCESS;
         break;
     }
+    case 9: {
+        struct _XENBUS_EVTCHN_INTERFACE_V9  *EvtchnInterface;
+
+        EvtchnInterface = (struct _XENBUS_EVTCHN_INTERFACE_V9 *)Interface;
+
+        status = STATUS_BUFFER_OVERFLOW;
+        if (Size < sizeof (struct _XENBUS_EVTCHN_INTERFACE_V9))
+            break;
+
+        *EvtchnInterface = EvtchnInterfaceVersion9;
+
+        ASSERT3U(Interface->Version, ==, Version);
+        Interface->Context = Context;
+
+        status = STATUS_SUCCESS;
+        break;
+    }
     default:
         status = STATUS_NOT_SUPPORTED;
         break;
@@ -41,18 +41,21 @@
 #include "assert.h"
 #include "util.h"
 
+#define EVENT_WORDS_PER_PAGE    (PAGE_SIZE / sizeof (event_word_t))
+#define EVENT_PAGE_COUNT        (EVTCHN_FIFO_NR_CHANNELS / EVENT_WORDS_PER_PAGE)
+
 typedef struct _XENBUS_EVTCHN_FIFO_CONTEXT {
     PXENBUS_FDO                     Fdo;
     KSPIN_LOCK                      Lock;
     LONG                            References;
     PMDL                            ControlBlockMdl[HVM_MAX_VCPUS];
-    PMDL                            *EventPageMdl;
+    evtchn_fifo_control_block_t     *ControlBlock[HVM_MAX_VCPUS];
+    PMDL                            EventPageMdl[EVENT_PAGE_COUNT];
+    event_word_t                    *EventPage[EVENT_PAGE_COUNT];
     ULONG                           EventPageCount;
     ULONG                           Head[HVM_MAX_VCPUS][EVTCHN_FIFO_MAX_QUEUES];
 } XENBUS_EVTCHN_FIFO_CONTEXT, *PXENBUS_EVTCHN_FIFO_CONTEXT;
 
-#define EVENT_WORDS_PER_PAGE    (PAGE_SIZE / sizeof (event_word_t))
-
 #define XENBUS_EVTCHN_FIFO_TAG  'OFIF'
 
 static FORCEINLINE PVOID
@@ -71,28 +74,25 @@ __EvtchnFifoFree(
     __FreePoolWithTag(Buffer, XENBUS_EVTCHN_FIFO_TAG);
 }
 
-static event_word_t *
-EvtchnFifoEventWord(
+// Event pages are only ever added (under the context lock) until the
+// ABI is released, and each page address is published before the page
+// count so lookups can be done without a lock.
+static FORCEINLINE event_word_t *
+__EvtchnFifoEventWord(
     IN  PXENBUS_EVTCHN_FIFO_CONTEXT Context,
     IN  ULONG                       Port
     )
 {
     ULONG                           Index;
-    PMDL                            Mdl;
-    event_word_t                    *EventWord;
+    event_word_t                    *EventPage;
 
     Index = Port / EVENT_WORDS_PER_PAGE;
     ASSERT3U(Index, <, Context->EventPageCount);
 
-    Mdl = Context->EventPageMdl[Index];
-
-    EventWord = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
-    ASSERT(EventWord != NULL);
-
-    ASSERT3U(Port, >=, Index * EVENT_WORDS_PER_PAGE);
-    Port -= Index * EVENT_WORDS_PER_PAGE;
+    EventPage = Context->EventPage[Index];
+    ASSERT(EventPage != NULL);
 
-    return &EventWord[Port];
+    return &EventPage[Port % EVENT_WORDS_PER_PAGE];
 }
 
 static FORCEINLINE BOOLEAN
@@ -167,7 +167,6 @@ EvtchnFifoExpand(
 {
     LONG                            Index;
     ULONG                           EventPageCount;
-    PMDL                            *EventPageMdl;
     PMDL                            Mdl;
     ULONG                           Start;
     ULONG                           End;
@@ -176,15 +175,11 @@ EvtchnFifoExpand(
     Index = Port / EVENT_WORDS_PER_PAGE;
     ASSERT3U(Index, >=, (LONG)Context->EventPageCount);
 
-    EventPageCount = Index + 1;
-    EventPageMdl = __EvtchnFifoAllocate(sizeof (PMDL) * EventPageCount);
-
-    status = STATUS_NO_MEMORY;
-    if (EventPageMdl == NULL)
+    status = STATUS_INVALID_PARAMETER;
+    if ((ULONG)Index >= EVENT_PAGE_COUNT)
         goto fail1;
 
-    for (Index = 0; Index < (LONG)Context->EventPageCount; Index++)
-        EventPageMdl[Index] = Context->EventPageMdl[Index];
+    EventPageCount = Index + 1;
 
     Index = Context->EventPageCount;
     while (Index < (LONG)EventPageCount) {
@@ -218,7 +213,9 @@ EvtchnFifoExpand(
                   Address.HighPart,
                   Address.LowPart);
 
-        EventPageMdl[Index++] = Mdl;
+        Context->EventPageMdl[Index] = Mdl;
+        Context->EventPage[Index] = EventWord;
+        Index++;
     }
 
     Start = Context->EventPageCount * EVENT_WORDS_PER_PAGE;
@@ -226,10 +223,8 @@ EvtchnFifoExpand(
 
     Info("added ports [%08x - %08x]\n", Start, End);
 
-    if (Context->EventPageMdl != NULL)
-        __EvtchnFifoFree(Context->EventPageMdl);
+    KeMemoryBarrier();
 
-    Context->EventPageMdl = EventPageMdl;
     Context->EventPageCount = EventPageCount;
 
     return STATUS_SUCCESS;
@@ -243,13 +238,14 @@ fail2:
     Error("fail2\n");
 
     while (--Index >= (LONG)Context->EventPageCount) {
-        Mdl = EventPageMdl[Index];
+        Mdl = Context->EventPageMdl[Index];
+
+        Context->EventPage[Index] = NULL;
+        Context->EventPageMdl[Index] = NULL;
 
         __FreePage(Mdl);
     }
 
-    __EvtchnFifoFree(EventPageMdl);
-
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -264,19 +260,20 @@ EvtchnFifoContract(
     LONG                            Index;
 
     Index = Context->EventPageCount;
+    Context->EventPageCount = 0;
+
+    KeMemoryBarrier();
+
     while (--Index >= 0) {
         PMDL    Mdl;
 
         Mdl = Context->EventPageMdl[Index];
 
+        Context->EventPage[Index] = NULL;
+        Context->EventPageMdl[Index] = NULL;
+
         __FreePage(Mdl);
     }
-
-    if (Context->EventPageMdl != NULL)
-        __EvtchnFifoFree(Context->EventPageMdl);
-
-    Context->EventPageMdl = NULL;
-    Context->EventPageCount = 0;
 }
 
 static BOOLEAN
@@ -314,12 +311,9 @@ EvtchnFifoPollPriority(
     Head = Context->Head[vcpu_id][Priority];
 
     if (Head == 0) {
-        PMDL                        Mdl;
         evtchn_fifo_control_block_t *ControlBlock;
 
-        Mdl = Context->ControlBlockMdl[vcpu_id];
-
-        ControlBlock = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+        ControlBlock = Context->ControlBlock[vcpu_id];
         ASSERT(ControlBlock != NULL);
 
         KeMemoryBarrier();
@@ -327,7 +321,7 @@ EvtchnFifoPollPriority(
     }
 
     Port = Head;
-    EventWord = EvtchnFifoEventWord(Context, Port);
+    EventWord = __EvtchnFifoEventWord(Context, Port);
 
     Head = __EvtchnFifoUnlink(EventWord);
 
@@ -355,7 +349,6 @@ EvtchnFifoPoll(
 {
     PXENBUS_EVTCHN_FIFO_CONTEXT     Context = (PVOID)_Context;
     unsigned int                    vcpu_id;
-    PMDL                            Mdl;
     evtchn_fifo_control_block_t     *ControlBlock;
     ULONG                           Ready;
     ULONG                           Priority;
@@ -368,16 +361,15 @@ EvtchnFifoPoll(
     if (!NT_SUCCESS(status))
         goto done;
 
-    Mdl = Context->ControlBlockMdl[vcpu_id];
-    if (Mdl == NULL)
+    ControlBlock = Context->ControlBlock[vcpu_id];
+    if (ControlBlock == NULL)
         goto done;
 
-    ControlBlock = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
-    ASSERT(ControlBlock != NULL);
-
     Ready = InterlockedExchange((LONG *)&ControlBlock->ready, 0);
 
-    while (_BitScanReverse(&Priority, Ready)) {
+    // Queue 0 is the highest priority (EVTCHN_FIFO_PRIORITY_MAX) so
+    // always service the lowest numbered ready queue first
+    while (_BitScanForward(&Priority, Ready)) {
         DoneSomething |= EvtchnFifoPollPriority(Context,
                                                 vcpu_id,
                                                 Priority,
@@ -431,7 +423,7 @@ EvtchnFifoPortAck(
     PXENBUS_EVTCHN_FIFO_CONTEXT     Context = (PVOID)_Context;
     event_word_t                    *EventWord;
 
-    EventWord = EvtchnFifoEventWord(Context, Port);
+    EventWord = __EvtchnFifoEventWord(Context, Port);
     __EvtchnFifoClearFlag(EventWord, EVTCHN_FIFO_PENDING);
 }
 
@@ -444,7 +436,7 @@ EvtchnFifoPortMask(
     PXENBUS_EVTCHN_FIFO_CONTEXT     Context = (PVOID)_Context;
     event_word_t                    *EventWord;
 
-    EventWord = EvtchnFifoEventWord(Context, Port);
+    EventWord = __EvtchnFifoEventWord(Context, Port);
     __EvtchnFifoSetFlag(EventWord, EVTCHN_FIFO_MASKED);
 }
 
@@ -459,7 +451,7 @@ EvtchnFifoPortUnmask(
     LONG                            Old;
     LONG                            New;
 
-    EventWord = EvtchnFifoEventWord(Context, Port);
+    EventWord = __EvtchnFifoEventWord(Context, Port);
 
     // Clear masked bit, spinning if busy
     do {
@@ -528,6 +520,9 @@ EvtchnFifoAcquire(
                   Address.LowPart);
 
         Context->ControlBlockMdl[vcpu_id] = Mdl;
+        Context->ControlBlock[vcpu_id] = MmGetSystemAddressForMdlSafe(Mdl,
+                                                                      NormalPagePriority);
+        ASSERT(Context->ControlBlock[vcpu_id] != NULL);
 
         Index++;
     }
@@ -555,6 +550,7 @@ fail1:
 
         Mdl = Context->ControlBlockMdl[vcpu_id];
         Context->ControlBlockMdl[vcpu_id] = NULL;
+        Context->ControlBlock[vcpu_id] = NULL;
 
         __FreePage(Mdl);
     }
@@ -595,6 +591,7 @@ EvtchnFifoRelease(
             continue;
 
         Context->ControlBlockMdl[vcpu_id] = NULL;
+        Context->ControlBlock[vcpu_id] = NULL;
 
         __FreePage(Mdl);
     }
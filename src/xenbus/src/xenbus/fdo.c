@@ -2864,6 +2864,7 @@ found:
     status = XENBUS_RANGE_SET(Create,
                               &Fdo->RangeSetInterface,
                               "io_space",
+                              XENBUS_RANGE_SET_TYPE_LIST,
                               &Fdo->IoRangeSet);
     if (!NT_SUCCESS(status))
         goto fail2;
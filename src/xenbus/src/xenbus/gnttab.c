@@ -37,6 +37,7 @@
 #include "gnttab.h"
 #include "fdo.h"
 #include "range_set.h"
+#include "registry.h"
 #include "dbg_print.h"
 #include "assert.h"
 #include "util.h"
@@ -50,6 +51,11 @@
 
 #define XENBUS_GNTTAB_ENTRY_MAGIC 'DTNG'
 
+// Number of frames mapped when the interface is first acquired, unless
+// overridden by the GnttabInitialFrameCount parameter. This covers the
+// rings of a typical set of frontends without any on-demand expansion.
+#define XENBUS_GNTTAB_DEFAULT_INITIAL_FRAME_COUNT   16
+
 #define MAXNAMELEN  128
 
 struct _XENBUS_GNTTAB_CACHE {
@@ -78,8 +84,13 @@ struct _XENBUS_GNTTAB_CONTEXT {
     KSPIN_LOCK                  Lock;
     LONG                        References;
     ULONG                       MaximumFrameCount;
+    ULONG                       InitialFrameCount;
     PHYSICAL_ADDRESS            Address;
+    KSPIN_LOCK                  ExpandLock;
     LONG                        FrameIndex;
+    LONG                        ExpandCount;
+    LONG                        ExhaustedCount;
+    LONG                        FailedCount;
     grant_entry_v1_t            *Table;
     XENBUS_RANGE_SET_INTERFACE  RangeSetInterface;
     PXENBUS_RANGE_SET           RangeSet;
@@ -111,41 +122,120 @@ __GnttabFree(
 }
 
 static NTSTATUS
-GnttabExpand(
-    IN  PXENBUS_GNTTAB_CONTEXT  Context
+GnttabMapFrames(
+    IN  PXENBUS_GNTTAB_CONTEXT  Context,
+    IN  LONG                    Index,
+    IN  LONG                    Count
     )
 {
-    ULONG                       Index;
+    XEN_MULTICALL               Multicall;
+    struct xen_add_to_physmap   op[XEN_MULTICALL_MAXIMUM_ENTRIES];
+    LONG                        End;
+    LONG                        Batch;
     PHYSICAL_ADDRESS            Address;
+    NTSTATUS                    status;
+
+    Address = Context->Address;
+    Address.QuadPart += (ULONGLONG)Index << PAGE_SHIFT;
+
+    // Add the frames to the physmap in batches
+    End = Index + Count;
+    for (; Index < End; Index += Batch) {
+        LONG    Entry;
+
+        Batch = __min(End - Index, XEN_MULTICALL_MAXIMUM_ENTRIES);
+
+        MulticallInitialize(&Multicall);
+
+        for (Entry = 0; Entry < Batch; Entry++) {
+            op[Entry].domid = DOMID_SELF;
+            op[Entry].space = XENMAPSPACE_grant_table;
+            op[Entry].idx = Index + Entry;
+            op[Entry].gpfn = (xen_pfn_t)(Address.QuadPart >> PAGE_SHIFT) + Entry;
+
+            status = MULTICALL_ADD(&Multicall,
+                                   memory_op,
+                                   2,
+                                   (ULONG_PTR)XENMEM_add_to_physmap,
+                                   (ULONG_PTR)&op[Entry]);
+            ASSERT(NT_SUCCESS(status));
+        }
+
+        status = MulticallFlush(&Multicall);
+        if (!NT_SUCCESS(status))
+            goto fail1;
+
+        for (Entry = 0; Entry < Batch; Entry++) {
+            LONG_PTR    rc;
+
+            rc = MulticallResult(&Multicall, (ULONG)Entry);
+            if (rc < 0) {
+                ERRNO_TO_STATUS(-rc, status);
+                goto fail2;
+            }
+
+            LogPrintf(LOG_LEVEL_INFO,
+                      "GNTTAB: MAP XENMAPSPACE_grant_table[%d] @ %08x.%08x\n",
+                      Index + Entry,
+                      Address.HighPart,
+                      Address.LowPart);
+
+            Address.QuadPart += PAGE_SIZE;
+        }
+    }
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+// Add up to Count frames to the table, provided nobody else has expanded
+// it since the caller sampled FrameIndex
+static NTSTATUS
+GnttabExpand(
+    IN  PXENBUS_GNTTAB_CONTEXT  Context,
+    IN  LONG                    FrameIndex,
+    IN  ULONG                   Count
+    )
+{
+    LONG                        Index;
     LONGLONG                    Start;
     LONGLONG                    End;
+    KIRQL                       Irql;
     NTSTATUS                    status;
 
-    Index = InterlockedIncrement(&Context->FrameIndex);
+    KeAcquireSpinLock(&Context->ExpandLock, &Irql);
+
+    if (Context->FrameIndex != FrameIndex)
+        goto done;
+
+    Index = FrameIndex + 1;
 
     status = STATUS_INSUFFICIENT_RESOURCES;
     ASSERT3U(Index, <=, Context->MaximumFrameCount);
-    if (Index == Context->MaximumFrameCount)
+    if ((ULONG)Index == Context->MaximumFrameCount)
         goto fail1;
 
-    Address = Context->Address;
-    Address.QuadPart += (ULONGLONG)Index << PAGE_SHIFT;
+    Count = __min(Count, Context->MaximumFrameCount - Index);
+    ASSERT(Count != 0);
 
-    status = MemoryAddToPhysmap((PFN_NUMBER)(Address.QuadPart >> PAGE_SHIFT),
-                                XENMAPSPACE_grant_table,
-                                Index);
+    status = GnttabMapFrames(Context, Index, (LONG)Count);
     if (!NT_SUCCESS(status))
         goto fail2;
 
-    LogPrintf(LOG_LEVEL_INFO,
-              "GNTTAB: MAP XENMAPSPACE_grant_table[%d] @ %08x.%08x\n",
-              Index,
-              Address.HighPart,
-              Address.LowPart);
+    // Publish the new frames before their references can be handed out
+    (VOID) InterlockedExchange(&Context->FrameIndex, (LONG)(Index + Count - 1));
+    Context->ExpandCount++;
 
     Start = __max(XENBUS_GNTTAB_RESERVED_ENTRY_COUNT,
                   Index * XENBUS_GNTTAB_ENTRY_PER_FRAME);
-    End = ((Index + 1) * XENBUS_GNTTAB_ENTRY_PER_FRAME) - 1;
+    End = ((Index + Count) * XENBUS_GNTTAB_ENTRY_PER_FRAME) - 1;
 
     status = XENBUS_RANGE_SET(Put,
                               &Context->RangeSetInterface,
@@ -155,7 +245,13 @@ GnttabExpand(
     if (!NT_SUCCESS(status))
         goto fail3;
 
-    Info("added references [%08llx - %08llx]\n", Start, End);
+    Info("added references [%08llx - %08llx] (%u frames)\n",
+         Start,
+         End,
+         Count);
+
+done:
+    KeReleaseSpinLock(&Context->ExpandLock, Irql);
 
     return STATUS_SUCCESS;
 
@@ -170,7 +266,9 @@ fail2:
 fail1:
     Error("fail1 (%08x)\n", status);
 
-    (VOID) InterlockedDecrement(&Context->FrameIndex);
+    Context->FailedCount++;
+
+    KeReleaseSpinLock(&Context->ExpandLock, Irql);
 
     return status;
 }
@@ -180,26 +278,14 @@ GnttabMap(
     IN  PXENBUS_GNTTAB_CONTEXT  Context
     )
 {
-    LONG                        Index;
-    PHYSICAL_ADDRESS            Address;
     NTSTATUS                    status;
 
-    Address = Context->Address;
-
-    for (Index = 0; Index <= Context->FrameIndex; Index++) {
-        status = MemoryAddToPhysmap((PFN_NUMBER)(Address.QuadPart >> PAGE_SHIFT),
-                                    XENMAPSPACE_grant_table,
-                                    Index);
-        ASSERT(NT_SUCCESS(status));
-
-        LogPrintf(LOG_LEVEL_INFO,
-                  "GNTTAB: MAP XENMAPSPACE_grant_table[%d] @ %08x.%08x\n",
-                  Index,
-                  Address.HighPart,
-                  Address.LowPart);
+    // Re-map the frames, this is on the resume path
+    if (Context->FrameIndex < 0)
+        return;
 
-        Address.QuadPart += PAGE_SIZE;
-    }
+    status = GnttabMapFrames(Context, 0, Context->FrameIndex + 1);
+    ASSERT(NT_SUCCESS(status));
 }
 
 static VOID
@@ -256,16 +342,24 @@ GnttabEntryCtor(
     PXENBUS_GNTTAB_CONTEXT  Context = Cache->Context;
     PXENBUS_GNTTAB_ENTRY    Entry = Object;
     LONGLONG                Reference;
+    LONG                    FrameIndex;
     NTSTATUS                status;
 
 again:
+    FrameIndex = Context->FrameIndex;
+    KeMemoryBarrier();
+
     status = XENBUS_RANGE_SET(Pop,
                               &Context->RangeSetInterface,
                               Context->RangeSet,
                               1,
                               &Reference);
     if (!NT_SUCCESS(status)) {
-        status = GnttabExpand(Context);
+        (VOID) InterlockedIncrement(&Context->ExhaustedCount);
+
+        // Double the table so that a burst of demand does not have to
+        // expand it one frame at a time
+        status = GnttabExpand(Context, FrameIndex, (ULONG)(FrameIndex + 1));
         if (!NT_SUCCESS(status))
             goto fail1;
 
@@ -585,8 +679,6 @@ GnttabMapForeignPages(
     )
 {
     PXENBUS_GNTTAB_CONTEXT      Context = Interface->Context;
-    LONG                        PageIndex;
-    PHYSICAL_ADDRESS            PageAddress;
     PXENBUS_GNTTAB_MAP_ENTRY    MapEntry;
     NTSTATUS                    status;
 
@@ -604,20 +696,16 @@ GnttabMapForeignPages(
     if (MapEntry == NULL)
         goto fail2;
 
-    PageAddress.QuadPart = Address->QuadPart;
     MapEntry->NumberPages = NumberPages;
 
-    for (PageIndex = 0; PageIndex < (LONG)NumberPages; PageIndex++) {
-        status = GrantTableMapForeignPage(Domain,
-                                          References[PageIndex],
-                                          PageAddress,
-                                          ReadOnly,
-                                          &MapEntry->MapHandles[PageIndex]);
-        if (!NT_SUCCESS(status))
-            goto fail3;
-
-        PageAddress.QuadPart += PAGE_SIZE;
-    }
+    status = GrantTableMapForeignPages(Domain,
+                                       NumberPages,
+                                       References,
+                                       *Address,
+                                       ReadOnly,
+                                       MapEntry->MapHandles);
+    if (!NT_SUCCESS(status))
+        goto fail3;
 
     status = HashTableAdd(Context->MapTable,
                           (ULONG_PTR)Address->QuadPart,
@@ -630,15 +718,13 @@ GnttabMapForeignPages(
 fail4:
     Error("fail4\n");
 
+    (VOID) GrantTableUnmapForeignPages(NumberPages,
+                                       MapEntry->MapHandles,
+                                       *Address);
+
 fail3:
     Error("fail3\n");
 
-    while (--PageIndex >= 0) {
-        PageAddress.QuadPart -= PAGE_SIZE;
-        (VOID) GrantTableUnmapForeignPage(MapEntry->MapHandles[PageIndex],
-                                          PageAddress);
-    }
-
     __GnttabFree(MapEntry);
 
 fail2:
@@ -659,8 +745,6 @@ GnttabUnmapForeignPages(
     )
 {
     PXENBUS_GNTTAB_CONTEXT      Context = Interface->Context;
-    ULONG                       PageIndex;
-    PHYSICAL_ADDRESS            PageAddress;
     PXENBUS_GNTTAB_MAP_ENTRY    MapEntry;
     NTSTATUS                    status;
 
@@ -675,15 +759,10 @@ GnttabUnmapForeignPages(
     if (!NT_SUCCESS(status))
         goto fail2;
 
-    PageAddress.QuadPart = Address.QuadPart;
-
-    for (PageIndex = 0; PageIndex < MapEntry->NumberPages; PageIndex++) {
-        status = GrantTableUnmapForeignPage(MapEntry->MapHandles[PageIndex],
-                                            PageAddress);
-        BUG_ON(!NT_SUCCESS(status));
-
-        PageAddress.QuadPart += PAGE_SIZE;
-    }
+    status = GrantTableUnmapForeignPages(MapEntry->NumberPages,
+                                         MapEntry->MapHandles,
+                                         Address);
+    BUG_ON(!NT_SUCCESS(status));
 
     FdoFreeIoSpace(Context->Fdo,
                    Address,
@@ -730,8 +809,16 @@ GnttabDebugCallback(
     
     XENBUS_DEBUG(Printf,
                  &Context->DebugInterface,
-                 "FrameIndex = %d\n",
-                 Context->FrameIndex);
+                 "FrameIndex = %d (MaximumFrameCount = %u)\n",
+                 Context->FrameIndex,
+                 Context->MaximumFrameCount);
+
+    XENBUS_DEBUG(Printf,
+                 &Context->DebugInterface,
+                 "ExpandCount = %d ExhaustedCount = %d FailedCount = %d\n",
+                 Context->ExpandCount,
+                 Context->ExhaustedCount,
+                 Context->FailedCount);
 }
                      
 NTSTATUS
@@ -784,6 +871,7 @@ GnttabAcquire(
     status = XENBUS_RANGE_SET(Create,
                               &Context->RangeSetInterface,
                               "gnttab",
+                              XENBUS_RANGE_SET_TYPE_TREE,
                               &Context->RangeSet);
     if (!NT_SUCCESS(status))
         goto fail5;
@@ -819,7 +907,7 @@ GnttabAcquire(
         goto fail10;
 
     /* Make sure at least the reserved refrences are present */
-    status = GnttabExpand(Context);
+    status = GnttabExpand(Context, -1, Context->InitialFrameCount);
     if (!NT_SUCCESS(status))
         goto fail11;
 
@@ -873,6 +961,9 @@ fail6:
     Context->RangeSet = NULL;
 
     Context->FrameIndex = 0;
+    Context->ExpandCount = 0;
+    Context->ExhaustedCount = 0;
+    Context->FailedCount = 0;
 
 fail5:
     Error("fail5\n");
@@ -953,6 +1044,9 @@ GnttabRelease(
     Context->RangeSet = NULL;
 
     Context->FrameIndex = 0;
+    Context->ExpandCount = 0;
+    Context->ExhaustedCount = 0;
+    Context->FailedCount = 0;
 
     XENBUS_RANGE_SET(Release, &Context->RangeSetInterface);
 
@@ -1018,6 +1112,8 @@ GnttabInitialize(
     OUT PXENBUS_GNTTAB_CONTEXT  *Context
     )
 {
+    HANDLE                      ParametersKey;
+    ULONG                       InitialFrameCount;
     NTSTATUS                    status;
 
     Trace("====>\n");
@@ -1058,6 +1154,17 @@ GnttabInitialize(
 
     InitializeListHead(&(*Context)->List);
     KeInitializeSpinLock(&(*Context)->Lock);
+    KeInitializeSpinLock(&(*Context)->ExpandLock);
+
+    ParametersKey = DriverGetParametersKey();
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "GnttabInitialFrameCount",
+                                     &InitialFrameCount);
+    if (!NT_SUCCESS(status) || InitialFrameCount == 0)
+        InitialFrameCount = XENBUS_GNTTAB_DEFAULT_INITIAL_FRAME_COUNT;
+
+    (*Context)->InitialFrameCount = InitialFrameCount;
 
     status = HashTableCreate(&(*Context)->MapTable);
     if (!NT_SUCCESS(status))
@@ -1170,6 +1277,9 @@ GnttabTeardown(
     HashTableDestroy(Context->MapTable);
     Context->MapTable = NULL;
 
+    Context->InitialFrameCount = 0;
+
+    RtlZeroMemory(&Context->ExpandLock, sizeof (KSPIN_LOCK));
     RtlZeroMemory(&Context->Lock, sizeof (KSPIN_LOCK));
     RtlZeroMemory(&Context->List, sizeof (LIST_ENTRY));
 
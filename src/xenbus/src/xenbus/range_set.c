@@ -46,17 +46,29 @@ typedef struct _RANGE {
     LONGLONG    End;
 } RANGE, *PRANGE;
 
+typedef struct _RANGE_NODE {
+    struct _RANGE_NODE  *Left;
+    struct _RANGE_NODE  *Right;
+    LONG                Height;
+    LONGLONG            Start;
+    LONGLONG            End;
+    ULONGLONG           Largest;    // Largest range in this sub-tree
+} RANGE_NODE, *PRANGE_NODE;
+
 #define MAXNAMELEN  128
 
 struct _XENBUS_RANGE_SET {
-    LIST_ENTRY      ListEntry;
-    CHAR            Name[MAXNAMELEN];
-    KSPIN_LOCK      Lock;
-    LIST_ENTRY      List;
-    PLIST_ENTRY     Cursor;
-    ULONG           RangeCount;
-    ULONGLONG       ItemCount;
-    PRANGE          Spare;
+    LIST_ENTRY              ListEntry;
+    CHAR                    Name[MAXNAMELEN];
+    XENBUS_RANGE_SET_TYPE   Type;
+    KSPIN_LOCK              Lock;
+    LIST_ENTRY              List;
+    PLIST_ENTRY             Cursor;
+    PRANGE_NODE             Root;
+    ULONG                   RangeCount;
+    ULONGLONG               ItemCount;
+    PRANGE                  Spare;
+    PRANGE_NODE             SpareNode;
 };
 
 struct _XENBUS_RANGE_SET_CONTEXT {
@@ -179,6 +191,468 @@ RangeSetMergeForwards(
     RangeSetRemove(RangeSet, TRUE);
 }
 
+//
+// Balanced (AVL) tree implementation. Nodes are keyed on Start and each
+// node records the largest range in its sub-tree so that a first-fit
+// search for Pop() need only visit one path from the root.
+//
+
+static FORCEINLINE LONG
+__RangeNodeHeight(
+    IN  PRANGE_NODE Node
+    )
+{
+    return (Node != NULL) ? Node->Height : 0;
+}
+
+static FORCEINLINE ULONGLONG
+__RangeNodeLargest(
+    IN  PRANGE_NODE Node
+    )
+{
+    return (Node != NULL) ? Node->Largest : 0;
+}
+
+static FORCEINLINE VOID
+__RangeNodeUpdate(
+    IN  PRANGE_NODE Node
+    )
+{
+    ULONGLONG       Largest;
+
+    Node->Height = 1 + __max(__RangeNodeHeight(Node->Left),
+                             __RangeNodeHeight(Node->Right));
+
+    Largest = (ULONGLONG)(Node->End + 1 - Node->Start);
+    Largest = __max(Largest, __RangeNodeLargest(Node->Left));
+    Largest = __max(Largest, __RangeNodeLargest(Node->Right));
+
+    Node->Largest = Largest;
+}
+
+static PRANGE_NODE
+RangeNodeRotateRight(
+    IN  PRANGE_NODE Node
+    )
+{
+    PRANGE_NODE     Left = Node->Left;
+
+    Node->Left = Left->Right;
+    Left->Right = Node;
+
+    __RangeNodeUpdate(Node);
+    __RangeNodeUpdate(Left);
+
+    return Left;
+}
+
+static PRANGE_NODE
+RangeNodeRotateLeft(
+    IN  PRANGE_NODE Node
+    )
+{
+    PRANGE_NODE     Right = Node->Right;
+
+    Node->Right = Right->Left;
+    Right->Left = Node;
+
+    __RangeNodeUpdate(Node);
+    __RangeNodeUpdate(Right);
+
+    return Right;
+}
+
+static PRANGE_NODE
+RangeNodeBalance(
+    IN  PRANGE_NODE Node
+    )
+{
+    LONG            Balance;
+
+    __RangeNodeUpdate(Node);
+
+    Balance = __RangeNodeHeight(Node->Left) - __RangeNodeHeight(Node->Right);
+
+    if (Balance > 1) {
+        if (__RangeNodeHeight(Node->Left->Left) <
+            __RangeNodeHeight(Node->Left->Right))
+            Node->Left = RangeNodeRotateLeft(Node->Left);
+
+        return RangeNodeRotateRight(Node);
+    }
+
+    if (Balance < -1) {
+        if (__RangeNodeHeight(Node->Right->Right) <
+            __RangeNodeHeight(Node->Right->Left))
+            Node->Right = RangeNodeRotateRight(Node->Right);
+
+        return RangeNodeRotateLeft(Node);
+    }
+
+    return Node;
+}
+
+static PRANGE_NODE
+RangeNodeInsert(
+    IN  PRANGE_NODE Root,
+    IN  PRANGE_NODE Node
+    )
+{
+    if (Root == NULL) {
+        Node->Left = Node->Right = NULL;
+        __RangeNodeUpdate(Node);
+        return Node;
+    }
+
+    ASSERT(Node->End < Root->Start || Node->Start > Root->End);
+
+    if (Node->Start < Root->Start)
+        Root->Left = RangeNodeInsert(Root->Left, Node);
+    else
+        Root->Right = RangeNodeInsert(Root->Right, Node);
+
+    return RangeNodeBalance(Root);
+}
+
+static PRANGE_NODE
+RangeNodeRemoveMinimum(
+    IN  PRANGE_NODE Root,
+    OUT PRANGE_NODE *Minimum
+    )
+{
+    if (Root->Left == NULL) {
+        *Minimum = Root;
+        return Root->Right;
+    }
+
+    Root->Left = RangeNodeRemoveMinimum(Root->Left, Minimum);
+
+    return RangeNodeBalance(Root);
+}
+
+static PRANGE_NODE
+RangeNodeRemove(
+    IN  PRANGE_NODE Root,
+    IN  PRANGE_NODE Node
+    )
+{
+    ASSERT(Root != NULL);
+
+    if (Node->Start < Root->Start) {
+        Root->Left = RangeNodeRemove(Root->Left, Node);
+    } else if (Node->Start > Root->Start) {
+        Root->Right = RangeNodeRemove(Root->Right, Node);
+    } else {
+        PRANGE_NODE Minimum;
+
+        ASSERT3P(Root, ==, Node);
+
+        if (Node->Right == NULL)
+            return Node->Left;
+
+        Root = RangeNodeRemoveMinimum(Node->Right, &Minimum);
+
+        Minimum->Right = Root;
+        Minimum->Left = Node->Left;
+        Root = Minimum;
+    }
+
+    return RangeNodeBalance(Root);
+}
+
+// Find the range with the highest Start that is <= Value
+static PRANGE_NODE
+RangeNodeFloor(
+    IN  PRANGE_NODE Root,
+    IN  LONGLONG    Value
+    )
+{
+    PRANGE_NODE     Floor = NULL;
+
+    while (Root != NULL) {
+        if (Root->Start <= Value) {
+            Floor = Root;
+            Root = Root->Right;
+        } else {
+            Root = Root->Left;
+        }
+    }
+
+    return Floor;
+}
+
+// Find the range with the lowest Start that is > Value
+static PRANGE_NODE
+RangeNodeCeiling(
+    IN  PRANGE_NODE Root,
+    IN  LONGLONG    Value
+    )
+{
+    PRANGE_NODE     Ceiling = NULL;
+
+    while (Root != NULL) {
+        if (Root->Start > Value) {
+            Ceiling = Root;
+            Root = Root->Left;
+        } else {
+            Root = Root->Right;
+        }
+    }
+
+    return Ceiling;
+}
+
+// Find the lowest range with at least Count items
+static PRANGE_NODE
+RangeNodeFirstFit(
+    IN  PRANGE_NODE Root,
+    IN  ULONGLONG   Count
+    )
+{
+    if (__RangeNodeLargest(Root) < Count)
+        return NULL;
+
+    for (;;) {
+        ASSERT(Root != NULL);
+
+        if (__RangeNodeLargest(Root->Left) >= Count)
+            Root = Root->Left;
+        else if ((ULONGLONG)(Root->End + 1 - Root->Start) >= Count)
+            return Root;
+        else
+            Root = Root->Right;
+    }
+}
+
+static FORCEINLINE PRANGE_NODE
+__RangeSetGetNode(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  LONGLONG            Start,
+    IN  LONGLONG            End
+    )
+{
+    PRANGE_NODE             Node;
+
+    if (RangeSet->SpareNode != NULL) {
+        Node = RangeSet->SpareNode;
+        RangeSet->SpareNode = NULL;
+    } else {
+        Node = __RangeSetAllocate(sizeof (RANGE_NODE));
+        if (Node == NULL)
+            return NULL;
+    }
+
+    ASSERT(IsZeroMemory(Node, sizeof (RANGE_NODE)));
+
+    Node->Start = Start;
+    Node->End = End;
+
+    return Node;
+}
+
+static FORCEINLINE VOID
+__RangeSetPutNode(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  PRANGE_NODE         Node
+    )
+{
+    RtlZeroMemory(Node, sizeof (RANGE_NODE));
+
+    if (RangeSet->SpareNode == NULL)
+        RangeSet->SpareNode = Node;
+    else
+        __RangeSetFree(Node);
+}
+
+static FORCEINLINE VOID
+__RangeSetTreeInsert(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  PRANGE_NODE         Node
+    )
+{
+    RangeSet->Root = RangeNodeInsert(RangeSet->Root, Node);
+    RangeSet->RangeCount++;
+}
+
+static FORCEINLINE VOID
+__RangeSetTreeRemove(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  PRANGE_NODE         Node
+    )
+{
+    RangeSet->Root = RangeNodeRemove(RangeSet->Root, Node);
+
+    ASSERT(RangeSet->RangeCount != 0);
+    --RangeSet->RangeCount;
+
+    Node->Left = Node->Right = NULL;
+    Node->Height = 0;
+    Node->Largest = 0;
+}
+
+static NTSTATUS
+RangeSetTreePop(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  ULONGLONG           Count,
+    OUT PLONGLONG           Start
+    )
+{
+    PRANGE_NODE             Node;
+    NTSTATUS                status;
+
+    Node = RangeNodeFirstFit(RangeSet->Root, Count);
+
+    status = STATUS_INSUFFICIENT_RESOURCES;
+    if (Node == NULL)
+        goto fail1;
+
+    *Start = Node->Start;
+
+    // Trimming the front of a range does not change the order of the
+    // tree but the Largest values on the path to it must be refreshed,
+    // so take it out and put it back.
+    __RangeSetTreeRemove(RangeSet, Node);
+
+    Node->Start += Count;
+    if (Node->Start > Node->End)
+        __RangeSetPutNode(RangeSet, Node);
+    else
+        __RangeSetTreeInsert(RangeSet, Node);
+
+    ASSERT3U(RangeSet->ItemCount, >=, Count);
+    RangeSet->ItemCount -= Count;
+
+    return STATUS_SUCCESS;
+
+fail1:
+    return status;
+}
+
+static NTSTATUS
+RangeSetTreePut(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  LONGLONG            Start,
+    IN  LONGLONG            End
+    )
+{
+    PRANGE_NODE             Previous;
+    PRANGE_NODE             Next;
+    PRANGE_NODE             Node;
+    NTSTATUS                status;
+
+    Previous = RangeNodeFloor(RangeSet->Root, Start);
+    ASSERT(Previous == NULL || Previous->End < Start);
+
+    Next = RangeNodeCeiling(RangeSet->Root, Start);
+    ASSERT(Next == NULL || Next->Start > End);
+
+    if (Previous != NULL && Previous->End != Start - 1)
+        Previous = NULL;    // Not touching
+
+    if (Next != NULL && Next->Start != End + 1)
+        Next = NULL;        // Not touching
+
+    if (Previous != NULL) {
+        __RangeSetTreeRemove(RangeSet, Previous);
+        Start = Previous->Start;
+
+        Node = Previous;
+    } else if (Next != NULL) {
+        Node = NULL;
+    } else {
+        Node = __RangeSetGetNode(RangeSet, Start, End);
+
+        status = STATUS_NO_MEMORY;
+        if (Node == NULL)
+            goto fail1;
+    }
+
+    if (Next != NULL) {
+        __RangeSetTreeRemove(RangeSet, Next);
+        End = Next->End;
+
+        if (Node == NULL)
+            Node = Next;
+        else
+            __RangeSetPutNode(RangeSet, Next);
+    }
+
+    ASSERT(Node != NULL);
+
+    Node->Start = Start;
+    Node->End = End;
+
+    __RangeSetTreeInsert(RangeSet, Node);
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+static NTSTATUS
+RangeSetTreeGet(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  LONGLONG            Start,
+    IN  LONGLONG            End
+    )
+{
+    PRANGE_NODE             Node;
+    PRANGE_NODE             Split;
+    NTSTATUS                status;
+
+    Node = RangeNodeFloor(RangeSet->Root, Start);
+
+    status = STATUS_OBJECT_NAME_NOT_FOUND;
+    if (Node == NULL || Node->End < End)
+        goto fail1;
+
+    ASSERT3S(Start, >=, Node->Start);
+
+    Split = NULL;
+    if (Start != Node->Start && End != Node->End) {
+        // We need to split a range
+        Split = __RangeSetGetNode(RangeSet, End + 1, Node->End);
+
+        status = STATUS_NO_MEMORY;
+        if (Split == NULL)
+            goto fail2;
+    }
+
+    if (Start == Node->Start) {
+        // Trimming the front needs to re-key the node
+        __RangeSetTreeRemove(RangeSet, Node);
+
+        Node->Start = End + 1;
+        if (Node->Start > Node->End)
+            __RangeSetPutNode(RangeSet, Node);
+        else
+            __RangeSetTreeInsert(RangeSet, Node);
+    } else {
+        // Trimming the back keeps the key but the Largest values on
+        // the path to the node must be refreshed
+        __RangeSetTreeRemove(RangeSet, Node);
+
+        Node->End = Start - 1;
+        __RangeSetTreeInsert(RangeSet, Node);
+
+        if (Split != NULL)
+            __RangeSetTreeInsert(RangeSet, Split);
+    }
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
 static NTSTATUS
 RangeSetPop(
     IN  PINTERFACE          Interface,
@@ -201,6 +675,16 @@ RangeSetPop(
 
     KeAcquireSpinLock(&RangeSet->Lock, &Irql);
 
+    if (RangeSet->Type == XENBUS_RANGE_SET_TYPE_TREE) {
+        status = RangeSetTreePop(RangeSet, Count, Start);
+        if (!NT_SUCCESS(status))
+            goto fail2;
+
+        KeReleaseSpinLock(&RangeSet->Lock, Irql);
+
+        return STATUS_SUCCESS;
+    }
+
     status = STATUS_INSUFFICIENT_RESOURCES;
 
     if (__RangeSetIsEmpty(RangeSet))
@@ -213,6 +697,8 @@ RangeSetPop(
 
         if ((ULONGLONG)(Range->End + 1 - Range->Start) >= Count)
             goto found;
+
+        Cursor = Cursor->Flink;
     }
 
     goto fail3;
@@ -341,6 +827,14 @@ RangeSetGet(
 
     KeAcquireSpinLock(&RangeSet->Lock, &Irql);
 
+    if (RangeSet->Type == XENBUS_RANGE_SET_TYPE_TREE) {
+        status = RangeSetTreeGet(RangeSet, Start, End);
+        if (!NT_SUCCESS(status))
+            goto fail2;
+
+        goto done;
+    }
+
     Cursor = RangeSet->Cursor;
     ASSERT(Cursor != &RangeSet->List);
 
@@ -527,7 +1021,9 @@ RangeSetPut(
 
     Cursor = RangeSet->Cursor;
 
-    if (__RangeSetIsEmpty(RangeSet)) {
+    if (RangeSet->Type == XENBUS_RANGE_SET_TYPE_TREE) {
+        status = RangeSetTreePut(RangeSet, Start, End);
+    } else if (__RangeSetIsEmpty(RangeSet)) {
         status = RangeSetAdd(RangeSet, Start, End, TRUE);
     } else {
         PRANGE  Range;
@@ -566,6 +1062,7 @@ NTSTATUS
 RangeSetCreate(
     IN  PINTERFACE              Interface,
     IN  const CHAR              *Name,
+    IN  XENBUS_RANGE_SET_TYPE   Type,
     OUT PXENBUS_RANGE_SET       *RangeSet
     )
 {
@@ -575,18 +1072,25 @@ RangeSetCreate(
 
     Trace("====> (%s)\n", Name);
 
+    status = STATUS_INVALID_PARAMETER;
+    if (Type != XENBUS_RANGE_SET_TYPE_LIST &&
+        Type != XENBUS_RANGE_SET_TYPE_TREE)
+        goto fail1;
+
     *RangeSet = __RangeSetAllocate(sizeof (XENBUS_RANGE_SET));
 
     status = STATUS_NO_MEMORY;
     if (*RangeSet == NULL)
-        goto fail1;
+        goto fail2;
 
     status = RtlStringCbPrintfA((*RangeSet)->Name,
                                 sizeof ((*RangeSet)->Name),
                                 "%s",
                                 Name);
     if (!NT_SUCCESS(status))
-        goto fail2;
+        goto fail3;
+
+    (*RangeSet)->Type = Type;
 
     KeInitializeSpinLock(&(*RangeSet)->Lock);
     InitializeListHead(&(*RangeSet)->List);
@@ -600,20 +1104,36 @@ RangeSetCreate(
 
     return STATUS_SUCCESS;
 
-fail2:
-    Error("fail2\n");
+fail3:
+    Error("fail3\n");
 
     RtlZeroMemory((*RangeSet)->Name, sizeof ((*RangeSet)->Name));
 
     ASSERT(IsZeroMemory(*RangeSet, sizeof (XENBUS_RANGE_SET)));
     __RangeSetFree(*RangeSet);
 
+fail2:
+    Error("fail2\n");
+
 fail1:
     Error("fail1 (%08x)\n", status);
 
     return status;
 }
 
+static NTSTATUS
+RangeSetCreateVersion1(
+    IN  PINTERFACE              Interface,
+    IN  const CHAR              *Name,
+    OUT PXENBUS_RANGE_SET       *RangeSet
+    )
+{
+    return RangeSetCreate(Interface,
+                          Name,
+                          XENBUS_RANGE_SET_TYPE_LIST,
+                          RangeSet);
+}
+
 VOID
 RangeSetDestroy(
     IN  PINTERFACE              Interface,
@@ -635,8 +1155,15 @@ RangeSetDestroy(
         __RangeSetFree(RangeSet->Spare);
         RangeSet->Spare = NULL;
     }
+
+    if (RangeSet->SpareNode != NULL) {
+        __RangeSetFree(RangeSet->SpareNode);
+        RangeSet->SpareNode = NULL;
+    }
         
     ASSERT(__RangeSetIsEmpty(RangeSet));
+    ASSERT3P(RangeSet->Root, ==, NULL);
+    RangeSet->Type = XENBUS_RANGE_SET_TYPE_INVALID;
     RtlZeroMemory(&RangeSet->List, sizeof (LIST_ENTRY));
     RtlZeroMemory(&RangeSet->Lock, sizeof (KSPIN_LOCK));
 
@@ -650,6 +1177,37 @@ RangeSetDestroy(
     Trace("<====\n");
 }
 
+static VOID
+RangeSetDumpTree(
+    IN      PXENBUS_RANGE_SET_CONTEXT   Context,
+    IN      PRANGE_NODE                 Node,
+    IN OUT  PULONG                      Count
+    )
+{
+    if (Node == NULL || *Count > 8)
+        return;
+
+    RangeSetDumpTree(Context, Node->Left, Count);
+
+    if (*Count > 8)
+        return;
+
+    XENBUS_DEBUG(Printf,
+                 &Context->DebugInterface,
+                 "   {%llx - %llx}\n",
+                 Node->Start,
+                 Node->End);
+
+    if (++(*Count) > 8) {
+        XENBUS_DEBUG(Printf,
+                     &Context->DebugInterface,
+                     "   ...\n");
+        return;
+    }
+
+    RangeSetDumpTree(Context, Node->Right, Count);
+}
+
 static VOID
 RangeSetDump(
     IN  PXENBUS_RANGE_SET_CONTEXT   Context,
@@ -658,10 +1216,22 @@ RangeSetDump(
 {
     XENBUS_DEBUG(Printf,
                  &Context->DebugInterface,
-                 " - %s:\n",
-                 RangeSet->Name);
+                 " - %s: (%s, %u ranges, %llu items)\n",
+                 RangeSet->Name,
+                 (RangeSet->Type == XENBUS_RANGE_SET_TYPE_TREE) ? "TREE" : "LIST",
+                 RangeSet->RangeCount,
+                 RangeSet->ItemCount);
 
-    if (IsListEmpty(&RangeSet->List)) {
+    if (RangeSet->Type == XENBUS_RANGE_SET_TYPE_TREE) {
+        ULONG   Count = 0;
+
+        if (RangeSet->Root == NULL)
+            XENBUS_DEBUG(Printf,
+                         &Context->DebugInterface,
+                         "   EMPTY\n");
+        else
+            RangeSetDumpTree(Context, RangeSet->Root, &Count);
+    } else if (IsListEmpty(&RangeSet->List)) {
         XENBUS_DEBUG(Printf,
                      &Context->DebugInterface,
                      "   EMPTY\n");
@@ -810,6 +1380,17 @@ static struct _XENBUS_RANGE_SET_INTERFACE_V1 RangeSetInterfaceVersion1 = {
     { sizeof (struct _XENBUS_RANGE_SET_INTERFACE_V1), 1, NULL, NULL, NULL },
     RangeSetAcquire,
     RangeSetRelease,
+    RangeSetCreateVersion1,
+    RangeSetPut,
+    RangeSetPop,
+    RangeSetGet,
+    RangeSetDestroy
+};
+
+static struct _XENBUS_RANGE_SET_INTERFACE_V2 RangeSetInterfaceVersion2 = {
+    { sizeof (struct _XENBUS_RANGE_SET_INTERFACE_V2), 2, NULL, NULL, NULL },
+    RangeSetAcquire,
+    RangeSetRelease,
     RangeSetCreate,
     RangeSetPut,
     RangeSetPop,
@@ -885,6 +1466,23 @@ RangeSetGetInterface(
         status = STATUS_SUCCESS;
         break;
     }
+    case 2: {
+        struct _XENBUS_RANGE_SET_INTERFACE_V2  *RangeSetInterface;
+
+        RangeSetInterface = (struct _XENBUS_RANGE_SET_INTERFACE_V2 *)Interface;
+
+        status = STATUS_BUFFER_OVERFLOW;
+        if (Size < sizeof (struct _XENBUS_RANGE_SET_INTERFACE_V2))
+            break;
+
+        *RangeSetInterface = RangeSetInterfaceVersion2;
+
+        ASSERT3U(Interface->Version, ==, Version);
+        Interface->Context = Context;
+
+        status = STATUS_SUCCESS;
+        break;
+    }
     default:
         status = STATUS_NOT_SUPPORTED;
         break;
@@ -42,17 +42,41 @@
 #define XENBUS_SHARED_INFO_EVTCHN_PER_SELECTOR     (sizeof (ULONG_PTR) * 8)
 #define XENBUS_SHARED_INFO_EVTCHN_SELECTOR_COUNT   (RTL_FIELD_SIZE(shared_info_t, evtchn_pending) / sizeof (ULONG_PTR))
 
+// A copy of the vCPU time information and the wallclock, in a page of its
+// own so that it can be mapped into user processes without exposing the
+// rest of the shared info page
+typedef struct _XENBUS_SHARED_INFO_TIME_PAGE {
+    struct vcpu_time_info   TimeInfo[XEN_LEGACY_MAX_VCPUS];
+    uint32_t                wc_version;
+    uint32_t                wc_sec;
+    uint32_t                wc_nsec;
+} XENBUS_SHARED_INFO_TIME_PAGE, *PXENBUS_SHARED_INFO_TIME_PAGE;
+
+C_ASSERT(sizeof (XENBUS_SHARED_INFO_TIME_PAGE) <= PAGE_SIZE);
+
+// How often the copy is brought up to date. Readers extrapolate from the
+// last published sample so this only bounds how stale the scaling is.
+#define XENBUS_SHARED_INFO_TIME_PERIOD  100 // ms
+
+#define TIME_US(_us)        ((_us) * 10)
+#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
+#define TIME_RELATIVE(_t)   (-(_t))
+
 struct _XENBUS_SHARED_INFO_CONTEXT {
-    PXENBUS_FDO                 Fdo;
-    KSPIN_LOCK                  Lock;
-    LONG                        References;
-    PHYSICAL_ADDRESS            Address;
-    shared_info_t               *Shared;
-    ULONG                       Port;
-    XENBUS_SUSPEND_INTERFACE    SuspendInterface;
-    PXENBUS_SUSPEND_CALLBACK    SuspendCallbackEarly;
-    XENBUS_DEBUG_INTERFACE      DebugInterface;
-    PXENBUS_DEBUG_CALLBACK      DebugCallback;
+    PXENBUS_FDO                     Fdo;
+    KSPIN_LOCK                      Lock;
+    LONG                            References;
+    PHYSICAL_ADDRESS                Address;
+    shared_info_t                   *Shared;
+    ULONG                           Port;
+    PXENBUS_SHARED_INFO_TIME_PAGE   TimePage;
+    LONG                            TimePageReferences;
+    KTIMER                          TimeTimer;
+    KDPC                            TimeDpc;
+    XENBUS_SUSPEND_INTERFACE        SuspendInterface;
+    PXENBUS_SUSPEND_CALLBACK        SuspendCallbackEarly;
+    XENBUS_DEBUG_INTERFACE          DebugInterface;
+    PXENBUS_DEBUG_CALLBACK          DebugCallback;
 };
 
 #define XENBUS_SHARED_INFO_TAG 'OFNI'
@@ -309,6 +333,107 @@ SharedInfoEvtchnUnmask(
     return SharedInfoTestBit(&Shared->evtchn_pending[SelectorBit], PortBit);
 }
 
+static unsigned int
+SharedInfoGetCurrentVcpu(
+    VOID
+    )
+{
+    ULONG                       Index;
+    unsigned int                vcpu_id;
+    NTSTATUS                    status;
+
+    ASSERT3U(KeGetCurrentIrql(), >=, DISPATCH_LEVEL);
+
+    Index = KeGetCurrentProcessorNumberEx(NULL);
+
+    // Only the first XEN_LEGACY_MAX_VCPUS vCPUs have time information in
+    // the shared info page. Any other vCPU falls back to vCPU 0, whose
+    // values are just as valid provided the TSC is synchronized.
+    status = SystemVirtualCpuIndex(Index, &vcpu_id);
+    if (!NT_SUCCESS(status) || vcpu_id >= XEN_LEGACY_MAX_VCPUS)
+        vcpu_id = 0;
+
+    return vcpu_id;
+}
+
+static ULONGLONG
+SharedInfoReadSystemTime(
+    IN  shared_info_t           *Shared,
+    IN  unsigned int            vcpu_id
+    )
+{
+    struct vcpu_time_info       *TimeInfo;
+    ULONG                       TimeVersion;
+    ULONGLONG                   Timestamp;
+    ULONGLONG                   Tsc;
+    ULONGLONG                   SystemTime;
+    ULONG                       TscSystemMul;
+    CHAR                        TscShift;
+
+    TimeInfo = &Shared->vcpu_info[vcpu_id].time;
+
+    // Loop until we can read a consistent set of values from the same update
+    do {
+        TimeVersion = TimeInfo->version;
+        KeMemoryBarrier();
+
+        // Cached time in nanoseconds since guest boot
+        SystemTime = TimeInfo->system_time;
+
+        // Timestamp counter value when these time values were last updated
+        Timestamp = TimeInfo->tsc_timestamp;
+
+        // Timestamp modifiers
+        TscShift = TimeInfo->tsc_shift;
+        TscSystemMul = TimeInfo->tsc_to_system_mul;
+
+        // Read counter ticks
+        Tsc = __rdtsc();
+        KeMemoryBarrier();
+
+    // Version is incremented to indicate update in progress.
+    // LSB of version is set if update in progress.
+    // Version is incremented again once update has completed.
+    } while (TimeInfo->version != TimeVersion ||
+             (TimeVersion & 1));
+
+    // Number of elapsed ticks since timestamp was captured
+    Tsc -= Timestamp;
+
+    // Scale ticks to nanoseconds
+    if (TscShift >= 0)
+        Tsc <<= TscShift;
+    else
+        Tsc >>= -TscShift;
+
+    // Time in nanoseconds since boot
+    return SystemTime + ((Tsc * TscSystemMul) >> 32);
+}
+
+static ULONGLONG
+SharedInfoGetSystemTime(
+    IN  PINTERFACE              Interface
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT Context = Interface->Context;
+    ULONGLONG                   SystemTime;
+    KIRQL                       Irql;
+
+    // Make sure we don't suspend or move to another vCPU while reading.
+    // Callers that are already at DISPATCH_LEVEL avoid the IRQL change.
+    Irql = KeGetCurrentIrql();
+    if (Irql < DISPATCH_LEVEL)
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+
+    SystemTime = SharedInfoReadSystemTime(Context->Shared,
+                                          SharedInfoGetCurrentVcpu());
+
+    if (Irql < DISPATCH_LEVEL)
+        KeLowerIrql(Irql);
+
+    return SystemTime;
+}
+
 static LARGE_INTEGER
 SharedInfoGetTime(
     IN  PINTERFACE              Interface
@@ -317,14 +442,9 @@ SharedInfoGetTime(
     PXENBUS_SHARED_INFO_CONTEXT Context = Interface->Context;
     shared_info_t               *Shared;
     ULONG                       WcVersion;
-    ULONG                       TimeVersion;
     ULONGLONG                   Seconds;
     ULONGLONG                   NanoSeconds;
-    ULONGLONG                   Timestamp;
-    ULONGLONG                   Tsc;
     ULONGLONG                   SystemTime;
-    ULONG                       TscSystemMul;
-    CHAR                        TscShift;
     LARGE_INTEGER               Now;
     TIME_FIELDS                 Time;
     KIRQL                       Irql;
@@ -334,46 +454,23 @@ SharedInfoGetTime(
 
     Shared = Context->Shared;
 
-    // Loop until we can read a consistent set of values from the same update
+    // Loop until we can read a consistent wallclock
     do {
         WcVersion = Shared->wc_version;
-        TimeVersion = Shared->vcpu_info[0].time.version;
         KeMemoryBarrier();
 
         // Wallclock time at system time zero (guest boot or resume)
         Seconds = Shared->wc_sec;
         NanoSeconds = Shared->wc_nsec;
 
-        // Cached time in nanoseconds since guest boot
-        SystemTime = Shared->vcpu_info[0].time.system_time;
-
-        // Timestamp counter value when these time values were last updated
-        Timestamp = Shared->vcpu_info[0].time.tsc_timestamp;
-
-        // Timestamp modifiers
-        TscShift = Shared->vcpu_info[0].time.tsc_shift;
-        TscSystemMul = Shared->vcpu_info[0].time.tsc_to_system_mul;
+        SystemTime = SharedInfoReadSystemTime(Shared,
+                                              SharedInfoGetCurrentVcpu());
         KeMemoryBarrier();
-
-    // Version is incremented to indicate update in progress.
-    // LSB of version is set if update in progress.
-    // Version is incremented again once update has completed.
     } while (Shared->wc_version != WcVersion ||
-             Shared->vcpu_info[0].time.version != TimeVersion ||
-             (WcVersion & 1) ||
-             (TimeVersion & 1));
-
-    // Read counter ticks
-    Tsc = __rdtsc();
+             (WcVersion & 1));
 
     KeLowerIrql(Irql);
 
-    // Number of elapsed ticks since timestamp was captured
-    Tsc -= Timestamp;
-
-    // Time in nanoseconds since boot
-    SystemTime += ((Tsc << TscShift) * TscSystemMul) >> 32;
-
     Trace("WALLCLOCK TIME AT BOOT: Seconds = %llu NanoSeconds = %llu\n",
           Seconds,
           NanoSeconds);
@@ -405,6 +502,249 @@ SharedInfoGetTime(
     return Now;
 }
 
+static VOID
+SharedInfoReadTimeInfo(
+    IN  struct vcpu_time_info   *Source,
+    OUT struct vcpu_time_info   *TimeInfo
+    )
+{
+    ULONG                       TimeVersion;
+
+    do {
+        TimeVersion = Source->version;
+        KeMemoryBarrier();
+
+        TimeInfo->tsc_timestamp = Source->tsc_timestamp;
+        TimeInfo->system_time = Source->system_time;
+        TimeInfo->tsc_to_system_mul = Source->tsc_to_system_mul;
+        TimeInfo->tsc_shift = Source->tsc_shift;
+        TimeInfo->flags = Source->flags;
+
+        KeMemoryBarrier();
+    } while (Source->version != TimeVersion ||
+             (TimeVersion & 1));
+}
+
+// Readers of the copy follow the same version protocol as readers of
+// the shared info page
+static VOID
+SharedInfoWriteTimeInfo(
+    IN  struct vcpu_time_info   *Destination,
+    IN  struct vcpu_time_info   *TimeInfo
+    )
+{
+    ULONG                       TimeVersion;
+
+    if (Destination->tsc_timestamp == TimeInfo->tsc_timestamp &&
+        Destination->system_time == TimeInfo->system_time &&
+        Destination->tsc_to_system_mul == TimeInfo->tsc_to_system_mul &&
+        Destination->tsc_shift == TimeInfo->tsc_shift &&
+        Destination->flags == TimeInfo->flags)
+        return;
+
+    TimeVersion = Destination->version;
+
+    Destination->version = TimeVersion + 1;
+    KeMemoryBarrier();
+
+    Destination->tsc_timestamp = TimeInfo->tsc_timestamp;
+    Destination->system_time = TimeInfo->system_time;
+    Destination->tsc_to_system_mul = TimeInfo->tsc_to_system_mul;
+    Destination->tsc_shift = TimeInfo->tsc_shift;
+    Destination->flags = TimeInfo->flags;
+
+    KeMemoryBarrier();
+    Destination->version = TimeVersion + 2;
+}
+
+static VOID
+SharedInfoRefreshTimePage(
+    IN  PXENBUS_SHARED_INFO_CONTEXT Context
+    )
+{
+    shared_info_t                   *Shared = Context->Shared;
+    PXENBUS_SHARED_INFO_TIME_PAGE   TimePage = Context->TimePage;
+    struct vcpu_time_info           TimeInfo;
+    unsigned int                    vcpu_id;
+    ULONG                           WcVersion;
+    ULONG                           Seconds;
+    ULONG                           NanoSeconds;
+
+    for (vcpu_id = 0; vcpu_id < XEN_LEGACY_MAX_VCPUS; vcpu_id++) {
+        SharedInfoReadTimeInfo(&Shared->vcpu_info[vcpu_id].time,
+                               &TimeInfo);
+        SharedInfoWriteTimeInfo(&TimePage->TimeInfo[vcpu_id],
+                                &TimeInfo);
+    }
+
+    do {
+        WcVersion = Shared->wc_version;
+        KeMemoryBarrier();
+
+        Seconds = Shared->wc_sec;
+        NanoSeconds = Shared->wc_nsec;
+
+        KeMemoryBarrier();
+    } while (Shared->wc_version != WcVersion ||
+             (WcVersion & 1));
+
+    if (TimePage->wc_sec == Seconds &&
+        TimePage->wc_nsec == NanoSeconds)
+        return;
+
+    WcVersion = TimePage->wc_version;
+
+    TimePage->wc_version = WcVersion + 1;
+    KeMemoryBarrier();
+
+    TimePage->wc_sec = Seconds;
+    TimePage->wc_nsec = NanoSeconds;
+
+    KeMemoryBarrier();
+    TimePage->wc_version = WcVersion + 2;
+}
+
+KDEFERRED_ROUTINE SharedInfoTimeDpc;
+
+VOID
+SharedInfoTimeDpc(
+    IN  PKDPC                       Dpc,
+    IN  PVOID                       _Context,
+    IN  PVOID                       Argument1,
+    IN  PVOID                       Argument2
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT     Context = _Context;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(Argument1);
+    UNREFERENCED_PARAMETER(Argument2);
+
+    KeAcquireSpinLockAtDpcLevel(&Context->Lock);
+
+    // The timer may have fired just as the last reference was dropped
+    if (Context->TimePage != NULL)
+        SharedInfoRefreshTimePage(Context);
+
+    KeReleaseSpinLockFromDpcLevel(&Context->Lock);
+}
+
+static NTSTATUS
+SharedInfoGetTimePage(
+    IN  PINTERFACE                  Interface,
+    OUT PVOID                       *Page,
+    OUT PULONG                      WallClockOffset
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT     Context = Interface->Context;
+    LARGE_INTEGER                   Timeout;
+    KIRQL                           Irql;
+    NTSTATUS                        status;
+
+    KeAcquireSpinLock(&Context->Lock, &Irql);
+
+    ASSERT3U(Context->References, !=, 0);
+
+    if (Context->TimePageReferences++ != 0)
+        goto done;
+
+    // A whole page, so that nothing else shares it
+    Context->TimePage = __SharedInfoAllocate(PAGE_SIZE);
+
+    status = STATUS_NO_MEMORY;
+    if (Context->TimePage == NULL)
+        goto fail1;
+
+    ASSERT3U(BYTE_OFFSET(Context->TimePage), ==, 0);
+
+    SharedInfoRefreshTimePage(Context);
+
+    Timeout.QuadPart = TIME_RELATIVE(TIME_MS(XENBUS_SHARED_INFO_TIME_PERIOD));
+
+    KeSetTimerEx(&Context->TimeTimer,
+                 Timeout,
+                 XENBUS_SHARED_INFO_TIME_PERIOD,
+                 &Context->TimeDpc);
+
+    Info("TIME PAGE @ %p\n", Context->TimePage);
+
+done:
+    *Page = Context->TimePage;
+    *WallClockOffset = FIELD_OFFSET(XENBUS_SHARED_INFO_TIME_PAGE, wc_version);
+
+    KeReleaseSpinLock(&Context->Lock, Irql);
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    --Context->TimePageReferences;
+    ASSERT3U(Context->TimePageReferences, ==, 0);
+    KeReleaseSpinLock(&Context->Lock, Irql);
+
+    return status;
+}
+
+static VOID
+SharedInfoPutTimePage(
+    IN  PINTERFACE                  Interface
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT     Context = Interface->Context;
+    PXENBUS_SHARED_INFO_TIME_PAGE   TimePage;
+    KIRQL                           Irql;
+
+    KeAcquireSpinLock(&Context->Lock, &Irql);
+
+    ASSERT3U(Context->TimePageReferences, !=, 0);
+    if (--Context->TimePageReferences > 0) {
+        KeReleaseSpinLock(&Context->Lock, Irql);
+        return;
+    }
+
+    (VOID) KeCancelTimer(&Context->TimeTimer);
+
+    TimePage = Context->TimePage;
+    Context->TimePage = NULL;
+
+    KeReleaseSpinLock(&Context->Lock, Irql);
+
+    Info("TIME PAGE @ %p\n", TimePage);
+
+    __SharedInfoFree(TimePage);
+}
+
+static NTSTATUS
+SharedInfoGetTimeInfoOffset(
+    IN  PINTERFACE              Interface,
+    IN  ULONG                   Index,
+    OUT PULONG                  Offset
+    )
+{
+    unsigned int                vcpu_id;
+    NTSTATUS                    status;
+
+    UNREFERENCED_PARAMETER(Interface);
+
+    status = SystemVirtualCpuIndex(Index, &vcpu_id);
+    if (!NT_SUCCESS(status))
+        goto fail1;
+
+    if (vcpu_id >= XEN_LEGACY_MAX_VCPUS)
+        vcpu_id = 0;
+
+    *Offset = FIELD_OFFSET(XENBUS_SHARED_INFO_TIME_PAGE, TimeInfo) +
+              (vcpu_id * sizeof (struct vcpu_time_info));
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
 static VOID
 SharedInfoMap(
     IN  PXENBUS_SHARED_INFO_CONTEXT Context
@@ -447,6 +787,51 @@ SharedInfoSuspendCallbackEarly(
     SharedInfoEvtchnMaskAll(Context);
 }
 
+static VOID
+SharedInfoDebugHypercallProfile(
+    IN  PXENBUS_SHARED_INFO_CONTEXT Context
+    )
+{
+    ULONG                           Index;
+    const CHAR                      *Name;
+    ULONG64                         Count;
+    ULONG64                         Cycles;
+    NTSTATUS                        status;
+
+    for (Index = 0; ; Index++) {
+        status = HypercallQueryProfile(Index, &Name, &Count, &Cycles);
+        if (!NT_SUCCESS(status))
+            break;
+
+        if (Count == 0)
+            continue;
+
+        XENBUS_DEBUG(Printf,
+                     &Context->DebugInterface,
+                     "HYPERCALL: %s: COUNT = %llu CYCLES = %llu (AVERAGE = %llu)\n",
+                     Name,
+                     Count,
+                     Cycles,
+                     Cycles / Count);
+    }
+
+    if (status == STATUS_NOT_SUPPORTED)
+        return;
+
+    for (Index = 0; ; Index++) {
+        status = HypercallQueryModuleProfile(Index, &Name, &Count, &Cycles);
+        if (!NT_SUCCESS(status))
+            break;
+
+        XENBUS_DEBUG(Printf,
+                     &Context->DebugInterface,
+                     "HYPERCALL: MODULE %s: COUNT = %llu CYCLES = %llu\n",
+                     Name,
+                     Count,
+                     Cycles);
+    }
+}
+
 static VOID
 SharedInfoDebugCallback(
     IN  PVOID                   Argument,
@@ -461,6 +846,8 @@ SharedInfoDebugCallback(
                  Context->Address.HighPart,
                  Context->Address.LowPart);
 
+    SharedInfoDebugHypercallProfile(Context);
+
     if (!Crashing) {
         shared_info_t   *Shared;
         ULONG           Index;
@@ -649,6 +1036,9 @@ SharedInfoRelease (
 
     Trace("====>\n");
 
+    // The refresh DPC reads Context->Shared
+    ASSERT3U(Context->TimePageReferences, ==, 0);
+
     Context->Port = 0;
 
     XENBUS_DEBUG(Deregister,
@@ -690,6 +1080,22 @@ static struct _XENBUS_SHARED_INFO_INTERFACE_V2 SharedInfoInterfaceVersion2 = {
     SharedInfoEvtchnUnmask,
     SharedInfoGetTime
 };
+
+static struct _XENBUS_SHARED_INFO_INTERFACE_V3 SharedInfoInterfaceVersion3 = {
+    { sizeof (struct _XENBUS_SHARED_INFO_INTERFACE_V3), 3, NULL, NULL, NULL },
+    SharedInfoAcquire,
+    SharedInfoRelease,
+    SharedInfoUpcallPending,
+    SharedInfoEvtchnPoll,
+    SharedInfoEvtchnAck,
+    SharedInfoEvtchnMask,
+    SharedInfoEvtchnUnmask,
+    SharedInfoGetTime,
+    SharedInfoGetSystemTime,
+    SharedInfoGetTimePage,
+    SharedInfoPutTimePage,
+    SharedInfoGetTimeInfoOffset
+};
                      
 NTSTATUS
 SharedInfoInitialize(
@@ -708,6 +1114,8 @@ SharedInfoInitialize(
         goto fail1;
 
     KeInitializeSpinLock(&(*Context)->Lock);
+    KeInitializeTimer(&(*Context)->TimeTimer);
+    KeInitializeDpc(&(*Context)->TimeDpc, SharedInfoTimeDpc, *Context);
 
     status = SuspendGetInterface(FdoGetSuspendContext(Fdo),
                                  XENBUS_SUSPEND_INTERFACE_VERSION_MAX,
@@ -765,6 +1173,23 @@ SharedInfoGetInterface(
         status = STATUS_SUCCESS;
         break;
     }
+    case 3: {
+        struct _XENBUS_SHARED_INFO_INTERFACE_V3 *SharedInfoInterface;
+
+        SharedInfoInterface = (struct _XENBUS_SHARED_INFO_INTERFACE_V3 *)Interface;
+
+        status = STATUS_BUFFER_OVERFLOW;
+        if (Size < sizeof (struct _XENBUS_SHARED_INFO_INTERFACE_V3))
+            break;
+
+        *SharedInfoInterface = SharedInfoInterfaceVersion3;
+
+        ASSERT3U(Interface->Version, ==, Version);
+        Interface->Context = Context;
+
+        status = STATUS_SUCCESS;
+        break;
+    }
     default:
         status = STATUS_NOT_SUPPORTED;
         break;
@@ -790,6 +1215,11 @@ SharedInfoTeardown(
 
     Context->Fdo = NULL;
 
+    ASSERT3P(Context->TimePage, ==, NULL);
+
+    RtlZeroMemory(&Context->TimeDpc, sizeof (KDPC));
+    RtlZeroMemory(&Context->TimeTimer, sizeof (KTIMER));
+
     RtlZeroMemory(&Context->DebugInterface,
                   sizeof (XENBUS_DEBUG_INTERFACE));
 
@@ -916,18 +916,27 @@ StoreSubmitRequest(
 
     Request->State = XENBUS_STORE_REQUEST_SUBMITTED;
 
-    Count = XENBUS_EVTCHN(GetCount,
-                          &Context->EvtchnInterface,
-                          Context->Channel);
-
-    StorePollLocked(Context);
-    KeMemoryBarrier();
-
     Timeout.QuadPart = TIME_RELATIVE(TIME_S(XENBUS_STORE_POLL_PERIOD));
 
-    while (Request->State != XENBUS_STORE_REQUEST_COMPLETED) {
+    // The lock is dropped while waiting so that requests from other
+    // vCPUs can be queued behind this one. Whoever polls next sends
+    // everything submitted so far with a single notification, and
+    // completes any request whose response has arrived.
+    for (;;) {
         NTSTATUS    status;
 
+        Count = XENBUS_EVTCHN(GetCount,
+                              &Context->EvtchnInterface,
+                              Context->Channel);
+
+        StorePollLocked(Context);
+        KeMemoryBarrier();
+
+        if (Request->State == XENBUS_STORE_REQUEST_COMPLETED)
+            break;
+
+        KeReleaseSpinLockFromDpcLevel(&Context->Lock);
+
         status = XENBUS_EVTCHN(Wait,
                                &Context->EvtchnInterface,
                                Context->Channel,
@@ -936,12 +945,7 @@ StoreSubmitRequest(
         if (status == STATUS_TIMEOUT)
             Warning("TIMED OUT\n");
 
-        Count = XENBUS_EVTCHN(GetCount,
-                              &Context->EvtchnInterface,
-                              Context->Channel);
-
-        StorePollLocked(Context);
-        KeMemoryBarrier();
+        KeAcquireSpinLockAtDpcLevel(&Context->Lock);
     }
 
     KeReleaseSpinLockFromDpcLevel(&Context->Lock);
@@ -45,8 +45,46 @@ struct _XENBUS_SUSPEND_CALLBACK {
     LIST_ENTRY  ListEntry;
     VOID        (*Function)(PVOID);
     PVOID       Argument;
+    ULONG64     Time;       // microseconds taken on the last resume
 };
 
+typedef enum _XENBUS_SUSPEND_PHASE {
+    SUSPEND_PHASE_CAPTURE = 0,
+    SUSPEND_PHASE_SHUTDOWN,
+    SUSPEND_PHASE_RESTORE,
+    SUSPEND_PHASE_EARLY,
+    SUSPEND_PHASE_LATE,
+    SUSPEND_PHASE_CONCURRENT,
+    SUSPEND_PHASE_RELEASE,
+    SUSPEND_PHASE_COUNT
+} XENBUS_SUSPEND_PHASE, *PXENBUS_SUSPEND_PHASE;
+
+static const CHAR *
+SuspendPhaseName(
+    IN  XENBUS_SUSPEND_PHASE    Phase
+    )
+{
+#define _SUSPEND_PHASE_NAME(_Phase) \
+    case SUSPEND_PHASE_ ## _Phase:  \
+        return #_Phase;
+
+    switch (Phase) {
+    _SUSPEND_PHASE_NAME(CAPTURE);
+    _SUSPEND_PHASE_NAME(SHUTDOWN);
+    _SUSPEND_PHASE_NAME(RESTORE);
+    _SUSPEND_PHASE_NAME(EARLY);
+    _SUSPEND_PHASE_NAME(LATE);
+    _SUSPEND_PHASE_NAME(CONCURRENT);
+    _SUSPEND_PHASE_NAME(RELEASE);
+    default:
+        break;
+    }
+
+    return "INVALID";
+
+#undef  _SUSPEND_PHASE_NAME
+}
+
 struct _XENBUS_SUSPEND_CONTEXT {
     PXENBUS_FDO                 Fdo;
     KSPIN_LOCK                  Lock;
@@ -54,8 +92,15 @@ struct _XENBUS_SUSPEND_CONTEXT {
     ULONG                       Count;
     LIST_ENTRY                  EarlyList;
     LIST_ENTRY                  LateList;
+    LIST_ENTRY                  ConcurrentList;
+    PLIST_ENTRY                 ConcurrentNext;
     XENBUS_DEBUG_INTERFACE      DebugInterface;
     PXENBUS_DEBUG_CALLBACK      DebugCallback;
+    LARGE_INTEGER               Frequency;
+    ULONG64                     Phase[SUSPEND_PHASE_COUNT];
+    ULONG64                     PhaseMaximum[SUSPEND_PHASE_COUNT];
+    ULONG64                     Downtime;
+    ULONG64                     DowntimeMaximum;
 };
 
 #define XENBUS_SUSPEND_TAG  'PSUS'
@@ -109,15 +154,31 @@ SuspendRegister(
         InsertTailList(&Context->LateList, &(*Callback)->ListEntry);
         break;
 
-    default:
-        ASSERT(FALSE);
+    case SUSPEND_CALLBACK_CONCURRENT:
+        status = STATUS_INVALID_PARAMETER;
+        if (Interface->Version < 2)
+            goto fail2;
+
+        InsertTailList(&Context->ConcurrentList, &(*Callback)->ListEntry);
         break;
+
+    default:
+        status = STATUS_INVALID_PARAMETER;
+        goto fail2;
     }
 
     KeReleaseSpinLock(&Context->Lock, Irql);
 
     return STATUS_SUCCESS;
 
+fail2:
+    Error("fail2\n");
+
+    KeReleaseSpinLock(&Context->Lock, Irql);
+
+    __SuspendFree(*Callback);
+    *Callback = NULL;
+
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -140,6 +201,109 @@ SuspendDeregister(
     __SuspendFree(Callback);
 }
 
+static FORCEINLINE ULONG64
+__SuspendTimestamp(
+    VOID
+    )
+{
+    // The performance counter is used, rather than system time, since
+    // it advances while interrupts are disabled
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+static FORCEINLINE ULONG64
+__SuspendMicroseconds(
+    IN  PXENBUS_SUSPEND_CONTEXT Context,
+    IN  ULONG64                 Start,
+    IN  ULONG64                 End
+    )
+{
+    return ((End - Start) * 1000000ull) / Context->Frequency.QuadPart;
+}
+
+static FORCEINLINE VOID
+__SuspendPhase(
+    IN      PXENBUS_SUSPEND_CONTEXT Context,
+    IN      XENBUS_SUSPEND_PHASE    Phase,
+    IN OUT  PULONG64                Timestamp
+    )
+{
+    ULONG64                         Now;
+    ULONG64                         Time;
+
+    Now = __SuspendTimestamp();
+    Time = __SuspendMicroseconds(Context, *Timestamp, Now);
+    *Timestamp = Now;
+
+    Context->Phase[Phase] = Time;
+    Context->PhaseMaximum[Phase] = __max(Context->PhaseMaximum[Phase], Time);
+}
+
+static FORCEINLINE VOID
+__SuspendRunCallback(
+    IN  PXENBUS_SUSPEND_CONTEXT     Context,
+    IN  PXENBUS_SUSPEND_CALLBACK    Callback
+    )
+{
+    ULONG64                         Start;
+
+    Start = __SuspendTimestamp();
+    Callback->Function(Callback->Argument);
+    Callback->Time = __SuspendMicroseconds(Context,
+                                           Start,
+                                           __SuspendTimestamp());
+}
+
+static VOID
+SuspendRunCallbacks(
+    IN  PXENBUS_SUSPEND_CONTEXT Context,
+    IN  PLIST_ENTRY             List
+    )
+{
+    PLIST_ENTRY                 ListEntry;
+
+    for (ListEntry = List->Flink;
+         ListEntry != List;
+         ListEntry = ListEntry->Flink) {
+        PXENBUS_SUSPEND_CALLBACK    Callback;
+
+        Callback = CONTAINING_RECORD(ListEntry, XENBUS_SUSPEND_CALLBACK, ListEntry);
+
+        __SuspendRunCallback(Context, Callback);
+    }
+}
+
+// Run on every vCPU by SyncRun(). Each vCPU takes the next callback
+// from the list until none are left, so frontends waiting on their
+// backends overlap rather than queueing behind each other.
+static VOID
+SuspendRunConcurrentCallbacks(
+    IN  PVOID                   Argument
+    )
+{
+    PXENBUS_SUSPEND_CONTEXT     Context = Argument;
+
+    for (;;) {
+        PLIST_ENTRY                 ListEntry;
+        PXENBUS_SUSPEND_CALLBACK    Callback;
+
+        KeAcquireSpinLockAtDpcLevel(&Context->Lock);
+
+        ListEntry = Context->ConcurrentNext;
+        if (ListEntry != &Context->ConcurrentList)
+            Context->ConcurrentNext = ListEntry->Flink;
+
+        KeReleaseSpinLockFromDpcLevel(&Context->Lock);
+
+        if (ListEntry == &Context->ConcurrentList)
+            break;
+
+        Callback = CONTAINING_RECORD(ListEntry, XENBUS_SUSPEND_CALLBACK, ListEntry);
+
+        __SuspendRunCallback(Context, Callback);
+    }
+}
+
 NTSTATUS
 #pragma prefast(suppress:28167) // Function changes IRQL
 SuspendTrigger(
@@ -148,6 +312,9 @@ SuspendTrigger(
 {
     PXENBUS_SUSPEND_CONTEXT Context = Interface->Context;
     KIRQL                   Irql;
+    ULONG64                 Start;
+    ULONG64                 Timestamp;
+    XENBUS_SUSPEND_PHASE    Phase;
     NTSTATUS                status;
 
     KeRaiseIrql(DISPATCH_LEVEL, &Irql);
@@ -155,9 +322,13 @@ SuspendTrigger(
     LogPrintf(LOG_LEVEL_INFO,
               "SUSPEND: ====>\n");
 
+    Start = Timestamp = __SuspendTimestamp();
+
     SyncCapture();
     SyncDisableInterrupts();
 
+    __SuspendPhase(Context, SUSPEND_PHASE_CAPTURE, &Timestamp);
+
     LogPrintf(LOG_LEVEL_INFO,
               "SUSPEND: SCHEDOP_shutdown:SHUTDOWN_suspend ====>\n");
     status = SchedShutdown(SHUTDOWN_suspend);
@@ -165,23 +336,20 @@ SuspendTrigger(
               "SUSPEND: SCHEDOP_shutdown:SHUTDOWN_suspend <==== (%08x)\n",
               status);
 
-    if (NT_SUCCESS(status)) {
-        PLIST_ENTRY ListEntry;
+    __SuspendPhase(Context, SUSPEND_PHASE_SHUTDOWN, &Timestamp);
 
+    if (NT_SUCCESS(status)) {
         Context->Count++;
 
         HypercallPopulate();
 
         UnplugDevices();
 
-        for (ListEntry = Context->EarlyList.Flink;
-             ListEntry != &Context->EarlyList;
-             ListEntry = ListEntry->Flink) {
-            PXENBUS_SUSPEND_CALLBACK  Callback;
+        __SuspendPhase(Context, SUSPEND_PHASE_RESTORE, &Timestamp);
 
-            Callback = CONTAINING_RECORD(ListEntry, XENBUS_SUSPEND_CALLBACK, ListEntry);
-            Callback->Function(Callback->Argument);
-        }
+        SuspendRunCallbacks(Context, &Context->EarlyList);
+
+        __SuspendPhase(Context, SUSPEND_PHASE_EARLY, &Timestamp);
     }
 
     SyncEnableInterrupts();
@@ -190,21 +358,40 @@ SuspendTrigger(
     // SyncRelease() is called.
 
     if (NT_SUCCESS(status)) {
-        PLIST_ENTRY ListEntry;
+        SuspendRunCallbacks(Context, &Context->LateList);
 
-        for (ListEntry = Context->LateList.Flink;
-             ListEntry != &Context->LateList;
-             ListEntry = ListEntry->Flink) {
-            PXENBUS_SUSPEND_CALLBACK  Callback;
+        __SuspendPhase(Context, SUSPEND_PHASE_LATE, &Timestamp);
 
-            Callback = CONTAINING_RECORD(ListEntry, XENBUS_SUSPEND_CALLBACK, ListEntry);
-            Callback->Function(Callback->Argument);
+        // ...apart from here, where every vCPU takes callbacks from
+        // the concurrent list under the lock
+        if (!IsListEmpty(&Context->ConcurrentList)) {
+            Context->ConcurrentNext = Context->ConcurrentList.Flink;
+            SyncRun(SuspendRunConcurrentCallbacks, Context);
+            ASSERT3P(Context->ConcurrentNext, ==, &Context->ConcurrentList);
+            Context->ConcurrentNext = NULL;
         }
+
+        __SuspendPhase(Context, SUSPEND_PHASE_CONCURRENT, &Timestamp);
     }
 
     SyncRelease();
 
-    LogPrintf(LOG_LEVEL_INFO, "SUSPEND: <====\n");
+    __SuspendPhase(Context, SUSPEND_PHASE_RELEASE, &Timestamp);
+
+    // This is the time for which the rest of the VM was stopped, less
+    // the time spent in the domain builder, which the guest cannot see
+    Context->Downtime = __SuspendMicroseconds(Context, Start, Timestamp);
+    Context->DowntimeMaximum = __max(Context->DowntimeMaximum,
+                                     Context->Downtime);
+
+    for (Phase = 0; Phase < SUSPEND_PHASE_COUNT; Phase++)
+        LogPrintf(LOG_LEVEL_INFO,
+                  "SUSPEND: %s %llu us\n",
+                  SuspendPhaseName(Phase),
+                  Context->Phase[Phase]);
+
+    LogPrintf(LOG_LEVEL_INFO, "SUSPEND: <==== (%llu us)\n",
+              Context->Downtime);
 
     KeLowerIrql(Irql);
 
@@ -227,23 +414,16 @@ SuspendGetCount(
 }
 
 static VOID
-SuspendDebugCallback(
-    IN  PVOID               Argument,
-    IN  BOOLEAN             Crashing
+SuspendDebugCallbacks(
+    IN  PXENBUS_SUSPEND_CONTEXT Context,
+    IN  PLIST_ENTRY             List,
+    IN  const CHAR              *Type
     )
 {
-    PXENBUS_SUSPEND_CONTEXT Context = Argument;
-    PLIST_ENTRY             ListEntry;
-
-    UNREFERENCED_PARAMETER(Crashing);
-
-    XENBUS_DEBUG(Printf,
-                 &Context->DebugInterface,
-                 "Count = %u\n",
-                 Context->Count);
+    PLIST_ENTRY                 ListEntry;
 
-    for (ListEntry = Context->EarlyList.Flink;
-         ListEntry != &Context->EarlyList;
+    for (ListEntry = List->Flink;
+         ListEntry != List;
          ListEntry = ListEntry->Flink) {
         PXENBUS_SUSPEND_CALLBACK    Callback;
         PCHAR                       Name;
@@ -256,45 +436,60 @@ SuspendDebugCallback(
         if (Name == NULL) {
             XENBUS_DEBUG(Printf,
                          &Context->DebugInterface,
-                         "EARLY: %p (%p)\n",
+                         "%s: %p (%p) %llu us\n",
+                         Type,
                          Callback->Function,
-                         Callback->Argument);
+                         Callback->Argument,
+                         Callback->Time);
         } else {
             XENBUS_DEBUG(Printf,
                          &Context->DebugInterface,
-                         "EARLY: %s + %p (%p)\n",
+                         "%s: %s + %p (%p) %llu us\n",
+                         Type,
                          Name,
                          (PVOID)Offset,
-                         Callback->Argument);
+                         Callback->Argument,
+                         Callback->Time);
         }
     }
+}
 
-    for (ListEntry = Context->LateList.Flink;
-         ListEntry != &Context->LateList;
-         ListEntry = ListEntry->Flink) {
-        PXENBUS_SUSPEND_CALLBACK    Callback;
-        PCHAR                       Name;
-        ULONG_PTR                   Offset;
+static VOID
+SuspendDebugCallback(
+    IN  PVOID               Argument,
+    IN  BOOLEAN             Crashing
+    )
+{
+    PXENBUS_SUSPEND_CONTEXT Context = Argument;
 
-        Callback = CONTAINING_RECORD(ListEntry, XENBUS_SUSPEND_CALLBACK, ListEntry);
+    UNREFERENCED_PARAMETER(Crashing);
 
-        ModuleLookup((ULONG_PTR)Callback->Function, &Name, &Offset);
+    XENBUS_DEBUG(Printf,
+                 &Context->DebugInterface,
+                 "Count = %u\n",
+                 Context->Count);
 
-        if (Name == NULL) {
-            XENBUS_DEBUG(Printf,
-                         &Context->DebugInterface,
-                         "LATE: %p (%p)\n",
-                         Callback->Function,
-                         Callback->Argument);
-        } else {
+    if (Context->Count != 0) {
+        XENBUS_SUSPEND_PHASE    Phase;
+
+        XENBUS_DEBUG(Printf,
+                     &Context->DebugInterface,
+                     "Downtime = %llu us (max %llu us)\n",
+                     Context->Downtime,
+                     Context->DowntimeMaximum);
+
+        for (Phase = 0; Phase < SUSPEND_PHASE_COUNT; Phase++)
             XENBUS_DEBUG(Printf,
                          &Context->DebugInterface,
-                         "LATE: %s + %p (%p)\n",
-                         Name,
-                         (PVOID)Offset,
-                         Callback->Argument);
-        }
+                         "- %s: %llu us (max %llu us)\n",
+                         SuspendPhaseName(Phase),
+                         Context->Phase[Phase],
+                         Context->PhaseMaximum[Phase]);
     }
+
+    SuspendDebugCallbacks(Context, &Context->EarlyList, "EARLY");
+    SuspendDebugCallbacks(Context, &Context->LateList, "LATE");
+    SuspendDebugCallbacks(Context, &Context->ConcurrentList, "CONCURRENT");
 }
 
 static NTSTATUS
@@ -363,12 +558,18 @@ SuspendRelease(
 
     Trace("====>\n");
 
-    if (!IsListEmpty(&Context->LateList) ||
+    if (!IsListEmpty(&Context->ConcurrentList) ||
+        !IsListEmpty(&Context->LateList) ||
         !IsListEmpty(&Context->EarlyList))
         BUG("OUTSTANDING CALLBACKS");
 
     Context->Count = 0;
 
+    RtlZeroMemory(Context->Phase, sizeof (Context->Phase));
+    RtlZeroMemory(Context->PhaseMaximum, sizeof (Context->PhaseMaximum));
+    Context->Downtime = 0;
+    Context->DowntimeMaximum = 0;
+
     XENBUS_DEBUG(Deregister,
                  &Context->DebugInterface,
                  Context->DebugCallback);
@@ -391,6 +592,16 @@ static struct _XENBUS_SUSPEND_INTERFACE_V1 SuspendInterfaceVersion1 = {
     SuspendTrigger,
     SuspendGetCount
 };
+
+static struct _XENBUS_SUSPEND_INTERFACE_V2 SuspendInterfaceVersion2 = {
+    { sizeof (struct _XENBUS_SUSPEND_INTERFACE_V2), 2, NULL, NULL, NULL },
+    SuspendAcquire,
+    SuspendRelease,
+    SuspendRegister,
+    SuspendDeregister,
+    SuspendTrigger,
+    SuspendGetCount
+};
                      
 NTSTATUS
 SuspendInitialize(
@@ -416,8 +627,11 @@ SuspendInitialize(
 
     InitializeListHead(&(*Context)->EarlyList);
     InitializeListHead(&(*Context)->LateList);
+    InitializeListHead(&(*Context)->ConcurrentList);
     KeInitializeSpinLock(&(*Context)->Lock);
 
+    (VOID) KeQueryPerformanceCounter(&(*Context)->Frequency);
+
     (*Context)->Fdo = Fdo;
 
     Trace("<====\n");
@@ -460,6 +674,23 @@ SuspendGetInterface(
         status = STATUS_SUCCESS;
         break;
     }
+    case 2: {
+        struct _XENBUS_SUSPEND_INTERFACE_V2  *SuspendInterface;
+
+        SuspendInterface = (struct _XENBUS_SUSPEND_INTERFACE_V2 *)Interface;
+
+        status = STATUS_BUFFER_OVERFLOW;
+        if (Size < sizeof (struct _XENBUS_SUSPEND_INTERFACE_V2))
+            break;
+
+        *SuspendInterface = SuspendInterfaceVersion2;
+
+        ASSERT3U(Interface->Version, ==, Version);
+        Interface->Context = Context;
+
+        status = STATUS_SUCCESS;
+        break;
+    }
     default:
         status = STATUS_NOT_SUPPORTED;
         break;
@@ -485,10 +716,13 @@ SuspendTeardown(
 
     Context->Fdo = NULL;
 
+    Context->Frequency.QuadPart = 0;
+
     RtlZeroMemory(&Context->DebugInterface,
                   sizeof (XENBUS_DEBUG_INTERFACE));
 
     RtlZeroMemory(&Context->Lock, sizeof (KSPIN_LOCK));
+    RtlZeroMemory(&Context->ConcurrentList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Context->LateList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Context->EarlyList, sizeof (LIST_ENTRY));
 
@@ -71,6 +71,12 @@
 //   interrupts and drop back to DISPATCH_LEVEL before enabling
 //   interrupts and dropping back to DISPATCH_LEVEL itself.
 //
+// - SyncRun() may be called while interrupts are enabled. It instructs
+//   the DPC routines to call a function at DISPATCH_LEVEL, calls the
+//   same function itself, and spins until all CPUs have returned from
+//   it. The function is thus run concurrently on every CPU while the
+//   scheduler remains stopped.
+//
 // - SyncRelease() instructs the DPC routines to exit, thus allowing
 //   the scheduler to run on the other CPUs again. It spins until all
 //   DPCs have completed and then returns.
@@ -82,6 +88,7 @@ static UCHAR        __Section[PAGE_SIZE];
 typedef struct  _SYNC_PROCESSOR {
     KDPC                Dpc;
     BOOLEAN             DisableInterrupts;
+    BOOLEAN             Run;
     BOOLEAN             Exit;
 } SYNC_PROCESSOR, *PSYNC_PROCESSOR;
 
@@ -89,6 +96,8 @@ typedef struct  _SYNC_CONTEXT {
     ULONG               Sequence;
     LONG                ProcessorCount;
     LONG                CompletionCount;
+    SYNC_FUNCTION       Function;
+    PVOID               Argument;
     SYNC_PROCESSOR      Processor[1];
 } SYNC_CONTEXT, *PSYNC_CONTEXT;
 
@@ -156,6 +165,17 @@ SyncWorker(
         if (Processor->Exit)
             break;
 
+        if (Processor->Run) {
+            ASSERT(!InterruptsDisabled);
+
+            Context->Function(Context->Argument);
+
+            Processor->Run = FALSE;
+            InterlockedIncrement(&Context->CompletionCount);
+
+            continue;
+        }
+
         if (Processor->DisableInterrupts == InterruptsDisabled) {
             _mm_pause();
             KeMemoryBarrier();
@@ -397,6 +417,54 @@ SyncEnableInterrupts(
     Trace("<====\n");
 }
 
+__drv_requiresIRQL(DISPATCH_LEVEL)
+VOID
+SyncRun(
+    IN  SYNC_FUNCTION   Function,
+    IN  PVOID           Argument
+    )
+{
+    PSYNC_CONTEXT       Context = SyncContext;
+    LONG                Index;
+
+    ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
+
+    Trace("====>\n");
+
+    Context->Sequence++;
+    Context->CompletionCount = 0;
+
+    Context->Function = Function;
+    Context->Argument = Argument;
+
+    KeMemoryBarrier();
+
+    for (Index = 0; Index < Context->ProcessorCount; Index++) {
+        PSYNC_PROCESSOR Processor = &Context->Processor[Index];
+
+        if (Index == SyncOwner)
+            continue;
+
+        Processor->Run = TRUE;
+    }
+
+    KeMemoryBarrier();
+
+    Function(Argument);
+
+    InterlockedIncrement(&Context->CompletionCount);
+
+    while (Context->CompletionCount < Context->ProcessorCount) {
+        _mm_pause();
+        KeMemoryBarrier();
+    }
+
+    Context->Function = NULL;
+    Context->Argument = NULL;
+
+    Trace("<====\n");
+}
+
 __drv_requiresIRQL(DISPATCH_LEVEL)
 VOID
 #pragma prefast(suppress:28167) // Function changes IRQL
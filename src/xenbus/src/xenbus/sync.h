@@ -58,6 +58,19 @@ SyncEnableInterrupts(
     VOID
     );
 
+typedef VOID
+(*SYNC_FUNCTION)(
+    IN  PVOID   Argument
+    );
+
+extern
+__drv_requiresIRQL(DISPATCH_LEVEL)
+VOID
+SyncRun(
+    IN  SYNC_FUNCTION   Function,
+    IN  PVOID           Argument
+    );
+
 extern
 __drv_requiresIRQL(DISPATCH_LEVEL)
 VOID
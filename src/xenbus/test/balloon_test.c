@@ -0,0 +1,953 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the extent handling in balloon.c. Windows' free memory and
+// Xen's view of which guest frames are backed are both replaced by a
+// single table of page states, so every page can be followed through
+// inflation and deflation. Xen can be told to accept only so many
+// extents in one call, which drives the fallbacks that hand the rest
+// back a page at a time. The range sets are the real ones.
+
+#define _XENBUS_FDO_H   // Keep the real FDO (and everything it pulls in) out
+#define _COMMON_MUTEX_H // balloon.c includes but does not use it
+
+#include <ntddk.h>
+#include <pthread.h>
+
+typedef struct _XENBUS_FDO  XENBUS_FDO, *PXENBUS_FDO;
+
+#include "../src/xenbus/debug.h"
+#include "../src/xenbus/store.h"
+#include "../src/xenbus/range_set.h"
+#include "../src/xenbus/balloon.h"
+
+extern PXENBUS_DEBUG_CONTEXT FdoGetDebugContext(PXENBUS_FDO);
+extern PXENBUS_RANGE_SET_CONTEXT FdoGetRangeSetContext(PXENBUS_FDO);
+extern PXENBUS_STORE_CONTEXT FdoGetStoreContext(PXENBUS_FDO);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_RANGE_SET
+#define XENBUS_RANGE_SET(_Method, _Interface, ...)    \
+    (_Interface)->RangeSet ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_BALLOON
+#define XENBUS_BALLOON(_Method, _Interface, ...)    \
+    (_Interface)->Balloon ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenbus/range_set.c"
+#include "../src/xenbus/balloon.c"
+
+#include "test.h"
+
+// Enough memory for an adjustment that is split across workers
+#define HOST_PAGES      (XENBUS_BALLOON_PARALLEL_THRESHOLD + 4 * XENBUS_BALLOON_EXTENT_PAGES)
+
+// Frame numbers start at an extent boundary but never at zero
+#define HOST_BASE_PFN   0x100000
+
+#define HOST_UNLIMITED  ((ULONG)-1)
+
+typedef enum _HOST_PAGE_STATE {
+    HOST_PAGE_FREE = 0,     // Windows may hand it out
+    HOST_PAGE_ALLOCATED,    // Backed and held by the driver
+    HOST_PAGE_BALLOONED,    // Given back to Xen
+    HOST_PAGE_RESERVED      // Held by someone else
+} HOST_PAGE_STATE;
+
+static UCHAR            HostPage[HOST_PAGES];
+static pthread_mutex_t  HostLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The most extents Xen will take or give back in a single call
+static ULONG            HostPopulateExtents = HOST_UNLIMITED;
+static ULONG            HostDecreaseExtents = HOST_UNLIMITED;
+
+// Pages moved by each call, indexed by order (0 or 9)
+typedef struct _HOST_CALLS {
+    ULONG   Calls;
+    ULONG   Requested;
+    ULONG   Done;
+} HOST_CALLS, *PHOST_CALLS;
+
+static HOST_CALLS       HostPopulate[2];
+static HOST_CALLS       HostDecrease[2];
+
+// Pages allocated or reclaimed by the thread that adjusts the balloon,
+// which runs the embedded worker
+static __thread BOOLEAN HostIsMain;
+static ULONGLONG        HostMainPages;
+
+static PUCHAR
+HostLookup(
+    IN  PFN_NUMBER  Pfn
+    )
+{
+    CHECK(Pfn >= HOST_BASE_PFN && Pfn < HOST_BASE_PFN + HOST_PAGES);
+
+    return &HostPage[Pfn - HOST_BASE_PFN];
+}
+
+static ULONG
+HostCount(
+    IN  HOST_PAGE_STATE State
+    )
+{
+    ULONG               Count;
+    ULONG               Index;
+
+    Count = 0;
+    for (Index = 0; Index < HOST_PAGES; Index++)
+        if (HostPage[Index] == State)
+            Count++;
+
+    return Count;
+}
+
+static VOID
+HostResetCalls(
+    VOID
+    )
+{
+    RtlZeroMemory(HostPopulate, sizeof (HostPopulate));
+    RtlZeroMemory(HostDecrease, sizeof (HostDecrease));
+}
+
+// Windows hands out the lowest free pages first, so inflation finds
+// whole extents wherever nothing else is in the way
+
+PMDL
+MmAllocatePagesForMdlEx(
+    IN  PHYSICAL_ADDRESS    LowAddress,
+    IN  PHYSICAL_ADDRESS    HighAddress,
+    IN  PHYSICAL_ADDRESS    SkipBytes,
+    IN  SIZE_T              TotalBytes,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  ULONG               Flags
+    )
+{
+    ULONG                   Requested = (ULONG)(TotalBytes >> PAGE_SHIFT);
+    PMDL                    Mdl;
+    PPFN_NUMBER             PfnArray;
+    ULONG                   Count;
+    ULONG                   Index;
+
+    CHECK(Flags & MM_ALLOCATE_PREFER_CONTIGUOUS);
+
+    Mdl = ExAllocatePoolWithTag(NonPagedPool,
+                                sizeof (MDL) + Requested * sizeof (PFN_NUMBER),
+                                'TSET');
+    if (Mdl == NULL)
+        return NULL;
+
+    RtlZeroMemory(Mdl, sizeof (MDL));
+    PfnArray = MmGetMdlPfnArray(Mdl);
+
+    pthread_mutex_lock(&HostLock);
+
+    Count = 0;
+    for (Index = 0; Index < HOST_PAGES && Count < Requested; Index++) {
+        if (HostPage[Index] != HOST_PAGE_FREE)
+            continue;
+
+        HostPage[Index] = HOST_PAGE_ALLOCATED;
+        PfnArray[Count++] = HOST_BASE_PFN + Index;
+    }
+
+    if (HostIsMain)
+        HostMainPages += Count;
+
+    pthread_mutex_unlock(&HostLock);
+
+    if (Count == 0) {
+        ExFreePool(Mdl);
+        return NULL;
+    }
+
+    Mdl->MdlFlags = MDL_PAGES_LOCKED;
+    Mdl->ByteCount = Count << PAGE_SHIFT;
+
+    return Mdl;
+}
+
+VOID
+MmFreePagesFromMdl(
+    IN  PMDL    Mdl
+    )
+{
+    PPFN_NUMBER PfnArray = MmGetMdlPfnArray(Mdl);
+    ULONG       Index;
+
+    pthread_mutex_lock(&HostLock);
+
+    for (Index = 0; Index < Mdl->ByteCount >> PAGE_SHIFT; Index++) {
+        PUCHAR  State = HostLookup(PfnArray[Index]);
+
+        CHECK_EQ(*State, HOST_PAGE_ALLOCATED);
+        *State = HOST_PAGE_FREE;
+    }
+
+    pthread_mutex_unlock(&HostLock);
+}
+
+// Frames are not real memory here so the check that a page is backed
+// takes the path for running short of address space
+PVOID
+MmMapLockedPagesSpecifyCache(
+    IN  PMDL                Mdl,
+    IN  KPROCESSOR_MODE     AccessMode,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  PVOID               BaseAddress,
+    IN  ULONG               BugCheckOnFailure,
+    IN  ULONG               Priority
+    )
+{
+    return NULL;
+}
+
+static ULONG
+HostExchange(
+    IN  ULONG           Order,
+    IN  ULONG           Requested,
+    IN  PPFN_NUMBER     PfnArray,
+    IN  ULONG           Limit,
+    IN  HOST_PAGE_STATE From,
+    IN  HOST_PAGE_STATE To,
+    IN  PHOST_CALLS     Calls
+    )
+{
+    ULONG               Count;
+    ULONG               Index;
+
+    CHECK(Order == 0 || Order == XENBUS_BALLOON_EXTENT_ORDER);
+
+    pthread_mutex_lock(&HostLock);
+
+    Count = (Order != 0) ? __min(Requested, Limit) : Requested;
+
+    for (Index = 0; Index < Count; Index++) {
+        PFN_NUMBER  Pfn = PfnArray[Index];
+        ULONG       Page;
+
+        CHECK_EQ(Pfn & ((1ul << Order) - 1), 0);
+
+        for (Page = 0; Page < (1ul << Order); Page++) {
+            PUCHAR  State = HostLookup(Pfn + Page);
+
+            CHECK_EQ(*State, From);
+            *State = To;
+        }
+    }
+
+    if (HostIsMain && To == HOST_PAGE_ALLOCATED)
+        HostMainPages += (ULONGLONG)Count << Order;
+
+    Calls = &Calls[(Order != 0) ? 1 : 0];
+    Calls->Calls++;
+    Calls->Requested += Requested;
+    Calls->Done += Count;
+
+    pthread_mutex_unlock(&HostLock);
+
+    return Count;
+}
+
+ULONG
+MemoryPopulatePhysmap(
+    IN  ULONG       Order,
+    IN  ULONG       Requested,
+    IN  PPFN_NUMBER PfnArray
+    )
+{
+    return HostExchange(Order,
+                        Requested,
+                        PfnArray,
+                        HostPopulateExtents,
+                        HOST_PAGE_BALLOONED,
+                        HOST_PAGE_ALLOCATED,
+                        HostPopulate);
+}
+
+ULONG
+MemoryDecreaseReservation(
+    IN  ULONG       Order,
+    IN  ULONG       Requested,
+    IN  PPFN_NUMBER PfnArray
+    )
+{
+    return HostExchange(Order,
+                        Requested,
+                        PfnArray,
+                        HostDecreaseExtents,
+                        HOST_PAGE_ALLOCATED,
+                        HOST_PAGE_BALLOONED,
+                        HostDecrease);
+}
+
+// Worker threads. Each one records what it was asked to do, and a
+// chosen one can be made to fail to start.
+
+struct _XENBUS_THREAD {
+    XENBUS_THREAD_FUNCTION  Function;
+    PVOID                   Context;
+    pthread_t               Thread;
+};
+
+#define THREADS 8
+
+static ULONGLONG    ThreadRequested[THREADS];
+static ULONG        Threads;
+static ULONG        ThreadFail = HOST_UNLIMITED;
+
+static PVOID
+ThreadStart(
+    IN  PVOID       Argument
+    )
+{
+    PXENBUS_THREAD  Thread = Argument;
+
+    (VOID) Thread->Function(Thread, Thread->Context);
+    return NULL;
+}
+
+NTSTATUS
+ThreadCreate(
+    IN  XENBUS_THREAD_FUNCTION  Function,
+    IN  PVOID                   Context,
+    OUT PXENBUS_THREAD          *Thread
+    )
+{
+    PXENBUS_BALLOON_WORKER      Worker = Context;
+    ULONG                       Index = Threads++;
+
+    CHECK(Index < THREADS);
+    ThreadRequested[Index] = Worker->Requested;
+
+    if (Index == ThreadFail)
+        return STATUS_UNSUCCESSFUL;
+
+    *Thread = calloc(1, sizeof (XENBUS_THREAD));
+    if (*Thread == NULL)
+        return STATUS_NO_MEMORY;
+
+    (*Thread)->Function = Function;
+    (*Thread)->Context = Context;
+
+    if (pthread_create(&(*Thread)->Thread, NULL, ThreadStart, *Thread) != 0) {
+        free(*Thread);
+        *Thread = NULL;
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+ThreadJoin(
+    IN  PXENBUS_THREAD  Thread
+    )
+{
+    (VOID) pthread_join(Thread->Thread, NULL);
+    free(Thread);
+}
+
+// Neighbours
+
+static KEVENT                       LowMemoryEvent;
+static PXENBUS_RANGE_SET_CONTEXT    RangeSetContext;
+
+PXENBUS_DEBUG_CONTEXT
+FdoGetDebugContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    return NULL;
+}
+
+PXENBUS_RANGE_SET_CONTEXT
+FdoGetRangeSetContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    return RangeSetContext;
+}
+
+PXENBUS_STORE_CONTEXT
+FdoGetStoreContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    return NULL;
+}
+
+struct _XENBUS_DEBUG_CALLBACK {
+    ULONG   Unused;
+};
+
+static XENBUS_DEBUG_CALLBACK    DebugCallback;
+
+static NTSTATUS
+DebugAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+DebugRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+static NTSTATUS
+DebugRegister(
+    IN  PINTERFACE              Interface,
+    IN  PCHAR                   Prefix,
+    IN  XENBUS_DEBUG_FUNCTION   Function,
+    IN  PVOID                   Argument,
+    OUT PXENBUS_DEBUG_CALLBACK  *Callback
+    )
+{
+    *Callback = &DebugCallback;
+    return STATUS_SUCCESS;
+}
+
+static VOID
+DebugDeregister(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_DEBUG_CALLBACK  Callback
+    )
+{
+    CHECK(Callback == &DebugCallback);
+}
+
+NTSTATUS
+DebugGetInterface(
+    IN      PXENBUS_DEBUG_CONTEXT   Context,
+    IN      ULONG                   Version,
+    IN OUT  PINTERFACE              Interface,
+    IN      ULONG                   Size
+    )
+{
+    PXENBUS_DEBUG_INTERFACE         DebugInterface;
+
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(Version);
+
+    RtlZeroMemory(Interface, Size);
+
+    DebugInterface = (PXENBUS_DEBUG_INTERFACE)Interface;
+    DebugInterface->Interface.Context = &DebugCallback;
+    DebugInterface->DebugAcquire = DebugAcquire;
+    DebugInterface->DebugRelease = DebugRelease;
+    DebugInterface->DebugRegister = DebugRegister;
+    DebugInterface->DebugDeregister = DebugDeregister;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+StoreAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+StoreRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+// No FIST entries
+static NTSTATUS
+StoreRead(
+    IN  PINTERFACE                  Interface,
+    IN  PXENBUS_STORE_TRANSACTION   Transaction,
+    IN  PCHAR                       Prefix,
+    IN  PCHAR                       Node,
+    OUT PCHAR                       *Value
+    )
+{
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+NTSTATUS
+StoreGetInterface(
+    IN      PXENBUS_STORE_CONTEXT   Context,
+    IN      ULONG                   Version,
+    IN OUT  PINTERFACE              Interface,
+    IN      ULONG                   Size
+    )
+{
+    PXENBUS_STORE_INTERFACE         StoreInterface;
+
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(Version);
+
+    RtlZeroMemory(Interface, Size);
+
+    StoreInterface = (PXENBUS_STORE_INTERFACE)Interface;
+    StoreInterface->StoreAcquire = StoreAcquire;
+    StoreInterface->StoreRelease = StoreRelease;
+    StoreInterface->StoreRead = StoreRead;
+
+    return STATUS_SUCCESS;
+}
+
+PKEVENT
+IoCreateNotificationEvent(
+    IN  PUNICODE_STRING EventName,
+    OUT PHANDLE         EventHandle
+    )
+{
+    UNREFERENCED_PARAMETER(EventName);
+
+    *EventHandle = (HANDLE)&LowMemoryEvent;
+    return &LowMemoryEvent;
+}
+
+NTSTATUS
+ZwClose(
+    IN  HANDLE  Handle
+    )
+{
+    CHECK(Handle == (HANDLE)&LowMemoryEvent);
+    return STATUS_SUCCESS;
+}
+
+// Range set helpers. Checking for a range takes it out and puts it back.
+
+static BOOLEAN
+RangeSetHolds(
+    IN  PXENBUS_BALLOON_CONTEXT Context,
+    IN  PXENBUS_RANGE_SET       RangeSet,
+    IN  LONGLONG                Start,
+    IN  ULONGLONG               Count
+    )
+{
+    NTSTATUS                    status;
+
+    status = XENBUS_RANGE_SET(Get,
+                              &Context->RangeSetInterface,
+                              RangeSet,
+                              Start,
+                              Count);
+    if (!NT_SUCCESS(status))
+        return FALSE;
+
+    status = XENBUS_RANGE_SET(Put,
+                              &Context->RangeSetInterface,
+                              RangeSet,
+                              Start,
+                              Count);
+    CHECK(NT_SUCCESS(status));
+
+    return TRUE;
+}
+
+static BOOLEAN
+RangeSetIsEmpty(
+    IN  PXENBUS_BALLOON_CONTEXT Context,
+    IN  PXENBUS_RANGE_SET       RangeSet
+    )
+{
+    LONGLONG                    Start;
+    NTSTATUS                    status;
+
+    status = XENBUS_RANGE_SET(Pop,
+                              &Context->RangeSetInterface,
+                              RangeSet,
+                              1,
+                              &Start);
+    if (!NT_SUCCESS(status))
+        return TRUE;
+
+    status = XENBUS_RANGE_SET(Put,
+                              &Context->RangeSetInterface,
+                              RangeSet,
+                              Start,
+                              1);
+    CHECK(NT_SUCCESS(status));
+
+    return FALSE;
+}
+
+#define EXTENT(_Index)  (HOST_BASE_PFN + (_Index) * XENBUS_BALLOON_EXTENT_PAGES)
+
+// Only naturally aligned and complete runs are extents, and the pages
+// left over keep their order
+
+typedef struct _RUN {
+    PFN_NUMBER  Start;
+    ULONG       Count;
+} RUN, *PRUN;
+
+#define RUNS    4
+
+typedef struct _EXTRACT_CASE {
+    const char  *Name;
+    RUN         Run[RUNS];
+    ULONG       Extents;
+    PFN_NUMBER  Extent[RUNS];
+} EXTRACT_CASE, *PEXTRACT_CASE;
+
+static const EXTRACT_CASE   ExtractCase[] = {
+    { "aligned",
+      { { EXTENT(1), 512 } },
+      1, { EXTENT(1) } },
+    { "starts one late",
+      { { EXTENT(1) + 1, 512 } },
+      0 },
+    { "one short",
+      { { EXTENT(1), 511 } },
+      0 },
+    { "hole in the middle",
+      { { EXTENT(1), 100 }, { EXTENT(1) + 101, 412 } },
+      0 },
+    { "between singles",
+      { { EXTENT(1) - 3, 3 }, { EXTENT(1), 1024 }, { EXTENT(3) + 7, 5 } },
+      2, { EXTENT(1), EXTENT(2) } },
+    { "unaligned run covering an extent",
+      { { EXTENT(1) + 200, 1024 } },
+      1, { EXTENT(2) } },
+};
+
+static VOID
+TestExtractExtents(
+    VOID
+    )
+{
+    PXENBUS_BALLOON_WORKER  Worker;
+    ULONG                   Case;
+
+    Worker = calloc(1, sizeof (XENBUS_BALLOON_WORKER));
+    CHECK(Worker != NULL);
+
+    for (Case = 0; Case < ARRAYSIZE(ExtractCase); Case++) {
+        const EXTRACT_CASE  *This = &ExtractCase[Case];
+        static PFN_NUMBER   Expected[4 * XENBUS_BALLOON_EXTENT_PAGES];
+        ULONG               Count;
+        ULONG               Singles;
+        ULONG               Extents;
+        ULONG               Index;
+        ULONG               Run;
+        ULONG               Failures = TestFailures;
+
+        RtlZeroMemory(Worker->PfnArray, sizeof (Worker->PfnArray));
+        RtlZeroMemory(Worker->ExtentArray, sizeof (Worker->ExtentArray));
+
+        Count = 0;
+        Singles = 0;
+        for (Run = 0; Run < RUNS; Run++) {
+            ULONG   Page;
+
+            for (Page = 0; Page < This->Run[Run].Count; Page++) {
+                PFN_NUMBER  Pfn = This->Run[Run].Start + Page;
+                ULONG       Extent;
+                BOOLEAN     InExtent = FALSE;
+
+                for (Extent = 0; Extent < This->Extents; Extent++)
+                    if (Pfn >= This->Extent[Extent] &&
+                        Pfn < This->Extent[Extent] + XENBUS_BALLOON_EXTENT_PAGES)
+                        InExtent = TRUE;
+
+                Worker->PfnArray[Count++] = Pfn;
+                if (!InExtent)
+                    Expected[Singles++] = Pfn;
+            }
+        }
+
+        Extents = BalloonExtractExtents(Worker, Count);
+        CHECK_EQ(Extents, This->Extents);
+
+        for (Index = 0; Index < This->Extents; Index++)
+            CHECK_EQ(Worker->ExtentArray[Index], This->Extent[Index]);
+
+        CHECK_EQ(Count - Extents * XENBUS_BALLOON_EXTENT_PAGES, Singles);
+
+        for (Index = 0; Index < Singles; Index++)
+            CHECK_EQ(Worker->PfnArray[Index], Expected[Index]);
+
+        CHECK(IsZeroMemory(&Worker->PfnArray[Singles],
+                           (Count - Singles) * sizeof (PFN_NUMBER)));
+
+        if (TestFailures != Failures)
+            fprintf(stderr, "extract: %s\n", This->Name);
+    }
+
+    free(Worker);
+}
+
+// Adjust the balloon and check that Xen and Windows agree with it
+static VOID
+Adjust(
+    IN  PXENBUS_BALLOON_INTERFACE   Interface,
+    IN  ULONGLONG                   Size
+    )
+{
+    NTSTATUS                        status;
+
+    status = XENBUS_BALLOON(Adjust, Interface, Size);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(XENBUS_BALLOON(GetSize, Interface), Size);
+
+    CHECK_EQ(HostCount(HOST_PAGE_BALLOONED), Size);
+    CHECK_EQ(HostCount(HOST_PAGE_ALLOCATED), 0);
+}
+
+// Extents that Xen will not take or give back as extents are moved a
+// page at a time instead
+static VOID
+TestExtentFallback(
+    IN  PXENBUS_BALLOON_INTERFACE   Interface
+    )
+{
+    PXENBUS_BALLOON_CONTEXT         Context = Interface->Interface.Context;
+    ULONG                           Index;
+
+    // Something else holds one page of the first extent
+    HostPage[5] = HOST_PAGE_RESERVED;
+
+    // Extents 1 to 3 are whole; the first extent, less the held page,
+    // and the first page of the fourth are singles. Xen takes two
+    // extents and the third goes back as pages.
+    HostResetCalls();
+    HostDecreaseExtents = 2;
+
+    Adjust(Interface, 4 * XENBUS_BALLOON_EXTENT_PAGES);
+
+    HostDecreaseExtents = HOST_UNLIMITED;
+
+    CHECK_EQ(HostDecrease[1].Requested, 3);
+    CHECK_EQ(HostDecrease[1].Done, 2);
+    CHECK_EQ(HostDecrease[0].Done, 2 * XENBUS_BALLOON_EXTENT_PAGES);
+
+    CHECK(RangeSetHolds(Context, Context->ExtentRangeSet,
+                        EXTENT(1) >> XENBUS_BALLOON_EXTENT_ORDER, 2));
+    CHECK(RangeSetHolds(Context, Context->RangeSet,
+                        EXTENT(3), XENBUS_BALLOON_EXTENT_PAGES + 1));
+    CHECK(RangeSetHolds(Context, Context->RangeSet, EXTENT(0), 5));
+    CHECK(RangeSetHolds(Context, Context->RangeSet, EXTENT(0) + 6, 506));
+
+    // Both extents are asked for but Xen backs only one, so the other is
+    // broken up and reclaimed with the rest of the pages
+    HostResetCalls();
+    HostPopulateExtents = 1;
+
+    Adjust(Interface, 0);
+
+    HostPopulateExtents = HOST_UNLIMITED;
+
+    CHECK_EQ(HostPopulate[1].Requested, 2);
+    CHECK_EQ(HostPopulate[1].Done, 1);
+    CHECK_EQ(HostPopulate[0].Done, 3 * XENBUS_BALLOON_EXTENT_PAGES);
+
+    CHECK(RangeSetIsEmpty(Context, Context->ExtentRangeSet));
+    CHECK(RangeSetIsEmpty(Context, Context->RangeSet));
+
+    HostPage[5] = HOST_PAGE_FREE;
+
+    for (Index = 0; Index < HOST_PAGES; Index++)
+        CHECK_EQ(HostPage[Index], HOST_PAGE_FREE);
+}
+
+// With no single pages left, reclaiming fewer pages than an extent
+// breaks the lowest extent up
+static VOID
+TestBreakUpExtent(
+    IN  PXENBUS_BALLOON_INTERFACE   Interface
+    )
+{
+    PXENBUS_BALLOON_CONTEXT         Context = Interface->Interface.Context;
+    ULONG                           Index;
+
+    HostResetCalls();
+
+    Adjust(Interface, 2 * XENBUS_BALLOON_EXTENT_PAGES);
+
+    CHECK_EQ(HostDecrease[1].Done, 2);
+    CHECK_EQ(HostDecrease[0].Calls, 0);
+    CHECK(RangeSetIsEmpty(Context, Context->RangeSet));
+
+    HostResetCalls();
+
+    Adjust(Interface, 2 * XENBUS_BALLOON_EXTENT_PAGES - 10);
+
+    CHECK_EQ(HostPopulate[1].Calls, 0);
+    CHECK_EQ(HostPopulate[0].Done, 10);
+
+    for (Index = 0; Index < 10; Index++)
+        CHECK_EQ(HostPage[Index], HOST_PAGE_FREE);
+
+    CHECK(RangeSetHolds(Context, Context->RangeSet,
+                        EXTENT(0) + 10, XENBUS_BALLOON_EXTENT_PAGES - 10));
+    CHECK(RangeSetHolds(Context, Context->ExtentRangeSet,
+                        EXTENT(1) >> XENBUS_BALLOON_EXTENT_ORDER, 1));
+    CHECK(!RangeSetHolds(Context, Context->ExtentRangeSet,
+                         EXTENT(0) >> XENBUS_BALLOON_EXTENT_ORDER, 1));
+
+    // The remaining extent still comes back whole
+    HostResetCalls();
+
+    Adjust(Interface, 0);
+
+    CHECK_EQ(HostPopulate[1].Done, 1);
+    CHECK_EQ(HostPopulate[0].Done, XENBUS_BALLOON_EXTENT_PAGES - 10);
+
+    CHECK(RangeSetIsEmpty(Context, Context->ExtentRangeSet));
+    CHECK(RangeSetIsEmpty(Context, Context->RangeSet));
+}
+
+// A large adjustment is shared between the workers, the first taking
+// the remainder and the share of any worker that could not be started.
+// BalloonAdjust() would make up any shortfall with another round, so
+// the worker threads are run directly.
+static VOID
+TestSplit(
+    IN  PXENBUS_BALLOON_INTERFACE   Interface
+    )
+{
+    PXENBUS_BALLOON_CONTEXT         Context = Interface->Interface.Context;
+    ULONGLONG                       Requested;
+    ULONGLONG                       Share;
+    ULONGLONG                       Count;
+    ULONG                           Index;
+    NTSTATUS                        status;
+
+    Requested = XENBUS_BALLOON_PARALLEL_THRESHOLD + 3;
+    Share = Requested / XENBUS_BALLOON_MAX_WORKERS;
+
+    CHECK(HostProcessorCount >= XENBUS_BALLOON_MAX_WORKERS);
+
+    Threads = 0;
+    HostMainPages = 0;
+
+    status = BalloonRun(Context, TRUE, Requested, &Count);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(Count, Requested);
+    Context->Size += Count;
+
+    CHECK_EQ(Threads, XENBUS_BALLOON_MAX_WORKERS - 1);
+    for (Index = 0; Index < Threads; Index++)
+        CHECK_EQ(ThreadRequested[Index], Share);
+
+    CHECK_EQ(HostMainPages, Share + 3);
+    CHECK_EQ(HostCount(HOST_PAGE_BALLOONED), Requested);
+
+    // The second helper fails to start and its share is reclaimed here
+    Threads = 0;
+    ThreadFail = 1;
+    HostMainPages = 0;
+
+    status = BalloonRun(Context, FALSE, Requested, &Count);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(Count, Requested);
+    Context->Size -= Count;
+
+    ThreadFail = HOST_UNLIMITED;
+
+    CHECK_EQ(Threads, XENBUS_BALLOON_MAX_WORKERS - 1);
+    CHECK_EQ(HostMainPages, 2 * Share + 3);
+    CHECK_EQ(HostCount(HOST_PAGE_FREE), HOST_PAGES);
+
+    // Below the threshold one worker does it all
+    Threads = 0;
+    Adjust(Interface, XENBUS_BALLOON_PARALLEL_THRESHOLD - 1);
+    CHECK_EQ(Threads, 0);
+
+    Threads = 0;
+    Adjust(Interface, 0);
+    CHECK_EQ(Threads, 0);
+
+    CHECK(RangeSetIsEmpty(Context, Context->ExtentRangeSet));
+    CHECK(RangeSetIsEmpty(Context, Context->RangeSet));
+}
+
+int
+main(
+    int                         argc,
+    char                        **argv
+    )
+{
+    PXENBUS_BALLOON_CONTEXT     Context;
+    XENBUS_BALLOON_INTERFACE    Interface;
+    NTSTATUS                    status;
+
+    UNREFERENCED_PARAMETER(argc);
+    UNREFERENCED_PARAMETER(argv);
+
+    HostIsMain = TRUE;
+
+    TestExtractExtents();
+
+    status = RangeSetInitialize(NULL, &RangeSetContext);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = BalloonInitialize(NULL, &Context);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = BalloonGetInterface(Context,
+                                 XENBUS_BALLOON_INTERFACE_VERSION_MAX,
+                                 (PINTERFACE)&Interface,
+                                 sizeof (Interface));
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = XENBUS_BALLOON(Acquire, &Interface);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    TestExtentFallback(&Interface);
+    TestBreakUpExtent(&Interface);
+    TestSplit(&Interface);
+
+    XENBUS_BALLOON(Release, &Interface);
+
+    BalloonTeardown(Context);
+    RangeSetTeardown(RangeSetContext);
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("balloon");
+}
@@ -0,0 +1,634 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Stress test of the DMA interception in dma.c. Several threads at
+// DISPATCH_LEVEL map and unmap through a shared set of intercepted
+// adapters while another thread keeps getting and putting adapters of
+// its own. Every call must reach the lower adapter that sits under the
+// adapter it was made on, and nothing may be left behind.
+
+#define _XENBUS_FDO_H       // Keep the real FDO and PDO (and everything
+#define _XENBUS_PDO_H       // they pull in) out
+#define _COMMON_NAMES_H_
+
+typedef struct _XENBUS_FDO  XENBUS_FDO, *PXENBUS_FDO;
+typedef struct _XENBUS_PDO  XENBUS_PDO, *PXENBUS_PDO;
+
+#include <ntddk.h>
+#include <pthread.h>
+
+static FORCEINLINE const CHAR *
+InterfaceTypeName(
+    IN  INTERFACE_TYPE  Type
+    )
+{
+    UNREFERENCED_PARAMETER(Type);
+    return "TYPE";
+}
+
+static FORCEINLINE const CHAR *
+DmaWidthName(
+    IN  DMA_WIDTH   Width
+    )
+{
+    UNREFERENCED_PARAMETER(Width);
+    return "WIDTH";
+}
+
+static FORCEINLINE const CHAR *
+DmaSpeedName(
+    IN  DMA_SPEED   Speed
+    )
+{
+    UNREFERENCED_PARAMETER(Speed);
+    return "SPEED";
+}
+
+extern PXENBUS_FDO      PdoGetFdo(PXENBUS_PDO);
+extern PDMA_ADAPTER     PdoGetDmaAdapter(PXENBUS_PDO, PDEVICE_DESCRIPTION,
+                                         PULONG);
+extern PDEVICE_OBJECT   FdoGetPhysicalDeviceObject(PXENBUS_FDO);
+
+#include "../src/xenbus/dma.c"
+
+#include "test.h"
+
+#define ADAPTER_COUNT       8
+#define THREAD_COUNT        4
+#define ITERATION_COUNT     100000
+#define CHURN_COUNT         20000
+
+// The lower adapter, standing in for the one the HAL hands to the PDO
+typedef struct _HOST_ADAPTER {
+    DMA_ADAPTER Adapter;
+    LONG        Channels;
+    LONG        Maps;
+    LONG        Flushes;
+    LONG        Frees;
+    LONG        Lists;
+    LONG        Puts;
+    LONG        Outstanding;
+    LONG        Strays;
+} HOST_ADAPTER, *PHOST_ADAPTER;
+
+static DMA_OPERATIONS   HostOperations;
+static DEVICE_OBJECT    HostPhysicalDeviceObject;
+
+static FORCEINLINE PHOST_ADAPTER
+HostAdapter(
+    IN  PDMA_ADAPTER    Adapter
+    )
+{
+    return CONTAINING_RECORD(Adapter, HOST_ADAPTER, Adapter);
+}
+
+static VOID
+HostPutDmaAdapter(
+    IN  PDMA_ADAPTER    Adapter
+    )
+{
+    PHOST_ADAPTER       Host = HostAdapter(Adapter);
+
+    CHECK_EQ(Host->Outstanding, 0);
+    free(Host);
+}
+
+static NTSTATUS
+HostAllocateAdapterChannel(
+    IN  PDMA_ADAPTER    Adapter,
+    IN  PDEVICE_OBJECT  DeviceObject,
+    IN  ULONG           NumberOfMapRegisters,
+    IN  PDRIVER_CONTROL Function,
+    IN  PVOID           Argument
+    )
+{
+    PHOST_ADAPTER       Host = HostAdapter(Adapter);
+    IO_ALLOCATION_ACTION Action;
+
+    UNREFERENCED_PARAMETER(NumberOfMapRegisters);
+
+    if (DeviceObject != &HostPhysicalDeviceObject)
+        InterlockedIncrement(&Host->Strays);
+
+    InterlockedIncrement(&Host->Channels);
+    InterlockedIncrement(&Host->Outstanding);
+
+    // The map register base identifies the lower adapter it came from
+    Action = Function(DeviceObject, NULL, Host, Argument);
+    CHECK_EQ(Action, DeallocateObjectKeepRegisters);
+
+    return STATUS_SUCCESS;
+}
+
+static PHYSICAL_ADDRESS
+HostMapTransfer(
+    IN      PDMA_ADAPTER    Adapter,
+    IN      PMDL            Mdl,
+    IN      PVOID           MapRegisterBase,
+    IN      PVOID           CurrentVa,
+    IN OUT  PULONG          Length,
+    IN      BOOLEAN         WriteToDevice
+    )
+{
+    PHOST_ADAPTER           Host = HostAdapter(Adapter);
+    PHYSICAL_ADDRESS        LogicalAddress;
+
+    UNREFERENCED_PARAMETER(Mdl);
+    UNREFERENCED_PARAMETER(CurrentVa);
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(WriteToDevice);
+
+    if (MapRegisterBase != Host)
+        InterlockedIncrement(&Host->Strays);
+
+    InterlockedIncrement(&Host->Maps);
+
+    LogicalAddress.QuadPart = (LONGLONG)(ULONG_PTR)Host;
+    return LogicalAddress;
+}
+
+static BOOLEAN
+HostFlushAdapterBuffers(
+    IN  PDMA_ADAPTER    Adapter,
+    IN  PMDL            Mdl,
+    IN  PVOID           MapRegisterBase,
+    IN  PVOID           CurrentVa,
+    IN  ULONG           Length,
+    IN  BOOLEAN         WriteToDevice
+    )
+{
+    PHOST_ADAPTER       Host = HostAdapter(Adapter);
+
+    UNREFERENCED_PARAMETER(Mdl);
+    UNREFERENCED_PARAMETER(CurrentVa);
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(WriteToDevice);
+
+    if (MapRegisterBase != Host)
+        InterlockedIncrement(&Host->Strays);
+
+    InterlockedIncrement(&Host->Flushes);
+    return TRUE;
+}
+
+static VOID
+HostFreeMapRegisters(
+    IN  PDMA_ADAPTER    Adapter,
+    IN  PVOID           MapRegisterBase,
+    IN  ULONG           NumberOfMapRegisters
+    )
+{
+    PHOST_ADAPTER       Host = HostAdapter(Adapter);
+
+    UNREFERENCED_PARAMETER(NumberOfMapRegisters);
+
+    if (MapRegisterBase != Host)
+        InterlockedIncrement(&Host->Strays);
+
+    InterlockedIncrement(&Host->Frees);
+    InterlockedDecrement(&Host->Outstanding);
+}
+
+static NTSTATUS
+HostGetScatterGatherList(
+    IN  PDMA_ADAPTER            Adapter,
+    IN  PDEVICE_OBJECT          DeviceObject,
+    IN  PMDL                    Mdl,
+    IN  PVOID                   CurrentVa,
+    IN  ULONG                   Length,
+    IN  PDRIVER_LIST_CONTROL    Function,
+    IN  PVOID                   Argument,
+    IN  BOOLEAN                 WriteToDevice
+    )
+{
+    PHOST_ADAPTER               Host = HostAdapter(Adapter);
+    PSCATTER_GATHER_LIST        ScatterGather;
+
+    UNREFERENCED_PARAMETER(Mdl);
+    UNREFERENCED_PARAMETER(CurrentVa);
+    UNREFERENCED_PARAMETER(WriteToDevice);
+
+    if (DeviceObject != &HostPhysicalDeviceObject)
+        InterlockedIncrement(&Host->Strays);
+
+    ScatterGather = malloc(sizeof (SCATTER_GATHER_LIST) +
+                           sizeof (SCATTER_GATHER_ELEMENT));
+    if (ScatterGather == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ScatterGather->NumberOfElements = 1;
+    ScatterGather->Elements[0].Address.QuadPart = (LONGLONG)(ULONG_PTR)Host;
+    ScatterGather->Elements[0].Length = Length;
+
+    InterlockedIncrement(&Host->Lists);
+    InterlockedIncrement(&Host->Outstanding);
+
+    Function(DeviceObject, NULL, ScatterGather, Argument);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+HostPutScatterGatherList(
+    IN  PDMA_ADAPTER            Adapter,
+    IN  PSCATTER_GATHER_LIST    ScatterGather,
+    IN  BOOLEAN                 WriteToDevice
+    )
+{
+    PHOST_ADAPTER               Host = HostAdapter(Adapter);
+
+    UNREFERENCED_PARAMETER(WriteToDevice);
+
+    if (ScatterGather->Elements[0].Address.QuadPart !=
+        (LONGLONG)(ULONG_PTR)Host)
+        InterlockedIncrement(&Host->Strays);
+
+    InterlockedIncrement(&Host->Puts);
+    InterlockedDecrement(&Host->Outstanding);
+
+    free(ScatterGather);
+}
+
+PDMA_ADAPTER
+PdoGetDmaAdapter(
+    IN  PXENBUS_PDO         Pdo,
+    IN  PDEVICE_DESCRIPTION DeviceDescription,
+    OUT PULONG              NumberOfMapRegisters
+    )
+{
+    PHOST_ADAPTER           Host;
+
+    UNREFERENCED_PARAMETER(Pdo);
+    UNREFERENCED_PARAMETER(DeviceDescription);
+
+    Host = calloc(1, sizeof (HOST_ADAPTER));
+    if (Host == NULL)
+        return NULL;
+
+    Host->Adapter.Version = 3;
+    Host->Adapter.Size = sizeof (DMA_ADAPTER);
+    Host->Adapter.DmaOperations = &HostOperations;
+
+    *NumberOfMapRegisters = 16;
+    return &Host->Adapter;
+}
+
+PXENBUS_FDO
+PdoGetFdo(
+    IN  PXENBUS_PDO Pdo
+    )
+{
+    UNREFERENCED_PARAMETER(Pdo);
+    return NULL;
+}
+
+PDEVICE_OBJECT
+FdoGetPhysicalDeviceObject(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    return &HostPhysicalDeviceObject;
+}
+
+static VOID
+HostInitializeOperations(
+    VOID
+    )
+{
+    HostOperations.Size = sizeof (DMA_OPERATIONS);
+    HostOperations.PutDmaAdapter = HostPutDmaAdapter;
+    HostOperations.AllocateAdapterChannel = HostAllocateAdapterChannel;
+    HostOperations.FlushAdapterBuffers = HostFlushAdapterBuffers;
+    HostOperations.FreeMapRegisters = HostFreeMapRegisters;
+    HostOperations.MapTransfer = HostMapTransfer;
+    HostOperations.GetScatterGatherList = HostGetScatterGatherList;
+    HostOperations.PutScatterGatherList = HostPutScatterGatherList;
+}
+
+// What the driver above sees of each request
+typedef struct _TEST_REQUEST {
+    DEVICE_OBJECT           DeviceObject;
+    PVOID                   MapRegisterBase;
+    PSCATTER_GATHER_LIST    ScatterGather;
+    ULONG                   Callbacks;
+} TEST_REQUEST, *PTEST_REQUEST;
+
+static IO_ALLOCATION_ACTION
+TestControl(
+    IN  PDEVICE_OBJECT  DeviceObject,
+    IN  PIRP            Irp,
+    IN  PVOID           MapRegisterBase,
+    IN  PVOID           Argument
+    )
+{
+    PTEST_REQUEST       Request = Argument;
+
+    CHECK(DeviceObject == &Request->DeviceObject);
+    CHECK(Irp == Request->DeviceObject.CurrentIrp);
+
+    Request->MapRegisterBase = MapRegisterBase;
+    Request->Callbacks++;
+
+    return DeallocateObjectKeepRegisters;
+}
+
+static VOID
+TestListControl(
+    IN  PDEVICE_OBJECT          DeviceObject,
+    IN  PIRP                    Irp,
+    IN  PSCATTER_GATHER_LIST    ScatterGather,
+    IN  PVOID                   Argument
+    )
+{
+    PTEST_REQUEST               Request = Argument;
+
+    CHECK(DeviceObject == &Request->DeviceObject);
+    CHECK(Irp == Request->DeviceObject.CurrentIrp);
+
+    Request->ScatterGather = ScatterGather;
+    Request->Callbacks++;
+}
+
+static PDMA_ADAPTER
+TestGetAdapter(
+    IN  XENBUS_DMA_ADAPTER_TYPE Type,
+    OUT PHOST_ADAPTER           *Host
+    )
+{
+    DEVICE_DESCRIPTION          DeviceDescription;
+    ULONG                       NumberOfMapRegisters;
+    PDMA_ADAPTER                Adapter;
+    PXENBUS_DMA_CONTEXT         Context;
+
+    RtlZeroMemory(&DeviceDescription, sizeof (DEVICE_DESCRIPTION));
+
+    Adapter = DmaGetAdapter(NULL,
+                            Type,
+                            &DeviceDescription,
+                            &NumberOfMapRegisters);
+    CHECK(Adapter != NULL);
+
+    Context = CONTAINING_RECORD(Adapter->DmaOperations,
+                                XENBUS_DMA_CONTEXT,
+                                Operations);
+    *Host = HostAdapter(Context->LowerAdapter);
+
+    if (Type == XENBUS_DMA_ADAPTER_PASSTHRU)
+        CHECK(Adapter == &(*Host)->Adapter);
+    else
+        CHECK(Adapter != &(*Host)->Adapter);
+
+    return Adapter;
+}
+
+// One request of each kind on the given adapter
+static BOOLEAN
+TestRequest(
+    IN  PDMA_ADAPTER    Adapter,
+    IN  PHOST_ADAPTER   Host,
+    IN  PTEST_REQUEST   Request
+    )
+{
+    PDMA_OPERATIONS     Operations = Adapter->DmaOperations;
+    PHYSICAL_ADDRESS    LogicalAddress;
+    ULONG               Length;
+    ULONG               Callbacks;
+    NTSTATUS            status;
+
+    Callbacks = Request->Callbacks;
+
+    status = Operations->AllocateAdapterChannel(Adapter,
+                                                &Request->DeviceObject,
+                                                1,
+                                                TestControl,
+                                                Request);
+    if (!NT_SUCCESS(status) || Request->MapRegisterBase != Host)
+        return FALSE;
+
+    Length = PAGE_SIZE;
+    LogicalAddress = Operations->MapTransfer(Adapter,
+                                             NULL,
+                                             Request->MapRegisterBase,
+                                             NULL,
+                                             &Length,
+                                             TRUE);
+    if (LogicalAddress.QuadPart != (LONGLONG)(ULONG_PTR)Host)
+        return FALSE;
+
+    (VOID) Operations->FlushAdapterBuffers(Adapter,
+                                           NULL,
+                                           Request->MapRegisterBase,
+                                           NULL,
+                                           Length,
+                                           TRUE);
+    Operations->FreeMapRegisters(Adapter, Request->MapRegisterBase, 1);
+
+    status = Operations->GetScatterGatherList(Adapter,
+                                              &Request->DeviceObject,
+                                              NULL,
+                                              NULL,
+                                              PAGE_SIZE,
+                                              TestListControl,
+                                              Request,
+                                              FALSE);
+    if (!NT_SUCCESS(status) ||
+        Request->ScatterGather->Elements[0].Address.QuadPart !=
+        (LONGLONG)(ULONG_PTR)Host)
+        return FALSE;
+
+    Operations->PutScatterGatherList(Adapter, Request->ScatterGather, FALSE);
+
+    return Request->Callbacks == Callbacks + 2;
+}
+
+static PDMA_ADAPTER     TestAdapter[ADAPTER_COUNT];
+static PHOST_ADAPTER    TestHost[ADAPTER_COUNT];
+static LONG             TestCount[ADAPTER_COUNT];
+static volatile LONG    TestRunning;
+
+typedef struct _TEST_THREAD {
+    pthread_t   Thread;
+    ULONG       Index;
+    ULONG       Count;
+    ULONG       Errors;
+} TEST_THREAD, *PTEST_THREAD;
+
+static PVOID
+TestWorker(
+    IN  PVOID       Argument
+    )
+{
+    PTEST_THREAD    Thread = Argument;
+    ULONGLONG       Seed = Thread->Index + 1;
+    TEST_REQUEST    Request;
+    ULONG           Iteration;
+
+    HostProcessorIndex = Thread->Index;
+    HostIrql = DISPATCH_LEVEL;
+
+    RtlZeroMemory(&Request, sizeof (TEST_REQUEST));
+    Request.DeviceObject.CurrentIrp = (PIRP)&Request;
+
+    for (Iteration = 0; Iteration < ITERATION_COUNT; Iteration++) {
+        ULONG   Index = TestRandom(&Seed) % ADAPTER_COUNT;
+
+        if (!TestRequest(TestAdapter[Index], TestHost[Index], &Request))
+            Thread->Errors++;
+
+        InterlockedIncrement(&TestCount[Index]);
+    }
+
+    return NULL;
+}
+
+// Adapters come and go on another device while the others are in use
+static PVOID
+TestChurn(
+    IN  PVOID       Argument
+    )
+{
+    PTEST_THREAD    Thread = Argument;
+    TEST_REQUEST    Request;
+
+    HostProcessorIndex = Thread->Index;
+    HostIrql = DISPATCH_LEVEL;
+
+    RtlZeroMemory(&Request, sizeof (TEST_REQUEST));
+
+    while (ReadAcquire(&TestRunning) != 0) {
+        XENBUS_DMA_ADAPTER_TYPE Type;
+        PDMA_ADAPTER            Adapter;
+        PHOST_ADAPTER           Host;
+
+        Type = (Thread->Count++ & 1) ?
+               XENBUS_DMA_ADAPTER_SUBSTITUTE :
+               XENBUS_DMA_ADAPTER_PASSTHRU;
+
+        HostIrql = PASSIVE_LEVEL;
+        Adapter = TestGetAdapter(Type, &Host);
+        HostIrql = DISPATCH_LEVEL;
+
+        if (!TestRequest(Adapter, Host, &Request))
+            Thread->Errors++;
+
+        Adapter->DmaOperations->PutDmaAdapter(Adapter);
+    }
+
+    return NULL;
+}
+
+static VOID
+TestStress(
+    VOID
+    )
+{
+    TEST_THREAD         Thread[THREAD_COUNT];
+    TEST_THREAD         Churn;
+    ULONG               Index;
+    ULONGLONG           Start;
+    ULONGLONG           Elapsed;
+
+    for (Index = 0; Index < ADAPTER_COUNT; Index++)
+        TestAdapter[Index] = TestGetAdapter((Index & 1) ?
+                                            XENBUS_DMA_ADAPTER_SUBSTITUTE :
+                                            XENBUS_DMA_ADAPTER_PASSTHRU,
+                                            &TestHost[Index]);
+
+    TestRunning = 1;
+
+    RtlZeroMemory(&Churn, sizeof (TEST_THREAD));
+    Churn.Index = THREAD_COUNT;
+    (VOID) pthread_create(&Churn.Thread, NULL, TestChurn, &Churn);
+
+    Start = TestNow();
+
+    for (Index = 0; Index < THREAD_COUNT; Index++) {
+        Thread[Index].Index = Index;
+        Thread[Index].Count = 0;
+        Thread[Index].Errors = 0;
+        (VOID) pthread_create(&Thread[Index].Thread, NULL, TestWorker,
+                              &Thread[Index]);
+    }
+
+    for (Index = 0; Index < THREAD_COUNT; Index++) {
+        (VOID) pthread_join(Thread[Index].Thread, NULL);
+        CHECK_EQ(Thread[Index].Errors, 0);
+    }
+
+    Elapsed = TestNow() - Start;
+
+    __atomic_store_n(&TestRunning, 0, __ATOMIC_RELEASE);
+    (VOID) pthread_join(Churn.Thread, NULL);
+    CHECK_EQ(Churn.Errors, 0);
+
+    for (Index = 0; Index < ADAPTER_COUNT; Index++) {
+        PHOST_ADAPTER       Host = TestHost[Index];
+        PXENBUS_DMA_CONTEXT Context;
+
+        Context = CONTAINING_RECORD(TestAdapter[Index]->DmaOperations,
+                                    XENBUS_DMA_CONTEXT,
+                                    Operations);
+
+        CHECK_EQ(Host->Strays, 0);
+        CHECK_EQ(Host->Outstanding, 0);
+        CHECK_EQ(Host->Channels, TestCount[Index]);
+        CHECK_EQ(Host->Maps, TestCount[Index]);
+        CHECK_EQ(Host->Flushes, TestCount[Index]);
+        CHECK_EQ(Host->Frees, TestCount[Index]);
+        CHECK_EQ(Host->Lists, TestCount[Index]);
+        CHECK_EQ(Host->Puts, TestCount[Index]);
+
+        CHECK(IsListEmpty(&Context->ControlList));
+        CHECK(IsListEmpty(&Context->ListControlList));
+
+        HostIrql = PASSIVE_LEVEL;
+        TestAdapter[Index]->DmaOperations->PutDmaAdapter(TestAdapter[Index]);
+    }
+
+    printf("dma: %u threads x %u requests in %llu ms (%u adapters churned)\n",
+           THREAD_COUNT, ITERATION_COUNT,
+           (unsigned long long)(Elapsed / 1000000),
+           Churn.Count);
+}
+
+int
+main(
+    VOID
+    )
+{
+    HostInitializeOperations();
+
+    TestStress();
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("dma");
+}
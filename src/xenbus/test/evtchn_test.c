@@ -0,0 +1,669 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the event channel interface versions in evtchn.c. Clients
+// that can live without channel priorities query version 9 optionally
+// and fall back to version 8 into the same structure, so the test
+// checks that version 9 only appends to version 8 and that a version 8
+// sized buffer is refused for version 9. It then drives SetPriority
+// against a stubbed hypercall to check which requests reach Xen.
+
+#define _XENBUS_FDO_H       // Keep the real FDO (and everything it pulls in) out
+#define _COMMON_REGISTRY_H
+
+#include <ntddk.h>
+
+typedef struct _XENBUS_FDO          XENBUS_FDO, *PXENBUS_FDO;
+typedef struct _XENBUS_INTERRUPT    XENBUS_INTERRUPT, *PXENBUS_INTERRUPT;
+
+#include "../src/xenbus/suspend.h"
+#include "../src/xenbus/debug.h"
+#include "../src/xenbus/shared_info.h"
+
+extern PXENBUS_SUSPEND_CONTEXT FdoGetSuspendContext(PXENBUS_FDO);
+extern PXENBUS_DEBUG_CONTEXT FdoGetDebugContext(PXENBUS_FDO);
+extern PXENBUS_SHARED_INFO_CONTEXT FdoGetSharedInfoContext(PXENBUS_FDO);
+extern PXENBUS_INTERRUPT FdoAllocateInterrupt(PXENBUS_FDO, KINTERRUPT_MODE,
+                                              USHORT, UCHAR,
+                                              KSERVICE_ROUTINE, PVOID);
+extern VOID FdoFreeInterrupt(PXENBUS_FDO, PXENBUS_INTERRUPT);
+extern UCHAR FdoGetInterruptVector(PXENBUS_FDO, PXENBUS_INTERRUPT);
+extern ULONG FdoGetInterruptLine(PXENBUS_FDO, PXENBUS_INTERRUPT);
+extern KIRQL FdoAcquireInterruptLock(PXENBUS_FDO, PXENBUS_INTERRUPT);
+extern VOID FdoReleaseInterruptLock(PXENBUS_FDO, PXENBUS_INTERRUPT, KIRQL);
+extern NTSTATUS RegistryQueryDwordValue(HANDLE, PCHAR, PULONG);
+extern HANDLE DriverGetParametersKey(VOID);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_SUSPEND
+#define XENBUS_SUSPEND(_Method, _Interface, ...)    \
+    (_Interface)->_Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_SHARED_INFO
+#define XENBUS_SHARED_INFO(_Method, _Interface, ...)    \
+    (_Interface)->SharedInfo ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenbus/evtchn_abi.h"
+
+#undef  XENBUS_EVTCHN_ABI
+#define XENBUS_EVTCHN_ABI(_Method, _Abi, ...)   \
+    (_Abi)->EvtchnAbi ## _Method((_Abi)->Context, ##__VA_ARGS__)
+
+// MSVC reads a BOOLEAN or USHORT straight out of its '...' slot but gcc
+// insists on the promoted int
+#include <stdarg.h>
+
+#undef  va_arg
+#define va_arg(_Arguments, _Type)                                       \
+        __builtin_choose_expr(sizeof (_Type) < sizeof (int),            \
+                              (_Type)__builtin_va_arg(_Arguments, int), \
+                              __builtin_va_arg(_Arguments, _Type))
+
+#include "../src/xenbus/evtchn.c"
+
+#include "test.h"
+
+// Everything else that evtchn.c calls belongs to paths this test does
+// not drive
+
+#define HOST_NOT_REACHED()                                      \
+        do {                                                    \
+            fprintf(stderr, "%s: not reached\n", __func__);     \
+            abort();                                            \
+        } while (FALSE)
+
+PXENBUS_SUSPEND_CONTEXT
+FdoGetSuspendContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_DEBUG_CONTEXT
+FdoGetDebugContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_SHARED_INFO_CONTEXT
+FdoGetSharedInfoContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_INTERRUPT
+FdoAllocateInterrupt(
+    IN  PXENBUS_FDO      Fdo,
+    IN  KINTERRUPT_MODE  InterruptMode,
+    IN  USHORT           Group,
+    IN  UCHAR            Number,
+    IN  KSERVICE_ROUTINE Callback,
+    IN  PVOID            Argument OPTIONAL
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+FdoFreeInterrupt(
+    IN  PXENBUS_FDO       Fdo,
+    IN  PXENBUS_INTERRUPT Interrupt
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+UCHAR
+FdoGetInterruptVector(
+    IN  PXENBUS_FDO       Fdo,
+    IN  PXENBUS_INTERRUPT Interrupt
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+ULONG
+FdoGetInterruptLine(
+    IN  PXENBUS_FDO       Fdo,
+    IN  PXENBUS_INTERRUPT Interrupt
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+KIRQL
+FdoAcquireInterruptLock(
+    IN  PXENBUS_FDO       Fdo,
+    IN  PXENBUS_INTERRUPT Interrupt
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+FdoReleaseInterruptLock(
+    IN  PXENBUS_FDO       Fdo,
+    IN  PXENBUS_INTERRUPT Interrupt,
+    IN  KIRQL             Irql
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+HANDLE
+DriverGetParametersKey(
+    VOID
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+RegistryQueryDwordValue(
+    IN  HANDLE Key,
+    IN  PCHAR  Name,
+    OUT PULONG Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+SuspendGetInterface(
+    IN     PXENBUS_SUSPEND_CONTEXT Context,
+    IN     ULONG                   Version,
+    IN OUT PINTERFACE              Interface,
+    IN     ULONG                   Size
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+DebugGetInterface(
+    IN     PXENBUS_DEBUG_CONTEXT Context,
+    IN     ULONG                 Version,
+    IN OUT PINTERFACE            Interface,
+    IN     ULONG                 Size
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+SharedInfoGetInterface(
+    IN     PXENBUS_SHARED_INFO_CONTEXT Context,
+    IN     ULONG                       Version,
+    IN OUT PINTERFACE                  Interface,
+    IN     ULONG                       Size
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EvtchnTwoLevelInitialize(
+    IN  PXENBUS_FDO                Fdo,
+    OUT PXENBUS_EVTCHN_ABI_CONTEXT *Context
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+EvtchnTwoLevelGetAbi(
+    IN  PXENBUS_EVTCHN_ABI_CONTEXT Context,
+    OUT PXENBUS_EVTCHN_ABI         Abi
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+EvtchnTwoLevelTeardown(
+    IN  PXENBUS_EVTCHN_ABI_CONTEXT Context
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EvtchnFifoInitialize(
+    IN  PXENBUS_FDO                Fdo,
+    OUT PXENBUS_EVTCHN_ABI_CONTEXT *Context
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+EvtchnFifoGetAbi(
+    IN  PXENBUS_EVTCHN_ABI_CONTEXT Context,
+    OUT PXENBUS_EVTCHN_ABI         Abi
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+EvtchnFifoTeardown(
+    IN  PXENBUS_EVTCHN_ABI_CONTEXT Context
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableCreate(
+    OUT PXENBUS_HASH_TABLE *Table
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+HashTableDestroy(
+    IN  PXENBUS_HASH_TABLE Table
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableAdd(
+    IN  PXENBUS_HASH_TABLE Table,
+    IN  ULONG_PTR          Key,
+    IN  ULONG_PTR          Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableRemove(
+    IN  PXENBUS_HASH_TABLE Table,
+    IN  ULONG_PTR          Key
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableLookup(
+    IN  PXENBUS_HASH_TABLE Table,
+    IN  ULONG_PTR          Key,
+    OUT PULONG_PTR         Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HvmSetParam(
+    IN  ULONG     Parameter,
+    IN  ULONGLONG Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HvmGetParam(
+    IN  ULONG      Parameter,
+    OUT PULONGLONG Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HvmSetEvtchnUpcallVector(
+    IN  unsigned int vcpu_id,
+    IN  UCHAR        Vector
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+SystemVirtualCpuIndex(
+    IN  ULONG        Index,
+    OUT unsigned int *vcpu_id
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelSend(
+    IN  evtchn_port_t Port
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelAllocateUnbound(
+    IN  domid_t       Domain,
+    OUT evtchn_port_t *Port
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelBindInterDomain(
+    IN  domid_t       RemoteDomain,
+    IN  evtchn_port_t RemotePort,
+    OUT evtchn_port_t *LocalPort
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelBindVirq(
+    IN  uint32_t      Virq,
+    OUT evtchn_port_t *LocalPort
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelQueryInterDomain(
+    IN  evtchn_port_t LocalPort,
+    OUT domid_t       *RemoteDomain,
+    OUT evtchn_port_t *RemotePort
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelClose(
+    IN  evtchn_port_t LocalPort
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelReset(
+    VOID
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelBindVirtualCpu(
+    IN  ULONG        LocalPort,
+    IN  unsigned int vcpu_id
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+EventChannelUnmask(
+    IN  ULONG LocalPort
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+BOOLEAN
+KeInsertQueueDpc(
+    IN  PRKDPC Dpc,
+    IN  PVOID  SystemArgument1,
+    IN  PVOID  SystemArgument2
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+BOOLEAN
+KeRemoveQueueDpc(
+    IN  PRKDPC Dpc
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+KeFlushQueuedDpcs(
+    VOID
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+USHORT
+RtlCaptureStackBackTrace(
+    IN  ULONG  FramesToSkip,
+    IN  ULONG  FramesToCapture,
+    OUT PVOID  *BackTrace,
+    OUT PULONG BackTraceHash OPTIONAL
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+ModuleLookup(
+    IN  ULONG_PTR  Address,
+    OUT PCHAR      *Name,
+    OUT PULONG_PTR Offset
+    )
+{
+    HOST_NOT_REACHED();
+}
+VOID
+LogPrintf(
+    IN  LOG_LEVEL   Level,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+}
+
+static ULONG    HostSetPriorityCalls;
+static NTSTATUS HostSetPriorityStatus;
+
+NTSTATUS
+EventChannelSetPriority(
+    IN  ULONG   LocalPort,
+    IN  ULONG   Priority
+    )
+{
+    UNREFERENCED_PARAMETER(LocalPort);
+    UNREFERENCED_PARAMETER(Priority);
+
+    HostSetPriorityCalls++;
+    return HostSetPriorityStatus;
+}
+
+#define V8_FIELD(_Field)                                                \
+        C_ASSERT(FIELD_OFFSET(struct _XENBUS_EVTCHN_INTERFACE_V8, _Field) == \
+                 FIELD_OFFSET(struct _XENBUS_EVTCHN_INTERFACE_V9, _Field))
+
+V8_FIELD(Interface);
+V8_FIELD(EvtchnAcquire);
+V8_FIELD(EvtchnRelease);
+V8_FIELD(EvtchnOpen);
+V8_FIELD(EvtchnBind);
+V8_FIELD(EvtchnUnmask);
+V8_FIELD(EvtchnSend);
+V8_FIELD(EvtchnTrigger);
+V8_FIELD(EvtchnGetCount);
+V8_FIELD(EvtchnWait);
+V8_FIELD(EvtchnGetPort);
+V8_FIELD(EvtchnClose);
+
+C_ASSERT(FIELD_OFFSET(struct _XENBUS_EVTCHN_INTERFACE_V9, EvtchnSetPriority) ==
+         sizeof (struct _XENBUS_EVTCHN_INTERFACE_V8));
+
+static VOID
+TestVersions(
+    VOID
+    )
+{
+    XENBUS_EVTCHN_CONTEXT               Context;
+    struct _XENBUS_EVTCHN_INTERFACE_V8  Version8;
+    XENBUS_EVTCHN_INTERFACE             Version9;
+    NTSTATUS                            status;
+
+    RtlZeroMemory(&Context, sizeof (Context));
+
+    // What a client does against a XENBUS that has version 9
+    RtlZeroMemory(&Version9, sizeof (Version9));
+    Version9.Interface.Version = 9;
+
+    status = EvtchnGetInterface(&Context, 9, &Version9.Interface,
+                                sizeof (Version9));
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK(Version9.Interface.Context == &Context);
+    CHECK(Version9.EvtchnSetPriority == EvtchnSetPriority);
+
+    // What the fallback does against one that only has version 8
+    RtlZeroMemory(&Version8, sizeof (Version8));
+    Version8.Interface.Version = 8;
+
+    status = EvtchnGetInterface(&Context, 8, &Version8.Interface,
+                                sizeof (Version8));
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK(Version8.Interface.Context == &Context);
+
+    CHECK(memcmp((PUCHAR)&Version8 + FIELD_OFFSET(struct _XENBUS_EVTCHN_INTERFACE_V8, EvtchnAcquire),
+                 (PUCHAR)&Version9 + FIELD_OFFSET(struct _XENBUS_EVTCHN_INTERFACE_V9, EvtchnAcquire),
+                 sizeof (Version8) -
+                 FIELD_OFFSET(struct _XENBUS_EVTCHN_INTERFACE_V8, EvtchnAcquire)) == 0);
+
+    // A version 8 sized buffer must not be overrun by version 9
+    RtlZeroMemory(&Version9, sizeof (Version9));
+    Version9.Interface.Version = 9;
+
+    status = EvtchnGetInterface(&Context, 9, &Version9.Interface,
+                                sizeof (Version8));
+    CHECK_EQ(status, STATUS_BUFFER_OVERFLOW);
+    CHECK(Version9.EvtchnSetPriority == NULL);
+
+    status = EvtchnGetInterface(&Context, 10, &Version9.Interface,
+                                sizeof (Version9));
+    CHECK_EQ(status, STATUS_NOT_SUPPORTED);
+}
+
+static VOID
+TestSetPriority(
+    VOID
+    )
+{
+    XENBUS_EVTCHN_CONTEXT   Context;
+    XENBUS_EVTCHN_CHANNEL   Channel;
+    INTERFACE               Interface;
+    NTSTATUS                status;
+
+    RtlZeroMemory(&Context, sizeof (Context));
+    RtlZeroMemory(&Interface, sizeof (Interface));
+    Interface.Context = &Context;
+
+    RtlZeroMemory(&Channel, sizeof (Channel));
+    Channel.Magic = XENBUS_EVTCHN_CHANNEL_MAGIC;
+    KeInitializeSpinLock(&Channel.Lock);
+    Channel.Active = TRUE;
+    Channel.LocalPort = 42;
+    Channel.Priority = XENBUS_EVTCHN_PRIORITY_DEFAULT;
+
+    HostSetPriorityCalls = 0;
+    HostSetPriorityStatus = STATUS_SUCCESS;
+
+    status = EvtchnSetPriority(&Interface, &Channel,
+                               (XENBUS_EVTCHN_PRIORITY)(EVTCHN_FIFO_PRIORITY_MIN + 1));
+    CHECK_EQ(status, STATUS_INVALID_PARAMETER);
+    CHECK_EQ(HostSetPriorityCalls, 0);
+
+    status = EvtchnSetPriority(&Interface, &Channel,
+                               XENBUS_EVTCHN_PRIORITY_DEFAULT);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(HostSetPriorityCalls, 0);
+
+    status = EvtchnSetPriority(&Interface, &Channel,
+                               XENBUS_EVTCHN_PRIORITY_HIGH);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(HostSetPriorityCalls, 1);
+    CHECK_EQ(Channel.Priority, XENBUS_EVTCHN_PRIORITY_HIGH);
+
+    // Setting it again must not cost another hypercall
+    status = EvtchnSetPriority(&Interface, &Channel,
+                               XENBUS_EVTCHN_PRIORITY_HIGH);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(HostSetPriorityCalls, 1);
+
+    // The two-level ABI has no priorities: the failure is reported and
+    // the recorded priority is left alone
+    HostSetPriorityStatus = STATUS_NOT_IMPLEMENTED;
+
+    status = EvtchnSetPriority(&Interface, &Channel,
+                               XENBUS_EVTCHN_PRIORITY_LOW);
+    CHECK_EQ(status, STATUS_NOT_IMPLEMENTED);
+    CHECK_EQ(HostSetPriorityCalls, 2);
+    CHECK_EQ(Channel.Priority, XENBUS_EVTCHN_PRIORITY_HIGH);
+
+    // A closed channel is left alone
+    HostSetPriorityStatus = STATUS_SUCCESS;
+    Channel.Active = FALSE;
+
+    status = EvtchnSetPriority(&Interface, &Channel,
+                               XENBUS_EVTCHN_PRIORITY_LOW);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(HostSetPriorityCalls, 2);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestVersions();
+    TestSetPriority();
+
+    return TEST_RESULT("evtchn");
+}
@@ -0,0 +1,690 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of grant table expansion in gnttab.c. The multicall that adds
+// frames to the physmap is replaced by a fake hypervisor that records
+// where each frame was placed and can fail a single add_to_physmap or a
+// whole flush, and the range set of free references is replaced by a
+// bitmap that catches a reference being freed twice or taken while not
+// free. The test grows the table in batches, checks that a failure part
+// way through publishes neither frames nor references and that a retry
+// starts again from the same frame, then drives the entry constructor
+// through repeated exhaustion to check that the table doubles, and
+// finally remaps and contracts the table as resume and release do.
+
+#define _XENBUS_FDO_H       // Keep the real FDO (and everything it pulls in) out
+#define _COMMON_REGISTRY_H
+
+#include <ntddk.h>
+
+typedef struct _XENBUS_FDO  XENBUS_FDO, *PXENBUS_FDO;
+
+#include "../src/xenbus/suspend.h"
+#include "../src/xenbus/debug.h"
+#include "../src/xenbus/range_set.h"
+#include "../src/xenbus/cache.h"
+
+extern PXENBUS_SUSPEND_CONTEXT FdoGetSuspendContext(PXENBUS_FDO);
+extern PXENBUS_DEBUG_CONTEXT FdoGetDebugContext(PXENBUS_FDO);
+extern PXENBUS_RANGE_SET_CONTEXT FdoGetRangeSetContext(PXENBUS_FDO);
+extern PXENBUS_CACHE_CONTEXT FdoGetCacheContext(PXENBUS_FDO);
+extern NTSTATUS FdoAllocateIoSpace(PXENBUS_FDO, ULONG, PPHYSICAL_ADDRESS);
+extern VOID FdoFreeIoSpace(PXENBUS_FDO, PHYSICAL_ADDRESS, ULONG);
+extern NTSTATUS RegistryQueryDwordValue(HANDLE, PCHAR, PULONG);
+extern HANDLE DriverGetParametersKey(VOID);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_SUSPEND
+#define XENBUS_SUSPEND(_Method, _Interface, ...)    \
+    (_Interface)->_Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_RANGE_SET
+#define XENBUS_RANGE_SET(_Method, _Interface, ...)    \
+    (_Interface)->RangeSet ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_CACHE
+#define XENBUS_CACHE(_Method, _Interface, ...)    \
+    (_Interface)->Cache ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenbus/gnttab.c"
+
+#include "test.h"
+
+#define HOST_MAX_FRAMES     64
+#define HOST_BASE_PFN       0x100000ull
+#define HOST_NO_FAILURE     ((ULONG)-1)
+
+#define HOST_MAX_REFERENCES (HOST_MAX_FRAMES * XENBUS_GNTTAB_ENTRY_PER_FRAME)
+
+// Where each grant table frame has been placed, or 0
+static xen_pfn_t    HostPhysmap[HOST_MAX_FRAMES];
+static ULONG        HostAdds;
+static ULONG        HostFlushes;
+static ULONG        HostLargestBatch;
+
+// The frame whose add_to_physmap fails, and the flush (counting from
+// zero) that fails outright
+static ULONG        HostFailFrame;
+static ULONG        HostFailFlush;
+
+// Free grant references
+static BOOLEAN      HostFree[HOST_MAX_REFERENCES];
+static ULONG        HostFreeCount;
+
+static VOID
+HostReset(
+    VOID
+    )
+{
+    RtlZeroMemory(HostPhysmap, sizeof (HostPhysmap));
+    HostAdds = 0;
+    HostFlushes = 0;
+    HostLargestBatch = 0;
+    HostFailFrame = HOST_NO_FAILURE;
+    HostFailFlush = HOST_NO_FAILURE;
+}
+
+VOID
+MulticallInitialize(
+    OUT PXEN_MULTICALL  Multicall
+    )
+{
+    Multicall->Count = 0;
+}
+
+NTSTATUS
+MulticallAdd(
+    IN  PXEN_MULTICALL  Multicall,
+    IN  ULONG           Ordinal,
+    IN  ULONG           Count,
+    ...
+    )
+{
+    multicall_entry_t   *Entry;
+    va_list             Arguments;
+    ULONG               Index;
+
+    if (Multicall->Count == XEN_MULTICALL_MAXIMUM_ENTRIES ||
+        Count > ARRAYSIZE(Entry->args))
+        return STATUS_BUFFER_OVERFLOW;
+
+    Entry = &Multicall->Entry[Multicall->Count];
+    Entry->op = Ordinal;
+    Entry->result = 0;
+
+    va_start(Arguments, Count);
+    for (Index = 0; Index < Count; Index++)
+        Entry->args[Index] = va_arg(Arguments, ULONG_PTR);
+    va_end(Arguments);
+
+    Multicall->ArgumentCount[Multicall->Count++] = Count;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+MulticallFlush(
+    IN  PXEN_MULTICALL  Multicall
+    )
+{
+    ULONG               Index;
+
+    if (HostFlushes++ == HostFailFlush)
+        return STATUS_UNSUCCESSFUL;
+
+    HostLargestBatch = __max(HostLargestBatch, Multicall->Count);
+
+    for (Index = 0; Index < Multicall->Count; Index++) {
+        multicall_entry_t           *Entry = &Multicall->Entry[Index];
+        struct xen_add_to_physmap   *op;
+
+        CHECK_EQ(Entry->op, __HYPERVISOR_memory_op);
+        CHECK_EQ(Multicall->ArgumentCount[Index], 2);
+        CHECK_EQ(Entry->args[0], XENMEM_add_to_physmap);
+
+        op = (struct xen_add_to_physmap *)Entry->args[1];
+        CHECK_EQ(op->domid, DOMID_SELF);
+        CHECK_EQ(op->space, XENMAPSPACE_grant_table);
+
+        HostAdds++;
+
+        if (op->idx >= HOST_MAX_FRAMES) {
+            CHECK(FALSE);
+            Entry->result = (xen_ulong_t)-EINVAL;
+            continue;
+        }
+
+        if (op->idx == HostFailFrame) {
+            Entry->result = (xen_ulong_t)-ENOMEM;
+            continue;
+        }
+
+        HostPhysmap[op->idx] = op->gpfn;
+        Entry->result = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+LONG_PTR
+MulticallResult(
+    IN  PXEN_MULTICALL  Multicall,
+    IN  ULONG           Index
+    )
+{
+    CHECK(Index < Multicall->Count);
+    return (LONG_PTR)Multicall->Entry[Index].result;
+}
+
+static NTSTATUS
+HostRangeSetPut(
+    IN  PINTERFACE          Interface,
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  LONGLONG            Start,
+    IN  ULONGLONG           Count
+    )
+{
+    ULONGLONG               Index;
+
+    CHECK(Start >= 0 && Start + Count <= HOST_MAX_REFERENCES);
+
+    for (Index = 0; Index < Count; Index++) {
+        CHECK(!HostFree[Start + Index]);
+        HostFree[Start + Index] = TRUE;
+    }
+
+    HostFreeCount += (ULONG)Count;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+HostRangeSetPop(
+    IN  PINTERFACE          Interface,
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  ULONGLONG           Count,
+    OUT PLONGLONG           Start
+    )
+{
+    ULONG                   Index;
+
+    CHECK_EQ(Count, 1);
+
+    for (Index = 0; Index < HOST_MAX_REFERENCES; Index++) {
+        if (HostFree[Index]) {
+            HostFree[Index] = FALSE;
+            HostFreeCount--;
+            *Start = Index;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+static NTSTATUS
+HostRangeSetGet(
+    IN  PINTERFACE          Interface,
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  LONGLONG            Start,
+    IN  ULONGLONG           Count
+    )
+{
+    ULONGLONG               Index;
+
+    CHECK(Start >= 0 && Start + Count <= HOST_MAX_REFERENCES);
+
+    for (Index = 0; Index < Count; Index++) {
+        CHECK(HostFree[Start + Index]);
+        HostFree[Start + Index] = FALSE;
+    }
+
+    HostFreeCount -= (ULONG)Count;
+    return STATUS_SUCCESS;
+}
+
+VOID
+LogPrintf(
+    IN  LOG_LEVEL   Level,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+}
+
+// Everything else that gnttab.c calls belongs to paths this test does
+// not drive
+
+#define HOST_NOT_REACHED()                                      \
+        do {                                                    \
+            fprintf(stderr, "%s: not reached\n", __func__);     \
+            abort();                                            \
+        } while (FALSE)
+
+PXENBUS_SUSPEND_CONTEXT
+FdoGetSuspendContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_DEBUG_CONTEXT
+FdoGetDebugContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_RANGE_SET_CONTEXT
+FdoGetRangeSetContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_CACHE_CONTEXT
+FdoGetCacheContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+FdoAllocateIoSpace(
+    IN  PXENBUS_FDO         Fdo,
+    IN  ULONG               Size,
+    OUT PPHYSICAL_ADDRESS   Address
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+FdoFreeIoSpace(
+    IN  PXENBUS_FDO         Fdo,
+    IN  PHYSICAL_ADDRESS    Address,
+    IN  ULONG               Size
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+SchedYield(
+    VOID
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+GrantTableQuerySize(
+    OUT uint32_t    *Current OPTIONAL,
+    OUT uint32_t    *Maximum OPTIONAL
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+GrantTableMapForeignPages(
+    IN  USHORT              Domain,
+    IN  ULONG               NumberPages,
+    IN  PULONG              GrantRef,
+    IN  PHYSICAL_ADDRESS    Address,
+    IN  BOOLEAN             ReadOnly,
+    OUT PULONG              Handle
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+GrantTableUnmapForeignPages(
+    IN  ULONG               NumberPages,
+    IN  PULONG              Handle,
+    IN  PHYSICAL_ADDRESS    Address
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableCreate(
+    OUT PXENBUS_HASH_TABLE *Table
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+HashTableDestroy(
+    IN  PXENBUS_HASH_TABLE Table
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableAdd(
+    IN  PXENBUS_HASH_TABLE Table,
+    IN  ULONG_PTR          Key,
+    IN  ULONG_PTR          Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableRemove(
+    IN  PXENBUS_HASH_TABLE Table,
+    IN  ULONG_PTR          Key
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+HashTableLookup(
+    IN  PXENBUS_HASH_TABLE Table,
+    IN  ULONG_PTR          Key,
+    OUT PULONG_PTR         Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PVOID
+MmMapIoSpace(
+    IN  PHYSICAL_ADDRESS    PhysicalAddress,
+    IN  SIZE_T              NumberOfBytes,
+    IN  MEMORY_CACHING_TYPE CacheType
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+MmUnmapIoSpace(
+    IN  PVOID   BaseAddress,
+    IN  SIZE_T  NumberOfBytes
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+HANDLE
+DriverGetParametersKey(
+    VOID
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+NTSTATUS
+RegistryQueryDwordValue(
+    IN  HANDLE Key,
+    IN  PCHAR  Name,
+    OUT PULONG Value
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+static XENBUS_GNTTAB_CONTEXT    TestContext;
+
+static PXENBUS_GNTTAB_CONTEXT
+TestCreate(
+    IN  ULONG   MaximumFrameCount
+    )
+{
+    PXENBUS_GNTTAB_CONTEXT  Context = &TestContext;
+
+    HostReset();
+    RtlZeroMemory(HostFree, sizeof (HostFree));
+    HostFreeCount = 0;
+
+    RtlZeroMemory(Context, sizeof (XENBUS_GNTTAB_CONTEXT));
+    KeInitializeSpinLock(&Context->ExpandLock);
+    Context->MaximumFrameCount = MaximumFrameCount;
+    Context->Address.QuadPart = HOST_BASE_PFN << PAGE_SHIFT;
+    Context->FrameIndex = -1;
+
+    Context->RangeSetInterface.RangeSetPut = HostRangeSetPut;
+    Context->RangeSetInterface.RangeSetPop = HostRangeSetPop;
+    Context->RangeSetInterface.RangeSetGet = HostRangeSetGet;
+
+    return Context;
+}
+
+// Frames [0, Count) are in place and their references, less the reserved
+// ones, are free
+static VOID
+TestCheckFrames(
+    IN  ULONG   Count
+    )
+{
+    ULONG       Index;
+
+    for (Index = 0; Index < HOST_MAX_FRAMES; Index++)
+        CHECK_EQ(HostPhysmap[Index],
+                 (Index < Count) ? HOST_BASE_PFN + Index : 0);
+
+    for (Index = 0; Index < HOST_MAX_REFERENCES; Index++)
+        CHECK_EQ(HostFree[Index],
+                 Index >= XENBUS_GNTTAB_RESERVED_ENTRY_COUNT &&
+                 Index < Count * XENBUS_GNTTAB_ENTRY_PER_FRAME);
+}
+
+static VOID
+TestExpandBatches(
+    VOID
+    )
+{
+    PXENBUS_GNTTAB_CONTEXT  Context = TestCreate(HOST_MAX_FRAMES);
+    NTSTATUS                status;
+
+    // 40 frames take two full multicalls and a partial one
+    status = GnttabExpand(Context, -1, 40);
+    CHECK(NT_SUCCESS(status));
+    CHECK_EQ(Context->FrameIndex, 39);
+    CHECK_EQ(Context->ExpandCount, 1);
+    CHECK_EQ(HostFlushes, 3);
+    CHECK_EQ(HostAdds, 40);
+    CHECK_EQ(HostLargestBatch, XEN_MULTICALL_MAXIMUM_ENTRIES);
+    TestCheckFrames(40);
+
+    // Someone else has already expanded past this caller's sample
+    status = GnttabExpand(Context, 10, 5);
+    CHECK(NT_SUCCESS(status));
+    CHECK_EQ(Context->FrameIndex, 39);
+    CHECK_EQ(Context->ExpandCount, 1);
+    CHECK_EQ(HostFlushes, 3);
+
+    // Growth stops at the hypervisor's maximum
+    HostReset();
+    status = GnttabExpand(Context, 39, 40);
+    CHECK(NT_SUCCESS(status));
+    CHECK_EQ(Context->FrameIndex, HOST_MAX_FRAMES - 1);
+    CHECK_EQ(Context->ExpandCount, 2);
+    CHECK_EQ(HostFlushes, 2);
+    CHECK_EQ(HostAdds, HOST_MAX_FRAMES - 40);
+    CHECK_EQ(HostPhysmap[39], 0);
+    CHECK_EQ(HostPhysmap[40], HOST_BASE_PFN + 40);
+    CHECK_EQ(HostPhysmap[HOST_MAX_FRAMES - 1], HOST_BASE_PFN + HOST_MAX_FRAMES - 1);
+    CHECK_EQ(HostFreeCount, HOST_MAX_REFERENCES - XENBUS_GNTTAB_RESERVED_ENTRY_COUNT);
+
+    status = GnttabExpand(Context, HOST_MAX_FRAMES - 1, 1);
+    CHECK_EQ(status, STATUS_INSUFFICIENT_RESOURCES);
+    CHECK_EQ(Context->FailedCount, 1);
+    CHECK_EQ(HostFlushes, 2);
+
+    // Resume puts every frame back where it was, in batches
+    HostReset();
+    GnttabMap(Context);
+    CHECK_EQ(HostFlushes, HOST_MAX_FRAMES / XEN_MULTICALL_MAXIMUM_ENTRIES);
+    TestCheckFrames(HOST_MAX_FRAMES);
+}
+
+static VOID
+TestExpandFailure(
+    VOID
+    )
+{
+    struct {
+        ULONG   FailFrame;
+        ULONG   FailFlush;
+        ULONG   Flushes;
+    } Case[] = {
+        { 0, HOST_NO_FAILURE, 1 },      // first frame of the first batch
+        { 20, HOST_NO_FAILURE, 2 },     // inside the second batch
+        { 39, HOST_NO_FAILURE, 3 },     // last frame of the last batch
+        { HOST_NO_FAILURE, 0, 1 },      // the first multicall
+        { HOST_NO_FAILURE, 2, 3 },      // the last multicall
+    };
+    ULONG                   Index;
+
+    for (Index = 0; Index < ARRAYSIZE(Case); Index++) {
+        PXENBUS_GNTTAB_CONTEXT  Context = TestCreate(HOST_MAX_FRAMES);
+        NTSTATUS                status;
+
+        status = GnttabExpand(Context, -1, 8);
+        CHECK(NT_SUCCESS(status));
+
+        // Frames are numbered from the end of the table, so move the
+        // failure with them
+        HostReset();
+        HostFailFrame = (Case[Index].FailFrame == HOST_NO_FAILURE) ?
+                        HOST_NO_FAILURE :
+                        8 + Case[Index].FailFrame;
+        HostFailFlush = Case[Index].FailFlush;
+
+        // Frames that did get mapped are neither published nor do their
+        // references become free
+        status = GnttabExpand(Context, 7, 40);
+        CHECK(!NT_SUCCESS(status));
+        CHECK_EQ(Context->FrameIndex, 7);
+        CHECK_EQ(Context->ExpandCount, 1);
+        CHECK_EQ(Context->FailedCount, 1);
+        CHECK_EQ(HostFlushes, Case[Index].Flushes);
+        CHECK_EQ(HostFreeCount,
+                 8 * XENBUS_GNTTAB_ENTRY_PER_FRAME - XENBUS_GNTTAB_RESERVED_ENTRY_COUNT);
+
+        // The next attempt starts again from the same frame
+        HostFailFrame = HOST_NO_FAILURE;
+        HostFailFlush = HOST_NO_FAILURE;
+        HostFlushes = 0;
+        HostAdds = 0;
+
+        status = GnttabExpand(Context, 7, 40);
+        CHECK(NT_SUCCESS(status));
+        CHECK_EQ(Context->FrameIndex, 47);
+        CHECK_EQ(HostFlushes, 3);
+        CHECK_EQ(HostAdds, 40);
+
+        GnttabMap(Context);
+        TestCheckFrames(48);
+    }
+}
+
+static VOID
+TestEntryExhaustion(
+    VOID
+    )
+{
+    PXENBUS_GNTTAB_CONTEXT  Context = TestCreate(HOST_MAX_FRAMES);
+    XENBUS_GNTTAB_CACHE     Cache;
+    static XENBUS_GNTTAB_ENTRY  Entry[HOST_MAX_REFERENCES];
+    ULONG                   Count;
+    ULONG                   Index;
+    NTSTATUS                status;
+
+    RtlZeroMemory(&Cache, sizeof (Cache));
+    Cache.Context = Context;
+
+    status = GnttabExpand(Context, -1, 1);
+    CHECK(NT_SUCCESS(status));
+
+    // Each time the references run out the table doubles, until it
+    // reaches the maximum
+    for (Count = 0; Count < HOST_MAX_REFERENCES; Count++) {
+        LONG    FrameIndex = Context->FrameIndex;
+        BOOLEAN Exhausted = (HostFreeCount == 0);
+
+        status = GnttabEntryCtor(&Cache, &Entry[Count]);
+        if (!NT_SUCCESS(status))
+            break;
+
+        CHECK_EQ(Entry[Count].Magic, XENBUS_GNTTAB_ENTRY_MAGIC);
+        CHECK_EQ(Entry[Count].Reference, XENBUS_GNTTAB_RESERVED_ENTRY_COUNT + Count);
+        CHECK_EQ(Context->FrameIndex,
+                 Exhausted ? (FrameIndex + 1) * 2 - 1 : FrameIndex);
+    }
+
+    CHECK_EQ(status, STATUS_INSUFFICIENT_RESOURCES);
+    CHECK_EQ(Count, HOST_MAX_REFERENCES - XENBUS_GNTTAB_RESERVED_ENTRY_COUNT);
+    CHECK_EQ(Context->FrameIndex, HOST_MAX_FRAMES - 1);
+
+    // 1 -> 2 -> 4 -> ... -> 64 frames, then one more attempt that fails
+    CHECK_EQ(Context->ExpandCount, 7);
+    CHECK_EQ(Context->ExhaustedCount, 7);
+    CHECK_EQ(Context->FailedCount, 1);
+
+    for (Index = 0; Index < Count; Index++)
+        GnttabEntryDtor(&Cache, &Entry[Index]);
+
+    TestCheckFrames(HOST_MAX_FRAMES);
+
+    // Release takes every reference back out of the range set
+    GnttabContract(Context);
+    CHECK_EQ(Context->FrameIndex, -1);
+    CHECK_EQ(HostFreeCount, 0);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    TestExpandBatches();
+    TestExpandFailure();
+    TestEntryExhaustion();
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("gnttab");
+}
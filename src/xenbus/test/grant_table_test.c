@@ -0,0 +1,497 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the batched grant mapping in grant_table.c. The grant table
+// hypercall is replaced by a fake hypervisor that records which frames
+// are mapped, and can fail single operations or whole hypercalls. The
+// test checks that a map that fails part way through leaves nothing
+// mapped, that an unmap carries on past failures, and then compares the
+// per-page and batched calls.
+
+#include <ntddk.h>
+#include <stdarg.h>
+
+#include "../src/xen/grant_table.c"
+
+#include "test.h"
+
+#define HOST_MAX_PAGES  4096
+#define HOST_BASE       0x100000000ull
+
+#define HOST_NO_FAILURE ((ULONG)-1)
+
+typedef struct _HOST_FRAME {
+    BOOLEAN     Mapped;
+    ULONG       Handle;
+    ULONG       GrantRef;
+} HOST_FRAME, *PHOST_FRAME;
+
+static HOST_FRAME   HostFrame[HOST_MAX_PAGES];
+static ULONG        HostMapped;
+static ULONG        HostNextHandle;
+static ULONG        HostHypercalls;
+
+// The grant reference whose map operation fails, and the hypercall
+// (counting from zero) that fails outright
+static ULONG        HostFailGrantRef;
+static LONG         HostFailGrantStatus;
+static ULONG        HostFailHypercall;
+
+// Unmap operations fail for this frame
+static ULONG        HostFailUnmapFrame;
+
+static VOID
+HostReset(
+    VOID
+    )
+{
+    RtlZeroMemory(HostFrame, sizeof (HostFrame));
+    HostMapped = 0;
+    HostNextHandle = 1;
+    HostHypercalls = 0;
+    HostFailGrantRef = HOST_NO_FAILURE;
+    HostFailGrantStatus = GNTST_bad_gntref;
+    HostFailHypercall = HOST_NO_FAILURE;
+    HostFailUnmapFrame = HOST_NO_FAILURE;
+}
+
+static PHOST_FRAME
+HostLookup(
+    IN  ULONG64 Address
+    )
+{
+    ULONG64     Frame;
+
+    if (Address < HOST_BASE || (Address & (PAGE_SIZE - 1)) != 0)
+        return NULL;
+
+    Frame = (Address - HOST_BASE) >> PAGE_SHIFT;
+    if (Frame >= HOST_MAX_PAGES)
+        return NULL;
+
+    return &HostFrame[Frame];
+}
+
+static VOID
+HostMap(
+    IN OUT  struct gnttab_map_grant_ref *op
+    )
+{
+    PHOST_FRAME                         Frame = HostLookup(op->host_addr);
+
+    CHECK(op->flags & GNTMAP_host_map);
+
+    if (Frame == NULL) {
+        op->status = GNTST_general_error;
+        return;
+    }
+
+    if (op->ref == HostFailGrantRef) {
+        op->status = (int16_t)HostFailGrantStatus;
+        return;
+    }
+
+    // Mapping over a mapping is a bug in the caller
+    CHECK(!Frame->Mapped);
+
+    Frame->Mapped = TRUE;
+    Frame->Handle = HostNextHandle++;
+    Frame->GrantRef = op->ref;
+    HostMapped++;
+
+    op->handle = Frame->Handle;
+    op->status = GNTST_okay;
+}
+
+static VOID
+HostUnmap(
+    IN OUT  struct gnttab_unmap_grant_ref   *op
+    )
+{
+    PHOST_FRAME                             Frame = HostLookup(op->host_addr);
+
+    if (Frame == NULL || !Frame->Mapped || Frame->Handle != op->handle) {
+        op->status = GNTST_bad_handle;
+        return;
+    }
+
+    if ((ULONG)(Frame - HostFrame) == HostFailUnmapFrame) {
+        op->status = GNTST_general_error;
+        return;
+    }
+
+    Frame->Mapped = FALSE;
+    HostMapped--;
+
+    op->status = GNTST_okay;
+}
+
+ULONG_PTR
+__Hypercall(
+    ULONG       Ordinal,
+    ULONG       Count,
+    ...
+    )
+{
+    va_list     Arguments;
+    ULONG       Command;
+    PVOID       Argument;
+    ULONG       Number;
+    ULONG       Index;
+
+    CHECK_EQ(Ordinal, __HYPERVISOR_grant_table_op);
+    CHECK_EQ(Count, 3);
+
+    va_start(Arguments, Count);
+    Command = va_arg(Arguments, ULONG);
+    Argument = va_arg(Arguments, PVOID);
+    Number = va_arg(Arguments, ULONG);
+    va_end(Arguments);
+
+    if (HostHypercalls++ == HostFailHypercall)
+        return (ULONG_PTR)-EFAULT;
+
+    CHECK(Number != 0 && Number <= GRANT_TABLE_BATCH_SIZE);
+
+    for (Index = 0; Index < Number; Index++) {
+        switch (Command) {
+        case GNTTABOP_map_grant_ref:
+            HostMap((struct gnttab_map_grant_ref *)Argument + Index);
+            break;
+
+        case GNTTABOP_unmap_grant_ref:
+            HostUnmap((struct gnttab_unmap_grant_ref *)Argument + Index);
+            break;
+
+        default:
+            CHECK(FALSE);
+            return (ULONG_PTR)-ENOSYS;
+        }
+    }
+
+    return 0;
+}
+
+VOID
+LogPrintf(
+    IN  LOG_LEVEL   Level,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+}
+
+static ULONG    GrantRef[HOST_MAX_PAGES];
+static ULONG    Handle[HOST_MAX_PAGES];
+
+static NTSTATUS
+TestMap(
+    IN  ULONG           NumberPages
+    )
+{
+    PHYSICAL_ADDRESS    Address;
+    ULONG               Index;
+
+    for (Index = 0; Index < NumberPages; Index++) {
+        GrantRef[Index] = 1000 + Index;
+        Handle[Index] = 0;
+    }
+
+    Address.QuadPart = HOST_BASE;
+
+    return GrantTableMapForeignPages(1, NumberPages, GrantRef, Address,
+                                     FALSE, Handle);
+}
+
+static NTSTATUS
+TestUnmap(
+    IN  ULONG           NumberPages
+    )
+{
+    PHYSICAL_ADDRESS    Address;
+
+    Address.QuadPart = HOST_BASE;
+
+    return GrantTableUnmapForeignPages(NumberPages, Handle, Address);
+}
+
+static VOID
+TestMapUnmap(
+    VOID
+    )
+{
+    ULONG       NumberPages = 100;
+    ULONG       Index;
+    NTSTATUS    status;
+
+    HostReset();
+
+    status = TestMap(NumberPages);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(HostMapped, NumberPages);
+    CHECK_EQ(HostHypercalls, (NumberPages + GRANT_TABLE_BATCH_SIZE - 1) /
+                             GRANT_TABLE_BATCH_SIZE);
+
+    for (Index = 0; Index < NumberPages; Index++) {
+        CHECK(HostFrame[Index].Mapped);
+        CHECK_EQ(HostFrame[Index].GrantRef, GrantRef[Index]);
+        CHECK_EQ(HostFrame[Index].Handle, Handle[Index]);
+    }
+
+    HostHypercalls = 0;
+
+    status = TestUnmap(NumberPages);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(HostMapped, 0);
+    CHECK_EQ(HostHypercalls, (NumberPages + GRANT_TABLE_BATCH_SIZE - 1) /
+                             GRANT_TABLE_BATCH_SIZE);
+}
+
+// Fail the map of every page in turn, and each hypercall in turn, and
+// check that nothing is left mapped
+static VOID
+TestMapRollback(
+    VOID
+    )
+{
+    ULONG       NumberPages = 3 * GRANT_TABLE_BATCH_SIZE + 5;
+    ULONG       Hypercalls = (NumberPages + GRANT_TABLE_BATCH_SIZE - 1) /
+                             GRANT_TABLE_BATCH_SIZE;
+    ULONG       Index;
+    NTSTATUS    status;
+
+    for (Index = 0; Index < NumberPages; Index++) {
+        HostReset();
+        HostFailGrantRef = 1000 + Index;
+
+        status = TestMap(NumberPages);
+        CHECK_EQ(status, STATUS_UNSUCCESSFUL);
+        CHECK_EQ(HostMapped, 0);
+    }
+
+    // The status of the first failure in a batch is the one reported
+    HostReset();
+    HostFailGrantRef = 1000 + GRANT_TABLE_BATCH_SIZE + 3;
+    HostFailGrantStatus = GNTST_permission_denied;
+
+    status = TestMap(NumberPages);
+    CHECK_EQ(status, STATUS_ACCESS_DENIED);
+    CHECK_EQ(HostMapped, 0);
+
+    for (Index = 0; Index < Hypercalls; Index++) {
+        HostReset();
+        HostFailHypercall = Index;
+
+        status = TestMap(NumberPages);
+        CHECK(!NT_SUCCESS(status));
+        CHECK_EQ(HostMapped, 0);
+    }
+}
+
+// An unmap reports the first failure but still unmaps everything else
+static VOID
+TestUnmapFailure(
+    VOID
+    )
+{
+    ULONG       NumberPages = 3 * GRANT_TABLE_BATCH_SIZE + 5;
+    ULONG       Index;
+    NTSTATUS    status;
+
+    for (Index = 0; Index < NumberPages; Index += 7) {
+        HostReset();
+
+        status = TestMap(NumberPages);
+        CHECK_EQ(status, STATUS_SUCCESS);
+
+        HostFailUnmapFrame = Index;
+
+        status = TestUnmap(NumberPages);
+        CHECK_EQ(status, STATUS_UNSUCCESSFUL);
+        CHECK_EQ(HostMapped, 1);
+        CHECK(HostFrame[Index].Mapped);
+    }
+
+    // A failed hypercall loses one batch, not the rest
+    HostReset();
+
+    status = TestMap(NumberPages);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    HostHypercalls = 0;
+    HostFailHypercall = 1;
+
+    status = TestUnmap(NumberPages);
+    CHECK(!NT_SUCCESS(status));
+    CHECK_EQ(HostMapped, GRANT_TABLE_BATCH_SIZE);
+
+    for (Index = 0; Index < NumberPages; Index++)
+        CHECK_EQ(HostFrame[Index].Mapped,
+                 Index >= GRANT_TABLE_BATCH_SIZE &&
+                 Index < 2 * GRANT_TABLE_BATCH_SIZE);
+}
+
+// Random lengths and failure points
+static VOID
+TestRandomRollback(
+    VOID
+    )
+{
+    ULONGLONG   State = 46;
+    ULONG       Iteration;
+    NTSTATUS    status;
+
+    for (Iteration = 0; Iteration < 2000; Iteration++) {
+        ULONG   NumberPages = 1 + TestRandom(&State) % 300;
+
+        HostReset();
+
+        switch (TestRandom(&State) % 3) {
+        case 0:
+            HostFailGrantRef = 1000 + TestRandom(&State) % NumberPages;
+            break;
+
+        case 1:
+            HostFailHypercall = TestRandom(&State) %
+                                ((NumberPages + GRANT_TABLE_BATCH_SIZE - 1) /
+                                 GRANT_TABLE_BATCH_SIZE);
+            break;
+
+        default:
+            break;
+        }
+
+        status = TestMap(NumberPages);
+        if (!NT_SUCCESS(status)) {
+            CHECK_EQ(HostMapped, 0);
+            continue;
+        }
+
+        CHECK_EQ(HostMapped, NumberPages);
+
+        status = TestUnmap(NumberPages);
+        CHECK_EQ(status, STATUS_SUCCESS);
+        CHECK_EQ(HostMapped, 0);
+    }
+}
+
+// The fake hypercall costs next to nothing, so the times only show the
+// work done around each hypercall; the counts are what batching saves
+// in traps to the hypervisor.
+static VOID
+TestBenchmark(
+    VOID
+    )
+{
+    ULONG               NumberPages = HOST_MAX_PAGES;
+    ULONG               Rounds = 100;
+    ULONG               Round;
+    ULONG               Index;
+    PHYSICAL_ADDRESS    Address;
+    ULONGLONG           Start;
+    ULONGLONG           PerPage;
+    ULONG               PerPageHypercalls;
+    ULONGLONG           Batched;
+    ULONG               BatchedHypercalls;
+    NTSTATUS            status;
+
+    HostReset();
+
+    for (Index = 0; Index < NumberPages; Index++)
+        GrantRef[Index] = 1000 + Index;
+
+    Start = TestNow();
+
+    for (Round = 0; Round < Rounds; Round++) {
+        for (Index = 0; Index < NumberPages; Index++) {
+            Address.QuadPart = HOST_BASE + ((ULONG64)Index << PAGE_SHIFT);
+
+            status = GrantTableMapForeignPage(1, GrantRef[Index], Address,
+                                              FALSE, &Handle[Index]);
+            CHECK_EQ(status, STATUS_SUCCESS);
+        }
+
+        for (Index = 0; Index < NumberPages; Index++) {
+            Address.QuadPart = HOST_BASE + ((ULONG64)Index << PAGE_SHIFT);
+
+            status = GrantTableUnmapForeignPage(Handle[Index], Address);
+            CHECK_EQ(status, STATUS_SUCCESS);
+        }
+    }
+
+    PerPage = TestNow() - Start;
+    PerPageHypercalls = HostHypercalls / Rounds;
+
+    CHECK_EQ(HostMapped, 0);
+
+    HostReset();
+
+    Start = TestNow();
+
+    for (Round = 0; Round < Rounds; Round++) {
+        status = TestMap(NumberPages);
+        CHECK_EQ(status, STATUS_SUCCESS);
+
+        status = TestUnmap(NumberPages);
+        CHECK_EQ(status, STATUS_SUCCESS);
+    }
+
+    Batched = TestNow() - Start;
+    BatchedHypercalls = HostHypercalls / Rounds;
+
+    CHECK_EQ(HostMapped, 0);
+    CHECK_EQ(PerPageHypercalls, 2 * NumberPages);
+    CHECK_EQ(BatchedHypercalls, 2 * NumberPages / GRANT_TABLE_BATCH_SIZE);
+
+    printf("grant_table: map+unmap %u pages: per-page %u hypercalls %llu ns, "
+           "batched %u hypercalls %llu ns\n",
+           NumberPages,
+           PerPageHypercalls,
+           PerPage / Rounds,
+           BatchedHypercalls,
+           Batched / Rounds);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestMapUnmap();
+    TestMapRollback();
+    TestUnmapFailure();
+    TestRandomRollback();
+    TestBenchmark();
+
+    return TEST_RESULT("grant_table");
+}
@@ -0,0 +1,526 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the hypercall profiling in hypercall.c. The hypercall gates
+// are replaced by stubs that burn a few cycles, and stack walks are
+// faked so that each thread appears to be calling from a module of its
+// own. The test checks the per-ordinal and per-module totals, that the
+// stack is only walked when caller attribution was asked for, and that
+// multicalls issued singly are still counted.
+
+#include <ntddk.h>
+#include <pthread.h>
+
+#include "../src/xen/hypercall.c"
+
+#include "test.h"
+
+#define THREAD_COUNT    4
+#define CALL_COUNT      10000
+
+#define HOST_XEN_OFFSET 0x1000
+#define HOST_MODULE_SIZE 0x10000
+
+static const CHAR   *HostModuleName[THREAD_COUNT] = {
+    "\\SystemRoot\\System32\\drivers\\xenvif.sys",
+    "\\SystemRoot\\System32\\drivers\\xenvbd.sys",
+    "xeniface.sys",
+    "\\??\\C:\\Windows\\System32\\drivers\\xennet.sys"
+};
+
+static ULONG_PTR        HostXenBase;
+static LONG             HostBacktraces;
+static LONG             HostMulticallUnsupported;
+static __thread ULONG   HostModule;
+
+// Somewhere in the middle of the fake module that the calling thread
+// belongs to
+static FORCEINLINE ULONG_PTR
+HostModuleBase(
+    IN  ULONG   Index
+    )
+{
+    return (ULONG_PTR)(Index + 1) << 32;
+}
+
+VOID
+ModuleLookup(
+    IN  ULONG_PTR   Address,
+    OUT PCHAR       *Name,
+    OUT PULONG_PTR  Offset
+    )
+{
+    ULONG           Index;
+
+    *Name = NULL;
+    *Offset = 0;
+
+    if (Address >= HostXenBase && Address < HostXenBase + HOST_MODULE_SIZE) {
+        *Name = "\\SystemRoot\\System32\\drivers\\xen.sys";
+        *Offset = Address - HostXenBase;
+        return;
+    }
+
+    for (Index = 0; Index < THREAD_COUNT; Index++) {
+        ULONG_PTR   Base = HostModuleBase(Index);
+
+        if (Address >= Base && Address < Base + HOST_MODULE_SIZE) {
+            *Name = (PCHAR)HostModuleName[Index];
+            *Offset = Address - Base;
+            return;
+        }
+    }
+}
+
+// Two frames in XEN.SYS, one the lookup cannot resolve, then the caller
+USHORT
+RtlCaptureStackBackTrace(
+    IN  ULONG   FramesToSkip,
+    IN  ULONG   FramesToCapture,
+    OUT PVOID   *BackTrace,
+    OUT PULONG  BackTraceHash OPTIONAL
+    )
+{
+    PVOID       Frame[4];
+    ULONG       Count;
+
+    UNREFERENCED_PARAMETER(FramesToSkip);
+    UNREFERENCED_PARAMETER(BackTraceHash);
+
+    InterlockedIncrement(&HostBacktraces);
+
+    Frame[0] = (PVOID)(HostXenBase + 0x100);
+    Frame[1] = (PVOID)(HostXenBase + 0x200);
+    Frame[2] = (PVOID)0x1234;
+    Frame[3] = (PVOID)(HostModuleBase(HostModule) + 0x300);
+
+    for (Count = 0; Count < ARRAYSIZE(Frame) && Count < FramesToCapture; Count++)
+        BackTrace[Count] = Frame[Count];
+
+    return (USHORT)Count;
+}
+
+VOID
+LogPrintf(
+    IN  LOG_LEVEL   Level,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+}
+
+VOID
+__writemsr(
+    IN  ULONG       Register,
+    IN  ULONG64     Value
+    )
+{
+    UNREFERENCED_PARAMETER(Register);
+    UNREFERENCED_PARAMETER(Value);
+    abort();
+}
+
+VOID
+__cpuid(
+    IN  unsigned int    Info[4],
+    IN  int             Leaf
+    )
+{
+    UNREFERENCED_PARAMETER(Info);
+    UNREFERENCED_PARAMETER(Leaf);
+    abort();
+}
+
+PHYSICAL_ADDRESS
+MmGetPhysicalAddress(
+    IN  PVOID   Address
+    )
+{
+    UNREFERENCED_PARAMETER(Address);
+    abort();
+}
+
+// Long enough that the TSC always moves on
+static uintptr_t
+HostHypercall(
+    IN  uint32_t    ord,
+    IN  uintptr_t   arg1
+    )
+{
+    ULONG64         Start = __rdtsc();
+
+    while (__rdtsc() - Start < 100)
+        _ReadWriteBarrier();
+
+    if (ord == __HYPERVISOR_multicall && HostMulticallUnsupported)
+        return (uintptr_t)-ENOSYS;
+
+    return arg1 + ord;
+}
+
+uintptr_t
+hypercall2(
+    IN  uint32_t    ord,
+    IN  uintptr_t   arg1,
+    IN  uintptr_t   arg2
+    )
+{
+    UNREFERENCED_PARAMETER(arg2);
+    return HostHypercall(ord, arg1);
+}
+
+uintptr_t
+hypercall3(
+    IN  uint32_t    ord,
+    IN  uintptr_t   arg1,
+    IN  uintptr_t   arg2,
+    IN  uintptr_t   arg3
+    )
+{
+    UNREFERENCED_PARAMETER(arg2);
+    UNREFERENCED_PARAMETER(arg3);
+    return HostHypercall(ord, arg1);
+}
+
+// The ordinals each thread issues; the last is beyond the profile
+static const ULONG  TestOrdinal[] = {
+    __HYPERVISOR_event_channel_op,
+    __HYPERVISOR_grant_table_op,
+    __HYPERVISOR_memory_op,
+    __HYPERVISOR_sched_op,
+    HYPERCALL_PROFILE_ORDINALS + 1
+};
+
+typedef struct _TEST_THREAD {
+    pthread_t   Thread;
+    ULONG       Index;
+    ULONG       Errors;
+} TEST_THREAD, *PTEST_THREAD;
+
+static PVOID
+TestWorker(
+    IN  PVOID       Argument
+    )
+{
+    PTEST_THREAD    Thread = Argument;
+    ULONG           Call;
+
+    HostProcessorIndex = Thread->Index;
+    HostModule = Thread->Index;
+
+    for (Call = 0; Call < CALL_COUNT; Call++) {
+        ULONG       Ordinal = TestOrdinal[Call % ARRAYSIZE(TestOrdinal)];
+        ULONG_PTR   Value;
+
+        // Calls from above DISPATCH_LEVEL are counted but not attributed
+        HostIrql = (Call % 10 == 0) ? HIGH_LEVEL : DISPATCH_LEVEL;
+
+        Value = (Call & 1) ?
+                __Hypercall(Ordinal, 2, (ULONG_PTR)Call, 0) :
+                __Hypercall(Ordinal, 3, (ULONG_PTR)Call, 0, 0);
+        if (Value != Call + Ordinal)
+            Thread->Errors++;
+    }
+
+    return NULL;
+}
+
+static VOID
+TestRun(
+    VOID
+    )
+{
+    TEST_THREAD     Thread[THREAD_COUNT];
+    ULONG           Index;
+
+    for (Index = 0; Index < THREAD_COUNT; Index++) {
+        Thread[Index].Index = Index;
+        Thread[Index].Errors = 0;
+        (VOID) pthread_create(&Thread[Index].Thread, NULL, TestWorker,
+                              &Thread[Index]);
+    }
+
+    for (Index = 0; Index < THREAD_COUNT; Index++) {
+        (VOID) pthread_join(Thread[Index].Thread, NULL);
+        CHECK_EQ(Thread[Index].Errors, 0);
+    }
+}
+
+// Calls per thread of the given entry in TestOrdinal
+static ULONG
+TestExpected(
+    IN  ULONG   Entry
+    )
+{
+    return CALL_COUNT / ARRAYSIZE(TestOrdinal) +
+           ((Entry < CALL_COUNT % ARRAYSIZE(TestOrdinal)) ? 1 : 0);
+}
+
+static VOID
+TestOrdinals(
+    IN  ULONG   Multicalls
+    )
+{
+    ULONG       Ordinal;
+
+    for (Ordinal = 0; Ordinal < HYPERCALL_PROFILE_ORDINALS; Ordinal++) {
+        const CHAR  *Name;
+        ULONG64     Count;
+        ULONG64     Cycles;
+        ULONG64     Expected;
+        ULONG       Entry;
+        NTSTATUS    status;
+
+        status = HypercallQueryProfile(Ordinal, &Name, &Count, &Cycles);
+        CHECK_EQ(status, STATUS_SUCCESS);
+
+        Expected = 0;
+        for (Entry = 0; Entry < ARRAYSIZE(TestOrdinal); Entry++)
+            if (TestOrdinal[Entry] == Ordinal)
+                Expected += (ULONG64)TestExpected(Entry) * THREAD_COUNT;
+
+        if (Ordinal == __HYPERVISOR_multicall)
+            Expected += Multicalls;
+
+        CHECK_EQ(Count, Expected);
+        CHECK((Count == 0) ? (Cycles == 0) : (Cycles >= Count * 100));
+
+        if (Ordinal == __HYPERVISOR_grant_table_op)
+            CHECK(strcmp(Name, "grant_table_op") == 0);
+    }
+
+    {
+        const CHAR  *Name;
+        ULONG64     Count;
+        ULONG64     Cycles;
+        NTSTATUS    status;
+
+        status = HypercallQueryProfile(HYPERCALL_PROFILE_ORDINALS, &Name,
+                                       &Count, &Cycles);
+        CHECK_EQ(status, STATUS_NO_MORE_ENTRIES);
+    }
+}
+
+static VOID
+TestDisabled(
+    VOID
+    )
+{
+    const CHAR  *Name;
+    ULONG64     Count;
+    ULONG64     Cycles;
+    NTSTATUS    status;
+
+    TestRun();
+
+    CHECK_EQ(HostBacktraces, 0);
+
+    status = HypercallQueryProfile(__HYPERVISOR_memory_op, &Name, &Count,
+                                   &Cycles);
+    CHECK_EQ(status, STATUS_NOT_SUPPORTED);
+
+    status = HypercallQueryModuleProfile(0, &Name, &Count, &Cycles);
+    CHECK_EQ(status, STATUS_NOT_SUPPORTED);
+}
+
+static VOID
+TestCounters(
+    VOID
+    )
+{
+    const CHAR  *Name;
+    ULONG64     Count;
+    ULONG64     Cycles;
+    NTSTATUS    status;
+
+    HypercallProfileEnable(FALSE);
+
+    TestRun();
+    TestOrdinals(0);
+
+    // The stack is never walked unless callers were asked for
+    CHECK_EQ(HostBacktraces, 0);
+
+    status = HypercallQueryModuleProfile(0, &Name, &Count, &Cycles);
+    CHECK_EQ(status, STATUS_NO_MORE_ENTRIES);
+
+    HypercallProfileDisable();
+}
+
+static VOID
+TestCallers(
+    VOID
+    )
+{
+    ULONG       Attributed;
+    ULONG       Entry;
+    ULONG       Index;
+    NTSTATUS    status;
+
+    HypercallProfileEnable(TRUE);
+
+    TestRun();
+    TestOrdinals(0);
+
+    // Calls made above DISPATCH_LEVEL are not attributed, and neither
+    // are the ones beyond the profiled ordinals
+    Attributed = 0;
+    for (Index = 0; Index < CALL_COUNT; Index++) {
+        Entry = Index % ARRAYSIZE(TestOrdinal);
+
+        if (Index % 10 != 0 &&
+            TestOrdinal[Entry] < HYPERCALL_PROFILE_ORDINALS)
+            Attributed++;
+    }
+
+    CHECK_EQ(HostBacktraces, Attributed * THREAD_COUNT);
+
+    for (Index = 0; Index < THREAD_COUNT; Index++) {
+        const CHAR  *Name;
+        ULONG64     Count;
+        ULONG64     Cycles;
+        const CHAR  *Expected;
+        ULONG       Module;
+
+        status = HypercallQueryModuleProfile(Index, &Name, &Count, &Cycles);
+        CHECK_EQ(status, STATUS_SUCCESS);
+        if (!NT_SUCCESS(status))
+            continue;
+
+        // The slots are claimed in whatever order the threads got there
+        for (Module = 0; Module < THREAD_COUNT; Module++) {
+            Expected = strrchr(HostModuleName[Module], '\\');
+            Expected = (Expected != NULL) ?
+                       Expected + 1 :
+                       HostModuleName[Module];
+
+            if (strcmp(Name, Expected) == 0)
+                break;
+        }
+
+        CHECK(Module < THREAD_COUNT);
+        CHECK_EQ(Count, Attributed);
+        CHECK(Cycles >= Count * 100);
+    }
+
+    {
+        const CHAR  *Name;
+        ULONG64     Count;
+        ULONG64     Cycles;
+
+        status = HypercallQueryModuleProfile(THREAD_COUNT, &Name, &Count,
+                                             &Cycles);
+        CHECK_EQ(status, STATUS_NO_MORE_ENTRIES);
+
+        status = HypercallQueryModuleProfile(HYPERCALL_PROFILE_MODULES,
+                                             &Name, &Count, &Cycles);
+        CHECK_EQ(status, STATUS_NO_MORE_ENTRIES);
+    }
+
+    HypercallProfileDisable();
+}
+
+static VOID
+TestMulticall(
+    VOID
+    )
+{
+    XEN_MULTICALL   Multicall;
+    ULONG           Index;
+    NTSTATUS        status;
+
+    HypercallProfileEnable(FALSE);
+
+    // Turned down by the hypervisor, then issued singly
+    HostMulticallUnsupported = 1;
+
+    HostProcessorIndex = 0;
+    HostIrql = PASSIVE_LEVEL;
+
+    MulticallInitialize(&Multicall);
+
+    for (Index = 0; Index < XEN_MULTICALL_MAXIMUM_ENTRIES; Index++) {
+        status = MulticallAdd(&Multicall, __HYPERVISOR_memory_op, 2,
+                              (ULONG_PTR)Index, 0);
+        CHECK_EQ(status, STATUS_SUCCESS);
+    }
+
+    status = MulticallFlush(&Multicall);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    for (Index = 0; Index < XEN_MULTICALL_MAXIMUM_ENTRIES; Index++)
+        CHECK_EQ(MulticallResult(&Multicall, Index),
+                 Index + __HYPERVISOR_memory_op);
+
+    {
+        const CHAR  *Name;
+        ULONG64     Count;
+        ULONG64     Cycles;
+
+        status = HypercallQueryProfile(__HYPERVISOR_multicall, &Name,
+                                       &Count, &Cycles);
+        CHECK_EQ(status, STATUS_SUCCESS);
+        CHECK_EQ(Count, 1);
+
+        status = HypercallQueryProfile(__HYPERVISOR_memory_op, &Name,
+                                       &Count, &Cycles);
+        CHECK_EQ(status, STATUS_SUCCESS);
+        CHECK_EQ(Count, XEN_MULTICALL_MAXIMUM_ENTRIES);
+    }
+
+    HypercallProfileDisable();
+
+    HostMulticallUnsupported = 0;
+    MulticallUnsupported = 0;
+}
+
+int
+main(
+    VOID
+    )
+{
+    HostXenBase = (ULONG_PTR)HypercallProfileEnable - HOST_XEN_OFFSET;
+
+    TestDisabled();
+    TestCounters();
+
+    HostBacktraces = 0;
+    TestCallers();
+
+    TestMulticall();
+
+    CHECK(HypercallProfile == NULL);
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("hypercall");
+}
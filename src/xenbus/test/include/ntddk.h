@@ -0,0 +1,1250 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Just enough of the kernel environment to build individual driver
+// source files as ordinary user-mode programs on a POSIX host, so that
+// their algorithms can be exercised by the tests in this directory.
+// Nothing here is used by the driver build itself.
+
+#ifndef _HOST_NTDDK_H
+#define _HOST_NTDDK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <sched.h>
+
+// util.h has its own __strtok_r(); keep it apart from the C library's
+#define __strtok_r  __host_strtok_r
+
+// The host C library already provides the fixed-width types that
+// xen-types.h would otherwise define.
+#define _XEN_TYPES_H
+
+#pragma GCC diagnostic ignored "-Wunknown-pragmas"
+
+// Types
+
+#define VOID    void
+
+typedef char                CHAR, *PCHAR;
+typedef unsigned char       UCHAR, *PUCHAR;
+typedef int16_t             SHORT, *PSHORT;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef int64_t             LONG64, *PLONG64;
+typedef uint64_t            ULONG64, *PULONG64;
+typedef long long           LONGLONG, *PLONGLONG;
+typedef unsigned long long  ULONGLONG, *PULONGLONG;
+typedef intptr_t            LONG_PTR, *PLONG_PTR;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR;
+typedef size_t              SIZE_T, *PSIZE_T;
+typedef uint8_t             BOOLEAN, *PBOOLEAN;
+typedef wchar_t             WCHAR, *PWCHAR;
+typedef void                *PVOID, **PPVOID;
+typedef const char          *PCSTR;
+typedef int32_t             NTSTATUS, *PNTSTATUS;
+typedef UCHAR               KIRQL, *PKIRQL;
+typedef ULONG_PTR           KSPIN_LOCK, *PKSPIN_LOCK;
+typedef ULONG_PTR           PFN_NUMBER, *PPFN_NUMBER;
+typedef ULONG_PTR           KAFFINITY;
+typedef PVOID               HANDLE, *PHANDLE;
+
+typedef struct _GUID {
+    ULONG   Data1;
+    USHORT  Data2;
+    USHORT  Data3;
+    UCHAR   Data4[8];
+} GUID, *PGUID;
+
+#define DEFINE_GUID(_Name, _L, _W1, _W2, _B1, _B2, _B3, _B4, _B5, _B6, _B7, _B8) \
+        static const GUID _Name __attribute__((unused)) =                       \
+            { _L, _W1, _W2, { _B1, _B2, _B3, _B4, _B5, _B6, _B7, _B8 } }
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG   LowPart;
+        LONG    HighPart;
+    };
+    LONGLONG    QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER, PHYSICAL_ADDRESS, *PPHYSICAL_ADDRESS;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        ULONG   LowPart;
+        ULONG   HighPart;
+    };
+    ULONGLONG   QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef enum _POOL_TYPE {
+    NonPagedPool,
+    PagedPool
+} POOL_TYPE;
+
+#define TRUE    1
+#define FALSE   0
+
+// Annotations
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST               const
+#define __in
+#define __out
+#define __in_opt
+#define __out_opt
+#define __checkReturn
+#define __analysis_assume(_EXP)
+#define __drv_requiresIRQL(_X)
+#define __drv_maxIRQL(_X)
+#define __drv_savesIRQL
+#define __drv_restoresIRQL
+#define __drv_raisesIRQL(_X)
+#define __drv_setsIRQL(_X)
+#define __drv_sameIRQL
+#define __drv_functionClass(_X)
+#define __drv_dispatchType(_X)
+#define __drv_at(_X, _Y)
+#define __drv_when(_X, _Y)
+#define __drv_arg(_X, _Y)
+#define __drv_neverHoldLock(_X)
+#define __drv_mustHoldCriticalRegion
+#define __drv_inTry
+#define _IRQL_requires_(_X)
+#define _IRQL_requires_max_(_X)
+#define _IRQL_requires_min_(_X)
+#define _IRQL_requires_same_
+#define _IRQL_raises_(_X)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _Acquires_lock_(_X)
+#define _Releases_lock_(_X)
+#define _Requires_lock_held_(_X)
+#define _Requires_lock_not_held_(_X)
+#define _Function_class_(_X)
+#define _Use_decl_annotations_
+#define _Check_return_
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _Out_opt_
+#define _Inout_opt_
+
+#define FORCEINLINE         inline __attribute__((always_inline))
+#define DECLSPEC_NOINLINE   __attribute__((noinline))
+#define DECLSPEC_CACHEALIGN __attribute__((aligned(64)))
+#define __declspec(_X)
+#define __forceinline       inline __attribute__((always_inline))
+#define NTAPI
+#define __stdcall
+#define __cdecl
+
+// Basic macros
+
+#define UNREFERENCED_PARAMETER(_P)  ((void)(_P))
+
+#define FIELD_OFFSET(_Type, _Field) \
+        ((LONG)offsetof(_Type, _Field))
+
+#define RTL_FIELD_SIZE(_Type, _Field)   \
+        (sizeof (((_Type *)0)->_Field))
+
+#define CONTAINING_RECORD(_Address, _Type, _Field) \
+        ((_Type *)((PUCHAR)(_Address) - offsetof(_Type, _Field)))
+
+#define ARRAYSIZE(_Array)   (sizeof (_Array) / sizeof ((_Array)[0]))
+#define RTL_NUMBER_OF(_Array)   ARRAYSIZE(_Array)
+
+#define C_ASSERT(_EXP)  _Static_assert((_EXP), #_EXP)
+
+#define __min(_X, _Y)   (((_X) < (_Y)) ? (_X) : (_Y))
+#define __max(_X, _Y)   (((_X) > (_Y)) ? (_X) : (_Y))
+
+#define PAGE_SHIFT  12
+#define PAGE_SIZE   (1ul << PAGE_SHIFT)
+
+#define BYTE_OFFSET(_Va)    ((ULONG)((ULONG_PTR)(_Va) & (PAGE_SIZE - 1)))
+#define PAGE_ALIGN(_Va)     ((PVOID)((ULONG_PTR)(_Va) & ~(PAGE_SIZE - 1)))
+
+#define ANYSIZE_ARRAY   1
+
+#define MAXULONG        0xffffffffu
+#define MAXLONG         0x7fffffff
+#define MAXUSHORT       0xffff
+#define MAXULONGLONG    0xffffffffffffffffull
+
+// Debug output filtering
+
+#define DPFLTR_ERROR_LEVEL      0
+#define DPFLTR_WARNING_LEVEL    1
+#define DPFLTR_TRACE_LEVEL      2
+#define DPFLTR_INFO_LEVEL       3
+#define DPFLTR_IHVDRIVER_ID     77
+
+// Status codes
+
+#define NT_SUCCESS(_Status) (((NTSTATUS)(_Status)) >= 0)
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES          ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_HANDLE           ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_MEMORY                ((NTSTATUS)0xC0000017L)
+#define STATUS_ACCESS_DENIED            ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_INVALID_BUFFER_SIZE      ((NTSTATUS)0xC0000206L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+#define STATUS_MEDIA_WRITE_PROTECTED    ((NTSTATUS)0xC00000A2L)
+#define STATUS_PIPE_BUSY                ((NTSTATUS)0xC00000AEL)
+#define STATUS_PIPE_CONNECTED           ((NTSTATUS)0xC00000B2L)
+#define STATUS_FILE_IS_A_DIRECTORY      ((NTSTATUS)0xC00000BAL)
+#define STATUS_UNEXPECTED_IO_ERROR      ((NTSTATUS)0xC00000E9L)
+#define STATUS_DIRECTORY_NOT_EMPTY      ((NTSTATUS)0xC0000101L)
+#define STATUS_OBJECTID_EXISTS          ((NTSTATUS)0xC000022BL)
+#define STATUS_RETRY                    ((NTSTATUS)0xC000022DL)
+
+// Memory
+
+#define RtlZeroMemory(_Buffer, _Length)         memset((_Buffer), 0, (_Length))
+#define RtlFillMemory(_Buffer, _Length, _Fill)  memset((_Buffer), (_Fill), (_Length))
+#define RtlCopyMemory(_Dest, _Src, _Length)     memcpy((_Dest), (_Src), (_Length))
+#define RtlMoveMemory(_Dest, _Src, _Length)     memmove((_Dest), (_Src), (_Length))
+#define RtlEqualMemory(_X, _Y, _Length)         (memcmp((_X), (_Y), (_Length)) == 0)
+
+static inline SIZE_T
+RtlCompareMemory(
+    IN  const VOID  *Source1,
+    IN  const VOID  *Source2,
+    IN  SIZE_T      Length
+    )
+{
+    const UCHAR     *X = Source1;
+    const UCHAR     *Y = Source2;
+    SIZE_T          Index;
+
+    for (Index = 0; Index < Length; Index++)
+        if (X[Index] != Y[Index])
+            break;
+
+    return Index;
+}
+
+// Allocations are counted so that tests can check for leaks
+extern LONG HostPoolAllocations;
+
+// Set to make the next N allocations fail (after Skip successes)
+extern LONG HostPoolFailSkip;
+extern LONG HostPoolFailCount;
+
+static inline PVOID
+ExAllocatePoolWithTag(
+    IN  POOL_TYPE   PoolType,
+    IN  SIZE_T      NumberOfBytes,
+    IN  ULONG       Tag
+    )
+{
+    PVOID           Buffer;
+
+    (void) PoolType;
+    (void) Tag;
+
+    if (__atomic_load_n(&HostPoolFailCount, __ATOMIC_RELAXED) != 0) {
+        if (__atomic_load_n(&HostPoolFailSkip, __ATOMIC_RELAXED) != 0) {
+            __atomic_sub_fetch(&HostPoolFailSkip, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_sub_fetch(&HostPoolFailCount, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+
+    // As in Windows, anything of a page or more starts on a page boundary
+    if (NumberOfBytes < PAGE_SIZE)
+        Buffer = malloc(NumberOfBytes);
+    else if (posix_memalign(&Buffer, PAGE_SIZE, NumberOfBytes) != 0)
+        Buffer = NULL;
+
+    if (Buffer != NULL) {
+        memset(Buffer, 0xAA, NumberOfBytes);    // Catch missing initialization
+        __atomic_add_fetch(&HostPoolAllocations, 1, __ATOMIC_RELAXED);
+    }
+
+    return Buffer;
+}
+
+static inline VOID
+ExFreePoolWithTag(
+    IN  PVOID   Buffer,
+    IN  ULONG   Tag
+    )
+{
+    (void) Tag;
+
+    __atomic_sub_fetch(&HostPoolAllocations, 1, __ATOMIC_RELAXED);
+    free(Buffer);
+}
+
+#define ExFreePool(_Buffer) ExFreePoolWithTag((_Buffer), 0)
+
+// Lists
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY  *Flink;
+    struct _LIST_ENTRY  *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+static inline VOID
+InitializeListHead(
+    IN  PLIST_ENTRY ListHead
+    )
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+static inline BOOLEAN
+IsListEmpty(
+    IN  const LIST_ENTRY    *ListHead
+    )
+{
+    return (BOOLEAN)(ListHead->Flink == ListHead);
+}
+
+static inline BOOLEAN
+RemoveEntryList(
+    IN  PLIST_ENTRY Entry
+    )
+{
+    PLIST_ENTRY     Flink = Entry->Flink;
+    PLIST_ENTRY     Blink = Entry->Blink;
+
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+
+    return (BOOLEAN)(Flink == Blink);
+}
+
+static inline PLIST_ENTRY
+RemoveHeadList(
+    IN  PLIST_ENTRY ListHead
+    )
+{
+    PLIST_ENTRY     Entry = ListHead->Flink;
+
+    RemoveEntryList(Entry);
+    return Entry;
+}
+
+static inline PLIST_ENTRY
+RemoveTailList(
+    IN  PLIST_ENTRY ListHead
+    )
+{
+    PLIST_ENTRY     Entry = ListHead->Blink;
+
+    RemoveEntryList(Entry);
+    return Entry;
+}
+
+static inline VOID
+InsertTailList(
+    IN  PLIST_ENTRY ListHead,
+    IN  PLIST_ENTRY Entry
+    )
+{
+    PLIST_ENTRY     Blink = ListHead->Blink;
+
+    Entry->Flink = ListHead;
+    Entry->Blink = Blink;
+    Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+static inline VOID
+InsertHeadList(
+    IN  PLIST_ENTRY ListHead,
+    IN  PLIST_ENTRY Entry
+    )
+{
+    PLIST_ENTRY     Flink = ListHead->Flink;
+
+    Entry->Flink = Flink;
+    Entry->Blink = ListHead;
+    Flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+// Interlocked operations
+
+#define InterlockedIncrement(_P)                    \
+        __atomic_add_fetch((_P), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(_P)                    \
+        __atomic_sub_fetch((_P), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(_P, _V)              \
+        __atomic_fetch_add((_P), (_V), __ATOMIC_SEQ_CST)
+#define InterlockedAdd(_P, _V)                      \
+        __atomic_add_fetch((_P), (_V), __ATOMIC_SEQ_CST)
+#define InterlockedOr(_P, _V)                       \
+        __atomic_fetch_or((_P), (_V), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(_P, _V)                      \
+        __atomic_fetch_and((_P), (_V), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(_P, _V)                 \
+        __atomic_exchange_n((_P), (_V), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(_P, _V)          \
+        __atomic_exchange_n((_P), (_V), __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64  InterlockedIncrement
+#define InterlockedDecrement64  InterlockedDecrement
+#define InterlockedExchangeAdd64    InterlockedExchangeAdd
+#define InterlockedAdd64        InterlockedAdd
+#define InterlockedExchange64   InterlockedExchange
+
+#define InterlockedCompareExchange(_P, _New, _Old)                  \
+        __extension__ ({                                            \
+            __typeof__(*(_P)) __Old = (_Old);                       \
+            __atomic_compare_exchange_n((_P), &__Old, (_New), 0,    \
+                                        __ATOMIC_SEQ_CST,           \
+                                        __ATOMIC_SEQ_CST);          \
+            __Old;                                                  \
+        })
+#define InterlockedCompareExchange64        InterlockedCompareExchange
+#define InterlockedCompareExchangePointer   InterlockedCompareExchange
+// Grant entry flags are volatile, which __typeof__ would copy to the
+// comparand
+#define InterlockedCompareExchange16(_P, _New, _Old)                \
+        __extension__ ({                                            \
+            SHORT   __Old = (_Old);                                 \
+            __atomic_compare_exchange_n((_P), &__Old, (_New), 0,    \
+                                        __ATOMIC_SEQ_CST,           \
+                                        __ATOMIC_SEQ_CST);          \
+            __Old;                                                  \
+        })
+
+#define InterlockedBitTestAndSet(_P, _Bit)                          \
+        ((__atomic_fetch_or((_P), 1l << (_Bit), __ATOMIC_SEQ_CST) >> (_Bit)) & 1)
+#define InterlockedBitTestAndReset(_P, _Bit)                        \
+        ((__atomic_fetch_and((_P), ~(1l << (_Bit)), __ATOMIC_SEQ_CST) >> (_Bit)) & 1)
+#define _InterlockedExchange8   InterlockedExchange
+
+#define KeMemoryBarrier()   __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define _ReadWriteBarrier() __asm__ __volatile__("" ::: "memory")
+#define YieldProcessor()    sched_yield()
+#define _mm_pause()         sched_yield()
+
+#define ReadNoFence(_P)         __atomic_load_n((_P), __ATOMIC_RELAXED)
+#define ReadAcquire(_P)         __atomic_load_n((_P), __ATOMIC_ACQUIRE)
+#define ReadPointerAcquire(_P)  __atomic_load_n((_P), __ATOMIC_ACQUIRE)
+#define ReadPointerNoFence(_P)  __atomic_load_n((_P), __ATOMIC_RELAXED)
+
+// IRQL and spin locks
+
+#define PASSIVE_LEVEL   0
+#define APC_LEVEL       1
+#define DISPATCH_LEVEL  2
+#define HIGH_LEVEL      15
+
+extern __thread KIRQL HostIrql;
+
+static inline KIRQL
+KeGetCurrentIrql(
+    VOID
+    )
+{
+    return HostIrql;
+}
+
+static inline VOID
+KeRaiseIrql(
+    IN  KIRQL   NewIrql,
+    OUT PKIRQL  OldIrql
+    )
+{
+    *OldIrql = HostIrql;
+    HostIrql = NewIrql;
+}
+
+static inline VOID
+KeLowerIrql(
+    IN  KIRQL   NewIrql
+    )
+{
+    HostIrql = NewIrql;
+}
+
+static inline KIRQL
+KeRaiseIrqlToDpcLevel(
+    VOID
+    )
+{
+    KIRQL   Irql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    return Irql;
+}
+
+static inline VOID
+KeInitializeSpinLock(
+    IN  PKSPIN_LOCK Lock
+    )
+{
+    *Lock = 0;
+}
+
+static inline VOID
+KeAcquireSpinLockAtDpcLevel(
+    IN  PKSPIN_LOCK Lock
+    )
+{
+    while (__atomic_exchange_n(Lock, 1, __ATOMIC_ACQUIRE) != 0)
+        sched_yield();
+}
+
+static inline VOID
+KeReleaseSpinLockFromDpcLevel(
+    IN  PKSPIN_LOCK Lock
+    )
+{
+    __atomic_store_n(Lock, 0, __ATOMIC_RELEASE);
+}
+
+#define KeAcquireSpinLock(_Lock, _Irql)         \
+        do {                                    \
+            KeRaiseIrql(DISPATCH_LEVEL, (_Irql)); \
+            KeAcquireSpinLockAtDpcLevel(_Lock); \
+        } while (FALSE)
+
+#define KeReleaseSpinLock(_Lock, _Irql)         \
+        do {                                    \
+            KeReleaseSpinLockFromDpcLevel(_Lock); \
+            KeLowerIrql(_Irql);                 \
+        } while (FALSE)
+
+typedef struct _FAST_MUTEX {
+    LONG    Owned;
+    KIRQL   OldIrql;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+static inline VOID
+ExInitializeFastMutex(
+    OUT PFAST_MUTEX Mutex
+    )
+{
+    Mutex->Owned = 0;
+    Mutex->OldIrql = PASSIVE_LEVEL;
+}
+
+static inline VOID
+ExAcquireFastMutex(
+    IN  PFAST_MUTEX Mutex
+    )
+{
+    KIRQL           Irql;
+
+    KeRaiseIrql(APC_LEVEL, &Irql);
+
+    while (__atomic_exchange_n(&Mutex->Owned, 1, __ATOMIC_ACQUIRE) != 0)
+        sched_yield();
+
+    Mutex->OldIrql = Irql;
+}
+
+static inline VOID
+ExReleaseFastMutex(
+    IN  PFAST_MUTEX Mutex
+    )
+{
+    KIRQL           Irql = Mutex->OldIrql;
+
+    Mutex->OldIrql = PASSIVE_LEVEL;
+    __atomic_store_n(&Mutex->Owned, 0, __ATOMIC_RELEASE);
+
+    KeLowerIrql(Irql);
+}
+
+// Processors
+
+extern ULONG HostProcessorCount;
+
+#define ALL_PROCESSOR_GROUPS    0xffff
+
+static inline ULONG
+KeQueryActiveProcessorCountEx(
+    IN  USHORT  GroupNumber
+    )
+{
+    (void) GroupNumber;
+    return HostProcessorCount;
+}
+
+#define KeQueryMaximumProcessorCountEx  KeQueryActiveProcessorCountEx
+
+extern __thread ULONG HostProcessorIndex;
+
+typedef struct _PROCESSOR_NUMBER {
+    USHORT  Group;
+    UCHAR   Number;
+    UCHAR   Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+static inline ULONG
+KeGetCurrentProcessorNumberEx(
+    OUT PPROCESSOR_NUMBER   ProcNumber OPTIONAL
+    )
+{
+    if (ProcNumber != NULL) {
+        ProcNumber->Group = 0;
+        ProcNumber->Number = (UCHAR)HostProcessorIndex;
+        ProcNumber->Reserved = 0;
+    }
+
+    return HostProcessorIndex;
+}
+
+static inline NTSTATUS
+KeGetProcessorNumberFromIndex(
+    IN  ULONG               ProcIndex,
+    OUT PPROCESSOR_NUMBER   ProcNumber
+    )
+{
+    if (ProcIndex >= HostProcessorCount)
+        return STATUS_INVALID_PARAMETER;
+
+    ProcNumber->Group = 0;
+    ProcNumber->Number = (UCHAR)ProcIndex;
+    ProcNumber->Reserved = 0;
+
+    return STATUS_SUCCESS;
+}
+
+static inline ULONG
+KeGetProcessorIndexFromNumber(
+    IN  PPROCESSOR_NUMBER   ProcNumber
+    )
+{
+    return ProcNumber->Number;
+}
+
+// DPCs and interrupts are only declared; a test that needs them to run
+// provides its own
+
+typedef struct _KDPC    KDPC, *PKDPC, *PRKDPC;
+
+typedef VOID
+KDEFERRED_ROUTINE(
+    IN  PKDPC   Dpc,
+    IN  PVOID   DeferredContext OPTIONAL,
+    IN  PVOID   SystemArgument1 OPTIONAL,
+    IN  PVOID   SystemArgument2 OPTIONAL
+    );
+
+typedef KDEFERRED_ROUTINE   *PKDEFERRED_ROUTINE;
+
+struct _KDPC {
+    PKDEFERRED_ROUTINE  DeferredRoutine;
+    PVOID               DeferredContext;
+    PROCESSOR_NUMBER    ProcNumber;
+};
+
+static inline VOID
+KeInitializeDpc(
+    IN  PRKDPC              Dpc,
+    IN  PKDEFERRED_ROUTINE  DeferredRoutine,
+    IN  PVOID               DeferredContext OPTIONAL
+    )
+{
+    Dpc->DeferredRoutine = DeferredRoutine;
+    Dpc->DeferredContext = DeferredContext;
+}
+
+static inline NTSTATUS
+KeSetTargetProcessorDpcEx(
+    IN OUT  PKDPC               Dpc,
+    IN      PPROCESSOR_NUMBER   ProcNumber
+    )
+{
+    Dpc->ProcNumber = *ProcNumber;
+    return STATUS_SUCCESS;
+}
+
+extern BOOLEAN KeInsertQueueDpc(PRKDPC, PVOID, PVOID);
+extern BOOLEAN KeRemoveQueueDpc(PRKDPC);
+
+typedef struct _KTIMER {
+    LARGE_INTEGER   DueTime;
+    LONG            Period;
+    PKDPC           Dpc;
+} KTIMER, *PKTIMER, *PRKTIMER;
+
+static inline VOID
+KeInitializeTimer(
+    OUT PKTIMER Timer
+    )
+{
+    Timer->DueTime.QuadPart = 0;
+    Timer->Period = 0;
+    Timer->Dpc = NULL;
+}
+
+extern BOOLEAN KeSetTimerEx(PKTIMER, LARGE_INTEGER, LONG, PKDPC);
+extern BOOLEAN KeCancelTimer(PKTIMER);
+
+typedef struct _KINTERRUPT  KINTERRUPT, *PKINTERRUPT;
+
+typedef BOOLEAN
+KSERVICE_ROUTINE(
+    IN  PKINTERRUPT Interrupt,
+    IN  PVOID       ServiceContext
+    );
+
+typedef KSERVICE_ROUTINE    *PKSERVICE_ROUTINE;
+
+typedef enum _KINTERRUPT_MODE {
+    LevelSensitive,
+    Latched
+} KINTERRUPT_MODE;
+
+// Time
+
+static inline ULONGLONG
+__rdtsc(
+    VOID
+    )
+{
+    ULONG   Low;
+    ULONG   High;
+
+    __asm__ __volatile__("rdtsc" : "=a" (Low), "=d" (High));
+    return ((ULONGLONG)High << 32) | Low;
+}
+
+extern VOID
+KeQuerySystemTime(
+    OUT PLARGE_INTEGER  CurrentTime
+    );
+
+// Nanoseconds, so the frequency is always 10^9
+extern LARGE_INTEGER
+KeQueryPerformanceCounter(
+    OUT PLARGE_INTEGER  PerformanceFrequency OPTIONAL
+    );
+
+typedef struct _TIME_FIELDS {
+    SHORT   Year;
+    SHORT   Month;
+    SHORT   Day;
+    SHORT   Hour;
+    SHORT   Minute;
+    SHORT   Second;
+    SHORT   Milliseconds;
+    SHORT   Weekday;
+} TIME_FIELDS, *PTIME_FIELDS;
+
+extern VOID RtlTimeToTimeFields(PLARGE_INTEGER, PTIME_FIELDS);
+
+// Anything else is declared so that unused inline helpers in shared
+// headers compile; calling one of them fails at link time.
+
+typedef struct _MDL {
+    struct _MDL *Next;
+    SHORT       Size;
+    SHORT       MdlFlags;
+    PVOID       Process;
+    PVOID       MappedSystemVa;
+    PVOID       StartVa;
+    ULONG       ByteCount;
+    ULONG       ByteOffset;
+} MDL, *PMDL;
+
+#define MDL_MAPPED_TO_SYSTEM_VA     0x0001
+#define MDL_PAGES_LOCKED            0x0002
+#define MDL_SOURCE_IS_NONPAGED_POOL 0x0004
+#define MDL_ALLOCATED_FIXED_SIZE    0x0008
+#define MDL_PARTIAL                 0x0010
+#define MDL_PARTIAL_HAS_BEEN_MAPPED 0x0020
+#define MDL_IO_PAGE_READ            0x0040
+#define MDL_WRITE_OPERATION         0x0080
+#define MDL_PARENT_MAPPED_SYSTEM_VA 0x0100
+#define MDL_IO_SPACE                0x0800
+
+#define MmGetMdlPfnArray(_Mdl)          ((PPFN_NUMBER)((PMDL)(_Mdl) + 1))
+#define MmGetMdlVirtualAddress(_Mdl)    \
+        ((PVOID)((PUCHAR)((_Mdl)->StartVa) + (_Mdl)->ByteOffset))
+#define MmGetMdlByteCount(_Mdl)         ((_Mdl)->ByteCount)
+#define MmGetMdlByteOffset(_Mdl)        ((_Mdl)->ByteOffset)
+
+typedef enum _MM_PAGE_PRIORITY {
+    LowPagePriority,
+    NormalPagePriority = 16,
+    HighPagePriority = 32
+} MM_PAGE_PRIORITY;
+
+#define MdlMappingNoWrite   0x80000000
+#define MdlMappingNoExecute 0x40000000
+
+static inline PVOID
+MmGetSystemAddressForMdlSafe(
+    IN  PMDL    Mdl,
+    IN  ULONG   Priority
+    )
+{
+    (void) Priority;
+
+    if ((Mdl->MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA |
+                          MDL_SOURCE_IS_NONPAGED_POOL)) == 0)
+        abort();
+
+    return Mdl->MappedSystemVa;
+}
+
+typedef enum _MEMORY_CACHING_TYPE {
+    MmNonCached,
+    MmCached,
+    MmWriteCombined
+} MEMORY_CACHING_TYPE;
+
+typedef enum _MODE {
+    KernelMode,
+    UserMode
+} MODE, KPROCESSOR_MODE;
+
+// Events are polled; a test that waits on one needs another thread to
+// set it.
+
+typedef struct _KEVENT {
+    LONG    State;
+} KEVENT, *PKEVENT;
+
+typedef enum _EVENT_TYPE {
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON {
+    Executive
+} KWAIT_REASON;
+
+#define IO_NO_INCREMENT 0
+
+static inline VOID
+KeInitializeEvent(
+    IN  PKEVENT     Event,
+    IN  EVENT_TYPE  Type,
+    IN  BOOLEAN     State
+    )
+{
+    (void) Type;
+    __atomic_store_n(&Event->State, State, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG
+KeSetEvent(
+    IN  PKEVENT Event,
+    IN  LONG    Increment,
+    IN  BOOLEAN Wait
+    )
+{
+    (void) Increment;
+    (void) Wait;
+    return __atomic_exchange_n(&Event->State, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline VOID
+KeClearEvent(
+    IN  PKEVENT Event
+    )
+{
+    __atomic_store_n(&Event->State, 0, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG
+KeReadStateEvent(
+    IN  PKEVENT Event
+    )
+{
+    return __atomic_load_n(&Event->State, __ATOMIC_SEQ_CST);
+}
+
+static inline NTSTATUS
+KeWaitForSingleObject(
+    IN  PVOID           Object,
+    IN  KWAIT_REASON    WaitReason,
+    IN  KPROCESSOR_MODE WaitMode,
+    IN  BOOLEAN         Alertable,
+    IN  PLARGE_INTEGER  Timeout OPTIONAL
+    )
+{
+    PKEVENT             Event = Object;
+    LARGE_INTEGER       Now;
+    LONGLONG            Deadline = 0;
+
+    (void) WaitReason;
+    (void) WaitMode;
+    (void) Alertable;
+
+    if (Timeout != NULL) {
+        KeQuerySystemTime(&Now);
+        Deadline = (Timeout->QuadPart < 0) ?
+                   Now.QuadPart - Timeout->QuadPart :
+                   Timeout->QuadPart;
+    }
+
+    while (!KeReadStateEvent(Event)) {
+        if (Timeout != NULL) {
+            KeQuerySystemTime(&Now);
+            if (Now.QuadPart >= Deadline)
+                return STATUS_TIMEOUT;
+        }
+
+        sched_yield();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Provided by any test that retires objects behind a DPC grace period
+extern VOID
+KeFlushQueuedDpcs(
+    VOID
+    );
+
+#define MM_DONT_ZERO_ALLOCATION         0x00000001
+#define MM_ALLOCATE_PREFER_CONTIGUOUS   0x00000020
+
+extern PMDL MmAllocatePagesForMdlEx(PHYSICAL_ADDRESS, PHYSICAL_ADDRESS,
+                                    PHYSICAL_ADDRESS, SIZE_T,
+                                    MEMORY_CACHING_TYPE, ULONG);
+extern PVOID MmMapLockedPagesSpecifyCache(PMDL, KPROCESSOR_MODE,
+                                          MEMORY_CACHING_TYPE, PVOID,
+                                          ULONG, ULONG);
+extern VOID MmUnmapLockedPages(PVOID, PMDL);
+extern VOID MmFreePagesFromMdl(PMDL);
+extern PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID);
+extern PVOID MmMapIoSpace(PHYSICAL_ADDRESS, SIZE_T, MEMORY_CACHING_TYPE);
+extern VOID MmUnmapIoSpace(PVOID, SIZE_T);
+extern USHORT RtlCaptureStackBackTrace(ULONG, ULONG, PVOID *, PULONG);
+
+typedef struct _UNICODE_STRING {
+    USHORT  Length;
+    USHORT  MaximumLength;
+    PWCHAR  Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+static inline VOID
+RtlInitUnicodeString(
+    OUT PUNICODE_STRING Unicode,
+    IN  const WCHAR     *Source
+    )
+{
+    Unicode->Buffer = (PWCHAR)Source;
+    Unicode->Length = (USHORT)(wcslen(Source) * sizeof (WCHAR));
+    Unicode->MaximumLength = Unicode->Length + sizeof (WCHAR);
+}
+
+typedef struct _STRING {
+    USHORT  Length;
+    USHORT  MaximumLength;
+    PCHAR   Buffer;
+} ANSI_STRING, *PANSI_STRING;
+
+// Provided by any test that converts strings
+extern NTSTATUS RtlUnicodeStringToAnsiString(PANSI_STRING, PUNICODE_STRING,
+                                             BOOLEAN);
+extern VOID RtlFreeAnsiString(PANSI_STRING);
+
+// Image load notification
+
+typedef struct _IMAGE_INFO {
+    ULONG   Properties;
+    PVOID   ImageBase;
+    ULONG   ImageSelector;
+    SIZE_T  ImageSize;
+    ULONG   ImageSectionNumber;
+    BOOLEAN SystemModeImage;
+} IMAGE_INFO, *PIMAGE_INFO;
+
+typedef VOID
+LOAD_IMAGE_NOTIFY_ROUTINE(
+    IN  PUNICODE_STRING FullImageName,
+    IN  HANDLE          ProcessId,
+    IN  PIMAGE_INFO     ImageInfo
+    );
+
+typedef LOAD_IMAGE_NOTIFY_ROUTINE   *PLOAD_IMAGE_NOTIFY_ROUTINE;
+
+extern NTSTATUS PsSetLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE);
+extern NTSTATUS PsRemoveLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE);
+
+// Provided by any test that broadcasts IPIs
+
+typedef ULONG_PTR
+KIPI_BROADCAST_WORKER(
+    IN  ULONG_PTR   Argument
+    );
+
+typedef KIPI_BROADCAST_WORKER   *PKIPI_BROADCAST_WORKER;
+
+extern ULONG_PTR KeIpiGenericCall(PKIPI_BROADCAST_WORKER, ULONG_PTR);
+
+extern PKEVENT IoCreateNotificationEvent(PUNICODE_STRING, PHANDLE);
+extern NTSTATUS ZwClose(HANDLE);
+extern VOID __writemsr(ULONG, ULONG64);
+extern VOID __cpuid(unsigned int Info[4], int Leaf);
+
+static inline VOID
+KeBugCheckEx(
+    IN  ULONG       Code,
+    IN  ULONG_PTR   Parameter1,
+    IN  ULONG_PTR   Parameter2,
+    IN  ULONG_PTR   Parameter3,
+    IN  ULONG_PTR   Parameter4
+    )
+{
+    fprintf(stderr, "BUGCHECK %08x (%lx %lx %lx %lx)\n",
+            Code,
+            (unsigned long)Parameter1,
+            (unsigned long)Parameter2,
+            (unsigned long)Parameter3,
+            (unsigned long)Parameter4);
+    abort();
+}
+
+// Interface header used by all the driver interfaces
+
+typedef struct _INTERFACE {
+    USHORT  Size;
+    USHORT  Version;
+    PVOID   Context;
+    PVOID   InterfaceReference;
+    PVOID   InterfaceDereference;
+} INTERFACE, *PINTERFACE;
+
+typedef struct _DEVICE_OBJECT   DEVICE_OBJECT, *PDEVICE_OBJECT;
+typedef struct _IRP             IRP, *PIRP;
+
+// Only the field that dma.c forwards to the driver's callbacks
+struct _DEVICE_OBJECT {
+    PIRP    CurrentIrp;
+};
+
+// DMA adapters, laid out as in wdm.h so that dma.c's operation table
+// and its version sizes are the same as in the kernel build
+
+typedef PVOID   POBJECT_TYPE;
+typedef PVOID   PRTL_BITMAP;
+typedef ULONG   NODE_REQUIREMENT;
+
+typedef struct _KDEVICE_QUEUE {
+    SHORT       Type;
+    SHORT       Size;
+    LIST_ENTRY  DeviceListHead;
+    KSPIN_LOCK  Lock;
+    BOOLEAN     Busy;
+} KDEVICE_QUEUE, *PKDEVICE_QUEUE;
+
+typedef enum _INTERFACE_TYPE {
+    Internal,
+    Isa,
+    Eisa,
+    MicroChannel,
+    TurboChannel,
+    PCIBus
+} INTERFACE_TYPE;
+
+typedef enum _DMA_WIDTH {
+    Width8Bits,
+    Width16Bits,
+    Width32Bits,
+    Width64Bits,
+    WidthNoWrap,
+    MaximumDmaWidth
+} DMA_WIDTH;
+
+typedef enum _DMA_SPEED {
+    Compatible,
+    TypeA,
+    TypeB,
+    TypeC,
+    TypeF,
+    MaximumDmaSpeed
+} DMA_SPEED;
+
+typedef struct _DEVICE_DESCRIPTION {
+    ULONG           Version;
+    BOOLEAN         Master;
+    BOOLEAN         ScatterGather;
+    BOOLEAN         DemandMode;
+    BOOLEAN         AutoInitialize;
+    BOOLEAN         Dma32BitAddresses;
+    BOOLEAN         IgnoreCount;
+    BOOLEAN         Reserved1;
+    BOOLEAN         Dma64BitAddresses;
+    ULONG           BusNumber;
+    ULONG           DmaChannel;
+    INTERFACE_TYPE  InterfaceType;
+    DMA_WIDTH       DmaWidth;
+    DMA_SPEED       DmaSpeed;
+    ULONG           MaximumLength;
+    ULONG           DmaPort;
+} DEVICE_DESCRIPTION, *PDEVICE_DESCRIPTION;
+
+typedef enum _IO_ALLOCATION_ACTION {
+    KeepObject = 1,
+    DeallocateObject,
+    DeallocateObjectKeepRegisters
+} IO_ALLOCATION_ACTION;
+
+typedef enum _DMA_COMPLETION_STATUS {
+    DmaComplete,
+    DmaAborted,
+    DmaError,
+    DmaCancelled
+} DMA_COMPLETION_STATUS;
+
+typedef struct _SCATTER_GATHER_ELEMENT {
+    PHYSICAL_ADDRESS    Address;
+    ULONG               Length;
+    ULONG_PTR           Reserved;
+} SCATTER_GATHER_ELEMENT, *PSCATTER_GATHER_ELEMENT;
+
+typedef struct _SCATTER_GATHER_LIST {
+    ULONG                   NumberOfElements;
+    ULONG_PTR               Reserved;
+    SCATTER_GATHER_ELEMENT  Elements[];
+} SCATTER_GATHER_LIST, *PSCATTER_GATHER_LIST;
+
+typedef struct _DMA_ADAPTER_INFO {
+    ULONG   Version;
+    ULONG   Flags[4];
+} DMA_ADAPTER_INFO, *PDMA_ADAPTER_INFO;
+
+typedef struct _DMA_TRANSFER_INFO {
+    ULONG   Version;
+    ULONG   MapRegisterCount;
+    ULONG   ScatterGatherElementCount;
+    ULONG   ScatterGatherListSize;
+} DMA_TRANSFER_INFO, *PDMA_TRANSFER_INFO;
+
+typedef struct _DMA_ADAPTER     DMA_ADAPTER, *PDMA_ADAPTER;
+typedef struct _DMA_OPERATIONS  DMA_OPERATIONS, *PDMA_OPERATIONS;
+
+typedef IO_ALLOCATION_ACTION DRIVER_CONTROL(PDEVICE_OBJECT, PIRP, PVOID, PVOID);
+typedef DRIVER_CONTROL *PDRIVER_CONTROL;
+
+typedef VOID DRIVER_LIST_CONTROL(PDEVICE_OBJECT, PIRP, PSCATTER_GATHER_LIST, PVOID);
+typedef DRIVER_LIST_CONTROL *PDRIVER_LIST_CONTROL;
+
+typedef VOID DMA_COMPLETION_ROUTINE(PDMA_ADAPTER, PDEVICE_OBJECT, PVOID,
+                                    DMA_COMPLETION_STATUS);
+typedef DMA_COMPLETION_ROUTINE *PDMA_COMPLETION_ROUTINE;
+
+struct _DMA_ADAPTER {
+    USHORT              Version;
+    USHORT              Size;
+    PDMA_OPERATIONS     DmaOperations;
+};
+
+struct _DMA_OPERATIONS {
+    ULONG   Size;
+    VOID    (*PutDmaAdapter)(PDMA_ADAPTER);
+    PVOID   (*AllocateCommonBuffer)(PDMA_ADAPTER, ULONG, PPHYSICAL_ADDRESS,
+                                    BOOLEAN);
+    VOID    (*FreeCommonBuffer)(PDMA_ADAPTER, ULONG, PHYSICAL_ADDRESS, PVOID,
+                                BOOLEAN);
+    NTSTATUS    (*AllocateAdapterChannel)(PDMA_ADAPTER, PDEVICE_OBJECT, ULONG,
+                                          PDRIVER_CONTROL, PVOID);
+    BOOLEAN (*FlushAdapterBuffers)(PDMA_ADAPTER, PMDL, PVOID, PVOID, ULONG,
+                                   BOOLEAN);
+    VOID    (*FreeAdapterChannel)(PDMA_ADAPTER);
+    VOID    (*FreeMapRegisters)(PDMA_ADAPTER, PVOID, ULONG);
+    PHYSICAL_ADDRESS    (*MapTransfer)(PDMA_ADAPTER, PMDL, PVOID, PVOID,
+                                       PULONG, BOOLEAN);
+    ULONG   (*GetDmaAlignment)(PDMA_ADAPTER);
+    ULONG   (*ReadDmaCounter)(PDMA_ADAPTER);
+    NTSTATUS    (*GetScatterGatherList)(PDMA_ADAPTER, PDEVICE_OBJECT, PMDL,
+                                        PVOID, ULONG, PDRIVER_LIST_CONTROL,
+                                        PVOID, BOOLEAN);
+    VOID    (*PutScatterGatherList)(PDMA_ADAPTER, PSCATTER_GATHER_LIST,
+                                    BOOLEAN);
+    NTSTATUS    (*CalculateScatterGatherList)(PDMA_ADAPTER, PMDL, PVOID, ULONG,
+                                              PULONG, PULONG);
+    NTSTATUS    (*BuildScatterGatherList)(PDMA_ADAPTER, PDEVICE_OBJECT, PMDL,
+                                          PVOID, ULONG, PDRIVER_LIST_CONTROL,
+                                          PVOID, BOOLEAN, PVOID, ULONG);
+    NTSTATUS    (*BuildMdlFromScatterGatherList)(PDMA_ADAPTER,
+                                                 PSCATTER_GATHER_LIST, PMDL,
+                                                 PMDL *);
+    NTSTATUS    (*GetDmaAdapterInfo)(PDMA_ADAPTER, PDMA_ADAPTER_INFO);
+    NTSTATUS    (*GetDmaTransferInfo)(PDMA_ADAPTER, PMDL, ULONGLONG, ULONG,
+                                      BOOLEAN, PDMA_TRANSFER_INFO);
+    NTSTATUS    (*InitializeDmaTransferContext)(PDMA_ADAPTER, PVOID);
+    PVOID   (*AllocateCommonBufferEx)(PDMA_ADAPTER, PPHYSICAL_ADDRESS, ULONG,
+                                      PPHYSICAL_ADDRESS, BOOLEAN,
+                                      NODE_REQUIREMENT);
+    NTSTATUS    (*AllocateAdapterChannelEx)(PDMA_ADAPTER, PDEVICE_OBJECT, PVOID,
+                                            ULONG, ULONG, PDRIVER_CONTROL,
+                                            PVOID, PVOID *);
+    NTSTATUS    (*ConfigureAdapterChannel)(PDMA_ADAPTER, ULONG, PVOID);
+    BOOLEAN (*CancelAdapterChannel)(PDMA_ADAPTER, PDEVICE_OBJECT, PVOID);
+    NTSTATUS    (*MapTransferEx)(PDMA_ADAPTER, PMDL, PVOID, ULONGLONG, ULONG,
+                                 PULONG, BOOLEAN, PSCATTER_GATHER_LIST, ULONG,
+                                 PDMA_COMPLETION_ROUTINE, PVOID);
+    NTSTATUS    (*GetScatterGatherListEx)(PDMA_ADAPTER, PDEVICE_OBJECT, PVOID,
+                                          PMDL, ULONGLONG, ULONG, ULONG,
+                                          PDRIVER_LIST_CONTROL, PVOID, BOOLEAN,
+                                          PDMA_COMPLETION_ROUTINE, PVOID,
+                                          PSCATTER_GATHER_LIST *);
+    NTSTATUS    (*BuildScatterGatherListEx)(PDMA_ADAPTER, PDEVICE_OBJECT, PVOID,
+                                            PMDL, ULONGLONG, ULONG, ULONG,
+                                            PDRIVER_LIST_CONTROL, PVOID,
+                                            BOOLEAN, PVOID, ULONG,
+                                            PDMA_COMPLETION_ROUTINE, PVOID,
+                                            PSCATTER_GATHER_LIST *);
+    NTSTATUS    (*FlushAdapterBuffersEx)(PDMA_ADAPTER, PMDL, PVOID, ULONGLONG,
+                                         ULONG, BOOLEAN);
+    VOID    (*FreeAdapterObject)(PDMA_ADAPTER, IO_ALLOCATION_ACTION);
+    NTSTATUS    (*CancelMappedTransfer)(PDMA_ADAPTER, PVOID);
+};
+
+#endif  // _HOST_NTDDK_H
@@ -0,0 +1,426 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the module table in module.c. The boot-time module list and
+// image load notifications are faked, and KeIpiGenericCall() reads the
+// table that is about to be retired, so that freeing it before the IPI
+// shows up under -fsanitize=address. The test checks that the table is
+// built and kept sorted whatever order modules arrive in, that lookups
+// are right at the first and last byte of each module and in the gaps
+// between them, that a module loaded over unloaded ones replaces them,
+// and that a failed load leaves the table as it was.
+
+#include <ntddk.h>
+#include <wchar.h>
+
+#include "../src/xen/module.c"
+
+#include "test.h"
+
+typedef struct _HOST_MODULE {
+    const CHAR  *Path;
+    ULONG_PTR   Start;
+    ULONG       Size;
+} HOST_MODULE, *PHOST_MODULE;
+
+// Deliberately out of order. The last one is only listed once the first
+// query has been answered, as if it had been loaded in between.
+static const HOST_MODULE    HostBootModule[] = {
+    { "\\SystemRoot\\system32\\ntoskrnl.exe", 0x800000, 0x100000 },
+    { "\\SystemRoot\\System32\\Drivers\\ACPI.sys", 0x200000, 0x10000 },
+    { "hal.dll", 0x600000, 0x20000 },
+    { "\\SystemRoot\\System32\\drivers\\XEN.sys", 0x100000, 0x8000 },
+};
+
+static ULONG                        HostQueries;
+static PLOAD_IMAGE_NOTIFY_ROUTINE   HostNotifyRoutine;
+static ULONG                        HostIpis;
+static PMODULE_TABLE                HostRetiring;
+
+NTSTATUS
+AuxKlibInitialize(
+    VOID
+    )
+{
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+AuxKlibQueryModuleInformation(
+    IN OUT  PULONG  BufferSize,
+    IN      ULONG   ElementSize,
+    OUT     PVOID   Buffer OPTIONAL
+    )
+{
+    PAUX_MODULE_EXTENDED_INFO   Info = Buffer;
+    ULONG                       Count;
+    ULONG                       Index;
+
+    CHECK_EQ(ElementSize, sizeof (AUX_MODULE_EXTENDED_INFO));
+
+    Count = (HostQueries++ == 0) ?
+            ARRAYSIZE(HostBootModule) - 1 :
+            ARRAYSIZE(HostBootModule);
+
+    if (Buffer == NULL || *BufferSize < Count * ElementSize) {
+        *BufferSize = Count * ElementSize;
+        return (Buffer == NULL) ? STATUS_SUCCESS : STATUS_BUFFER_TOO_SMALL;
+    }
+
+    for (Index = 0; Index < Count; Index++) {
+        RtlZeroMemory(&Info[Index], sizeof (AUX_MODULE_EXTENDED_INFO));
+        Info[Index].BasicInfo.ImageBase = (PVOID)HostBootModule[Index].Start;
+        Info[Index].ImageSize = HostBootModule[Index].Size;
+        strcpy((CHAR *)Info[Index].FullPathName, HostBootModule[Index].Path);
+    }
+
+    *BufferSize = Count * ElementSize;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsSetLoadImageNotifyRoutine(
+    IN  PLOAD_IMAGE_NOTIFY_ROUTINE  Routine
+    )
+{
+    CHECK(HostNotifyRoutine == NULL);
+    HostNotifyRoutine = Routine;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsRemoveLoadImageNotifyRoutine(
+    IN  PLOAD_IMAGE_NOTIFY_ROUTINE  Routine
+    )
+{
+    CHECK(HostNotifyRoutine == Routine);
+    HostNotifyRoutine = NULL;
+    return STATUS_SUCCESS;
+}
+
+// The replaced table must already be unpublished, and must still be
+// intact because a lookup on another processor may be reading it
+ULONG_PTR
+KeIpiGenericCall(
+    IN  PKIPI_BROADCAST_WORKER  Worker,
+    IN  ULONG_PTR               Argument
+    )
+{
+    HostIpis++;
+
+    if (HostRetiring != NULL) {
+        ULONG   Index;
+
+        CHECK(ModuleContext.Table != HostRetiring);
+
+        for (Index = 0; Index < HostRetiring->Count; Index++)
+            CHECK(HostRetiring->Module[Index]->Start <=
+                  HostRetiring->Module[Index]->End);
+    }
+
+    return Worker(Argument);
+}
+
+NTSTATUS
+RtlUnicodeStringToAnsiString(
+    OUT PANSI_STRING    Ansi,
+    IN  PUNICODE_STRING Unicode,
+    IN  BOOLEAN         Allocate
+    )
+{
+    ULONG               Length = Unicode->Length / sizeof (WCHAR);
+    ULONG               Index;
+
+    CHECK(Allocate);
+
+    Ansi->Buffer = malloc(Length + 1);
+    if (Ansi->Buffer == NULL)
+        return STATUS_NO_MEMORY;
+
+    for (Index = 0; Index < Length; Index++)
+        Ansi->Buffer[Index] = (CHAR)Unicode->Buffer[Index];
+    Ansi->Buffer[Length] = '\0';
+
+    Ansi->Length = (USHORT)Length;
+    Ansi->MaximumLength = (USHORT)(Length + 1);
+    return STATUS_SUCCESS;
+}
+
+VOID
+RtlFreeAnsiString(
+    IN  PANSI_STRING    Ansi
+    )
+{
+    free(Ansi->Buffer);
+    Ansi->Buffer = NULL;
+}
+
+static VOID
+TestLoad(
+    IN  const WCHAR *Path,
+    IN  ULONG_PTR   Start,
+    IN  SIZE_T      Size,
+    IN  BOOLEAN     SystemModeImage
+    )
+{
+    UNICODE_STRING  Unicode;
+    IMAGE_INFO      Info;
+
+    RtlInitUnicodeString(&Unicode, Path);
+
+    RtlZeroMemory(&Info, sizeof (Info));
+    Info.ImageBase = (PVOID)Start;
+    Info.ImageSize = Size;
+    Info.SystemModeImage = SystemModeImage;
+
+    HostRetiring = ModuleContext.Table;
+    HostNotifyRoutine(&Unicode, NULL, &Info);
+    HostRetiring = NULL;
+}
+
+// Address must fall in module Name at Offset, or in no module if Name is
+// NULL
+static VOID
+TestLookup(
+    IN  ULONG_PTR   Address,
+    IN  const CHAR  *Name,
+    IN  ULONG_PTR   Offset
+    )
+{
+    PCHAR           Found;
+    ULONG_PTR       FoundOffset;
+
+    ModuleLookup(Address, &Found, &FoundOffset);
+
+    if (Name == NULL) {
+        CHECK(Found == NULL);
+        CHECK_EQ(FoundOffset, 0);
+    } else {
+        CHECK(Found != NULL && strcmp(Found, Name) == 0);
+        CHECK_EQ(FoundOffset, Offset);
+    }
+}
+
+// The table holds exactly these modules, in this order, and each is
+// found at its first and last byte but not either side of it unless a
+// neighbour is there
+static VOID
+TestTable(
+    IN  const HOST_MODULE   *Expected,
+    IN  ULONG               Count
+    )
+{
+    PMODULE_TABLE           Table = ModuleContext.Table;
+    ULONG                   Index;
+
+    CHECK(Table != NULL);
+    CHECK_EQ(Table->Count, Count);
+    if (Table->Count != Count)
+        return;
+
+    for (Index = 0; Index < Count; Index++) {
+        const HOST_MODULE   *Module = &Expected[Index];
+
+        CHECK_EQ(Table->Module[Index]->Start, Module->Start);
+        CHECK_EQ(Table->Module[Index]->End, Module->Start + Module->Size - 1);
+        CHECK(strcmp(Table->Module[Index]->Name, Module->Path) == 0);
+
+        TestLookup(Module->Start, Module->Path, 0);
+        TestLookup(Module->Start + Module->Size - 1, Module->Path, Module->Size - 1);
+
+        if (Index == 0 || Expected[Index - 1].Start + Expected[Index - 1].Size != Module->Start)
+            TestLookup(Module->Start - 1, NULL, 0);
+
+        if (Index == Count - 1 || Module->Start + Module->Size != Expected[Index + 1].Start)
+            TestLookup(Module->Start + Module->Size, NULL, 0);
+    }
+
+    TestLookup(0, NULL, 0);
+    TestLookup(~(ULONG_PTR)0, NULL, 0);
+}
+
+static VOID
+TestInitialize(
+    VOID
+    )
+{
+    // Names are stripped of their path and lower-cased
+    static const HOST_MODULE    Expected[] = {
+        { "xen.sys", 0x100000, 0x8000 },
+        { "acpi.sys", 0x200000, 0x10000 },
+        { "hal.dll", 0x600000, 0x20000 },
+        { "ntoskrnl.exe", 0x800000, 0x100000 },
+    };
+    NTSTATUS                    status;
+
+    TestLookup(0x100000, NULL, 0);
+
+    status = ModuleInitialize();
+    CHECK(NT_SUCCESS(status));
+    CHECK(HostNotifyRoutine == ModuleLoad);
+
+    // Sized, found too small because a module was loaded, then read
+    CHECK_EQ(HostQueries, 3);
+
+    // Nothing could see the table before it was published
+    CHECK_EQ(HostIpis, 0);
+
+    TestTable(Expected, ARRAYSIZE(Expected));
+}
+
+static VOID
+TestInsert(
+    VOID
+    )
+{
+    static const HOST_MODULE    Expected[] = {
+        { "first.sys", 0x1000, 0x1000 },
+        { "xen.sys", 0x100000, 0x8000 },
+        { "next.sys", 0x108000, 0x1000 },
+        { "acpi.sys", 0x200000, 0x10000 },
+        { "middle.sys", 0x400000, 0x3000 },
+        { "hal.dll", 0x600000, 0x20000 },
+        { "ntoskrnl.exe", 0x800000, 0x100000 },
+        { "last.sys", 0x10000000, 0x1000 },
+    };
+    LONG                        Allocations;
+
+    // One new module and one replaced table for each load
+    Allocations = HostPoolAllocations;
+
+    TestLoad(L"\\SystemRoot\\System32\\drivers\\middle.sys", 0x400000, 0x3000, TRUE);
+    TestLoad(L"\\SystemRoot\\System32\\drivers\\last.sys", 0x10000000, 0x1000, TRUE);
+    TestLoad(L"first.sys", 0x1000, 0x1000, TRUE);
+
+    // Right after the end of xen.sys, which must not be displaced
+    TestLoad(L"\\SystemRoot\\System32\\drivers\\next.sys", 0x108000, 0x1000, TRUE);
+
+    CHECK_EQ(HostIpis, 4);
+    CHECK_EQ(HostPoolAllocations, Allocations + 4);
+
+    // User mode images are not tracked
+    TestLoad(L"\\Windows\\System32\\user.dll", 0x500000, 0x1000, FALSE);
+    CHECK_EQ(HostIpis, 4);
+
+    TestTable(Expected, ARRAYSIZE(Expected));
+}
+
+static VOID
+TestReplace(
+    VOID
+    )
+{
+    static const HOST_MODULE    Expected[] = {
+        { "first.sys", 0x1000, 0x1000 },
+        { "xen.sys", 0x100000, 0x8000 },
+        { "next.sys", 0x108000, 0x1000 },
+        { "again.sys", 0x200000, 0x4000 },
+        { "wide.sys", 0x402fff, 0x1fd002 },
+        { "ntoskrnl.exe", 0x800000, 0x100000 },
+        { "last.sys", 0x10000000, 0x1000 },
+    };
+    LONG                        Allocations;
+
+    Allocations = HostPoolAllocations;
+
+    // A smaller image at the base of acpi.sys, which must have been
+    // unloaded
+    TestLoad(L"again.sys", 0x200000, 0x4000, TRUE);
+    CHECK_EQ(HostPoolAllocations, Allocations);
+    TestLookup(0x204000, NULL, 0);
+
+    // An image that covers the last byte of middle.sys and the first of
+    // hal.dll replaces both
+    TestLoad(L"wide.sys", 0x402fff, 0x1fd002, TRUE);
+    CHECK_EQ(HostPoolAllocations, Allocations - 1);
+
+    CHECK_EQ(HostIpis, 6);
+
+    TestTable(Expected, ARRAYSIZE(Expected));
+}
+
+static VOID
+TestFailure(
+    VOID
+    )
+{
+    PMODULE_TABLE   Table = ModuleContext.Table;
+    LONG            Allocations = HostPoolAllocations;
+    ULONG           Skip;
+
+    // The name buffer, the module and the new table
+    for (Skip = 0; Skip < 3; Skip++) {
+        HostPoolFailSkip = Skip;
+        HostPoolFailCount = 1;
+
+        TestLoad(L"failed.sys", 0x200000, 0x1000, TRUE);
+
+        CHECK_EQ(HostPoolFailCount, 0);
+        HostPoolFailSkip = 0;
+        HostPoolFailCount = 0;
+
+        CHECK(ModuleContext.Table == Table);
+        CHECK_EQ(HostPoolAllocations, Allocations);
+        TestLookup(0x200000, "again.sys", 0);
+    }
+
+    CHECK_EQ(HostIpis, 6);
+}
+
+static VOID
+TestTeardown(
+    VOID
+    )
+{
+    ModuleTeardown();
+
+    CHECK(HostNotifyRoutine == NULL);
+    CHECK(ModuleContext.Table == NULL);
+    CHECK_EQ(HostIpis, 7);
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    TestLookup(0x100000, NULL, 0);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    TestInitialize();
+    TestInsert();
+    TestReplace();
+    TestFailure();
+    TestTeardown();
+
+    return TEST_RESULT("module");
+}
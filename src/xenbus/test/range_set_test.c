@@ -0,0 +1,404 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Randomized differential test of the RANGE_SET implementations. The
+// same sequence of Put/Pop/Get operations is applied to a LIST set, a
+// TREE set and a flat bitmap, and every result must agree.
+
+#define _XENBUS_FDO_H   // Keep the real FDO (and everything it pulls in) out
+
+typedef struct _XENBUS_FDO  XENBUS_FDO, *PXENBUS_FDO;
+
+#include "../src/xenbus/debug.h"
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+extern PXENBUS_DEBUG_CONTEXT FdoGetDebugContext(PXENBUS_FDO);
+
+#include "../src/xenbus/range_set.c"
+
+#include "test.h"
+
+PXENBUS_DEBUG_CONTEXT
+FdoGetDebugContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    return NULL;
+}
+
+NTSTATUS
+DebugGetInterface(
+    IN      PXENBUS_DEBUG_CONTEXT   Context,
+    IN      ULONG                   Version,
+    IN OUT  PINTERFACE              Interface,
+    IN      ULONG                   Size
+    )
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(Version);
+
+    RtlZeroMemory(Interface, Size);
+    return STATUS_SUCCESS;
+}
+
+#define UNIVERSE    4096
+
+typedef struct _MODEL {
+    UCHAR   Present[UNIVERSE];
+} MODEL, *PMODEL;
+
+static BOOLEAN
+ModelPop(
+    IN  PMODEL      Model,
+    IN  ULONGLONG   Count,
+    OUT PLONGLONG   Start
+    )
+{
+    LONGLONG        Index;
+    ULONGLONG       Run;
+
+    // First fit, lowest address first
+    Run = 0;
+    for (Index = 0; Index < UNIVERSE; Index++) {
+        Run = (Model->Present[Index]) ? Run + 1 : 0;
+
+        if (Run == Count) {
+            LONGLONG    First = Index + 1 - (LONGLONG)Count;
+
+            // A run is only usable if it starts a range
+            while (First > 0 && Model->Present[First - 1])
+                First--;
+
+            *Start = First;
+            memset(&Model->Present[First], 0, (SIZE_T)Count);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOLEAN
+ModelIsSet(
+    IN  PMODEL      Model,
+    IN  LONGLONG    Start,
+    IN  ULONGLONG   Count,
+    IN  UCHAR       Value
+    )
+{
+    ULONGLONG       Index;
+
+    for (Index = 0; Index < Count; Index++)
+        if (Model->Present[Start + Index] != Value)
+            return FALSE;
+
+    return TRUE;
+}
+
+static ULONG
+ModelRangeCount(
+    IN  PMODEL  Model
+    )
+{
+    ULONG       Count;
+    ULONG       Index;
+
+    Count = 0;
+    for (Index = 0; Index < UNIVERSE; Index++)
+        if (Model->Present[Index] &&
+            (Index == 0 || !Model->Present[Index - 1]))
+            Count++;
+
+    return Count;
+}
+
+static ULONGLONG
+ModelItemCount(
+    IN  PMODEL  Model
+    )
+{
+    ULONGLONG   Count;
+    ULONG       Index;
+
+    Count = 0;
+    for (Index = 0; Index < UNIVERSE; Index++)
+        Count += Model->Present[Index];
+
+    return Count;
+}
+
+static VOID
+TreeCheck(
+    IN  PRANGE_NODE Node,
+    IN  PMODEL      Model,
+    IN OUT  PULONG  Count
+    )
+{
+    if (Node == NULL)
+        return;
+
+    TreeCheck(Node->Left, Model, Count);
+
+    CHECK(ModelIsSet(Model,
+                     Node->Start,
+                     (ULONGLONG)(Node->End + 1 - Node->Start),
+                     1));
+    CHECK(Node->Start == 0 || !Model->Present[Node->Start - 1]);
+    CHECK(Node->End == UNIVERSE - 1 || !Model->Present[Node->End + 1]);
+    CHECK(__RangeNodeHeight(Node) ==
+          1 + __max(__RangeNodeHeight(Node->Left),
+                    __RangeNodeHeight(Node->Right)));
+    CHECK(abs(__RangeNodeHeight(Node->Left) -
+              __RangeNodeHeight(Node->Right)) <= 1);
+
+    (*Count)++;
+
+    TreeCheck(Node->Right, Model, Count);
+}
+
+static VOID
+ListCheck(
+    IN  PXENBUS_RANGE_SET   RangeSet,
+    IN  PMODEL              Model
+    )
+{
+    PLIST_ENTRY             ListEntry;
+    ULONG                   Count;
+
+    Count = 0;
+    for (ListEntry = RangeSet->List.Flink;
+         ListEntry != &RangeSet->List;
+         ListEntry = ListEntry->Flink) {
+        PRANGE  Range = CONTAINING_RECORD(ListEntry, RANGE, ListEntry);
+
+        CHECK(Range->Start <= Range->End);
+        CHECK(ModelIsSet(Model,
+                         Range->Start,
+                         (ULONGLONG)(Range->End + 1 - Range->Start),
+                         1));
+        CHECK(Range->Start == 0 || !Model->Present[Range->Start - 1]);
+        CHECK(Range->End == UNIVERSE - 1 || !Model->Present[Range->End + 1]);
+        Count++;
+    }
+
+    CHECK_EQ(Count, ModelRangeCount(Model));
+    CHECK_EQ(RangeSet->RangeCount, Count);
+}
+
+static VOID
+Check(
+    IN  PXENBUS_RANGE_SET   List,
+    IN  PXENBUS_RANGE_SET   Tree,
+    IN  PMODEL              Model
+    )
+{
+    ULONG                   Count;
+
+    ListCheck(List, Model);
+
+    Count = 0;
+    TreeCheck(Tree->Root, Model, &Count);
+    CHECK_EQ(Count, ModelRangeCount(Model));
+    CHECK_EQ(Tree->RangeCount, Count);
+
+    CHECK_EQ(List->ItemCount, ModelItemCount(Model));
+    CHECK_EQ(Tree->ItemCount, ModelItemCount(Model));
+}
+
+static VOID
+RunSeed(
+    IN  PINTERFACE  Interface,
+    IN  ULONGLONG   Seed,
+    IN  ULONG       Operations
+    )
+{
+    PXENBUS_RANGE_SET   List;
+    PXENBUS_RANGE_SET   Tree;
+    MODEL               Model;
+    ULONGLONG           State = Seed;
+    ULONG               Index;
+    NTSTATUS            status;
+
+    status = RangeSetCreate(Interface, "list", XENBUS_RANGE_SET_TYPE_LIST, &List);
+    CHECK(NT_SUCCESS(status));
+
+    status = RangeSetCreate(Interface, "tree", XENBUS_RANGE_SET_TYPE_TREE, &Tree);
+    CHECK(NT_SUCCESS(status));
+
+    memset(&Model, 0, sizeof (Model));
+
+    // Start with everything present, as the grant table does
+    CHECK(NT_SUCCESS(RangeSetPut(Interface, List, 0, UNIVERSE)));
+    CHECK(NT_SUCCESS(RangeSetPut(Interface, Tree, 0, UNIVERSE)));
+    memset(Model.Present, 1, UNIVERSE);
+
+    for (Index = 0; Index < Operations && TestFailures == 0; Index++) {
+        ULONG       Operation = TestRandom(&State) % 3;
+        ULONGLONG   Count = 1 + (TestRandom(&State) % 4 == 0 ?
+                                 TestRandom(&State) % 64 :
+                                 TestRandom(&State) % 4);
+        LONGLONG    Start = TestRandom(&State) % (UNIVERSE - Count + 1);
+
+        switch (Operation) {
+        case 0: {   // Pop
+            LONGLONG    ListStart = -1;
+            LONGLONG    TreeStart = -1;
+            LONGLONG    ModelStart = -1;
+            BOOLEAN     Expected;
+
+            Expected = ModelPop(&Model, Count, &ModelStart);
+
+            status = RangeSetPop(Interface, List, Count, &ListStart);
+            CHECK_EQ(NT_SUCCESS(status), Expected);
+
+            status = RangeSetPop(Interface, Tree, Count, &TreeStart);
+            CHECK_EQ(NT_SUCCESS(status), Expected);
+
+            if (Expected) {
+                CHECK_EQ(ListStart, ModelStart);
+                CHECK_EQ(TreeStart, ModelStart);
+            }
+            break;
+        }
+        case 1:     // Put back something that is absent
+            if (!ModelIsSet(&Model, Start, Count, 0))
+                break;
+
+            CHECK(NT_SUCCESS(RangeSetPut(Interface, List, Start, Count)));
+            CHECK(NT_SUCCESS(RangeSetPut(Interface, Tree, Start, Count)));
+            memset(&Model.Present[Start], 1, (SIZE_T)Count);
+            break;
+
+        case 2: {   // Get a specific range
+            BOOLEAN Expected = ModelIsSet(&Model, Start, Count, 1);
+
+            // The LIST implementation treats getting an absent range as
+            // a caller bug (it asserts) so only the TREE sees those.
+            if (Expected) {
+                status = RangeSetGet(Interface, List, Start, Count);
+                CHECK(NT_SUCCESS(status));
+            }
+
+            status = RangeSetGet(Interface, Tree, Start, Count);
+            CHECK_EQ(NT_SUCCESS(status), Expected);
+
+            if (Expected)
+                memset(&Model.Present[Start], 0, (SIZE_T)Count);
+            break;
+        }
+        }
+
+        Check(List, Tree, &Model);
+    }
+
+    if (TestFailures != 0)
+        fprintf(stderr, "seed %llu failed at operation %u\n", Seed, Index);
+
+    // Drain both sets so that they can be destroyed
+    for (Index = 0; Index < UNIVERSE; Index++) {
+        if (!Model.Present[Index])
+            continue;
+
+        CHECK(NT_SUCCESS(RangeSetGet(Interface, List, Index, 1)));
+        CHECK(NT_SUCCESS(RangeSetGet(Interface, Tree, Index, 1)));
+        Model.Present[Index] = 0;
+    }
+
+    Check(List, Tree, &Model);
+
+    RangeSetDestroy(Interface, List);
+    RangeSetDestroy(Interface, Tree);
+}
+
+// Pop() on a list used to stop at the cursor's first range that was too
+// small instead of moving on to one that fits.
+static VOID
+ListPopSkipsSmallRanges(
+    IN  PINTERFACE      Interface
+    )
+{
+    PXENBUS_RANGE_SET   List;
+    LONGLONG            Start;
+
+    CHECK(NT_SUCCESS(RangeSetCreate(Interface, "pop", XENBUS_RANGE_SET_TYPE_LIST, &List)));
+
+    CHECK(NT_SUCCESS(RangeSetPut(Interface, List, 0, 1)));
+    CHECK(NT_SUCCESS(RangeSetPut(Interface, List, 10, 2)));
+    CHECK(NT_SUCCESS(RangeSetPut(Interface, List, 20, 8)));
+
+    CHECK(NT_SUCCESS(RangeSetPop(Interface, List, 4, &Start)));
+    CHECK_EQ(Start, 20);
+
+    CHECK(NT_SUCCESS(RangeSetPop(Interface, List, 2, &Start)));
+    CHECK_EQ(Start, 10);
+
+    CHECK(!NT_SUCCESS(RangeSetPop(Interface, List, 5, &Start)));
+
+    CHECK(NT_SUCCESS(RangeSetGet(Interface, List, 0, 1)));
+    CHECK(NT_SUCCESS(RangeSetGet(Interface, List, 24, 4)));
+
+    RangeSetDestroy(Interface, List);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    XENBUS_RANGE_SET_CONTEXT    Context;
+    INTERFACE                   Interface;
+    ULONG                       Seeds;
+    ULONGLONG                   Seed;
+
+    Seeds = (argc > 1) ? (ULONG)strtoul(argv[1], NULL, 0) : 200;
+
+    RtlZeroMemory(&Context, sizeof (Context));
+    KeInitializeSpinLock(&Context.Lock);
+    InitializeListHead(&Context.List);
+
+    RtlZeroMemory(&Interface, sizeof (Interface));
+    Interface.Context = &Context;
+
+    ListPopSkipsSmallRanges(&Interface);
+
+    for (Seed = 1; Seed <= Seeds && TestFailures == 0; Seed++)
+        RunSeed(&Interface, Seed, 2000);
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("range_set");
+}
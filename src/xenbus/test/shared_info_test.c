@@ -0,0 +1,987 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the time information that shared_info.c reads from Xen and
+// republishes in a page of its own for XENIFACE to map into user
+// processes. A fake TSC that advances by one on every read, and scaling
+// factors chosen so that one tick is exactly one nanosecond, make every
+// system time computable in advance: a reader racing a simulated
+// hypervisor and the refresh DPC must see the time of its own TSC read,
+// never a value assembled from two different updates, and never time
+// going backwards.
+
+#define _XENBUS_FDO_H       // Keep the real FDO (and everything it pulls in) out
+
+#include <ntddk.h>
+#include <pthread.h>
+
+typedef struct _XENBUS_FDO  XENBUS_FDO, *PXENBUS_FDO;
+
+#include "../src/xenbus/suspend.h"
+#include "../src/xenbus/debug.h"
+#include "../src/xenbus/shared_info.h"
+
+extern NTSTATUS FdoAllocateIoSpace(PXENBUS_FDO, ULONG, PPHYSICAL_ADDRESS);
+extern VOID FdoFreeIoSpace(PXENBUS_FDO, PHYSICAL_ADDRESS, ULONG);
+extern PXENBUS_SUSPEND_CONTEXT FdoGetSuspendContext(PXENBUS_FDO);
+extern PXENBUS_DEBUG_CONTEXT FdoGetDebugContext(PXENBUS_FDO);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+
+#undef  XENBUS_SUSPEND
+#define XENBUS_SUSPEND(_Method, _Interface, ...)    \
+    (_Interface)->_Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_SHARED_INFO
+#define XENBUS_SHARED_INFO(_Method, _Interface, ...)    \
+    (_Interface)->SharedInfo ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+static ULONGLONG    TestTsc;
+
+static ULONGLONG
+TestReadTsc(
+    VOID
+    )
+{
+    return __atomic_fetch_add(&TestTsc, 1, __ATOMIC_SEQ_CST);
+}
+
+#define __rdtsc TestReadTsc
+
+// Lets a test run a step of another party at each barrier shared_info.c
+// passes, so that interleavings a single CPU would rarely produce are
+// reproduced exactly
+static VOID     (*TestBarrierHook)(ULONG);
+static ULONG    TestBarrierCount;
+
+#define TestFence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static VOID
+TestBarrier(
+    VOID
+    )
+{
+    TestFence();
+
+    if (TestBarrierHook != NULL)
+        TestBarrierHook(TestBarrierCount++);
+}
+
+#undef  KeMemoryBarrier
+#define KeMemoryBarrier()   TestBarrier()
+
+#include "../src/xenbus/shared_info.c"
+
+#include "test.h"
+
+// Everything else that shared_info.c calls belongs to paths this test
+// does not drive
+
+#define HOST_NOT_REACHED()                                      \
+        do {                                                    \
+            fprintf(stderr, "%s: not reached\n", __func__);     \
+            abort();                                            \
+        } while (FALSE)
+
+NTSTATUS
+FdoAllocateIoSpace(
+    IN  PXENBUS_FDO         Fdo,
+    IN  ULONG               Size,
+    OUT PPHYSICAL_ADDRESS   Address
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+FdoFreeIoSpace(
+    IN  PXENBUS_FDO         Fdo,
+    IN  PHYSICAL_ADDRESS    Address,
+    IN  ULONG               Size
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_SUSPEND_CONTEXT
+FdoGetSuspendContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PXENBUS_DEBUG_CONTEXT
+FdoGetDebugContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+RtlTimeToTimeFields(
+    IN  PLARGE_INTEGER  Time,
+    OUT PTIME_FIELDS    TimeFields
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+PVOID
+MmMapIoSpace(
+    IN  PHYSICAL_ADDRESS    PhysicalAddress,
+    IN  SIZE_T              NumberOfBytes,
+    IN  MEMORY_CACHING_TYPE CacheType
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+MmUnmapIoSpace(
+    IN  PVOID   BaseAddress,
+    IN  SIZE_T  NumberOfBytes
+    )
+{
+    HOST_NOT_REACHED();
+}
+
+VOID
+LogPrintf(
+    IN  LOG_LEVEL   Level,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+}
+
+// Virtual CPU ids simply follow processor indices
+NTSTATUS
+SystemVirtualCpuIndex(
+    IN  ULONG           Index,
+    OUT unsigned int    *vcpu_id
+    )
+{
+    if (Index >= HostProcessorCount)
+        return STATUS_INVALID_PARAMETER;
+
+    *vcpu_id = Index;
+    return STATUS_SUCCESS;
+}
+
+// The refresh timer only records how it was armed; the tests run the
+// DPC themselves
+
+static ULONG    TestTimerSet;
+static ULONG    TestTimerCancelled;
+
+BOOLEAN
+KeSetTimerEx(
+    IN  PKTIMER         Timer,
+    IN  LARGE_INTEGER   DueTime,
+    IN  LONG            Period,
+    IN  PKDPC           Dpc
+    )
+{
+    Timer->DueTime = DueTime;
+    Timer->Period = Period;
+    Timer->Dpc = Dpc;
+
+    TestTimerSet++;
+    return FALSE;
+}
+
+BOOLEAN
+KeCancelTimer(
+    IN  PKTIMER Timer
+    )
+{
+    Timer->Dpc = NULL;
+
+    TestTimerCancelled++;
+    return TRUE;
+}
+
+// The system time is the TSC less this, whichever update it is read from
+#define TEST_TSC_BASE   0x100000000ull
+
+static XENBUS_SHARED_INFO_CONTEXT   TestContext;
+static XENBUS_SHARED_INFO_INTERFACE TestInterface;
+
+static VOID
+TestSetup(
+    VOID
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT     Context = &TestContext;
+    NTSTATUS                        status;
+
+    RtlZeroMemory(Context, sizeof (XENBUS_SHARED_INFO_CONTEXT));
+
+    Context->Shared = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    RtlZeroMemory(Context->Shared, PAGE_SIZE);
+
+    KeInitializeSpinLock(&Context->Lock);
+    KeInitializeTimer(&Context->TimeTimer);
+    KeInitializeDpc(&Context->TimeDpc, SharedInfoTimeDpc, Context);
+    Context->References = 1;
+
+    status = SharedInfoGetInterface(Context,
+                                    3,
+                                    &TestInterface.Interface,
+                                    sizeof (TestInterface));
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    TestTimerSet = 0;
+    TestTimerCancelled = 0;
+}
+
+static VOID
+TestTeardown(
+    VOID
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT     Context = &TestContext;
+
+    CHECK(Context->TimePage == NULL);
+    CHECK_EQ(Context->TimePageReferences, 0);
+
+    free(Context->Shared);
+    RtlZeroMemory(Context, sizeof (XENBUS_SHARED_INFO_CONTEXT));
+}
+
+// Publish a sample the way Xen does, in two halves
+static VOID
+TestXenUpdateBegin(
+    IN  struct vcpu_time_info   *TimeInfo,
+    IN  CHAR                    TscShift,
+    IN  ULONG                   TscSystemMul
+    )
+{
+    TimeInfo->version++;
+    TestFence();
+
+    TimeInfo->tsc_timestamp = TestReadTsc();
+    TimeInfo->tsc_to_system_mul = TscSystemMul;
+    TimeInfo->tsc_shift = TscShift;
+}
+
+static VOID
+TestXenUpdateEnd(
+    IN  struct vcpu_time_info   *TimeInfo
+    )
+{
+    TimeInfo->system_time = TimeInfo->tsc_timestamp - TEST_TSC_BASE;
+
+    TestFence();
+    TimeInfo->version++;
+}
+
+static VOID
+TestXenUpdate(
+    IN  struct vcpu_time_info   *TimeInfo,
+    IN  CHAR                    TscShift,
+    IN  ULONG                   TscSystemMul
+    )
+{
+    TestXenUpdateBegin(TimeInfo, TscShift, TscSystemMul);
+    TestXenUpdateEnd(TimeInfo);
+}
+
+static VOID
+TestXenUpdateWallClock(
+    IN  shared_info_t   *Shared,
+    IN  ULONG           Seconds
+    )
+{
+    Shared->wc_version++;
+    TestFence();
+
+    Shared->wc_sec = Seconds;
+    Shared->wc_nsec = Seconds % 1000000000;
+
+    TestFence();
+    Shared->wc_version++;
+}
+
+// What a XENIFACE client does with the mapped page
+static ULONGLONG
+TestReadPageTime(
+    IN  PUCHAR                  Page,
+    IN  ULONG                   Offset
+    )
+{
+    volatile struct vcpu_time_info  *TimeInfo;
+    ULONG                           Version;
+    ULONGLONG                       SystemTime;
+    ULONGLONG                       Timestamp;
+    ULONG                           TscSystemMul;
+    CHAR                            TscShift;
+    ULONGLONG                       Tsc;
+
+    TimeInfo = (volatile struct vcpu_time_info *)(Page + Offset);
+
+    do {
+        Version = TimeInfo->version;
+        TestFence();
+
+        SystemTime = TimeInfo->system_time;
+        Timestamp = TimeInfo->tsc_timestamp;
+        TscSystemMul = TimeInfo->tsc_to_system_mul;
+        TscShift = TimeInfo->tsc_shift;
+        Tsc = TestReadTsc();
+
+        TestFence();
+    } while (TimeInfo->version != Version || (Version & 1));
+
+    Tsc -= Timestamp;
+    if (TscShift >= 0)
+        Tsc <<= TscShift;
+    else
+        Tsc >>= -TscShift;
+
+    return SystemTime + ((Tsc * TscSystemMul) >> 32);
+}
+
+static VOID
+TestReadPageWallClock(
+    IN  PUCHAR      Page,
+    IN  ULONG       Offset,
+    OUT PULONG      Seconds,
+    OUT PULONG      NanoSeconds
+    )
+{
+    volatile ULONG  *WallClock = (volatile ULONG *)(Page + Offset);
+    ULONG           Version;
+
+    do {
+        Version = WallClock[0];
+        TestFence();
+
+        *Seconds = WallClock[1];
+        *NanoSeconds = WallClock[2];
+
+        TestFence();
+    } while (WallClock[0] != Version || (Version & 1));
+}
+
+// Each scaling of a known number of ticks, read both from the shared
+// info page and from the copy
+static VOID
+TestScaling(
+    VOID
+    )
+{
+    static const struct {
+        CHAR        TscShift;
+        ULONG       TscSystemMul;
+        ULONGLONG   Ticks;
+        ULONGLONG   Expected;
+    } Case[] = {
+        {  0, 0x80000000u, 1000000, 500000 },
+        {  1, 0x80000000u, 1000000, 1000000 },
+        {  2, 0x40000000u, 1000000, 1000000 },
+        { -1, 0x80000000u, 1000000, 250000 },
+        { -2, 0xc0000000u, 1000000, 187500 },
+        {  0, 0xffffffffu, 1ull << 32, (1ull << 32) - 1 },
+    };
+    PXENBUS_SHARED_INFO_CONTEXT Context = &TestContext;
+    struct vcpu_time_info       *TimeInfo;
+    PVOID                       Page;
+    ULONG                       WallClockOffset;
+    ULONG                       Offset;
+    ULONG                       Index;
+    NTSTATUS                    status;
+
+    TestSetup();
+
+    TimeInfo = &Context->Shared->vcpu_info[1].time;
+
+    status = XENBUS_SHARED_INFO(GetTimePage, &TestInterface, &Page,
+                                &WallClockOffset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = XENBUS_SHARED_INFO(GetTimeInfoOffset, &TestInterface, 1,
+                                &Offset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    for (Index = 0; Index < ARRAYSIZE(Case); Index++) {
+        TimeInfo->version += 2;
+        TimeInfo->tsc_timestamp = 7000000;
+        TimeInfo->system_time = 123456789;
+        TimeInfo->tsc_to_system_mul = Case[Index].TscSystemMul;
+        TimeInfo->tsc_shift = Case[Index].TscShift;
+
+        TestTsc = 7000000 + Case[Index].Ticks;
+        CHECK_EQ(SharedInfoReadSystemTime(Context->Shared, 1),
+                 123456789 + Case[Index].Expected);
+
+        SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+
+        TestTsc = 7000000 + Case[Index].Ticks;
+        CHECK_EQ(TestReadPageTime(Page, Offset),
+                 123456789 + Case[Index].Expected);
+    }
+
+    XENBUS_SHARED_INFO(PutTimePage, &TestInterface);
+
+    TestTeardown();
+}
+
+// The page holds the copy and nothing else, lives as long as it is
+// referenced and is only refreshed while it exists
+static VOID
+TestTimePage(
+    VOID
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT     Context = &TestContext;
+    XENBUS_SHARED_INFO_TIME_PAGE    Expected;
+    PUCHAR                          Page;
+    PVOID                           Other;
+    ULONG                           WallClockOffset;
+    ULONG                           Offset;
+    ULONG                           Index;
+    NTSTATUS                        status;
+
+    TestSetup();
+
+    // Everything Xen puts in the page is non-zero; only the time and the
+    // wallclock may show through
+    memset(Context->Shared, 0xa5, PAGE_SIZE);
+    for (Index = 0; Index < XEN_LEGACY_MAX_VCPUS; Index++) {
+        struct vcpu_time_info   *TimeInfo;
+
+        TimeInfo = &Context->Shared->vcpu_info[Index].time;
+        TimeInfo->version = 2 * Index;
+        TimeInfo->pad0 = 0;
+        RtlZeroMemory(TimeInfo->pad1, sizeof (TimeInfo->pad1));
+    }
+    Context->Shared->wc_version = 4;
+
+    RtlZeroMemory(&Expected, sizeof (Expected));
+    for (Index = 0; Index < XEN_LEGACY_MAX_VCPUS; Index++) {
+        Expected.TimeInfo[Index] = Context->Shared->vcpu_info[Index].time;
+        Expected.TimeInfo[Index].version = 2;
+    }
+    Expected.wc_version = 2;
+    Expected.wc_sec = Context->Shared->wc_sec;
+    Expected.wc_nsec = Context->Shared->wc_nsec;
+
+    status = XENBUS_SHARED_INFO(GetTimePage, &TestInterface, (PVOID *)&Page,
+                                &WallClockOffset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(BYTE_OFFSET(Page), 0);
+    CHECK_EQ(WallClockOffset,
+             FIELD_OFFSET(XENBUS_SHARED_INFO_TIME_PAGE, wc_version));
+
+    CHECK(memcmp(Page, &Expected, sizeof (Expected)) == 0);
+    for (Index = sizeof (Expected); Index < PAGE_SIZE; Index++)
+        CHECK_EQ(Page[Index], 0);
+
+    for (Index = 0; Index < HostProcessorCount; Index++) {
+        status = XENBUS_SHARED_INFO(GetTimeInfoOffset, &TestInterface,
+                                    Index, &Offset);
+        CHECK_EQ(status, STATUS_SUCCESS);
+        CHECK(memcmp(Page + Offset, &Expected.TimeInfo[Index],
+                     sizeof (struct vcpu_time_info)) == 0);
+    }
+
+    status = XENBUS_SHARED_INFO(GetTimeInfoOffset, &TestInterface,
+                                HostProcessorCount, &Offset);
+    CHECK(!NT_SUCCESS(status));
+
+    // The refresh runs every 100ms from the first reference to the last
+    CHECK_EQ(TestTimerSet, 1);
+    CHECK_EQ(Context->TimeTimer.Period, 100);
+    CHECK(Context->TimeTimer.DueTime.QuadPart < 0);
+    CHECK(Context->TimeTimer.Dpc == &Context->TimeDpc);
+
+    status = XENBUS_SHARED_INFO(GetTimePage, &TestInterface, &Other,
+                                &WallClockOffset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK(Other == Page);
+    CHECK_EQ(TestTimerSet, 1);
+
+    // An unchanged sample is not republished
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+    CHECK(memcmp(Page, &Expected, sizeof (Expected)) == 0);
+
+    TestXenUpdate(&Context->Shared->vcpu_info[2].time, 1, 0x80000000u);
+    TestXenUpdateWallClock(Context->Shared, 1700000000);
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+
+    Expected.TimeInfo[2] = Context->Shared->vcpu_info[2].time;
+    Expected.TimeInfo[2].version = 4;
+    Expected.wc_version = 4;
+    Expected.wc_sec = 1700000000;
+    Expected.wc_nsec = 1700000000 % 1000000000;
+    CHECK(memcmp(Page, &Expected, sizeof (Expected)) == 0);
+
+    XENBUS_SHARED_INFO(PutTimePage, &TestInterface);
+    CHECK_EQ(TestTimerCancelled, 0);
+    CHECK(Context->TimePage == (PVOID)Page);
+
+    XENBUS_SHARED_INFO(PutTimePage, &TestInterface);
+    CHECK_EQ(TestTimerCancelled, 1);
+    CHECK(Context->TimePage == NULL);
+
+    // A timer that fired as the page went away finds nothing to do
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+
+    TestTeardown();
+}
+
+// A reader of the copy that is interrupted half way through, between
+// two barriers of the refresh
+typedef struct _TEST_SPLIT_READER {
+    BOOLEAN     Active;
+    ULONG       Version;
+    ULONGLONG   SystemTime;
+    ULONG       WcVersion;
+    ULONG       WcSeconds;
+    ULONG       Accepted;
+    ULONG       Errors;
+} TEST_SPLIT_READER, *PTEST_SPLIT_READER;
+
+static TEST_SPLIT_READER            TestSplit;
+static volatile struct vcpu_time_info *TestSplitTimeInfo;
+static volatile ULONG               *TestSplitWallClock;
+
+static VOID
+TestSplitReaderEnd(
+    VOID
+    )
+{
+    PTEST_SPLIT_READER  Reader = &TestSplit;
+    ULONGLONG           Timestamp;
+    ULONG               TscSystemMul;
+    CHAR                TscShift;
+    ULONGLONG           Now;
+    ULONGLONG           Tsc;
+    ULONG               NanoSeconds;
+
+    if (!Reader->Active)
+        return;
+
+    Reader->Active = FALSE;
+
+    Timestamp = TestSplitTimeInfo->tsc_timestamp;
+    TscSystemMul = TestSplitTimeInfo->tsc_to_system_mul;
+    TscShift = TestSplitTimeInfo->tsc_shift;
+    Now = TestReadTsc();
+    NanoSeconds = TestSplitWallClock[2];
+    TestFence();
+
+    if (TestSplitTimeInfo->version == Reader->Version &&
+        (Reader->Version & 1) == 0) {
+        Tsc = Now - Timestamp;
+        if (TscShift >= 0)
+            Tsc <<= TscShift;
+        else
+            Tsc >>= -TscShift;
+
+        if (Reader->SystemTime + ((Tsc * TscSystemMul) >> 32) !=
+            Now - TEST_TSC_BASE)
+            Reader->Errors++;
+
+        Reader->Accepted++;
+    }
+
+    if (TestSplitWallClock[0] == Reader->WcVersion &&
+        (Reader->WcVersion & 1) == 0) {
+        if (NanoSeconds != Reader->WcSeconds % 1000000000)
+            Reader->Errors++;
+
+        Reader->Accepted++;
+    }
+}
+
+static VOID
+TestSplitReaderBegin(
+    VOID
+    )
+{
+    PTEST_SPLIT_READER  Reader = &TestSplit;
+
+    Reader->Version = TestSplitTimeInfo->version;
+    Reader->WcVersion = TestSplitWallClock[0];
+    TestFence();
+
+    Reader->SystemTime = TestSplitTimeInfo->system_time;
+    Reader->WcSeconds = TestSplitWallClock[1];
+
+    Reader->Active = TRUE;
+}
+
+// At every barrier the pending read completes and another one starts
+static VOID
+TestSplitReaderHook(
+    IN  ULONG   Count
+    )
+{
+    UNREFERENCED_PARAMETER(Count);
+
+    TestSplitReaderEnd();
+    TestSplitReaderBegin();
+}
+
+static struct vcpu_time_info    *TestSplitUpdate;
+
+// Xen updates the time information while it is being read: it starts
+// after the reader has sampled the version and finishes after the reader
+// has read the fields
+static VOID
+TestSplitUpdateHook(
+    IN  ULONG   Count
+    )
+{
+    if (Count == 0)
+        TestXenUpdateBegin(TestSplitUpdate, 2, 0x40000000u);
+    else if (Count == 1)
+        TestXenUpdateEnd(TestSplitUpdate);
+}
+
+static VOID
+TestCountHook(
+    IN  ULONG   Count
+    )
+{
+    UNREFERENCED_PARAMETER(Count);
+}
+
+static ULONG    TestSplitWallClockCount;
+
+// Likewise for the wallclock, whose reads are the last barriers of the
+// refresh when no time information changes
+static VOID
+TestSplitWallClockHook(
+    IN  ULONG       Count
+    )
+{
+    shared_info_t   *Shared = TestContext.Shared;
+
+    if (Count == TestSplitWallClockCount) {
+        Shared->wc_version++;
+        TestFence();
+
+        Shared->wc_sec = 1700000002;
+    } else if (Count == TestSplitWallClockCount + 1) {
+        Shared->wc_nsec = 1700000002 % 1000000000;
+
+        TestFence();
+        Shared->wc_version++;
+    }
+}
+
+static VOID
+TestInterleaving(
+    VOID
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT Context = &TestContext;
+    PUCHAR                      Page;
+    ULONG                       WallClockOffset;
+    ULONG                       Offset;
+    ULONGLONG                   Before;
+    ULONGLONG                   Time;
+    NTSTATUS                    status;
+
+    TestSetup();
+
+    TestTsc = TEST_TSC_BASE;
+    TestXenUpdate(&Context->Shared->vcpu_info[0].time, 1, 0x80000000u);
+    TestXenUpdateWallClock(Context->Shared, 1700000000);
+
+    status = XENBUS_SHARED_INFO(GetTimePage, &TestInterface, (PVOID *)&Page,
+                                &WallClockOffset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = XENBUS_SHARED_INFO(GetTimeInfoOffset, &TestInterface, 0,
+                                &Offset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    // A reader of the copy never accepts a sample that the refresh is
+    // part way through publishing
+    TestSplitTimeInfo = (volatile struct vcpu_time_info *)(Page + Offset);
+    TestSplitWallClock = (volatile ULONG *)(Page + WallClockOffset);
+    RtlZeroMemory(&TestSplit, sizeof (TestSplit));
+
+    TestXenUpdate(&Context->Shared->vcpu_info[0].time, 2, 0x40000000u);
+    TestXenUpdateWallClock(Context->Shared, 1700000001);
+
+    TestBarrierCount = 0;
+    TestBarrierHook = TestSplitReaderHook;
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+    TestBarrierHook = NULL;
+    TestSplitReaderEnd();
+
+    CHECK(TestSplit.Accepted != 0);
+    CHECK_EQ(TestSplit.Errors, 0);
+
+    // The refresh never copies a sample that Xen is part way through
+    TestSplitUpdate = &Context->Shared->vcpu_info[0].time;
+
+    TestBarrierCount = 0;
+    TestBarrierHook = TestSplitUpdateHook;
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+    TestBarrierHook = NULL;
+
+    CHECK_EQ(TestSplitTimeInfo->tsc_timestamp,
+             Context->Shared->vcpu_info[0].time.tsc_timestamp);
+
+    Before = TestTsc - TEST_TSC_BASE;
+    Time = TestReadPageTime(Page, Offset);
+    CHECK_EQ(Time, Before);
+
+    TestBarrierCount = 0;
+    TestBarrierHook = TestCountHook;
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+    TestBarrierHook = NULL;
+
+    TestSplitWallClockCount = TestBarrierCount - 2;
+
+    TestBarrierCount = 0;
+    TestBarrierHook = TestSplitWallClockHook;
+    SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+    TestBarrierHook = NULL;
+
+    CHECK_EQ(TestSplitWallClock[1], 1700000002);
+    CHECK_EQ(TestSplitWallClock[2], 1700000002 % 1000000000);
+
+    // Nor does a reader of the shared info page itself
+    TestBarrierCount = 0;
+    TestBarrierHook = TestSplitUpdateHook;
+    Before = TestTsc - TEST_TSC_BASE;
+    Time = SharedInfoReadSystemTime(Context->Shared, 0);
+    TestBarrierHook = NULL;
+
+    CHECK(Time > Before);
+    CHECK(Time < TestTsc - TEST_TSC_BASE);
+
+    XENBUS_SHARED_INFO(PutTimePage, &TestInterface);
+
+    TestTeardown();
+}
+
+#define READER_COUNT    3
+#define UPDATE_COUNT    200000
+
+typedef struct _TEST_THREAD {
+    pthread_t       Thread;
+    ULONG           Index;
+    PUCHAR          Page;
+    ULONG           WallClockOffset;
+    ULONG           Offset[XEN_LEGACY_MAX_VCPUS];
+    ULONG           Reads;
+    ULONG           Errors;
+} TEST_THREAD, *PTEST_THREAD;
+
+static LONG TestStop;
+
+// Xen updating every vCPU in turn, switching between two scalings that
+// both make a tick one nanosecond
+static PVOID
+TestXen(
+    IN  PVOID   Argument
+    )
+{
+    shared_info_t   *Shared = TestContext.Shared;
+    ULONG           Update;
+
+    UNREFERENCED_PARAMETER(Argument);
+
+    for (Update = 0; Update < UPDATE_COUNT; Update++) {
+        struct vcpu_time_info   *TimeInfo;
+
+        TimeInfo = &Shared->vcpu_info[Update % HostProcessorCount].time;
+
+        if (Update & 1)
+            TestXenUpdate(TimeInfo, 1, 0x80000000u);
+        else
+            TestXenUpdate(TimeInfo, 2, 0x40000000u);
+
+        if (Update % 16 == 0)
+            TestXenUpdateWallClock(Shared, 1700000000 + Update);
+    }
+
+    __atomic_store_n(&TestStop, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static PVOID
+TestRefresh(
+    IN  PVOID                   Argument
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT Context = &TestContext;
+
+    UNREFERENCED_PARAMETER(Argument);
+
+    HostIrql = DISPATCH_LEVEL;
+
+    while (!__atomic_load_n(&TestStop, __ATOMIC_SEQ_CST))
+        SharedInfoTimeDpc(&Context->TimeDpc, Context, NULL, NULL);
+
+    return NULL;
+}
+
+// Every time read must lie between the TSC reads either side of it, so
+// that it can be neither torn nor earlier than the previous one
+static PVOID
+TestReader(
+    IN  PVOID       Argument
+    )
+{
+    PTEST_THREAD    Thread = Argument;
+    ULONGLONG       LastShared = 0;
+    ULONGLONG       LastPage = 0;
+
+    while (!__atomic_load_n(&TestStop, __ATOMIC_SEQ_CST)) {
+        ULONG       vcpu_id = Thread->Reads % HostProcessorCount;
+        ULONGLONG   Before;
+        ULONGLONG   After;
+        ULONGLONG   Time;
+        ULONG       Seconds;
+        ULONG       NanoSeconds;
+
+        Before = TestReadTsc() - TEST_TSC_BASE;
+        Time = SharedInfoReadSystemTime(TestContext.Shared, vcpu_id);
+        After = TestReadTsc() - TEST_TSC_BASE;
+
+        if (Time <= Before || Time >= After || Time <= LastShared)
+            Thread->Errors++;
+        LastShared = Time;
+
+        Before = TestReadTsc() - TEST_TSC_BASE;
+        Time = TestReadPageTime(Thread->Page, Thread->Offset[vcpu_id]);
+        After = TestReadTsc() - TEST_TSC_BASE;
+
+        if (Time <= Before || Time >= After || Time <= LastPage)
+            Thread->Errors++;
+        LastPage = Time;
+
+        TestReadPageWallClock(Thread->Page, Thread->WallClockOffset,
+                              &Seconds, &NanoSeconds);
+        if (NanoSeconds != Seconds % 1000000000)
+            Thread->Errors++;
+
+        Thread->Reads++;
+    }
+
+    return NULL;
+}
+
+static VOID
+TestConcurrent(
+    VOID
+    )
+{
+    PXENBUS_SHARED_INFO_CONTEXT Context = &TestContext;
+    TEST_THREAD                 Thread[READER_COUNT];
+    pthread_t                   Xen;
+    pthread_t                   Refresh;
+    PVOID                       Page;
+    ULONG                       WallClockOffset;
+    ULONG                       Index;
+    ULONG                       vcpu_id;
+    NTSTATUS                    status;
+
+    TestSetup();
+
+    TestTsc = TEST_TSC_BASE;
+    for (vcpu_id = 0; vcpu_id < HostProcessorCount; vcpu_id++)
+        TestXenUpdate(&Context->Shared->vcpu_info[vcpu_id].time, 1,
+                      0x80000000u);
+    TestXenUpdateWallClock(Context->Shared, 1700000000);
+
+    status = XENBUS_SHARED_INFO(GetTimePage, &TestInterface, &Page,
+                                &WallClockOffset);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    TestStop = 0;
+
+    for (Index = 0; Index < READER_COUNT; Index++) {
+        Thread[Index].Index = Index;
+        Thread[Index].Page = Page;
+        Thread[Index].WallClockOffset = WallClockOffset;
+        Thread[Index].Reads = 0;
+        Thread[Index].Errors = 0;
+
+        for (vcpu_id = 0; vcpu_id < HostProcessorCount; vcpu_id++) {
+            status = XENBUS_SHARED_INFO(GetTimeInfoOffset, &TestInterface,
+                                        vcpu_id,
+                                        &Thread[Index].Offset[vcpu_id]);
+            CHECK_EQ(status, STATUS_SUCCESS);
+        }
+
+        (VOID) pthread_create(&Thread[Index].Thread, NULL, TestReader,
+                              &Thread[Index]);
+    }
+
+    (VOID) pthread_create(&Refresh, NULL, TestRefresh, NULL);
+    (VOID) pthread_create(&Xen, NULL, TestXen, NULL);
+
+    (VOID) pthread_join(Xen, NULL);
+    (VOID) pthread_join(Refresh, NULL);
+
+    for (Index = 0; Index < READER_COUNT; Index++) {
+        (VOID) pthread_join(Thread[Index].Thread, NULL);
+        CHECK(Thread[Index].Reads != 0);
+        CHECK_EQ(Thread[Index].Errors, 0);
+    }
+
+    XENBUS_SHARED_INFO(PutTimePage, &TestInterface);
+
+    TestTeardown();
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    UNREFERENCED_PARAMETER(argc);
+    UNREFERENCED_PARAMETER(argv);
+
+    TestScaling();
+    TestTimePage();
+    TestInterleaving();
+    TestConcurrent();
+
+    return TEST_RESULT("shared_info");
+}
@@ -0,0 +1,576 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Test of the resume sequencing in suspend.c. Callbacks of each type
+// are registered, a suspend is triggered against stubbed hypercalls and
+// CPU capture, and the test checks the order in which the callbacks ran
+// and that the concurrent ones were shared out between several threads
+// standing in for the captured vCPUs.
+
+#define _XENBUS_FDO_H   // Keep the real FDO (and everything it pulls in) out
+
+typedef struct _XENBUS_FDO  XENBUS_FDO, *PXENBUS_FDO;
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../src/xenbus/debug.h"
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+extern PXENBUS_DEBUG_CONTEXT FdoGetDebugContext(PXENBUS_FDO);
+
+#include "../src/xenbus/suspend.c"
+
+#undef  XENBUS_SUSPEND
+#define XENBUS_SUSPEND(_Method, _Interface, ...)    \
+    (_Interface)->_Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "test.h"
+
+PXENBUS_DEBUG_CONTEXT
+FdoGetDebugContext(
+    IN  PXENBUS_FDO Fdo
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    return NULL;
+}
+
+static NTSTATUS
+HostDebugAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+HostDebugRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+static NTSTATUS
+HostDebugRegister(
+    IN  PINTERFACE              Interface,
+    IN  PCHAR                   Prefix,
+    IN  XENBUS_DEBUG_FUNCTION   Function,
+    IN  PVOID                   Argument OPTIONAL,
+    OUT PXENBUS_DEBUG_CALLBACK  *Callback
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    UNREFERENCED_PARAMETER(Prefix);
+    UNREFERENCED_PARAMETER(Function);
+    UNREFERENCED_PARAMETER(Argument);
+
+    *Callback = (PXENBUS_DEBUG_CALLBACK)1;
+    return STATUS_SUCCESS;
+}
+
+static VOID
+HostDebugDeregister(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_DEBUG_CALLBACK  Callback
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    UNREFERENCED_PARAMETER(Callback);
+}
+
+NTSTATUS
+DebugGetInterface(
+    IN      PXENBUS_DEBUG_CONTEXT   Context,
+    IN      ULONG                   Version,
+    IN OUT  PINTERFACE              Interface,
+    IN      ULONG                   Size
+    )
+{
+    PXENBUS_DEBUG_INTERFACE         DebugInterface;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    RtlZeroMemory(Interface, Size);
+
+    DebugInterface = (PXENBUS_DEBUG_INTERFACE)Interface;
+    DebugInterface->Interface.Version = (USHORT)Version;
+    DebugInterface->DebugAcquire = HostDebugAcquire;
+    DebugInterface->DebugRelease = HostDebugRelease;
+    DebugInterface->DebugRegister = HostDebugRegister;
+    DebugInterface->DebugDeregister = HostDebugDeregister;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+ModuleLookup(
+    IN  ULONG_PTR   Address,
+    OUT PCHAR       *Name,
+    OUT PULONG_PTR  Offset
+    )
+{
+    UNREFERENCED_PARAMETER(Address);
+
+    *Name = NULL;
+    *Offset = 0;
+}
+
+VOID
+LogPrintf(
+    IN  LOG_LEVEL   Level,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+}
+
+VOID
+HypercallPopulate(
+    VOID
+    )
+{
+}
+
+VOID
+UnplugDevices(
+    VOID
+    )
+{
+}
+
+// The stand-in for the captured vCPUs
+
+#define THREAD_COUNT    4
+
+typedef enum _HOST_SYNC_STATE {
+    HOST_SYNC_RELEASED = 0,
+    HOST_SYNC_CAPTURED,
+    HOST_SYNC_DISABLED,
+    HOST_SYNC_ENABLED
+} HOST_SYNC_STATE;
+
+static HOST_SYNC_STATE  HostSyncState;
+static NTSTATUS         HostShutdownStatus;
+static ULONG            HostSyncRuns;
+
+NTSTATUS
+SchedShutdown(
+    IN  ULONG   Reason
+    )
+{
+    CHECK_EQ(Reason, SHUTDOWN_suspend);
+    CHECK_EQ(HostSyncState, HOST_SYNC_DISABLED);
+
+    return HostShutdownStatus;
+}
+
+VOID
+SyncCapture(
+    VOID
+    )
+{
+    CHECK_EQ(HostSyncState, HOST_SYNC_RELEASED);
+    CHECK_EQ(KeGetCurrentIrql(), DISPATCH_LEVEL);
+    HostSyncState = HOST_SYNC_CAPTURED;
+}
+
+VOID
+SyncDisableInterrupts(
+    VOID
+    )
+{
+    KIRQL   Irql;
+
+    CHECK_EQ(HostSyncState, HOST_SYNC_CAPTURED);
+    HostSyncState = HOST_SYNC_DISABLED;
+
+    KeRaiseIrql(HIGH_LEVEL, &Irql);
+}
+
+VOID
+SyncEnableInterrupts(
+    VOID
+    )
+{
+    CHECK_EQ(HostSyncState, HOST_SYNC_DISABLED);
+    HostSyncState = HOST_SYNC_ENABLED;
+
+    KeLowerIrql(DISPATCH_LEVEL);
+}
+
+VOID
+SyncRelease(
+    VOID
+    )
+{
+    CHECK_EQ(HostSyncState, HOST_SYNC_ENABLED);
+    HostSyncState = HOST_SYNC_RELEASED;
+}
+
+typedef struct _HOST_SYNC_WORKER {
+    pthread_t       Thread;
+    ULONG           Index;
+    SYNC_FUNCTION   Function;
+    PVOID           Argument;
+} HOST_SYNC_WORKER, *PHOST_SYNC_WORKER;
+
+static PVOID
+HostSyncWorker(
+    IN  PVOID           Argument
+    )
+{
+    PHOST_SYNC_WORKER   Worker = Argument;
+
+    HostIrql = DISPATCH_LEVEL;
+    HostProcessorIndex = Worker->Index;
+
+    Worker->Function(Worker->Argument);
+
+    return NULL;
+}
+
+VOID
+SyncRun(
+    IN  SYNC_FUNCTION   Function,
+    IN  PVOID           Argument
+    )
+{
+    HOST_SYNC_WORKER    Worker[THREAD_COUNT - 1];
+    ULONG               Index;
+
+    CHECK_EQ(HostSyncState, HOST_SYNC_ENABLED);
+    CHECK_EQ(KeGetCurrentIrql(), DISPATCH_LEVEL);
+
+    HostSyncRuns++;
+
+    for (Index = 0; Index < THREAD_COUNT - 1; Index++) {
+        Worker[Index].Index = Index + 1;
+        Worker[Index].Function = Function;
+        Worker[Index].Argument = Argument;
+
+        if (pthread_create(&Worker[Index].Thread, NULL, HostSyncWorker,
+                           &Worker[Index]) != 0)
+            abort();
+    }
+
+    Function(Argument);
+
+    for (Index = 0; Index < THREAD_COUNT - 1; Index++)
+        (void) pthread_join(Worker[Index].Thread, NULL);
+}
+
+// The callbacks
+
+#define CALLBACK_COUNT      8
+#define CALLBACK_DELAY_US   20000
+
+typedef struct _HOST_CALLBACK {
+    XENBUS_SUSPEND_CALLBACK_TYPE    Type;
+    PXENBUS_SUSPEND_CALLBACK        Callback;
+    LONG                            Calls;
+    LONG                            Order;
+    ULONG                           Processor;
+    KIRQL                           Irql;
+} HOST_CALLBACK, *PHOST_CALLBACK;
+
+static LONG     HostCallbackOrder;
+static LONG     HostConcurrentActive;
+static LONG     HostConcurrentPeak;
+
+static VOID
+HostCallback(
+    IN  PVOID       Argument
+    )
+{
+    PHOST_CALLBACK  Callback = Argument;
+    LONG            Active;
+
+    InterlockedIncrement(&Callback->Calls);
+    Callback->Order = InterlockedIncrement(&HostCallbackOrder);
+    Callback->Processor = KeGetCurrentProcessorNumberEx(NULL);
+    Callback->Irql = KeGetCurrentIrql();
+
+    if (Callback->Type != SUSPEND_CALLBACK_CONCURRENT)
+        return;
+
+    // Stand in for a frontend waiting on its backend
+    Active = InterlockedIncrement(&HostConcurrentActive);
+    for (;;) {
+        LONG    Peak = HostConcurrentPeak;
+
+        if (Active <= Peak ||
+            InterlockedCompareExchange(&HostConcurrentPeak, Active, Peak) == Peak)
+            break;
+    }
+
+    usleep(CALLBACK_DELAY_US);
+
+    InterlockedDecrement(&HostConcurrentActive);
+}
+
+static VOID
+TestRegister(
+    IN  PXENBUS_SUSPEND_CONTEXT     Context
+    )
+{
+    XENBUS_SUSPEND_INTERFACE        Interface;
+    struct _XENBUS_SUSPEND_INTERFACE_V1 InterfaceV1;
+    PXENBUS_SUSPEND_CALLBACK        Callback;
+    LONG                            Allocations;
+    NTSTATUS                        status;
+
+    CHECK_EQ(SuspendGetInterface(Context, 3, (PINTERFACE)&Interface,
+                                 sizeof (Interface)), STATUS_NOT_SUPPORTED);
+
+    status = SuspendGetInterface(Context, 1, (PINTERFACE)&InterfaceV1,
+                                 sizeof (InterfaceV1));
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(InterfaceV1.Interface.Version, 1);
+
+    status = XENBUS_SUSPEND(Acquire, &InterfaceV1);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    Allocations = HostPoolAllocations;
+
+    // Version 1 callers do not know about concurrent callbacks
+    Callback = (PXENBUS_SUSPEND_CALLBACK)1;
+    status = XENBUS_SUSPEND(Register, &InterfaceV1,
+                            SUSPEND_CALLBACK_CONCURRENT,
+                            HostCallback, NULL, &Callback);
+    CHECK_EQ(status, STATUS_INVALID_PARAMETER);
+    CHECK(Callback == NULL);
+    CHECK_EQ(HostPoolAllocations, Allocations);
+
+    status = SuspendGetInterface(Context, 2, (PINTERFACE)&Interface,
+                                 sizeof (Interface));
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(Interface.Interface.Version, 2);
+
+    Callback = (PXENBUS_SUSPEND_CALLBACK)1;
+    status = XENBUS_SUSPEND(Register, &Interface,
+                            SUSPEND_CALLBACK_TYPE_INVALID,
+                            HostCallback, NULL, &Callback);
+    CHECK_EQ(status, STATUS_INVALID_PARAMETER);
+    CHECK(Callback == NULL);
+    CHECK_EQ(HostPoolAllocations, Allocations);
+
+    status = XENBUS_SUSPEND(Register, &Interface,
+                            SUSPEND_CALLBACK_CONCURRENT,
+                            HostCallback, NULL, &Callback);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    XENBUS_SUSPEND(Deregister, &Interface, Callback);
+
+    CHECK_EQ(HostPoolAllocations, Allocations);
+
+    XENBUS_SUSPEND(Release, &InterfaceV1);
+}
+
+static VOID
+TestTrigger(
+    IN  PXENBUS_SUSPEND_CONTEXT     Context,
+    IN  ULONG                       ConcurrentCount,
+    IN  NTSTATUS                    ShutdownStatus
+    )
+{
+    XENBUS_SUSPEND_INTERFACE        Interface;
+    HOST_CALLBACK                   Callback[3 * CALLBACK_COUNT];
+    ULONG                           Count;
+    ULONG                           Index;
+    LONG                            LastLate;
+    LONG                            FirstConcurrent;
+    ULONG                           Processors;
+    ULONG64                         Start;
+    ULONG64                         Elapsed;
+    NTSTATUS                        status;
+
+    status = SuspendGetInterface(Context, 2, (PINTERFACE)&Interface,
+                                 sizeof (Interface));
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = XENBUS_SUSPEND(Acquire, &Interface);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    RtlZeroMemory(Callback, sizeof (Callback));
+    Count = 0;
+
+    // Interleave the registrations so that list order cannot be
+    // mistaken for type order
+    for (Index = 0; Index < CALLBACK_COUNT; Index++) {
+        Callback[Count++].Type = SUSPEND_CALLBACK_LATE;
+        if (Index < ConcurrentCount)
+            Callback[Count++].Type = SUSPEND_CALLBACK_CONCURRENT;
+        Callback[Count++].Type = SUSPEND_CALLBACK_EARLY;
+    }
+
+    for (Index = 0; Index < Count; Index++) {
+        status = XENBUS_SUSPEND(Register, &Interface,
+                                Callback[Index].Type,
+                                HostCallback,
+                                &Callback[Index],
+                                &Callback[Index].Callback);
+        CHECK_EQ(status, STATUS_SUCCESS);
+    }
+
+    HostCallbackOrder = 0;
+    HostConcurrentActive = 0;
+    HostConcurrentPeak = 0;
+    HostSyncRuns = 0;
+    HostShutdownStatus = ShutdownStatus;
+
+    Start = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    status = XENBUS_SUSPEND(Trigger, &Interface);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    Elapsed = (KeQueryPerformanceCounter(NULL).QuadPart - Start) / 1000;
+
+    CHECK_EQ(HostSyncState, HOST_SYNC_RELEASED);
+    CHECK_EQ(KeGetCurrentIrql(), PASSIVE_LEVEL);
+
+    if (!NT_SUCCESS(ShutdownStatus)) {
+        // Nothing is resumed if the domain did not suspend
+        for (Index = 0; Index < Count; Index++)
+            CHECK_EQ(Callback[Index].Calls, 0);
+
+        CHECK_EQ(HostSyncRuns, 0);
+        goto done;
+    }
+
+    // Every callback runs once: early at HIGH_LEVEL, the rest at
+    // DISPATCH_LEVEL, and early before late before concurrent
+    LastLate = 0;
+    FirstConcurrent = MAXLONG;
+    Processors = 0;
+
+    for (Index = 0; Index < Count; Index++) {
+        PHOST_CALLBACK  This = &Callback[Index];
+
+        CHECK_EQ(This->Calls, 1);
+
+        switch (This->Type) {
+        case SUSPEND_CALLBACK_EARLY:
+            CHECK_EQ(This->Irql, HIGH_LEVEL);
+            CHECK(This->Order <= CALLBACK_COUNT);
+            CHECK_EQ(This->Processor, 0);
+            break;
+
+        case SUSPEND_CALLBACK_LATE:
+            CHECK_EQ(This->Irql, DISPATCH_LEVEL);
+            CHECK(This->Order > CALLBACK_COUNT);
+            CHECK_EQ(This->Processor, 0);
+            LastLate = __max(LastLate, This->Order);
+            break;
+
+        case SUSPEND_CALLBACK_CONCURRENT:
+            CHECK_EQ(This->Irql, DISPATCH_LEVEL);
+            FirstConcurrent = __min(FirstConcurrent, This->Order);
+            Processors |= 1u << This->Processor;
+
+            // The recorded time covers the callback itself
+            CHECK(This->Callback->Time >= CALLBACK_DELAY_US);
+            break;
+
+        default:
+            CHECK(FALSE);
+            break;
+        }
+    }
+
+    CHECK_EQ(LastLate, 2 * CALLBACK_COUNT);
+
+    if (ConcurrentCount == 0) {
+        // Nothing to share out, so the other vCPUs are left alone
+        CHECK_EQ(HostSyncRuns, 0);
+        CHECK(Context->Phase[SUSPEND_PHASE_CONCURRENT] < CALLBACK_DELAY_US);
+        goto done;
+    }
+
+    CHECK_EQ(HostSyncRuns, 1);
+    CHECK(FirstConcurrent > LastLate);
+
+    CHECK(Context->Phase[SUSPEND_PHASE_CONCURRENT] >= CALLBACK_DELAY_US);
+    CHECK(Context->Phase[SUSPEND_PHASE_CONCURRENT] <= Elapsed);
+    CHECK(Context->Downtime <= Elapsed);
+
+    if (ConcurrentCount == 1)
+        goto done;
+
+    // The concurrent callbacks overlapped, on more than one vCPU, and
+    // took less time than they would have done one after another
+    CHECK(HostConcurrentPeak > 1);
+    CHECK(HostConcurrentPeak <= THREAD_COUNT);
+    CHECK(__builtin_popcount(Processors) > 1);
+    CHECK(Elapsed < (ULONG64)ConcurrentCount * CALLBACK_DELAY_US);
+
+done:
+    CHECK(Context->ConcurrentNext == NULL);
+
+    for (Index = 0; Index < Count; Index++)
+        XENBUS_SUSPEND(Deregister, &Interface, Callback[Index].Callback);
+
+    XENBUS_SUSPEND(Release, &Interface);
+}
+
+int
+main(
+    VOID
+    )
+{
+    PXENBUS_SUSPEND_CONTEXT Context;
+    NTSTATUS                status;
+
+    status = SuspendInitialize(NULL, &Context);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    TestRegister(Context);
+
+    TestTrigger(Context, CALLBACK_COUNT, STATUS_SUCCESS);
+    TestTrigger(Context, 1, STATUS_SUCCESS);
+    TestTrigger(Context, 0, STATUS_SUCCESS);
+    TestTrigger(Context, CALLBACK_COUNT, STATUS_UNSUCCESSFUL);
+
+    CHECK_EQ(SuspendGetReferences(Context), 0);
+
+    SuspendTeardown(Context);
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("suspend");
+}
@@ -115,10 +115,8 @@ StreamCsqPeekNextIrp(
     )
 {
     PXENCONS_STREAM Stream;
+    PUCHAR          MajorFunction = PeekContext;
     PLIST_ENTRY     ListEntry;
-    PIRP            NextIrp;
-
-    UNREFERENCED_PARAMETER(PeekContext);
 
     Stream = CONTAINING_RECORD(Csq, XENCONS_STREAM, Csq);
 
@@ -126,12 +124,22 @@ StreamCsqPeekNextIrp(
                 Stream->List.Flink :
                 Irp->Tail.Overlay.ListEntry.Flink;
 
-    if (ListEntry == &Stream->List)
-        return NULL;
+    // If a major function is specified, skip IRPs for the other direction
+    while (ListEntry != &Stream->List) {
+        PIRP                NextIrp;
+        PIO_STACK_LOCATION  StackLocation;
+
+        NextIrp = CONTAINING_RECORD(ListEntry, IRP, Tail.Overlay.ListEntry);
+        StackLocation = IoGetCurrentIrpStackLocation(NextIrp);
 
-    NextIrp = CONTAINING_RECORD(ListEntry, IRP, Tail.Overlay.ListEntry);
+        if (MajorFunction == NULL ||
+            StackLocation->MajorFunction == *MajorFunction)
+            return NextIrp;
 
-    return NextIrp;
+        ListEntry = ListEntry->Flink;
+    }
+
+    return NULL;
 }
 
 #pragma warning(push)
@@ -195,6 +203,61 @@ StreamCsqCompleteCanceledIrp(
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
 }
 
+static BOOLEAN
+StreamProcessIrp(
+    IN  PXENCONS_STREAM     Stream,
+    IN  PIRP                Irp
+    )
+{
+    PIO_STACK_LOCATION      StackLocation;
+    UCHAR                   MajorFunction;
+    PCHAR                   Buffer;
+    ULONG                   Length;
+    ULONG                   Done;
+
+    StackLocation = IoGetCurrentIrpStackLocation(Irp);
+    MajorFunction = StackLocation->MajorFunction;
+
+    Buffer = Irp->AssociatedIrp.SystemBuffer;
+
+    switch (MajorFunction) {
+    case IRP_MJ_READ:
+        Length = StackLocation->Parameters.Read.Length;
+
+        Done = XENBUS_CONSOLE(Read,
+                              &Stream->ConsoleInterface,
+                              Buffer,
+                              Length);
+        break;
+
+    case IRP_MJ_WRITE:
+        Length = StackLocation->Parameters.Write.Length;
+
+        Done = XENBUS_CONSOLE(Write,
+                              &Stream->ConsoleInterface,
+                              Buffer,
+                              Length);
+        break;
+
+    default:
+        ASSERT(FALSE);
+
+        Irp->IoStatus.Information = 0;
+        Irp->IoStatus.Status = STATUS_UNSUCCESSFUL;
+        return TRUE;
+    }
+
+    // Nothing was transferred so the ring is empty (read) or full
+    // (write). Leave the IRP queued until the next ring event.
+    if (Done == 0 && Length != 0)
+        return FALSE;
+
+    Irp->IoStatus.Information = Done;
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+
+    return TRUE;
+}
+
 static NTSTATUS
 StreamWorker(
     IN  PXENCONS_THREAD     Self,
@@ -223,7 +286,9 @@ StreamWorker(
         goto fail2;
 
     for (;;) {
-        PIRP    Irp;
+        static UCHAR    MajorFunctions[] = { IRP_MJ_WRITE, IRP_MJ_READ };
+        LIST_ENTRY      List;
+        ULONG           Index;
 
         (VOID) KeWaitForSingleObject(Event,
                                      Executive,
@@ -235,85 +300,45 @@ StreamWorker(
         if (ThreadIsAlerted(Self))
             break;
 
-        for (Irp = IoCsqRemoveNextIrp(&Stream->Csq, NULL);
-             Irp != NULL;
-             Irp = IoCsqRemoveNextIrp(&Stream->Csq, NULL)) {
-            PIO_STACK_LOCATION  StackLocation;
-            UCHAR               MajorFunction;
-            BOOLEAN             Blocked;
-
-            StackLocation = IoGetCurrentIrpStackLocation(Irp);
-            MajorFunction = StackLocation->MajorFunction;
+        InitializeListHead(&List);
 
-            switch (MajorFunction) {
-            case IRP_MJ_READ:
-                Blocked = !XENBUS_CONSOLE(CanRead,
-                                          &Stream->ConsoleInterface);
-                break;
+        // Drain each direction independently, so a read waiting for
+        // input does not hold up writes queued behind it, and complete
+        // everything that was serviced in one batch.
+        for (Index = 0; Index < ARRAYSIZE(MajorFunctions); Index++) {
+            for (;;) {
+                PIRP    Irp;
 
-            case IRP_MJ_WRITE:
-                Blocked = !XENBUS_CONSOLE(CanWrite,
-                                          &Stream->ConsoleInterface);
-                break;
+                Irp = IoCsqRemoveNextIrp(&Stream->Csq,
+                                         &MajorFunctions[Index]);
+                if (Irp == NULL)
+                    break;
 
-            default:
-                ASSERT(FALSE);
-
-                Blocked = TRUE;
-                break;
-            }
+                if (!StreamProcessIrp(Stream, Irp)) {
+                    status = IoCsqInsertIrpEx(&Stream->Csq,
+                                              Irp,
+                                              NULL,
+                                              (PVOID)TRUE);
+                    ASSERT(NT_SUCCESS(status));
 
-            if (Blocked) {
-                status = IoCsqInsertIrpEx(&Stream->Csq,
-                                          Irp,
-                                          NULL,
-                                          (PVOID)TRUE);
-                ASSERT(NT_SUCCESS(status));
+                    break;
+                }
 
-                break;
+                InsertTailList(&List, &Irp->Tail.Overlay.ListEntry);
             }
+        }
 
-            switch (MajorFunction) {
-            case IRP_MJ_READ: {
-                ULONG   Length;
-                PCHAR   Buffer;
-                ULONG   Read;
-
-                Length = StackLocation->Parameters.Read.Length;
-                Buffer = Irp->AssociatedIrp.SystemBuffer;
-
-                Read = XENBUS_CONSOLE(Read,
-                                      &Stream->ConsoleInterface,
-                                      Buffer,
-                                      Length);
+        while (!IsListEmpty(&List)) {
+            PLIST_ENTRY         ListEntry;
+            PIRP                Irp;
+            PIO_STACK_LOCATION  StackLocation;
+            UCHAR               MajorFunction;
 
-                Irp->IoStatus.Information = Read;
-                Irp->IoStatus.Status = STATUS_SUCCESS;
-                break;
-            }
-            case IRP_MJ_WRITE: {
-                ULONG   Length;
-                PCHAR   Buffer;
-                ULONG   Written;
-
-                Length = StackLocation->Parameters.Write.Length;
-                Buffer = Irp->AssociatedIrp.SystemBuffer;
-
-                Written = XENBUS_CONSOLE(Write,
-                                         &Stream->ConsoleInterface,
-                                         Buffer,
-                                         Length);
-
-                Irp->IoStatus.Information = Written;
-                Irp->IoStatus.Status = STATUS_SUCCESS;
-                break;
-            }
-            default:
-                ASSERT(FALSE);
+            ListEntry = RemoveHeadList(&List);
+            Irp = CONTAINING_RECORD(ListEntry, IRP, Tail.Overlay.ListEntry);
 
-                Irp->IoStatus.Status = STATUS_UNSUCCESSFUL;
-                break;
-            }
+            StackLocation = IoGetCurrentIrpStackLocation(Irp);
+            MajorFunction = StackLocation->MajorFunction;
 
             Trace("COMPLETE (%02x:%s) (%u bytes)\n",
                   MajorFunction,
@@ -131,6 +131,63 @@ typedef LARGE_INTEGER
     IN  PINTERFACE  Interface
     );
 
+/*! \typedef XENBUS_SHARED_INFO_GET_SYSTEM_TIME
+    \brief Return the hypervisor system time, read from the time
+    information of the vCPU the caller is running on
+
+    \param Interface The interface header
+    \return The time since boot (or resume) in nanoseconds
+*/
+typedef ULONGLONG
+(*XENBUS_SHARED_INFO_GET_SYSTEM_TIME)(
+    IN  PINTERFACE  Interface
+    );
+
+/*! \typedef XENBUS_SHARED_INFO_GET_TIME_PAGE
+    \brief Get a reference to a page holding a copy of the hypervisor
+    time information, so that it can be mapped elsewhere
+
+    \param Interface The interface header
+    \param Page Buffer to receive the kernel address of the page
+    \param WallClockOffset Buffer to receive the byte offset of the
+    wallclock version, seconds and nanoseconds fields in the page
+
+    The page holds nothing but the vCPU time information and the wallclock,
+    which are kept up to date until the reference is dropped by
+    XENBUS_SHARED_INFO_PUT_TIME_PAGE. It must only ever be mapped read-only.
+*/
+typedef NTSTATUS
+(*XENBUS_SHARED_INFO_GET_TIME_PAGE)(
+    IN  PINTERFACE  Interface,
+    OUT PVOID       *Page,
+    OUT PULONG      WallClockOffset
+    );
+
+/*! \typedef XENBUS_SHARED_INFO_PUT_TIME_PAGE
+    \brief Drop a reference obtained by XENBUS_SHARED_INFO_GET_TIME_PAGE
+
+    \param Interface The interface header
+*/
+typedef VOID
+(*XENBUS_SHARED_INFO_PUT_TIME_PAGE)(
+    IN  PINTERFACE  Interface
+    );
+
+/*! \typedef XENBUS_SHARED_INFO_GET_TIME_INFO_OFFSET
+    \brief Get the byte offset of a processor's vcpu_time_info within
+    the page returned by XENBUS_SHARED_INFO_GET_TIME_PAGE
+
+    \param Interface The interface header
+    \param Index The system processor index
+    \param Offset Buffer to receive the offset
+*/
+typedef NTSTATUS
+(*XENBUS_SHARED_INFO_GET_TIME_INFO_OFFSET)(
+    IN  PINTERFACE  Interface,
+    IN  ULONG       Index,
+    OUT PULONG      Offset
+    );
+
 // {7E73C34F-1640-4649-A8F3-263BC930A004}
 DEFINE_GUID(GUID_XENBUS_SHARED_INFO_INTERFACE, 
 0x7e73c34f, 0x1640, 0x4649, 0xa8, 0xf3, 0x26, 0x3b, 0xc9, 0x30, 0xa0, 0x4);
@@ -166,7 +223,27 @@ struct _XENBUS_SHARED_INFO_INTERFACE_V2 {
     XENBUS_SHARED_INFO_GET_TIME         SharedInfoGetTime;
 };
 
-typedef struct _XENBUS_SHARED_INFO_INTERFACE_V2 XENBUS_SHARED_INFO_INTERFACE, *PXENBUS_SHARED_INFO_INTERFACE;
+/*! \struct _XENBUS_SHARED_INFO_INTERFACE_V3
+    \brief SHARED_INFO interface version 3
+    \ingroup interfaces
+*/
+struct _XENBUS_SHARED_INFO_INTERFACE_V3 {
+    INTERFACE                               Interface;
+    XENBUS_SHARED_INFO_ACQUIRE              SharedInfoAcquire;
+    XENBUS_SHARED_INFO_RELEASE              SharedInfoRelease;
+    XENBUS_SHARED_INFO_UPCALL_PENDING       SharedInfoUpcallPending;
+    XENBUS_SHARED_INFO_EVTCHN_POLL          SharedInfoEvtchnPoll;
+    XENBUS_SHARED_INFO_EVTCHN_ACK           SharedInfoEvtchnAck;
+    XENBUS_SHARED_INFO_EVTCHN_MASK          SharedInfoEvtchnMask;
+    XENBUS_SHARED_INFO_EVTCHN_UNMASK        SharedInfoEvtchnUnmask;
+    XENBUS_SHARED_INFO_GET_TIME             SharedInfoGetTime;
+    XENBUS_SHARED_INFO_GET_SYSTEM_TIME      SharedInfoGetSystemTime;
+    XENBUS_SHARED_INFO_GET_TIME_PAGE        SharedInfoGetTimePage;
+    XENBUS_SHARED_INFO_PUT_TIME_PAGE        SharedInfoPutTimePage;
+    XENBUS_SHARED_INFO_GET_TIME_INFO_OFFSET SharedInfoGetTimeInfoOffset;
+};
+
+typedef struct _XENBUS_SHARED_INFO_INTERFACE_V3 XENBUS_SHARED_INFO_INTERFACE, *PXENBUS_SHARED_INFO_INTERFACE;
 
 /*! \def XENBUS_SHARED_INFO
     \brief Macro at assist in method invocation
@@ -177,6 +254,6 @@ typedef struct _XENBUS_SHARED_INFO_INTERFACE_V2 XENBUS_SHARED_INFO_INTERFACE, *P
 #endif  // _WINDLL
 
 #define XENBUS_SHARED_INFO_INTERFACE_VERSION_MIN    1
-#define XENBUS_SHARED_INFO_INTERFACE_VERSION_MAX    2
+#define XENBUS_SHARED_INFO_INTERFACE_VERSION_MAX    3
 
 #endif  // _XENBUS_SHARED_INFO_H
@@ -163,7 +163,9 @@ typedef struct _XENIFACE_EVTCHN_BIND_INTERDOMAIN_IN {
     USHORT  RemoteDomain; /*!< Remote domain that has already bound the channel */
     ULONG   RemotePort;   /*!< Port number that is assigned to the event channel in the RemoteDomain */
     BOOLEAN Mask;         /*!< Set to TRUE if the event channel should be initially masked */
-    HANDLE  Event;        /*!< Handle to an event object that will receive event channel notifications */
+    HANDLE  Event;        /*!< Handle to an event object that will receive event channel notifications,
+                               or NULL to deliver notifications through the ring mapped by
+                               IOCTL_XENIFACE_EVTCHN_RING_MAP */
 } XENIFACE_EVTCHN_BIND_INTERDOMAIN_IN, *PXENIFACE_EVTCHN_BIND_INTERDOMAIN_IN;
 
 /*! \brief Output for IOCTL_XENIFACE_EVTCHN_BIND_INTERDOMAIN */
@@ -184,7 +186,9 @@ typedef struct _XENIFACE_EVTCHN_BIND_INTERDOMAIN_OUT {
 typedef struct _XENIFACE_EVTCHN_BIND_UNBOUND_IN {
     USHORT  RemoteDomain; /*!< Remote domain that will bind the channel */
     BOOLEAN Mask;         /*!< Set to TRUE if the event channel should be initially masked */
-    HANDLE  Event;        /*!< Handle to an event object that will receive event channel notifications */
+    HANDLE  Event;        /*!< Handle to an event object that will receive event channel notifications,
+                               or NULL to deliver notifications through the ring mapped by
+                               IOCTL_XENIFACE_EVTCHN_RING_MAP */
 } XENIFACE_EVTCHN_BIND_UNBOUND_IN, *PXENIFACE_EVTCHN_BIND_UNBOUND_IN;
 
 /*! \brief Output for IOCTL_XENIFACE_EVTCHN_BIND_UNBOUND */
@@ -234,6 +238,56 @@ typedef struct _XENIFACE_EVTCHN_UNMASK_IN {
     ULONG LocalPort; /*!< Local port number that is assigned to the event channel */
 } XENIFACE_EVTCHN_UNMASK_IN, *PXENIFACE_EVTCHN_UNMASK_IN;
 
+/*! \brief Event channel notification ring shared with user mode
+
+    The driver writes the local port number of each channel that fires
+    into Ports[Producer % Size] and then advances Producer. The consumer
+    reads entries up to Producer and then advances Consumer. Both indices
+    are free-running.
+
+    The ring event is only signalled when the driver adds to an empty
+    ring, so a consumer must write Consumer and then re-check Producer
+    before waiting on the event again.
+
+    If the ring is full the port is dropped and Overflow is set. The
+    consumer should then clear Overflow and poll all of its ring-bound
+    channels.
+*/
+typedef struct _XENIFACE_EVTCHN_RING {
+    volatile ULONG Producer; /*!< Index of the next entry to be written by the driver */
+    volatile ULONG Consumer; /*!< Index of the next entry to be read by the consumer */
+    volatile ULONG Overflow; /*!< Non-zero if notifications have been dropped */
+    ULONG          Size;     /*!< Number of entries in Ports (always a power of 2) */
+    ULONG          Ports[1]; /*!< Local port numbers of channels that have fired */
+} XENIFACE_EVTCHN_RING, *PXENIFACE_EVTCHN_RING;
+
+/*! \brief Maximum number of pages in an event channel notification ring */
+#define XENIFACE_EVTCHN_RING_MAX_PAGES  16
+
+/*! \brief Map an event channel notification ring into the calling process
+
+    Only one ring may be mapped per handle. It stays mapped until the
+    handle is closed. Channels subsequently bound on the same handle
+    with a NULL Event deliver notifications through the ring.
+
+    Input: XENIFACE_EVTCHN_RING_MAP_IN
+
+    Output: XENIFACE_EVTCHN_RING_MAP_OUT
+*/
+#define IOCTL_XENIFACE_EVTCHN_RING_MAP \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x815, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+/*! \brief Input for IOCTL_XENIFACE_EVTCHN_RING_MAP */
+typedef struct _XENIFACE_EVTCHN_RING_MAP_IN {
+    ULONG  NumberPages; /*!< Number of pages in the ring (at most XENIFACE_EVTCHN_RING_MAX_PAGES) */
+    HANDLE Event;       /*!< Handle to an event object that is signalled when the ring becomes non-empty */
+} XENIFACE_EVTCHN_RING_MAP_IN, *PXENIFACE_EVTCHN_RING_MAP_IN;
+
+/*! \brief Output for IOCTL_XENIFACE_EVTCHN_RING_MAP */
+typedef struct _XENIFACE_EVTCHN_RING_MAP_OUT {
+    PXENIFACE_EVTCHN_RING Ring; /*!< User-mode address of the ring */
+} XENIFACE_EVTCHN_RING_MAP_OUT, *PXENIFACE_EVTCHN_RING_MAP_OUT;
+
 /*! \brief Bitmask of XenStore key permissions */
 typedef enum _XENIFACE_GNTTAB_PAGE_FLAGS {
     XENIFACE_GNTTAB_READONLY          = 1 << 0, /*!< If set, the granted/mapped pages are read-only */
@@ -323,6 +377,99 @@ typedef struct _XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN {
     ULONG RequestId; /*! Request ID used in the corresponding IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES call */
 } XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN, *PXENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN;
 
+/*! \brief Maximum number of regions in a single batched grant/map IOCTL */
+#define XENIFACE_GNTTAB_BATCH_MAX_ENTRIES 4096
+
+/*! \brief Description of one region in a batched grant/map IOCTL */
+typedef struct _XENIFACE_GNTTAB_BATCH_ENTRY {
+    ULONG                      RequestId;    /*!< A unique (for the handle) number identifying the region */
+    USHORT                     RemoteDomain; /*!< Remote domain that is being granted access, or that has granted access */
+    ULONG                      NumberPages;  /*!< Number of 4k pages in the region */
+    XENIFACE_GNTTAB_PAGE_FLAGS Flags;        /*!< Additional flags */
+    ULONG                      NotifyOffset; /*!< Offset of a byte in the region that will be set to 0 when the region is released */
+    ULONG                      NotifyPort;   /*!< Local port number of an open event channel that will be notified when the region is released */
+} XENIFACE_GNTTAB_BATCH_ENTRY, *PXENIFACE_GNTTAB_BATCH_ENTRY;
+
+/*! \brief Input for IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_BATCH and IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_BATCH
+
+    For IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_BATCH the entries are followed by
+    an array of ULONG grant references: NumberPages references for each entry, in
+    entry order.
+*/
+typedef struct _XENIFACE_GNTTAB_BATCH_IN {
+    ULONG                       NumberEntries;            /*!< Number of regions */
+    XENIFACE_GNTTAB_BATCH_ENTRY Entries[ANYSIZE_ARRAY];   /*!< Region descriptions */
+} XENIFACE_GNTTAB_BATCH_IN, *PXENIFACE_GNTTAB_BATCH_IN;
+
+/*! \brief Per-region result of a batched grant/map IOCTL */
+typedef struct _XENIFACE_GNTTAB_BATCH_RESULT {
+    LONG  Status;  /*!< NTSTATUS of the operation on this region */
+    PVOID Address; /*!< User-mode address of the region, NULL if Status is a failure */
+} XENIFACE_GNTTAB_BATCH_RESULT, *PXENIFACE_GNTTAB_BATCH_RESULT;
+
+/*! \brief Output for IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_BATCH and IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_BATCH
+
+    For IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_BATCH the results are followed by
+    an array of ULONG grant references: NumberPages references for each entry, in
+    entry order. References of a failed entry are set to 0.
+*/
+typedef struct _XENIFACE_GNTTAB_BATCH_OUT {
+    XENIFACE_GNTTAB_BATCH_RESULT Results[ANYSIZE_ARRAY]; /*!< One result for each input entry */
+} XENIFACE_GNTTAB_BATCH_OUT, *PXENIFACE_GNTTAB_BATCH_OUT;
+
+/*! \brief Input for IOCTL_XENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_BATCH and IOCTL_XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_BATCH
+
+    Output: an array of NumberEntries LONG values, the NTSTATUS of releasing each region.
+*/
+typedef struct _XENIFACE_GNTTAB_RELEASE_BATCH_IN {
+    ULONG NumberEntries;                /*!< Number of regions */
+    ULONG RequestIds[ANYSIZE_ARRAY];    /*!< Request IDs used when the regions were set up */
+} XENIFACE_GNTTAB_RELEASE_BATCH_IN, *PXENIFACE_GNTTAB_RELEASE_BATCH_IN;
+
+/*! \brief Grant permission to access many local memory regions to foreign domains
+    \note Unlike IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS this IOCTL completes
+           immediately. The regions stay granted (and mapped into the calling process)
+           until they are revoked with IOCTL_XENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_BATCH
+           or the handle is closed. Request IDs only need to be unique per handle.
+
+    Input: XENIFACE_GNTTAB_BATCH_IN
+
+    Output: XENIFACE_GNTTAB_BATCH_OUT
+*/
+#define IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_BATCH \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x824, METHOD_NEITHER, FILE_ANY_ACCESS)
+
+/*! \brief Revoke foreign access to regions granted by IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_BATCH
+
+    Input: XENIFACE_GNTTAB_RELEASE_BATCH_IN
+
+    Output: LONG[NumberEntries]
+*/
+#define IOCTL_XENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_BATCH \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x825, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+/*! \brief Map many foreign memory regions into the current address space
+    \note Unlike IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES this IOCTL completes
+           immediately. The regions stay mapped until they are unmapped with
+           IOCTL_XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_BATCH or the handle is closed.
+           Request IDs only need to be unique per handle.
+
+    Input: XENIFACE_GNTTAB_BATCH_IN
+
+    Output: XENIFACE_GNTTAB_BATCH_OUT
+*/
+#define IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_BATCH \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x826, METHOD_NEITHER, FILE_ANY_ACCESS)
+
+/*! \brief Unmap regions mapped by IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_BATCH
+
+    Input: XENIFACE_GNTTAB_RELEASE_BATCH_IN
+
+    Output: LONG[NumberEntries]
+*/
+#define IOCTL_XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_BATCH \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x827, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 /*! \brief Gets the current suspend count.
 
     Input: None
@@ -369,6 +516,74 @@ typedef struct _XENIFACE_SUSPEND_REGISTER_OUT {
 #define IOCTL_XENIFACE_SHAREDINFO_GET_TIME \
     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x840, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+/*! \brief Layout of the per-processor time information in the page mapped
+    by IOCTL_XENIFACE_SHAREDINFO_MAP_TIME (mirrors Xen's vcpu_time_info)
+
+    To read the time since boot in nanoseconds:
+    1. Read Version; retry if it is odd.
+    2. Read the remaining fields and the TSC.
+    3. Retry if Version has changed.
+    4. Scale (TSC - TscTimestamp) by TscShift (left if positive, right
+       if negative), multiply by TscToSystemMul, shift right by 32 and
+       add SystemTime.
+*/
+typedef struct _XENIFACE_VCPU_TIME_INFO {
+    ULONG     Version;         /*!< Odd while an update is in progress */
+    ULONG     Pad0;
+    ULONGLONG TscTimestamp;    /*!< TSC at the last update */
+    ULONGLONG SystemTime;      /*!< Nanoseconds since boot at the last update */
+    ULONG     TscToSystemMul;  /*!< 32.32 fixed point TSC to nanoseconds multiplier */
+    CHAR      TscShift;        /*!< Shift applied to the TSC delta before multiplying */
+    UCHAR     Flags;           /*!< XENIFACE_VCPU_TIME_TSC_STABLE if the TSC is stable across processors */
+    UCHAR     Pad1[2];
+} XENIFACE_VCPU_TIME_INFO, *PXENIFACE_VCPU_TIME_INFO;
+
+/*! \brief XENIFACE_VCPU_TIME_INFO Flags bit set when the TSC is stable
+    across processors
+*/
+#define XENIFACE_VCPU_TIME_TSC_STABLE   0x01
+
+/*! \brief Layout of the wallclock in the page mapped by
+    IOCTL_XENIFACE_SHAREDINFO_MAP_TIME
+
+    Seconds and NanoSeconds give the UTC time (since the Unix epoch) at
+    which SystemTime was zero. Version is odd while an update is in progress.
+*/
+typedef struct _XENIFACE_WALLCLOCK {
+    ULONG     Version;
+    ULONG     Seconds;
+    ULONG     NanoSeconds;
+} XENIFACE_WALLCLOCK, *PXENIFACE_WALLCLOCK;
+
+/*! \brief Maps the hypervisor time information read-only into the calling
+    process
+
+    Input: None
+
+    Output: XENIFACE_SHAREDINFO_MAP_TIME_OUT, with room for one
+            TimeInfoOffset per active processor in all groups (see
+            GetActiveProcessorCount(ALL_PROCESSOR_GROUPS))
+
+    The page holds nothing but the time information and the wallclock.
+    It is a copy that XENBUS refreshes every 100ms, following the same
+    version protocol as Xen's own shared info page.
+
+    Only one mapping may exist per handle. It is valid until the handle is
+    closed and survives suspend/resume; SystemTime restarts from zero after
+    a migration, so wallclock time should always be computed from both.
+*/
+#define IOCTL_XENIFACE_SHAREDINFO_MAP_TIME \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x841, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+/*! \brief Output for IOCTL_XENIFACE_SHAREDINFO_MAP_TIME */
+typedef struct _XENIFACE_SHAREDINFO_MAP_TIME_OUT {
+    PVOID Page;                             /*!< User-mode address of the read-only page */
+    ULONG WallClockOffset;                  /*!< Byte offset of the XENIFACE_WALLCLOCK in the page */
+    ULONG NumberProcessors;                 /*!< Number of entries in TimeInfoOffset */
+    ULONG TimeInfoOffset[ANYSIZE_ARRAY];    /*!< Byte offset of each processor's XENIFACE_VCPU_TIME_INFO,
+                                                 indexed by system processor number */
+} XENIFACE_SHAREDINFO_MAP_TIME_OUT, *PXENIFACE_SHAREDINFO_MAP_TIME_OUT;
+
 /*! \brief Logs a message to Dom0
 
     Input: NUL-terminated CHAR array containing the message to log
@@ -2468,6 +2468,7 @@ FdoCreate(
     PXENIFACE_FDO       Fdo;
     WCHAR               Name[MAXNAMELEN * sizeof (WCHAR)];
     ULONG               Size;
+    ULONG               Index;
     NTSTATUS            status;
 
 #pragma prefast(suppress:28197) // Possibly leaking memory 'FunctionDeviceObject'
@@ -2598,15 +2599,23 @@ FdoCreate(
 
     KeInitializeSpinLock(&Fdo->EvtchnLock);
     InitializeListHead(&Fdo->EvtchnList);
+    InitializeListHead(&Fdo->EvtchnRingList);
 
     KeInitializeSpinLock(&Fdo->SuspendLock);
     InitializeListHead(&Fdo->SuspendList);
 
+    KeInitializeSpinLock(&Fdo->SharedInfoLock);
+    InitializeListHead(&Fdo->SharedInfoTimeList);
+
     KeInitializeSpinLock(&Fdo->IrpQueueLock);
     InitializeListHead(&Fdo->IrpList);
 
     KeInitializeSpinLock(&Fdo->GnttabCacheLock);
 
+    KeInitializeSpinLock(&Fdo->GnttabRegionLock);
+    for (Index = 0; Index < XENIFACE_GNTTAB_BUCKET_COUNT; Index++)
+        InitializeListHead(&Fdo->GnttabRegionList[Index]);
+
     status = IoCsqInitializeEx(&Fdo->IrpQueue,
                                CsqInsertIrpEx,
                                CsqRemoveIrp,
@@ -2629,15 +2638,27 @@ FdoCreate(
 fail15:
     Error("fail15\n");
 
+    for (Index = 0; Index < XENIFACE_GNTTAB_BUCKET_COUNT; Index++)
+        ASSERT(IsListEmpty(&Fdo->GnttabRegionList[Index]));
+    RtlZeroMemory(Fdo->GnttabRegionList, sizeof (Fdo->GnttabRegionList));
+    RtlZeroMemory(&Fdo->GnttabRegionLock, sizeof (KSPIN_LOCK));
+
     RtlZeroMemory(&Fdo->GnttabCacheLock, sizeof (KSPIN_LOCK));
     ASSERT(IsListEmpty(&Fdo->IrpList));
     RtlZeroMemory(&Fdo->IrpList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Fdo->IrpQueueLock, sizeof (KSPIN_LOCK));
 
+    ASSERT(IsListEmpty(&Fdo->SharedInfoTimeList));
+    RtlZeroMemory(&Fdo->SharedInfoTimeList, sizeof (LIST_ENTRY));
+    RtlZeroMemory(&Fdo->SharedInfoLock, sizeof (KSPIN_LOCK));
+
     ASSERT(IsListEmpty(&Fdo->SuspendList));
     RtlZeroMemory(&Fdo->SuspendList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Fdo->SuspendLock, sizeof (KSPIN_LOCK));
 
+    ASSERT(IsListEmpty(&Fdo->EvtchnRingList));
+    RtlZeroMemory(&Fdo->EvtchnRingList, sizeof (LIST_ENTRY));
+    ASSERT(IsZeroMemory(Fdo->EvtchnTable, sizeof (Fdo->EvtchnTable)));
     ASSERT(IsListEmpty(&Fdo->EvtchnList));
     RtlZeroMemory(&Fdo->EvtchnList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Fdo->EvtchnLock, sizeof (KSPIN_LOCK));
@@ -2741,6 +2762,7 @@ FdoDestroy(
 {
     PXENIFACE_DX          Dx = Fdo->Dx;
     PDEVICE_OBJECT        FunctionDeviceObject = Dx->DeviceObject;
+    ULONG                 Index;
 
     ASSERT(IsListEmpty(&Dx->ListEntry));
     ASSERT3U(Fdo->References, ==, 0);
@@ -2754,16 +2776,28 @@ FdoDestroy(
 
     Dx->Fdo = NULL;
 
+    for (Index = 0; Index < XENIFACE_GNTTAB_BUCKET_COUNT; Index++)
+        ASSERT(IsListEmpty(&Fdo->GnttabRegionList[Index]));
+    RtlZeroMemory(Fdo->GnttabRegionList, sizeof (Fdo->GnttabRegionList));
+    RtlZeroMemory(&Fdo->GnttabRegionLock, sizeof (KSPIN_LOCK));
+
     RtlZeroMemory(&Fdo->GnttabCacheLock, sizeof (KSPIN_LOCK));
     ASSERT(IsListEmpty(&Fdo->IrpList));
     RtlZeroMemory(&Fdo->IrpList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Fdo->IrpQueueLock, sizeof (KSPIN_LOCK));
     RtlZeroMemory(&Fdo->IrpQueue, sizeof (IO_CSQ));
 
+    ASSERT(IsListEmpty(&Fdo->SharedInfoTimeList));
+    RtlZeroMemory(&Fdo->SharedInfoTimeList, sizeof (LIST_ENTRY));
+    RtlZeroMemory(&Fdo->SharedInfoLock, sizeof (KSPIN_LOCK));
+
     ASSERT(IsListEmpty(&Fdo->SuspendList));
     RtlZeroMemory(&Fdo->SuspendList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Fdo->SuspendLock, sizeof (KSPIN_LOCK));
 
+    ASSERT(IsListEmpty(&Fdo->EvtchnRingList));
+    RtlZeroMemory(&Fdo->EvtchnRingList, sizeof (LIST_ENTRY));
+    ASSERT(IsZeroMemory(Fdo->EvtchnTable, sizeof (Fdo->EvtchnTable)));
     ASSERT(IsListEmpty(&Fdo->EvtchnList));
     RtlZeroMemory(&Fdo->EvtchnList, sizeof (LIST_ENTRY));
     RtlZeroMemory(&Fdo->EvtchnLock, sizeof (KSPIN_LOCK));
@@ -57,6 +57,14 @@ typedef struct _FDO_RESOURCE {
 } FDO_RESOURCE, *PFDO_RESOURCE;
 
 
+// Event channel contexts are indexed by local port in a two-level table
+#define XENIFACE_EVTCHN_MAX_PORT        (1 << 17)
+#define XENIFACE_EVTCHN_LEAF_SIZE       (PAGE_SIZE / sizeof (PVOID))
+#define XENIFACE_EVTCHN_TABLE_SIZE      (XENIFACE_EVTCHN_MAX_PORT / XENIFACE_EVTCHN_LEAF_SIZE)
+
+// Persistent grant/map regions are hashed by request ID
+#define XENIFACE_GNTTAB_BUCKET_COUNT    256
+
 typedef struct _XENIFACE_FDO {
     struct _XENIFACE_DX             *Dx;
     PDEVICE_OBJECT                  LowerDeviceObject;
@@ -89,12 +97,20 @@ typedef struct _XENIFACE_FDO {
 
     KSPIN_LOCK                      EvtchnLock;
     LIST_ENTRY                      EvtchnList;
+    struct _XENIFACE_EVTCHN_CONTEXT **EvtchnTable[XENIFACE_EVTCHN_TABLE_SIZE];
+    LIST_ENTRY                      EvtchnRingList;
 
     KSPIN_LOCK                      SuspendLock;
     LIST_ENTRY                      SuspendList;
 
+    KSPIN_LOCK                      SharedInfoLock;
+    LIST_ENTRY                      SharedInfoTimeList;
+
     KSPIN_LOCK                      GnttabCacheLock;
 
+    KSPIN_LOCK                      GnttabRegionLock;
+    LIST_ENTRY                      GnttabRegionList[XENIFACE_GNTTAB_BUCKET_COUNT];
+
     IO_CSQ                          IrpQueue;
     KSPIN_LOCK                      IrpQueueLock;
     LIST_ENTRY                      IrpList;
@@ -35,6 +35,7 @@
 #include "ioctls.h"
 #include "xeniface_ioctls.h"
 #include "log.h"
+#include "assert.h"
 
 _Function_class_(KDEFERRED_ROUTINE)
 _IRQL_requires_(DISPATCH_LEVEL)
@@ -63,6 +64,79 @@ EvtchnNotificationDpc(
                   FALSE);
 }
 
+_Function_class_(KDEFERRED_ROUTINE)
+_IRQL_requires_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+static
+VOID
+EvtchnRingDpc(
+    __in      PKDPC Dpc,
+    __in_opt  PVOID _Context,
+    __in_opt  PVOID Argument1,
+    __in_opt  PVOID Argument2
+    )
+{
+    PXENIFACE_EVTCHN_RING_CONTEXT Ring = _Context;
+    PXENIFACE_EVTCHN_RING Shared;
+    PSLIST_ENTRY ListEntry;
+    BOOLEAN Signal;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(Argument1);
+    UNREFERENCED_PARAMETER(Argument2);
+
+    ASSERT(Ring != NULL);
+
+    ListEntry = InterlockedFlushSList(&Ring->PendingList);
+    if (ListEntry == NULL)
+        return;
+
+    Shared = Ring->Shared;
+    Signal = FALSE;
+
+    // The DPC may be running on more than one CPU
+    KeAcquireSpinLockAtDpcLevel(&Ring->Lock);
+
+    while (ListEntry != NULL) {
+        PXENIFACE_EVTCHN_CONTEXT Context;
+        ULONG Producer;
+
+        Context = CONTAINING_RECORD(ListEntry, XENIFACE_EVTCHN_CONTEXT, PendingEntry);
+        ListEntry = ListEntry->Next;
+
+        (VOID) InterlockedExchange(&Context->Pending, 0);
+
+        // Size and Producer are taken from our own copies: everything
+        // in the shared page is writable by user mode.
+        Producer = Ring->Producer;
+
+        if (Producer - Shared->Consumer >= Ring->Size) {
+            Shared->Overflow = 1;
+            Signal = TRUE;
+        } else {
+            Shared->Ports[Producer & (Ring->Size - 1)] = Context->LocalPort;
+            KeMemoryBarrier();
+
+            Ring->Producer = Shared->Producer = Producer + 1;
+            KeMemoryBarrier();
+
+            // Only wake the consumer if the ring was empty
+            if (Shared->Consumer == Producer)
+                Signal = TRUE;
+        }
+
+        XENBUS_EVTCHN(Unmask,
+                      &Ring->Fdo->EvtchnInterface,
+                      Context->Channel,
+                      FALSE);
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&Ring->Lock);
+
+    if (Signal)
+        KeSetEvent(Ring->Event, 0, FALSE);
+}
+
 _Function_class_(KSERVICE_ROUTINE)
 _IRQL_requires_(HIGH_LEVEL)
 _IRQL_requires_same_
@@ -74,17 +148,22 @@ EvtchnInterruptHandler(
     )
 {
     PXENIFACE_EVTCHN_CONTEXT Context = Argument;
-    PROCESSOR_NUMBER ProcNumber;
-    ULONG ProcIndex;
+    PXENIFACE_EVTCHN_RING_CONTEXT Ring;
 
     UNREFERENCED_PARAMETER(Interrupt);
 
     ASSERT(Context != NULL);
 
-    KeGetCurrentProcessorNumberEx(&ProcNumber);
-    ProcIndex = KeGetProcessorIndexFromNumber(&ProcNumber);
+    Ring = Context->Ring;
+    if (Ring == NULL) {
+        (VOID) KeInsertQueueDpc(&Context->Dpc, NULL, NULL);
+        return TRUE;
+    }
+
+    if (InterlockedExchange(&Context->Pending, 1) == 0)
+        InterlockedPushEntrySList(&Ring->PendingList, &Context->PendingEntry);
 
-    (VOID) KeInsertQueueDpc(&Context->Dpc, NULL, NULL);
+    (VOID) KeInsertQueueDpc(&Ring->Dpc, NULL, NULL);
 
     return TRUE;
 }
@@ -109,7 +188,9 @@ EvtchnFree(
     // Wait for our DPCs to complete.
     KeFlushQueuedDpcs();
 
-    ObDereferenceObject(Context->Event);
+    if (Context->Event != NULL)
+        ObDereferenceObject(Context->Event);
+
     RtlZeroMemory(Context, sizeof(XENIFACE_EVTCHN_CONTEXT));
     ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
 }
@@ -123,27 +204,181 @@ EvtchnFindChannel(
     __in_opt  PFILE_OBJECT  FileObject
     )
 {
-    PXENIFACE_EVTCHN_CONTEXT Context, Found = NULL;
-    PLIST_ENTRY Node;
+    PXENIFACE_EVTCHN_CONTEXT *Leaf;
+    PXENIFACE_EVTCHN_CONTEXT Context;
 
-    Node = Fdo->EvtchnList.Flink;
-    while (Node->Flink != Fdo->EvtchnList.Flink) {
-        Context = CONTAINING_RECORD(Node, XENIFACE_EVTCHN_CONTEXT, Entry);
+    if (LocalPort >= XENIFACE_EVTCHN_MAX_PORT)
+        return NULL;
 
-        Node = Node->Flink;
-        if (Context->LocalPort != LocalPort)
-            continue;
+    Leaf = Fdo->EvtchnTable[LocalPort / XENIFACE_EVTCHN_LEAF_SIZE];
+    if (Leaf == NULL)
+        return NULL;
+
+    Context = Leaf[LocalPort % XENIFACE_EVTCHN_LEAF_SIZE];
+    if (Context == NULL)
+        return NULL;
+
+    ASSERT3U(Context->LocalPort, ==, LocalPort);
+
+    if (FileObject != NULL &&
+        FileObject != Context->FileObject) {
+        return NULL;
+    }
+
+    return Context;
+}
+
+_Requires_exclusive_lock_held_(Fdo->EvtchnLock)
+static
+NTSTATUS
+EvtchnInsertChannel(
+    __in  PXENIFACE_FDO             Fdo,
+    __in  PXENIFACE_EVTCHN_CONTEXT  Context
+    )
+{
+    PXENIFACE_EVTCHN_CONTEXT *Leaf;
+    ULONG Index;
+    NTSTATUS status;
+
+    status = STATUS_INVALID_PARAMETER;
+    if (Context->LocalPort >= XENIFACE_EVTCHN_MAX_PORT)
+        goto fail1;
+
+    Index = Context->LocalPort / XENIFACE_EVTCHN_LEAF_SIZE;
+
+    Leaf = Fdo->EvtchnTable[Index];
+    if (Leaf == NULL) {
+        status = STATUS_NO_MEMORY;
+        Leaf = ExAllocatePoolWithTag(NonPagedPool, PAGE_SIZE, XENIFACE_POOL_TAG);
+        if (Leaf == NULL)
+            goto fail2;
+
+        RtlZeroMemory(Leaf, PAGE_SIZE);
+        Fdo->EvtchnTable[Index] = Leaf;
+    }
+
+    ASSERT3P(Leaf[Context->LocalPort % XENIFACE_EVTCHN_LEAF_SIZE], ==, NULL);
+    Leaf[Context->LocalPort % XENIFACE_EVTCHN_LEAF_SIZE] = Context;
 
-        if (FileObject != NULL &&
-            FileObject != Context->FileObject) {
+    InsertTailList(&Fdo->EvtchnList, &Context->Entry);
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+_Requires_exclusive_lock_held_(Fdo->EvtchnLock)
+VOID
+EvtchnRemoveChannel(
+    __in  PXENIFACE_FDO             Fdo,
+    __in  PXENIFACE_EVTCHN_CONTEXT  Context
+    )
+{
+    PXENIFACE_EVTCHN_CONTEXT *Leaf;
+
+    Leaf = Fdo->EvtchnTable[Context->LocalPort / XENIFACE_EVTCHN_LEAF_SIZE];
+    ASSERT(Leaf != NULL);
+
+    ASSERT3P(Leaf[Context->LocalPort % XENIFACE_EVTCHN_LEAF_SIZE], ==, Context);
+    Leaf[Context->LocalPort % XENIFACE_EVTCHN_LEAF_SIZE] = NULL;
+
+    RemoveEntryList(&Context->Entry);
+}
+
+_Requires_exclusive_lock_held_(Fdo->EvtchnLock)
+VOID
+EvtchnFreeTable(
+    __in  PXENIFACE_FDO Fdo
+    )
+{
+    ULONG Index;
+
+    ASSERT(IsListEmpty(&Fdo->EvtchnList));
+
+    for (Index = 0; Index < XENIFACE_EVTCHN_TABLE_SIZE; Index++) {
+        PXENIFACE_EVTCHN_CONTEXT *Leaf = Fdo->EvtchnTable[Index];
+
+        if (Leaf == NULL)
             continue;
-        }
 
-        Found = Context;
-        break;
+        Fdo->EvtchnTable[Index] = NULL;
+
+        ASSERT(IsZeroMemory(Leaf, PAGE_SIZE));
+        ExFreePoolWithTag(Leaf, XENIFACE_POOL_TAG);
     }
+}
 
-    return Found;
+_Requires_exclusive_lock_held_(Fdo->EvtchnLock)
+static
+PXENIFACE_EVTCHN_RING_CONTEXT
+EvtchnFindRing(
+    __in  PXENIFACE_FDO Fdo,
+    __in  PFILE_OBJECT  FileObject
+    )
+{
+    PLIST_ENTRY Node;
+
+    for (Node = Fdo->EvtchnRingList.Flink;
+         Node != &Fdo->EvtchnRingList;
+         Node = Node->Flink) {
+        PXENIFACE_EVTCHN_RING_CONTEXT Ring;
+
+        Ring = CONTAINING_RECORD(Node, XENIFACE_EVTCHN_RING_CONTEXT, Entry);
+        if (Ring->FileObject == FileObject)
+            return Ring;
+    }
+
+    return NULL;
+}
+
+// Channels bound without an event deliver through the handle's ring
+static
+NTSTATUS
+EvtchnBindEvent(
+    __in  PXENIFACE_FDO             Fdo,
+    __in  HANDLE                    Event,
+    __in  PFILE_OBJECT              FileObject,
+    __in  PXENIFACE_EVTCHN_CONTEXT  Context
+    )
+{
+    KIRQL Irql;
+    NTSTATUS status;
+
+    if (Event != NULL) {
+        status = ObReferenceObjectByHandle(Event,
+                                           EVENT_MODIFY_STATE,
+                                           *ExEventObjectType,
+                                           UserMode,
+                                           &Context->Event,
+                                           NULL);
+        if (!NT_SUCCESS(status))
+            goto fail1;
+
+        KeInitializeDpc(&Context->Dpc, EvtchnNotificationDpc, Context);
+        return STATUS_SUCCESS;
+    }
+
+    KeAcquireSpinLock(&Fdo->EvtchnLock, &Irql);
+    Context->Ring = EvtchnFindRing(Fdo, FileObject);
+    KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
+
+    status = STATUS_INVALID_PARAMETER;
+    if (Context->Ring == NULL)
+        goto fail2;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
 }
 
 DECLSPEC_NOINLINE
@@ -161,6 +396,7 @@ IoctlEvtchnBindUnbound(
     PXENIFACE_EVTCHN_BIND_UNBOUND_IN In = Buffer;
     PXENIFACE_EVTCHN_BIND_UNBOUND_OUT Out = Buffer;
     PXENIFACE_EVTCHN_CONTEXT Context;
+    KIRQL Irql;
 
     status = STATUS_INVALID_BUFFER_SIZE;
     if (InLen != sizeof(XENIFACE_EVTCHN_BIND_UNBOUND_IN) ||
@@ -179,17 +415,10 @@ IoctlEvtchnBindUnbound(
     Trace("> RemoteDomain %d, Mask %d, FO %p\n",
                        In->RemoteDomain, In->Mask, FileObject);
 
-    status = ObReferenceObjectByHandle(In->Event,
-                                       EVENT_MODIFY_STATE,
-                                       *ExEventObjectType,
-                                       UserMode,
-                                       &Context->Event,
-                                       NULL);
+    status = EvtchnBindEvent(Fdo, In->Event, FileObject, Context);
     if (!NT_SUCCESS(status))
         goto fail3;
 
-    KeInitializeDpc(&Context->Dpc, EvtchnNotificationDpc, Context);
-
     status = STATUS_UNSUCCESSFUL;
     Context->Channel = XENBUS_EVTCHN(Open,
                                      &Fdo->EvtchnInterface,
@@ -207,7 +436,12 @@ IoctlEvtchnBindUnbound(
 
     Context->Fdo = Fdo;
 
-    ExInterlockedInsertTailList(&Fdo->EvtchnList, &Context->Entry, &Fdo->EvtchnLock);
+    KeAcquireSpinLock(&Fdo->EvtchnLock, &Irql);
+    status = EvtchnInsertChannel(Fdo, Context);
+    KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
+
+    if (!NT_SUCCESS(status))
+        goto fail5;
 
     Out->LocalPort = Context->LocalPort;
     *Info = sizeof(XENIFACE_EVTCHN_BIND_UNBOUND_OUT);
@@ -222,9 +456,17 @@ IoctlEvtchnBindUnbound(
     Trace("< LocalPort %lu, Context %p\n", Context->LocalPort, Context);
     return STATUS_SUCCESS;
 
+fail5:
+    Error("Fail5\n");
+    XENBUS_EVTCHN(Close,
+                  &Fdo->EvtchnInterface,
+                  Context->Channel);
+    KeFlushQueuedDpcs();
+
 fail4:
     Error("Fail4\n");
-    ObDereferenceObject(Context->Event);
+    if (Context->Event != NULL)
+        ObDereferenceObject(Context->Event);
 
 fail3:
     Error("Fail3\n");
@@ -254,6 +496,7 @@ IoctlEvtchnBindInterdomain(
     PXENIFACE_EVTCHN_BIND_INTERDOMAIN_IN In = Buffer;
     PXENIFACE_EVTCHN_BIND_INTERDOMAIN_OUT Out = Buffer;
     PXENIFACE_EVTCHN_CONTEXT Context;
+    KIRQL Irql;
 
     status = STATUS_INVALID_BUFFER_SIZE;
     if (InLen != sizeof(XENIFACE_EVTCHN_BIND_INTERDOMAIN_IN) ||
@@ -272,17 +515,10 @@ IoctlEvtchnBindInterdomain(
     Trace("> RemoteDomain %d, RemotePort %lu, Mask %d, FO %p\n",
                        In->RemoteDomain, In->RemotePort, In->Mask, FileObject);
 
-    status = ObReferenceObjectByHandle(In->Event,
-                                       EVENT_MODIFY_STATE,
-                                       *ExEventObjectType,
-                                       UserMode,
-                                       &Context->Event,
-                                       NULL);
+    status = EvtchnBindEvent(Fdo, In->Event, FileObject, Context);
     if (!NT_SUCCESS(status))
         goto fail3;
 
-    KeInitializeDpc(&Context->Dpc, EvtchnNotificationDpc, Context);
-
     status = STATUS_UNSUCCESSFUL;
     Context->Channel = XENBUS_EVTCHN(Open,
                                      &Fdo->EvtchnInterface,
@@ -301,7 +537,12 @@ IoctlEvtchnBindInterdomain(
 
     Context->Fdo = Fdo;
 
-    ExInterlockedInsertTailList(&Fdo->EvtchnList, &Context->Entry, &Fdo->EvtchnLock);
+    KeAcquireSpinLock(&Fdo->EvtchnLock, &Irql);
+    status = EvtchnInsertChannel(Fdo, Context);
+    KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
+
+    if (!NT_SUCCESS(status))
+        goto fail5;
 
     Out->LocalPort = Context->LocalPort;
     *Info = sizeof(XENIFACE_EVTCHN_BIND_INTERDOMAIN_OUT);
@@ -317,9 +558,17 @@ IoctlEvtchnBindInterdomain(
 
     return STATUS_SUCCESS;
 
+fail5:
+    Error("Fail5\n");
+    XENBUS_EVTCHN(Close,
+                  &Fdo->EvtchnInterface,
+                  Context->Channel);
+    KeFlushQueuedDpcs();
+
 fail4:
     Error("Fail4\n");
-    ObDereferenceObject(Context->Event);
+    if (Context->Event != NULL)
+        ObDereferenceObject(Context->Event);
 
 fail3:
     Error("Fail3\n");
@@ -363,7 +612,7 @@ IoctlEvtchnClose(
     if (Context == NULL)
         goto fail2;
 
-    RemoveEntryList(&Context->Entry);
+    EvtchnRemoveChannel(Fdo, Context);
     KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
     EvtchnFree(Fdo, Context);
 
@@ -491,3 +740,197 @@ fail1:
     Error("Fail1 (%08x)\n", status);
     return status;
 }
+
+_IRQL_requires_(PASSIVE_LEVEL) // needed for KeFlushQueuedDpcs
+VOID
+EvtchnRingFree(
+    __in     PXENIFACE_FDO Fdo,
+    __inout  PXENIFACE_EVTCHN_RING_CONTEXT Ring
+    )
+{
+    KAPC_STATE ApcState;
+    BOOLEAN ChangeProcess;
+
+    UNREFERENCED_PARAMETER(Fdo);
+
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    Trace("Ring %p, FO %p\n", Ring, Ring->FileObject);
+
+    // All channels using the ring must already be closed
+    KeFlushQueuedDpcs();
+    ASSERT(InterlockedFlushSList(&Ring->PendingList) == NULL);
+
+    // We are not guaranteed to be in the context of the process that
+    // mapped the ring, but we need to be there to unmap it.
+    ChangeProcess = PsGetCurrentProcess() != Ring->Process;
+    if (ChangeProcess)
+        KeStackAttachProcess(Ring->Process, &ApcState);
+
+    MmUnmapLockedPages(Ring->UserVa, Ring->Mdl);
+
+    if (ChangeProcess)
+        KeUnstackDetachProcess(&ApcState);
+
+    IoFreeMdl(Ring->Mdl);
+    ExFreePoolWithTag(Ring->Shared, XENIFACE_POOL_TAG);
+    ObDereferenceObject(Ring->Event);
+    ObDereferenceObject(Ring->Process);
+
+    RtlZeroMemory(Ring, sizeof(XENIFACE_EVTCHN_RING_CONTEXT));
+    ExFreePoolWithTag(Ring, XENIFACE_POOL_TAG);
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlEvtchnRingMap(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_EVTCHN_RING_MAP_IN In = Buffer;
+    PXENIFACE_EVTCHN_RING_MAP_OUT Out = Buffer;
+    PXENIFACE_EVTCHN_RING_CONTEXT Ring;
+    ULONG Length;
+    ULONG Size;
+    KIRQL Irql;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != sizeof(XENIFACE_EVTCHN_RING_MAP_IN) ||
+        OutLen != sizeof(XENIFACE_EVTCHN_RING_MAP_OUT)) {
+        goto fail1;
+    }
+
+    status = STATUS_INVALID_PARAMETER;
+    if (In->NumberPages == 0 ||
+        In->NumberPages > XENIFACE_EVTCHN_RING_MAX_PAGES) {
+        goto fail2;
+    }
+
+    Trace("> NumberPages %lu, FO %p\n", In->NumberPages, FileObject);
+
+    status = STATUS_NO_MEMORY;
+    Ring = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_EVTCHN_RING_CONTEXT), XENIFACE_POOL_TAG);
+    if (Ring == NULL)
+        goto fail3;
+
+    RtlZeroMemory(Ring, sizeof(XENIFACE_EVTCHN_RING_CONTEXT));
+    Ring->Fdo = Fdo;
+    Ring->FileObject = FileObject;
+    Ring->NumberPages = In->NumberPages;
+    InitializeSListHead(&Ring->PendingList);
+    KeInitializeSpinLock(&Ring->Lock);
+    KeInitializeDpc(&Ring->Dpc, EvtchnRingDpc, Ring);
+
+    status = ObReferenceObjectByHandle(In->Event,
+                                       EVENT_MODIFY_STATE,
+                                       *ExEventObjectType,
+                                       UserMode,
+                                       &Ring->Event,
+                                       NULL);
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
+    Length = Ring->NumberPages * PAGE_SIZE;
+
+    status = STATUS_NO_MEMORY;
+    Ring->Shared = ExAllocatePoolWithTag(NonPagedPool, Length, XENIFACE_POOL_TAG);
+    if (Ring->Shared == NULL)
+        goto fail5;
+
+    RtlZeroMemory(Ring->Shared, Length);
+
+    // Round the number of entries down to a power of 2
+    Size = (Length - FIELD_OFFSET(XENIFACE_EVTCHN_RING, Ports)) / sizeof(ULONG);
+    while ((Size & (Size - 1)) != 0)
+        Size &= Size - 1;
+
+    Ring->Size = Ring->Shared->Size = Size;
+
+    Ring->Mdl = IoAllocateMdl(Ring->Shared, Length, FALSE, FALSE, NULL);
+    if (Ring->Mdl == NULL)
+        goto fail6;
+
+    MmBuildMdlForNonPagedPool(Ring->Mdl);
+    ASSERT(MmGetMdlByteCount(Ring->Mdl) == Length);
+
+#pragma prefast(suppress:6320) // we want to catch all exceptions
+    __try {
+        Ring->UserVa = MmMapLockedPagesSpecifyCache(Ring->Mdl,
+                                                    UserMode,
+                                                    MmCached,
+                                                    NULL,
+                                                    FALSE,
+                                                    NormalPagePriority);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        goto fail7;
+    }
+
+    status = STATUS_UNSUCCESSFUL;
+    if (Ring->UserVa == NULL)
+        goto fail8;
+
+    Ring->Process = PsGetCurrentProcess();
+    ObReferenceObject(Ring->Process);
+
+    KeAcquireSpinLock(&Fdo->EvtchnLock, &Irql);
+
+    status = STATUS_INVALID_DEVICE_STATE;
+    if (EvtchnFindRing(Fdo, FileObject) != NULL)
+        goto fail9;
+
+    InsertTailList(&Fdo->EvtchnRingList, &Ring->Entry);
+
+    KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
+
+    Out->Ring = Ring->UserVa;
+    *Info = sizeof(XENIFACE_EVTCHN_RING_MAP_OUT);
+
+    Trace("< Ring %p, Size %lu, UserVa %p\n", Ring, Ring->Size, Ring->UserVa);
+
+    return STATUS_SUCCESS;
+
+fail9:
+    Error("Fail9\n");
+    KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
+
+    ObDereferenceObject(Ring->Process);
+    MmUnmapLockedPages(Ring->UserVa, Ring->Mdl);
+
+fail8:
+    Error("Fail8\n");
+
+fail7:
+    Error("Fail7\n");
+    IoFreeMdl(Ring->Mdl);
+
+fail6:
+    Error("Fail6\n");
+    ExFreePoolWithTag(Ring->Shared, XENIFACE_POOL_TAG);
+
+fail5:
+    Error("Fail5\n");
+    ObDereferenceObject(Ring->Event);
+
+fail4:
+    Error("Fail4\n");
+    RtlZeroMemory(Ring, sizeof(XENIFACE_EVTCHN_RING_CONTEXT));
+    ExFreePoolWithTag(Ring, XENIFACE_POOL_TAG);
+
+fail3:
+    Error("Fail3\n");
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
@@ -35,37 +35,32 @@
 #include "log.h"
 #include "irp_queue.h"
 
-// Complete a canceled gnttab IRP, cleanup associated grant/map.
-_Function_class_(IO_WORKITEM_ROUTINE)
-VOID
-CompleteGnttabIrp(
-    __in      PDEVICE_OBJECT DeviceObject,
-    __in_opt  PVOID          Context
+// Number of pages granted per acquisition of the grant cache lock
+#define XENIFACE_GNTTAB_LOCK_BATCH  64
+
+// Free a grant/map context. This has to be done in the context of the
+// process the memory was mapped into.
+_IRQL_requires_(PASSIVE_LEVEL)
+static VOID
+GnttabFreeContext(
+    __in  PXENIFACE_FDO         Fdo,
+    __in  PXENIFACE_CONTEXT_ID  Id
     )
 {
-    PXENIFACE_DX Dx = (PXENIFACE_DX)DeviceObject->DeviceExtension;
-    PXENIFACE_FDO Fdo = Dx->Fdo;
-    PIRP Irp = Context;
-    PXENIFACE_CONTEXT_ID Id;
-    PIO_WORKITEM WorkItem;
+    PEPROCESS Process = Id->Process;
     KAPC_STATE ApcState;
     BOOLEAN ChangeProcess;
 
-    ASSERT(Context != NULL);
-
-    Id = Irp->Tail.Overlay.DriverContext[0];
-    WorkItem = Irp->Tail.Overlay.DriverContext[1];
-
-    // We are not guaranteed to be in the context of the process that initiated the IRP,
+    // We are not guaranteed to be in the context of the process that set up the grant/map,
     // but we need to be there to unmap memory.
-    ChangeProcess = PsGetCurrentProcess() != Id->Process;
+    ChangeProcess = PsGetCurrentProcess() != Process;
     if (ChangeProcess) {
-        Trace("Changing process from %p to %p\n", PsGetCurrentProcess(), Id->Process);
-        KeStackAttachProcess(Id->Process, &ApcState);
+        Trace("Changing process from %p to %p\n", PsGetCurrentProcess(), Process);
+        KeStackAttachProcess(Process, &ApcState);
     }
 
-    Trace("Irp %p, Process %p, Id %lu, Type %d, IRQL %d\n",
-          Irp, Id->Process, Id->RequestId, Id->Type, KeGetCurrentIrql());
+    Trace("Process %p, Id %lu, Type %d, IRQL %d\n",
+          Process, Id->RequestId, Id->Type, KeGetCurrentIrql());
 
     switch (Id->Type) {
 
@@ -83,6 +78,30 @@ CompleteGnttabIrp(
 
     if (ChangeProcess)
         KeUnstackDetachProcess(&ApcState);
+}
+
+// Complete a canceled gnttab IRP, cleanup associated grant/map.
+_Function_class_(IO_WORKITEM_ROUTINE)
+VOID
+CompleteGnttabIrp(
+    __in      PDEVICE_OBJECT DeviceObject,
+    __in_opt  PVOID          Context
+    )
+{
+    PXENIFACE_DX Dx = (PXENIFACE_DX)DeviceObject->DeviceExtension;
+    PXENIFACE_FDO Fdo = Dx->Fdo;
+    PIRP Irp = Context;
+    PXENIFACE_CONTEXT_ID Id;
+    PIO_WORKITEM WorkItem;
+
+    ASSERT(Context != NULL);
+
+    Id = Irp->Tail.Overlay.DriverContext[0];
+    WorkItem = Irp->Tail.Overlay.DriverContext[1];
+
+    Trace("Irp %p\n", Irp);
+
+    GnttabFreeContext(Fdo, Id);
 
     IoFreeWorkItem(WorkItem);
 
@@ -136,110 +155,67 @@ FindGnttabIrp(
     return Irp;
 }
 
-DECLSPEC_NOINLINE
-NTSTATUS
-IoctlGnttabPermitForeignAccess(
-    __in     PXENIFACE_FDO  Fdo,
-    __in     PVOID          Buffer,
-    __in     ULONG          InLen,
-    __in     ULONG          OutLen,
-    __inout  PIRP           Irp
+// Allocate the memory of a grant, share it with the remote domain and map
+// it into the current process.
+_IRQL_requires_(PASSIVE_LEVEL)
+static NTSTATUS
+GnttabPermitPages(
+    __in     PXENIFACE_FDO            Fdo,
+    __inout  PXENIFACE_GRANT_CONTEXT  Context
     )
 {
     NTSTATUS status;
-    PXENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_IN In;
-    PXENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_OUT Out = Irp->UserBuffer;
-    PXENIFACE_GRANT_CONTEXT Context;
+    KIRQL Irql;
     ULONG Page;
-
-    status = STATUS_INVALID_BUFFER_SIZE;
-    if (InLen != sizeof(XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_IN))
-        goto fail1;
-
-    // This IOCTL uses METHOD_NEITHER so we directly access user memory.
-    status = __CaptureUserBuffer(Buffer, InLen, &In);
-    if (!NT_SUCCESS(status))
-        goto fail2;
-
-    status = STATUS_INVALID_PARAMETER;
-    if (In->NumberPages == 0 ||
-        In->NumberPages > 1024 * 1024) {
-        goto fail3;
-    }
-
-    if ((In->Flags & XENIFACE_GNTTAB_USE_NOTIFY_OFFSET) &&
-        (In->NotifyOffset >= In->NumberPages * PAGE_SIZE)) {
-        goto fail4;
-    }
-
-    status = STATUS_INVALID_BUFFER_SIZE;
-    if (OutLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_OUT, References[In->NumberPages]))
-        goto fail5;
-
-    status = STATUS_NO_MEMORY;
-    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_GRANT_CONTEXT), XENIFACE_POOL_TAG);
-    if (Context == NULL)
-        goto fail6;
-
-    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
-    Context->Id.Type = XENIFACE_CONTEXT_GRANT;
-    Context->Id.Process = PsGetCurrentProcess();
-    Context->Id.RequestId = In->RequestId;
-    Context->RemoteDomain = In->RemoteDomain;
-    Context->NumberPages = In->NumberPages;
-    Context->Flags = In->Flags;
-    Context->NotifyOffset = In->NotifyOffset;
-    Context->NotifyPort = In->NotifyPort;
-
-    Trace("> RemoteDomain %d, NumberPages %lu, Flags 0x%x, Offset 0x%x, Port %d, Process %p, Id %lu\n",
-                       Context->RemoteDomain, Context->NumberPages, Context->Flags, Context->NotifyOffset, Context->NotifyPort,
-                       Context->Id.Process, Context->Id.RequestId);
-
-    // Check if the request ID is unique for this process.
-    // This doesn't protect us from simultaneous requests with the same ID arriving here
-    // but another check for duplicate ID is performed when the context/IRP is queued at the end.
-    // Ideally we would lock the whole section but that's not really an option since we touch user memory.
-    status = STATUS_INVALID_PARAMETER;
-    if (FindGnttabIrp(Fdo, &Context->Id) != NULL)
-        goto fail7;
+    ULONG Last;
 
     status = STATUS_NO_MEMORY;
     Context->Grants = ExAllocatePoolWithTag(NonPagedPool, Context->NumberPages * sizeof(PXENBUS_GNTTAB_ENTRY), XENIFACE_POOL_TAG);
     if (Context->Grants == NULL)
-        goto fail8;
+        goto fail1;
 
     RtlZeroMemory(Context->Grants, Context->NumberPages * sizeof(PXENBUS_GNTTAB_ENTRY));
 
     // allocate memory to share
-    status = STATUS_NO_MEMORY;
     Context->KernelVa = ExAllocatePoolWithTag(NonPagedPool, Context->NumberPages * PAGE_SIZE, XENIFACE_POOL_TAG);
     if (Context->KernelVa == NULL)
-        goto fail9;
+        goto fail2;
 
     RtlZeroMemory(Context->KernelVa, Context->NumberPages * PAGE_SIZE);
     Context->Mdl = IoAllocateMdl(Context->KernelVa, Context->NumberPages * PAGE_SIZE, FALSE, FALSE, NULL);
     if (Context->Mdl == NULL)
-        goto fail10;
+        goto fail3;
 
     MmBuildMdlForNonPagedPool(Context->Mdl);
     ASSERT(MmGetMdlByteCount(Context->Mdl) == Context->NumberPages * PAGE_SIZE);
 
-    // perform sharing
-    for (Page = 0; Page < Context->NumberPages; Page++) {
-        status = XENBUS_GNTTAB(PermitForeignAccess,
-                               &Fdo->GnttabInterface,
-                               Fdo->GnttabCache,
-                               FALSE,
-                               Context->RemoteDomain,
-                               MmGetMdlPfnArray(Context->Mdl)[Page],
-                               (Context->Flags & XENIFACE_GNTTAB_READONLY) != 0,
-                               &(Context->Grants[Page]));
-
-// prefast somehow thinks that this call can modify Page...
-#pragma prefast(suppress:6385)
-        Info("Grants[%lu] = %p\n", Page, Context->Grants[Page]);
+    // perform sharing, taking the cache lock once per batch of pages rather than once per page
+    status = STATUS_SUCCESS;
+    Page = 0;
+    while (Page < Context->NumberPages) {
+        Last = __min(Page + XENIFACE_GNTTAB_LOCK_BATCH, Context->NumberPages);
+
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+        GnttabAcquireLock(Fdo);
+
+        for (; Page < Last; Page++) {
+            status = XENBUS_GNTTAB(PermitForeignAccess,
+                                   &Fdo->GnttabInterface,
+                                   Fdo->GnttabCache,
+                                   TRUE,
+                                   Context->RemoteDomain,
+                                   MmGetMdlPfnArray(Context->Mdl)[Page],
+                                   (Context->Flags & XENIFACE_GNTTAB_READONLY) != 0,
+                                   &(Context->Grants[Page]));
+            if (!NT_SUCCESS(status))
+                break;
+        }
+
+        GnttabReleaseLock(Fdo);
+        KeLowerIrql(Irql);
+
         if (!NT_SUCCESS(status))
-            goto fail11;
+            goto fail4;
     }
 
     // map into user mode
@@ -254,86 +230,14 @@ IoctlGnttabPermitForeignAccess(
     }
     __except (EXCEPTION_EXECUTE_HANDLER) {
         status = GetExceptionCode();
-        goto fail12;
+        goto fail5;
     }
 
     status = STATUS_UNSUCCESSFUL;
     if (Context->UserVa == NULL)
-        goto fail13;
-
-    Trace("< Context %p, Irp %p, KernelVa %p, UserVa %p\n",
-                       Context, Irp, Context->KernelVa, Context->UserVa);
-
-    // Pass the result to user mode.
-#pragma prefast(suppress: 6320) // we want to catch all exceptions
-    try {
-        ProbeForWrite(Out, OutLen, 1);
-        Out->Address = Context->UserVa;
-
-        for (Page = 0; Page < Context->NumberPages; Page++) {
-            Out->References[Page] = XENBUS_GNTTAB(GetReference,
-                                                  &Fdo->GnttabInterface,
-                                                  Context->Grants[Page]);
-        }
-    } except(EXCEPTION_EXECUTE_HANDLER) {
-        status = GetExceptionCode();
-        Error("Exception 0x%lx while probing/writing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
-        goto fail14;
-    }
-
-    // Insert the IRP/context into the pending queue.
-    // This also checks (again) if the request ID is unique for the calling process.
-    Irp->Tail.Overlay.DriverContext[0] = &Context->Id;
-    status = IoCsqInsertIrpEx(&Fdo->IrpQueue, Irp, NULL, &Context->Id);
-    if (!NT_SUCCESS(status))
-        goto fail15;
-
-    __FreeCapturedBuffer(In);
-
-    return STATUS_PENDING;
-
-fail15:
-    Error("Fail15\n");
-
-fail14:
-    Error("Fail14\n");
-    MmUnmapLockedPages(Context->UserVa, Context->Mdl);
-
-fail13:
-    Error("Fail13\n");
-
-fail12:
-    Error("Fail12\n");
-
-fail11:
-    Error("Fail11: Page = %lu\n", Page);
-
-    while (Page > 0) {
-        ASSERT(NT_SUCCESS(XENBUS_GNTTAB(RevokeForeignAccess,
-                                        &Fdo->GnttabInterface,
-                                        Fdo->GnttabCache,
-                                        FALSE,
-                                        Context->Grants[Page - 1])));
-
-        --Page;
-    }
-    IoFreeMdl(Context->Mdl);
-
-fail10:
-    Error("Fail10\n");
-    ExFreePoolWithTag(Context->KernelVa, XENIFACE_POOL_TAG);
-
-fail9:
-    Error("Fail9\n");
-    ExFreePoolWithTag(Context->Grants, XENIFACE_POOL_TAG);
-
-fail8:
-    Error("Fail8\n");
+        goto fail6;
 
-fail7:
-    Error("Fail7\n");
-    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
-    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+    return STATUS_SUCCESS;
 
 fail6:
     Error("Fail6\n");
@@ -342,45 +246,46 @@ fail5:
     Error("Fail5\n");
 
 fail4:
-    Error("Fail4\n");
+    Error("Fail4: Page = %lu\n", Page);
+
+    while (Page > 0) {
+        --Page;
+        (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                             &Fdo->GnttabInterface,
+                             Fdo->GnttabCache,
+                             FALSE,
+                             Context->Grants[Page]);
+    }
+
+    IoFreeMdl(Context->Mdl);
+    Context->Mdl = NULL;
 
 fail3:
     Error("Fail3\n");
-    __FreeCapturedBuffer(In);
+    ExFreePoolWithTag(Context->KernelVa, XENIFACE_POOL_TAG);
+    Context->KernelVa = NULL;
 
 fail2:
     Error("Fail2\n");
+    ExFreePoolWithTag(Context->Grants, XENIFACE_POOL_TAG);
+    Context->Grants = NULL;
 
 fail1:
     Error("Fail1 (%08x)\n", status);
     return status;
 }
 
+// Undo GnttabPermitPages().
 _IRQL_requires_max_(APC_LEVEL)
-VOID
-GnttabFreeGrant(
+static VOID
+GnttabRevokePages(
     __in     PXENIFACE_FDO            Fdo,
     __inout  PXENIFACE_GRANT_CONTEXT  Context
-)
+    )
 {
     NTSTATUS status;
     ULONG Page;
 
-    ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
-
-    Trace("Context %p\n", Context);
-
-    if (Context->Flags & XENIFACE_GNTTAB_USE_NOTIFY_OFFSET) {
-        ((PCHAR)Context->KernelVa)[Context->NotifyOffset] = 0;
-    }
-
-    if (Context->Flags & XENIFACE_GNTTAB_USE_NOTIFY_PORT) {
-        status = EvtchnNotify(Fdo, Context->NotifyPort, NULL);
-
-        if (!NT_SUCCESS(status)) // non-fatal, we must free memory
-            Error("failed to notify port %lu: 0x%x\n", Context->NotifyPort, status);
-    }
-
     // unmap from user address space
     MmUnmapLockedPages(Context->UserVa, Context->Mdl);
 
@@ -402,96 +307,140 @@ GnttabFreeGrant(
 
     RtlZeroMemory(Context->Grants, Context->NumberPages * sizeof(PXENBUS_GNTTAB_ENTRY));
     ExFreePoolWithTag(Context->Grants, XENIFACE_POOL_TAG);
-
-    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
-    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
 }
 
-DECLSPEC_NOINLINE
-NTSTATUS
-IoctlGnttabRevokeForeignAccess(
-    __in  PXENIFACE_FDO     Fdo,
-    __in  PVOID             Buffer,
-    __in  ULONG             InLen,
-    __in  ULONG             OutLen
+// Map foreign pages into system space and into the current process.
+_IRQL_requires_(PASSIVE_LEVEL)
+static NTSTATUS
+GnttabMapPages(
+    __in     PXENIFACE_FDO            Fdo,
+    __inout  PXENIFACE_MAP_CONTEXT    Context,
+    __in     PULONG                   References
     )
 {
     NTSTATUS status;
-    PXENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_IN In = Buffer;
-    PXENIFACE_GRANT_CONTEXT Context = NULL;
-    XENIFACE_CONTEXT_ID Id;
-    PIRP PendingIrp;
-    PXENIFACE_CONTEXT_ID ContextId;
-
-    status = STATUS_INVALID_BUFFER_SIZE;
-    if (InLen != sizeof(XENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_IN))
-        goto fail1;
 
-    Id.Type = XENIFACE_CONTEXT_GRANT;
-    Id.Process = PsGetCurrentProcess();
-    Id.RequestId = In->RequestId;
+    status = XENBUS_GNTTAB(MapForeignPages,
+                           &Fdo->GnttabInterface,
+                           Context->RemoteDomain,
+                           Context->NumberPages,
+                           References,
+                           Context->Flags & XENIFACE_GNTTAB_READONLY,
+                           &Context->Address);
 
-    Trace("> Process %p, Id %lu\n", Id.Process, Id.RequestId);
+    if (!NT_SUCCESS(status))
+        goto fail1;
 
-    status = STATUS_NOT_FOUND;
-    PendingIrp = IoCsqRemoveNextIrp(&Fdo->IrpQueue, &Id);
-    if (PendingIrp == NULL)
+    status = STATUS_NO_MEMORY;
+    Context->KernelVa = MmMapIoSpace(Context->Address, Context->NumberPages * PAGE_SIZE, MmCached);
+    if (Context->KernelVa == NULL)
         goto fail2;
 
-    ContextId = PendingIrp->Tail.Overlay.DriverContext[0];
-    Context = CONTAINING_RECORD(ContextId, XENIFACE_GRANT_CONTEXT, Id);
-    GnttabFreeGrant(Fdo, Context);
-
-    PendingIrp->IoStatus.Status = STATUS_SUCCESS;
-    PendingIrp->IoStatus.Information = 0;
-    IoCompleteRequest(PendingIrp, IO_NO_INCREMENT);
+    Context->Mdl = IoAllocateMdl(Context->KernelVa, Context->NumberPages * PAGE_SIZE, FALSE, FALSE, NULL);
+    if (Context->Mdl == NULL)
+        goto fail3;
 
-    return STATUS_SUCCESS;
+    MmBuildMdlForNonPagedPool(Context->Mdl);
 
-fail2:
+    // map into user mode
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+    __try {
+        Context->UserVa = MmMapLockedPagesSpecifyCache(Context->Mdl,
+                                                       UserMode,
+                                                       MmCached,
+                                                       NULL,
+                                                       FALSE,
+                                                       NormalPagePriority);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        goto fail4;
+    }
+
+    status = STATUS_UNSUCCESSFUL;
+    if (Context->UserVa == NULL)
+        goto fail5;
+
+    return STATUS_SUCCESS;
+
+fail5:
+    Error("Fail5\n");
+
+fail4:
+    Error("Fail4\n");
+    IoFreeMdl(Context->Mdl);
+    Context->Mdl = NULL;
+
+fail3:
+    Error("Fail3\n");
+    MmUnmapIoSpace(Context->KernelVa, Context->NumberPages * PAGE_SIZE);
+    Context->KernelVa = NULL;
+
+fail2:
     Error("Fail2\n");
+    (VOID) XENBUS_GNTTAB(UnmapForeignPages,
+                         &Fdo->GnttabInterface,
+                         Context->Address);
 
 fail1:
     Error("Fail1 (%08x)\n", status);
     return status;
 }
 
+// Undo GnttabMapPages().
+_IRQL_requires_max_(APC_LEVEL)
+static VOID
+GnttabUnmapPages(
+    __in     PXENIFACE_FDO            Fdo,
+    __inout  PXENIFACE_MAP_CONTEXT    Context
+    )
+{
+    NTSTATUS status;
+
+    // unmap from user address space
+    MmUnmapLockedPages(Context->UserVa, Context->Mdl);
+
+    IoFreeMdl(Context->Mdl);
+
+    // unmap from system space
+    MmUnmapIoSpace(Context->KernelVa, Context->NumberPages * PAGE_SIZE);
+
+    // undo mapping
+    status = XENBUS_GNTTAB(UnmapForeignPages,
+                           &Fdo->GnttabInterface,
+                           Context->Address);
+
+    ASSERT(NT_SUCCESS(status));
+}
+
 DECLSPEC_NOINLINE
 NTSTATUS
-IoctlGnttabMapForeignPages(
-    __in     PXENIFACE_FDO     Fdo,
-    __in     PVOID             Buffer,
-    __in     ULONG             InLen,
-    __in     ULONG             OutLen,
-    __inout  PIRP              Irp
+IoctlGnttabPermitForeignAccess(
+    __in     PXENIFACE_FDO  Fdo,
+    __in     PVOID          Buffer,
+    __in     ULONG          InLen,
+    __in     ULONG          OutLen,
+    __inout  PIRP           Irp
     )
 {
     NTSTATUS status;
-    PXENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN In = Buffer;
-    PXENIFACE_GNTTAB_MAP_FOREIGN_PAGES_OUT Out = Irp->UserBuffer;
-    ULONG NumberPages;
-    ULONG PageIndex;
-    PXENIFACE_MAP_CONTEXT Context;
+    PXENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_IN In;
+    PXENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_OUT Out = Irp->UserBuffer;
+    PXENIFACE_GRANT_CONTEXT Context;
+    ULONG Page;
 
     status = STATUS_INVALID_BUFFER_SIZE;
-    if (InLen < sizeof(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN) ||
-        OutLen != sizeof(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_OUT)) {
+    if (InLen != sizeof(XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_IN))
         goto fail1;
-    }
 
     // This IOCTL uses METHOD_NEITHER so we directly access user memory.
-
-    // Calculate the expected number of pages based on input buffer size.
-    NumberPages = (InLen - (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN, References)) / sizeof(In->References[0]);
-
     status = __CaptureUserBuffer(Buffer, InLen, &In);
     if (!NT_SUCCESS(status))
         goto fail2;
 
     status = STATUS_INVALID_PARAMETER;
     if (In->NumberPages == 0 ||
-        In->NumberPages > 1024 * 1024 ||
-        In->NumberPages != NumberPages) {
+        In->NumberPages > 1024 * 1024) {
         goto fail3;
     }
 
@@ -501,16 +450,16 @@ IoctlGnttabMapForeignPages(
     }
 
     status = STATUS_INVALID_BUFFER_SIZE;
-    if (InLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN, References[In->NumberPages]))
+    if (OutLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_OUT, References[In->NumberPages]))
         goto fail5;
 
     status = STATUS_NO_MEMORY;
-    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_MAP_CONTEXT), XENIFACE_POOL_TAG);
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_GRANT_CONTEXT), XENIFACE_POOL_TAG);
     if (Context == NULL)
         goto fail6;
 
-    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
-    Context->Id.Type = XENIFACE_CONTEXT_MAP;
+    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
+    Context->Id.Type = XENIFACE_CONTEXT_GRANT;
     Context->Id.Process = PsGetCurrentProcess();
     Context->Id.RequestId = In->RequestId;
     Context->RemoteDomain = In->RemoteDomain;
@@ -523,67 +472,36 @@ IoctlGnttabMapForeignPages(
                        Context->RemoteDomain, Context->NumberPages, Context->Flags, Context->NotifyOffset, Context->NotifyPort,
                        Context->Id.Process, Context->Id.RequestId);
 
-    for (PageIndex = 0; PageIndex < In->NumberPages; PageIndex++)
-        Info("> Ref %d\n", In->References[PageIndex]);
-
+    // Check if the request ID is unique for this process.
+    // This doesn't protect us from simultaneous requests with the same ID arriving here
+    // but another check for duplicate ID is performed when the context/IRP is queued at the end.
+    // Ideally we would lock the whole section but that's not really an option since we touch user memory.
     status = STATUS_INVALID_PARAMETER;
     if (FindGnttabIrp(Fdo, &Context->Id) != NULL)
         goto fail7;
 
-    status = XENBUS_GNTTAB(MapForeignPages,
-                           &Fdo->GnttabInterface,
-                           Context->RemoteDomain,
-                           Context->NumberPages,
-                           In->References,
-                           Context->Flags & XENIFACE_GNTTAB_READONLY,
-                           &Context->Address);
-
+    status = GnttabPermitPages(Fdo, Context);
     if (!NT_SUCCESS(status))
         goto fail8;
 
-    status = STATUS_NO_MEMORY;
-    Context->KernelVa = MmMapIoSpace(Context->Address, Context->NumberPages * PAGE_SIZE, MmCached);
-    if (Context->KernelVa == NULL)
-        goto fail9;
-
-    status = STATUS_NO_MEMORY;
-    Context->Mdl = IoAllocateMdl(Context->KernelVa, Context->NumberPages * PAGE_SIZE, FALSE, FALSE, NULL);
-    if (Context->Mdl == NULL)
-        goto fail10;
-
-    MmBuildMdlForNonPagedPool(Context->Mdl);
-
-    // map into user mode
-#pragma prefast(suppress: 6320) // we want to catch all exceptions
-    __try {
-        Context->UserVa = MmMapLockedPagesSpecifyCache(Context->Mdl,
-                                                       UserMode,
-                                                       MmCached,
-                                                       NULL,
-                                                       FALSE,
-                                                       NormalPagePriority);
-    }
-    __except (EXCEPTION_EXECUTE_HANDLER) {
-        status = GetExceptionCode();
-        goto fail11;
-    }
-
-    status = STATUS_UNSUCCESSFUL;
-    if (Context->UserVa == NULL)
-        goto fail12;
-
-    Trace("< Context %p, Irp %p, Address %p, KernelVa %p, UserVa %p\n",
-                       Context, Irp, Context->Address, Context->KernelVa, Context->UserVa);
+    Trace("< Context %p, Irp %p, KernelVa %p, UserVa %p\n",
+                       Context, Irp, Context->KernelVa, Context->UserVa);
 
     // Pass the result to user mode.
 #pragma prefast(suppress: 6320) // we want to catch all exceptions
     try {
         ProbeForWrite(Out, OutLen, 1);
         Out->Address = Context->UserVa;
+
+        for (Page = 0; Page < Context->NumberPages; Page++) {
+            Out->References[Page] = XENBUS_GNTTAB(GetReference,
+                                                  &Fdo->GnttabInterface,
+                                                  Context->Grants[Page]);
+        }
     } except(EXCEPTION_EXECUTE_HANDLER) {
         status = GetExceptionCode();
         Error("Exception 0x%lx while probing/writing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
-        goto fail13;
+        goto fail9;
     }
 
     // Insert the IRP/context into the pending queue.
@@ -591,43 +509,25 @@ IoctlGnttabMapForeignPages(
     Irp->Tail.Overlay.DriverContext[0] = &Context->Id;
     status = IoCsqInsertIrpEx(&Fdo->IrpQueue, Irp, NULL, &Context->Id);
     if (!NT_SUCCESS(status))
-        goto fail14;
+        goto fail10;
 
     __FreeCapturedBuffer(In);
 
     return STATUS_PENDING;
 
-fail14:
-    Error("Fail14\n");
-
-fail13:
-    Error("Fail13\n");
-    MmUnmapLockedPages(Context->UserVa, Context->Mdl);
-
-fail12:
-    Error("Fail12\n");
-
-fail11:
-    Error("Fail11\n");
-    IoFreeMdl(Context->Mdl);
-
 fail10:
     Error("Fail10\n");
-    MmUnmapIoSpace(Context->KernelVa, Context->NumberPages * PAGE_SIZE);
 
 fail9:
     Error("Fail9\n");
-    ASSERT(NT_SUCCESS(XENBUS_GNTTAB(UnmapForeignPages,
-                                    &Fdo->GnttabInterface,
-                                    Context->Address
-                                    )));
+    GnttabRevokePages(Fdo, Context);
 
 fail8:
     Error("Fail8\n");
 
 fail7:
     Error("Fail7\n");
-    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
     ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
 
 fail6:
@@ -652,12 +552,11 @@ fail1:
 }
 
 _IRQL_requires_max_(APC_LEVEL)
-DECLSPEC_NOINLINE
 VOID
-GnttabFreeMap(
+GnttabFreeGrant(
     __in     PXENIFACE_FDO            Fdo,
-    __inout  PXENIFACE_MAP_CONTEXT    Context
-    )
+    __inout  PXENIFACE_GRANT_CONTEXT  Context
+)
 {
     NTSTATUS status;
 
@@ -676,28 +575,15 @@ GnttabFreeMap(
             Error("failed to notify port %lu: 0x%x\n", Context->NotifyPort, status);
     }
 
-    // unmap from user address space
-    MmUnmapLockedPages(Context->UserVa, Context->Mdl);
-
-    IoFreeMdl(Context->Mdl);
-
-    // unmap from system space
-    MmUnmapIoSpace(Context->KernelVa, Context->NumberPages * PAGE_SIZE);
-
-    // undo mapping
-    status = XENBUS_GNTTAB(UnmapForeignPages,
-                           &Fdo->GnttabInterface,
-                           Context->Address);
-
-    ASSERT(NT_SUCCESS(status));
+    GnttabRevokePages(Fdo, Context);
 
-    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
     ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
 }
 
 DECLSPEC_NOINLINE
 NTSTATUS
-IoctlGnttabUnmapForeignPages(
+IoctlGnttabRevokeForeignAccess(
     __in  PXENIFACE_FDO     Fdo,
     __in  PVOID             Buffer,
     __in  ULONG             InLen,
@@ -705,19 +591,17 @@ IoctlGnttabUnmapForeignPages(
     )
 {
     NTSTATUS status;
-    PXENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN In = Buffer;
-    PXENIFACE_MAP_CONTEXT Context = NULL;
+    PXENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_IN In = Buffer;
+    PXENIFACE_GRANT_CONTEXT Context = NULL;
     XENIFACE_CONTEXT_ID Id;
     PIRP PendingIrp;
     PXENIFACE_CONTEXT_ID ContextId;
 
     status = STATUS_INVALID_BUFFER_SIZE;
-    if (InLen != sizeof(XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN) ||
-        OutLen != 0) {
+    if (InLen != sizeof(XENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_IN))
         goto fail1;
-    }
 
-    Id.Type = XENIFACE_CONTEXT_MAP;
+    Id.Type = XENIFACE_CONTEXT_GRANT;
     Id.Process = PsGetCurrentProcess();
     Id.RequestId = In->RequestId;
 
@@ -729,8 +613,8 @@ IoctlGnttabUnmapForeignPages(
         goto fail2;
 
     ContextId = PendingIrp->Tail.Overlay.DriverContext[0];
-    Context = CONTAINING_RECORD(ContextId, XENIFACE_MAP_CONTEXT, Id);
-    GnttabFreeMap(Fdo, Context);
+    Context = CONTAINING_RECORD(ContextId, XENIFACE_GRANT_CONTEXT, Id);
+    GnttabFreeGrant(Fdo, Context);
 
     PendingIrp->IoStatus.Status = STATUS_SUCCESS;
     PendingIrp->IoStatus.Information = 0;
@@ -745,3 +629,853 @@ fail1:
     Error("Fail1 (%08x)\n", status);
     return status;
 }
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabMapForeignPages(
+    __in     PXENIFACE_FDO     Fdo,
+    __in     PVOID             Buffer,
+    __in     ULONG             InLen,
+    __in     ULONG             OutLen,
+    __inout  PIRP              Irp
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN In = Buffer;
+    PXENIFACE_GNTTAB_MAP_FOREIGN_PAGES_OUT Out = Irp->UserBuffer;
+    ULONG NumberPages;
+    PXENIFACE_MAP_CONTEXT Context;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen < sizeof(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN) ||
+        OutLen != sizeof(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_OUT)) {
+        goto fail1;
+    }
+
+    // This IOCTL uses METHOD_NEITHER so we directly access user memory.
+
+    // Calculate the expected number of pages based on input buffer size.
+    NumberPages = (InLen - (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN, References)) / sizeof(In->References[0]);
+
+    status = __CaptureUserBuffer(Buffer, InLen, &In);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+    status = STATUS_INVALID_PARAMETER;
+    if (In->NumberPages == 0 ||
+        In->NumberPages > 1024 * 1024 ||
+        In->NumberPages != NumberPages) {
+        goto fail3;
+    }
+
+    if ((In->Flags & XENIFACE_GNTTAB_USE_NOTIFY_OFFSET) &&
+        (In->NotifyOffset >= In->NumberPages * PAGE_SIZE)) {
+        goto fail4;
+    }
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_IN, References[In->NumberPages]))
+        goto fail5;
+
+    status = STATUS_NO_MEMORY;
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_MAP_CONTEXT), XENIFACE_POOL_TAG);
+    if (Context == NULL)
+        goto fail6;
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    Context->Id.Type = XENIFACE_CONTEXT_MAP;
+    Context->Id.Process = PsGetCurrentProcess();
+    Context->Id.RequestId = In->RequestId;
+    Context->RemoteDomain = In->RemoteDomain;
+    Context->NumberPages = In->NumberPages;
+    Context->Flags = In->Flags;
+    Context->NotifyOffset = In->NotifyOffset;
+    Context->NotifyPort = In->NotifyPort;
+
+    Trace("> RemoteDomain %d, NumberPages %lu, Flags 0x%x, Offset 0x%x, Port %d, Process %p, Id %lu\n",
+                       Context->RemoteDomain, Context->NumberPages, Context->Flags, Context->NotifyOffset, Context->NotifyPort,
+                       Context->Id.Process, Context->Id.RequestId);
+
+    status = STATUS_INVALID_PARAMETER;
+    if (FindGnttabIrp(Fdo, &Context->Id) != NULL)
+        goto fail7;
+
+    status = GnttabMapPages(Fdo, Context, In->References);
+    if (!NT_SUCCESS(status))
+        goto fail8;
+
+    Trace("< Context %p, Irp %p, Address %p, KernelVa %p, UserVa %p\n",
+                       Context, Irp, Context->Address, Context->KernelVa, Context->UserVa);
+
+    // Pass the result to user mode.
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+    try {
+        ProbeForWrite(Out, OutLen, 1);
+        Out->Address = Context->UserVa;
+    } except(EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        Error("Exception 0x%lx while probing/writing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
+        goto fail9;
+    }
+
+    // Insert the IRP/context into the pending queue.
+    // This also checks (again) if the request ID is unique for the calling process.
+    Irp->Tail.Overlay.DriverContext[0] = &Context->Id;
+    status = IoCsqInsertIrpEx(&Fdo->IrpQueue, Irp, NULL, &Context->Id);
+    if (!NT_SUCCESS(status))
+        goto fail10;
+
+    __FreeCapturedBuffer(In);
+
+    return STATUS_PENDING;
+
+fail10:
+    Error("Fail10\n");
+
+fail9:
+    Error("Fail9\n");
+    GnttabUnmapPages(Fdo, Context);
+
+fail8:
+    Error("Fail8\n");
+
+fail7:
+    Error("Fail7\n");
+    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+
+fail6:
+    Error("Fail6\n");
+
+fail5:
+    Error("Fail5\n");
+
+fail4:
+    Error("Fail4\n");
+
+fail3:
+    Error("Fail3\n");
+    __FreeCapturedBuffer(In);
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+_IRQL_requires_max_(APC_LEVEL)
+DECLSPEC_NOINLINE
+VOID
+GnttabFreeMap(
+    __in     PXENIFACE_FDO            Fdo,
+    __inout  PXENIFACE_MAP_CONTEXT    Context
+    )
+{
+    NTSTATUS status;
+
+    ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+    Trace("Context %p\n", Context);
+
+    if (Context->Flags & XENIFACE_GNTTAB_USE_NOTIFY_OFFSET) {
+        ((PCHAR)Context->KernelVa)[Context->NotifyOffset] = 0;
+    }
+
+    if (Context->Flags & XENIFACE_GNTTAB_USE_NOTIFY_PORT) {
+        status = EvtchnNotify(Fdo, Context->NotifyPort, NULL);
+
+        if (!NT_SUCCESS(status)) // non-fatal, we must free memory
+            Error("failed to notify port %lu: 0x%x\n", Context->NotifyPort, status);
+    }
+
+    GnttabUnmapPages(Fdo, Context);
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabUnmapForeignPages(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN In = Buffer;
+    PXENIFACE_MAP_CONTEXT Context = NULL;
+    XENIFACE_CONTEXT_ID Id;
+    PIRP PendingIrp;
+    PXENIFACE_CONTEXT_ID ContextId;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != sizeof(XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_IN) ||
+        OutLen != 0) {
+        goto fail1;
+    }
+
+    Id.Type = XENIFACE_CONTEXT_MAP;
+    Id.Process = PsGetCurrentProcess();
+    Id.RequestId = In->RequestId;
+
+    Trace("> Process %p, Id %lu\n", Id.Process, Id.RequestId);
+
+    status = STATUS_NOT_FOUND;
+    PendingIrp = IoCsqRemoveNextIrp(&Fdo->IrpQueue, &Id);
+    if (PendingIrp == NULL)
+        goto fail2;
+
+    ContextId = PendingIrp->Tail.Overlay.DriverContext[0];
+    Context = CONTAINING_RECORD(ContextId, XENIFACE_MAP_CONTEXT, Id);
+    GnttabFreeMap(Fdo, Context);
+
+    PendingIrp->IoStatus.Status = STATUS_SUCCESS;
+    PendingIrp->IoStatus.Information = 0;
+    IoCompleteRequest(PendingIrp, IO_NO_INCREMENT);
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+static FORCEINLINE PLIST_ENTRY
+__GnttabRegionBucket(
+    __in  PXENIFACE_FDO Fdo,
+    __in  ULONG         RequestId
+    )
+{
+    return &Fdo->GnttabRegionList[RequestId % XENIFACE_GNTTAB_BUCKET_COUNT];
+}
+
+_Requires_lock_held_(Fdo->GnttabRegionLock)
+static PXENIFACE_REGION
+GnttabFindRegion(
+    __in  PXENIFACE_FDO         Fdo,
+    __in  XENIFACE_CONTEXT_TYPE Type,
+    __in  ULONG                 RequestId,
+    __in  PVOID                 FileObject
+    )
+{
+    PLIST_ENTRY Head = __GnttabRegionBucket(Fdo, RequestId);
+    PLIST_ENTRY Node;
+    PXENIFACE_REGION Region;
+
+    for (Node = Head->Flink; Node != Head; Node = Node->Flink) {
+        Region = CONTAINING_RECORD(Node, XENIFACE_REGION, Entry);
+
+        if (Region->Id->Type == Type &&
+            Region->Id->RequestId == RequestId &&
+            Region->FileObject == FileObject)
+            return Region;
+    }
+
+    return NULL;
+}
+
+// Publish a region, unless its request ID is already in use on the same handle.
+_Requires_lock_not_held_(Fdo->GnttabRegionLock)
+static NTSTATUS
+GnttabInsertRegion(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PXENIFACE_REGION  Region
+    )
+{
+    NTSTATUS status;
+    KIRQL Irql;
+
+    KeAcquireSpinLock(&Fdo->GnttabRegionLock, &Irql);
+
+    status = STATUS_INVALID_PARAMETER;
+    if (GnttabFindRegion(Fdo, Region->Id->Type, Region->Id->RequestId, Region->FileObject) != NULL)
+        goto fail1;
+
+    InsertTailList(__GnttabRegionBucket(Fdo, Region->Id->RequestId), &Region->Entry);
+
+    KeReleaseSpinLock(&Fdo->GnttabRegionLock, Irql);
+
+    return STATUS_SUCCESS;
+
+fail1:
+    KeReleaseSpinLock(&Fdo->GnttabRegionLock, Irql);
+
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+// Free a region that has already been unlinked from the FDO.
+_IRQL_requires_(PASSIVE_LEVEL)
+static VOID
+GnttabReleaseRegion(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PXENIFACE_REGION  Region
+    )
+{
+    PEPROCESS Process = Region->Id->Process;
+
+    GnttabFreeContext(Fdo, Region->Id);
+    ObDereferenceObject(Process);
+}
+
+// Check a batch of region descriptions and count their pages.
+static NTSTATUS
+GnttabCheckBatch(
+    __in  PXENIFACE_GNTTAB_BATCH_IN In,
+    __in  ULONG                     InLen,
+    __out PULONG                    NumberPages
+    )
+{
+    PXENIFACE_GNTTAB_BATCH_ENTRY Entry;
+    ULONG Index;
+
+    if (In->NumberEntries == 0 ||
+        In->NumberEntries > XENIFACE_GNTTAB_BATCH_MAX_ENTRIES ||
+        InLen < (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[In->NumberEntries])) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *NumberPages = 0;
+
+    for (Index = 0; Index < In->NumberEntries; Index++) {
+        Entry = &In->Entries[Index];
+
+        if (Entry->NumberPages == 0 ||
+            Entry->NumberPages > 1024 * 1024) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if ((Entry->Flags & XENIFACE_GNTTAB_USE_NOTIFY_OFFSET) &&
+            (Entry->NotifyOffset >= Entry->NumberPages * PAGE_SIZE)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        // Bounding the total also keeps the buffer size calculations from overflowing.
+        *NumberPages += Entry->NumberPages;
+        if (*NumberPages > 1024 * 1024)
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Grant one region of a batch. The address and grant references are written
+// to user mode before the region is published, so that it cannot be revoked
+// from under us.
+_IRQL_requires_(PASSIVE_LEVEL)
+static NTSTATUS
+GnttabPermitRegion(
+    __in  PXENIFACE_FDO                 Fdo,
+    __in  PXENIFACE_GNTTAB_BATCH_ENTRY  Entry,
+    __in  PFILE_OBJECT                  FileObject,
+    __out PXENIFACE_GNTTAB_BATCH_RESULT Result,
+    __out PULONG                        References
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_GRANT_CONTEXT Context;
+    ULONG Page;
+
+    status = STATUS_NO_MEMORY;
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_GRANT_CONTEXT), XENIFACE_POOL_TAG);
+    if (Context == NULL)
+        goto fail1;
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
+    Context->Id.Type = XENIFACE_CONTEXT_GRANT;
+    Context->Id.Process = PsGetCurrentProcess();
+    Context->Id.RequestId = Entry->RequestId;
+    Context->Region.FileObject = FileObject;
+    Context->Region.Id = &Context->Id;
+    Context->RemoteDomain = Entry->RemoteDomain;
+    Context->NumberPages = Entry->NumberPages;
+    Context->Flags = Entry->Flags;
+    Context->NotifyOffset = Entry->NotifyOffset;
+    Context->NotifyPort = Entry->NotifyPort;
+
+    // The region can outlive the request, keep the process around until it is freed
+    ObReferenceObject(Context->Id.Process);
+
+    status = GnttabPermitPages(Fdo, Context);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+    try {
+        Result->Address = Context->UserVa;
+
+        for (Page = 0; Page < Context->NumberPages; Page++) {
+            References[Page] = XENBUS_GNTTAB(GetReference,
+                                             &Fdo->GnttabInterface,
+                                             Context->Grants[Page]);
+        }
+    } except(EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        goto fail3;
+    }
+
+    status = GnttabInsertRegion(Fdo, &Context->Region);
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
+    return STATUS_SUCCESS;
+
+fail4:
+    Error("Fail4\n");
+
+fail3:
+    Error("Fail3\n");
+    GnttabRevokePages(Fdo, Context);
+
+fail2:
+    Error("Fail2\n");
+    ObDereferenceObject(Context->Id.Process);
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_GRANT_CONTEXT));
+    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+// Map one region of a batch. As for grants, the address is written to user
+// mode before the region is published.
+_IRQL_requires_(PASSIVE_LEVEL)
+static NTSTATUS
+GnttabMapRegion(
+    __in  PXENIFACE_FDO                 Fdo,
+    __in  PXENIFACE_GNTTAB_BATCH_ENTRY  Entry,
+    __in  PULONG                        References,
+    __in  PFILE_OBJECT                  FileObject,
+    __out PXENIFACE_GNTTAB_BATCH_RESULT Result
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_MAP_CONTEXT Context;
+
+    status = STATUS_NO_MEMORY;
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_MAP_CONTEXT), XENIFACE_POOL_TAG);
+    if (Context == NULL)
+        goto fail1;
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    Context->Id.Type = XENIFACE_CONTEXT_MAP;
+    Context->Id.Process = PsGetCurrentProcess();
+    Context->Id.RequestId = Entry->RequestId;
+    Context->Region.FileObject = FileObject;
+    Context->Region.Id = &Context->Id;
+    Context->RemoteDomain = Entry->RemoteDomain;
+    Context->NumberPages = Entry->NumberPages;
+    Context->Flags = Entry->Flags;
+    Context->NotifyOffset = Entry->NotifyOffset;
+    Context->NotifyPort = Entry->NotifyPort;
+
+    ObReferenceObject(Context->Id.Process);
+
+    status = GnttabMapPages(Fdo, Context, References);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+    try {
+        Result->Address = Context->UserVa;
+    } except(EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        goto fail3;
+    }
+
+    status = GnttabInsertRegion(Fdo, &Context->Region);
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
+    return STATUS_SUCCESS;
+
+fail4:
+    Error("Fail4\n");
+
+fail3:
+    Error("Fail3\n");
+    GnttabUnmapPages(Fdo, Context);
+
+fail2:
+    Error("Fail2\n");
+    ObDereferenceObject(Context->Id.Process);
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_MAP_CONTEXT));
+    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabPermitForeignAccessBatch(
+    __in     PXENIFACE_FDO     Fdo,
+    __in     PVOID             Buffer,
+    __in     ULONG             InLen,
+    __in     ULONG             OutLen,
+    __inout  PIRP              Irp
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_GNTTAB_BATCH_IN In;
+    PXENIFACE_GNTTAB_BATCH_OUT Out = Irp->UserBuffer;
+    PFILE_OBJECT FileObject = IoGetCurrentIrpStackLocation(Irp)->FileObject;
+    PXENIFACE_GNTTAB_BATCH_ENTRY Entry;
+    PULONG References;
+    ULONG NumberPages;
+    ULONG Index;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen < (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[1]) ||
+        InLen > (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[XENIFACE_GNTTAB_BATCH_MAX_ENTRIES])) {
+        goto fail1;
+    }
+
+    // This IOCTL uses METHOD_NEITHER so we directly access user memory.
+    status = __CaptureUserBuffer(Buffer, InLen, &In);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+    status = GnttabCheckBatch(In, InLen, &NumberPages);
+    if (!NT_SUCCESS(status))
+        goto fail3;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[In->NumberEntries]) ||
+        OutLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_OUT, Results[In->NumberEntries]) + NumberPages * sizeof(ULONG)) {
+        goto fail4;
+    }
+
+    // Probe the output before setting anything up; faults after this point
+    // only happen if user mode frees the buffer from under us.
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+    try {
+        ProbeForWrite(Out, OutLen, 1);
+    } except(EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        Error("Exception 0x%lx while probing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
+        goto fail5;
+    }
+
+    Trace("> Process %p, FileObject %p, NumberEntries %lu, NumberPages %lu\n",
+          PsGetCurrentProcess(), FileObject, In->NumberEntries, NumberPages);
+
+    References = (PULONG)&Out->Results[In->NumberEntries];
+
+    for (Index = 0; Index < In->NumberEntries; Index++) {
+        Entry = &In->Entries[Index];
+
+        status = GnttabPermitRegion(Fdo, Entry, FileObject, &Out->Results[Index], References);
+
+        // Regions granted so far stay in place if this faults; they can be
+        // revoked by ID and are freed when the handle is closed anyway.
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+        try {
+            Out->Results[Index].Status = status;
+
+            if (!NT_SUCCESS(status)) {
+                Out->Results[Index].Address = NULL;
+                RtlZeroMemory(References, Entry->NumberPages * sizeof(ULONG));
+            }
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            status = GetExceptionCode();
+            Error("Exception 0x%lx while writing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
+            goto fail6;
+        }
+
+        References += Entry->NumberPages;
+    }
+
+    Trace("<\n");
+
+    __FreeCapturedBuffer(In);
+
+    Irp->IoStatus.Information = OutLen;
+    return STATUS_SUCCESS;
+
+fail6:
+    Error("Fail6\n");
+
+fail5:
+    Error("Fail5\n");
+
+fail4:
+    Error("Fail4\n");
+
+fail3:
+    Error("Fail3\n");
+    __FreeCapturedBuffer(In);
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabMapForeignPagesBatch(
+    __in     PXENIFACE_FDO     Fdo,
+    __in     PVOID             Buffer,
+    __in     ULONG             InLen,
+    __in     ULONG             OutLen,
+    __inout  PIRP              Irp
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_GNTTAB_BATCH_IN In;
+    PXENIFACE_GNTTAB_BATCH_OUT Out = Irp->UserBuffer;
+    PFILE_OBJECT FileObject = IoGetCurrentIrpStackLocation(Irp)->FileObject;
+    PXENIFACE_GNTTAB_BATCH_ENTRY Entry;
+    PULONG References;
+    ULONG NumberPages;
+    ULONG Index;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen < (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[1]) ||
+        InLen > (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[XENIFACE_GNTTAB_BATCH_MAX_ENTRIES]) + 1024 * 1024 * sizeof(ULONG)) {
+        goto fail1;
+    }
+
+    // This IOCTL uses METHOD_NEITHER so we directly access user memory.
+    status = __CaptureUserBuffer(Buffer, InLen, &In);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+    status = GnttabCheckBatch(In, InLen, &NumberPages);
+    if (!NT_SUCCESS(status))
+        goto fail3;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_IN, Entries[In->NumberEntries]) + NumberPages * sizeof(ULONG) ||
+        OutLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_BATCH_OUT, Results[In->NumberEntries])) {
+        goto fail4;
+    }
+
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+    try {
+        ProbeForWrite(Out, OutLen, 1);
+    } except(EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        Error("Exception 0x%lx while probing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
+        goto fail5;
+    }
+
+    Trace("> Process %p, FileObject %p, NumberEntries %lu, NumberPages %lu\n",
+          PsGetCurrentProcess(), FileObject, In->NumberEntries, NumberPages);
+
+    References = (PULONG)&In->Entries[In->NumberEntries];
+
+    for (Index = 0; Index < In->NumberEntries; Index++) {
+        Entry = &In->Entries[Index];
+
+        status = GnttabMapRegion(Fdo, Entry, References, FileObject, &Out->Results[Index]);
+
+        // Regions mapped so far stay in place if this faults; they can be
+        // unmapped by ID and are freed when the handle is closed anyway.
+#pragma prefast(suppress: 6320) // we want to catch all exceptions
+        try {
+            Out->Results[Index].Status = status;
+
+            if (!NT_SUCCESS(status))
+                Out->Results[Index].Address = NULL;
+        } except(EXCEPTION_EXECUTE_HANDLER) {
+            status = GetExceptionCode();
+            Error("Exception 0x%lx while writing output buffer at %p, size 0x%lx\n", status, Out, OutLen);
+            goto fail6;
+        }
+
+        References += Entry->NumberPages;
+    }
+
+    Trace("<\n");
+
+    __FreeCapturedBuffer(In);
+
+    Irp->IoStatus.Information = OutLen;
+    return STATUS_SUCCESS;
+
+fail6:
+    Error("Fail6\n");
+
+fail5:
+    Error("Fail5\n");
+
+fail4:
+    Error("Fail4\n");
+
+fail3:
+    Error("Fail3\n");
+    __FreeCapturedBuffer(In);
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+// Release a batch of regions by request ID. Input and output share the
+// system buffer: Status[Index] overlays RequestIds[Index - 1], which has
+// already been consumed by the time it is written.
+_IRQL_requires_(PASSIVE_LEVEL)
+static NTSTATUS
+GnttabReleaseBatch(
+    __in  PXENIFACE_FDO         Fdo,
+    __in  XENIFACE_CONTEXT_TYPE Type,
+    __in  PVOID                 Buffer,
+    __in  ULONG                 InLen,
+    __in  ULONG                 OutLen,
+    __in  PFILE_OBJECT          FileObject,
+    __out PULONG_PTR            Info
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_GNTTAB_RELEASE_BATCH_IN In = Buffer;
+    PLONG Out = Buffer;
+    PXENIFACE_REGION Region;
+    ULONG NumberEntries;
+    ULONG RequestId;
+    ULONG Index;
+    KIRQL Irql;
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen < (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_RELEASE_BATCH_IN, RequestIds[1]))
+        goto fail1;
+
+    NumberEntries = In->NumberEntries;
+
+    status = STATUS_INVALID_PARAMETER;
+    if (NumberEntries == 0 ||
+        NumberEntries > XENIFACE_GNTTAB_BATCH_MAX_ENTRIES) {
+        goto fail2;
+    }
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != (ULONG)FIELD_OFFSET(XENIFACE_GNTTAB_RELEASE_BATCH_IN, RequestIds[NumberEntries]) ||
+        OutLen != NumberEntries * sizeof(LONG)) {
+        goto fail3;
+    }
+
+    Trace("> Type %d, FileObject %p, NumberEntries %lu\n", Type, FileObject, NumberEntries);
+
+    for (Index = 0; Index < NumberEntries; Index++) {
+        RequestId = In->RequestIds[Index];
+
+        KeAcquireSpinLock(&Fdo->GnttabRegionLock, &Irql);
+
+        Region = GnttabFindRegion(Fdo, Type, RequestId, FileObject);
+        if (Region != NULL)
+            RemoveEntryList(&Region->Entry);
+
+        KeReleaseSpinLock(&Fdo->GnttabRegionLock, Irql);
+
+        if (Region == NULL) {
+            Out[Index] = STATUS_NOT_FOUND;
+            continue;
+        }
+
+        GnttabReleaseRegion(Fdo, Region);
+        Out[Index] = STATUS_SUCCESS;
+    }
+
+    *Info = OutLen;
+    return STATUS_SUCCESS;
+
+fail3:
+    Error("Fail3\n");
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabRevokeForeignAccessBatch(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    )
+{
+    return GnttabReleaseBatch(Fdo, XENIFACE_CONTEXT_GRANT, Buffer, InLen, OutLen, FileObject, Info);
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabUnmapForeignPagesBatch(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    )
+{
+    return GnttabReleaseBatch(Fdo, XENIFACE_CONTEXT_MAP, Buffer, InLen, OutLen, FileObject, Info);
+}
+
+// Free the persistent regions of a handle, or all of them if FileObject is NULL.
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+GnttabFreeRegions(
+    __in      PXENIFACE_FDO Fdo,
+    __in_opt  PFILE_OBJECT  FileObject
+    )
+{
+    PLIST_ENTRY Head;
+    PLIST_ENTRY Node;
+    PXENIFACE_REGION Region;
+    LIST_ENTRY ToFree;
+    ULONG Index;
+    KIRQL Irql;
+
+    InitializeListHead(&ToFree);
+    KeAcquireSpinLock(&Fdo->GnttabRegionLock, &Irql);
+    for (Index = 0; Index < XENIFACE_GNTTAB_BUCKET_COUNT; Index++) {
+        Head = &Fdo->GnttabRegionList[Index];
+
+        Node = Head->Flink;
+        while (Node != Head) {
+            Region = CONTAINING_RECORD(Node, XENIFACE_REGION, Entry);
+
+            Node = Node->Flink;
+            if (FileObject != NULL &&
+                Region->FileObject != FileObject)
+                continue;
+
+            RemoveEntryList(&Region->Entry);
+            // GnttabReleaseRegion requires PASSIVE_LEVEL and we're inside a lock
+            InsertTailList(&ToFree, &Region->Entry);
+        }
+    }
+    KeReleaseSpinLock(&Fdo->GnttabRegionLock, Irql);
+
+    while (!IsListEmpty(&ToFree)) {
+        Node = RemoveHeadList(&ToFree);
+        Region = CONTAINING_RECORD(Node, XENIFACE_REGION, Entry);
+
+        Trace("Region %p (Type %d, Id %lu)\n", Region, Region->Id->Type, Region->Id->RequestId);
+        GnttabReleaseRegion(Fdo, Region);
+    }
+}
@@ -66,3 +66,196 @@ fail1:
     Error("Fail1 (%08x)\n", status);
     return status;
 }
+
+_Requires_lock_held_(Fdo->SharedInfoLock)
+static PXENIFACE_TIME_CONTEXT
+SharedInfoFindTime(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PFILE_OBJECT      FileObject
+    )
+{
+    PLIST_ENTRY             Node;
+    PXENIFACE_TIME_CONTEXT  Context;
+
+    for (Node = Fdo->SharedInfoTimeList.Flink;
+         Node != &Fdo->SharedInfoTimeList;
+         Node = Node->Flink) {
+        Context = CONTAINING_RECORD(Node, XENIFACE_TIME_CONTEXT, Entry);
+
+        if (Context->FileObject == FileObject)
+            return Context;
+    }
+
+    return NULL;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+SharedInfoFreeTime(
+    __in     PXENIFACE_FDO Fdo,
+    __inout  PXENIFACE_TIME_CONTEXT Context
+    )
+{
+    KAPC_STATE ApcState;
+    BOOLEAN ChangeProcess;
+
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    Trace("Context %p, FO %p\n", Context, Context->FileObject);
+
+    // We are not guaranteed to be in the context of the process that
+    // mapped the page, but we need to be there to unmap it.
+    ChangeProcess = PsGetCurrentProcess() != Context->Process;
+    if (ChangeProcess)
+        KeStackAttachProcess(Context->Process, &ApcState);
+
+    MmUnmapLockedPages(Context->UserVa, Context->Mdl);
+
+    if (ChangeProcess)
+        KeUnstackDetachProcess(&ApcState);
+
+    IoFreeMdl(Context->Mdl);
+    XENBUS_SHARED_INFO(PutTimePage, &Fdo->SharedInfoInterface);
+    ObDereferenceObject(Context->Process);
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_TIME_CONTEXT));
+    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+}
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlSharedInfoMapTime(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    )
+{
+    NTSTATUS status;
+    PXENIFACE_SHAREDINFO_MAP_TIME_OUT Out = Buffer;
+    PXENIFACE_TIME_CONTEXT Context;
+    PVOID Page;
+    ULONG WallClockOffset;
+    ULONG NumberProcessors;
+    ULONG Length;
+    ULONG Index;
+    KIRQL Irql;
+
+    NumberProcessors = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    Length = FIELD_OFFSET(XENIFACE_SHAREDINFO_MAP_TIME_OUT, TimeInfoOffset) +
+             (NumberProcessors * sizeof(ULONG));
+
+    status = STATUS_INVALID_BUFFER_SIZE;
+    if (InLen != 0 || OutLen < Length)
+        goto fail1;
+
+    Trace("> FO %p\n", FileObject);
+
+    status = STATUS_NO_MEMORY;
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(XENIFACE_TIME_CONTEXT), XENIFACE_POOL_TAG);
+    if (Context == NULL)
+        goto fail2;
+
+    RtlZeroMemory(Context, sizeof(XENIFACE_TIME_CONTEXT));
+    Context->FileObject = FileObject;
+
+    status = XENBUS_SHARED_INFO(GetTimePage,
+                                &Fdo->SharedInfoInterface,
+                                &Page,
+                                &WallClockOffset);
+    if (!NT_SUCCESS(status))
+        goto fail3;
+
+    for (Index = 0; Index < NumberProcessors; Index++) {
+        status = XENBUS_SHARED_INFO(GetTimeInfoOffset,
+                                    &Fdo->SharedInfoInterface,
+                                    Index,
+                                    &Out->TimeInfoOffset[Index]);
+        if (!NT_SUCCESS(status))
+            goto fail4;
+    }
+
+    status = STATUS_NO_MEMORY;
+    Context->Mdl = IoAllocateMdl(Page, PAGE_SIZE, FALSE, FALSE, NULL);
+    if (Context->Mdl == NULL)
+        goto fail5;
+
+    MmBuildMdlForNonPagedPool(Context->Mdl);
+
+    // The page is shared with every other process that maps it, so user
+    // mode must never be able to write to it
+#pragma prefast(suppress:6320) // we want to catch all exceptions
+    __try {
+        Context->UserVa = MmMapLockedPagesSpecifyCache(Context->Mdl,
+                                                       UserMode,
+                                                       MmCached,
+                                                       NULL,
+                                                       FALSE,
+                                                       NormalPagePriority | MdlMappingNoWrite);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        goto fail6;
+    }
+
+    status = STATUS_UNSUCCESSFUL;
+    if (Context->UserVa == NULL)
+        goto fail7;
+
+    Context->Process = PsGetCurrentProcess();
+    ObReferenceObject(Context->Process);
+
+    KeAcquireSpinLock(&Fdo->SharedInfoLock, &Irql);
+
+    status = STATUS_INVALID_DEVICE_STATE;
+    if (SharedInfoFindTime(Fdo, FileObject) != NULL)
+        goto fail8;
+
+    InsertTailList(&Fdo->SharedInfoTimeList, &Context->Entry);
+
+    KeReleaseSpinLock(&Fdo->SharedInfoLock, Irql);
+
+    Out->Page = Context->UserVa;
+    Out->WallClockOffset = WallClockOffset;
+    Out->NumberProcessors = NumberProcessors;
+    *Info = Length;
+
+    Trace("< Context %p, UserVa %p\n", Context, Context->UserVa);
+
+    return STATUS_SUCCESS;
+
+fail8:
+    Error("Fail8\n");
+    KeReleaseSpinLock(&Fdo->SharedInfoLock, Irql);
+
+    ObDereferenceObject(Context->Process);
+    MmUnmapLockedPages(Context->UserVa, Context->Mdl);
+
+fail7:
+    Error("Fail7\n");
+
+fail6:
+    Error("Fail6\n");
+    IoFreeMdl(Context->Mdl);
+
+fail5:
+    Error("Fail5\n");
+
+fail4:
+    Error("Fail4\n");
+    XENBUS_SHARED_INFO(PutTimePage, &Fdo->SharedInfoInterface);
+
+fail3:
+    Error("Fail3\n");
+    RtlZeroMemory(Context, sizeof(XENIFACE_TIME_CONTEXT));
+    ExFreePoolWithTag(Context, XENIFACE_POOL_TAG);
+
+fail2:
+    Error("Fail2\n");
+
+fail1:
+    Error("Fail1 (%08x)\n", status);
+    return status;
+}
@@ -141,7 +141,7 @@ fail1:
     return status;
 }
 
-// Cleanup store watches and event channels, called on file object close.
+// Cleanup store watches, event channels, rings and mappings, called on file object close.
 _IRQL_requires_(PASSIVE_LEVEL) // EvtchnFree calls KeFlushQueuedDpcs
 VOID
 XenIfaceCleanup(
@@ -152,10 +152,16 @@ XenIfaceCleanup(
     PLIST_ENTRY Node;
     PXENIFACE_STORE_CONTEXT StoreContext;
     PXENIFACE_EVTCHN_CONTEXT EvtchnContext;
+    PXENIFACE_EVTCHN_RING_CONTEXT EvtchnRing;
     PXENIFACE_SUSPEND_CONTEXT SuspendContext;
+    PXENIFACE_TIME_CONTEXT TimeContext;
     KIRQL Irql;
     LIST_ENTRY ToFree;
 
+    // persistent grant/map regions (before the event channels their
+    // notifications may use are closed)
+    GnttabFreeRegions(Fdo, FileObject);
+
     // store watches
     InitializeListHead(&ToFree);
     KeAcquireSpinLock(&Fdo->StoreWatchLock, &Irql);
@@ -197,7 +203,7 @@ XenIfaceCleanup(
             continue;
 
         Trace("Evtchn context %p\n", EvtchnContext);
-        RemoveEntryList(&EvtchnContext->Entry);
+        EvtchnRemoveChannel(Fdo, EvtchnContext);
         // EvtchnFree requires PASSIVE_LEVEL and we're inside a lock
         InsertTailList(&ToFree, &EvtchnContext->Entry);
     }
@@ -211,6 +217,38 @@ XenIfaceCleanup(
         RemoveEntryList(&EvtchnContext->Entry);
         EvtchnFree(Fdo, EvtchnContext);
     }
+
+    // event channel rings (only once the channels using them are gone)
+    InitializeListHead(&ToFree);
+    KeAcquireSpinLock(&Fdo->EvtchnLock, &Irql);
+    Node = Fdo->EvtchnRingList.Flink;
+    while (Node->Flink != Fdo->EvtchnRingList.Flink) {
+        EvtchnRing = CONTAINING_RECORD(Node, XENIFACE_EVTCHN_RING_CONTEXT, Entry);
+
+        Node = Node->Flink;
+        if (FileObject != NULL &&
+            EvtchnRing->FileObject != FileObject)
+            continue;
+
+        Trace("Evtchn ring %p\n", EvtchnRing);
+        RemoveEntryList(&EvtchnRing->Entry);
+        // EvtchnRingFree requires PASSIVE_LEVEL and we're inside a lock
+        InsertTailList(&ToFree, &EvtchnRing->Entry);
+    }
+
+    if (FileObject == NULL)
+        EvtchnFreeTable(Fdo);
+
+    KeReleaseSpinLock(&Fdo->EvtchnLock, Irql);
+
+    Node = ToFree.Flink;
+    while (Node->Flink != ToFree.Flink) {
+        EvtchnRing = CONTAINING_RECORD(Node, XENIFACE_EVTCHN_RING_CONTEXT, Entry);
+        Node = Node->Flink;
+
+        RemoveEntryList(&EvtchnRing->Entry);
+        EvtchnRingFree(Fdo, EvtchnRing);
+    }
      
     // suspend events
     KeAcquireSpinLock(&Fdo->SuspendLock, &Irql);
@@ -228,6 +266,34 @@ XenIfaceCleanup(
         SuspendFreeEvent(Fdo, SuspendContext);
     }
     KeReleaseSpinLock(&Fdo->SuspendLock, Irql);
+
+    // time page mappings
+    InitializeListHead(&ToFree);
+    KeAcquireSpinLock(&Fdo->SharedInfoLock, &Irql);
+    Node = Fdo->SharedInfoTimeList.Flink;
+    while (Node->Flink != Fdo->SharedInfoTimeList.Flink) {
+        TimeContext = CONTAINING_RECORD(Node, XENIFACE_TIME_CONTEXT, Entry);
+
+        Node = Node->Flink;
+        if (FileObject != NULL &&
+            TimeContext->FileObject != FileObject)
+            continue;
+
+        Trace("Time context %p\n", TimeContext);
+        RemoveEntryList(&TimeContext->Entry);
+        // SharedInfoFreeTime requires PASSIVE_LEVEL and we're inside a lock
+        InsertTailList(&ToFree, &TimeContext->Entry);
+    }
+    KeReleaseSpinLock(&Fdo->SharedInfoLock, Irql);
+
+    Node = ToFree.Flink;
+    while (Node->Flink != ToFree.Flink) {
+        TimeContext = CONTAINING_RECORD(Node, XENIFACE_TIME_CONTEXT, Entry);
+        Node = Node->Flink;
+
+        RemoveEntryList(&TimeContext->Entry);
+        SharedInfoFreeTime(Fdo, TimeContext);
+    }
 }
 
 NTSTATUS
@@ -297,6 +363,10 @@ XenIfaceIoctl(
         status = IoctlEvtchnUnmask(Fdo, Buffer, InLen, OutLen, Stack->FileObject);
         break;
 
+    case IOCTL_XENIFACE_EVTCHN_RING_MAP:
+        status = IoctlEvtchnRingMap(Fdo, Buffer, InLen, OutLen, Stack->FileObject, &Irp->IoStatus.Information);
+        break;
+
         // gnttab
     case IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS: // this is a METHOD_NEITHER IOCTL
         status = IoctlGnttabPermitForeignAccess(Fdo, Stack->Parameters.DeviceIoControl.Type3InputBuffer, InLen, OutLen, Irp);
@@ -314,6 +384,22 @@ XenIfaceIoctl(
         status = IoctlGnttabUnmapForeignPages(Fdo, Buffer, InLen, OutLen);
         break;
 
+    case IOCTL_XENIFACE_GNTTAB_PERMIT_FOREIGN_ACCESS_BATCH: // this is a METHOD_NEITHER IOCTL
+        status = IoctlGnttabPermitForeignAccessBatch(Fdo, Stack->Parameters.DeviceIoControl.Type3InputBuffer, InLen, OutLen, Irp);
+        break;
+
+    case IOCTL_XENIFACE_GNTTAB_REVOKE_FOREIGN_ACCESS_BATCH:
+        status = IoctlGnttabRevokeForeignAccessBatch(Fdo, Buffer, InLen, OutLen, Stack->FileObject, &Irp->IoStatus.Information);
+        break;
+
+    case IOCTL_XENIFACE_GNTTAB_MAP_FOREIGN_PAGES_BATCH: // this is a METHOD_NEITHER IOCTL
+        status = IoctlGnttabMapForeignPagesBatch(Fdo, Stack->Parameters.DeviceIoControl.Type3InputBuffer, InLen, OutLen, Irp);
+        break;
+
+    case IOCTL_XENIFACE_GNTTAB_UNMAP_FOREIGN_PAGES_BATCH:
+        status = IoctlGnttabUnmapForeignPagesBatch(Fdo, Buffer, InLen, OutLen, Stack->FileObject, &Irp->IoStatus.Information);
+        break;
+
         // suspend
     case IOCTL_XENIFACE_SUSPEND_GET_COUNT:
         status = IoctlSuspendGetCount(Fdo, Buffer, InLen, OutLen, &Irp->IoStatus.Information);
@@ -332,6 +418,10 @@ XenIfaceIoctl(
         status = IoctlSharedInfoGetTime(Fdo, Buffer, InLen, OutLen, &Irp->IoStatus.Information);
         break;
 
+    case IOCTL_XENIFACE_SHAREDINFO_MAP_TIME:
+        status = IoctlSharedInfoMapTime(Fdo, Buffer, InLen, OutLen, Stack->FileObject, &Irp->IoStatus.Information);
+        break;
+
         // misc
     case IOCTL_XENIFACE_LOG:
         status = IoctlLog(Fdo, Buffer, InLen, OutLen);
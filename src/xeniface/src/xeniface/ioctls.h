@@ -46,6 +46,15 @@ typedef struct _XENIFACE_CONTEXT_ID {
     PEPROCESS              Process;
 } XENIFACE_CONTEXT_ID, *PXENIFACE_CONTEXT_ID;
 
+// Grant/map regions set up by the batch IOCTLs are not tied to a pending IRP.
+// They are hashed by request ID in the FDO and live until they are released
+// or the handle that created them is cleaned up.
+typedef struct _XENIFACE_REGION {
+    LIST_ENTRY             Entry;
+    PVOID                  FileObject;
+    PXENIFACE_CONTEXT_ID   Id;
+} XENIFACE_REGION, *PXENIFACE_REGION;
+
 typedef struct _XENIFACE_STORE_CONTEXT {
     LIST_ENTRY             Entry;
     PCHAR                  Path;
@@ -55,16 +64,44 @@ typedef struct _XENIFACE_STORE_CONTEXT {
     PVOID                  FileObject;
 } XENIFACE_STORE_CONTEXT, *PXENIFACE_STORE_CONTEXT;
 
-typedef struct _XENIFACE_EVTCHN_CONTEXT {
+typedef struct _XENIFACE_EVTCHN_RING_CONTEXT {
     LIST_ENTRY             Entry;
-    PXENBUS_EVTCHN_CHANNEL Channel;
-    ULONG                  LocalPort;
-    PKEVENT                Event;
+    SLIST_HEADER           PendingList;
     PXENIFACE_FDO          Fdo;
-    KDPC                   Dpc;
     PVOID                  FileObject;
+    PEPROCESS              Process;
+    PKEVENT                Event;
+    KSPIN_LOCK             Lock;
+    KDPC                   Dpc;
+    ULONG                  NumberPages;
+    ULONG                  Size;
+    ULONG                  Producer;
+    PXENIFACE_EVTCHN_RING  Shared;
+    PMDL                   Mdl;
+    PVOID                  UserVa;
+} XENIFACE_EVTCHN_RING_CONTEXT, *PXENIFACE_EVTCHN_RING_CONTEXT;
+
+typedef struct _XENIFACE_EVTCHN_CONTEXT {
+    LIST_ENTRY                    Entry;
+    PXENBUS_EVTCHN_CHANNEL        Channel;
+    ULONG                         LocalPort;
+    PKEVENT                       Event;
+    PXENIFACE_FDO                 Fdo;
+    KDPC                          Dpc;
+    PVOID                         FileObject;
+    PXENIFACE_EVTCHN_RING_CONTEXT Ring;
+    SLIST_ENTRY                   PendingEntry;
+    LONG                          Pending;
 } XENIFACE_EVTCHN_CONTEXT, *PXENIFACE_EVTCHN_CONTEXT;
 
+typedef struct _XENIFACE_TIME_CONTEXT {
+    LIST_ENTRY              Entry;
+    PVOID                   FileObject;
+    PEPROCESS               Process;
+    PMDL                    Mdl;
+    PVOID                   UserVa;
+} XENIFACE_TIME_CONTEXT, *PXENIFACE_TIME_CONTEXT;
+
 typedef struct _XENIFACE_SUSPEND_CONTEXT {
     LIST_ENTRY              Entry;
     PKEVENT                 Event;
@@ -73,7 +110,7 @@ typedef struct _XENIFACE_SUSPEND_CONTEXT {
 
 typedef struct _XENIFACE_GRANT_CONTEXT {
     XENIFACE_CONTEXT_ID        Id;
-    LIST_ENTRY                 Entry;
+    XENIFACE_REGION            Region;
     PXENBUS_GNTTAB_ENTRY       *Grants;
     USHORT                     RemoteDomain;
     ULONG                      NumberPages;
@@ -87,7 +124,7 @@ typedef struct _XENIFACE_GRANT_CONTEXT {
 
 typedef struct _XENIFACE_MAP_CONTEXT {
     XENIFACE_CONTEXT_ID        Id;
-    LIST_ENTRY                 Entry;
+    XENIFACE_REGION            Region;
     USHORT                     RemoteDomain;
     ULONG                      NumberPages;
     XENIFACE_GNTTAB_PAGE_FLAGS Flags;
@@ -251,6 +288,17 @@ IoctlEvtchnUnmask(
     __in  PFILE_OBJECT      FileObject
     );
 
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlEvtchnRingMap(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    );
+
 _Requires_lock_not_held_(Fdo->EvtchnLock)
 DECLSPEC_NOINLINE
 NTSTATUS
@@ -278,6 +326,26 @@ EvtchnFree(
     __inout  PXENIFACE_EVTCHN_CONTEXT Context
     );
 
+_Requires_exclusive_lock_held_(Fdo->EvtchnLock)
+VOID
+EvtchnRemoveChannel(
+    __in  PXENIFACE_FDO             Fdo,
+    __in  PXENIFACE_EVTCHN_CONTEXT  Context
+    );
+
+_Requires_exclusive_lock_held_(Fdo->EvtchnLock)
+VOID
+EvtchnFreeTable(
+    __in  PXENIFACE_FDO Fdo
+    );
+
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+EvtchnRingFree(
+    __in     PXENIFACE_FDO Fdo,
+    __inout  PXENIFACE_EVTCHN_RING_CONTEXT Ring
+    );
+
 DECLSPEC_NOINLINE
 NTSTATUS
 IoctlGnttabPermitForeignAccess(
@@ -336,6 +404,55 @@ IoctlGnttabUnmapForeignPages(
     __in  ULONG             OutLen
     );
 
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabPermitForeignAccessBatch(
+    __in     PXENIFACE_FDO     Fdo,
+    __in     PVOID             Buffer,
+    __in     ULONG             InLen,
+    __in     ULONG             OutLen,
+    __inout  PIRP              Irp
+    );
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabRevokeForeignAccessBatch(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    );
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabMapForeignPagesBatch(
+    __in     PXENIFACE_FDO     Fdo,
+    __in     PVOID             Buffer,
+    __in     ULONG             InLen,
+    __in     ULONG             OutLen,
+    __inout  PIRP              Irp
+    );
+
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlGnttabUnmapForeignPagesBatch(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    );
+
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+GnttabFreeRegions(
+    __in      PXENIFACE_FDO Fdo,
+    __in_opt  PFILE_OBJECT  FileObject
+    );
+
 _Acquires_exclusive_lock_(((PXENIFACE_FDO)Argument)->GnttabCacheLock)
 _IRQL_requires_(DISPATCH_LEVEL)
 VOID
@@ -420,6 +537,24 @@ IoctlSharedInfoGetTime(
     __out PULONG_PTR        Info
     );
 
+DECLSPEC_NOINLINE
+NTSTATUS
+IoctlSharedInfoMapTime(
+    __in  PXENIFACE_FDO     Fdo,
+    __in  PVOID             Buffer,
+    __in  ULONG             InLen,
+    __in  ULONG             OutLen,
+    __in  PFILE_OBJECT      FileObject,
+    __out PULONG_PTR        Info
+    );
+
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+SharedInfoFreeTime(
+    __in     PXENIFACE_FDO Fdo,
+    __inout  PXENIFACE_TIME_CONTEXT Context
+    );
+
 NTSTATUS
 IoctlLog(
     __in  PXENIFACE_FDO     Fdo,
@@ -219,7 +219,11 @@ struct _XENVIF_VIF_OFFLOAD_OPTIONS_V1 {
             USHORT  NeedChecksumValue:1;
             /*! Force segmentation of packets containing TCP large segments on receive side */
             USHORT  NeedLargePacketSplit:1;
-            USHORT  Reserved:6;
+            /*! Segment IPv4 packets containing UDP large datagrams */
+            USHORT  OffloadIpVersion4UdpLargePacket:1;
+            /*! Segment IPv6 packets containing UDP large datagrams */
+            USHORT  OffloadIpVersion6UdpLargePacket:1;
+            USHORT  Reserved:4;
         };
 
         /*! Raw representation */
@@ -550,7 +554,7 @@ typedef NTSTATUS
     \param Offset The offset of the packet data in the initial MDL
     \param Length The total length of the packet
     \param OffloadOptions The requested offload options for this packet
-    \param MaximumSegmentSize The TCP MSS (used only if OffloadOptions.OffloadIpVersion[4|6]LargePacket is set)
+    \param MaximumSegmentSize The TCP or UDP MSS (used only if OffloadOptions.OffloadIpVersion[4|6][Udp]LargePacket is set)
     \param TagControlInformation The VLAN TCI (used only if OffloadOptions.OffloadTagManipulation is set)
     \param Hash Hash information for the packet
     \param More A flag to indicate whether there will more packets queued with the same value of Hash
@@ -46,7 +46,8 @@
 typedef enum _XENBUS_SUSPEND_CALLBACK_TYPE {
     SUSPEND_CALLBACK_TYPE_INVALID = 0,
     SUSPEND_CALLBACK_EARLY,             /*!< Early */
-    SUSPEND_CALLBACK_LATE               /*!< Late */
+    SUSPEND_CALLBACK_LATE,              /*!< Late */
+    SUSPEND_CALLBACK_CONCURRENT         /*!< Concurrent (version 2 and later) */
 } XENBUS_SUSPEND_CALLBACK_TYPE, *PXENBUS_SUSPEND_CALLBACK_TYPE;
 
 /*! \typedef XENBUS_SUSPEND_CALLBACK
@@ -83,6 +84,11 @@ typedef VOID
     vCPUs corralled at the same IRQL as the callback. \a Early callback
     functions are always invoked with IRQL == HIGH_LEVEL and \a Late callback
     functions are always invoked with IRQL == DISPATCH_LEVEL
+
+    \a Concurrent callback functions are invoked with IRQL == DISPATCH_LEVEL
+    once all \a Late callback functions have returned, and before the
+    other vCPUs are released. They are shared out between all vCPUs, so
+    any number of them may be running at the same time.
 */  
 typedef VOID
 (*XENBUS_SUSPEND_FUNCTION)(
@@ -160,7 +166,24 @@ struct _XENBUS_SUSPEND_INTERFACE_V1 {
     XENBUS_SUSPEND_GET_COUNT    GetCount;
 };
 
-typedef struct _XENBUS_SUSPEND_INTERFACE_V1 XENBUS_SUSPEND_INTERFACE, *PXENBUS_SUSPEND_INTERFACE;
+/*! \struct _XENBUS_SUSPEND_INTERFACE_V2
+    \brief SUSPEND interface version 2
+
+    The methods are unchanged from version 1. \a Register additionally
+    accepts \a SUSPEND_CALLBACK_CONCURRENT.
+    \ingroup interfaces
+*/
+struct _XENBUS_SUSPEND_INTERFACE_V2 {
+    INTERFACE                   Interface;
+    XENBUS_SUSPEND_ACQUIRE      Acquire;
+    XENBUS_SUSPEND_RELEASE      Release;
+    XENBUS_SUSPEND_REGISTER     Register;
+    XENBUS_SUSPEND_DEREGISTER   Deregister;
+    XENBUS_SUSPEND_TRIGGER      Trigger;
+    XENBUS_SUSPEND_GET_COUNT    GetCount;
+};
+
+typedef struct _XENBUS_SUSPEND_INTERFACE_V2 XENBUS_SUSPEND_INTERFACE, *PXENBUS_SUSPEND_INTERFACE;
 
 /*! \def XENBUS_SUSPEND
     \brief Macro at assist in method invocation
@@ -171,7 +194,7 @@ typedef struct _XENBUS_SUSPEND_INTERFACE_V1 XENBUS_SUSPEND_INTERFACE, *PXENBUS_S
 #endif  // _WINDLL
 
 #define XENBUS_SUSPEND_INTERFACE_VERSION_MIN    1
-#define XENBUS_SUSPEND_INTERFACE_VERSION_MAX    1
+#define XENBUS_SUSPEND_INTERFACE_VERSION_MAX    2
 
 #endif  // _XENBUS_SUSPEND_INTERFACE_H
 
@@ -0,0 +1,104 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */
+
+/*! \file xenvbd_ioctls.h
+    \brief User-mode miniport IOCTL interfaces to the XENVBD driver
+
+    Requests are issued with IOCTL_SCSI_MINIPORT to the storage adapter.
+    The buffer starts with an SRB_IO_CONTROL header whose Signature is
+    XENVBD_IOCTL_SIGNATURE and whose ControlCode is one of the
+    XENVBD_IOCTL_* values below. The payload follows the header.
+*/
+
+#ifndef _XENVBD_IOCTLS_H_
+#define _XENVBD_IOCTLS_H_
+
+/*! \brief SRB_IO_CONTROL signature for XENVBD requests */
+#define XENVBD_IOCTL_SIGNATURE  "XENVBD  "
+
+/*! \brief Number of log2 buckets in a latency histogram
+
+    Bucket N counts completions taking [2^N, 2^(N+1)) microseconds,
+    except bucket 0 which also counts sub-microsecond completions and
+    the last bucket which also counts anything longer.
+*/
+#define XENVBD_LATENCY_BUCKETS  32
+
+/*! \brief Number of log2 buckets in the in-flight depth histogram
+
+    Bucket 0 counts submissions onto an empty ring, bucket N (N > 0)
+    counts submissions made while [2^(N-1), 2^N) requests were in flight.
+*/
+#define XENVBD_DEPTH_BUCKETS    16
+
+/*! \brief Operation classes tracked by the statistics */
+typedef enum _XENVBD_STATISTICS_OPERATION {
+    XENVBD_STATISTICS_READ = 0,     /*!< BLKIF_OP_READ */
+    XENVBD_STATISTICS_WRITE,        /*!< BLKIF_OP_WRITE */
+    XENVBD_STATISTICS_FLUSH,        /*!< BLKIF_OP_FLUSH_DISKCACHE or BLKIF_OP_WRITE_BARRIER */
+    XENVBD_STATISTICS_DISCARD,      /*!< BLKIF_OP_DISCARD */
+    XENVBD_STATISTICS_OPERATION_COUNT
+} XENVBD_STATISTICS_OPERATION, *PXENVBD_STATISTICS_OPERATION;
+
+/*! \brief Latency histograms for a single operation class */
+typedef struct _XENVBD_LATENCY {
+    ULONG64 Count;                              /*!< Number of samples */
+    ULONG64 TotalMicroseconds;                  /*!< Sum of all samples */
+    ULONG64 Buckets[XENVBD_LATENCY_BUCKETS];    /*!< Log2 histogram of samples */
+} XENVBD_LATENCY, *PXENVBD_LATENCY;
+
+/*! \brief Query I/O statistics for a single target
+
+    Input: XENVBD_STATISTICS, with TargetId set
+
+    Output: XENVBD_STATISTICS
+
+    Counters are cumulative from the time the target was created.
+*/
+#define XENVBD_IOCTL_QUERY_STATISTICS   0x00000001
+
+/*! \brief Payload for XENVBD_IOCTL_QUERY_STATISTICS */
+typedef struct _XENVBD_STATISTICS {
+    ULONG           TargetId;   /*!< Target to query (input) */
+    ULONG           Version;    /*!< Set to XENVBD_STATISTICS_VERSION (output) */
+
+    /*! Time from the blkif request being placed on the shared ring to its response */
+    XENVBD_LATENCY  Backend[XENVBD_STATISTICS_OPERATION_COUNT];
+    /*! Time from the SRB being queued to the target to its completion */
+    XENVBD_LATENCY  Total[XENVBD_STATISTICS_OPERATION_COUNT];
+    /*! Number of blkif requests in flight, sampled at each submission */
+    ULONG64         Depth[XENVBD_DEPTH_BUCKETS];
+} XENVBD_STATISTICS, *PXENVBD_STATISTICS;
+
+/*! \brief Current version of XENVBD_STATISTICS */
+#define XENVBD_STATISTICS_VERSION   1
+
+#endif // _XENVBD_IOCTLS_H_
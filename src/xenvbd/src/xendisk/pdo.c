@@ -490,16 +490,82 @@ fail1:
     return status;
 }
 
+// Large range lists are split so that several UNMAPs are in flight at once
+#define PDO_TRIM_RANGES_PER_SRB 256
+
+typedef struct _XENDISK_TRIM {
+    PXENDISK_PDO                Pdo;
+    PIRP                        Irp;
+    LONG                        References;
+    NTSTATUS                    Status;
+} XENDISK_TRIM, *PXENDISK_TRIM;
+
+typedef struct _XENDISK_TRIM_SRB {
+    PXENDISK_TRIM               Trim;
+    SCSI_REQUEST_BLOCK          Srb;
+    UNMAP_LIST_HEADER           Unmap;  // must be last, descriptors follow
+} XENDISK_TRIM_SRB, *PXENDISK_TRIM_SRB;
+
+static VOID
+PdoTrimRelease(
+    IN  PXENDISK_TRIM           Trim
+    )
+{
+    if (InterlockedDecrement(&Trim->References) != 0)
+        return;
+
+    (VOID) PdoCompleteIrp(Trim->Pdo, Trim->Irp, Trim->Status);
+    __PdoFree(Trim);
+}
+
+__drv_functionClass(IO_COMPLETION_ROUTINE)
+__drv_sameIRQL
 static NTSTATUS
-PdoSendTrimSynchronous(
+__PdoSendTrimSrb(
+    IN  PDEVICE_OBJECT          DeviceObject,
+    IN  PIRP                    Irp,
+    IN  PVOID                   Context
+    )
+{
+    PXENDISK_TRIM_SRB           TrimSrb = Context;
+    PXENDISK_TRIM               Trim = TrimSrb->Trim;
+    NTSTATUS                    status = Irp->IoStatus.Status;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    // the first failure is reported for the whole request
+    if (!NT_SUCCESS(status))
+        (VOID) InterlockedCompareExchange((PLONG)&Trim->Status,
+                                          status,
+                                          STATUS_SUCCESS);
+
+    if (Irp->MdlAddress) {
+        MmUnlockPages(Irp->MdlAddress);
+        IoFreeMdl(Irp->MdlAddress);
+    }
+
+    IoFreeIrp(Irp);
+    __PdoFree(TrimSrb);
+
+    PdoTrimRelease(Trim);
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static NTSTATUS
+PdoSendTrimSrb(
     IN  PXENDISK_PDO            Pdo,
+    IN  PXENDISK_TRIM           Trim,
     IN  PDEVICE_DATA_SET_RANGE  Ranges,
     IN  ULONG                   Count
     )
 {
-    SCSI_REQUEST_BLOCK          Srb;
+    PXENDISK_TRIM_SRB           TrimSrb;
+    PSCSI_REQUEST_BLOCK         Srb;
     PCDB                        Cdb;
     PUNMAP_LIST_HEADER          Unmap;
+    PIRP                        Irp;
+    PIO_STACK_LOCATION          Stack;
     ULONG                       Length;
     ULONG                       Index;
     NTSTATUS                    status;
@@ -508,25 +574,30 @@ PdoSendTrimSynchronous(
              (Count * sizeof(UNMAP_BLOCK_DESCRIPTOR));
 
     status = STATUS_NO_MEMORY;
-    Unmap = __PdoAllocate(Length);
-    if (Unmap == NULL)
+    TrimSrb = __PdoAllocate(FIELD_OFFSET(XENDISK_TRIM_SRB, Unmap) + Length);
+    if (TrimSrb == NULL)
         goto fail1;
 
-    RtlZeroMemory(&Srb, sizeof(SCSI_REQUEST_BLOCK));
-    Srb.Length = sizeof(SCSI_REQUEST_BLOCK);
-    Srb.SrbFlags = 0;
-    Srb.Function = SRB_FUNCTION_EXECUTE_SCSI;
-    Srb.DataBuffer = Unmap;
-    Srb.DataTransferLength = Length;
-    Srb.TimeOutValue = (ULONG)-1;
-    Srb.CdbLength = 10;
+    TrimSrb->Trim = Trim;
+    Srb = &TrimSrb->Srb;
+    Unmap = &TrimSrb->Unmap;
 
-    Cdb = (PCDB)&Srb.Cdb[0];
+    Srb->Length = sizeof(SCSI_REQUEST_BLOCK);
+    Srb->SrbFlags = 0;
+    Srb->Function = SRB_FUNCTION_EXECUTE_SCSI;
+    Srb->DataBuffer = Unmap;
+    Srb->DataTransferLength = Length;
+    Srb->TimeOutValue = (ULONG)-1;
+    Srb->CdbLength = 10;
+
+    Cdb = (PCDB)&Srb->Cdb[0];
     Cdb->UNMAP.OperationCode = SCSIOP_UNMAP;
-    *(PUSHORT)Cdb->UNMAP.AllocationLength = _byteswap_ushort((USHORT)Length);
+    // AllocationLength is at an odd offset in the CDB
+    Cdb->UNMAP.AllocationLength[0] = (UCHAR)(Length >> 8);
+    Cdb->UNMAP.AllocationLength[1] = (UCHAR)Length;
 
-	*(PUSHORT)Unmap->DataLength = _byteswap_ushort((USHORT)(Length - FIELD_OFFSET(UNMAP_LIST_HEADER, BlockDescrDataLength)));
-	*(PUSHORT)Unmap->BlockDescrDataLength = _byteswap_ushort((USHORT)(Length - FIELD_OFFSET(UNMAP_LIST_HEADER, Descriptors[0])));
+    *(PUSHORT)Unmap->DataLength = _byteswap_ushort((USHORT)(Length - FIELD_OFFSET(UNMAP_LIST_HEADER, BlockDescrDataLength)));
+    *(PUSHORT)Unmap->BlockDescrDataLength = _byteswap_ushort((USHORT)(Length - FIELD_OFFSET(UNMAP_LIST_HEADER, Descriptors[0])));
 
     for (Index = 0; Index < Count; ++Index) {
         PUNMAP_BLOCK_DESCRIPTOR Block = &Unmap->Descriptors[Index];
@@ -544,17 +615,61 @@ PdoSendTrimSynchronous(
         *(PULONG)Block->LbaCount = _byteswap_ulong(LengthInSectors);
     }
 
-    status = PdoSendAwaitSrb(Pdo, &Srb);
-    if (!NT_SUCCESS(status))
+    status = STATUS_NO_MEMORY;
+    Irp = IoAllocateIrp((CCHAR)(Pdo->LowerDeviceObject->StackSize + 1), FALSE);
+    if (Irp == NULL)
         goto fail2;
 
-    __PdoFree(Unmap);
-    return status;
+    Stack = IoGetNextIrpStackLocation(Irp);
+    Stack->MajorFunction = IRP_MJ_SCSI;
+    Stack->Parameters.Scsi.Srb = Srb;
+
+    IoSetCompletionRoutine(Irp,
+                           __PdoSendTrimSrb,
+                           TrimSrb,
+                           TRUE,
+                           TRUE,
+                           TRUE);
+
+    Irp->MdlAddress = IoAllocateMdl(Srb->DataBuffer,
+                                    Srb->DataTransferLength,
+                                    FALSE,
+                                    FALSE,
+                                    Irp);
+    if (Irp->MdlAddress == NULL)
+        goto fail3;
+
+#pragma warning(disable:6320)
+    try {
+        MmProbeAndLockPages(Irp->MdlAddress, KernelMode, IoWriteAccess);
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+
+        goto fail4;
+    }
+#pragma warning(default:6320)
+
+    Srb->OriginalRequest = Irp;
+
+    InterlockedIncrement(&Trim->References);
+    (VOID) IoCallDriver(Pdo->LowerDeviceObject, Irp);
+
+    return STATUS_SUCCESS;
+
+fail4:
+    Error("fail4\n");
+
+    IoFreeMdl(Irp->MdlAddress);
+
+fail3:
+    Error("fail3\n");
+
+    IoFreeIrp(Irp);
 
 fail2:
     Error("fail2\n");
 
-    __PdoFree(Unmap);
+    __PdoFree(TrimSrb);
 
 fail1:
     Error("fail1 (%08x)\n", status);
@@ -562,6 +677,58 @@ fail1:
     return status;
 }
 
+static NTSTATUS
+PdoSendTrim(
+    IN  PXENDISK_PDO            Pdo,
+    IN  PIRP                    Irp,
+    IN  PDEVICE_DATA_SET_RANGE  Ranges,
+    IN  ULONG                   Count
+    )
+{
+    PXENDISK_TRIM               Trim;
+    ULONG                       Index;
+    NTSTATUS                    status;
+
+    status = STATUS_NO_MEMORY;
+    Trim = __PdoAllocate(sizeof(XENDISK_TRIM));
+    if (Trim == NULL)
+        goto fail1;
+
+    Trim->Pdo = Pdo;
+    Trim->Irp = Irp;
+    Trim->Status = STATUS_SUCCESS;
+
+    // hold a reference while submitting so that the IRP cannot complete
+    // before the last UNMAP has been sent
+    Trim->References = 1;
+
+    IoMarkIrpPending(Irp);
+
+    Index = 0;
+    while (Index < Count) {
+        ULONG   Batch = __min(Count - Index, PDO_TRIM_RANGES_PER_SRB);
+
+        status = PdoSendTrimSrb(Pdo, Trim, &Ranges[Index], Batch);
+        if (!NT_SUCCESS(status)) {
+            (VOID) InterlockedCompareExchange((PLONG)&Trim->Status,
+                                              status,
+                                              STATUS_SUCCESS);
+            break;
+        }
+
+        Index += Batch;
+    }
+
+    PdoTrimRelease(Trim);
+
+    return STATUS_PENDING;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return PdoCompleteIrp(Pdo, Irp, status);
+}
+
 static const CHAR *
 PropertyIdName(
     IN  STORAGE_PROPERTY_ID Id
@@ -677,9 +844,7 @@ PdoManageDataSetAttributes(
         Ranges = (PDEVICE_DATA_SET_RANGE)((PUCHAR)Attributes + Attributes->DataSetRangesOffset);
         NumRanges = Attributes->DataSetRangesLength / sizeof(DEVICE_DATA_SET_RANGE);
 
-        status = PdoSendTrimSynchronous(Pdo, Ranges, NumRanges);
-
-        status = PdoCompleteIrp(Pdo, Irp, status);
+        status = PdoSendTrim(Pdo, Irp, Ranges, NumRanges);
         break;
 
     default:
@@ -93,6 +93,9 @@ struct _XENVBD_ADAPTER {
     ULONG                       BuildIo;
     ULONG                       StartIo;
     ULONG                       Completed;
+
+    ULONG                       PerfFlags;
+    ULONG                       ConcurrentChannels;
 };
 
 static FORCEINLINE PVOID
@@ -910,6 +913,11 @@ AdapterDebugCallback(
                  Adapter->BuildIo,
                  Adapter->StartIo,
                  Adapter->Completed);
+    XENBUS_DEBUG(Printf,
+                 &Adapter->DebugInterface,
+                 "ADAPTER: PerfFlags       : %08x (%u channels)\n",
+                 Adapter->PerfFlags,
+                 Adapter->ConcurrentChannels);
 }
 
 static NTSTATUS
@@ -1291,10 +1299,23 @@ AdapterInitialize(
     status = AdapterQueryInterface(Adapter,
                                    XENBUS_EVTCHN,
                                    &Adapter->EvtchnInterface,
-                                   FALSE);
+                                   TRUE);
     if (!NT_SUCCESS(status))
         goto fail2;
 
+    // Fall back to the previous version, without channel priorities,
+    // if XENBUS is older than this driver
+    if (Adapter->EvtchnInterface.Interface.Version == 0) {
+        status = __AdapterQueryInterface(Adapter,
+                                         &GUID_XENBUS_EVTCHN_INTERFACE,
+                                         8,
+                                         (PINTERFACE)&Adapter->EvtchnInterface,
+                                         sizeof (struct _XENBUS_EVTCHN_INTERFACE_V8),
+                                         FALSE);
+        if (!NT_SUCCESS(status))
+            goto fail2;
+    }
+
     status = AdapterQueryInterface(Adapter,
                                    XENBUS_GNTTAB,
                                    &Adapter->GnttabInterface,
@@ -1312,10 +1333,23 @@ AdapterInitialize(
     status = AdapterQueryInterface(Adapter,
                                    XENBUS_SUSPEND,
                                    &Adapter->SuspendInterface,
-                                   FALSE);
+                                   TRUE);
     if (!NT_SUCCESS(status))
         goto fail5;
 
+    // Fall back to the original version, without concurrent resume
+    // callbacks, if XENBUS is older than this driver
+    if (Adapter->SuspendInterface.Interface.Version == 0) {
+        status = __AdapterQueryInterface(Adapter,
+                                         &GUID_XENBUS_SUSPEND_INTERFACE,
+                                         XENBUS_SUSPEND_INTERFACE_VERSION_MIN,
+                                         (PINTERFACE)&Adapter->SuspendInterface,
+                                         sizeof (struct _XENBUS_SUSPEND_INTERFACE_V1),
+                                         FALSE);
+        if (!NT_SUCCESS(status))
+            goto fail5;
+    }
+
     status = AdapterQueryInterface(Adapter,
                                    XENBUS_DEBUG,
                                    &Adapter->DebugInterface,
@@ -1505,6 +1539,9 @@ AdapterTeardown(
     Adapter->StartIo                = 0;
     Adapter->Completed              = 0;
 
+    Adapter->PerfFlags              = 0;
+    Adapter->ConcurrentChannels     = 0;
+
     ASSERT(IsZeroMemory(Adapter, sizeof(XENVBD_ADAPTER)));
     Trace("<===== (%d)\n", KeGetCurrentIrql());
 }
@@ -1868,6 +1905,59 @@ AdapterHwResetBus(
     return TRUE;
 }
 
+// The payload layout is shared by 32-bit and 64-bit callers
+C_ASSERT(FIELD_OFFSET(XENVBD_STATISTICS, Backend) == 8);
+C_ASSERT(sizeof (XENVBD_STATISTICS) == 2312);
+
+static VOID
+AdapterSrbIoControl(
+    IN  PXENVBD_ADAPTER     Adapter,
+    IN  PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    PSRB_IO_CONTROL         IoControl = Srb->DataBuffer;
+    PXENVBD_STATISTICS      Statistics;
+    PXENVBD_TARGET          Target;
+
+    Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+
+    if (IoControl == NULL ||
+        Srb->DataTransferLength < sizeof(SRB_IO_CONTROL))
+        return;
+
+    if (RtlCompareMemory(IoControl->Signature,
+                         XENVBD_IOCTL_SIGNATURE,
+                         sizeof(IoControl->Signature)) != sizeof(IoControl->Signature))
+        return;
+
+    switch (IoControl->ControlCode) {
+    case XENVBD_IOCTL_QUERY_STATISTICS:
+        if (IoControl->Length < sizeof(XENVBD_STATISTICS) ||
+            Srb->DataTransferLength < sizeof(SRB_IO_CONTROL) + sizeof(XENVBD_STATISTICS))
+            break;
+
+        Statistics = (PXENVBD_STATISTICS)(IoControl + 1);
+        if (Statistics->TargetId >= XENVBD_MAX_TARGETS)
+            break;
+
+        Target = AdapterGetTarget(Adapter, Statistics->TargetId);
+        if (Target == NULL) {
+            Srb->SrbStatus = SRB_STATUS_NO_DEVICE;
+            break;
+        }
+
+        Statistics->Version = XENVBD_STATISTICS_VERSION;
+        TargetQueryStatistics(Target, Statistics);
+
+        IoControl->ReturnCode = 0;
+        Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        break;
+
+    default:
+        break;
+    }
+}
+
 static FORCEINLINE VOID
 __AdapterSrbPnp(
     IN  PXENVBD_ADAPTER         Adapter,
@@ -1941,6 +2031,10 @@ AdapterHwBuildIo(
         Srb->SrbStatus = SRB_STATUS_SUCCESS;
         break;
 
+    case SRB_FUNCTION_IO_CONTROL:
+        AdapterSrbIoControl(Adapter, Srb);
+        break;
+
     case SRB_FUNCTION_ABORT_COMMAND:
         Srb->SrbStatus = SRB_STATUS_ABORT_FAILED;
         break;
@@ -2132,6 +2226,50 @@ fail1:
     return FALSE;
 }
 
+static VOID
+AdapterInitializePerfOpts(
+    IN  PXENVBD_ADAPTER     Adapter
+    )
+{
+    PERF_CONFIGURATION_DATA Perf;
+    ULONG                   status;
+
+    RtlZeroMemory(&Perf, sizeof(Perf));
+    Perf.Version = STOR_PERF_VERSION;
+    Perf.Size = sizeof(Perf);
+
+    status = StorPortInitializePerfOpts(Adapter, TRUE, &Perf);
+    if (status != STOR_STATUS_SUCCESS)
+        goto fail1;
+
+    // Have StorPort queue each completion DPC on the CPU that submitted
+    // the SRB, and let HwStartIo run on all CPUs at once (the ring
+    // queues are individually locked)
+    Perf.Flags &= STOR_PERF_DPC_REDIRECTION |
+                  STOR_PERF_CONCURRENT_CHANNELS;
+    Perf.ConcurrentChannels = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    status = StorPortInitializePerfOpts(Adapter, FALSE, &Perf);
+    if (status != STOR_STATUS_SUCCESS)
+        goto fail2;
+
+    Adapter->PerfFlags = Perf.Flags;
+    Adapter->ConcurrentChannels = (Perf.Flags & STOR_PERF_CONCURRENT_CHANNELS) ?
+                                  Perf.ConcurrentChannels :
+                                  1;
+
+    Verbose("PerfFlags %08x (%u channels)\n",
+            Adapter->PerfFlags,
+            Adapter->ConcurrentChannels);
+    return;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+}
+
 HW_INITIALIZE   AdapterHwInitialize;
 
 BOOLEAN
@@ -2139,6 +2277,8 @@ AdapterHwInitialize(
     IN  PVOID   DevExt
     )
 {
+    AdapterInitializePerfOpts(DevExt);
+
     return StorPortEnablePassiveInitialization(DevExt,
                                                AdapterHwPassiveInitialize);
 }
@@ -1436,7 +1436,8 @@ FrontendSuspendCallback(
     Verbose("Target[%d] : ===> from %s\n", Frontend->TargetId, __XenvbdStateName(Frontend->State));
     State = Frontend->State;
 
-    // dont acquire state lock - called at DISPATCH on 1 vCPU with interrupts enabled
+    // dont acquire state lock - called at DISPATCH with interrupts enabled while the
+    // scheduler is stopped, and no other vCPU runs this frontend's callback
 #pragma warning(suppress: 26110) // warning C26110: Caller failing to hold lock <lock> before calling function <func>.
     status = __FrontendSetState(Frontend, XENVBD_CLOSED);
     if (!NT_SUCCESS(status)) {
@@ -1444,7 +1445,7 @@ FrontendSuspendCallback(
         ASSERT(FALSE);
     }
 
-    // dont acquire state lock - called at DISPATCH on 1 vCPU with interrupts enabled
+    // dont acquire state lock - as above
     status = __FrontendSetState(Frontend, State);
     if (!NT_SUCCESS(status)) {
         Error("Target[%d] : SetState %s (%08x)\n", Frontend->TargetId, __XenvbdStateName(State), status);
@@ -1561,8 +1562,11 @@ FrontendD3ToD0(
     if (!NT_SUCCESS(status))
         goto fail3;
 
+    // Targets reconnect in parallel after resume, where XENBUS allows
     status = XENBUS_SUSPEND(Register,
                             &Frontend->SuspendInterface,
+                            (Frontend->SuspendInterface.Interface.Version >= 2) ?
+                            SUSPEND_CALLBACK_CONCURRENT :
                             SUSPEND_CALLBACK_LATE,
                             FrontendSuspendCallback,
                             Frontend,
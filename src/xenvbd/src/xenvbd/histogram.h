@@ -0,0 +1,75 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _XENVBD_HISTOGRAM_H
+#define _XENVBD_HISTOGRAM_H
+
+#include <ntddk.h>
+#include <xenvbd_ioctls.h>
+
+// Log2 bucket of Value, with everything at or beyond the last bucket
+// folded into it
+static FORCEINLINE ULONG
+__HistogramBucket(
+    IN  ULONG64     Value,
+    IN  ULONG       Count
+    )
+{
+    ULONG           Index;
+
+    if (Value > MAXULONG)
+        return Count - 1;
+
+    if (!_BitScanReverse(&Index, (ULONG)Value))
+        return 0;
+
+    return __min(Index, Count - 1);
+}
+
+// See XENVBD_LATENCY_BUCKETS
+static FORCEINLINE ULONG
+HistogramLatencyBucket(
+    IN  ULONG64     Microseconds
+    )
+{
+    return __HistogramBucket(Microseconds, XENVBD_LATENCY_BUCKETS);
+}
+
+// See XENVBD_DEPTH_BUCKETS
+static FORCEINLINE ULONG
+HistogramDepthBucket(
+    IN  ULONG       Depth
+    )
+{
+    return __HistogramBucket((ULONG64)Depth << 1, XENVBD_DEPTH_BUCKETS);
+}
+
+#endif // _XENVBD_HISTOGRAM_H
@@ -48,6 +48,7 @@
 #include "driver.h"
 #include "granter.h"
 #include "queue.h"
+#include "histogram.h"
 
 #include "util.h"
 #include "debug.h"
@@ -98,8 +99,14 @@ struct _XENVBD_RING {
     ULONG                           BlkOpBarrier;
     ULONG                           BlkOpDiscard;
     ULONG                           BlkOpFlush;
+    ULONG                           BlkOpMerged;
     ULONG64                         SegsGranted;
     ULONG64                         SegsBounced;
+
+    LARGE_INTEGER                   Frequency;
+    XENVBD_LATENCY                  Backend[XENVBD_STATISTICS_OPERATION_COUNT];
+    XENVBD_LATENCY                  Total[XENVBD_STATISTICS_OPERATION_COUNT];
+    ULONG64                         Depth[XENVBD_DEPTH_BUCKETS];
 };
 
 #define MAX_NAME_LEN                64
@@ -140,6 +147,66 @@ xen_wmb()
     _WriteBarrier();
 }
 
+static FORCEINLINE XENVBD_STATISTICS_OPERATION
+__RingStatisticsOperation(
+    IN  UCHAR       Operation
+    )
+{
+    switch (Operation) {
+    case BLKIF_OP_READ:
+        return XENVBD_STATISTICS_READ;
+    case BLKIF_OP_WRITE:
+        return XENVBD_STATISTICS_WRITE;
+    case BLKIF_OP_WRITE_BARRIER:
+    case BLKIF_OP_FLUSH_DISKCACHE:
+        return XENVBD_STATISTICS_FLUSH;
+    case BLKIF_OP_DISCARD:
+    default:
+        return XENVBD_STATISTICS_DISCARD;
+    }
+}
+
+static FORCEINLINE VOID
+__RingSampleLatency(
+    IN  PXENVBD_RING    Ring,
+    IN  PXENVBD_LATENCY Latency,
+    IN  ULONG64         Start,
+    IN  ULONG64         End
+    )
+{
+    ULONG64             Microseconds;
+
+    if (Start == 0 || End < Start)
+        return;
+
+    Microseconds = ((End - Start) * 1000000ull) / Ring->Frequency.QuadPart;
+
+    InterlockedIncrement64((PLONG64)&Latency->Count);
+    InterlockedExchangeAdd64((PLONG64)&Latency->TotalMicroseconds,
+                             (LONG64)Microseconds);
+    InterlockedIncrement64((PLONG64)&Latency->Buckets[HistogramLatencyBucket(Microseconds)]);
+}
+
+static FORCEINLINE VOID
+__RingSampleDepth(
+    IN  PXENVBD_RING    Ring
+    )
+{
+    ULONG               Depth;
+
+    Depth = Ring->Front.req_prod_pvt - Ring->Front.rsp_cons;
+
+    InterlockedIncrement64((PLONG64)&Ring->Depth[HistogramDepthBucket(Depth)]);
+}
+
+static FORCEINLINE ULONG64
+__RingTimestamp(
+    VOID
+    )
+{
+    return (ULONG64)KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
 static FORCEINLINE VOID
 __RingInsert(
     IN  PXENVBD_RING        Ring,
@@ -387,12 +454,15 @@ RingPutRequest(
         RingPutIndirect(Ring, Indirect);
     }
 
+    ASSERT(IsListEmpty(&Request->Merged));
+
     Request->SrbExt = NULL;
     Request->Operation = 0;
     Request->Flags = 0;
     Request->NrSegments = 0;
     Request->FirstSector = 0;
     Request->NrSectors = 0;
+    Request->SubmitTime = 0;
     RtlZeroMemory(&Request->ListEntry, sizeof(LIST_ENTRY));
 
     XENBUS_CACHE(Put,
@@ -699,6 +769,8 @@ RingPrepareBlkifReadWrite(
     ASSERT3U(Request->NrSegments, >, 0);
     ASSERT3U(Request->NrSegments, <=, MaxSegments);
 
+    Request->NrSectors = *SectorsDone;
+
     return TRUE;
 
 fail2:
@@ -709,15 +781,26 @@ fail1:
 static BOOLEAN
 RingPrepareBlkifIndirect(
     IN  PXENVBD_RING    Ring,
-    IN  PXENVBD_REQUEST Request
+    IN  PXENVBD_REQUEST Request,
+    IN  ULONG           NrSegments
     )
 {
     ULONG               Index;
-    ULONG               NrSegments = 0;
+    ULONG               Existing;
+    ULONG               Capacity;
+    PLIST_ENTRY         ListEntry;
 
-    for (Index = 0;
+    // a merged request may already hold some indirect pages
+    Existing = 0;
+    for (ListEntry = Request->Indirects.Flink;
+         ListEntry != &Request->Indirects;
+         ListEntry = ListEntry->Flink)
+        ++Existing;
+    Capacity = Existing * XENVBD_MAX_SEGMENTS_PER_PAGE;
+
+    for (Index = Existing;
             Index < BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST &&
-            NrSegments < Request->NrSegments;
+            Capacity < NrSegments;
                 ++Index) {
         PXENVBD_INDIRECT    Indirect;
 
@@ -726,12 +809,21 @@ RingPrepareBlkifIndirect(
             goto fail1;
         InsertTailList(&Request->Indirects, &Indirect->ListEntry);
 
-        NrSegments += XENVBD_MAX_SEGMENTS_PER_PAGE;
+        Capacity += XENVBD_MAX_SEGMENTS_PER_PAGE;
     }
 
     return TRUE;
 
 fail1:
+    // give back the pages added here, a merge tail keeps the ones it had
+    while (Index-- > Existing) {
+        PXENVBD_INDIRECT    Indirect;
+
+        ListEntry = RemoveTailList(&Request->Indirects);
+        Indirect = CONTAINING_RECORD(ListEntry, XENVBD_INDIRECT, ListEntry);
+        RingPutIndirect(Ring, Indirect);
+    }
+
     return FALSE;
 }
 
@@ -753,6 +845,85 @@ RingUseIndirect(
     return MaxIndirectSegs;
 }
 
+static FORCEINLINE ULONG
+RingMaxMergeSegments(
+    IN  PXENVBD_RING    Ring
+    )
+{
+    const ULONG MaxIndirectSegs = FrontendGetFeatures(Ring->Frontend)->Indirect;
+
+    if (MaxIndirectSegs <= BLKIF_MAX_SEGMENTS_PER_REQUEST)
+        return BLKIF_MAX_SEGMENTS_PER_REQUEST; // not supported
+
+    return __min(MaxIndirectSegs,
+                 BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST * XENVBD_MAX_SEGMENTS_PER_PAGE);
+}
+
+static BOOLEAN
+RingMergeRequest(
+    IN  PXENVBD_RING    Ring,
+    IN  PXENVBD_REQUEST Request
+    )
+{
+    PXENVBD_QUEUE       Queue = &Ring->PreparedReqs;
+    PXENVBD_REQUEST     Tail;
+    ULONG               NrSegments;
+    BOOLEAN             Merged;
+    KIRQL               Irql;
+
+    if (Request->Operation != BLKIF_OP_READ &&
+        Request->Operation != BLKIF_OP_WRITE)
+        return FALSE;
+
+    Merged = FALSE;
+
+    // Only the tail of the prepared queue is considered, so a request is
+    // never moved ahead of a barrier, flush or discard queued before it.
+    // The queue lock is held across the merge so the tail cannot be
+    // submitted while its segments are being extended.
+    KeAcquireSpinLock(&Queue->Lock, &Irql);
+
+    if (IsListEmpty(&Queue->List))
+        goto done;
+
+    Tail = CONTAINING_RECORD(Queue->List.Blink, XENVBD_REQUEST, ListEntry);
+
+    if (Tail->Operation != Request->Operation ||
+        Tail->FirstSector + Tail->NrSectors != Request->FirstSector)
+        goto done;
+
+    NrSegments = Tail->NrSegments + Request->NrSegments;
+    if (NrSegments > RingMaxMergeSegments(Ring))
+        goto done;
+
+    if (NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST &&
+        !RingPrepareBlkifIndirect(Ring, Tail, NrSegments))
+        goto done;
+
+    for (;;) {
+        PLIST_ENTRY     ListEntry;
+
+        ListEntry = RemoveHeadList(&Request->Segments);
+        if (ListEntry == &Request->Segments)
+            break;
+        InsertTailList(&Tail->Segments, ListEntry);
+    }
+
+    Tail->NrSegments = (USHORT)NrSegments;
+    Tail->NrSectors += Request->NrSectors;
+    Request->NrSegments = 0;
+
+    // Request keeps its reference on the SRB and is completed with Tail
+    InsertTailList(&Tail->Merged, &Request->ListEntry);
+    ++Ring->BlkOpMerged;
+    Merged = TRUE;
+
+done:
+    KeReleaseSpinLock(&Queue->Lock, Irql);
+
+    return Merged;
+}
+
 static FORCEINLINE VOID
 RingQueueRequestList(
     IN  PXENVBD_RING    Ring,
@@ -768,6 +939,9 @@ RingQueueRequestList(
             break;
 
         Request = CONTAINING_RECORD(ListEntry, XENVBD_REQUEST, ListEntry);
+        if (RingMergeRequest(Ring, Request))
+            continue;
+
         __RingIncBlkifOpCount(Ring, Request);
         QueueAppend(&Ring->PreparedReqs, &Request->ListEntry);
     }
@@ -788,6 +962,18 @@ RingCancelRequestList(
             break;
 
         Request = CONTAINING_RECORD(ListEntry, XENVBD_REQUEST, ListEntry);
+
+        for (;;) {
+            PXENVBD_REQUEST Merged;
+
+            ListEntry = RemoveHeadList(&Request->Merged);
+            if (ListEntry == &Request->Merged)
+                break;
+
+            Merged = CONTAINING_RECORD(ListEntry, XENVBD_REQUEST, ListEntry);
+            RingPutRequest(Ring, Merged);
+        }
+
         RingPutRequest(Ring, Request);
     }
 }
@@ -832,7 +1018,7 @@ RingPrepareReadWrite(
             goto fail2;
 
         if (MaxSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
-            if (!RingPrepareBlkifIndirect(Ring, Request))
+            if (!RingPrepareBlkifIndirect(Ring, Request, Request->NrSegments))
                 goto fail3;
         }
 
@@ -893,47 +1079,248 @@ fail1:
     return FALSE;
 }
 
+#define XENVBD_MAX_UNMAP_SRBS   32
+
+typedef struct _XENVBD_UNMAP_RANGE {
+    ULONG64     Start;
+    ULONG64     End;    // exclusive
+    ULONG       Index;  // SRB the range came from
+} XENVBD_UNMAP_RANGE, *PXENVBD_UNMAP_RANGE;
+
+static FORCEINLINE ULONG
+__RingUnmapDescriptorCount(
+    IN  PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    PUNMAP_LIST_HEADER      Unmap = Srb->DataBuffer;
+
+    return _byteswap_ushort(*(PUSHORT)Unmap->BlockDescrDataLength) / sizeof(UNMAP_BLOCK_DESCRIPTOR);
+}
+
+// Lowest sector >= Value that sits on a discard extent boundary
+static FORCEINLINE ULONG64
+__RingUnmapAlignUp(
+    IN  ULONG64     Value,
+    IN  ULONG       Granularity,
+    IN  ULONG       Alignment
+    )
+{
+    return Value + (Granularity - ((Value + Granularity - Alignment) % Granularity)) % Granularity;
+}
+
+// Highest sector <= Value that sits on a discard extent boundary
+static FORCEINLINE ULONG64
+__RingUnmapAlignDown(
+    IN  ULONG64     Value,
+    IN  ULONG       Granularity,
+    IN  ULONG       Alignment
+    )
+{
+    ULONG64         Offset = (Value + Granularity - Alignment) % Granularity;
+
+    return (Value >= Offset) ? Value - Offset : 0;
+}
+
+static VOID
+RingSortUnmapRanges(
+    IN  PXENVBD_UNMAP_RANGE Ranges,
+    IN  ULONG               Count
+    )
+{
+    ULONG                   Gap;
+    ULONG                   Index;
+
+    // Shell sort by starting sector; a descriptor list is at most a few
+    // thousand entries and usually already close to sorted
+    for (Gap = Count / 2; Gap > 0; Gap /= 2) {
+        for (Index = Gap; Index < Count; ++Index) {
+            XENVBD_UNMAP_RANGE  Range = Ranges[Index];
+            ULONG               Next;
+
+            for (Next = Index;
+                 Next >= Gap && Ranges[Next - Gap].Start > Range.Start;
+                 Next -= Gap)
+                Ranges[Next] = Ranges[Next - Gap];
+
+            Ranges[Next] = Range;
+        }
+    }
+}
+
 static BOOLEAN
 RingPrepareUnmap(
     IN  PXENVBD_RING        Ring,
     IN  PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PXENVBD_SRBEXT          SrbExt = Srb->SrbExtension;
-    PUNMAP_LIST_HEADER      Unmap = Srb->DataBuffer;
-	ULONG                   Count = _byteswap_ushort(*(PUSHORT)Unmap->BlockDescrDataLength) / sizeof(UNMAP_BLOCK_DESCRIPTOR);
+    PXENVBD_DISKINFO        DiskInfo = FrontendGetDiskInfo(Ring->Frontend);
+    PXENVBD_TARGET          Target = FrontendGetTarget(Ring->Frontend);
+    PXENVBD_ADAPTER         Adapter = TargetGetAdapter(Target);
+    PXENVBD_SRBEXT          SrbExts[XENVBD_MAX_UNMAP_SRBS];
+    PXENVBD_REQUEST         Last[XENVBD_MAX_UNMAP_SRBS];
+    ULONG                   NrSrbs;
+    PXENVBD_UNMAP_RANGE     Ranges;
+    ULONG                   Count;
+    ULONG                   NrRanges;
+    ULONG                   Granularity;
+    ULONG                   Alignment;
+    ULONG                   Idle;
     ULONG                   Index;
     LIST_ENTRY              List;
 
-    Srb->SrbStatus = SRB_STATUS_PENDING;
+    // Gather this SRB and any UNMAP SRBs queued directly behind it, so
+    // that a burst of TRIMs is coalesced as a whole
+    SrbExts[0] = Srb->SrbExtension;
+    Count = __RingUnmapDescriptorCount(Srb);
+
+    for (NrSrbs = 1; NrSrbs < XENVBD_MAX_UNMAP_SRBS; ++NrSrbs) {
+        PXENVBD_SRBEXT      SrbExt;
+        PLIST_ENTRY         ListEntry;
+
+        ListEntry = QueuePop(&Ring->FreshSrbs);
+        if (ListEntry == NULL)
+            break;
+
+        SrbExt = CONTAINING_RECORD(ListEntry, XENVBD_SRBEXT, ListEntry);
+        if (Cdb_OperationEx(SrbExt->Srb) != SCSIOP_UNMAP) {
+            QueueUnPop(&Ring->FreshSrbs, &SrbExt->ListEntry);
+            break;
+        }
+
+        SrbExts[NrSrbs] = SrbExt;
+        Count += __RingUnmapDescriptorCount(SrbExt->Srb);
+    }
+
+    for (Index = 0; Index < NrSrbs; ++Index) {
+        SrbExts[Index]->Srb->SrbStatus = SRB_STATUS_PENDING;
+        SrbExts[Index]->RequestCount = 0;
+        Last[Index] = NULL;
+    }
 
     InitializeListHead(&List);
-    SrbExt->RequestCount = 0;
+    Ranges = NULL;
+
+    if (Count != 0) {
+        Ranges = __RingAllocate(sizeof(XENVBD_UNMAP_RANGE) * Count);
+        if (Ranges == NULL)
+            goto fail1;
+    }
+
+    NrRanges = 0;
+    for (Index = 0; Index < NrSrbs; ++Index) {
+        PUNMAP_LIST_HEADER  Unmap = SrbExts[Index]->Srb->DataBuffer;
+        ULONG               Descr;
 
-    for (Index = 0; Index < Count; ++Index) {
-        PUNMAP_BLOCK_DESCRIPTOR Descr = &Unmap->Descriptors[Index];
-        PXENVBD_REQUEST         Request;
+        for (Descr = 0; Descr < __RingUnmapDescriptorCount(SrbExts[Index]->Srb); ++Descr) {
+            ULONG64     Start = _byteswap_uint64(*(PULONG64)Unmap->Descriptors[Descr].StartingLba);
+            ULONG       Length = _byteswap_ulong(*(PULONG)Unmap->Descriptors[Descr].LbaCount);
+
+            if (Length == 0)
+                continue;
+
+            Ranges[NrRanges].Start = Start;
+            Ranges[NrRanges].End = Start + Length;
+            Ranges[NrRanges].Index = Index;
+            ++NrRanges;
+        }
+    }
+
+    RingSortUnmapRanges(Ranges, NrRanges);
+
+    // discard-granularity and discard-alignment are in bytes
+    Granularity = __max(DiskInfo->DiscardGranularity / DiskInfo->SectorSize, 1);
+    Alignment = (DiskInfo->DiscardAlignment / DiskInfo->SectorSize) % Granularity;
+
+    Index = 0;
+    while (Index < NrRanges) {
+        ULONG               First = Index;
+        ULONG64             Start = Ranges[Index].Start;
+        ULONG64             End = Ranges[Index].End;
+        PXENVBD_REQUEST     Request;
+        ULONG               Other;
+
+        // coalesce overlapping and adjacent ranges
+        for (++Index; Index < NrRanges && Ranges[Index].Start <= End; ++Index)
+            End = __max(End, Ranges[Index].End);
+
+        // trim to whole discard extents, the backend ignores anything smaller
+        Start = __RingUnmapAlignUp(Start, Granularity, Alignment);
+        End = __RingUnmapAlignDown(End, Granularity, Alignment);
+        if (End <= Start)
+            continue;
 
         Request = RingGetRequest(Ring);
         if (Request == NULL)
-            goto fail1;
+            goto fail2;
         InsertTailList(&List, &Request->ListEntry);
-        InterlockedIncrement(&SrbExt->RequestCount);
 
-        Request->SrbExt         = SrbExt;
+        Request->SrbExt         = SrbExts[Ranges[First].Index];
         Request->Operation      = BLKIF_OP_DISCARD;
-        Request->FirstSector    = _byteswap_uint64(*(PULONG64)Descr->StartingLba);
-        Request->NrSectors      = _byteswap_ulong(*(PULONG)Descr->LbaCount);
+        Request->FirstSector    = Start;
+        Request->NrSectors      = End - Start;
         Request->Flags          = 0;
+        InterlockedIncrement(&Request->SrbExt->RequestCount);
+        Last[Ranges[First].Index] = Request;
+
+        // every other SRB covered by this range holds a reference until it completes
+        for (Other = First + 1; Other < Index; ++Other) {
+            ULONG               SrbIndex = Ranges[Other].Index;
+            PXENVBD_REQUEST     Merged;
+
+            if (Last[SrbIndex] == Request)
+                continue;
+
+            Merged = RingGetRequest(Ring);
+            if (Merged == NULL)
+                goto fail3;
+            InsertTailList(&Request->Merged, &Merged->ListEntry);
+
+            Merged->SrbExt      = SrbExts[SrbIndex];
+            Merged->Operation   = BLKIF_OP_DISCARD;
+            InterlockedIncrement(&Merged->SrbExt->RequestCount);
+            Last[SrbIndex] = Request;
+        }
+    }
+
+    if (Ranges != NULL)
+        __RingFree(Ranges);
+
+    // SRBs whose ranges were all too small to discard have nothing to wait for
+    Idle = 0;
+    for (Index = 0; Index < NrSrbs; ++Index) {
+        if (SrbExts[Index]->RequestCount == 0)
+            Idle |= 1u << Index;
     }
 
     RingQueueRequestList(Ring, &List);
+
+    for (Index = 0; Index < NrSrbs; ++Index) {
+        PSCSI_REQUEST_BLOCK Idler;
+
+        if ((Idle & (1u << Index)) == 0)
+            continue;
+
+        Idler = SrbExts[Index]->Srb;
+        Idler->SrbStatus = SRB_STATUS_SUCCESS;
+        Idler->ScsiStatus = 0x00; // SCSI_GOOD
+        AdapterCompleteSrb(Adapter, SrbExts[Index]);
+    }
+
     return TRUE;
 
-fail1:
+fail3:
+fail2:
     RingCancelRequestList(Ring, &List);
-    SrbExt->RequestCount = 0;
-    Srb->SrbStatus = SRB_STATUS_ERROR;
+    __RingFree(Ranges);
+fail1:
+    for (Index = NrSrbs; Index-- != 0;) {
+        SrbExts[Index]->RequestCount = 0;
+        SrbExts[Index]->Srb->SrbStatus = SRB_STATUS_ERROR;
+
+        // the first SRB is put back by the caller
+        if (Index != 0)
+            QueueUnPop(&Ring->FreshSrbs, &SrbExts[Index]->ListEntry);
+    }
     return FALSE;
 }
 
@@ -990,7 +1377,10 @@ RingSubmit(
         return FALSE;
     }
 
+    __RingSampleDepth(Ring);
+
     req = RING_GET_REQUEST(&Ring->Front, Ring->Front.req_prod_pvt);
+    Request->SubmitTime = __RingTimestamp();
     __RingInsert(Ring, Request, req);
     KeMemoryBarrier();
     ++Ring->Front.req_prod_pvt;
@@ -1130,6 +1520,75 @@ __BlkifOperationName(
     }
 }
 
+static VOID
+RingCompleteRequest(
+    IN  PXENVBD_RING    Ring,
+    IN  PXENVBD_REQUEST Request,
+    IN  UCHAR           SrbStatus
+    )
+{
+    PXENVBD_TARGET      Target = FrontendGetTarget(Ring->Frontend);
+    PXENVBD_ADAPTER     Adapter = TargetGetAdapter(Target);
+    ULONG64             Now = __RingTimestamp();
+    LIST_ENTRY          List;
+
+    // Request holds the segments of every request merged into it, so it
+    // must be put (revoking grants) before any of the SRBs is completed
+    InitializeListHead(&List);
+    InsertTailList(&List, &Request->ListEntry);
+
+    for (;;) {
+        PLIST_ENTRY     ListEntry;
+
+        ListEntry = RemoveHeadList(&Request->Merged);
+        if (ListEntry == &Request->Merged)
+            break;
+        InsertTailList(&List, ListEntry);
+    }
+
+    for (;;) {
+        PXENVBD_SRBEXT      SrbExt;
+        PSCSI_REQUEST_BLOCK Srb;
+        UCHAR               Operation;
+        PLIST_ENTRY         ListEntry;
+
+        ListEntry = RemoveHeadList(&List);
+        if (ListEntry == &List)
+            break;
+        Request = CONTAINING_RECORD(ListEntry, XENVBD_REQUEST, ListEntry);
+
+        SrbExt      = Request->SrbExt;
+        Srb         = SrbExt->Srb;
+        Operation   = Request->Operation;
+
+        RingPutRequest(Ring, Request);
+
+        if (SrbStatus != SRB_STATUS_PENDING)
+            Srb->SrbStatus = SrbStatus;
+
+        // complete srb
+        if (InterlockedDecrement(&SrbExt->RequestCount) == 0) {
+            if (Srb->SrbStatus == SRB_STATUS_PENDING) {
+                // SRB has not hit a failure condition (BLKIF_RSP_ERROR | BLKIF_RSP_EOPNOTSUPP)
+                // from any of its responses. SRB must have succeeded
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                Srb->ScsiStatus = 0x00; // SCSI_GOOD
+            } else {
+                // Srb->SrbStatus has already been set by 1 or more requests with Status != BLKIF_RSP_OKAY
+                Srb->ScsiStatus = 0x40; // SCSI_ABORTED
+            }
+
+            if (Srb->SrbStatus != SRB_STATUS_ABORTED)
+                __RingSampleLatency(Ring,
+                                    &Ring->Total[__RingStatisticsOperation(Operation)],
+                                    SrbExt->QueueTime,
+                                    Now);
+
+            AdapterCompleteSrb(Adapter, SrbExt);
+        }
+    }
+}
+
 static VOID
 RingCompleteResponse(
     IN  PXENVBD_RING    Ring,
@@ -1138,26 +1597,28 @@ RingCompleteResponse(
     )
 {
     PXENVBD_REQUEST     Request;
-    PSCSI_REQUEST_BLOCK Srb;
-    PXENVBD_SRBEXT      SrbExt;
+    UCHAR               SrbStatus;
 
     Request = RingFindRequest(Ring, Id);
     if (Request == NULL)
         return;
 
-    SrbExt  = Request->SrbExt;
-    Srb     = SrbExt->Srb;
+    __RingSampleLatency(Ring,
+                        &Ring->Backend[__RingStatisticsOperation(Request->Operation)],
+                        Request->SubmitTime,
+                        __RingTimestamp());
 
     switch (Status) {
     case BLKIF_RSP_OKAY:
         RingRequestCopyOutput(Request);
+        SrbStatus = SRB_STATUS_PENDING;
         break;
 
     case BLKIF_RSP_EOPNOTSUPP:
         // Remove appropriate feature support
         FrontendRemoveFeature(Ring->Frontend, Request->Operation);
         // Succeed this SRB, subsiquent SRBs will be succeeded instead of being passed to the backend.
-        Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        SrbStatus = SRB_STATUS_SUCCESS;
         break;
 
     case BLKIF_RSP_ERROR:
@@ -1166,29 +1627,11 @@ RingCompleteResponse(
                 FrontendGetTargetId(Ring->Frontend),
                 __BlkifOperationName(Request->Operation),
                 Id);
-        Srb->SrbStatus = SRB_STATUS_ERROR;
+        SrbStatus = SRB_STATUS_ERROR;
         break;
     }
 
-    RingPutRequest(Ring, Request);
-
-    // complete srb
-    if (InterlockedDecrement(&SrbExt->RequestCount) == 0) {
-        PXENVBD_TARGET  Target = FrontendGetTarget(Ring->Frontend);
-        PXENVBD_ADAPTER Adapter = TargetGetAdapter(Target);
-
-        if (Srb->SrbStatus == SRB_STATUS_PENDING) {
-            // SRB has not hit a failure condition (BLKIF_RSP_ERROR | BLKIF_RSP_EOPNOTSUPP)
-            // from any of its responses. SRB must have succeeded
-            Srb->SrbStatus = SRB_STATUS_SUCCESS;
-            Srb->ScsiStatus = 0x00; // SCSI_GOOD
-        } else {
-            // Srb->SrbStatus has already been set by 1 or more requests with Status != BLKIF_RSP_OKAY
-            Srb->ScsiStatus = 0x40; // SCSI_ABORTED
-        }
-
-        AdapterCompleteSrb(Adapter, SrbExt);
-    }
+    RingCompleteRequest(Ring, Request, SrbStatus);
 }
 
 static BOOLEAN
@@ -1338,10 +1781,11 @@ RingDpc(
 
     for (;;) {
         if (!RingNotifyResponses(Ring)) {
-            XENBUS_EVTCHN(Unmask,
-                          &Ring->EvtchnInterface,
-                          Ring->Channel,
-                          FALSE);
+            (VOID) XENBUS_EVTCHN(Unmask,
+                                 &Ring->EvtchnInterface,
+                                 Ring->Channel,
+                                 FALSE,
+                                 TRUE);
             break;
         }
         if (__RingDpcTimeout(Ring)) {
@@ -1450,6 +1894,10 @@ RingDebugCallback(
                  "Segments Granted=%llu Bounced=%llu\n",
                  Ring->SegsGranted,
                  Ring->SegsBounced);
+    XENBUS_DEBUG(Printf,
+                 &Ring->DebugInterface,
+                 "Requests Merged=%u\n",
+                 Ring->BlkOpMerged);
 
     QueueDebugCallback(&Ring->FreshSrbs,
                        "Fresh    ",
@@ -1495,6 +1943,7 @@ RingRequestCtor(
 
     InitializeListHead(&Request->Segments);
     InitializeListHead(&Request->Indirects);
+    InitializeListHead(&Request->Merged);
     return STATUS_SUCCESS;
 }
 
@@ -1593,6 +2042,7 @@ RingCreate(
     KeInitializeDpc(&(*Ring)->Dpc, RingDpc, *Ring);
     KeInitializeDpc(&(*Ring)->TimerDpc, RingDpc, *Ring);
     KeInitializeTimer(&(*Ring)->Timer);
+    (VOID) KeQueryPerformanceCounter(&(*Ring)->Frequency);
 
     QueueInit(&(*Ring)->FreshSrbs);
     QueueInit(&(*Ring)->PreparedReqs);
@@ -1703,6 +2153,7 @@ fail2:
     RtlZeroMemory(&(*Ring)->SubmittedReqs, sizeof(XENVBD_QUEUE));
     RtlZeroMemory(&(*Ring)->ShutdownSrbs, sizeof(XENVBD_QUEUE));
 
+    RtlZeroMemory(&(*Ring)->Frequency, sizeof(LARGE_INTEGER));
     RtlZeroMemory(&(*Ring)->Timer, sizeof(KTIMER));
     RtlZeroMemory(&(*Ring)->TimerDpc, sizeof(KDPC));
     RtlZeroMemory(&(*Ring)->Dpc, sizeof(KDPC));
@@ -1761,13 +2212,58 @@ RingDestroy(
     Ring->BlkOpBarrier = 0;
     Ring->BlkOpDiscard = 0;
     Ring->BlkOpFlush = 0;
+    Ring->BlkOpMerged = 0;
     Ring->SegsGranted = 0;
     Ring->SegsBounced = 0;
 
+    RtlZeroMemory(Ring->Backend, sizeof(Ring->Backend));
+    RtlZeroMemory(Ring->Total, sizeof(Ring->Total));
+    RtlZeroMemory(Ring->Depth, sizeof(Ring->Depth));
+    RtlZeroMemory(&Ring->Frequency, sizeof(LARGE_INTEGER));
+
     ASSERT(IsZeroMemory(Ring, sizeof(XENVBD_RING)));
     __RingFree(Ring);
 }
 
+// Spread the rings of different targets across the vCPUs so that
+// response processing for each target happens on its own CPU
+static VOID
+RingBindChannel(
+    IN  PXENVBD_RING    Ring
+    )
+{
+    ULONG               Count;
+    ULONG               Index;
+    PROCESSOR_NUMBER    ProcNumber;
+    NTSTATUS            status;
+
+    Count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    Index = FrontendGetTargetId(Ring->Frontend) % Count;
+
+    status = KeGetProcessorNumberFromIndex(Index, &ProcNumber);
+    ASSERT(NT_SUCCESS(status));
+
+    status = XENBUS_EVTCHN(Bind,
+                           &Ring->EvtchnInterface,
+                           Ring->Channel,
+                           ProcNumber.Group,
+                           ProcNumber.Number);
+    if (!NT_SUCCESS(status))
+        Warning("Target[%d] : failed to bind event channel to CPU %u:%u (%08x)\n",
+                FrontendGetTargetId(Ring->Frontend),
+                ProcNumber.Group,
+                ProcNumber.Number,
+                status);
+
+    // Request completions unblock waiting I/O so let them preempt
+    // bulk traffic on other channels bound to the same CPU
+    if (Ring->EvtchnInterface.Interface.Version >= 9)
+        (VOID) XENBUS_EVTCHN(SetPriority,
+                             &Ring->EvtchnInterface,
+                             Ring->Channel,
+                             XENBUS_EVTCHN_PRIORITY_HIGH);
+}
+
 NTSTATUS
 RingConnect(
     IN  PXENVBD_RING    Ring
@@ -1861,10 +2357,13 @@ RingConnect(
     if (Ring->Channel == NULL)
         goto fail6;
 
-    XENBUS_EVTCHN(Unmask,
-                  &Ring->EvtchnInterface,
-                  Ring->Channel,
-                  FALSE);
+    RingBindChannel(Ring);
+
+    (VOID) XENBUS_EVTCHN(Unmask,
+                         &Ring->EvtchnInterface,
+                         Ring->Channel,
+                         FALSE,
+                         TRUE);
 
     status = XENBUS_DEBUG(Register,
                           &Ring->DebugInterface,
@@ -2071,8 +2570,6 @@ RingDisable(
 
     // Fail PreparedReqs
     for (;;) {
-        PXENVBD_SRBEXT      SrbExt;
-        PSCSI_REQUEST_BLOCK Srb;
         PXENVBD_REQUEST     Request;
         PLIST_ENTRY         ListEntry;
 
@@ -2080,16 +2577,8 @@ RingDisable(
         if (ListEntry == NULL)
             break;
         Request = CONTAINING_RECORD(ListEntry, XENVBD_REQUEST, ListEntry);
-        SrbExt = Request->SrbExt;
-        Srb = SrbExt->Srb;
-
-        RingPutRequest(Ring, Request);
 
-        if (InterlockedDecrement(&SrbExt->RequestCount) == 0) {
-            Srb->SrbStatus = SRB_STATUS_ABORTED;
-            Srb->ScsiStatus = 0x40; // SCSI_ABORTED
-            AdapterCompleteSrb(Adapter, SrbExt);
-        }
+        RingCompleteRequest(Ring, Request, SRB_STATUS_ABORTED);
     }
 
     //
@@ -2173,6 +2662,7 @@ RingQueueRequest(
     IN  PXENVBD_SRBEXT  SrbExt
     )
 {
+    SrbExt->QueueTime = __RingTimestamp();
     QueueAppend(&Ring->FreshSrbs,
                 &SrbExt->ListEntry);
 
@@ -2198,3 +2688,16 @@ RingQueueShutdown(
     if (KeInsertQueueDpc(&Ring->Dpc, NULL, NULL))
 	    ++Ring->Dpcs;
 }
+
+VOID
+RingQueryStatistics(
+    IN  PXENVBD_RING        Ring,
+    OUT PXENVBD_STATISTICS  Statistics
+    )
+{
+    // The counters are updated without a lock, so this is a snapshot
+    // that may be slightly inconsistent between histograms
+    RtlCopyMemory(Statistics->Backend, Ring->Backend, sizeof(Ring->Backend));
+    RtlCopyMemory(Statistics->Total, Ring->Total, sizeof(Ring->Total));
+    RtlCopyMemory(Statistics->Depth, Ring->Depth, sizeof(Ring->Depth));
+}
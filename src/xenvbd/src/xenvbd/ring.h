@@ -34,6 +34,8 @@
 
 typedef struct _XENVBD_RING XENVBD_RING, *PXENVBD_RING;
 
+#include <xenvbd_ioctls.h>
+
 #include "frontend.h"
 #include "srbext.h"
 
@@ -91,4 +93,10 @@ RingQueueShutdown(
     IN  PXENVBD_SRBEXT  SrbExt
     );
 
+extern VOID
+RingQueryStatistics(
+    IN  PXENVBD_RING        Ring,
+    OUT PXENVBD_STATISTICS  Statistics
+    );
+
 #endif // _XENVBD_RING_H
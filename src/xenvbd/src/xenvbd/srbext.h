@@ -44,6 +44,8 @@ typedef struct _XENVBD_SRBEXT {
     PVOID                   SGList;
     ULONG                   SGIndex;
     ULONG                   SGOffset;
+
+    ULONG64                 QueueTime;  // performance counter when queued to the ring
 } XENVBD_SRBEXT, *PXENVBD_SRBEXT;
 
 typedef struct _XENVBD_REQUEST {
@@ -56,8 +58,11 @@ typedef struct _XENVBD_REQUEST {
     LIST_ENTRY              Segments;   // BLKIF_OP_{READ/WRITE} only
 
     ULONG64                 FirstSector;
-    ULONG64                 NrSectors;  // BLKIF_OP_DISCARD only
+    ULONG64                 NrSectors;  // BLKIF_OP_{READ/WRITE/DISCARD} only
     LIST_ENTRY              Indirects;  // BLKIF_OP_{READ/WRITE} with NrSegments > 11 only
+    LIST_ENTRY              Merged;     // BLKIF_OP_{READ/WRITE} only, requests coalesced into this one
+
+    ULONG64                 SubmitTime; // performance counter when placed on the shared ring
 } XENVBD_REQUEST, *PXENVBD_REQUEST;
 
 typedef struct _XENVBD_BOUNCE {
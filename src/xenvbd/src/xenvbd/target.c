@@ -998,6 +998,15 @@ TargetShutdown(
     RingQueueShutdown(FrontendGetRing(Target->Frontend), SrbExt);
 }
 
+VOID
+TargetQueryStatistics(
+    IN  PXENVBD_TARGET      Target,
+    OUT PXENVBD_STATISTICS  Statistics
+    )
+{
+    RingQueryStatistics(FrontendGetRing(Target->Frontend), Statistics);
+}
+
 VOID
 TargetIssueDeviceEject(
     IN  PXENVBD_TARGET  Target,
@@ -33,6 +33,7 @@
 #define _XENVBD_TARGET_H
 
 #include <ntddk.h>
+#include <xenvbd_ioctls.h>
 
 typedef struct _XENVBD_TARGET XENVBD_TARGET, *PXENVBD_TARGET;
 
@@ -122,6 +123,12 @@ TargetShutdown(
     IN  PXENVBD_SRBEXT  SrbExt
     );
 
+extern VOID
+TargetQueryStatistics(
+    IN  PXENVBD_TARGET      Target,
+    OUT PXENVBD_STATISTICS  Statistics
+    );
+
 #define TARGET_GET_PROPERTY(_name, _type)       \
 extern _type                                    \
 TargetGet ## _name ## (                         \
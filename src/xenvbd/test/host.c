@@ -0,0 +1,74 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <ntddk.h>
+#include <time.h>
+
+LONG            HostPoolAllocations;
+LONG            HostPoolFailSkip;
+LONG            HostPoolFailCount;
+ULONG           HostProcessorCount = 4;
+
+__thread KIRQL  HostIrql;
+__thread ULONG  HostProcessorIndex;
+
+VOID
+KeQuerySystemTime(
+    OUT PLARGE_INTEGER  CurrentTime
+    )
+{
+    struct timespec     Now;
+
+    (void) clock_gettime(CLOCK_REALTIME, &Now);
+
+    // 100ns units since 1601
+    CurrentTime->QuadPart = ((LONGLONG)Now.tv_sec + 11644473600ll) * 10000000ll +
+                            Now.tv_nsec / 100;
+}
+
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+    OUT PLARGE_INTEGER  PerformanceFrequency OPTIONAL
+    )
+{
+    struct timespec     Now;
+    LARGE_INTEGER       Counter;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &Now);
+
+    if (PerformanceFrequency != NULL)
+        PerformanceFrequency->QuadPart = 1000000000ll;
+
+    Counter.QuadPart = (LONGLONG)Now.tv_sec * 1000000000ll + Now.tv_nsec;
+    return Counter;
+}
+
+ULONG           TestFailures;
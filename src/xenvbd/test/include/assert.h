@@ -0,0 +1,127 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host replacement for src/xenvbd/assert.h. Assertions are always
+// enabled and abort the test.
+
+#ifndef _XENVBD_ASSERT_H
+#define _XENVBD_ASSERT_H
+
+#include <ntddk.h>
+
+#include "debug.h"
+
+static inline VOID
+__HostAssertionFailed(
+    IN  const CHAR  *Expression,
+    IN  const CHAR  *File,
+    IN  ULONG       Line
+    )
+{
+    fprintf(stderr, "%s:%u: ASSERTION FAILED: %s\n", File, Line, Expression);
+    abort();
+}
+
+#define BUG(_TEXT)                                          \
+        __HostAssertionFailed("BUG: " _TEXT, __FILE__, __LINE__)
+
+#define BUG_ON(_EXP)                \
+        if (_EXP) BUG(#_EXP)
+
+#undef  ASSERT
+
+#define ASSERT(_EXP)                                                \
+        do {                                                        \
+            if (!(_EXP))                                            \
+                __HostAssertionFailed(#_EXP, __FILE__, __LINE__);   \
+        } while (FALSE)
+
+#define ASSERT3U(_X, _OP, _Y)                       \
+        do {                                        \
+            ULONGLONG   _Lval = (ULONGLONG)(_X);    \
+            ULONGLONG   _Rval = (ULONGLONG)(_Y);    \
+            if (!(_Lval _OP _Rval)) {               \
+                fprintf(stderr, "%s = %llu\n", #_X, _Lval); \
+                fprintf(stderr, "%s = %llu\n", #_Y, _Rval); \
+                ASSERT((_X) _OP (_Y));              \
+            }                                       \
+        } while (FALSE)
+
+#define ASSERT3S(_X, _OP, _Y)                       \
+        do {                                        \
+            LONGLONG    _Lval = (LONGLONG)(_X);     \
+            LONGLONG    _Rval = (LONGLONG)(_Y);     \
+            if (!(_Lval _OP _Rval)) {               \
+                fprintf(stderr, "%s = %lld\n", #_X, _Lval); \
+                fprintf(stderr, "%s = %lld\n", #_Y, _Rval); \
+                ASSERT((_X) _OP (_Y));              \
+            }                                       \
+        } while (FALSE)
+
+#define ASSERT3P(_X, _OP, _Y)                       \
+        do {                                        \
+            PVOID   _Lval = (PVOID)(_X);            \
+            PVOID   _Rval = (PVOID)(_Y);            \
+            if (!(_Lval _OP _Rval)) {               \
+                fprintf(stderr, "%s = %p\n", #_X, _Lval); \
+                fprintf(stderr, "%s = %p\n", #_Y, _Rval); \
+                ASSERT((_X) _OP (_Y));              \
+            }                                       \
+        } while (FALSE)
+
+static inline BOOLEAN
+_IsZeroMemory(
+    IN  const CHAR  *Caller,
+    IN  const CHAR  *Name,
+    IN  PVOID       Buffer,
+    IN  ULONG       Length
+    )
+{
+    ULONG           Offset;
+
+    for (Offset = 0; Offset < Length; Offset++) {
+        if (*((PUCHAR)Buffer + Offset) != 0) {
+            Error("%s: non-zero byte in %s (%p+0x%x)\n",
+                  Caller, Name, Buffer, Offset);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+#define IsZeroMemory(_Buffer, _Length) \
+        _IsZeroMemory(__FUNCTION__, #_Buffer, (_Buffer), (_Length))
+
+#define IMPLY(_X, _Y)   (!(_X) || (_Y))
+#define EQUIV(_X, _Y)   (IMPLY((_X), (_Y)) && IMPLY((_Y), (_X)))
+
+#endif  // _XENVBD_ASSERT_H
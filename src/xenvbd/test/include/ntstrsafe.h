@@ -0,0 +1,78 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HOST_NTSTRSAFE_H
+#define _HOST_NTSTRSAFE_H
+
+#include <ntddk.h>
+
+static inline NTSTATUS
+RtlStringCbPrintfA(
+    OUT PCHAR       Buffer,
+    IN  SIZE_T      Size,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    va_list         Arguments;
+    int             Length;
+
+    va_start(Arguments, Format);
+    Length = vsnprintf(Buffer, Size, Format, Arguments);
+    va_end(Arguments);
+
+    if (Length < 0)
+        return STATUS_INVALID_PARAMETER;
+
+    return ((SIZE_T)Length < Size) ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+}
+
+#define RtlStringCchPrintfA RtlStringCbPrintfA
+
+static inline NTSTATUS
+RtlStringCbLengthA(
+    IN  const CHAR  *String,
+    IN  SIZE_T      Size,
+    OUT PSIZE_T     Length
+    )
+{
+    SIZE_T          Count = strnlen(String, Size);
+
+    if (Count == Size)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Length != NULL)
+        *Length = Count;
+
+    return STATUS_SUCCESS;
+}
+
+#endif  // _HOST_NTSTRSAFE_H
@@ -0,0 +1,137 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Just the parts of storport.h and scsi.h that the tests reach.
+
+#ifndef _HOST_STORPORT_H
+#define _HOST_STORPORT_H
+
+#include <ntddk.h>
+
+typedef struct _SCSI_REQUEST_BLOCK {
+    USHORT  Length;
+    UCHAR   Function;
+    UCHAR   SrbStatus;
+    UCHAR   ScsiStatus;
+    UCHAR   PathId;
+    UCHAR   TargetId;
+    UCHAR   Lun;
+    UCHAR   QueueTag;
+    UCHAR   QueueAction;
+    UCHAR   CdbLength;
+    UCHAR   SenseInfoBufferLength;
+    ULONG   SrbFlags;
+    ULONG   DataTransferLength;
+    ULONG   TimeOutValue;
+    PVOID   DataBuffer;
+    PVOID   SenseInfoBuffer;
+    struct _SCSI_REQUEST_BLOCK  *NextSrb;
+    PVOID   OriginalRequest;
+    PVOID   SrbExtension;
+    ULONG   QueueSortKey;
+    UCHAR   Cdb[16];
+} SCSI_REQUEST_BLOCK, *PSCSI_REQUEST_BLOCK;
+
+#define SRB_FUNCTION_EXECUTE_SCSI   0x00
+
+#define SRB_STATUS_PENDING      0x00
+#define SRB_STATUS_SUCCESS      0x01
+#define SRB_STATUS_ABORTED      0x02
+#define SRB_STATUS_ERROR        0x04
+
+#define SCSIOP_READ                 0x28
+#define SCSIOP_WRITE                0x2A
+#define SCSIOP_SYNCHRONIZE_CACHE    0x35
+#define SCSIOP_UNMAP                0x42
+#define SCSIOP_READ16               0x88
+#define SCSIOP_WRITE16              0x8A
+#define SCSIOP_SYNCHRONIZE_CACHE16  0x91
+#define SCSIOP_READ_CAPACITY16      0x9E
+
+#define SERVICE_ACTION_READ_CAPACITY16  0x10
+
+typedef union _CDB {
+    struct _UNMAP {
+        UCHAR   OperationCode;
+        UCHAR   Anchor : 1;
+        UCHAR   Reserved1 : 7;
+        UCHAR   Reserved2[4];
+        UCHAR   GroupNumber : 5;
+        UCHAR   Reserved3 : 3;
+        UCHAR   AllocationLength[2];
+        UCHAR   Control;
+    } UNMAP;
+
+    struct _READ_CAPACITY16 {
+        UCHAR   OperationCode;
+        UCHAR   ServiceAction : 5;
+        UCHAR   Reserved1 : 3;
+        UCHAR   LogicalBlock[8];
+        UCHAR   AllocationLength[4];
+        UCHAR   PMI : 1;
+        UCHAR   Reserved2 : 7;
+        UCHAR   Control;
+    } READ_CAPACITY16;
+
+    UCHAR   AsByte[16];
+} CDB, *PCDB;
+
+typedef struct _READ_CAPACITY16_DATA {
+    LARGE_INTEGER   LogicalBlockAddress;
+    ULONG           BytesPerBlock;
+    UCHAR           ProtectionEnable : 1;
+    UCHAR           ProtectionType : 3;
+    UCHAR           Reserved : 4;
+    UCHAR           LogicalPerPhysicalExponent : 4;
+    UCHAR           SatisfyingProtectionInfo : 4;
+    UCHAR           LowestAlignedBlock_MSB : 6;
+    UCHAR           LBPRZ : 1;
+    UCHAR           LBPME : 1;
+    UCHAR           LowestAlignedBlock_LSB;
+    UCHAR           Reserved3[16];
+} READ_CAPACITY16_DATA, *PREAD_CAPACITY16_DATA;
+
+typedef struct _UNMAP_BLOCK_DESCRIPTOR {
+    UCHAR   StartingLba[8];
+    UCHAR   LbaCount[4];
+    UCHAR   Reserved[4];
+} UNMAP_BLOCK_DESCRIPTOR, *PUNMAP_BLOCK_DESCRIPTOR;
+
+typedef struct _UNMAP_LIST_HEADER {
+    UCHAR                   DataLength[2];
+    UCHAR                   BlockDescrDataLength[2];
+    UCHAR                   Reserved[4];
+    UNMAP_BLOCK_DESCRIPTOR  Descriptors[0];
+} UNMAP_LIST_HEADER, *PUNMAP_LIST_HEADER;
+
+extern VOID StorPortStallExecution(ULONG);
+
+#endif  // _HOST_STORPORT_H
@@ -0,0 +1,615 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+// Host test for the TRIM path in xendisk's pdo.c.
+//
+// IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES IRPs are sent through
+// PdoDispatch() by a fake upper driver. The UNMAP SRBs that come out
+// are held by a fake lower driver, which completes them in whatever
+// order and with whatever status a test asks for, or straight away.
+
+#include <ntddk.h>
+
+#include "debug.h"
+#include "assert.h"
+
+// The xendisk assertions are replaced by the host ones, and names.h
+// does not build on the host; the names pdo.c needs are below.
+#define _XENDISK_ASSERT_H
+#define _XENVBD_NAMES_H
+
+static const CHAR *PowerMinorFunctionName(ULONG Function) { return "MINOR"; }
+static const CHAR *PowerDeviceStateName(DEVICE_POWER_STATE State) { return "DEVICE"; }
+static const CHAR *PowerSystemStateName(SYSTEM_POWER_STATE State) { return "SYSTEM"; }
+static const CHAR *PowerActionName(POWER_ACTION Action) { return "ACTION"; }
+
+#include "../src/xendisk/pdo.c"
+
+#include "test.h"
+
+// Nothing here creates, powers or removes the device, so none of these
+// neighbours is ever called
+
+VOID FdoAddPhysicalDeviceObject(PXENDISK_FDO Fdo, PDEVICE_OBJECT DeviceObject) { abort(); }
+VOID FdoRemovePhysicalDeviceObject(PXENDISK_FDO Fdo, PDEVICE_OBJECT DeviceObject) { abort(); }
+VOID FdoAcquireMutex(PXENDISK_FDO Fdo) { abort(); }
+VOID FdoReleaseMutex(PXENDISK_FDO Fdo) { abort(); }
+PDEVICE_OBJECT FdoGetPhysicalDeviceObject(PXENDISK_FDO Fdo) { abort(); }
+PDRIVER_OBJECT DriverGetDriverObject(VOID) { abort(); }
+HANDLE DriverGetParametersKey(VOID) { abort(); }
+NTSTATUS RegistryQueryDwordValue(HANDLE Key, PCHAR Name, PULONG Value) { abort(); }
+NTSTATUS ThreadCreate(XENDISK_THREAD_FUNCTION Function, PVOID Context, PXENDISK_THREAD *Thread) { abort(); }
+PKEVENT ThreadGetEvent(PXENDISK_THREAD Self) { abort(); }
+BOOLEAN ThreadIsAlerted(PXENDISK_THREAD Self) { abort(); }
+VOID ThreadWake(PXENDISK_THREAD Thread) { abort(); }
+VOID ThreadAlert(PXENDISK_THREAD Thread) { abort(); }
+VOID ThreadJoin(PXENDISK_THREAD Thread) { abort(); }
+POWER_STATE PoSetPowerState(PDEVICE_OBJECT DeviceObject, POWER_STATE_TYPE Type, POWER_STATE State) { abort(); }
+NTSTATUS IoCreateDevice(PDRIVER_OBJECT DriverObject, ULONG ExtensionSize, PUNICODE_STRING Name, ULONG Type, ULONG Characteristics, BOOLEAN Exclusive, PDEVICE_OBJECT *DeviceObject) { abort(); }
+VOID IoDeleteDevice(PDEVICE_OBJECT DeviceObject) { abort(); }
+PDEVICE_OBJECT IoAttachDeviceToDeviceStack(PDEVICE_OBJECT Source, PDEVICE_OBJECT Target) { abort(); }
+VOID IoDetachDevice(PDEVICE_OBJECT DeviceObject) { abort(); }
+PDEVICE_OBJECT IoGetAttachedDeviceReference(PDEVICE_OBJECT DeviceObject) { abort(); }
+VOID IoInvalidateDeviceRelations(PDEVICE_OBJECT DeviceObject, DEVICE_RELATION_TYPE Type) { abort(); }
+VOID ObDereferenceObject(PVOID Object) { abort(); }
+
+// MDLs describe the buffer they were made for and must be unlocked
+// before they are freed
+
+PMDL
+IoAllocateMdl(
+    IN  PVOID   VirtualAddress,
+    IN  ULONG   Length,
+    IN  BOOLEAN SecondaryBuffer,
+    IN  BOOLEAN ChargeQuota,
+    IN  PVOID   Irp
+    )
+{
+    PMDL        Mdl;
+
+    Mdl = ExAllocatePoolWithTag(NonPagedPool, sizeof (MDL), 'ldM');
+    if (Mdl == NULL)
+        return NULL;
+
+    RtlZeroMemory(Mdl, sizeof (MDL));
+    Mdl->StartVa = PAGE_ALIGN(VirtualAddress);
+    Mdl->ByteOffset = BYTE_OFFSET(VirtualAddress);
+    Mdl->ByteCount = Length;
+
+    return Mdl;
+}
+
+VOID
+IoFreeMdl(
+    IN  PMDL    Mdl
+    )
+{
+    CHECK((Mdl->MdlFlags & MDL_PAGES_LOCKED) == 0);
+    ExFreePoolWithTag(Mdl, 'ldM');
+}
+
+VOID
+MmProbeAndLockPages(
+    IN  PMDL            Mdl,
+    IN  KPROCESSOR_MODE Mode,
+    IN  LOCK_OPERATION  Operation
+    )
+{
+    CHECK((Mdl->MdlFlags & MDL_PAGES_LOCKED) == 0);
+    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+}
+
+VOID
+MmUnlockPages(
+    IN  PMDL    Mdl
+    )
+{
+    CHECK(Mdl->MdlFlags & MDL_PAGES_LOCKED);
+    Mdl->MdlFlags &= ~MDL_PAGES_LOCKED;
+}
+
+// The lower driver: SCSI IRPs are held until a test completes them,
+// unless Synchronous is set, in which case they complete with Status
+// before IoCallDriver() returns.
+
+#define TEST_MAX_IRPS   8
+
+typedef struct _TEST_LOWER {
+    PIRP        Irp[TEST_MAX_IRPS];
+    ULONG       Count;
+    ULONG       Outstanding;
+    BOOLEAN     Synchronous;
+    NTSTATUS    Status[TEST_MAX_IRPS];
+} TEST_LOWER, *PTEST_LOWER;
+
+static TEST_LOWER   Lower;
+
+static NTSTATUS
+TestLowerComplete(
+    IN  ULONG           Index,
+    IN  NTSTATUS        Status
+    )
+{
+    PIRP                Irp = Lower.Irp[Index];
+    PIO_STACK_LOCATION  Stack = IoGetCurrentIrpStackLocation(Irp);
+    PSCSI_REQUEST_BLOCK Srb = Stack->Parameters.Scsi.Srb;
+
+    ASSERT(Irp != NULL);
+    Lower.Irp[Index] = NULL;
+    --Lower.Outstanding;
+
+    Srb->SrbStatus = NT_SUCCESS(Status) ? SRB_STATUS_SUCCESS : SRB_STATUS_ERROR;
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
+
+static NTSTATUS
+TestLowerDispatch(
+    IN  PDEVICE_OBJECT  DeviceObject,
+    IN  PIRP            Irp
+    )
+{
+    PIO_STACK_LOCATION  Stack = IoGetCurrentIrpStackLocation(Irp);
+    PSCSI_REQUEST_BLOCK Srb = Stack->Parameters.Scsi.Srb;
+    ULONG               Index;
+
+    CHECK_EQ(Stack->MajorFunction, IRP_MJ_SCSI);
+    CHECK(Srb->OriginalRequest == Irp);
+    CHECK(Irp->MdlAddress != NULL);
+    CHECK(Irp->MdlAddress->MdlFlags & MDL_PAGES_LOCKED);
+    CHECK(MmGetMdlVirtualAddress(Irp->MdlAddress) == Srb->DataBuffer);
+    CHECK_EQ(MmGetMdlByteCount(Irp->MdlAddress), Srb->DataTransferLength);
+
+    ASSERT3U(Lower.Count, <, TEST_MAX_IRPS);
+    Index = Lower.Count++;
+    Lower.Irp[Index] = Irp;
+    ++Lower.Outstanding;
+
+    if (Lower.Synchronous)
+        return TestLowerComplete(Index, Lower.Status[Index]);
+
+    IoMarkIrpPending(Irp);
+    return STATUS_PENDING;
+}
+
+static DRIVER_OBJECT    LowerDriver = {
+    .MajorFunction[IRP_MJ_SCSI] = TestLowerDispatch
+};
+
+static DEVICE_OBJECT    LowerDevice = {
+    .DriverObject = &LowerDriver,
+    .StackSize = 1
+};
+
+// The filter: the PDO under test, with 512 byte sectors
+
+static NTSTATUS
+TestFilterDispatch(
+    IN  PDEVICE_OBJECT  DeviceObject,
+    IN  PIRP            Irp
+    )
+{
+    PXENDISK_DX         Dx = DeviceObject->DeviceExtension;
+
+    return PdoDispatch(Dx->Pdo, Irp);
+}
+
+static DRIVER_OBJECT    FilterDriver = {
+    .MajorFunction[IRP_MJ_DEVICE_CONTROL] = TestFilterDispatch
+};
+
+static XENDISK_DX       FilterDx;
+static XENDISK_PDO      FilterPdo;
+
+static DEVICE_OBJECT    FilterDevice = {
+    .DriverObject = &FilterDriver,
+    .DeviceExtension = &FilterDx,
+    .StackSize = 2
+};
+
+static VOID
+TestPdoInitialize(
+    VOID
+    )
+{
+    RtlZeroMemory(&FilterDx, sizeof (XENDISK_DX));
+    RtlZeroMemory(&FilterPdo, sizeof (XENDISK_PDO));
+    RtlZeroMemory(&Lower, sizeof (TEST_LOWER));
+
+    FilterDx.DeviceObject = &FilterDevice;
+    FilterDx.Type = PHYSICAL_DEVICE_OBJECT;
+    FilterDx.DevicePnpState = Started;
+    FilterDx.Pdo = &FilterPdo;
+    IoInitializeRemoveLock(&FilterDx.RemoveLock, PDO_TAG, 0, 0);
+
+    FilterPdo.Dx = &FilterDx;
+    FilterPdo.LowerDeviceObject = &LowerDevice;
+    FilterPdo.PhysicalDeviceObject = &LowerDevice;
+    FilterPdo.InterceptTrim = TRUE;
+    FilterPdo.SectorSize = 512;
+}
+
+// The originator: a TRIM of Count ranges, range i being (i % 7) + 1
+// sectors at sector 16 * i
+
+#define TEST_MAX_RANGES 1024
+
+typedef struct _TEST_TRIM {
+    PIRP                    Irp;
+    NTSTATUS                DispatchStatus;
+    ULONG                   Completed;
+    NTSTATUS                Status;
+    BOOLEAN                 PendingReturned;
+    ULONG                   Outstanding;    // lower IRPs when it completed
+    ULONG                   Sent;           // lower IRPs sent by then
+    ULONG                   RemoveLockCount;
+
+    DEVICE_MANAGE_DATA_SET_ATTRIBUTES   Attributes;
+    DEVICE_DATA_SET_RANGE               Ranges[TEST_MAX_RANGES];
+} TEST_TRIM, *PTEST_TRIM;
+
+static NTSTATUS
+TestTrimCompleted(
+    IN  PDEVICE_OBJECT  DeviceObject,
+    IN  PIRP            Irp,
+    IN  PVOID           Context
+    )
+{
+    PTEST_TRIM          Trim = Context;
+
+    CHECK(Irp == Trim->Irp);
+
+    Trim->Completed++;
+    Trim->Status = Irp->IoStatus.Status;
+    Trim->PendingReturned = Irp->PendingReturned;
+    Trim->Outstanding = Lower.Outstanding;
+    Trim->Sent = Lower.Count;
+    Trim->RemoveLockCount = FilterDx.RemoveLock.IoCount;
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static VOID
+TestTrimSend(
+    IN  PTEST_TRIM      Trim,
+    IN  ULONG           Count
+    )
+{
+    PIO_STACK_LOCATION  Stack;
+    ULONG               Index;
+
+    ASSERT3U(Count, <=, TEST_MAX_RANGES);
+
+    RtlZeroMemory(Trim, sizeof (TEST_TRIM));
+
+    Trim->Attributes.Size = sizeof (DEVICE_MANAGE_DATA_SET_ATTRIBUTES);
+    Trim->Attributes.Action = DeviceDsmAction_Trim;
+    Trim->Attributes.DataSetRangesOffset = FIELD_OFFSET(TEST_TRIM, Ranges) -
+                                           FIELD_OFFSET(TEST_TRIM, Attributes);
+    Trim->Attributes.DataSetRangesLength = Count * sizeof (DEVICE_DATA_SET_RANGE);
+
+    for (Index = 0; Index < Count; ++Index) {
+        Trim->Ranges[Index].StartingOffset = 16ll * 512 * Index;
+        Trim->Ranges[Index].LengthInBytes = ((Index % 7) + 1) * 512;
+    }
+
+    Trim->Irp = IoAllocateIrp(FilterDevice.StackSize + 1, FALSE);
+    ASSERT(Trim->Irp != NULL);
+
+    Stack = IoGetNextIrpStackLocation(Trim->Irp);
+    Stack->MajorFunction = IRP_MJ_DEVICE_CONTROL;
+    Stack->Parameters.DeviceIoControl.IoControlCode = IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES;
+    Stack->Parameters.DeviceIoControl.InputBufferLength =
+        Trim->Attributes.DataSetRangesOffset + Trim->Attributes.DataSetRangesLength;
+
+    Trim->Irp->AssociatedIrp.SystemBuffer = &Trim->Attributes;
+    Trim->Irp->IoStatus.Status = STATUS_PENDING;
+
+    IoSetCompletionRoutine(Trim->Irp, TestTrimCompleted, Trim, TRUE, TRUE, TRUE);
+
+    Trim->DispatchStatus = IoCallDriver(&FilterDevice, Trim->Irp);
+}
+
+static VOID
+TestTrimFinish(
+    IN  PTEST_TRIM  Trim
+    )
+{
+    CHECK_EQ(Trim->Completed, 1);
+    CHECK_EQ(Trim->Outstanding, 0);
+    CHECK_EQ(FilterDx.RemoveLock.IoCount, 1);
+
+    IoFreeIrp(Trim->Irp);
+    CHECK_EQ(HostPoolAllocations, 0);
+}
+
+// Check the UNMAP in lower IRP Index against ranges First to First + Count
+static VOID
+TestCheckUnmap(
+    IN  PTEST_TRIM          Trim,
+    IN  ULONG               Index,
+    IN  ULONG               First,
+    IN  ULONG               Count
+    )
+{
+    PIRP                    Irp = Lower.Irp[Index];
+    PSCSI_REQUEST_BLOCK     Srb;
+    PUNMAP_LIST_HEADER      Unmap;
+    ULONG                   Length;
+    USHORT                  Value;
+    ULONG                   Descriptor;
+
+    Srb = IoGetCurrentIrpStackLocation(Irp)->Parameters.Scsi.Srb;
+    Unmap = Srb->DataBuffer;
+    Length = sizeof (UNMAP_LIST_HEADER) + Count * sizeof (UNMAP_BLOCK_DESCRIPTOR);
+
+    CHECK_EQ(Srb->Function, SRB_FUNCTION_EXECUTE_SCSI);
+    CHECK_EQ(Srb->CdbLength, 10);
+    CHECK_EQ(Srb->Cdb[0], SCSIOP_UNMAP);
+    CHECK_EQ(Srb->DataTransferLength, Length);
+
+    memcpy(&Value, &Srb->Cdb[7], sizeof (Value));
+    CHECK_EQ(_byteswap_ushort(Value), Length);
+    memcpy(&Value, Unmap->DataLength, sizeof (Value));
+    CHECK_EQ(_byteswap_ushort(Value), Length - 2);
+    memcpy(&Value, Unmap->BlockDescrDataLength, sizeof (Value));
+    CHECK_EQ(_byteswap_ushort(Value), Count * sizeof (UNMAP_BLOCK_DESCRIPTOR));
+
+    for (Descriptor = 0; Descriptor < Count; ++Descriptor) {
+        PDEVICE_DATA_SET_RANGE  Range = &Trim->Ranges[First + Descriptor];
+        ULONG64                 Lba;
+        ULONG                   LbaCount;
+
+        memcpy(&Lba, Unmap->Descriptors[Descriptor].StartingLba, sizeof (Lba));
+        memcpy(&LbaCount, Unmap->Descriptors[Descriptor].LbaCount, sizeof (LbaCount));
+
+        CHECK_EQ(_byteswap_uint64(Lba), Range->StartingOffset / 512);
+        CHECK_EQ(_byteswap_ulong(LbaCount), Range->LengthInBytes / 512);
+    }
+}
+
+static VOID
+TestTrimSplit(
+    VOID
+    )
+{
+    // Up to 256 ranges go in each UNMAP
+    static const struct {
+        ULONG   Count;
+        ULONG   Unmaps;
+    } Table[] = {
+        { 1, 1 },
+        { 2, 1 },
+        { 255, 1 },
+        { 256, 1 },
+        { 257, 2 },
+        { 512, 2 },
+        { 513, 3 },
+        { 1024, 4 },
+    };
+    ULONG   Index;
+
+    for (Index = 0; Index < ARRAYSIZE(Table); ++Index) {
+        ULONG           Count = Table[Index].Count;
+        static TEST_TRIM Trim;
+        ULONG           Srb;
+
+        TestPdoInitialize();
+        TestTrimSend(&Trim, Count);
+
+        // Every UNMAP is sent before any of them completes
+        CHECK_EQ(Trim.DispatchStatus, STATUS_PENDING);
+        CHECK_EQ(Trim.Completed, 0);
+        CHECK_EQ(Lower.Count, Table[Index].Unmaps);
+
+        for (Srb = 0; Srb < Lower.Count; ++Srb)
+            TestCheckUnmap(&Trim, Srb, Srb * 256, __min(Count - Srb * 256, 256));
+
+        // The IOCTL holds the remove lock until the last one completes
+        for (Srb = 0; Srb < Lower.Count; ++Srb) {
+            CHECK_EQ(Trim.Completed, 0);
+            CHECK_EQ(FilterDx.RemoveLock.IoCount, 2);
+            (VOID) TestLowerComplete(Srb, STATUS_SUCCESS);
+        }
+
+        CHECK_EQ(Trim.Status, STATUS_SUCCESS);
+        CHECK(Trim.PendingReturned);
+        CHECK_EQ(Trim.RemoveLockCount, 1);
+        TestTrimFinish(&Trim);
+    }
+}
+
+static VOID
+TestTrimEmpty(
+    VOID
+    )
+{
+    static TEST_TRIM    Trim;
+
+    // No ranges: nothing is sent and the IOCTL completes at once
+    TestPdoInitialize();
+    TestTrimSend(&Trim, 0);
+
+    CHECK_EQ(Trim.DispatchStatus, STATUS_PENDING);
+    CHECK_EQ(Lower.Count, 0);
+    CHECK_EQ(Trim.Status, STATUS_SUCCESS);
+    CHECK(Trim.PendingReturned);
+    TestTrimFinish(&Trim);
+}
+
+// Three UNMAPs, completed in the given order with the given statuses.
+// The IOCTL must complete with the last of them, with the status of
+// the first to fail.
+static VOID
+TestTrimCompletionOrder(
+    VOID
+    )
+{
+    static const struct {
+        ULONG       Order[3];
+        NTSTATUS    Status[3];      // By UNMAP, not by completion order
+        NTSTATUS    Expected;
+    } Table[] = {
+        { { 0, 1, 2 }, { STATUS_SUCCESS, STATUS_SUCCESS, STATUS_SUCCESS }, STATUS_SUCCESS },
+        { { 2, 1, 0 }, { STATUS_SUCCESS, STATUS_SUCCESS, STATUS_SUCCESS }, STATUS_SUCCESS },
+        { { 0, 1, 2 }, { STATUS_SUCCESS, STATUS_UNSUCCESSFUL, STATUS_SUCCESS }, STATUS_UNSUCCESSFUL },
+        { { 1, 0, 2 }, { STATUS_SUCCESS, STATUS_UNSUCCESSFUL, STATUS_SUCCESS }, STATUS_UNSUCCESSFUL },
+        { { 0, 2, 1 }, { STATUS_SUCCESS, STATUS_UNSUCCESSFUL, STATUS_SUCCESS }, STATUS_UNSUCCESSFUL },
+        { { 2, 1, 0 }, { STATUS_NOT_SUPPORTED, STATUS_UNSUCCESSFUL, STATUS_SUCCESS }, STATUS_UNSUCCESSFUL },
+        { { 0, 2, 1 }, { STATUS_SUCCESS, STATUS_UNSUCCESSFUL, STATUS_NOT_SUPPORTED }, STATUS_NOT_SUPPORTED },
+        { { 1, 2, 0 }, { STATUS_NOT_SUPPORTED, STATUS_UNSUCCESSFUL, STATUS_NO_MEMORY }, STATUS_UNSUCCESSFUL },
+    };
+    ULONG   Index;
+
+    for (Index = 0; Index < ARRAYSIZE(Table); ++Index) {
+        static TEST_TRIM    Trim;
+        ULONG               Step;
+
+        TestPdoInitialize();
+        TestTrimSend(&Trim, 513);
+        CHECK_EQ(Lower.Count, 3);
+
+        for (Step = 0; Step < 3; ++Step) {
+            ULONG   Srb = Table[Index].Order[Step];
+
+            CHECK_EQ(Trim.Completed, 0);
+            (VOID) TestLowerComplete(Srb, Table[Index].Status[Srb]);
+        }
+
+        CHECK_EQ(Trim.Status, Table[Index].Expected);
+        TestTrimFinish(&Trim);
+    }
+}
+
+// UNMAPs that complete inside IoCallDriver() must not complete the
+// IOCTL before the last of them has been sent
+static VOID
+TestTrimSynchronous(
+    VOID
+    )
+{
+    static const NTSTATUS   Status[][3] = {
+        { STATUS_SUCCESS, STATUS_SUCCESS, STATUS_SUCCESS },
+        { STATUS_SUCCESS, STATUS_UNSUCCESSFUL, STATUS_SUCCESS },
+        { STATUS_UNSUCCESSFUL, STATUS_NOT_SUPPORTED, STATUS_SUCCESS },
+    };
+    ULONG                   Index;
+
+    for (Index = 0; Index < ARRAYSIZE(Status); ++Index) {
+        static TEST_TRIM    Trim;
+        NTSTATUS            Expected;
+        ULONG               Srb;
+
+        TestPdoInitialize();
+        Lower.Synchronous = TRUE;
+        memcpy(Lower.Status, Status[Index], sizeof (Status[Index]));
+
+        TestTrimSend(&Trim, 513);
+
+        Expected = STATUS_SUCCESS;
+        for (Srb = 0; Srb < 3; ++Srb) {
+            if (!NT_SUCCESS(Status[Index][Srb])) {
+                Expected = Status[Index][Srb];
+                break;
+            }
+        }
+
+        CHECK_EQ(Trim.DispatchStatus, STATUS_PENDING);
+        CHECK_EQ(Lower.Count, 3);
+        CHECK_EQ(Trim.Sent, 3);
+        CHECK_EQ(Trim.Status, Expected);
+        TestTrimFinish(&Trim);
+    }
+}
+
+// An allocation failure stops the split. The UNMAPs already sent still
+// complete, and the IOCTL reports the failure once they have.
+static VOID
+TestTrimAllocationFailure(
+    VOID
+    )
+{
+    // The XENDISK_TRIM, then an SRB, an IRP and an MDL for each UNMAP
+    ULONG   Skip;
+
+    for (Skip = 0; Skip < 1 + 3 * 3; ++Skip) {
+        static TEST_TRIM    Trim;
+        ULONG               Sent = (Skip == 0) ? 0 : (Skip - 1) / 3;
+        ULONG               Srb;
+
+        TestPdoInitialize();
+
+        // The originator's IRP is allocated first
+        HostPoolFailSkip = Skip + 1;
+        HostPoolFailCount = 1;
+
+        TestTrimSend(&Trim, 513);
+
+        CHECK_EQ(HostPoolFailCount, 0);
+        HostPoolFailCount = 0;
+        HostPoolFailSkip = 0;
+
+        CHECK_EQ(Lower.Count, Sent);
+
+        if (Skip == 0) {
+            // Nothing to wait for: the IOCTL fails straight away
+            CHECK_EQ(Trim.DispatchStatus, STATUS_NO_MEMORY);
+        } else {
+            CHECK_EQ(Trim.DispatchStatus, STATUS_PENDING);
+        }
+
+        for (Srb = 0; Srb < Sent; ++Srb) {
+            CHECK_EQ(Trim.Completed, 0);
+            (VOID) TestLowerComplete(Srb, STATUS_SUCCESS);
+        }
+
+        CHECK_EQ(Trim.Status, STATUS_NO_MEMORY);
+        TestTrimFinish(&Trim);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestTrimSplit();
+    TestTrimEmpty();
+    TestTrimCompletionOrder();
+    TestTrimSynchronous();
+    TestTrimAllocationFailure();
+
+    return TEST_RESULT("pdo_test");
+}
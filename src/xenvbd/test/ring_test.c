@@ -0,0 +1,1693 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+// Host test for the request path in ring.c.
+//
+// SRBs are queued to a ring made by RingCreate() over fake cache,
+// granter and adapter neighbours, and prepared with RingPrepareFresh()
+// as the DPC would. A fake backend then consumes the shared ring,
+// following indirect pages through the fake grant table, and responds
+// in whatever order a test asks for.
+
+#include <ntddk.h>
+
+#include "debug.h"
+#include "assert.h"
+
+// Keep the driver's own headers for the ring's neighbours out of the
+// way; the declarations ring.c needs are provided below.
+#define _XENVBD_FRONTEND_H
+#define _XENVBD_TARGET_H
+#define _XENVBD_ADAPTER_H
+#define _XENVBD_DRIVER_H
+#define _XENVBD_GRANTER_H
+#define _XEN_H
+#define XENCDB_H
+
+#include <storport.h>
+#include <xen-version.h>
+#include <xen/io/ring.h>
+#include <xen/io/blkif.h>
+#include <cache_interface.h>
+#include <store_interface.h>
+#include <evtchn_interface.h>
+#include <debug_interface.h>
+
+typedef struct _XENVBD_CAPS {
+    BOOLEAN                     Connected;
+    BOOLEAN                     Removable;
+    BOOLEAN                     SurpriseRemovable;
+    BOOLEAN                     Paging;
+    BOOLEAN                     Hibernation;
+    BOOLEAN                     DumpFile;
+} XENVBD_CAPS, *PXENVBD_CAPS;
+
+typedef struct _XENVBD_FEATURES {
+    ULONG                       Indirect;
+    BOOLEAN                     Persistent;
+} XENVBD_FEATURES, *PXENVBD_FEATURES;
+
+typedef struct _XENVBD_DISKINFO {
+    ULONG64                     SectorCount;
+    ULONG                       SectorSize;
+    ULONG                       PhysSectorSize;
+    ULONG                       DiskInfo;
+    BOOLEAN                     Barrier;
+    BOOLEAN                     FlushCache;
+    BOOLEAN                     Discard;
+    BOOLEAN                     DiscardSecure;
+    ULONG                       DiscardAlignment;
+    ULONG                       DiscardGranularity;
+} XENVBD_DISKINFO, *PXENVBD_DISKINFO;
+
+typedef enum _XENVBD_FEATURE {
+    FeatureRemovable = 0,
+    FeaturePersistent,
+    FeatureMaxIndirectSegments,
+    FeatureBarrier,
+    FeatureFlushCache,
+    FeatureDiscard,
+    FeatureDiscardEnable,
+    FeatureDiscardSecure,
+    FeatureDiscardAlignment,
+    FeatureDiscardGranularity,
+    FeatureMaxRingPageOrder,
+
+    // Add any new features before this enum
+    NumberOfFeatures
+} XENVBD_FEATURE, *PXENVBD_FEATURE;
+
+typedef struct _XENVBD_FRONTEND XENVBD_FRONTEND, *PXENVBD_FRONTEND;
+typedef struct _XENVBD_TARGET   XENVBD_TARGET, *PXENVBD_TARGET;
+typedef struct _XENVBD_ADAPTER  XENVBD_ADAPTER, *PXENVBD_ADAPTER;
+typedef struct _XENVBD_GRANTER  XENVBD_GRANTER, *PXENVBD_GRANTER;
+
+#include "srbext.h"
+
+// Just the 16 byte READ, WRITE and SYNCHRONIZE CACHE forms that the
+// tests build, and UNMAP
+static UCHAR
+Cdb_OperationEx(
+    IN  const SCSI_REQUEST_BLOCK    *Srb
+    )
+{
+    switch (Srb->Cdb[0]) {
+    case SCSIOP_READ16:
+        return SCSIOP_READ;
+    case SCSIOP_WRITE16:
+        return SCSIOP_WRITE;
+    case SCSIOP_SYNCHRONIZE_CACHE16:
+        return SCSIOP_SYNCHRONIZE_CACHE;
+    default:
+        return Srb->Cdb[0];
+    }
+}
+
+static ULONG64
+Cdb_LogicalBlock(
+    IN  const SCSI_REQUEST_BLOCK    *Srb
+    )
+{
+    ULONG64     Value;
+
+    memcpy(&Value, &Srb->Cdb[2], sizeof (Value));
+    return _byteswap_uint64(Value);
+}
+
+static ULONG
+Cdb_TransferBlock(
+    IN  const SCSI_REQUEST_BLOCK    *Srb
+    )
+{
+    ULONG       Value;
+
+    memcpy(&Value, &Srb->Cdb[10], sizeof (Value));
+    return _byteswap_ulong(Value);
+}
+
+static PXENVBD_GRANTER      FrontendGetGranter(PXENVBD_FRONTEND);
+static PXENVBD_TARGET       FrontendGetTarget(PXENVBD_FRONTEND);
+static PXENVBD_DISKINFO     FrontendGetDiskInfo(PXENVBD_FRONTEND);
+static PXENVBD_FEATURES     FrontendGetFeatures(PXENVBD_FRONTEND);
+static PXENVBD_CAPS         FrontendGetCaps(PXENVBD_FRONTEND);
+static ULONG                FrontendGetTargetId(PXENVBD_FRONTEND);
+static ULONG                FrontendGetDeviceId(PXENVBD_FRONTEND);
+static PCHAR                FrontendGetBackendPath(PXENVBD_FRONTEND);
+static PCHAR                FrontendGetFrontendPath(PXENVBD_FRONTEND);
+static USHORT               FrontendGetBackendDomain(PXENVBD_FRONTEND);
+static VOID                 FrontendRemoveFeature(PXENVBD_FRONTEND, UCHAR);
+static PXENVBD_ADAPTER      TargetGetAdapter(PXENVBD_TARGET);
+static VOID                 AdapterGetCacheInterface(PXENVBD_ADAPTER, PXENBUS_CACHE_INTERFACE);
+static VOID                 AdapterGetStoreInterface(PXENVBD_ADAPTER, PXENBUS_STORE_INTERFACE);
+static VOID                 AdapterGetEvtchnInterface(PXENVBD_ADAPTER, PXENBUS_EVTCHN_INTERFACE);
+static VOID                 AdapterGetDebugInterface(PXENVBD_ADAPTER, PXENBUS_DEBUG_INTERFACE);
+static VOID                 AdapterCompleteSrb(PXENVBD_ADAPTER, PXENVBD_SRBEXT);
+static PFN_NUMBER           AdapterGetNextSGEntry(PXENVBD_ADAPTER, PXENVBD_SRBEXT,
+                                                  ULONG, PULONG, PULONG);
+static PXENVBD_BOUNCE       AdapterGetBounce(PXENVBD_ADAPTER);
+static VOID                 AdapterPutBounce(PXENVBD_ADAPTER, PXENVBD_BOUNCE);
+static NTSTATUS             GranterGet(PXENVBD_GRANTER, PFN_NUMBER, BOOLEAN, PVOID *);
+static VOID                 GranterPut(PXENVBD_GRANTER, PVOID);
+static ULONG                GranterReference(PXENVBD_GRANTER, PVOID);
+static BOOLEAN              DriverGetFeatureOverride(XENVBD_FEATURE, PULONG);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_EVTCHN
+#define XENBUS_EVTCHN(_Method, _Interface, ...)    \
+    (_Interface)->Evtchn ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_CACHE
+#define XENBUS_CACHE(_Method, _Interface, ...)    \
+    (_Interface)->Cache ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenvbd/queue.c"
+#include "../src/xenvbd/ring.c"
+
+#include "test.h"
+
+// The frontend: 512 byte sectors, with indirect segments as a test sets
+
+struct _XENVBD_FRONTEND {
+    XENVBD_DISKINFO     DiskInfo;
+    XENVBD_FEATURES     Features;
+    XENVBD_CAPS         Caps;
+};
+
+static XENVBD_FRONTEND  Frontend;
+
+// The granter: handles are entries in a table indexed by reference, so
+// the backend below can find the page behind any reference it is given.
+// Get can be made to fail after a given number of successes.
+
+#define TEST_GRANTS     8192
+
+typedef struct _TEST_GRANT {
+    BOOLEAN         InUse;
+    BOOLEAN         ReadOnly;
+    PFN_NUMBER      Pfn;
+} TEST_GRANT, *PTEST_GRANT;
+
+struct _XENVBD_GRANTER {
+    TEST_GRANT      Grant[TEST_GRANTS];
+    ULONG           Next;
+    LONG            Outstanding;
+    LONG            Budget;
+};
+
+static XENVBD_GRANTER   Granter = { .Next = 1, .Budget = -1 };
+
+static NTSTATUS
+GranterGet(
+    IN  PXENVBD_GRANTER Granter,
+    IN  PFN_NUMBER      Pfn,
+    IN  BOOLEAN         ReadOnly,
+    OUT PVOID           *Handle
+    )
+{
+    ULONG               Count;
+
+    if (Granter->Budget == 0)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    if (Granter->Budget > 0)
+        --Granter->Budget;
+
+    // Reference 0 is never handed out, as with the real table
+    for (Count = 0; Count < TEST_GRANTS; ++Count) {
+        PTEST_GRANT     Grant = &Granter->Grant[Granter->Next];
+
+        Granter->Next = (Granter->Next + 1) % TEST_GRANTS;
+        if (Granter->Next == 0)
+            Granter->Next = 1;
+
+        if (Grant->InUse || Grant == &Granter->Grant[0])
+            continue;
+
+        Grant->InUse = TRUE;
+        Grant->ReadOnly = ReadOnly;
+        Grant->Pfn = Pfn;
+        ++Granter->Outstanding;
+
+        *Handle = Grant;
+        return STATUS_SUCCESS;
+    }
+
+    abort();
+}
+
+static VOID
+GranterPut(
+    IN  PXENVBD_GRANTER Granter,
+    IN  PVOID           Handle
+    )
+{
+    PTEST_GRANT         Grant = Handle;
+
+    ASSERT(Grant->InUse);
+    RtlZeroMemory(Grant, sizeof (TEST_GRANT));
+    --Granter->Outstanding;
+}
+
+static ULONG
+GranterReference(
+    IN  PXENVBD_GRANTER Granter,
+    IN  PVOID           Handle
+    )
+{
+    return (ULONG)((PTEST_GRANT)Handle - Granter->Grant);
+}
+
+static PTEST_GRANT
+TestGrantLookup(
+    IN  ULONG   Reference
+    )
+{
+    PTEST_GRANT Grant;
+
+    ASSERT3U(Reference, <, TEST_GRANTS);
+    Grant = &Granter.Grant[Reference];
+    ASSERT(Grant->InUse);
+
+    return Grant;
+}
+
+// The caches: objects come straight from the (counted) pool and are
+// constructed on every Get. Get can be made to fail after a given
+// number of successes.
+
+struct _XENBUS_CACHE {
+    ULONG               Size;
+    XENBUS_CACHE_CTOR   Ctor;
+    XENBUS_CACHE_DTOR   Dtor;
+    PVOID               Argument;
+    LONG                Outstanding;
+    LONG                Budget;
+};
+
+static NTSTATUS
+CacheAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    return STATUS_SUCCESS;
+}
+
+static VOID
+CacheRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+}
+
+static NTSTATUS
+CacheCreate(
+    IN  PINTERFACE                  Interface,
+    IN  const CHAR                  *Name,
+    IN  ULONG                       Size,
+    IN  ULONG                       Reservation,
+    IN  XENBUS_CACHE_CTOR           Ctor,
+    IN  XENBUS_CACHE_DTOR           Dtor,
+    IN  XENBUS_CACHE_ACQUIRE_LOCK   AcquireLock,
+    IN  XENBUS_CACHE_RELEASE_LOCK   ReleaseLock,
+    IN  PVOID                       Argument OPTIONAL,
+    OUT PXENBUS_CACHE               *Cache
+    )
+{
+    *Cache = ExAllocatePoolWithTag(NonPagedPool, sizeof (XENBUS_CACHE), 'TSET');
+    if (*Cache == NULL)
+        return STATUS_NO_MEMORY;
+
+    (*Cache)->Size = Size;
+    (*Cache)->Ctor = Ctor;
+    (*Cache)->Dtor = Dtor;
+    (*Cache)->Argument = Argument;
+    (*Cache)->Outstanding = 0;
+    (*Cache)->Budget = -1;
+
+    return STATUS_SUCCESS;
+}
+
+static PVOID
+CacheGet(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache,
+    IN  BOOLEAN         Locked
+    )
+{
+    PVOID               Object;
+
+    if (Cache->Budget == 0)
+        return NULL;
+    if (Cache->Budget > 0)
+        --Cache->Budget;
+
+    Object = ExAllocatePoolWithTag(NonPagedPool, Cache->Size, 'TSET');
+    if (Object == NULL)
+        return NULL;
+
+    RtlZeroMemory(Object, Cache->Size);
+    if (!NT_SUCCESS(Cache->Ctor(Cache->Argument, Object))) {
+        ExFreePool(Object);
+        return NULL;
+    }
+
+    ++Cache->Outstanding;
+    return Object;
+}
+
+static VOID
+CachePut(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache,
+    IN  PVOID           Object,
+    IN  BOOLEAN         Locked
+    )
+{
+    Cache->Dtor(Cache->Argument, Object);
+    ExFreePool(Object);
+    --Cache->Outstanding;
+}
+
+static VOID
+CacheDestroy(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache
+    )
+{
+    CHECK_EQ(Cache->Outstanding, 0);
+    ExFreePool(Cache);
+}
+
+// Indirect pages are real, so that the backend can read them; the PFN
+// of a page is just its address shifted down.
+
+PMDL
+MmAllocatePagesForMdlEx(
+    IN  PHYSICAL_ADDRESS    LowAddress,
+    IN  PHYSICAL_ADDRESS    HighAddress,
+    IN  PHYSICAL_ADDRESS    SkipBytes,
+    IN  SIZE_T              TotalBytes,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  ULONG               Flags
+    )
+{
+    PMDL                    Mdl;
+    PVOID                   Page;
+
+    ASSERT3U(TotalBytes, ==, PAGE_SIZE);
+
+    Mdl = ExAllocatePoolWithTag(NonPagedPool,
+                                sizeof (MDL) + sizeof (PFN_NUMBER),
+                                'TSET');
+    if (Mdl == NULL)
+        return NULL;
+
+    if (posix_memalign(&Page, PAGE_SIZE, PAGE_SIZE) != 0) {
+        ExFreePool(Mdl);
+        return NULL;
+    }
+
+    RtlZeroMemory(Mdl, sizeof (MDL));
+    Mdl->StartVa = Page;
+    Mdl->ByteCount = PAGE_SIZE;
+    MmGetMdlPfnArray(Mdl)[0] = (PFN_NUMBER)((ULONG_PTR)Page >> PAGE_SHIFT);
+
+    return Mdl;
+}
+
+PVOID
+MmMapLockedPagesSpecifyCache(
+    IN  PMDL                Mdl,
+    IN  KPROCESSOR_MODE     AccessMode,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  PVOID               BaseAddress,
+    IN  ULONG               BugCheckOnFailure,
+    IN  ULONG               Priority
+    )
+{
+    Mdl->MappedSystemVa = Mdl->StartVa;
+    Mdl->MdlFlags |= MDL_MAPPED_TO_SYSTEM_VA;
+
+    return Mdl->MappedSystemVa;
+}
+
+VOID
+MmUnmapLockedPages(
+    IN  PVOID   BaseAddress,
+    IN  PMDL    Mdl
+    )
+{
+    ASSERT3P(BaseAddress, ==, Mdl->MappedSystemVa);
+    Mdl->MappedSystemVa = NULL;
+    Mdl->MdlFlags &= ~MDL_MAPPED_TO_SYSTEM_VA;
+}
+
+VOID
+MmFreePagesFromMdl(
+    IN  PMDL    Mdl
+    )
+{
+    free(Mdl->StartVa);
+    Mdl->StartVa = NULL;
+}
+
+// SRBs: the data of each is a run of whole, distinct pages starting at
+// its own PFN, so that the backend can tell whose page a segment is.
+
+#define TEST_MAX_DESCRIPTORS    8
+
+typedef struct _TEST_SRB {
+    SCSI_REQUEST_BLOCK  Srb;
+    XENVBD_SRBEXT       SrbExt;
+    PFN_NUMBER          Pfn;
+    ULONG64             Unmap[(sizeof (UNMAP_LIST_HEADER) +
+                               TEST_MAX_DESCRIPTORS * sizeof (UNMAP_BLOCK_DESCRIPTOR)) /
+                              sizeof (ULONG64)];
+} TEST_SRB, *PTEST_SRB;
+
+static VOID
+TestSrbInitialize(
+    IN  PTEST_SRB   TestSrb,
+    IN  UCHAR       Operation,
+    IN  ULONG64     Sector,
+    IN  ULONG       Sectors,
+    IN  PFN_NUMBER  Pfn
+    )
+{
+    PSCSI_REQUEST_BLOCK Srb = &TestSrb->Srb;
+    ULONG64             Lba = _byteswap_uint64(Sector);
+    ULONG               Length = _byteswap_ulong(Sectors);
+
+    RtlZeroMemory(TestSrb, sizeof (TEST_SRB));
+
+    Srb->CdbLength = 16;
+    Srb->Cdb[0] = Operation;
+    memcpy(&Srb->Cdb[2], &Lba, sizeof (Lba));
+    memcpy(&Srb->Cdb[10], &Length, sizeof (Length));
+    Srb->DataTransferLength = Sectors * Frontend.DiskInfo.SectorSize;
+    Srb->SrbExtension = &TestSrb->SrbExt;
+    Srb->SrbStatus = 0xFF;
+
+    TestSrb->SrbExt.Srb = Srb;
+    TestSrb->SrbExt.SGList = TestSrb;
+    TestSrb->Pfn = Pfn;
+}
+
+// Append a block descriptor to an UNMAP SRB
+static VOID
+TestSrbAddUnmap(
+    IN  PTEST_SRB   TestSrb,
+    IN  ULONG64     Start,
+    IN  ULONG       Length
+    )
+{
+    PUNMAP_LIST_HEADER  Header = (PUNMAP_LIST_HEADER)TestSrb->Unmap;
+    USHORT              Value;
+    ULONG64             Lba;
+    ULONG               Count;
+
+    memcpy(&Value, Header->BlockDescrDataLength, sizeof (Value));
+    Count = _byteswap_ushort(Value) / sizeof (UNMAP_BLOCK_DESCRIPTOR);
+    ASSERT3U(Count, <, TEST_MAX_DESCRIPTORS);
+
+    Lba = _byteswap_uint64(Start);
+    Length = _byteswap_ulong(Length);
+    memcpy(Header->Descriptors[Count].StartingLba, &Lba, sizeof (Lba));
+    memcpy(Header->Descriptors[Count].LbaCount, &Length, sizeof (Length));
+    ++Count;
+
+    Value = _byteswap_ushort((USHORT)(Count * sizeof (UNMAP_BLOCK_DESCRIPTOR)));
+    memcpy(Header->BlockDescrDataLength, &Value, sizeof (Value));
+    Value = _byteswap_ushort((USHORT)(Count * sizeof (UNMAP_BLOCK_DESCRIPTOR) + 6));
+    memcpy(Header->DataLength, &Value, sizeof (Value));
+
+    TestSrb->Srb.DataBuffer = Header;
+    TestSrb->Srb.DataTransferLength = sizeof (UNMAP_LIST_HEADER) +
+                                      Count * sizeof (UNMAP_BLOCK_DESCRIPTOR);
+}
+
+static PFN_NUMBER
+AdapterGetNextSGEntry(
+    IN  PXENVBD_ADAPTER Adapter,
+    IN  PXENVBD_SRBEXT  SrbExt,
+    IN  ULONG           Existing,
+    OUT PULONG          Offset,
+    OUT PULONG          Length
+    )
+{
+    PTEST_SRB           TestSrb = SrbExt->SGList;
+    ULONG               Done = SrbExt->SGIndex * PAGE_SIZE;
+
+    ASSERT3U(Existing, ==, 0);
+    ASSERT3U(Done, <, TestSrb->Srb.DataTransferLength);
+
+    *Offset = 0;
+    *Length = __min(PAGE_SIZE, TestSrb->Srb.DataTransferLength - Done);
+
+    return TestSrb->Pfn + SrbExt->SGIndex++;
+}
+
+static PXENVBD_BOUNCE
+AdapterGetBounce(
+    IN  PXENVBD_ADAPTER Adapter
+    )
+{
+    abort();    // the SRBs here never need bouncing
+}
+
+static VOID
+AdapterPutBounce(
+    IN  PXENVBD_ADAPTER Adapter,
+    IN  PXENVBD_BOUNCE  Bounce
+    )
+{
+    abort();
+}
+
+// Completions are recorded in order, along with how many grants were
+// still held at the time.
+
+#define TEST_MAX_COMPLETIONS    64
+
+static PSCSI_REQUEST_BLOCK  Completed[TEST_MAX_COMPLETIONS];
+static LONG                 CompletedGrants[TEST_MAX_COMPLETIONS];
+static ULONG                CompletedCount;
+
+static VOID
+AdapterCompleteSrb(
+    IN  PXENVBD_ADAPTER Adapter,
+    IN  PXENVBD_SRBEXT  SrbExt
+    )
+{
+    ASSERT3U(SrbExt->Srb->SrbStatus, !=, SRB_STATUS_PENDING);
+    ASSERT3U(CompletedCount, <, TEST_MAX_COMPLETIONS);
+
+    CompletedGrants[CompletedCount] = Granter.Outstanding;
+    Completed[CompletedCount++] = SrbExt->Srb;
+}
+
+static XENBUS_CACHE_INTERFACE   CacheInterface = {
+    .CacheAcquire = CacheAcquire,
+    .CacheRelease = CacheRelease,
+    .CacheCreate = CacheCreate,
+    .CacheGet = CacheGet,
+    .CachePut = CachePut,
+    .CacheDestroy = CacheDestroy
+};
+
+static VOID
+AdapterGetCacheInterface(
+    IN  PXENVBD_ADAPTER         Adapter,
+    OUT PXENBUS_CACHE_INTERFACE Interface
+    )
+{
+    *Interface = CacheInterface;
+}
+
+static VOID
+EvtchnSend(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel
+    )
+{
+}
+
+// Neighbours; nothing on the request path reaches these
+
+static PXENVBD_GRANTER FrontendGetGranter(PXENVBD_FRONTEND Frontend) { return &Granter; }
+static PXENVBD_TARGET FrontendGetTarget(PXENVBD_FRONTEND Frontend) { return NULL; }
+static PXENVBD_DISKINFO FrontendGetDiskInfo(PXENVBD_FRONTEND Frontend) { return &Frontend->DiskInfo; }
+static PXENVBD_FEATURES FrontendGetFeatures(PXENVBD_FRONTEND Frontend) { return &Frontend->Features; }
+static PXENVBD_CAPS FrontendGetCaps(PXENVBD_FRONTEND Frontend) { return &Frontend->Caps; }
+static ULONG FrontendGetTargetId(PXENVBD_FRONTEND Frontend) { return 0; }
+static ULONG FrontendGetDeviceId(PXENVBD_FRONTEND Frontend) { return 768; }
+static PCHAR FrontendGetBackendPath(PXENVBD_FRONTEND Frontend) { abort(); }
+static PCHAR FrontendGetFrontendPath(PXENVBD_FRONTEND Frontend) { abort(); }
+static USHORT FrontendGetBackendDomain(PXENVBD_FRONTEND Frontend) { abort(); }
+static VOID FrontendRemoveFeature(PXENVBD_FRONTEND Frontend, UCHAR Operation) { abort(); }
+static PXENVBD_ADAPTER TargetGetAdapter(PXENVBD_TARGET Target) { return NULL; }
+static VOID AdapterGetStoreInterface(PXENVBD_ADAPTER Adapter, PXENBUS_STORE_INTERFACE Interface) { abort(); }
+static VOID AdapterGetEvtchnInterface(PXENVBD_ADAPTER Adapter, PXENBUS_EVTCHN_INTERFACE Interface) { abort(); }
+static VOID AdapterGetDebugInterface(PXENVBD_ADAPTER Adapter, PXENBUS_DEBUG_INTERFACE Interface) { abort(); }
+static BOOLEAN DriverGetFeatureOverride(XENVBD_FEATURE Feature, PULONG Value) { abort(); }
+
+// The DPC is driven by hand
+BOOLEAN KeInsertQueueDpc(PKDPC Dpc, PVOID Argument1, PVOID Argument2) { return FALSE; }
+BOOLEAN KeSetTimer(PKTIMER Timer, LARGE_INTEGER DueTime, PKDPC Dpc) { abort(); }
+BOOLEAN KeCancelTimer(PKTIMER Timer) { abort(); }
+NTSTATUS KeQueryDpcWatchdogInformation(PKDPC_WATCHDOG_INFORMATION Information) { abort(); }
+NTSTATUS KeGetProcessorNumberFromIndex(ULONG Index, PPROCESSOR_NUMBER Number) { abort(); }
+VOID StorPortStallExecution(ULONG Delay) { abort(); }
+
+// The backend: requests are taken off the shared ring and decoded,
+// indirect ones through their pages, into one flat list of segments
+
+#define TEST_MAX_TAKEN      8
+#define TEST_MAX_SEGMENTS   (BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST * XENVBD_MAX_SEGMENTS_PER_PAGE)
+
+typedef struct _TEST_REQUEST {
+    ULONG64     Id;
+    UCHAR       Operation;
+    BOOLEAN     Indirect;
+    ULONG64     Sector;
+    ULONG64     NrSectors;  // Counted from the segments, or as given for a discard
+    ULONG       NrSegments;
+    ULONG       NrPages;    // Indirect pages
+    PFN_NUMBER  Pfn[TEST_MAX_SEGMENTS];
+} TEST_REQUEST, *PTEST_REQUEST;
+
+static blkif_back_ring_t    Back;
+static TEST_REQUEST         Taken[TEST_MAX_TAKEN];
+
+static VOID
+TestDecodeSegment(
+    IN  PTEST_REQUEST   Request,
+    IN  ULONG           Reference,
+    IN  UCHAR           First,
+    IN  UCHAR           Last
+    )
+{
+    PTEST_GRANT         Grant = TestGrantLookup(Reference);
+
+    // A write only needs the backend to read the page
+    CHECK_EQ(Grant->ReadOnly, Request->Operation == BLKIF_OP_WRITE);
+    CHECK(First <= Last);
+    CHECK(Last < PAGE_SIZE / Frontend.DiskInfo.SectorSize);
+
+    ASSERT3U(Request->NrSegments, <, TEST_MAX_SEGMENTS);
+    Request->Pfn[Request->NrSegments++] = Grant->Pfn;
+    Request->NrSectors += Last - First + 1;
+}
+
+static ULONG
+BackendTake(
+    VOID
+    )
+{
+    ULONG   Count;
+
+    for (Count = 0; RING_HAS_UNCONSUMED_REQUESTS(&Back); ++Count) {
+        blkif_request_t *req = RING_GET_REQUEST(&Back, Back.req_cons);
+        PTEST_REQUEST   Request = &Taken[Count];
+        ULONG           Index;
+
+        ASSERT3U(Count, <, TEST_MAX_TAKEN);
+        ++Back.req_cons;
+
+        RtlZeroMemory(Request, sizeof (TEST_REQUEST));
+        Request->Id = req->id;
+        Request->Sector = req->sector_number;
+
+        if (req->operation == BLKIF_OP_INDIRECT) {
+            blkif_request_indirect_t    *req_indirect = (blkif_request_indirect_t *)req;
+            ULONG                       NrSegments = req_indirect->nr_segments;
+
+            Request->Operation = req_indirect->indirect_op;
+            Request->Indirect = TRUE;
+            CHECK_EQ(req_indirect->handle, 768);
+            CHECK(NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST);
+
+            Request->NrPages = (NrSegments + XENVBD_MAX_SEGMENTS_PER_PAGE - 1) /
+                               XENVBD_MAX_SEGMENTS_PER_PAGE;
+            ASSERT3U(Request->NrPages, <=, BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST);
+
+            for (Index = 0; Index < NrSegments; ++Index) {
+                PTEST_GRANT     Page;
+                PBLKIF_SEGMENT  Segment;
+
+                Page = TestGrantLookup(req_indirect->indirect_grefs[Index / XENVBD_MAX_SEGMENTS_PER_PAGE]);
+                CHECK(Page->ReadOnly);
+
+                Segment = (PBLKIF_SEGMENT)(Page->Pfn << PAGE_SHIFT);
+                Segment += Index % XENVBD_MAX_SEGMENTS_PER_PAGE;
+
+                TestDecodeSegment(Request, Segment->GrantRef, Segment->First, Segment->Last);
+            }
+        } else if (req->operation == BLKIF_OP_DISCARD) {
+            blkif_request_discard_t     *req_discard = (blkif_request_discard_t *)req;
+
+            Request->Operation = BLKIF_OP_DISCARD;
+            CHECK_EQ(req_discard->handle, 768);
+            CHECK_EQ(req_discard->flag, 0);
+            Request->NrSectors = req_discard->nr_sectors;
+        } else {
+            Request->Operation = req->operation;
+            CHECK_EQ(req->handle, 768);
+            CHECK(req->nr_segments <= BLKIF_MAX_SEGMENTS_PER_REQUEST);
+
+            if (req->operation == BLKIF_OP_READ ||
+                req->operation == BLKIF_OP_WRITE) {
+                for (Index = 0; Index < req->nr_segments; ++Index)
+                    TestDecodeSegment(Request,
+                                      req->seg[Index].gref,
+                                      req->seg[Index].first_sect,
+                                      req->seg[Index].last_sect);
+            } else {
+                CHECK_EQ(req->nr_segments, 0);
+            }
+        }
+    }
+
+    return Count;
+}
+
+static VOID
+BackendRespond(
+    IN  PXENVBD_RING    Ring,
+    IN  PTEST_REQUEST   Request,
+    IN  SHORT           Status
+    )
+{
+    blkif_response_t    *rsp;
+    KIRQL               Irql;
+    int                 Notify;
+
+    rsp = RING_GET_RESPONSE(&Back, Back.rsp_prod_pvt);
+    rsp->id = Request->Id;
+    rsp->operation = Request->Operation;
+    rsp->status = Status;
+    ++Back.rsp_prod_pvt;
+
+    RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&Back, Notify);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    (VOID) RingPoll(Ring);
+    KeLowerIrql(Irql);
+}
+
+// Each request decoded by the backend should cover, in order, the
+// pages of the given SRBs from the given page onwards
+static VOID
+CheckRequestPages(
+    IN  PTEST_REQUEST   Request,
+    IN  PTEST_SRB       TestSrb,
+    IN  ULONG           FirstPage,
+    IN  ULONG           NrPages
+    )
+{
+    ULONG               Index;
+
+    CHECK_EQ(Request->NrSegments, NrPages);
+    for (Index = 0; Index < NrPages && Index < Request->NrSegments; ++Index) {
+        ULONG   Pages = TestSrb->Srb.DataTransferLength / PAGE_SIZE;
+
+        // Move on to the next SRB once this one's pages are used up
+        while (FirstPage >= Pages) {
+            FirstPage -= Pages;
+            ++TestSrb;
+            Pages = TestSrb->Srb.DataTransferLength / PAGE_SIZE;
+        }
+
+        CHECK_EQ(Request->Pfn[Index], TestSrb->Pfn + FirstPage);
+        ++FirstPage;
+    }
+}
+
+static PXENVBD_RING
+TestRingCreate(
+    IN  ULONG       Indirect
+    )
+{
+    PXENVBD_RING    Ring;
+    NTSTATUS        status;
+    PVOID           Shared;
+
+    RtlZeroMemory(&Frontend, sizeof (Frontend));
+    Frontend.DiskInfo.SectorSize = 512;
+    Frontend.DiskInfo.FlushCache = TRUE;
+    Frontend.Features.Indirect = Indirect;
+
+    status = RingCreate(&Frontend, &Ring);
+    ASSERT(NT_SUCCESS(status));
+
+    if (posix_memalign(&Shared, PAGE_SIZE, PAGE_SIZE) != 0)
+        abort();
+
+    Ring->Shared = Shared;
+    SHARED_RING_INIT(Ring->Shared);
+    FRONT_RING_INIT(&Ring->Front, Ring->Shared, PAGE_SIZE);
+    BACK_RING_INIT(&Back, Ring->Shared, PAGE_SIZE);
+
+    Ring->EvtchnInterface.EvtchnSend = EvtchnSend;
+    Ring->Connected = TRUE;
+    Ring->Enabled = TRUE;
+
+    CompletedCount = 0;
+
+    return Ring;
+}
+
+static VOID
+TestRingDestroy(
+    IN  PXENVBD_RING    Ring
+    )
+{
+    CHECK_EQ(QueueCount(&Ring->FreshSrbs), 0);
+    CHECK_EQ(QueueCount(&Ring->PreparedReqs), 0);
+    CHECK_EQ(QueueCount(&Ring->SubmittedReqs), 0);
+    CHECK_EQ(Granter.Outstanding, 0);
+
+    free(Ring->Shared);
+    Ring->Shared = NULL;
+    RtlZeroMemory(&Ring->Front, sizeof (Ring->Front));
+    RtlZeroMemory(&Ring->EvtchnInterface, sizeof (Ring->EvtchnInterface));
+    Ring->Connected = FALSE;
+    Ring->Enabled = FALSE;
+    Ring->Submitted = 0;
+    Ring->Received = 0;
+
+    RingDestroy(Ring);
+
+    CHECK_EQ(HostPoolAllocations, 0);
+}
+
+static VOID
+TestQueue(
+    IN  PXENVBD_RING    Ring,
+    IN  PTEST_SRB       TestSrb
+    )
+{
+    RingQueueRequest(Ring, &TestSrb->SrbExt);
+}
+
+// Prepare everything queued, as the DPC would before it submits
+static VOID
+TestPrepare(
+    IN  PXENVBD_RING    Ring
+    )
+{
+    while (RingPrepareFresh(Ring))
+        ;
+}
+
+static ULONG
+TestSubmit(
+    IN  PXENVBD_RING    Ring
+    )
+{
+    CHECK(RingSubmitPrepared(Ring));
+
+    return BackendTake();
+}
+
+static VOID
+TestMergeContiguous(
+    VOID
+    )
+{
+    PXENVBD_RING    Ring = TestRingCreate(0);
+    TEST_SRB        Srb[6];
+    ULONG           Count;
+    ULONG           Index;
+
+    TestSrbInitialize(&Srb[0], SCSIOP_WRITE16, 0, 8, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_WRITE16, 8, 8, 0x2000);     // follows Srb[0]
+    TestSrbInitialize(&Srb[2], SCSIOP_WRITE16, 100, 8, 0x3000);   // leaves a gap
+    TestSrbInitialize(&Srb[3], SCSIOP_READ16, 108, 8, 0x4000);    // follows Srb[2], but reads
+    TestSrbInitialize(&Srb[4], SCSIOP_SYNCHRONIZE_CACHE16, 0, 0, 0);
+    TestSrbInitialize(&Srb[5], SCSIOP_READ16, 116, 8, 0x5000);    // follows Srb[3], after a flush
+
+    for (Index = 0; Index < ARRAYSIZE(Srb); ++Index)
+        TestQueue(Ring, &Srb[Index]);
+    TestPrepare(Ring);
+
+    CHECK_EQ(QueueCount(&Ring->PreparedReqs), 5);
+    CHECK_EQ(Ring->BlkOpMerged, 1);
+
+    Count = TestSubmit(Ring);
+    CHECK_EQ(Count, 5);
+
+    CHECK_EQ(Taken[0].Operation, BLKIF_OP_WRITE);
+    CHECK(!Taken[0].Indirect);
+    CHECK_EQ(Taken[0].Sector, 0);
+    CHECK_EQ(Taken[0].NrSectors, 16);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 2);
+
+    CHECK_EQ(Taken[1].Operation, BLKIF_OP_WRITE);
+    CHECK_EQ(Taken[1].Sector, 100);
+    CheckRequestPages(&Taken[1], &Srb[2], 0, 1);
+
+    CHECK_EQ(Taken[2].Operation, BLKIF_OP_READ);
+    CHECK_EQ(Taken[2].Sector, 108);
+    CheckRequestPages(&Taken[2], &Srb[3], 0, 1);
+
+    CHECK_EQ(Taken[3].Operation, BLKIF_OP_FLUSH_DISKCACHE);
+
+    CHECK_EQ(Taken[4].Operation, BLKIF_OP_READ);
+    CHECK_EQ(Taken[4].Sector, 116);
+    CheckRequestPages(&Taken[4], &Srb[5], 0, 1);
+
+    for (Index = 0; Index < Count; ++Index)
+        BackendRespond(Ring, &Taken[Index], BLKIF_RSP_OKAY);
+
+    // The merged SRB completes with the one it was merged into
+    CHECK_EQ(CompletedCount, ARRAYSIZE(Srb));
+    for (Index = 0; Index < ARRAYSIZE(Srb) && Index < CompletedCount; ++Index) {
+        CHECK(Completed[Index] == &Srb[Index].Srb);
+        CHECK_EQ(Srb[Index].Srb.SrbStatus, SRB_STATUS_SUCCESS);
+        CHECK_EQ(Srb[Index].Srb.ScsiStatus, 0x00);
+    }
+
+    TestRingDestroy(Ring);
+}
+
+static VOID
+TestMergeLimit(
+    VOID
+    )
+{
+    static const struct {
+        ULONG   Indirect;
+        ULONG   Limit;
+    } Table[] = {
+        { 0, BLKIF_MAX_SEGMENTS_PER_REQUEST },
+        { BLKIF_MAX_SEGMENTS_PER_REQUEST, BLKIF_MAX_SEGMENTS_PER_REQUEST },
+        { BLKIF_MAX_SEGMENTS_PER_REQUEST + 1, BLKIF_MAX_SEGMENTS_PER_REQUEST + 1 },
+        { 256, 256 },
+        { TEST_MAX_SEGMENTS, TEST_MAX_SEGMENTS },
+        { 2 * TEST_MAX_SEGMENTS, TEST_MAX_SEGMENTS },   // as much as 8 indirect pages hold
+    };
+    PXENVBD_RING    Ring;
+    TEST_SRB        Srb[4];
+    ULONG           Index;
+
+    Ring = TestRingCreate(0);
+
+    for (Index = 0; Index < ARRAYSIZE(Table); ++Index) {
+        Frontend.Features.Indirect = Table[Index].Indirect;
+        CHECK_EQ(RingMaxMergeSegments(Ring), Table[Index].Limit);
+    }
+
+    // Without indirect segments a merge has to fit a single request
+    Frontend.Features.Indirect = 0;
+
+    TestSrbInitialize(&Srb[0], SCSIOP_WRITE16, 0, 32, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_WRITE16, 32, 32, 0x2000);
+    TestSrbInitialize(&Srb[2], SCSIOP_WRITE16, 64, 32, 0x3000);   // 12 segments would be too many
+
+    for (Index = 0; Index < 3; ++Index)
+        TestQueue(Ring, &Srb[Index]);
+    TestPrepare(Ring);
+
+    CHECK_EQ(TestSubmit(Ring), 2);
+    CHECK(!Taken[0].Indirect);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 8);
+    CHECK_EQ(Taken[1].Sector, 64);
+    CheckRequestPages(&Taken[1], &Srb[2], 0, 4);
+
+    BackendRespond(Ring, &Taken[0], BLKIF_RSP_OKAY);
+    BackendRespond(Ring, &Taken[1], BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, 3);
+
+    TestRingDestroy(Ring);
+
+    // With them, up to the backend's limit
+    Ring = TestRingCreate(32);
+
+    TestSrbInitialize(&Srb[0], SCSIOP_WRITE16, 0, 80, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_WRITE16, 80, 80, 0x2000);
+    TestSrbInitialize(&Srb[2], SCSIOP_WRITE16, 160, 96, 0x3000);
+    TestSrbInitialize(&Srb[3], SCSIOP_WRITE16, 256, 8, 0x4000);   // 33 segments would be too many
+
+    for (Index = 0; Index < 4; ++Index)
+        TestQueue(Ring, &Srb[Index]);
+    TestPrepare(Ring);
+
+    CHECK_EQ(Ring->BlkOpMerged, 2);
+    CHECK_EQ(TestSubmit(Ring), 2);
+    CHECK(Taken[0].Indirect);
+    CHECK_EQ(Taken[0].NrPages, 1);
+    CHECK_EQ(Taken[0].NrSectors, 256);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 32);
+    CHECK(!Taken[1].Indirect);
+    CHECK_EQ(Taken[1].Sector, 256);
+    CheckRequestPages(&Taken[1], &Srb[3], 0, 1);
+
+    BackendRespond(Ring, &Taken[1], BLKIF_RSP_OKAY);
+    BackendRespond(Ring, &Taken[0], BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, 4);
+
+    TestRingDestroy(Ring);
+}
+
+static VOID
+TestMergeIndirect(
+    VOID
+    )
+{
+    PXENVBD_RING    Ring;
+    PXENVBD_REQUEST Tail;
+    TEST_SRB        Srb[2];
+    ULONG           Index;
+
+    // A direct tail becomes indirect when a merge takes it past 11
+    // segments, and the backend sees one request in the indirect format
+    Ring = TestRingCreate(64);
+
+    TestSrbInitialize(&Srb[0], SCSIOP_READ16, 1000, 64, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_READ16, 1064, 64, 0x2000);
+
+    TestQueue(Ring, &Srb[0]);
+    TestQueue(Ring, &Srb[1]);
+    TestPrepare(Ring);
+
+    CHECK_EQ(QueueCount(&Ring->PreparedReqs), 1);
+    CHECK_EQ(Ring->BlkOpMerged, 1);
+    CHECK_EQ(Ring->IndirectCache->Outstanding, 1);
+
+    CHECK_EQ(TestSubmit(Ring), 1);
+    CHECK(Taken[0].Indirect);
+    CHECK_EQ(Taken[0].Operation, BLKIF_OP_READ);
+    CHECK_EQ(Taken[0].Sector, 1000);
+    CHECK_EQ(Taken[0].NrSectors, 128);
+    CHECK_EQ(Taken[0].NrPages, 1);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 16);
+
+    BackendRespond(Ring, &Taken[0], BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, 2);
+
+    TestRingDestroy(Ring);
+
+    // If a direct tail cannot get all the indirect pages it needs, the
+    // merge is refused and the ones it did get are given back
+    Ring = TestRingCreate(1024);
+
+    TestSrbInitialize(&Srb[0], SCSIOP_WRITE16, 0, 64, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_WRITE16, 64, 8000, 0x10000);
+
+    TestQueue(Ring, &Srb[0]);
+    TestQueue(Ring, &Srb[1]);
+
+    // Two pages for Srb[1] itself, then one of the two for the merge
+    Ring->IndirectCache->Budget = 3;
+    TestPrepare(Ring);
+    Ring->IndirectCache->Budget = -1;
+
+    CHECK_EQ(QueueCount(&Ring->PreparedReqs), 2);
+    CHECK_EQ(Ring->BlkOpMerged, 0);
+    CHECK_EQ(Ring->IndirectCache->Outstanding, 2);
+
+    Tail = CONTAINING_RECORD(Ring->PreparedReqs.List.Flink, XENVBD_REQUEST, ListEntry);
+    CHECK(IsListEmpty(&Tail->Indirects));
+    CHECK(IsListEmpty(&Tail->Merged));
+
+    CHECK_EQ(TestSubmit(Ring), 2);
+    CHECK(!Taken[0].Indirect);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 8);
+    CHECK(Taken[1].Indirect);
+    CHECK_EQ(Taken[1].NrPages, 2);
+    CheckRequestPages(&Taken[1], &Srb[1], 0, 1000);
+
+    for (Index = 0; Index < 2; ++Index)
+        BackendRespond(Ring, &Taken[Index], BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, 2);
+
+    TestRingDestroy(Ring);
+
+    // The same when an indirect tail needs another page and cannot get
+    // its grant: it keeps just the page it already had
+    Ring = TestRingCreate(1024);
+
+    TestSrbInitialize(&Srb[0], SCSIOP_WRITE16, 0, 800, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_WRITE16, 800, 4000, 0x10000);
+
+    TestQueue(Ring, &Srb[0]);
+    TestQueue(Ring, &Srb[1]);
+
+    // Each SRB's data pages and its one indirect page, then the merge
+    Granter.Budget = 100 + 1 + 500 + 1;
+    TestPrepare(Ring);
+    Granter.Budget = -1;
+
+    CHECK_EQ(QueueCount(&Ring->PreparedReqs), 2);
+    CHECK_EQ(Ring->BlkOpMerged, 0);
+    CHECK_EQ(Ring->IndirectCache->Outstanding, 2);
+
+    Tail = CONTAINING_RECORD(Ring->PreparedReqs.List.Flink, XENVBD_REQUEST, ListEntry);
+    CHECK(!IsListEmpty(&Tail->Indirects));
+    CHECK(Tail->Indirects.Flink == Tail->Indirects.Blink);
+
+    CHECK_EQ(TestSubmit(Ring), 2);
+    CHECK_EQ(Taken[0].NrPages, 1);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 100);
+    CHECK_EQ(Taken[1].NrPages, 1);
+    CheckRequestPages(&Taken[1], &Srb[1], 0, 500);
+
+    for (Index = 0; Index < 2; ++Index)
+        BackendRespond(Ring, &Taken[Index], BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, 2);
+
+    TestRingDestroy(Ring);
+}
+
+static VOID
+TestMergeCompletion(
+    VOID
+    )
+{
+    PXENVBD_RING    Ring = TestRingCreate(0);
+    TEST_SRB        Srb[4];
+    ULONG           Index;
+
+    // Srb[0] is split into 11 and 9 segments; Srb[1] is merged into the
+    // second half, so the two SRBs share a request
+    TestSrbInitialize(&Srb[0], SCSIOP_WRITE16, 0, 160, 0x1000);
+    TestSrbInitialize(&Srb[1], SCSIOP_WRITE16, 160, 16, 0x2000);
+
+    TestQueue(Ring, &Srb[0]);
+    TestQueue(Ring, &Srb[1]);
+    TestPrepare(Ring);
+
+    CHECK_EQ(Ring->BlkOpMerged, 1);
+    CHECK_EQ(TestSubmit(Ring), 2);
+    CheckRequestPages(&Taken[0], &Srb[0], 0, 11);
+    CheckRequestPages(&Taken[1], &Srb[0], 11, 11);
+
+    // Srb[1] completes with the request it was merged into, after every
+    // grant of that request has been revoked, while Srb[0] still waits
+    // for its first half
+    BackendRespond(Ring, &Taken[1], BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, 1);
+    CHECK(Completed[0] == &Srb[1].Srb);
+    CHECK_EQ(CompletedGrants[0], 11);
+    CHECK_EQ(Srb[1].Srb.SrbStatus, SRB_STATUS_SUCCESS);
+
+    BackendRespond(Ring, &Taken[0], BLKIF_RSP_ERROR);
+    CHECK_EQ(CompletedCount, 2);
+    CHECK(Completed[1] == &Srb[0].Srb);
+    CHECK_EQ(CompletedGrants[1], 0);
+    CHECK_EQ(Srb[0].Srb.SrbStatus, SRB_STATUS_ERROR);
+    CHECK_EQ(Srb[0].Srb.ScsiStatus, 0x40);
+
+    // A failed request fails every SRB merged into it, the one it was
+    // prepared for first
+    CompletedCount = 0;
+
+    TestSrbInitialize(&Srb[2], SCSIOP_READ16, 1000, 8, 0x3000);
+    TestSrbInitialize(&Srb[3], SCSIOP_READ16, 1008, 8, 0x4000);
+
+    TestQueue(Ring, &Srb[2]);
+    TestQueue(Ring, &Srb[3]);
+    TestPrepare(Ring);
+
+    CHECK_EQ(TestSubmit(Ring), 1);
+    BackendRespond(Ring, &Taken[0], BLKIF_RSP_ERROR);
+
+    CHECK_EQ(CompletedCount, 2);
+    CHECK(Completed[0] == &Srb[2].Srb);
+    CHECK(Completed[1] == &Srb[3].Srb);
+    for (Index = 2; Index < 4; ++Index) {
+        CHECK_EQ(Srb[Index].Srb.SrbStatus, SRB_STATUS_ERROR);
+        CHECK_EQ(Srb[Index].Srb.ScsiStatus, 0x40);
+    }
+    for (Index = 0; Index < 2; ++Index)
+        CHECK_EQ(CompletedGrants[Index], 0);
+
+    TestRingDestroy(Ring);
+}
+
+static VOID
+TestUnmapAlign(
+    VOID
+    )
+{
+    static const struct {
+        ULONG64 Value;
+        ULONG   Granularity;    // Sectors
+        ULONG   Alignment;      // Sectors, less than Granularity
+        ULONG64 Up;
+        ULONG64 Down;
+    } Table[] = {
+        { 0, 1, 0, 0, 0 },
+        { 12345, 1, 0, 12345, 12345 },
+        { 0, 8, 0, 0, 0 },
+        { 1, 8, 0, 8, 0 },
+        { 7, 8, 0, 8, 0 },
+        { 8, 8, 0, 8, 8 },
+        { 9, 8, 0, 16, 8 },
+        // Extents start at 2, 10, 18, ...
+        { 0, 8, 2, 2, 0 },
+        { 1, 8, 2, 2, 0 },
+        { 2, 8, 2, 2, 2 },
+        { 3, 8, 2, 10, 2 },
+        { 9, 8, 2, 10, 2 },
+        { 10, 8, 2, 10, 10 },
+        // Extents start at 7, 15, ...
+        { 6, 8, 7, 7, 0 },
+        { 8, 8, 7, 15, 7 },
+        // Extents that are not a power of two
+        { 1000, 24, 5, 1013, 989 },
+        { 1013, 24, 5, 1013, 1013 },
+        { 0xFFFFFFFFFFFFFFF0ull, 8, 0, 0xFFFFFFFFFFFFFFF0ull, 0xFFFFFFFFFFFFFFF0ull },
+    };
+    ULONG   Index;
+
+    for (Index = 0; Index < ARRAYSIZE(Table); ++Index) {
+        CHECK_EQ(__RingUnmapAlignUp(Table[Index].Value,
+                                    Table[Index].Granularity,
+                                    Table[Index].Alignment),
+                 Table[Index].Up);
+        CHECK_EQ(__RingUnmapAlignDown(Table[Index].Value,
+                                      Table[Index].Granularity,
+                                      Table[Index].Alignment),
+                 Table[Index].Down);
+    }
+}
+
+static VOID
+TestUnmapSort(
+    VOID
+    )
+{
+    static const ULONG  Counts[] = { 0, 1, 2, 3, 17, 1000, 4096 };
+    PXENVBD_UNMAP_RANGE Ranges;
+    ULONG64             Seed = 1;
+    ULONG               Index;
+
+    Ranges = calloc(4096, sizeof (XENVBD_UNMAP_RANGE));
+    ASSERT(Ranges != NULL);
+
+    for (Index = 0; Index < ARRAYSIZE(Counts); ++Index) {
+        ULONG   Count = Counts[Index];
+        ULONG64 Sum;
+        ULONG   Range;
+
+        // Plenty of equal starts, and the SRB index as a checksum
+        Sum = 0;
+        for (Range = 0; Range < Count; ++Range) {
+            Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+            Ranges[Range].Start = (Seed >> 33) % (Count + 1);
+            Ranges[Range].End = Ranges[Range].Start + 1;
+            Ranges[Range].Index = Range;
+            Sum += Ranges[Range].Start * 31 + Range;
+        }
+
+        RingSortUnmapRanges(Ranges, Count);
+
+        for (Range = 0; Range < Count; ++Range) {
+            CHECK_EQ(Ranges[Range].End, Ranges[Range].Start + 1);
+            if (Range != 0)
+                CHECK(Ranges[Range - 1].Start <= Ranges[Range].Start);
+            Sum -= Ranges[Range].Start * 31 + Ranges[Range].Index;
+        }
+        CHECK_EQ(Sum, 0);
+    }
+
+    free(Ranges);
+}
+
+// SRBs holding a reference on a submitted request, as a bit mask
+static ULONG
+TestRequestSrbs(
+    IN  PTEST_REQUEST   Taken,
+    IN  PTEST_SRB       Srb
+    )
+{
+    PXENVBD_REQUEST     Request = (PXENVBD_REQUEST)(ULONG_PTR)Taken->Id;
+    PLIST_ENTRY         ListEntry;
+    ULONG               Mask;
+
+    Mask = 1u << (CONTAINING_RECORD(Request->SrbExt, TEST_SRB, SrbExt) - Srb);
+
+    for (ListEntry = Request->Merged.Flink;
+         ListEntry != &Request->Merged;
+         ListEntry = ListEntry->Flink) {
+        PXENVBD_REQUEST Merged = CONTAINING_RECORD(ListEntry, XENVBD_REQUEST, ListEntry);
+        ULONG           Bit;
+
+        Bit = 1u << (CONTAINING_RECORD(Merged->SrbExt, TEST_SRB, SrbExt) - Srb);
+        CHECK((Mask & Bit) == 0);   // one reference per SRB
+        CHECK_EQ(Merged->Operation, BLKIF_OP_DISCARD);
+        Mask |= Bit;
+    }
+
+    return Mask;
+}
+
+static VOID
+TestUnmapPrepare(
+    VOID
+    )
+{
+    static const struct {
+        const CHAR  *Name;
+        ULONG       Granularity;    // Bytes, as the backend gives them
+        ULONG       Alignment;      // Bytes
+        ULONG       NrSrbs;
+        struct {
+            ULONG   Srb;
+            ULONG64 Start;
+            ULONG   Length;
+        }           Descriptors[TEST_MAX_DESCRIPTORS];
+        struct {
+            ULONG64 Start;
+            ULONG64 Length;
+            ULONG   Srbs;           // Mask of the SRBs that wait for it
+        }           Discards[4];
+        ULONG       Idle;           // Mask of the SRBs with nothing to discard
+    } Table[] = {
+        { "single", 0, 0, 1,
+          { { 0, 10, 20 } },
+          { { 10, 20, 1 } }, 0 },
+        { "sorted", 512, 0, 1,
+          { { 0, 100, 10 }, { 0, 0, 10 }, { 0, 50, 10 } },
+          { { 0, 10, 1 }, { 50, 10, 1 }, { 100, 10, 1 } }, 0 },
+        { "adjacent and overlapping", 512, 0, 1,
+          { { 0, 15, 20 }, { 0, 0, 10 }, { 0, 10, 5 } },
+          { { 0, 35, 1 } }, 0 },
+        { "contained", 512, 0, 1,
+          { { 0, 0, 100 }, { 0, 10, 10 } },
+          { { 0, 100, 1 } }, 0 },
+        { "across SRBs", 512, 0, 3,
+          { { 0, 0, 100 }, { 1, 50, 100 }, { 2, 1000, 8 } },
+          { { 0, 150, 3 }, { 1000, 8, 4 } }, 0 },
+        { "sorted across SRBs", 512, 0, 2,
+          { { 0, 100, 10 }, { 1, 0, 10 } },
+          { { 0, 10, 2 }, { 100, 10, 1 } }, 0 },
+        { "one SRB twice in a range", 512, 0, 2,
+          { { 0, 0, 10 }, { 0, 20, 10 }, { 1, 5, 20 } },
+          { { 0, 30, 3 } }, 0 },
+        { "granularity", 4096, 0, 1,
+          { { 0, 3, 20 } },
+          { { 8, 8, 1 } }, 0 },
+        { "alignment", 4096, 1024, 1,
+          { { 0, 0, 30 } },
+          { { 2, 24, 1 } }, 0 },
+        { "alignment beyond granularity", 4096, 5120, 1,
+          { { 0, 0, 30 } },
+          { { 2, 24, 1 } }, 0 },
+        { "shrunk to nothing", 4096, 0, 2,
+          { { 0, 1, 6 }, { 1, 16, 8 } },
+          { { 16, 8, 2 } }, 1 },
+        { "shrunk to nothing when aligned", 4096, 1024, 2,
+          { { 0, 2, 7 }, { 0, 19, 5 }, { 1, 10, 8 } },
+          { { 10, 8, 2 } }, 1 },
+        { "small ranges merged", 4096, 0, 2,
+          { { 0, 1, 6 }, { 1, 7, 10 } },
+          { { 8, 8, 3 } }, 0 },
+        { "empty descriptors", 512, 0, 3,
+          { { 0, 5, 0 }, { 1, 10, 0 }, { 1, 20, 4 }, { 2, 24, 0 } },
+          { { 20, 4, 2 } }, 5 },
+        { "nothing at all", 4096, 0, 2,
+          { { 0, 1, 1 }, { 1, 9, 6 } },
+          { { 0 } }, 3 },
+    };
+    ULONG   Index;
+
+    for (Index = 0; Index < ARRAYSIZE(Table); ++Index) {
+        PXENVBD_RING    Ring = TestRingCreate(0);
+        TEST_SRB        Srb[3];
+        ULONG           NrDiscards;
+        ULONG           Count;
+        ULONG           Entry;
+
+        Frontend.DiskInfo.Discard = TRUE;
+        Frontend.DiskInfo.DiscardGranularity = Table[Index].Granularity;
+        Frontend.DiskInfo.DiscardAlignment = Table[Index].Alignment;
+
+        for (Entry = 0; Entry < Table[Index].NrSrbs; ++Entry)
+            TestSrbInitialize(&Srb[Entry], SCSIOP_UNMAP, 0, 0, 0);
+
+        for (Entry = 0; Entry < TEST_MAX_DESCRIPTORS; ++Entry) {
+            if (Entry != 0 && Table[Index].Descriptors[Entry].Length == 0 &&
+                Table[Index].Descriptors[Entry].Start == 0)
+                break;
+
+            TestSrbAddUnmap(&Srb[Table[Index].Descriptors[Entry].Srb],
+                            Table[Index].Descriptors[Entry].Start,
+                            Table[Index].Descriptors[Entry].Length);
+        }
+
+        for (Entry = 0; Entry < Table[Index].NrSrbs; ++Entry)
+            TestQueue(Ring, &Srb[Entry]);
+        TestPrepare(Ring);
+
+        // SRBs with nothing left to discard complete straight away
+        for (Entry = 0; Entry < CompletedCount; ++Entry) {
+            ULONG   Srbs = 1u << (CONTAINING_RECORD(Completed[Entry], TEST_SRB, Srb) - Srb);
+
+            if ((Table[Index].Idle & Srbs) == 0)
+                fprintf(stderr, "%s: SRB completed early\n", Table[Index].Name);
+            CHECK(Table[Index].Idle & Srbs);
+            CHECK_EQ(Completed[Entry]->SrbStatus, SRB_STATUS_SUCCESS);
+        }
+        CHECK_EQ(CompletedCount, __builtin_popcount(Table[Index].Idle));
+
+        for (NrDiscards = 0;
+             NrDiscards < ARRAYSIZE(Table[Index].Discards) &&
+             Table[Index].Discards[NrDiscards].Length != 0;
+             ++NrDiscards)
+            ;
+
+        Count = TestSubmit(Ring);
+        if (Count != NrDiscards)
+            fprintf(stderr, "%s: %u discards\n", Table[Index].Name, Count);
+        CHECK_EQ(Count, NrDiscards);
+
+        for (Entry = 0; Entry < Count && Entry < NrDiscards; ++Entry) {
+            if (Taken[Entry].Sector != Table[Index].Discards[Entry].Start ||
+                Taken[Entry].NrSectors != Table[Index].Discards[Entry].Length)
+                fprintf(stderr, "%s: discard %u is [%llu, +%llu)\n", Table[Index].Name,
+                        Entry, (unsigned long long)Taken[Entry].Sector,
+                        (unsigned long long)Taken[Entry].NrSectors);
+
+            CHECK_EQ(Taken[Entry].Operation, BLKIF_OP_DISCARD);
+            CHECK_EQ(Taken[Entry].Sector, Table[Index].Discards[Entry].Start);
+            CHECK_EQ(Taken[Entry].NrSectors, Table[Index].Discards[Entry].Length);
+            CHECK_EQ(TestRequestSrbs(&Taken[Entry], Srb), Table[Index].Discards[Entry].Srbs);
+        }
+
+        for (Entry = 0; Entry < Count; ++Entry)
+            BackendRespond(Ring, &Taken[Entry], BLKIF_RSP_OKAY);
+
+        CHECK_EQ(CompletedCount, Table[Index].NrSrbs);
+        for (Entry = 0; Entry < Table[Index].NrSrbs; ++Entry) {
+            CHECK_EQ(Srb[Entry].SrbExt.RequestCount, 0);
+            CHECK_EQ(Srb[Entry].Srb.SrbStatus, SRB_STATUS_SUCCESS);
+        }
+
+        TestRingDestroy(Ring);
+    }
+}
+
+static VOID
+TestUnmapCompletion(
+    VOID
+    )
+{
+    PXENVBD_RING    Ring;
+    TEST_SRB        Srb[2];
+    ULONG           Pass;
+
+    // Srb[0] has a range of its own and shares another with Srb[1], so
+    // it is the last to complete whichever discard finishes first. A
+    // failure in either discard fails the SRBs that wait on it.
+    for (Pass = 0; Pass < 2; ++Pass) {
+        Ring = TestRingCreate(0);
+        Frontend.DiskInfo.Discard = TRUE;
+        Frontend.DiskInfo.DiscardGranularity = 0;
+        Frontend.DiskInfo.DiscardAlignment = 0;
+
+        TestSrbInitialize(&Srb[0], SCSIOP_UNMAP, 0, 0, 0);
+        TestSrbAddUnmap(&Srb[0], 1000, 10);
+        TestSrbAddUnmap(&Srb[0], 0, 10);
+        TestSrbInitialize(&Srb[1], SCSIOP_UNMAP, 0, 0, 0);
+        TestSrbAddUnmap(&Srb[1], 5, 20);
+
+        TestQueue(Ring, &Srb[0]);
+        TestQueue(Ring, &Srb[1]);
+        TestPrepare(Ring);
+
+        CHECK_EQ(TestSubmit(Ring), 2);
+        CHECK_EQ(Taken[0].Sector, 0);
+        CHECK_EQ(TestRequestSrbs(&Taken[0], Srb), 3);
+        CHECK_EQ(Taken[1].Sector, 1000);
+        CHECK_EQ(TestRequestSrbs(&Taken[1], Srb), 1);
+
+        if (Pass == 0) {
+            // The shared discard fails first: Srb[1] fails at once and
+            // Srb[0] fails when its other discard completes
+            BackendRespond(Ring, &Taken[0], BLKIF_RSP_ERROR);
+            CHECK_EQ(CompletedCount, 1);
+            CHECK(Completed[0] == &Srb[1].Srb);
+            CHECK_EQ(Srb[1].Srb.SrbStatus, SRB_STATUS_ERROR);
+            CHECK_EQ(Srb[1].Srb.ScsiStatus, 0x40);
+
+            BackendRespond(Ring, &Taken[1], BLKIF_RSP_OKAY);
+            CHECK_EQ(CompletedCount, 2);
+            CHECK(Completed[1] == &Srb[0].Srb);
+            CHECK_EQ(Srb[0].Srb.SrbStatus, SRB_STATUS_ERROR);
+            CHECK_EQ(Srb[0].Srb.ScsiStatus, 0x40);
+        } else {
+            // Srb[0]'s own discard fails first: nothing completes until
+            // the shared one does, and then only Srb[0] has failed
+            BackendRespond(Ring, &Taken[1], BLKIF_RSP_ERROR);
+            CHECK_EQ(CompletedCount, 0);
+
+            BackendRespond(Ring, &Taken[0], BLKIF_RSP_OKAY);
+            CHECK_EQ(CompletedCount, 2);
+            CHECK(Completed[0] == &Srb[0].Srb);
+            CHECK(Completed[1] == &Srb[1].Srb);
+            CHECK_EQ(Srb[0].Srb.SrbStatus, SRB_STATUS_ERROR);
+            CHECK_EQ(Srb[1].Srb.SrbStatus, SRB_STATUS_SUCCESS);
+        }
+
+        TestRingDestroy(Ring);
+    }
+}
+
+static VOID
+TestStatisticsSubmit(
+    VOID
+    )
+{
+    PXENVBD_RING        Ring = TestRingCreate(0);
+    XENVBD_STATISTICS   Statistics;
+    TEST_SRB            Srb[5];
+    ULONG64             Expected[XENVBD_DEPTH_BUCKETS];
+    ULONG               Index;
+
+    // Nothing here can merge, so the depth seen by each submission is
+    // the number of requests already on the ring
+    RtlZeroMemory(Expected, sizeof (Expected));
+    for (Index = 0; Index < ARRAYSIZE(Srb); ++Index) {
+        if (Index == 2)
+            TestSrbInitialize(&Srb[Index], SCSIOP_SYNCHRONIZE_CACHE16, 0, 0, 0);
+        else
+            TestSrbInitialize(&Srb[Index], SCSIOP_WRITE16, Index * 100, 8, 0x1000 * (Index + 1));
+        TestQueue(Ring, &Srb[Index]);
+
+        ++Expected[HistogramDepthBucket(Index)];
+    }
+    TestPrepare(Ring);
+
+    CHECK_EQ(TestSubmit(Ring), ARRAYSIZE(Srb));
+    for (Index = 0; Index < ARRAYSIZE(Srb); ++Index)
+        BackendRespond(Ring, &Taken[Index],
+                       (Index == 3) ? BLKIF_RSP_ERROR : BLKIF_RSP_OKAY);
+    CHECK_EQ(CompletedCount, ARRAYSIZE(Srb));
+
+    RingQueryStatistics(Ring, &Statistics);
+
+    for (Index = 0; Index < XENVBD_DEPTH_BUCKETS; ++Index)
+        CHECK_EQ(Statistics.Depth[Index], Expected[Index]);
+
+    // A failed SRB still counts towards the latency it saw
+    CHECK_EQ(Statistics.Backend[XENVBD_STATISTICS_WRITE].Count, 4);
+    CHECK_EQ(Statistics.Total[XENVBD_STATISTICS_WRITE].Count, 4);
+    CHECK_EQ(Statistics.Backend[XENVBD_STATISTICS_FLUSH].Count, 1);
+    CHECK_EQ(Statistics.Total[XENVBD_STATISTICS_FLUSH].Count, 1);
+    CHECK_EQ(Statistics.Backend[XENVBD_STATISTICS_READ].Count, 0);
+    CHECK_EQ(Statistics.Total[XENVBD_STATISTICS_DISCARD].Count, 0);
+
+    TestRingDestroy(Ring);
+}
+
+// The histograms are sampled on several CPUs at once and without the
+// ring lock, so no sample may be lost
+
+#define TEST_SAMPLE_THREADS 4
+#define TEST_SAMPLES        200000
+
+static PVOID
+TestSampleThread(
+    IN  PVOID       Argument
+    )
+{
+    PXENVBD_RING    Ring = Argument;
+    ULONG64         Millisecond = Ring->Frequency.QuadPart / 1000;
+    ULONG           Index;
+
+    for (Index = 0; Index < TEST_SAMPLES; ++Index) {
+        __RingSampleDepth(Ring);
+        __RingSampleLatency(Ring,
+                            &Ring->Backend[XENVBD_STATISTICS_READ],
+                            1,
+                            1 + Millisecond);
+    }
+
+    return NULL;
+}
+
+static VOID
+TestStatisticsConcurrent(
+    VOID
+    )
+{
+    PXENVBD_RING        Ring = TestRingCreate(0);
+    XENVBD_STATISTICS   Statistics;
+    pthread_t           Thread[TEST_SAMPLE_THREADS];
+    ULONG               Index;
+
+    for (Index = 0; Index < TEST_SAMPLE_THREADS; ++Index)
+        if (pthread_create(&Thread[Index], NULL, TestSampleThread, Ring) != 0)
+            abort();
+
+    for (Index = 0; Index < TEST_SAMPLE_THREADS; ++Index)
+        (VOID) pthread_join(Thread[Index], NULL);
+
+    RingQueryStatistics(Ring, &Statistics);
+
+    CHECK_EQ(Statistics.Depth[0], TEST_SAMPLE_THREADS * TEST_SAMPLES);
+    CHECK_EQ(Statistics.Backend[XENVBD_STATISTICS_READ].Count,
+             TEST_SAMPLE_THREADS * TEST_SAMPLES);
+    CHECK_EQ(Statistics.Backend[XENVBD_STATISTICS_READ].TotalMicroseconds,
+             TEST_SAMPLE_THREADS * TEST_SAMPLES * 1000ull);
+    CHECK_EQ(Statistics.Backend[XENVBD_STATISTICS_READ].Buckets[HistogramLatencyBucket(1000)],
+             TEST_SAMPLE_THREADS * TEST_SAMPLES);
+
+    TestRingDestroy(Ring);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    TestMergeContiguous();
+    TestMergeLimit();
+    TestMergeIndirect();
+    TestMergeCompletion();
+    TestUnmapAlign();
+    TestUnmapSort();
+    TestUnmapPrepare();
+    TestUnmapCompletion();
+    TestStatisticsSubmit();
+    TestStatisticsConcurrent();
+
+    return TEST_RESULT("ring_test");
+}
@@ -0,0 +1,161 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <ntddk.h>
+
+#include "histogram.h"
+
+#include "test.h"
+
+static VOID
+TestLatencyBuckets(
+    VOID
+    )
+{
+    ULONG   Shift;
+
+    CHECK_EQ(HistogramLatencyBucket(0), 0);
+    CHECK_EQ(HistogramLatencyBucket(1), 0);
+
+    // [2^N, 2^(N+1)) lands in bucket N
+    for (Shift = 1; Shift < XENVBD_LATENCY_BUCKETS; Shift++) {
+        ULONG64 Value = 1ull << Shift;
+
+        CHECK_EQ(HistogramLatencyBucket(Value - 1), Shift - 1);
+        CHECK_EQ(HistogramLatencyBucket(Value), Shift);
+        CHECK_EQ(HistogramLatencyBucket(Value + 1), Shift);
+    }
+
+    // Anything longer is folded into the last bucket
+    CHECK_EQ(HistogramLatencyBucket(MAXULONG), XENVBD_LATENCY_BUCKETS - 1);
+    CHECK_EQ(HistogramLatencyBucket((ULONG64)MAXULONG + 1), XENVBD_LATENCY_BUCKETS - 1);
+    CHECK_EQ(HistogramLatencyBucket(1ull << 40), XENVBD_LATENCY_BUCKETS - 1);
+    CHECK_EQ(HistogramLatencyBucket(~0ull), XENVBD_LATENCY_BUCKETS - 1);
+}
+
+static VOID
+TestDepthBuckets(
+    VOID
+    )
+{
+    ULONG   Bucket;
+
+    // An idle ring has its own bucket
+    CHECK_EQ(HistogramDepthBucket(0), 0);
+
+    // [2^(N-1), 2^N) lands in bucket N
+    for (Bucket = 1; Bucket < XENVBD_DEPTH_BUCKETS; Bucket++) {
+        ULONG   Low = 1u << (Bucket - 1);
+        ULONG   High = (1u << Bucket) - 1;
+
+        CHECK_EQ(HistogramDepthBucket(Low), Bucket);
+        CHECK_EQ(HistogramDepthBucket(High), Bucket);
+    }
+
+    // Deeper rings are folded into the last bucket, including depths
+    // that overflow a ULONG once doubled
+    CHECK_EQ(HistogramDepthBucket(1u << (XENVBD_DEPTH_BUCKETS - 1)),
+             XENVBD_DEPTH_BUCKETS - 1);
+    CHECK_EQ(HistogramDepthBucket(1u << 31), XENVBD_DEPTH_BUCKETS - 1);
+    CHECK_EQ(HistogramDepthBucket(MAXULONG), XENVBD_DEPTH_BUCKETS - 1);
+}
+
+static VOID
+TestBucketRange(
+    VOID
+    )
+{
+    ULONG   Shift;
+
+    // A single bucket takes everything
+    CHECK_EQ(__HistogramBucket(0, 1), 0);
+    CHECK_EQ(__HistogramBucket(MAXULONG, 1), 0);
+    CHECK_EQ(__HistogramBucket(~0ull, 1), 0);
+
+    // Buckets never decrease and never run off the end, either side of
+    // every power of two
+    for (Shift = 0; Shift < 64; Shift++) {
+        ULONG64 Value = 1ull << Shift;
+
+        CHECK(__HistogramBucket(Value - 1, XENVBD_LATENCY_BUCKETS) <=
+              __HistogramBucket(Value, XENVBD_LATENCY_BUCKETS));
+        CHECK(__HistogramBucket(Value, XENVBD_LATENCY_BUCKETS) <
+              XENVBD_LATENCY_BUCKETS);
+        CHECK(__HistogramBucket(Value, XENVBD_DEPTH_BUCKETS) <
+              XENVBD_DEPTH_BUCKETS);
+    }
+}
+
+// XENVBD_STATISTICS is exchanged with user mode callers of either word
+// size, so its layout is fixed
+static VOID
+TestStatisticsLayout(
+    VOID
+    )
+{
+    // SRB_IO_CONTROL.Signature is 8 bytes with no terminator
+    CHECK_EQ(sizeof (XENVBD_IOCTL_SIGNATURE) - 1, 8);
+
+    CHECK_EQ(XENVBD_STATISTICS_OPERATION_COUNT, 4);
+    CHECK_EQ(XENVBD_STATISTICS_VERSION, 1);
+
+    CHECK_EQ(FIELD_OFFSET(XENVBD_LATENCY, Count), 0);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_LATENCY, TotalMicroseconds), 8);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_LATENCY, Buckets), 16);
+    CHECK_EQ(sizeof (XENVBD_LATENCY), 16 + 8 * XENVBD_LATENCY_BUCKETS);
+
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, TargetId), 0);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Version), 4);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Backend), 8);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Total), 1096);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Depth), 2184);
+    CHECK_EQ(sizeof (XENVBD_STATISTICS), 2312);
+
+    // Every 64-bit field is naturally aligned, so 32-bit and 64-bit
+    // compilers agree on the layout without packing
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Backend) % 8, 0);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Total) % 8, 0);
+    CHECK_EQ(FIELD_OFFSET(XENVBD_STATISTICS, Depth) % 8, 0);
+    CHECK_EQ(sizeof (XENVBD_STATISTICS) % 8, 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestLatencyBuckets();
+    TestDepthBuckets();
+    TestBucketRange();
+    TestStatisticsLayout();
+
+    return TEST_RESULT("statistics");
+}
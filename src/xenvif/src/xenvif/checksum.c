@@ -54,7 +54,12 @@ __AccumulateChecksum(
     Current = *Accumulator;
 
     while (ByteCount > 1) {
-        Current += *((PUSHORT)BaseVa);
+        USHORT  Word;
+
+        // BaseVa need not be 2-byte aligned
+        RtlCopyMemory(&Word, BaseVa, sizeof (USHORT));
+
+        Current += Word;
         if (Current & (1 << 31))
             Current = (Current & 0xFFFF) + (Current >> 16);
         BaseVa += 2;
@@ -80,6 +85,64 @@ AccumulateChecksum(
     __AccumulateChecksum(Accumulator, BaseVa, ByteCount);
 }
 
+// Add Length bytes of payload, which may be spread across any number of
+// buffers of any length. A buffer that starts at an odd offset into the
+// data has its bytes the other way round within each 16-bit word, so its
+// partial sum is swapped before it is added in.
+static FORCEINLINE VOID
+__AccumulateChecksumPayload(
+    IN OUT  PULONG                  Accumulator,
+    IN      PXENVIF_PACKET_PAYLOAD  Payload,
+    IN      ULONG                   Length
+    )
+{
+    PMDL                            Mdl;
+    ULONG                           Offset;
+    ULONG                           Current;
+    BOOLEAN                         Odd;
+
+    Mdl = Payload->Mdl;
+    Offset = Payload->Offset;
+    Current = *Accumulator;
+    Odd = FALSE;
+
+    while (Length != 0) {
+        PUCHAR  BaseVa;
+        ULONG   ByteCount;
+        ULONG   Partial;
+
+        ASSERT(Mdl != NULL);
+
+        BaseVa = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+        BaseVa += Offset;
+
+        ByteCount = Mdl->ByteCount;
+        ASSERT3U(Offset, <=, ByteCount);
+        ByteCount -= Offset;
+        ByteCount = __min(ByteCount, Length);
+
+        Partial = 0;
+        __AccumulateChecksum(&Partial, BaseVa, ByteCount);
+
+        if (Odd)
+            Partial = ((Partial & 0xFF) << 8) | (Partial >> 8);
+
+        Current += Partial;
+        while ((Current >> 16) != 0)
+            Current = (Current & 0xFFFF) + (Current >> 16);
+
+        if (ByteCount & 1)
+            Odd = !Odd;
+
+        Length -= ByteCount;
+
+        Mdl = Mdl->Next;
+        Offset = 0;
+    }
+
+    *Accumulator = Current;
+}
+
 BOOLEAN
 ChecksumVerify(
     IN  USHORT  Calculated,
@@ -278,8 +341,6 @@ ChecksumTcpPacket(
     PIP_HEADER                  IpHeader;
     PTCP_HEADER                 TcpHeader;
     USHORT                      Saved;
-    PMDL                        Mdl;
-    ULONG                       Offset;
     ULONG                       Length;
 
     ASSERT(Info->IpHeader.Length != 0);
@@ -303,9 +364,6 @@ ChecksumTcpPacket(
                              StartVa + Info->TcpOptions.Offset,
                              Info->TcpOptions.Length);
 
-    Mdl = Payload->Mdl;
-    Offset = Payload->Offset;
-
     if (IpHeader->Version == 4) {
         PIPV4_HEADER    Version4 = &IpHeader->Version4;
         
@@ -323,27 +381,7 @@ ChecksumTcpPacket(
     Length -= Info->TcpOptions.Length;
     Length = __min(Length, Payload->Length);
 
-    while (Length != 0) {
-        PUCHAR  BaseVa;
-        ULONG   ByteCount;
-
-        ASSERT(Mdl != NULL);
-
-        BaseVa = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
-        BaseVa += Offset;
-
-        ByteCount = Mdl->ByteCount;
-        ASSERT3U(Offset, <=, ByteCount);
-        ByteCount -= Offset;
-        ByteCount = __min(ByteCount, Length);
-
-        __AccumulateChecksum(&Accumulator, BaseVa, ByteCount);
-
-        Length -= ByteCount;
-
-        Mdl = Mdl->Next;
-        Offset = 0;
-    }
+    __AccumulateChecksumPayload(&Accumulator, Payload, Length);
 
     // As-per RFC1624, Accumulator should never be 0.
     ASSERT(Accumulator != 0);
@@ -363,8 +401,6 @@ ChecksumUdpPacket(
     PIP_HEADER                  IpHeader;
     PUDP_HEADER                 UdpHeader;
     USHORT                      Saved;
-    PMDL                        Mdl;
-    ULONG                       Offset;
     ULONG                       Length;
 
     ASSERT(Info->IpHeader.Length != 0);
@@ -383,9 +419,6 @@ ChecksumUdpPacket(
 
     UdpHeader->Checksum = Saved;
 
-    Mdl = Payload->Mdl;
-    Offset = Payload->Offset;
-
     if (IpHeader->Version == 4) {
         PIPV4_HEADER    Version4 = &IpHeader->Version4;
         
@@ -402,27 +435,7 @@ ChecksumUdpPacket(
     Length -= Info->UdpHeader.Length;
     Length = __min(Length, Payload->Length);
 
-    while (Length != 0) {
-        PUCHAR  BaseVa;
-        ULONG   ByteCount;
-
-        ASSERT(Mdl != NULL);
-
-        BaseVa = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
-        BaseVa += Offset;
-
-        ByteCount = Mdl->ByteCount;
-        ASSERT3U(Offset, <=, ByteCount);
-        ByteCount -= Offset;
-        ByteCount = __min(ByteCount, Length);
-
-        __AccumulateChecksum(&Accumulator, BaseVa, ByteCount);
-
-        Length -= ByteCount;
-
-        Mdl = Mdl->Next;
-        Offset = 0;
-    }
+    __AccumulateChecksumPayload(&Accumulator, Payload, Length);
 
     // As-per RFC1624, Accumulator should never be 0.
     ASSERT(Accumulator != 0);
@@ -60,6 +60,22 @@ RtlRandomEx (
 
 #define MAXNAMELEN  128
 
+typedef VOID
+(*XENVIF_CONTROLLER_COMPLETION)(
+    IN  PVOID       Argument,
+    IN  NTSTATUS    Status,
+    IN  ULONG       Data
+    );
+
+typedef struct _XENVIF_CONTROLLER_SLOT {
+    USHORT                          Id;
+    USHORT                          Type;
+    XENVIF_CONTROLLER_COMPLETION    Completion;
+    PVOID                           Argument;
+} XENVIF_CONTROLLER_SLOT, *PXENVIF_CONTROLLER_SLOT;
+
+#define XENVIF_CONTROLLER_MAXIMUM_SLOTS 8
+
 struct _XENVIF_CONTROLLER {
     PXENVIF_FRONTEND                    Frontend;
     KSPIN_LOCK                          Lock;
@@ -72,8 +88,15 @@ struct _XENVIF_CONTROLLER {
     ULONG                               Events;
     BOOLEAN                             Connected;
     USHORT                              RequestId;
-    struct xen_netif_ctrl_request       Request;
-    struct xen_netif_ctrl_response      Response;
+    XENVIF_CONTROLLER_SLOT              Slot[XENVIF_CONTROLLER_MAXIMUM_SLOTS];
+    ULONG                               Outstanding;
+    PMDL                                KeyMdl;
+    PXENBUS_GNTTAB_ENTRY                KeyEntry;
+    PMDL                                MappingMdl;
+    PXENBUS_GNTTAB_ENTRY                MappingEntry;
+    ULONG                               Requests;
+    ULONG                               Responses;
+    ULONG                               Batches;
     XENBUS_GNTTAB_INTERFACE             GnttabInterface;
     XENBUS_EVTCHN_INTERFACE             EvtchnInterface;
     XENBUS_STORE_INTERFACE              StoreInterface;
@@ -146,6 +169,50 @@ __ControllerSend(
                          Controller->Channel);
 }
 
+static FORCEINLINE NTSTATUS
+__ControllerTranslateStatus(
+    IN  ULONG   Status
+    )
+{
+    switch (Status) {
+    case XEN_NETIF_CTRL_STATUS_SUCCESS:
+        return STATUS_SUCCESS;
+
+    case XEN_NETIF_CTRL_STATUS_NOT_SUPPORTED:
+        return STATUS_NOT_SUPPORTED;
+
+    case XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER:
+        return STATUS_INVALID_PARAMETER;
+
+    case XEN_NETIF_CTRL_STATUS_BUFFER_OVERFLOW:
+        return STATUS_BUFFER_OVERFLOW;
+
+    default:
+        return STATUS_UNSUCCESSFUL;
+    }
+}
+
+static PXENVIF_CONTROLLER_SLOT
+ControllerFindSlot(
+    IN  PXENVIF_CONTROLLER  Controller,
+    IN  USHORT              Id
+    )
+{
+    ULONG                   Index;
+
+    if (Id == 0)
+        return NULL;
+
+    for (Index = 0; Index < XENVIF_CONTROLLER_MAXIMUM_SLOTS; Index++) {
+        PXENVIF_CONTROLLER_SLOT Slot = &Controller->Slot[Index];
+
+        if (Slot->Id == Id)
+            return Slot;
+    }
+
+    return NULL;
+}
+
 VOID
 ControllerPoll(
     IN  PXENVIF_CONTROLLER          Controller
@@ -153,42 +220,77 @@ ControllerPoll(
 {
     RING_IDX                        rsp_prod;
     RING_IDX                        rsp_cons;
-    struct xen_netif_ctrl_response  *rsp;
 
-    KeMemoryBarrier();
+    for (;;) {
+        KeMemoryBarrier();
 
-    rsp_prod = Controller->Shared->rsp_prod;
-    rsp_cons = Controller->Front.rsp_cons;
+        rsp_prod = Controller->Shared->rsp_prod;
+        rsp_cons = Controller->Front.rsp_cons;
 
-    KeMemoryBarrier();
+        KeMemoryBarrier();
 
-    if (rsp_cons == rsp_prod)
-        return;
+        if (rsp_cons == rsp_prod)
+            break;
 
-    rsp = RING_GET_RESPONSE(&Controller->Front, rsp_cons);
-    rsp_cons++;
+        while (rsp_cons != rsp_prod) {
+            struct xen_netif_ctrl_response  *rsp;
+            struct xen_netif_ctrl_response  Response;
+            PXENVIF_CONTROLLER_SLOT         Slot;
+            XENVIF_CONTROLLER_COMPLETION    Completion;
+            PVOID                           Argument;
 
-    Controller->Response = *rsp;
+            rsp = RING_GET_RESPONSE(&Controller->Front, rsp_cons);
+            rsp_cons++;
 
-    KeMemoryBarrier();
+            Response = *rsp;
+
+            Slot = ControllerFindSlot(Controller, (USHORT)Response.id);
+            if (Slot == NULL) {
+                Warning("%s: unexpected response id %u\n",
+                        FrontendGetPath(Controller->Frontend),
+                        Response.id);
+                continue;
+            }
+
+            ASSERT3U(Response.type, ==, Slot->Type);
+
+            Completion = Slot->Completion;
+            Argument = Slot->Argument;
+
+            RtlZeroMemory(Slot, sizeof (XENVIF_CONTROLLER_SLOT));
+
+            ASSERT(Controller->Outstanding != 0);
+            --Controller->Outstanding;
+            Controller->Responses++;
+
+            if (Completion != NULL)
+                Completion(Argument,
+                           __ControllerTranslateStatus(Response.status),
+                           Response.data);
+        }
+
+        KeMemoryBarrier();
 
-    Controller->Front.rsp_cons = rsp_cons;
-    Controller->Shared->rsp_event = rsp_cons + 1;
+        Controller->Front.rsp_cons = rsp_cons;
+        Controller->Shared->rsp_event = rsp_cons + 1;
+    }
 }
 
 static NTSTATUS
 ControllerPutRequest(
-    IN  PXENVIF_CONTROLLER          Controller,
-    IN  USHORT                      Type,
-    IN  ULONG                       Data0,
-    IN  ULONG                       Data1,
-    IN  ULONG                       Data2
+    IN  PXENVIF_CONTROLLER              Controller,
+    IN  USHORT                          Type,
+    IN  ULONG                           Data0,
+    IN  ULONG                           Data1,
+    IN  ULONG                           Data2,
+    IN  XENVIF_CONTROLLER_COMPLETION    Completion OPTIONAL,
+    IN  PVOID                           Argument OPTIONAL
     )
 {
-    RING_IDX                        req_prod;
-    struct xen_netif_ctrl_request   *req;
-    BOOLEAN                         Notify;
-    NTSTATUS                        status;
+    RING_IDX                            req_prod;
+    struct xen_netif_ctrl_request       *req;
+    PXENVIF_CONTROLLER_SLOT             Slot;
+    NTSTATUS                            status;
 
     status = STATUS_NOT_SUPPORTED;
     if (!Controller->Connected)
@@ -198,27 +300,62 @@ ControllerPutRequest(
     if (RING_FULL(&Controller->Front))
         goto fail2;
 
-    Controller->Request.type = Type;
+    for (Slot = &Controller->Slot[0];
+         Slot != &Controller->Slot[XENVIF_CONTROLLER_MAXIMUM_SLOTS];
+         Slot++)
+        if (Slot->Id == 0)
+            break;
+
+    if (Slot == &Controller->Slot[XENVIF_CONTROLLER_MAXIMUM_SLOTS])
+        goto fail3;
 
-    Controller->Request.id = Controller->RequestId++;
-    if (Controller->Request.id == 0) // Make sure we skip zero
-        Controller->Request.id = Controller->RequestId++;
+    Slot->Id = Controller->RequestId++;
+    if (Slot->Id == 0) // Make sure we skip zero
+        Slot->Id = Controller->RequestId++;
 
-    Controller->Request.data[0] = Data0;
-    Controller->Request.data[1] = Data1;
-    Controller->Request.data[2] = Data2;
+    Slot->Type = Type;
+    Slot->Completion = Completion;
+    Slot->Argument = Argument;
 
     req_prod = Controller->Front.req_prod_pvt;
 
     req = RING_GET_REQUEST(&Controller->Front, req_prod);
     req_prod++;
 
-    *req = Controller->Request;
+    req->type = Type;
+    req->id = Slot->Id;
+    req->data[0] = Data0;
+    req->data[1] = Data1;
+    req->data[2] = Data2;
 
     KeMemoryBarrier();
 
     Controller->Front.req_prod_pvt = req_prod;
 
+    Controller->Outstanding++;
+    Controller->Requests++;
+
+    return STATUS_SUCCESS;
+
+fail3:
+    Error("fail3\n");
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+static VOID
+ControllerPushRequests(
+    IN  PXENVIF_CONTROLLER  Controller
+    )
+{
+    BOOLEAN                 Notify;
+
 #pragma warning (push)
 #pragma warning (disable:4244)
 
@@ -230,15 +367,7 @@ ControllerPutRequest(
     if (Notify)
         __ControllerSend(Controller);
 
-    return STATUS_SUCCESS;
-
-fail2:
-    Error("fail2\n");
-
-fail1:
-    Error("fail1 (%08x)\n", status);
-
-    return status;
+    Controller->Batches++;
 }
 
 #define TIME_US(_us)        ((_us) * 10)
@@ -247,10 +376,9 @@ fail1:
 
 #define XENVIF_CONTROLLER_POLL_PERIOD 100 // ms
 
-static NTSTATUS
-ControllerGetResponse(
-    IN  PXENVIF_CONTROLLER          Controller,
-    OUT PULONG                      Data OPTIONAL
+static VOID
+ControllerWaitForResponses(
+    IN  PXENVIF_CONTROLLER          Controller
     )
 {
     LARGE_INTEGER                   Timeout;
@@ -268,7 +396,7 @@ ControllerGetResponse(
         ControllerPoll(Controller);
         KeMemoryBarrier();
 
-        if (Controller->Response.id == Controller->Request.id)
+        if (Controller->Outstanding == 0)
             break;
 
         status = XENBUS_EVTCHN(Wait,
@@ -279,38 +407,69 @@ ControllerGetResponse(
         if (status == STATUS_TIMEOUT)
             __ControllerSend(Controller);
     }
+}
 
-    ASSERT3U(Controller->Response.type, ==, Controller->Request.type);
+typedef struct _XENVIF_CONTROLLER_RESULT {
+    NTSTATUS    Status;
+    ULONG       Data;
+} XENVIF_CONTROLLER_RESULT, *PXENVIF_CONTROLLER_RESULT;
 
-    switch (Controller->Response.status) {
-    case XEN_NETIF_CTRL_STATUS_SUCCESS:
-        status = STATUS_SUCCESS;
-        break;
+static VOID
+ControllerCompleteResult(
+    IN  PVOID                   Argument,
+    IN  NTSTATUS                Status,
+    IN  ULONG                   Data
+    )
+{
+    PXENVIF_CONTROLLER_RESULT   Result = Argument;
 
-    case XEN_NETIF_CTRL_STATUS_NOT_SUPPORTED:
-        status = STATUS_NOT_SUPPORTED;
-        break;
+    Result->Status = Status;
+    Result->Data = Data;
+}
 
-    case XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER:
-        status = STATUS_INVALID_PARAMETER;
-        break;
+static NTSTATUS
+ControllerTransact(
+    IN  PXENVIF_CONTROLLER          Controller,
+    IN  USHORT                      Type,
+    IN  ULONG                       Data0,
+    IN  ULONG                       Data1,
+    IN  ULONG                       Data2,
+    OUT PULONG                      Data OPTIONAL
+    )
+{
+    XENVIF_CONTROLLER_RESULT        Result;
+    NTSTATUS                        status;
 
-    case XEN_NETIF_CTRL_STATUS_BUFFER_OVERFLOW:
-        status = STATUS_BUFFER_OVERFLOW;
-        break;
+    Result.Status = STATUS_UNSUCCESSFUL;
+    Result.Data = 0;
 
-    default:
-        status = STATUS_UNSUCCESSFUL;
-        break;
-    }
+    status = ControllerPutRequest(Controller,
+                                  Type,
+                                  Data0,
+                                  Data1,
+                                  Data2,
+                                  ControllerCompleteResult,
+                                  &Result);
+    if (!NT_SUCCESS(status))
+        goto fail1;
+
+    ControllerPushRequests(Controller);
+    ControllerWaitForResponses(Controller);
+
+    status = Result.Status;
+    if (!NT_SUCCESS(status))
+        goto fail2;
 
-    if (NT_SUCCESS(status) && Data != NULL)
-        *Data = Controller->Response.data;
+    if (Data != NULL)
+        *Data = Result.Data;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
 
-    RtlZeroMemory(&Controller->Request,
-                  sizeof (struct xen_netif_ctrl_request));
-    RtlZeroMemory(&Controller->Response,
-                  sizeof (struct xen_netif_ctrl_response));
+fail1:
+    Error("fail1 (%08x)\n", status);
 
     return status;
 }
@@ -340,8 +499,99 @@ ControllerDebugCallback(
     IN  BOOLEAN         Crashing
     )
 {
-    UNREFERENCED_PARAMETER(Argument);
+    PXENVIF_CONTROLLER  Controller = Argument;
+
     UNREFERENCED_PARAMETER(Crashing);
+
+    XENBUS_DEBUG(Printf,
+                 &Controller->DebugInterface,
+                 "FRONT: req_prod_pvt = %u rsp_cons = %u nr_ents = %u sring = %p\n",
+                 Controller->Front.req_prod_pvt,
+                 Controller->Front.rsp_cons,
+                 Controller->Front.nr_ents,
+                 Controller->Front.sring);
+
+    XENBUS_DEBUG(Printf,
+                 &Controller->DebugInterface,
+                 "SHARED: req_prod = %u req_event = %u rsp_prod = %u rsp_event = %u\n",
+                 Controller->Shared->req_prod,
+                 Controller->Shared->req_event,
+                 Controller->Shared->rsp_prod,
+                 Controller->Shared->rsp_event);
+
+    XENBUS_DEBUG(Printf,
+                 &Controller->DebugInterface,
+                 "Requests = %u Responses = %u Batches = %u Outstanding = %u\n",
+                 Controller->Requests,
+                 Controller->Responses,
+                 Controller->Batches,
+                 Controller->Outstanding);
+}
+
+static NTSTATUS
+ControllerGrantPage(
+    IN  PXENVIF_CONTROLLER      Controller,
+    OUT PMDL                    *Mdl,
+    OUT PXENBUS_GNTTAB_ENTRY    *Entry
+    )
+{
+    PXENVIF_FRONTEND            Frontend;
+    PFN_NUMBER                  Pfn;
+    NTSTATUS                    status;
+
+    Frontend = Controller->Frontend;
+
+    *Mdl = __AllocatePage();
+
+    status = STATUS_NO_MEMORY;
+    if (*Mdl == NULL)
+        goto fail1;
+
+    ASSERT((*Mdl)->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+
+    Pfn = MmGetMdlPfnArray(*Mdl)[0];
+
+    status = XENBUS_GNTTAB(PermitForeignAccess,
+                           &Controller->GnttabInterface,
+                           Controller->GnttabCache,
+                           TRUE,
+                           FrontendGetBackendDomain(Frontend),
+                           Pfn,
+                           TRUE,
+                           Entry);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+    __FreePage(*Mdl);
+    *Mdl = NULL;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+static VOID
+ControllerRevokePage(
+    IN  PXENVIF_CONTROLLER      Controller,
+    IN  PMDL                    *Mdl,
+    IN  PXENBUS_GNTTAB_ENTRY    *Entry
+    )
+{
+    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                         &Controller->GnttabInterface,
+                         Controller->GnttabCache,
+                         TRUE,
+                         *Entry);
+    *Entry = NULL;
+
+    __FreePage(*Mdl);
+    *Mdl = NULL;
 }
 
 NTSTATUS
@@ -490,6 +740,21 @@ ControllerConnect(
     if (!NT_SUCCESS(status))
         goto fail8;
 
+    // The hash key and mapping pages stay granted (read-only) for the
+    // lifetime of the connection so that RSS updates need no grant
+    // table operations.
+    status = ControllerGrantPage(Controller,
+                                 &Controller->KeyMdl,
+                                 &Controller->KeyEntry);
+    if (!NT_SUCCESS(status))
+        goto fail9;
+
+    status = ControllerGrantPage(Controller,
+                                 &Controller->MappingMdl,
+                                 &Controller->MappingEntry);
+    if (!NT_SUCCESS(status))
+        goto fail10;
+
     Controller->Channel = XENBUS_EVTCHN(Open,
                                         &Controller->EvtchnInterface,
                                         XENBUS_EVTCHN_TYPE_UNBOUND,
@@ -500,7 +765,13 @@ ControllerConnect(
 
     status = STATUS_UNSUCCESSFUL;
     if (Controller->Channel == NULL)
-        goto fail9;
+        goto fail11;
+
+    if (Controller->EvtchnInterface.Interface.Version >= 9)
+        (VOID) XENBUS_EVTCHN(SetPriority,
+                             &Controller->EvtchnInterface,
+                             Controller->Channel,
+                             XENBUS_EVTCHN_PRIORITY_HIGH);
 
     (VOID) XENBUS_EVTCHN(Unmask,
                          &Controller->EvtchnInterface,
@@ -515,7 +786,7 @@ ControllerConnect(
                           Controller,
                           &Controller->DebugCallback);
     if (!NT_SUCCESS(status))
-        goto fail10;
+        goto fail12;
 
     __ControllerAcquireLock(Controller);
 
@@ -527,8 +798,8 @@ done:
     Trace("<====\n");
     return STATUS_SUCCESS;
 
-fail10:
-    Error("fail10\n");
+fail12:
+    Error("fail12\n");
 
     XENBUS_EVTCHN(Close,
                   &Controller->EvtchnInterface,
@@ -537,6 +808,20 @@ fail10:
 
     Controller->Events = 0;
 
+fail11:
+    Error("fail11\n");
+
+    ControllerRevokePage(Controller,
+                         &Controller->MappingMdl,
+                         &Controller->MappingEntry);
+
+fail10:
+    Error("fail10\n");
+
+    ControllerRevokePage(Controller,
+                         &Controller->KeyMdl,
+                         &Controller->KeyEntry);
+
 fail9:
     Error("fail9\n");
 
@@ -682,6 +967,7 @@ ControllerDisconnect(
         goto done;
     }
 
+    ASSERT3U(Controller->Outstanding, ==, 0);
     Controller->Connected = FALSE;
 
     __ControllerReleaseLock(Controller);
@@ -698,6 +984,14 @@ ControllerDisconnect(
 
     Controller->Events = 0;
 
+    ControllerRevokePage(Controller,
+                         &Controller->MappingMdl,
+                         &Controller->MappingEntry);
+
+    ControllerRevokePage(Controller,
+                         &Controller->KeyMdl,
+                         &Controller->KeyEntry);
+
     (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
                          &Controller->GnttabInterface,
                          Controller->GnttabCache,
@@ -713,6 +1007,10 @@ ControllerDisconnect(
     __FreePage(Controller->Mdl);
     Controller->Mdl = NULL;
 
+    Controller->Requests = 0;
+    Controller->Responses = 0;
+    Controller->Batches = 0;
+
     XENBUS_GNTTAB(DestroyCache,
                   &Controller->GnttabInterface,
                   Controller->GnttabCache);
@@ -760,252 +1058,132 @@ ControllerTeardown(
     __ControllerFree(Controller);
 }
 
-NTSTATUS
-ControllerSetHashAlgorithm(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  ULONG               Algorithm
+static NTSTATUS
+__ControllerPutHashKey(
+    IN  PXENVIF_CONTROLLER              Controller,
+    IN  PUCHAR                          Key,
+    IN  ULONG                           Size,
+    IN  XENVIF_CONTROLLER_COMPLETION    Completion,
+    IN  PVOID                           Argument
     )
 {
-    PXENVIF_FRONTEND        Frontend;
-    NTSTATUS                status;
-
-    Frontend = Controller->Frontend;
-
-    __ControllerAcquireLock(Controller);
+    PUCHAR                              Buffer;
+    NTSTATUS                            status;
 
-    status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_SET_HASH_ALGORITHM,
-                                  Algorithm,
-                                  0,
-                                  0);
-    if (!NT_SUCCESS(status))
+    status = STATUS_INVALID_PARAMETER;
+    if (Size > PAGE_SIZE)
         goto fail1;
 
-    status = ControllerGetResponse(Controller, NULL);
-    if (!NT_SUCCESS(status))
+    status = STATUS_NOT_SUPPORTED;
+    if (!Controller->Connected)
         goto fail2;
 
-    __ControllerReleaseLock(Controller);
-
-    return STATUS_SUCCESS;
-
-fail2:
-    Error("fail2\n");
-
-fail1:
-    Error("fail1 (%08x)\n", status);
-
-    __ControllerReleaseLock(Controller);
-
-    return status;
-}
-
-NTSTATUS
-ControllerGetHashFlags(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  PULONG              Flags
-    )
-{
-    PXENVIF_FRONTEND        Frontend;
-    NTSTATUS                status;
-
-    Frontend = Controller->Frontend;
+    Buffer = Controller->KeyMdl->MappedSystemVa;
+    ASSERT(Buffer != NULL);
 
-    __ControllerAcquireLock(Controller);
+    RtlCopyMemory(Buffer, Key, Size);
 
     status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_GET_HASH_FLAGS,
-                                  0,
+                                  XEN_NETIF_CTRL_TYPE_SET_HASH_KEY,
+                                  XENBUS_GNTTAB(GetReference,
+                                                &Controller->GnttabInterface,
+                                                Controller->KeyEntry),
+                                  Size,
                                   0,
-                                  0);
+                                  Completion,
+                                  Argument);
     if (!NT_SUCCESS(status))
-        goto fail1;
-
-    status = ControllerGetResponse(Controller, Flags);
-    if (!NT_SUCCESS(status))
-        goto fail2;
-
-    __ControllerReleaseLock(Controller);
+        goto fail3;
 
     return STATUS_SUCCESS;
 
+fail3:
+    Error("fail3\n");
+
 fail2:
     Error("fail2\n");
 
 fail1:
     Error("fail1 (%08x)\n", status);
 
-    __ControllerReleaseLock(Controller);
-
     return status;
 }
 
-NTSTATUS
-ControllerSetHashFlags(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  ULONG               Flags
+static NTSTATUS
+__ControllerPutHashMapping(
+    IN  PXENVIF_CONTROLLER              Controller,
+    IN  PULONG                          Mapping,
+    IN  ULONG                           Size,
+    IN  ULONG                           Offset,
+    IN  XENVIF_CONTROLLER_COMPLETION    Completion,
+    IN  PVOID                           Argument
     )
 {
-    PXENVIF_FRONTEND        Frontend;
-    NTSTATUS                status;
-
-    Frontend = Controller->Frontend;
-
-    __ControllerAcquireLock(Controller);
+    PUCHAR                              Buffer;
+    NTSTATUS                            status;
 
-    status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_SET_HASH_FLAGS,
-                                  Flags,
-                                  0,
-                                  0);
-    if (!NT_SUCCESS(status))
+    status = STATUS_INVALID_PARAMETER;
+    if (Size * sizeof (ULONG) > PAGE_SIZE)
         goto fail1;
 
-    status = ControllerGetResponse(Controller, NULL);
-    if (!NT_SUCCESS(status))
+    status = STATUS_NOT_SUPPORTED;
+    if (!Controller->Connected)
         goto fail2;
 
-    __ControllerReleaseLock(Controller);
-
-    return STATUS_SUCCESS;
-
-fail2:
-    Error("fail2\n");
-
-fail1:
-    Error("fail1 (%08x)\n", status);
-
-    __ControllerReleaseLock(Controller);
-
-    return status;
-}
-
-NTSTATUS
-ControllerSetHashKey(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  PUCHAR              Key,
-    IN  ULONG               Size
-    )
-{
-    PXENVIF_FRONTEND        Frontend;
-    PMDL                    Mdl;
-    PUCHAR                  Buffer;
-    PFN_NUMBER              Pfn;
-    PXENBUS_GNTTAB_ENTRY    Entry;
-    NTSTATUS                status;
-
-    Frontend = Controller->Frontend;
-
-    __ControllerAcquireLock(Controller);
-
-    Mdl = __AllocatePage();
-
-    status = STATUS_NO_MEMORY;
-    if (Controller->Mdl == NULL)
-        goto fail1;
-
-    ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
-    Buffer = Mdl->MappedSystemVa;
+    Buffer = Controller->MappingMdl->MappedSystemVa;
     ASSERT(Buffer != NULL);
 
-    RtlCopyMemory(Buffer, Key, Size);
-
-    Pfn = MmGetMdlPfnArray(Mdl)[0];
-
-    status = XENBUS_GNTTAB(PermitForeignAccess,
-                           &Controller->GnttabInterface,
-                           Controller->GnttabCache,
-                           TRUE,
-                           FrontendGetBackendDomain(Frontend),
-                           Pfn,
-                           FALSE,
-                           &Entry);
-    if (!NT_SUCCESS(status))
-        goto fail2;
+    RtlCopyMemory(Buffer, Mapping, Size * sizeof (ULONG));
 
     status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_SET_HASH_KEY,
+                                  XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING,
                                   XENBUS_GNTTAB(GetReference,
                                                 &Controller->GnttabInterface,
-                                                Entry),
+                                                Controller->MappingEntry),
                                   Size,
-                                  0);
+                                  Offset,
+                                  Completion,
+                                  Argument);
     if (!NT_SUCCESS(status))
         goto fail3;
 
-    status = ControllerGetResponse(Controller, NULL);
-    if (!NT_SUCCESS(status))
-        goto fail4;
-
-    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
-                         &Controller->GnttabInterface,
-                         Controller->GnttabCache,
-                         TRUE,
-                         Entry);
-
-    __FreePage(Mdl);
-
-    __ControllerReleaseLock(Controller);
-
     return STATUS_SUCCESS;
 
-fail4:
-    Error("fail4\n");
-
 fail3:
     Error("fail3\n");
 
-    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
-                         &Controller->GnttabInterface,
-                         Controller->GnttabCache,
-                         TRUE,
-                         Entry);
-
 fail2:
     Error("fail2\n");
 
-    __FreePage(Mdl);
-
 fail1:
     Error("fail1 (%08x)\n", status);
 
-    __ControllerReleaseLock(Controller);
-
     return status;
 }
 
 NTSTATUS
-ControllerGetHashMappingSize(
+ControllerGetHashFlags(
     IN  PXENVIF_CONTROLLER  Controller,
-    IN  PULONG              Size
+    IN  PULONG              Flags
     )
 {
-    PXENVIF_FRONTEND        Frontend;
     NTSTATUS                status;
 
-    Frontend = Controller->Frontend;
-
     __ControllerAcquireLock(Controller);
 
-    status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_GET_HASH_MAPPING_SIZE,
-                                  0,
-                                  0,
-                                  0);
+    status = ControllerTransact(Controller,
+                                XEN_NETIF_CTRL_TYPE_GET_HASH_FLAGS,
+                                0,
+                                0,
+                                0,
+                                Flags);
     if (!NT_SUCCESS(status))
         goto fail1;
 
-    status = ControllerGetResponse(Controller, Size);
-    if (!NT_SUCCESS(status))
-        goto fail2;
-
     __ControllerReleaseLock(Controller);
 
     return STATUS_SUCCESS;
 
-fail2:
-    Error("fail2\n");
-
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -1014,140 +1192,142 @@ fail1:
     return status;
 }
 
-NTSTATUS
-ControllerSetHashMappingSize(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  ULONG               Size
+typedef struct _XENVIF_CONTROLLER_BATCH {
+    NTSTATUS    Status;
+    ULONG       Failed;
+} XENVIF_CONTROLLER_BATCH, *PXENVIF_CONTROLLER_BATCH;
+
+static VOID
+ControllerCompleteBatch(
+    IN  PVOID                   Argument,
+    IN  NTSTATUS                Status,
+    IN  ULONG                   Data
     )
 {
-    PXENVIF_FRONTEND        Frontend;
-    NTSTATUS                status;
-
-    Frontend = Controller->Frontend;
-
-    __ControllerAcquireLock(Controller);
-
-    status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING_SIZE,
-                                  Size,
-                                  0,
-                                  0);
-    if (!NT_SUCCESS(status))
-        goto fail1;
-
-    status = ControllerGetResponse(Controller, NULL);
-    if (!NT_SUCCESS(status))
-        goto fail2;
-
-    __ControllerReleaseLock(Controller);
-
-    return STATUS_SUCCESS;
+    PXENVIF_CONTROLLER_BATCH    Batch = Argument;
 
-fail2:
-    Error("fail2\n");
-
-fail1:
-    Error("fail1 (%08x)\n", status);
-
-    __ControllerReleaseLock(Controller);
+    UNREFERENCED_PARAMETER(Data);
 
-    return status;
+    // Keep the first failure. Each request succeeds or fails on its own
+    // so those after it may still have been applied.
+    if (!NT_SUCCESS(Status) && Batch->Failed++ == 0)
+        Batch->Status = Status;
 }
 
 NTSTATUS
-ControllerSetHashMapping(
+ControllerSetHash(
     IN  PXENVIF_CONTROLLER  Controller,
+    IN  ULONG               Algorithm,
     IN  PULONG              Mapping,
     IN  ULONG               Size,
-    IN  ULONG               Offset
+    IN  PUCHAR              Key,
+    IN  ULONG               KeySize,
+    IN  ULONG               Flags
     )
 {
-    PXENVIF_FRONTEND        Frontend;
-    PMDL                    Mdl;
-    PUCHAR                  Buffer;
-    PFN_NUMBER              Pfn;
-    PXENBUS_GNTTAB_ENTRY    Entry;
+    XENVIF_CONTROLLER_BATCH Batch;
     NTSTATUS                status;
 
-    Frontend = Controller->Frontend;
-
     __ControllerAcquireLock(Controller);
 
-    status = STATUS_INVALID_PARAMETER;
-    if (Size * sizeof (ULONG) > PAGE_SIZE)
-        goto fail1;
-
-    Mdl = __AllocatePage();
-
-    status = STATUS_NO_MEMORY;
-    if (Controller->Mdl == NULL)
-        goto fail2;
-
-    ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
-    Buffer = Mdl->MappedSystemVa;
-    ASSERT(Buffer != NULL);
-
-    RtlCopyMemory(Buffer, Mapping, Size * sizeof (ULONG));
-
-    Pfn = MmGetMdlPfnArray(Mdl)[0];
-
-    status = XENBUS_GNTTAB(PermitForeignAccess,
-                           &Controller->GnttabInterface,
-                           Controller->GnttabCache,
-                           TRUE,
-                           FrontendGetBackendDomain(Frontend),
-                           Pfn,
-                           FALSE,
-                           &Entry);
-    if (!NT_SUCCESS(status))
-        goto fail3;
+    Batch.Status = STATUS_SUCCESS;
+    Batch.Failed = 0;
 
+    // Queue the whole update so that the backend sees it in a single
+    // notification and we wait for a single set of responses.
     status = ControllerPutRequest(Controller,
-                                  XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING,
-                                  XENBUS_GNTTAB(GetReference,
-                                                &Controller->GnttabInterface,
-                                                Entry),
-                                  Size,
-                                  Offset);
+                                  XEN_NETIF_CTRL_TYPE_SET_HASH_ALGORITHM,
+                                  Algorithm,
+                                  0,
+                                  0,
+                                  ControllerCompleteBatch,
+                                  &Batch);
     if (!NT_SUCCESS(status))
-        goto fail4;
+        goto fail1;
 
-    status = ControllerGetResponse(Controller, NULL);
-    if (!NT_SUCCESS(status))
-        goto fail5;
+    // Disabling hashing needs nothing more than the algorithm
+    if (Algorithm != XEN_NETIF_CTRL_HASH_ALGORITHM_NONE) {
+        status = ControllerPutRequest(Controller,
+                                      XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING_SIZE,
+                                      Size,
+                                      0,
+                                      0,
+                                      ControllerCompleteBatch,
+                                      &Batch);
+        if (!NT_SUCCESS(status))
+            goto fail2;
+
+        status = __ControllerPutHashMapping(Controller,
+                                            Mapping,
+                                            Size,
+                                            0,
+                                            ControllerCompleteBatch,
+                                            &Batch);
+        if (!NT_SUCCESS(status))
+            goto fail3;
+
+        status = __ControllerPutHashKey(Controller,
+                                        Key,
+                                        KeySize,
+                                        ControllerCompleteBatch,
+                                        &Batch);
+        if (!NT_SUCCESS(status))
+            goto fail4;
+
+        status = ControllerPutRequest(Controller,
+                                      XEN_NETIF_CTRL_TYPE_SET_HASH_FLAGS,
+                                      Flags,
+                                      0,
+                                      0,
+                                      ControllerCompleteBatch,
+                                      &Batch);
+        if (!NT_SUCCESS(status))
+            goto fail5;
+    }
 
-    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
-                         &Controller->GnttabInterface,
-                         Controller->GnttabCache,
-                         TRUE,
-                         Entry);
+    ControllerPushRequests(Controller);
+    ControllerWaitForResponses(Controller);
 
-    __FreePage(Mdl);
+    status = Batch.Status;
+    if (!NT_SUCCESS(status))
+        goto fail6;
 
     __ControllerReleaseLock(Controller);
 
     return STATUS_SUCCESS;
 
+fail6:
+    Error("fail6\n");
+
 fail5:
     Error("fail5\n");
 
 fail4:
     Error("fail4\n");
 
-    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
-                         &Controller->GnttabInterface,
-                         Controller->GnttabCache,
-                         TRUE,
-                         Entry);
-
 fail3:
     Error("fail3\n");
 
-    __FreePage(Mdl);
-
 fail2:
     Error("fail2\n");
 
+    // Flush whatever made it onto the ring so that no slot is left
+    // referring to our stack.
+    if (Controller->Outstanding != 0) {
+        ControllerPushRequests(Controller);
+        ControllerWaitForResponses(Controller);
+    }
+
+    // The backend may now have, say, the new algorithm with the old key
+    // or mapping. Turn hashing off rather than leave it half configured.
+    if (Algorithm != XEN_NETIF_CTRL_HASH_ALGORITHM_NONE)
+        (VOID) ControllerTransact(Controller,
+                                  XEN_NETIF_CTRL_TYPE_SET_HASH_ALGORITHM,
+                                  XEN_NETIF_CTRL_HASH_ALGORITHM_NONE,
+                                  0,
+                                  0,
+                                  NULL);
+
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -77,12 +77,6 @@ ControllerTeardown(
     IN  PXENVIF_CONTROLLER  Controller
     );
 
-extern NTSTATUS
-ControllerSetHashAlgorithm(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  ULONG               Algorithm
-    );
-
 extern NTSTATUS
 ControllerGetHashFlags(
     IN  PXENVIF_CONTROLLER  Controller,
@@ -90,36 +84,14 @@ ControllerGetHashFlags(
     );
 
 extern NTSTATUS
-ControllerSetHashFlags(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  ULONG               Flags
-    );
-
-extern NTSTATUS
-ControllerSetHashKey(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  PUCHAR              Key,
-    IN  ULONG               Size
-    );
-
-extern NTSTATUS
-ControllerGetHashMappingSize(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  PULONG              Size
-    );
-
-extern NTSTATUS
-ControllerSetHashMappingSize(
-    IN  PXENVIF_CONTROLLER  Controller,
-    IN  ULONG               Size
-    );
-
-extern NTSTATUS
-ControllerSetHashMapping(
+ControllerSetHash(
     IN  PXENVIF_CONTROLLER  Controller,
+    IN  ULONG               Algorithm,
     IN  PULONG              Mapping,
     IN  ULONG               Size,
-    IN  ULONG               Offset
+    IN  PUCHAR              Key,
+    IN  ULONG               KeySize,
+    IN  ULONG               Flags
     );
 
 
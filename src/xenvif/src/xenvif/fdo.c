@@ -3107,10 +3107,23 @@ FdoCreate(
                                  EVTCHN,
                                  (PINTERFACE)&Fdo->EvtchnInterface,
                                  sizeof (Fdo->EvtchnInterface),
-                                 FALSE);
+                                 TRUE);
     if (!NT_SUCCESS(status))
         goto fail9;
 
+    // Channel priorities are only a hint so fall back to the previous
+    // version if XENBUS is older than this driver
+    if (Fdo->EvtchnInterface.Interface.Version == 0) {
+        status = FdoQueryInterface(Fdo,
+                                   &GUID_XENBUS_EVTCHN_INTERFACE,
+                                   8,
+                                   (PINTERFACE)&Fdo->EvtchnInterface,
+                                   sizeof (struct _XENBUS_EVTCHN_INTERFACE_V8),
+                                   FALSE);
+        if (!NT_SUCCESS(status))
+            goto fail9;
+    }
+
     status = FDO_QUERY_INTERFACE(Fdo,
                                  XENBUS,
                                  STORE,
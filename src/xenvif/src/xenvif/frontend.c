@@ -984,102 +984,13 @@ FrontendSetMulticastAddresses(
     IN  ULONG               Count
     )
 {
-    PXENVIF_TRANSMITTER     Transmitter;
     PXENVIF_MAC             Mac;
-    KIRQL                   Irql;
-    PETHERNET_ADDRESS       MulticastAddress;
-    ULONG                   MulticastCount;
-    ULONG                   MulticastIndex;
-    ULONG                   Index;
-    NTSTATUS                status;
 
-    Transmitter = FrontendGetTransmitter(Frontend);
     Mac = FrontendGetMac(Frontend);
 
-    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
-
-    status = MacQueryMulticastAddresses(Mac, NULL, &MulticastCount);
-    ASSERT3U(status, ==, STATUS_BUFFER_OVERFLOW);
-
-    if (MulticastCount != 0) {
-        MulticastAddress = __FrontendAllocate(sizeof (ETHERNET_ADDRESS) *
-                                              MulticastCount);
-
-        status = STATUS_NO_MEMORY;
-        if (MulticastAddress == NULL)
-            goto fail1;
-
-        status = MacQueryMulticastAddresses(Mac,
-                                            MulticastAddress,
-                                            &MulticastCount);
-        if (!NT_SUCCESS(status))
-            goto fail2;
-    } else
-        MulticastAddress = NULL;
-
-    for (Index = 0; Index < Count; Index++) {
-        BOOLEAN Found;
-
-        ASSERT(Address[Index].Byte[0] & 0x01);
-
-        Found = FALSE;
-
-        // If the multicast address has already been added and it
-        // appears in the updated list then we don't want to remove it.
-        for (MulticastIndex = 0;
-             MulticastIndex < MulticastCount;
-             MulticastIndex++) {
-            if (RtlEqualMemory(&Address[Index],
-                               &MulticastAddress[MulticastIndex],
-                               ETHERNET_ADDRESS_LENGTH)) {
-                Found = TRUE;
-                RtlZeroMemory(&MulticastAddress[MulticastIndex],
-                              ETHERNET_ADDRESS_LENGTH);
-                break;
-            }
-        }
-
-        if (!Found) {
-            (VOID) MacAddMulticastAddress(Mac, &Address[Index]);
-            (VOID) TransmitterQueueMulticastControl(Transmitter,
-                                                    &Address[Index],
-                                                    TRUE);
-        }
-    }
-
-    // Walk the multicast list removing any addresses not in the
-    // updated list
-    for (MulticastIndex = 0;
-         MulticastIndex < MulticastCount;
-         MulticastIndex++) {
-        if (!(MulticastAddress[MulticastIndex].Byte[0] & 0x01))
-            continue;
-
-        (VOID) TransmitterQueueMulticastControl(Transmitter,
-                                                &MulticastAddress[MulticastIndex],
-                                                FALSE);
-        (VOID) MacRemoveMulticastAddress(Mac,
-                                         &MulticastAddress[MulticastIndex]);
-    }
-
-    if (MulticastAddress != NULL)
-        __FrontendFree(MulticastAddress);
-
-    KeLowerIrql(Irql);
-
-    return STATUS_SUCCESS;
-
-fail2:
-    Error("fail2\n");
-
-    __FrontendFree(MulticastAddress);
-
-fail1:
-    Error("fail1 (%08x)\n", status);
-
-    KeLowerIrql(Irql);
-
-    return status;
+    // The MAC diffs the new list against the old one and queues the
+    // corresponding multicast control requests
+    return MacSetMulticastAddresses(Mac, Address, Count);
 }
 
 static NTSTATUS
@@ -1829,47 +1740,29 @@ __FrontendUpdateHash(
 
     case XENVIF_PACKET_HASH_ALGORITHM_UNSPECIFIED:
     default:
-        (VOID) ControllerSetHashAlgorithm(Controller,
-                                          XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
+        (VOID) ControllerSetHash(Controller,
+                                 XEN_NETIF_CTRL_HASH_ALGORITHM_NONE,
+                                 NULL,
+                                 0,
+                                 NULL,
+                                 0,
+                                 0);
         goto done;
     }
 
-    status = ControllerSetHashAlgorithm(Controller,
-                                        XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ);
+    status = ControllerSetHash(Controller,
+                               XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ,
+                               Mapping,
+                               Size,
+                               Hash->Key,
+                               XENVIF_VIF_HASH_KEY_SIZE,
+                               Flags);
     if (!NT_SUCCESS(status))
         goto fail1;
 
-    status = ControllerSetHashMappingSize(Controller, Size);
-    if (!NT_SUCCESS(status))
-        goto fail2;
-
-    status = ControllerSetHashMapping(Controller, Mapping, Size, 0);
-    if (!NT_SUCCESS(status))
-        goto fail3;
-
-    status = ControllerSetHashKey(Controller, Hash->Key, XENVIF_VIF_HASH_KEY_SIZE);
-    if (!NT_SUCCESS(status))
-        goto fail4;
-
-    status = ControllerSetHashFlags(Controller, Flags);
-    if (!NT_SUCCESS(status))
-        goto fail5;
-
 done:
     return STATUS_SUCCESS;
 
-fail5:
-    Error("fail5\n");
-
-fail4:
-    Error("fail4\n");
-
-fail3:
-    Error("fail3\n");
-
-fail2:
-    Error("fail2\n");
-
 fail1:
     Error("fail1 (%08x)\n", status);
 
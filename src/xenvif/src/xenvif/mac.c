@@ -42,10 +42,37 @@
 #include "assert.h"
 #include "util.h"
 
-typedef struct _XENVIF_MAC_MULTICAST {
+extern VOID
+NTAPI
+KeGenericCallDpc(
+    __in        PKDEFERRED_ROUTINE  Routine,
+    __in_opt    PVOID               Context
+    );
+
+extern VOID
+NTAPI
+KeSignalCallDpcDone(
+    __in    PVOID   SystemArgument1
+    );
+
+extern LOGICAL
+NTAPI
+KeSignalCallDpcSynchronize(
+    __in    PVOID   SystemArgument2
+    );
+
+// Immutable set of multicast addresses used by the receive path. The
+// table is the only record of the addresses: a list update builds a
+// whole new table, publishes it with a single pointer exchange and hands
+// the old one to the retire thread, which frees it once every processor
+// has dropped below DISPATCH_LEVEL and so no reader can still see it.
+typedef struct _XENVIF_MAC_MULTICAST_TABLE {
     LIST_ENTRY          ListEntry;
-    ETHERNET_ADDRESS    Address;
-} XENVIF_MAC_MULTICAST, *PXENVIF_MAC_MULTICAST;
+    ULONG               Count;
+    ULONG               Mask;
+    ULONG               Filter[8];
+    ETHERNET_ADDRESS    Entry[1];
+} XENVIF_MAC_MULTICAST_TABLE, *PXENVIF_MAC_MULTICAST_TABLE;
 
 struct _XENVIF_MAC {
     PXENVIF_FRONTEND        Frontend;
@@ -56,8 +83,10 @@ struct _XENVIF_MAC {
     ETHERNET_ADDRESS        PermanentAddress;
     ETHERNET_ADDRESS        CurrentAddress;
     ETHERNET_ADDRESS        BroadcastAddress;
-    LIST_ENTRY              MulticastList;
-    ULONG                   MulticastCount;
+    PXENVIF_MAC_MULTICAST_TABLE MulticastTable;
+    LIST_ENTRY              MulticastRetireList;
+    ULONG                   MulticastRetired;
+    PXENVIF_THREAD          MulticastThread;
     XENVIF_MAC_FILTER_LEVEL FilterLevel[ETHERNET_ADDRESS_TYPE_COUNT];
     XENBUS_DEBUG_INTERFACE  DebugInterface;
     PXENBUS_DEBUG_CALLBACK  DebugCallback;
@@ -83,6 +112,280 @@ __MacFree(
     __FreePoolWithTag(Buffer, XENVIF_MAC_TAG);
 }
 
+static FORCEINLINE ULONG
+__MacMulticastHash(
+    IN  PETHERNET_ADDRESS   Address
+    )
+{
+    ULONG                   Value;
+
+    // Multicast addresses differ mostly in their low order bytes so fold
+    // those in last and then apply Fibonacci hashing to spread them.
+    Value = ((ULONG)Address->Byte[0] << 8) | Address->Byte[1];
+    Value *= 0x9E3779B1;
+    Value ^= ((ULONG)Address->Byte[2] << 24) |
+             ((ULONG)Address->Byte[3] << 16) |
+             ((ULONG)Address->Byte[4] << 8) |
+             Address->Byte[5];
+
+    return Value * 0x9E3779B1;
+}
+
+#define XENVIF_MAC_MULTICAST_FILTER_BIT(_Hash)  ((_Hash) >> 24)
+#define XENVIF_MAC_MULTICAST_SLOT(_Hash)        ((_Hash) >> 4)
+
+static FORCEINLINE BOOLEAN
+__MacMulticastTableLookup(
+    IN  PXENVIF_MAC_MULTICAST_TABLE Table,
+    IN  PETHERNET_ADDRESS           Address
+    )
+{
+    ULONG                           Hash;
+    ULONG                           Bit;
+    ULONG                           Slot;
+
+    if (Table == NULL)
+        return FALSE;
+
+    Hash = __MacMulticastHash(Address);
+
+    Bit = XENVIF_MAC_MULTICAST_FILTER_BIT(Hash);
+    if ((Table->Filter[Bit / 32] & (1u << (Bit % 32))) == 0)
+        return FALSE;
+
+    // Empty slots hold the zero address, which can never be multicast,
+    // and the table is never more than half full so the probe always
+    // terminates.
+    for (Slot = XENVIF_MAC_MULTICAST_SLOT(Hash) & Table->Mask;
+         (Table->Entry[Slot].Byte[0] & 0x01) != 0;
+         Slot = (Slot + 1) & Table->Mask) {
+        if (RtlEqualMemory(&Table->Entry[Slot],
+                           Address,
+                           ETHERNET_ADDRESS_LENGTH))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static FORCEINLINE VOID
+__MacMulticastTableInsert(
+    IN  PXENVIF_MAC_MULTICAST_TABLE Table,
+    IN  PETHERNET_ADDRESS           Address
+    )
+{
+    ULONG                           Hash;
+    ULONG                           Bit;
+    ULONG                           Slot;
+
+    Hash = __MacMulticastHash(Address);
+
+    Bit = XENVIF_MAC_MULTICAST_FILTER_BIT(Hash);
+    Table->Filter[Bit / 32] |= 1u << (Bit % 32);
+
+    for (Slot = XENVIF_MAC_MULTICAST_SLOT(Hash) & Table->Mask;
+         (Table->Entry[Slot].Byte[0] & 0x01) != 0;
+         Slot = (Slot + 1) & Table->Mask) {
+        if (RtlEqualMemory(&Table->Entry[Slot],
+                           Address,
+                           ETHERNET_ADDRESS_LENGTH))
+            return;
+    }
+
+    Table->Entry[Slot] = *Address;
+    Table->Count++;
+}
+
+static FORCEINLINE ULONG
+__MacMulticastTableCount(
+    IN  PXENVIF_MAC_MULTICAST_TABLE Table
+    )
+{
+    return (Table != NULL) ? Table->Count : 0;
+}
+
+static NTSTATUS
+MacMulticastTableCreate(
+    IN  PETHERNET_ADDRESS           Address,
+    IN  ULONG                       Count,
+    OUT PXENVIF_MAC_MULTICAST_TABLE *Table
+    )
+{
+    ULONG                           Size;
+    ULONG                           Index;
+    NTSTATUS                        status;
+
+    *Table = NULL;
+
+    if (Count == 0)
+        return STATUS_SUCCESS;
+
+    status = STATUS_INVALID_PARAMETER;
+    if (Count > (MAXULONG / 2) / sizeof (ETHERNET_ADDRESS))
+        goto fail1;
+
+    Size = 4;
+    while (Size < Count * 2)
+        Size <<= 1;
+
+    *Table = __MacAllocate(FIELD_OFFSET(XENVIF_MAC_MULTICAST_TABLE, Entry) +
+                           Size * sizeof (ETHERNET_ADDRESS));
+
+    status = STATUS_NO_MEMORY;
+    if (*Table == NULL)
+        goto fail2;
+
+    (*Table)->Mask = Size - 1;
+
+    for (Index = 0; Index < Count; Index++) {
+        ASSERT(Address[Index].Byte[0] & 0x01);
+        __MacMulticastTableInsert(*Table, &Address[Index]);
+    }
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+static VOID
+__MacMulticastTableRetire(
+    IN  PXENVIF_MAC                 Mac,
+    IN  PXENVIF_MAC_MULTICAST_TABLE Table
+    )
+{
+    KIRQL                           Irql;
+
+    if (Table == NULL)
+        return;
+
+    KeAcquireSpinLock(&Mac->Lock, &Irql);
+    InsertTailList(&Mac->MulticastRetireList, &Table->ListEntry);
+    Mac->MulticastRetired++;
+    KeReleaseSpinLock(&Mac->Lock, Irql);
+
+    ThreadWake(Mac->MulticastThread);
+}
+
+__drv_functionClass(KDEFERRED_ROUTINE)
+__drv_maxIRQL(DISPATCH_LEVEL)
+__drv_minIRQL(DISPATCH_LEVEL)
+__drv_requiresIRQL(DISPATCH_LEVEL)
+__drv_sameIRQL
+static VOID
+MacMulticastTableQuiesce(
+    IN  PKDPC   Dpc,
+    IN  PVOID   Context,
+    IN  PVOID   Argument1,
+    IN  PVOID   Argument2
+    )
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(Context);
+
+    (VOID) KeSignalCallDpcSynchronize(Argument2);
+    KeSignalCallDpcDone(Argument1);
+}
+
+static VOID
+MacMulticastTableReap(
+    IN  PXENVIF_MAC Mac
+    )
+{
+    LIST_ENTRY      List;
+    ULONG           Count;
+    KIRQL           Irql;
+
+    KeAcquireSpinLock(&Mac->Lock, &Irql);
+
+    if (IsListEmpty(&Mac->MulticastRetireList)) {
+        KeReleaseSpinLock(&Mac->Lock, Irql);
+        return;
+    }
+
+    // Take everything retired so far so that a burst of updates costs a
+    // single grace period
+    InitializeListHead(&List);
+    while (!IsListEmpty(&Mac->MulticastRetireList)) {
+        PLIST_ENTRY ListEntry;
+
+        ListEntry = RemoveHeadList(&Mac->MulticastRetireList);
+        InsertTailList(&List, ListEntry);
+    }
+
+    KeReleaseSpinLock(&Mac->Lock, Irql);
+
+    // Readers look at the table at DISPATCH_LEVEL, either from a DPC or
+    // from a thread that raised itself there (see the receiver), so
+    // flushing DPC queues is not enough. A DPC only runs on a processor
+    // once that processor has dropped below DISPATCH_LEVEL, so when one
+    // has run on every processor no reader can still be using a table
+    // that was unpublished before we started.
+    KeGenericCallDpc(MacMulticastTableQuiesce, NULL);
+
+    Count = 0;
+    while (!IsListEmpty(&List)) {
+        PLIST_ENTRY                 ListEntry;
+        PXENVIF_MAC_MULTICAST_TABLE Table;
+
+        ListEntry = RemoveHeadList(&List);
+        ASSERT3P(ListEntry, !=, &List);
+
+        Table = CONTAINING_RECORD(ListEntry,
+                                  XENVIF_MAC_MULTICAST_TABLE,
+                                  ListEntry);
+        __MacFree(Table);
+        Count++;
+    }
+
+    KeAcquireSpinLock(&Mac->Lock, &Irql);
+    ASSERT3U(Mac->MulticastRetired, >=, Count);
+    Mac->MulticastRetired -= Count;
+    KeReleaseSpinLock(&Mac->Lock, Irql);
+}
+
+static NTSTATUS
+MacMulticastRetire(
+    IN  PXENVIF_THREAD  Self,
+    IN  PVOID           Context
+    )
+{
+    PXENVIF_MAC         Mac = Context;
+    PKEVENT             Event;
+    BOOLEAN             Alerted;
+
+    Trace("====>\n");
+
+    Event = ThreadGetEvent(Self);
+
+    for (;;) {
+        (VOID) KeWaitForSingleObject(Event,
+                                     Executive,
+                                     KernelMode,
+                                     FALSE,
+                                     NULL);
+        KeClearEvent(Event);
+
+        // MacTeardown() retires the last table before it alerts, so
+        // sample the alert first to be sure the reap below includes it
+        Alerted = ThreadIsAlerted(Self);
+
+        MacMulticastTableReap(Mac);
+
+        if (Alerted)
+            break;
+    }
+
+    Trace("<====\n");
+
+    return STATUS_SUCCESS;
+}
+
 static FORCEINLINE NTSTATUS
 __MacSetPermanentAddress(
     IN  PXENVIF_MAC         Mac,
@@ -198,6 +501,13 @@ MacDebugCallback(
                  (Mac->FilterLevel[ETHERNET_ADDRESS_BROADCAST] == XENVIF_MAC_FILTER_ALL) ? "All" :
                  (Mac->FilterLevel[ETHERNET_ADDRESS_BROADCAST] == XENVIF_MAC_FILTER_MATCHING) ? "Matching" :
                  "None");
+
+    XENBUS_DEBUG(Printf,
+                 &Mac->DebugInterface,
+                 "MulticastCount = %u MulticastTable = %p MulticastRetired = %u\n",
+                 __MacMulticastTableCount(Mac->MulticastTable),
+                 Mac->MulticastTable,
+                 Mac->MulticastRetired);
 }
 
 NTSTATUS
@@ -215,7 +525,13 @@ MacInitialize(
         goto fail1;
 
     KeInitializeSpinLock(&(*Mac)->Lock);
-    InitializeListHead(&(*Mac)->MulticastList);
+    InitializeListHead(&(*Mac)->MulticastRetireList);
+
+    status = ThreadCreate(MacMulticastRetire,
+                          *Mac,
+                          &(*Mac)->MulticastThread);
+    if (!NT_SUCCESS(status))
+        goto fail2;
 
     FdoGetDebugInterface(PdoGetFdo(FrontendGetPdo(Frontend)),
                          &(*Mac)->DebugInterface);
@@ -227,6 +543,16 @@ MacInitialize(
 
     return STATUS_SUCCESS;
 
+fail2:
+    Error("fail2\n");
+
+    RtlZeroMemory(&(*Mac)->MulticastRetireList, sizeof (LIST_ENTRY));
+    RtlZeroMemory(&(*Mac)->Lock, sizeof (KSPIN_LOCK));
+
+    ASSERT(IsZeroMemory(*Mac, sizeof (XENVIF_MAC)));
+    __MacFree(*Mac);
+    *Mac = NULL;
+
 fail1:
     Error("fail1 (%08x)\n");
 
@@ -241,7 +567,7 @@ MacDumpAddressTable(
     PXENVIF_FRONTEND    Frontend;
     PETHERNET_ADDRESS   Address;
     ULONG               Count;
-    PLIST_ENTRY         ListEntry;
+    PXENVIF_MAC_MULTICAST_TABLE Table;
     ULONG               Index;
     KIRQL               Irql;
     NTSTATUS            status;
@@ -256,7 +582,8 @@ MacDumpAddressTable(
     if (!Mac->Connected)
         goto fail1;
 
-    Count = 1 + Mac->MulticastCount;
+    Table = Mac->MulticastTable;
+    Count = 1 + __MacMulticastTableCount(Table);
 
     Address = __MacAllocate(sizeof (ETHERNET_ADDRESS) *
                             Count);
@@ -270,16 +597,13 @@ MacDumpAddressTable(
     MacQueryCurrentAddress(Mac, &Address[Index]);
     Index++;
 
-    for (ListEntry = Mac->MulticastList.Flink;
-         ListEntry != &Mac->MulticastList;
-         ListEntry = ListEntry->Flink) {
-        PXENVIF_MAC_MULTICAST   Multicast;
-
-        Multicast = CONTAINING_RECORD(ListEntry,
-                                      XENVIF_MAC_MULTICAST,
-                                      ListEntry);
+    if (Table != NULL) {
+        ULONG   Slot;
 
-        Address[Index++] = Multicast->Address;
+        for (Slot = 0; Slot <= Table->Mask; Slot++) {
+            if (Table->Entry[Slot].Byte[0] & 0x01)
+                Address[Index++] = Table->Entry[Slot];
+        }
     }
 
     ASSERT3U(Index, ==, Count);
@@ -293,7 +617,7 @@ MacDumpAddressTable(
                         "mac");
 
     for (Index = 0; Index < Count; Index++) {
-        CHAR    Node[sizeof ("mac/XX")];
+        CHAR    Node[sizeof ("mac/XXXXXXXXXX")];
 
         status = RtlStringCbPrintfA(Node,
                                     sizeof (Node),
@@ -553,25 +877,19 @@ MacTeardown(
     IN  PXENVIF_MAC Mac
     )
 {
-    while (!IsListEmpty(&Mac->MulticastList)) {
-        PLIST_ENTRY             ListEntry;
-        PXENVIF_MAC_MULTICAST   Multicast;
+    PXENVIF_MAC_MULTICAST_TABLE Table;
 
-        ListEntry = RemoveHeadList(&Mac->MulticastList);
-        ASSERT3P(ListEntry, !=, &Mac->MulticastList);
+    Table = InterlockedExchangePointer((PVOID *)&Mac->MulticastTable, NULL);
+    __MacMulticastTableRetire(Mac, Table);
 
-        RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+    // The retire thread reaps anything outstanding before it exits
+    ThreadAlert(Mac->MulticastThread);
+    ThreadJoin(Mac->MulticastThread);
+    Mac->MulticastThread = NULL;
 
-        Multicast = CONTAINING_RECORD(ListEntry,
-                                      XENVIF_MAC_MULTICAST,
-                                      ListEntry);
-        __MacFree(Multicast);
-
-        --Mac->MulticastCount;
-    }
-    ASSERT3U(Mac->MulticastCount, ==, 0);
-
-    RtlZeroMemory(&Mac->MulticastList, sizeof (LIST_ENTRY));
+    ASSERT3U(Mac->MulticastRetired, ==, 0);
+    ASSERT(IsListEmpty(&Mac->MulticastRetireList));
+    RtlZeroMemory(&Mac->MulticastRetireList, sizeof (LIST_ENTRY));
 
     RtlZeroMemory(&Mac->FilterLevel,
                   ETHERNET_ADDRESS_TYPE_COUNT * sizeof (XENVIF_MAC_FILTER_LEVEL));
@@ -688,111 +1006,97 @@ MacQueryMaximumFrameSize(
 }
 
 NTSTATUS
-MacAddMulticastAddress(
+MacSetMulticastAddresses(
     IN      PXENVIF_MAC         Mac,
-    IN      PETHERNET_ADDRESS   Address
+    IN      PETHERNET_ADDRESS   Address,
+    IN      ULONG               Count
     )
 {
     PXENVIF_FRONTEND            Frontend;
-    PXENVIF_MAC_MULTICAST       Multicast;
+    PXENVIF_TRANSMITTER         Transmitter;
+    PXENVIF_MAC_MULTICAST_TABLE New;
+    PXENVIF_MAC_MULTICAST_TABLE Old;
+    ULONG                       Slot;
     KIRQL                       Irql;
     NTSTATUS                    status;
 
     Frontend = Mac->Frontend;
+    Transmitter = FrontendGetTransmitter(Frontend);
 
-    ASSERT(Address->Byte[0] & 0x01);
-
-    Multicast = __MacAllocate(sizeof (XENVIF_MAC_MULTICAST));
-
-    status = STATUS_NO_MEMORY;
-    if (Multicast == NULL)
+    status = MacMulticastTableCreate(Address, Count, &New);
+    if (!NT_SUCCESS(status))
         goto fail1;
 
-    Multicast->Address = *Address;
+    // Stay at DISPATCH_LEVEL until the old table has been handed to the
+    // retire thread. Any table published in the meantime cannot then be
+    // freed underneath us, even if another update replaces it.
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
 
-    KeAcquireSpinLock(&Mac->Lock, &Irql);
-    InsertTailList(&Mac->MulticastList, &Multicast->ListEntry);
-    Mac->MulticastCount++;
-    KeReleaseSpinLock(&Mac->Lock, Irql);
+    KeAcquireSpinLockAtDpcLevel(&Mac->Lock);
+    Old = InterlockedExchangePointer((PVOID *)&Mac->MulticastTable, New);
+    KeReleaseSpinLockFromDpcLevel(&Mac->Lock);
 
-    (VOID) MacDumpAddressTable(Mac);
+    if (New != NULL) {
+        for (Slot = 0; Slot <= New->Mask; Slot++) {
+            PETHERNET_ADDRESS   Entry = &New->Entry[Slot];
 
-    Trace("%s: %02X:%02X:%02X:%02X:%02X:%02X\n",
-          FrontendGetPrefix(Frontend),
-          Address->Byte[0],
-          Address->Byte[1],
-          Address->Byte[2],
-          Address->Byte[3],
-          Address->Byte[4],
-          Address->Byte[5]);
+            if (!(Entry->Byte[0] & 0x01))
+                continue;
 
-    return STATUS_SUCCESS;
+            if (__MacMulticastTableLookup(Old, Entry))
+                continue;
 
-fail1:
-    Error("fail1 (%08x)\n", status);
+            (VOID) TransmitterQueueMulticastControl(Transmitter,
+                                                    Entry,
+                                                    TRUE);
 
-    return status;
-}
+            Trace("%s: ADD %02X:%02X:%02X:%02X:%02X:%02X\n",
+                  FrontendGetPrefix(Frontend),
+                  Entry->Byte[0],
+                  Entry->Byte[1],
+                  Entry->Byte[2],
+                  Entry->Byte[3],
+                  Entry->Byte[4],
+                  Entry->Byte[5]);
+        }
+    }
 
-NTSTATUS
-MacRemoveMulticastAddress(
-    IN      PXENVIF_MAC         Mac,
-    IN      PETHERNET_ADDRESS   Address
-    )
-{
-    PXENVIF_FRONTEND            Frontend;
-    PLIST_ENTRY                 ListEntry;
-    PXENVIF_MAC_MULTICAST       Multicast;
-    KIRQL                       Irql;
-    NTSTATUS                    status;
+    if (Old != NULL) {
+        for (Slot = 0; Slot <= Old->Mask; Slot++) {
+            PETHERNET_ADDRESS   Entry = &Old->Entry[Slot];
 
-    Frontend = Mac->Frontend;
+            if (!(Entry->Byte[0] & 0x01))
+                continue;
 
-    KeAcquireSpinLock(&Mac->Lock, &Irql);
+            if (__MacMulticastTableLookup(New, Entry))
+                continue;
 
-    for (ListEntry = Mac->MulticastList.Flink;
-         ListEntry != &Mac->MulticastList;
-         ListEntry = ListEntry->Flink) {
-        Multicast = CONTAINING_RECORD(ListEntry,
-                                      XENVIF_MAC_MULTICAST,
-                                      ListEntry);
+            (VOID) TransmitterQueueMulticastControl(Transmitter,
+                                                    Entry,
+                                                    FALSE);
 
-        if (RtlEqualMemory(&Multicast->Address,
-                           Address,
-                           ETHERNET_ADDRESS_LENGTH))
-            goto found;
+            Trace("%s: REMOVE %02X:%02X:%02X:%02X:%02X:%02X\n",
+                  FrontendGetPrefix(Frontend),
+                  Entry->Byte[0],
+                  Entry->Byte[1],
+                  Entry->Byte[2],
+                  Entry->Byte[3],
+                  Entry->Byte[4],
+                  Entry->Byte[5]);
+        }
     }
 
-    status = STATUS_OBJECT_NAME_NOT_FOUND;
-    goto fail1;
-
-found:
-    ASSERT(Mac->MulticastCount != 0);
-    --Mac->MulticastCount;
+    __MacMulticastTableRetire(Mac, Old);
 
-    RemoveEntryList(&Multicast->ListEntry);
-    __MacFree(Multicast);
-
-    KeReleaseSpinLock(&Mac->Lock, Irql);
+    KeLowerIrql(Irql);
 
     (VOID) MacDumpAddressTable(Mac);
 
-    Trace("%s: %02X:%02X:%02X:%02X:%02X:%02X\n",
-          FrontendGetPrefix(Frontend),
-          Address->Byte[0],
-          Address->Byte[1],
-          Address->Byte[2],
-          Address->Byte[3],
-          Address->Byte[4],
-          Address->Byte[5]);
-
     return STATUS_SUCCESS;
 
 fail1:
     Error("fail1 (%08x)\n", status);
 
-    KeReleaseSpinLock(&Mac->Lock, Irql);
-
     return status;
 }
 
@@ -803,36 +1107,34 @@ MacQueryMulticastAddresses(
     IN OUT  PULONG              Count
     )
 {
-    PLIST_ENTRY                 ListEntry;
+    PXENVIF_MAC_MULTICAST_TABLE Table;
+    ULONG                       Slot;
     KIRQL                       Irql;
     NTSTATUS                    status;
 
     KeAcquireSpinLock(&Mac->Lock, &Irql);
 
+    Table = Mac->MulticastTable;
+
     status = STATUS_BUFFER_OVERFLOW;
-    if (Address == NULL || *Count < Mac->MulticastCount)
+    if (Address == NULL || *Count < __MacMulticastTableCount(Table))
         goto fail1;
 
     *Count = 0;
-    for (ListEntry = Mac->MulticastList.Flink;
-         ListEntry != &Mac->MulticastList;
-         ListEntry = ListEntry->Flink) {
-        PXENVIF_MAC_MULTICAST   Multicast;
-
-        Multicast = CONTAINING_RECORD(ListEntry,
-                                      XENVIF_MAC_MULTICAST,
-                                      ListEntry);
-
-        Address[(*Count)++] = Multicast->Address;
+    if (Table != NULL) {
+        for (Slot = 0; Slot <= Table->Mask; Slot++) {
+            if (Table->Entry[Slot].Byte[0] & 0x01)
+                Address[(*Count)++] = Table->Entry[Slot];
+        }
     }
-    ASSERT3U(*Count, ==, Mac->MulticastCount);
+    ASSERT3U(*Count, ==, __MacMulticastTableCount(Table));
 
     KeReleaseSpinLock(&Mac->Lock, Irql);
 
     return STATUS_SUCCESS;
 
 fail1:
-    *Count = Mac->MulticastCount;
+    *Count = __MacMulticastTableCount(Table);
 
     KeReleaseSpinLock(&Mac->Lock, Irql);
 
@@ -919,8 +1221,10 @@ MacApplyFilters(
     Type = GET_ETHERNET_ADDRESS_TYPE(DestinationAddress);
     Allow = FALSE;
 
+    // This is called for every received packet so no lock is taken.
+    // The filter levels are single words and the multicast table is
+    // immutable once published (see MacSetMulticastAddresses()).
     ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
-    KeAcquireSpinLockAtDpcLevel(&Mac->Lock);
 
     switch (Type) {
     case ETHERNET_ADDRESS_UNICAST:
@@ -952,9 +1256,9 @@ MacApplyFilters(
             break;
 
         case XENVIF_MAC_FILTER_MATCHING: {
-            PXENVIF_FRONTEND    Frontend;
-            PXENVIF_TRANSMITTER Transmitter;
-            PLIST_ENTRY         ListEntry;
+            PXENVIF_FRONTEND            Frontend;
+            PXENVIF_TRANSMITTER         Transmitter;
+            PXENVIF_MAC_MULTICAST_TABLE Table;
 
             Frontend = Mac->Frontend;
             Transmitter = FrontendGetTransmitter(Frontend);
@@ -964,22 +1268,10 @@ MacApplyFilters(
                 break;
             }
 
-            for (ListEntry = Mac->MulticastList.Flink;
-                 ListEntry != &Mac->MulticastList;
-                 ListEntry = ListEntry->Flink) {
-                PXENVIF_MAC_MULTICAST   Multicast;
-
-                Multicast = CONTAINING_RECORD(ListEntry,
-                                              XENVIF_MAC_MULTICAST,
-                                              ListEntry);
-
-                if (RtlEqualMemory(&Multicast->Address,
-                                   DestinationAddress,
-                                   ETHERNET_ADDRESS_LENGTH)) {
-                    Allow = TRUE;
-                    break;
-                }
-            }
+            Table = Mac->MulticastTable;
+            KeMemoryBarrier();
+
+            Allow = __MacMulticastTableLookup(Table, DestinationAddress);
 
             break;
         }
@@ -1014,7 +1306,5 @@ MacApplyFilters(
         break;
     }
 
-    KeReleaseSpinLockFromDpcLevel(&Mac->Lock);
-
     return Allow;
 }
@@ -96,15 +96,10 @@ MacQueryBroadcastAddress(
     );
 
 extern NTSTATUS
-MacAddMulticastAddress(
+MacSetMulticastAddresses(
     IN      PXENVIF_MAC         Mac,
-    OUT     PETHERNET_ADDRESS   Address
-    );
-
-extern NTSTATUS
-MacRemoveMulticastAddress(
-    IN      PXENVIF_MAC         Mac,
-    OUT     PETHERNET_ADDRESS   Address
+    IN      PETHERNET_ADDRESS   Address,
+    IN      ULONG               Count
     );
 
 extern NTSTATUS
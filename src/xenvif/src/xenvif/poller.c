@@ -330,6 +330,14 @@ PollerChannelConnect(
                          ProcNumber.Group,
                          ProcNumber.Number);
 
+    // Bulk receive traffic should not delay latency sensitive channels
+    if (Channel->Type == XENVIF_POLLER_CHANNEL_RECEIVER &&
+        Poller->EvtchnInterface.Interface.Version >= 9)
+        (VOID) XENBUS_EVTCHN(SetPriority,
+                             &Poller->EvtchnInterface,
+                             Channel->Channel,
+                             XENBUS_EVTCHN_PRIORITY_LOW);
+
     (VOID) XENBUS_EVTCHN(Unmask,
                          &Poller->EvtchnInterface,
                          Channel->Channel,
@@ -75,12 +75,20 @@ typedef struct _XENVIF_RECEIVER_HASH {
 
 #define XENVIF_RECEIVER_MAXIMUM_FRAGMENT_ID (XENVIF_RECEIVER_RING_SIZE - 1)
 
+// Protocol headers are normally parsed into a small pool buffer, rather
+// than a page of their own, leaving the payload where the backend put it.
+// Anything that does not fit falls back to a full page. This is not NDIS
+// header-data split, which Windows 8 (NDIS 6.30) and later no longer support,
+// so the split is invisible above XENVIF.
+#define XENVIF_RECEIVER_HEADER_SIZE 256
+
 typedef struct _XENVIF_RECEIVER_RING {
     PXENVIF_RECEIVER            Receiver;
     ULONG                       Index;
     PCHAR                       Path;
     KSPIN_LOCK                  Lock;
     PXENBUS_CACHE               PacketCache;
+    PXENBUS_CACHE               HeaderCache;
     PXENBUS_CACHE               FragmentCache;
     PXENBUS_GNTTAB_CACHE        GnttabCache;
     PMDL                        Mdl;
@@ -91,6 +99,8 @@ typedef struct _XENVIF_RECEIVER_RING {
     ULONG                       RequestsPosted;
     ULONG                       RequestsPushed;
     ULONG                       ResponsesProcessed;
+    ULONG                       HeadersSplit;
+    ULONG                       HeadersPulledUp;
     BOOLEAN                     Connected;
     BOOLEAN                     Enabled;
     BOOLEAN                     Stopped;
@@ -115,6 +125,7 @@ typedef struct _XENVIF_RECEIVER_PACKET {
     MDL                             Mdl;
     PFN_NUMBER                      __Pfn;
     PMDL                            SystemMdl;
+    BOOLEAN                         Header;
 } XENVIF_RECEIVER_PACKET, *PXENVIF_RECEIVER_PACKET;
 
 struct _XENVIF_RECEIVER {
@@ -131,6 +142,7 @@ struct _XENVIF_RECEIVER {
     ULONG                           DisableIpVersion6Gso;
     ULONG                           IpAlignOffset;
     ULONG                           AlwaysPullup;
+    ULONG                           SplitHeaders;
     XENBUS_STORE_INTERFACE          StoreInterface;
     XENBUS_DEBUG_INTERFACE          DebugInterface;
     PXENBUS_DEBUG_CALLBACK          DebugCallback;
@@ -185,6 +197,9 @@ ReceiverPacketCtor(
 
 #pragma warning(pop)
 
+    Packet->Mdl.StartVa = Mdl->StartVa;
+    Packet->Mdl.ByteOffset = Mdl->ByteOffset;
+
     ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
     Packet->Mdl.MappedSystemVa = Mdl->MappedSystemVa;
 
@@ -225,6 +240,107 @@ ReceiverPacketDtor(
     ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
 }
 
+static NTSTATUS
+ReceiverHeaderCtor(
+    IN  PVOID               Argument,
+    IN  PVOID               Object
+    )
+{
+    PXENVIF_RECEIVER_RING   Ring = Argument;
+    PXENVIF_RECEIVER_PACKET Packet = Object;
+    PUCHAR                  Buffer;
+    PMDL                    Mdl;
+    NTSTATUS                status;
+
+    ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
+
+    Buffer = __ReceiverAllocate(XENVIF_RECEIVER_HEADER_SIZE);
+
+    status = STATUS_NO_MEMORY;
+    if (Buffer == NULL)
+        goto fail1;
+
+    // Allocations smaller than a page never cross a page boundary
+    ASSERT3U(BYTE_OFFSET(Buffer) + XENVIF_RECEIVER_HEADER_SIZE, <=, PAGE_SIZE);
+
+    Mdl = IoAllocateMdl(Buffer,
+                        XENVIF_RECEIVER_HEADER_SIZE,
+                        FALSE,
+                        FALSE,
+                        NULL);
+    if (Mdl == NULL)
+        goto fail2;
+
+    MmBuildMdlForNonPagedPool(Mdl);
+
+    ASSERT3U(Mdl->ByteCount, ==, XENVIF_RECEIVER_HEADER_SIZE);
+
+    Packet->SystemMdl = Mdl;
+    Packet->Header = TRUE;
+
+#pragma warning(push)
+#pragma warning(disable:28145) // modifying struct MDL
+
+    Packet->Mdl.Size = sizeof (MDL) + sizeof (PFN_NUMBER);
+    Packet->Mdl.MdlFlags = Mdl->MdlFlags;
+
+#pragma warning(pop)
+
+    Packet->Mdl.StartVa = Mdl->StartVa;
+    Packet->Mdl.ByteOffset = Mdl->ByteOffset;
+
+    ASSERT(Mdl->MdlFlags & MDL_SOURCE_IS_NONPAGED_POOL);
+    Packet->Mdl.MappedSystemVa = Mdl->MappedSystemVa;
+
+    Packet->__Pfn = MmGetMdlPfnArray(Mdl)[0];
+
+    Packet->Ring = Ring;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+    __ReceiverFree(Buffer);
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
+
+    return status;
+}
+
+static VOID
+ReceiverHeaderDtor(
+    IN  PVOID               Argument,
+    IN  PVOID               Object
+    )
+{
+    PXENVIF_RECEIVER_RING   Ring = Argument;
+    PXENVIF_RECEIVER_PACKET Packet = Object;
+    PMDL                    Mdl;
+    PUCHAR                  Buffer;
+
+    ASSERT3P(Packet->Ring, ==, Ring);
+    Packet->Ring = NULL;
+
+    ASSERT(Packet->Header);
+    Packet->Header = FALSE;
+
+    Mdl = Packet->SystemMdl;
+    Packet->SystemMdl = NULL;
+
+    Buffer = MmGetMdlVirtualAddress(Mdl);
+
+    IoFreeMdl(Mdl);
+    __ReceiverFree(Buffer);
+
+    RtlZeroMemory(&Packet->Mdl, sizeof (MDL) + sizeof (PFN_NUMBER));
+
+    ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
+}
+
 static FORCEINLINE PXENVIF_RECEIVER_PACKET
 __ReceiverRingGetPacket(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -249,6 +365,30 @@ __ReceiverRingGetPacket(
     return Packet;
 }
 
+static FORCEINLINE PXENVIF_RECEIVER_PACKET
+__ReceiverRingGetHeader(
+    IN  PXENVIF_RECEIVER_RING   Ring
+    )
+{
+    PXENVIF_RECEIVER            Receiver;
+    PXENVIF_RECEIVER_PACKET     Packet;
+
+    Receiver = Ring->Receiver;
+
+    Packet = XENBUS_CACHE(Get,
+                          &Receiver->CacheInterface,
+                          Ring->HeaderCache,
+                          TRUE);
+    if (Packet == NULL)
+        return NULL;
+
+    ASSERT(IsZeroMemory(&Packet->Info, sizeof (XENVIF_PACKET_INFO)));
+    ASSERT3P(Packet->Ring, ==, Ring);
+    ASSERT(Packet->Header);
+
+    return Packet;
+}
+
 static FORCEINLINE VOID
 __ReceiverRingPutPacket(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -285,12 +425,15 @@ __ReceiverRingPutPacket(
 
 #pragma warning(pop)
 
-    ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    Packet->Mdl.StartVa = Mdl->StartVa;
+    Packet->Mdl.ByteOffset = Mdl->ByteOffset;
+
+    ASSERT(Mdl->MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
     Packet->Mdl.MappedSystemVa = Mdl->MappedSystemVa;
 
     XENBUS_CACHE(Put,
                  &Receiver->CacheInterface,
-                 Ring->PacketCache,
+                 (Packet->Header) ? Ring->HeaderCache : Ring->PacketCache,
                  Packet,
                  Locked);
 }
@@ -405,7 +548,7 @@ ReceiverRingProcessTag(
 
     PayloadLength = Packet->Length - Info->Length;
 
-    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
     BaseVa = Packet->Mdl.MappedSystemVa;
     ASSERT(BaseVa != NULL);
 
@@ -496,7 +639,7 @@ ReceiverRingProcessChecksum(
     if (Info->IpHeader.Length == 0)
         return;
 
-    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
     BaseVa = Packet->Mdl.MappedSystemVa;
     ASSERT(BaseVa != NULL);
 
@@ -689,6 +832,115 @@ fail1:
     return FALSE;
 }
 
+typedef struct _XENVIF_RECEIVER_PEEK_CONTEXT {
+    PUCHAR  EndVa;
+    BOOLEAN Overflow;
+} XENVIF_RECEIVER_PEEK_CONTEXT, *PXENVIF_RECEIVER_PEEK_CONTEXT;
+
+static BOOLEAN
+ReceiverRingPeek(
+    IN      PVOID                   Argument,
+    IN      PUCHAR                  DestinationVa,
+    IN OUT  PXENVIF_PACKET_PAYLOAD  Payload,
+    IN      ULONG                   Length
+    )
+{
+    PXENVIF_RECEIVER_PEEK_CONTEXT   Context = Argument;
+    PMDL                            Mdl;
+    ULONG                           Offset;
+
+    // Unlike ReceiverRingPullup() this leaves the MDL chain untouched;
+    // only the payload cursor moves.
+    Mdl = Payload->Mdl;
+    Offset = Payload->Offset;
+
+    if (Payload->Length < Length)
+        goto fail1;
+
+    if (DestinationVa + Length > Context->EndVa) {
+        Context->Overflow = TRUE;
+        goto fail2;
+    }
+
+    Payload->Length -= Length;
+
+    while (Length != 0) {
+        PUCHAR  SourceVa;
+        ULONG   MdlByteCount;
+        ULONG   CopyLength;
+
+        ASSERT(Mdl != NULL);
+
+        ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+        SourceVa = Mdl->MappedSystemVa;
+        ASSERT(SourceVa != NULL);
+
+        SourceVa += Offset;
+
+        MdlByteCount = Mdl->ByteCount - Offset;
+
+        CopyLength = __min(MdlByteCount, Length);
+
+        RtlCopyMemory(DestinationVa, SourceVa, CopyLength);
+        DestinationVa += CopyLength;
+
+        Offset += CopyLength;
+        Length -= CopyLength;
+
+        MdlByteCount -= CopyLength;
+        if (MdlByteCount == 0) {
+            Mdl = Mdl->Next;
+            Offset = 0;
+        }
+    }
+
+    Payload->Mdl = Mdl;
+    Payload->Offset = Offset;
+
+    return TRUE;
+
+fail2:
+fail1:
+    return FALSE;
+}
+
+static FORCEINLINE VOID
+__ReceiverRingTrimPayload(
+    IN      PXENVIF_RECEIVER_RING   Ring,
+    IN      PMDL                    Mdl,
+    IN OUT  PXENVIF_PACKET_PAYLOAD  Payload
+    )
+{
+    // Release any fragments that ReceiverRingPeek() consumed completely
+    while (Mdl != NULL &&
+           (Mdl != Payload->Mdl || Payload->Length == 0)) {
+        PMDL    Next;
+
+        Next = Mdl->Next;
+        Mdl->Next = NULL;
+
+        __ReceiverRingPutMdl(Ring, Mdl, TRUE);
+
+        Mdl = Next;
+    }
+
+    if (Payload->Length == 0) {
+        Payload->Mdl = NULL;
+        Payload->Offset = 0;
+        return;
+    }
+
+    ASSERT3P(Mdl, ==, Payload->Mdl);
+    ASSERT3U(Payload->Offset, <=, Mdl->ByteCount);
+
+    // Skip the headers in place; the data itself is not moved
+    Mdl->ByteOffset += Payload->Offset;
+    Mdl->MappedSystemVa = (PUCHAR)Mdl->MappedSystemVa + Payload->Offset;
+    Mdl->ByteCount -= Payload->Offset;
+
+    Payload->Offset = 0;
+}
+
 static FORCEINLINE VOID
 __ReceiverRingPullupPacket(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -699,7 +951,7 @@ __ReceiverRingPullupPacket(
     XENVIF_PACKET_PAYLOAD       Payload;
     ULONG                       Length;
 
-    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
     BaseVa = Packet->Mdl.MappedSystemVa;
     ASSERT(BaseVa != NULL);
 
@@ -707,7 +959,8 @@ __ReceiverRingPullupPacket(
     Payload.Offset = 0;
     Payload.Length = Packet->Length - Packet->Mdl.ByteCount;
 
-    Length = __min(Payload.Length, PAGE_SIZE - Packet->Mdl.ByteCount);
+    Length = __min(Payload.Length,
+                   Packet->SystemMdl->ByteCount - Packet->Mdl.ByteCount);
 
     Packet->Mdl.Next = NULL;
 
@@ -743,7 +996,7 @@ __ReceiverRingBuildSegment(
 
     Info = &Packet->Info;
 
-    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
     InfoVa = Packet->Mdl.MappedSystemVa;
     ASSERT(InfoVa != NULL);
 
@@ -938,7 +1191,7 @@ ReceiverRingProcessLargePacket(
 
     Packet->Mdl.Next = NULL;
 
-    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
     InfoVa = Packet->Mdl.MappedSystemVa;
     ASSERT(InfoVa != NULL);
 
@@ -1186,6 +1439,81 @@ fail1:
                                1);
 }
 
+static FORCEINLINE PXENVIF_RECEIVER_PACKET
+__ReceiverRingSplitHeader(
+    IN      PXENVIF_RECEIVER_RING   Ring,
+    IN      PXENVIF_RECEIVER_PACKET Packet,
+    IN OUT  PXENVIF_PACKET_PAYLOAD  Payload
+    )
+{
+    PXENVIF_RECEIVER                Receiver;
+    PXENVIF_RECEIVER_PACKET         Header;
+    XENVIF_RECEIVER_PEEK_CONTEXT    Context;
+    XENVIF_PACKET_PAYLOAD           Peek;
+    PXENVIF_PACKET_INFO             Info;
+    PUCHAR                          BaseVa;
+    NTSTATUS                        status;
+
+    Receiver = Ring->Receiver;
+
+    // Packets that are going to be pulled up in full need a whole page
+    if (Receiver->AlwaysPullup != 0 ||
+        Receiver->IpAlignOffset >= XENVIF_RECEIVER_HEADER_SIZE)
+        goto fail1;
+
+    Header = __ReceiverRingGetHeader(Ring);
+    if (Header == NULL)
+        goto fail2;
+
+    RtlCopyMemory(Header,
+                  Packet,
+                  FIELD_OFFSET(XENVIF_RECEIVER_PACKET, Mdl));
+
+    Header->Offset = Receiver->IpAlignOffset;
+
+    ASSERT(Header->Mdl.MdlFlags & MDL_SOURCE_IS_NONPAGED_POOL);
+    BaseVa = Header->Mdl.MappedSystemVa;
+    ASSERT(BaseVa != NULL);
+
+    Context.EndVa = BaseVa + Header->SystemMdl->ByteCount;
+    Context.Overflow = FALSE;
+
+    BaseVa += Header->Offset;
+
+    Header->Mdl.ByteCount = Header->Offset;
+
+    Info = &Header->Info;
+
+    Peek = *Payload;
+
+    status = ParsePacket(BaseVa, ReceiverRingPeek, &Context, &Peek, Info);
+    if (!NT_SUCCESS(status))
+        goto fail3;
+
+    // See ReceiverRingProcessStandardPacket()
+    if (Info->LLCSnapHeader.Length != 0)
+        goto fail4;
+
+    ASSERT3U(Header->Length, ==, Info->Length + Peek.Length);
+
+    Header->Mdl.ByteCount += Info->Length;
+
+    __ReceiverRingTrimPayload(Ring, Payload->Mdl, &Peek);
+    *Payload = Peek;
+
+    return Header;
+
+fail4:
+fail3:
+    // Nothing has been consumed from the payload so the caller can
+    // simply fall back to parsing into a full page.
+    __ReceiverRingPutPacket(Ring, Header, TRUE);
+
+fail2:
+fail1:
+    return NULL;
+}
+
 static VOID
 ReceiverRingProcessPacket(
     IN  PXENVIF_RECEIVER_RING       Ring,
@@ -1217,49 +1545,69 @@ ReceiverRingProcessPacket(
     Payload.Offset = 0;
     Payload.Length = Length;
 
-    // Get a new packet structure that will just contain the header after
-    // parsing. We need to preserve metadata from the original.
+    New = NULL;
+    if (Receiver->SplitHeaders != 0)
+        New = __ReceiverRingSplitHeader(Ring, Packet, &Payload);
 
-    New = __ReceiverRingGetPacket(Ring, TRUE);
+    if (New != NULL) {
+        Packet = New;
 
-    status = STATUS_NO_MEMORY;
-    if (New == NULL) {
-        FrontendIncrementStatistic(Frontend,
-            XENVIF_RECEIVER_FRONTEND_ERRORS,
-            1);
-        goto fail1;
-    }
+        Ring->HeadersSplit++;
+    } else {
+        // Get a new packet structure that will just contain the header after
+        // parsing. We need to preserve metadata from the original.
 
-    RtlCopyMemory(New,
-                  Packet,
-                  FIELD_OFFSET(XENVIF_RECEIVER_PACKET, Mdl));
+        New = __ReceiverRingGetPacket(Ring, TRUE);
+
+        status = STATUS_NO_MEMORY;
+        if (New == NULL) {
+            FrontendIncrementStatistic(Frontend,
+                XENVIF_RECEIVER_FRONTEND_ERRORS,
+                1);
+            goto fail1;
+        }
 
-    Packet = New;
+        RtlCopyMemory(New,
+                      Packet,
+                      FIELD_OFFSET(XENVIF_RECEIVER_PACKET, Mdl));
 
-    // Override offset to align
-    Packet->Offset = Receiver->IpAlignOffset;
+        Packet = New;
 
-    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
-    BaseVa = Packet->Mdl.MappedSystemVa;
-    ASSERT(BaseVa != NULL);
+        // Override offset to align
+        Packet->Offset = Receiver->IpAlignOffset;
 
-    BaseVa += Packet->Offset;
+        ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+        BaseVa = Packet->Mdl.MappedSystemVa;
+        ASSERT(BaseVa != NULL);
 
-    Packet->Mdl.ByteCount = Packet->Offset;
+        BaseVa += Packet->Offset;
 
-    Info = &Packet->Info;
+        Packet->Mdl.ByteCount = Packet->Offset;
 
-    status = ParsePacket(BaseVa, ReceiverRingPullup, Ring, &Payload, Info);
-    if (!NT_SUCCESS(status)) {
-        FrontendIncrementStatistic(Frontend,
-                                   XENVIF_RECEIVER_FRONTEND_ERRORS,
-                                   1);
-        goto fail2;
+        Info = &Packet->Info;
+
+        status = ParsePacket(BaseVa, ReceiverRingPullup, Ring, &Payload, Info);
+        if (!NT_SUCCESS(status)) {
+            FrontendIncrementStatistic(Frontend,
+                                       XENVIF_RECEIVER_FRONTEND_ERRORS,
+                                       1);
+            goto fail2;
+        }
+
+        Packet->Mdl.ByteCount += Info->Length;
+
+        Ring->HeadersPulledUp++;
     }
 
-    ASSERT3U(Packet->Length, ==, Info->Length + Payload.Length);
+    Info = &Packet->Info;
+
+    ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
+    BaseVa = Packet->Mdl.MappedSystemVa;
+    ASSERT(BaseVa != NULL);
+
+    BaseVa += Packet->Offset;
 
-    Packet->Mdl.ByteCount += Info->Length;
+    ASSERT3U(Packet->Length, ==, Info->Length + Payload.Length);
 
     if (Payload.Length != 0) {
         ASSERT(Payload.Mdl != NULL);
@@ -1421,7 +1769,7 @@ __ReceiverRingReleaseLock(
                                    XENVIF_RECEIVER_PACKET,
                                    ListEntry);
 
-        ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+        ASSERT(Packet->Mdl.MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL));
         BaseVa = Packet->Mdl.MappedSystemVa;
         ASSERT(BaseVa != NULL);
 
@@ -1891,6 +2239,12 @@ ReceiverRingDebugCallback(
                  Ring->RequestsPosted,
                  Ring->RequestsPushed,
                  Ring->ResponsesProcessed);
+
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "HeadersSplit = %u HeadersPulledUp = %u\n",
+                 Ring->HeadersSplit,
+                 Ring->HeadersPulledUp);
 }
 
 static DECLSPEC_NOINLINE BOOLEAN
@@ -2296,7 +2650,7 @@ __ReceiverRingInitialize(
 
     status = RtlStringCbPrintfA(Name,
                                 sizeof (Name),
-                                "%s_receiver_fragment",
+                                "%s_receiver_header",
                                 (*Ring)->Path);
     if (!NT_SUCCESS(status))
         goto fail5;
@@ -2305,6 +2659,31 @@ __ReceiverRingInitialize(
         if (Name[Index] == '/')
             Name[Index] = '_';
 
+    status = XENBUS_CACHE(Create,
+                          &Receiver->CacheInterface,
+                          Name,
+                          sizeof (XENVIF_RECEIVER_PACKET),
+                          0,
+                          ReceiverHeaderCtor,
+                          ReceiverHeaderDtor,
+                          ReceiverRingAcquireLock,
+                          ReceiverRingReleaseLock,
+                          *Ring,
+                          &(*Ring)->HeaderCache);
+    if (!NT_SUCCESS(status))
+        goto fail6;
+
+    status = RtlStringCbPrintfA(Name,
+                                sizeof (Name),
+                                "%s_receiver_fragment",
+                                (*Ring)->Path);
+    if (!NT_SUCCESS(status))
+        goto fail7;
+
+    for (Index = 0; Name[Index] != '\0'; Index++)
+        if (Name[Index] == '/')
+            Name[Index] = '_';
+
     status = XENBUS_CACHE(Create,
                           &Receiver->CacheInterface,
                           Name,
@@ -2317,24 +2696,35 @@ __ReceiverRingInitialize(
                           *Ring,
                           &(*Ring)->FragmentCache);
     if (!NT_SUCCESS(status))
-        goto fail6;
+        goto fail8;
 
     status = ThreadCreate(ReceiverRingWatchdog,
                           *Ring,
                           &(*Ring)->WatchdogThread);
     if (!NT_SUCCESS(status))
-        goto fail7;
+        goto fail9;
 
     return STATUS_SUCCESS;
 
-fail7:
-    Error("fail7\n");
+fail9:
+    Error("fail9\n");
 
     XENBUS_CACHE(Destroy,
                  &Receiver->CacheInterface,
                  (*Ring)->FragmentCache);
     (*Ring)->FragmentCache = NULL;
 
+fail8:
+    Error("fail8\n");
+
+fail7:
+    Error("fail7\n");
+
+    XENBUS_CACHE(Destroy,
+                 &Receiver->CacheInterface,
+                 (*Ring)->HeaderCache);
+    (*Ring)->HeaderCache = NULL;
+
 fail6:
     Error("fail6\n");
 
@@ -2637,6 +3027,9 @@ __ReceiverRingDisconnect(
     Ring->RequestsPushed = 0;
     Ring->RequestsPosted = 0;
 
+    Ring->HeadersSplit = 0;
+    Ring->HeadersPulledUp = 0;
+
     XENBUS_DEBUG(Deregister,
                  &Receiver->DebugInterface,
                  Ring->DebugCallback);
@@ -2687,6 +3080,11 @@ __ReceiverRingTeardown(
                  Ring->FragmentCache);
     Ring->FragmentCache = NULL;
 
+    XENBUS_CACHE(Destroy,
+                 &Receiver->CacheInterface,
+                 Ring->HeaderCache);
+    Ring->HeaderCache = NULL;
+
     XENBUS_CACHE(Destroy,
                  &Receiver->CacheInterface,
                  Ring->PacketCache);
@@ -2783,6 +3181,7 @@ ReceiverInitialize(
     (*Receiver)->DisableIpVersion6Gso = 0;
     (*Receiver)->IpAlignOffset = 0;
     (*Receiver)->AlwaysPullup = 0;
+    (*Receiver)->SplitHeaders = 1;
 
     if (ParametersKey != NULL) {
         ULONG   ReceiverCalculateChecksums;
@@ -2791,6 +3190,7 @@ ReceiverInitialize(
         ULONG   ReceiverDisableIpVersion6Gso;
         ULONG   ReceiverIpAlignOffset;
         ULONG   ReceiverAlwaysPullup;
+        ULONG   ReceiverSplitHeaders;
 
         status = RegistryQueryDwordValue(ParametersKey,
                                          "ReceiverCalculateChecksums",
@@ -2827,6 +3227,12 @@ ReceiverInitialize(
                                          &ReceiverAlwaysPullup);
         if (NT_SUCCESS(status))
             (*Receiver)->AlwaysPullup = ReceiverAlwaysPullup;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "ReceiverSplitHeaders",
+                                         &ReceiverSplitHeaders);
+        if (NT_SUCCESS(status))
+            (*Receiver)->SplitHeaders = ReceiverSplitHeaders;
     }
 
     KeInitializeEvent(&(*Receiver)->Event, NotificationEvent, FALSE);
@@ -2915,6 +3321,7 @@ fail2:
     (*Receiver)->DisableIpVersion6Gso = 0;
     (*Receiver)->IpAlignOffset = 0;
     (*Receiver)->AlwaysPullup = 0;
+    (*Receiver)->SplitHeaders = 0;
 
     ASSERT(IsZeroMemory(*Receiver, sizeof (XENVIF_RECEIVER)));
     __ReceiverFree(*Receiver);
@@ -3360,6 +3767,7 @@ ReceiverTeardown(
     Receiver->DisableIpVersion6Gso = 0;
     Receiver->IpAlignOffset = 0;
     Receiver->AlwaysPullup = 0;
+    Receiver->SplitHeaders = 0;
 
     ASSERT(IsZeroMemory(Receiver, sizeof (XENVIF_RECEIVER)));
     __ReceiverFree(Receiver);
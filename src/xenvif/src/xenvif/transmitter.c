@@ -69,6 +69,7 @@ typedef struct _XENVIF_TRANSMITTER_PACKET {
     LIST_ENTRY                                  ListEntry;
     PVOID                                       Cookie;
     ULONG                                       Reference;
+    struct _XENVIF_TRANSMITTER_PACKET           *Parent;
     XENVIF_VIF_OFFLOAD_OPTIONS                  OffloadOptions;
     USHORT                                      MaximumSegmentSize;
     USHORT                                      TagControlInformation;
@@ -211,6 +212,8 @@ struct _XENVIF_TRANSMITTER {
     XENBUS_RANGE_SET_INTERFACE  RangeSetInterface;
     PXENVIF_TRANSMITTER_RING    *Ring;
     BOOLEAN                     MulticastControl;
+    BOOLEAN                     IpVersion4Gso;
+    BOOLEAN                     IpVersion6Gso;
     ULONG                       DisableIpVersion4Gso;
     ULONG                       DisableIpVersion6Gso;
     ULONG                       AlwaysCopy;
@@ -335,6 +338,7 @@ __TransmitterPutPacket(
     ASSERT(IsZeroMemory(&Packet->ListEntry, sizeof (LIST_ENTRY)));
     ASSERT3U(Packet->Reference, ==, 0);
     Packet->Cookie = NULL;
+    Packet->Parent = NULL;
 
     Packet->OffloadOptions.Value = 0;
     Packet->MaximumSegmentSize = 0;
@@ -1739,6 +1743,299 @@ fail1:
     return status;
 }
 
+static FORCEINLINE VOID
+__TransmitterAdvancePayload(
+    IN OUT  PXENVIF_PACKET_PAYLOAD  Payload,
+    IN      ULONG                   Length
+    )
+{
+    PMDL                            Mdl;
+    ULONG                           Offset;
+
+    ASSERT3U(Length, <=, Payload->Length);
+    Payload->Length -= Length;
+
+    Mdl = Payload->Mdl;
+    Offset = Payload->Offset + Length;
+
+    while (Payload->Length != 0 && Offset >= Mdl->ByteCount) {
+        Offset -= Mdl->ByteCount;
+        Mdl = Mdl->Next;
+        ASSERT(Mdl != NULL);
+    }
+
+    Payload->Mdl = Mdl;
+    Payload->Offset = Offset;
+}
+
+static FORCEINLINE BOOLEAN
+__TransmitterRingSegmentationRequired(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_PACKET  Packet
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+
+    Transmitter = Ring->Transmitter;
+
+    if (Packet->OffloadOptions.OffloadIpVersion4LargePacket)
+        return !Transmitter->IpVersion4Gso;
+
+    if (Packet->OffloadOptions.OffloadIpVersion6LargePacket)
+        return !Transmitter->IpVersion6Gso;
+
+    // There is no UDP GSO type in the netif protocol
+    if (Packet->OffloadOptions.OffloadIpVersion4UdpLargePacket ||
+        Packet->OffloadOptions.OffloadIpVersion6UdpLargePacket)
+        return TRUE;
+
+    return FALSE;
+}
+
+static FORCEINLINE USHORT
+__TransmitterGetPacketID(
+    IN  PUCHAR              StartVa,
+    IN  PXENVIF_PACKET_INFO Info
+    )
+{
+    PIP_HEADER              IpHeader;
+
+    IpHeader = (PIP_HEADER)(StartVa + Info->IpHeader.Offset);
+
+    return (IpHeader->Version == 4) ?
+           NTOHS(IpHeader->Version4.PacketID) :
+           0;
+}
+
+// Fix up the IP and UDP lengths (and IPv4 packet ID) of the headers of
+// a segment carrying Length bytes of payload. HeaderLength is the total
+// length of the headers.
+static FORCEINLINE VOID
+__TransmitterFixupSegmentHeaders(
+    IN      PUCHAR              StartVa,
+    IN      ULONG               HeaderLength,
+    IN      PXENVIF_PACKET_INFO Info,
+    IN      ULONG               Length,
+    IN OUT  PUSHORT             PacketID
+    )
+{
+    PIP_HEADER                  IpHeader;
+
+    if (Info->UdpHeader.Length != 0) {
+        PUDP_HEADER UdpHeader;
+
+        UdpHeader = (PUDP_HEADER)(StartVa + Info->UdpHeader.Offset);
+        UdpHeader->PacketLength =
+            HTONS((USHORT)(HeaderLength - Info->UdpHeader.Offset + Length));
+    }
+
+    IpHeader = (PIP_HEADER)(StartVa + Info->IpHeader.Offset);
+
+    if (IpHeader->Version == 4) {
+        IpHeader->Version4.PacketLength =
+            HTONS((USHORT)(HeaderLength - Info->IpHeader.Offset + Length));
+        IpHeader->Version4.PacketID = HTONS(*PacketID);
+        (*PacketID)++;
+    } else {
+        ASSERT3U(IpHeader->Version, ==, 6);
+        IpHeader->Version6.PayloadLength =
+            HTONS((USHORT)(HeaderLength - Info->IpHeader.Offset -
+                           Info->IpHeader.Length + Length));
+    }
+}
+
+// Split a large packet that the backend cannot segment into a series
+// of segment packets, each with its own copy of the headers and a slice
+// of the original payload. The segments replace the large packet at
+// the head of the packet queue and the large packet is completed when
+// the last of them is.
+static FORCEINLINE NTSTATUS
+__TransmitterRingSegmentPacket(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_PACKET  Packet
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_PACKET_INFO             Info;
+    XENVIF_PACKET_PAYLOAD           Payload;
+    USHORT                          PacketID;
+    ULONG                           Offset;
+    LIST_ENTRY                      List;
+    ULONG                           Count;
+    PLIST_ENTRY                     ListEntry;
+    PXENVIF_TRANSMITTER_PACKET      Segment;
+    NTSTATUS                        status;
+
+    Transmitter = Ring->Transmitter;
+
+    Info = &Packet->Info;
+    Payload = Packet->Payload;
+
+    ASSERT3U(Packet->Reference, ==, 0);
+
+    status = STATUS_INVALID_PARAMETER;
+    if (Info->Length == 0 ||
+        Info->IpHeader.Length == 0 ||
+        (Info->TcpHeader.Length == 0 && Info->UdpHeader.Length == 0) ||
+        Info->IsAFragment ||
+        Packet->MaximumSegmentSize == 0 ||
+        Payload.Length == 0)
+        goto fail1;
+
+    PacketID = __TransmitterGetPacketID(Packet->Header, Info);
+
+    InitializeListHead(&List);
+    Count = 0;
+    Offset = 0;
+
+    while (Payload.Length != 0) {
+        PUCHAR      BaseVa;
+        PIP_HEADER  IpHeader;
+        ULONG       Length;
+
+        Segment = __TransmitterGetPacket(Transmitter);
+
+        status = STATUS_NO_MEMORY;
+        if (Segment == NULL)
+            goto fail2;
+
+        Segment->Parent = Packet;
+        Packet->Reference++;
+
+        InsertTailList(&List, &Segment->ListEntry);
+        Count++;
+
+        Length = __min(Payload.Length, Packet->MaximumSegmentSize);
+
+        Segment->OffloadOptions = Packet->OffloadOptions;
+        Segment->OffloadOptions.OffloadIpVersion4LargePacket = 0;
+        Segment->OffloadOptions.OffloadIpVersion6LargePacket = 0;
+        Segment->OffloadOptions.OffloadIpVersion4UdpLargePacket = 0;
+        Segment->OffloadOptions.OffloadIpVersion6UdpLargePacket = 0;
+        Segment->TagControlInformation = Packet->TagControlInformation;
+        Segment->Hash = Packet->Hash;
+        Segment->Length = Info->Length + Length;
+        Segment->Info = *Info;
+
+        Segment->Payload.Mdl = Payload.Mdl;
+        Segment->Payload.Offset = Payload.Offset;
+        Segment->Payload.Length = Length;
+
+        __TransmitterAdvancePayload(&Payload, Length);
+
+        BaseVa = Segment->Header;
+        RtlCopyMemory(BaseVa, Packet->Header, Info->Length);
+
+        __TransmitterFixupSegmentHeaders(BaseVa,
+                                         Info->Length,
+                                         Info,
+                                         Length,
+                                         &PacketID);
+
+        IpHeader = (PIP_HEADER)(BaseVa + Info->IpHeader.Offset);
+
+        if (Info->TcpHeader.Length != 0) {
+            PTCP_HEADER TcpHeader;
+
+            TcpHeader = (PTCP_HEADER)(BaseVa + Info->TcpHeader.Offset);
+
+            TcpHeader->Seq = HTONL(NTOHL(TcpHeader->Seq) + Offset);
+
+            // FIN and PSH belong on the last segment, CWR on the first
+            if (Payload.Length != 0)
+                TcpHeader->Flags &= ~(TCP_FIN | TCP_PSH);
+
+            if (Offset != 0)
+                TcpHeader->Flags &= ~TCP_CWR;
+        }
+
+        // The IPv4 header checksum is always filled in as the segment is
+        // prepared. The transport checksum is left to the backend only if
+        // the large packet asked for that, whichever the IP version, and
+        // is calculated here if not.
+        if (IpHeader->Version == 4)
+            Segment->OffloadOptions.OffloadIpVersion4HeaderChecksum = 1;
+
+        if (Info->TcpHeader.Length != 0) {
+            PTCP_HEADER TcpHeader;
+
+            TcpHeader = (PTCP_HEADER)(BaseVa + Info->TcpHeader.Offset);
+
+            if (!Segment->OffloadOptions.OffloadIpVersion4TcpChecksum &&
+                !Segment->OffloadOptions.OffloadIpVersion6TcpChecksum) {
+                USHORT  Checksum;
+
+                Checksum = ChecksumPseudoHeader(BaseVa, &Segment->Info);
+                TcpHeader->Checksum = ChecksumTcpPacket(BaseVa,
+                                                        &Segment->Info,
+                                                        Checksum,
+                                                        &Segment->Payload);
+            }
+        } else {
+            PUDP_HEADER UdpHeader;
+
+            UdpHeader = (PUDP_HEADER)(BaseVa + Info->UdpHeader.Offset);
+
+            if (!Segment->OffloadOptions.OffloadIpVersion4UdpChecksum &&
+                !Segment->OffloadOptions.OffloadIpVersion6UdpChecksum) {
+                USHORT  Checksum;
+
+                Checksum = ChecksumPseudoHeader(BaseVa, &Segment->Info);
+                Checksum = ChecksumUdpPacket(BaseVa,
+                                             &Segment->Info,
+                                             Checksum,
+                                             &Segment->Payload);
+
+                // A zero checksum must be transmitted as all ones
+                UdpHeader->Checksum = (Checksum != 0) ? Checksum : 0xFFFF;
+            }
+        }
+
+        Offset += Length;
+    }
+
+    // The large packet is replaced by its segments
+    Ring->PacketsQueued += Count - 1;
+
+    while (!IsListEmpty(&List)) {
+        ListEntry = RemoveTailList(&List);
+        ASSERT3P(ListEntry, !=, &List);
+
+        InsertHeadList(&Ring->PacketQueue, ListEntry);
+    }
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+    while (!IsListEmpty(&List)) {
+        ListEntry = RemoveHeadList(&List);
+        ASSERT3P(ListEntry, !=, &List);
+
+        RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+
+        Segment = CONTAINING_RECORD(ListEntry,
+                                    XENVIF_TRANSMITTER_PACKET,
+                                    ListEntry);
+
+        ASSERT3P(Segment->Parent, ==, Packet);
+        Segment->Parent = NULL;
+
+        ASSERT(Packet->Reference != 0);
+        --Packet->Reference;
+
+        __TransmitterPutPacket(Transmitter, Segment);
+    }
+
+    ASSERT3U(Packet->Reference, ==, 0);
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
 static FORCEINLINE NTSTATUS
 __TransmitterRingPrepareArp(
     IN  PXENVIF_TRANSMITTER_RING    Ring,
@@ -2428,6 +2725,37 @@ __TransmitterRingFakeResponses(
     }
 }
 
+static FORCEINLINE PXENVIF_TRANSMITTER_PACKET
+__TransmitterRingCompleteSegment(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_PACKET  Segment
+    )
+{
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+
+    ASSERT(Segment->Completion.Status != 0);
+
+    Packet = Segment->Parent;
+    Segment->Parent = NULL;
+
+    if (Segment->Completion.Status != XENVIF_TRANSMITTER_PACKET_OK &&
+        Packet->Completion.Status == 0)
+        Packet->Completion.Status = Segment->Completion.Status;
+
+    Ring->PacketsCompleted++;
+
+    __TransmitterPutPacket(Ring->Transmitter, Segment);
+
+    ASSERT(Packet->Reference != 0);
+    if (--Packet->Reference != 0)
+        return NULL;
+
+    if (Packet->Completion.Status == 0)
+        Packet->Completion.Status = XENVIF_TRANSMITTER_PACKET_OK;
+
+    return Packet;
+}
+
 static FORCEINLINE VOID
 __TransmitterRingCompletePacket(
     IN  PXENVIF_TRANSMITTER_RING    Ring,
@@ -2446,6 +2774,15 @@ __TransmitterRingCompletePacket(
     Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
 
+    // A segment completes its large packet once all its siblings are done
+    if (Packet->Parent != NULL) {
+        Packet = __TransmitterRingCompleteSegment(Ring, Packet);
+        if (Packet == NULL)
+            return;
+    } else {
+        Ring->PacketsCompleted++;
+    }
+
     ASSERT(Packet->Completion.Status != 0);
 
     if (Packet->Completion.Status != XENVIF_TRANSMITTER_PACKET_OK) {
@@ -2597,7 +2934,6 @@ __TransmitterRingCompletePacket(
 
 done:
     InsertTailList(&Ring->PacketComplete, &Packet->ListEntry);
-    Ring->PacketsCompleted++;
 }
 
 static DECLSPEC_NOINLINE BOOLEAN
@@ -2958,7 +3294,14 @@ TransmitterRingSchedule(
 
             ASSERT3U(Packet->Completion.Status, ==, 0);
 
-            status = __TransmitterRingPreparePacket(Ring, Packet);
+            if (__TransmitterRingSegmentationRequired(Ring, Packet)) {
+                status = __TransmitterRingSegmentPacket(Ring, Packet);
+                if (NT_SUCCESS(status))
+                    continue;
+            } else {
+                status = __TransmitterRingPreparePacket(Ring, Packet);
+            }
+
             if (!NT_SUCCESS(status)) {
                 PXENVIF_TRANSMITTER Transmitter;
                 PXENVIF_FRONTEND    Frontend;
@@ -4541,6 +4884,38 @@ TransmitterConnect(
         }
     }
 
+    if (Transmitter->DisableIpVersion4Gso == 0) {
+        status = XENBUS_STORE(Read,
+                              &Transmitter->StoreInterface,
+                              NULL,
+                              FrontendGetBackendPath(Frontend),
+                              "feature-gso-tcpv4",
+                              &Buffer);
+        if (NT_SUCCESS(status)) {
+            Transmitter->IpVersion4Gso = (BOOLEAN)strtol(Buffer, NULL, 2);
+
+            XENBUS_STORE(Free,
+                         &Transmitter->StoreInterface,
+                         Buffer);
+        }
+    }
+
+    if (Transmitter->DisableIpVersion6Gso == 0) {
+        status = XENBUS_STORE(Read,
+                              &Transmitter->StoreInterface,
+                              NULL,
+                              FrontendGetBackendPath(Frontend),
+                              "feature-gso-tcpv6",
+                              &Buffer);
+        if (NT_SUCCESS(status)) {
+            Transmitter->IpVersion6Gso = (BOOLEAN)strtol(Buffer, NULL, 2);
+
+            XENBUS_STORE(Free,
+                         &Transmitter->StoreInterface,
+                         Buffer);
+        }
+    }
+
     Index = 0;
     while (Index < (LONG)FrontendGetNumQueues(Frontend)) {
         PXENVIF_TRANSMITTER_RING    Ring = Transmitter->Ring[Index];
@@ -4580,6 +4955,8 @@ fail4:
         __TransmitterRingDisconnect(Ring);
     }
 
+    Transmitter->IpVersion6Gso = FALSE;
+    Transmitter->IpVersion4Gso = FALSE;
     Transmitter->MulticastControl = FALSE;
 
     XENBUS_GNTTAB(Release, &Transmitter->GnttabInterface);
@@ -4794,6 +5171,8 @@ TransmitterDisconnect(
         __TransmitterRingDisconnect(Ring);
     }
 
+    Transmitter->IpVersion6Gso = FALSE;
+    Transmitter->IpVersion4Gso = FALSE;
     Transmitter->MulticastControl = FALSE;
 
     XENBUS_GNTTAB(Release, &Transmitter->GnttabInterface);
@@ -5148,49 +5527,11 @@ TransmitterQueryOffloadOptions(
 
     Options->OffloadTagManipulation = 1;
 
-    if (Transmitter->DisableIpVersion4Gso == 0) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv4",
-                              &Buffer);
-    } else {
-        Buffer = NULL;
-        status = STATUS_NOT_SUPPORTED;
-    }
-
-    if (!NT_SUCCESS(status)) {
-        Options->OffloadIpVersion4LargePacket = 0;
-    } else {
-        Options->OffloadIpVersion4LargePacket = (USHORT)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
-
-    if (Transmitter->DisableIpVersion6Gso == 0) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv6",
-                              &Buffer);
-    } else {
-        Buffer = NULL;
-        status = STATUS_NOT_SUPPORTED;
-    }
-
-    if (!NT_SUCCESS(status)) {
-        Options->OffloadIpVersion6LargePacket = 0;
-    } else {
-        Options->OffloadIpVersion6LargePacket = (USHORT)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
+    // Large packets are segmented here if the backend cannot do it
+    Options->OffloadIpVersion4LargePacket = 1;
+    Options->OffloadIpVersion6LargePacket = 1;
+    Options->OffloadIpVersion4UdpLargePacket = 1;
+    Options->OffloadIpVersion6UdpLargePacket = 1;
 
     Options->OffloadIpVersion4HeaderChecksum = 1;
 
@@ -5259,44 +5600,12 @@ TransmitterQueryLargePacketSize(
     OUT PULONG                  Size
     )
 {
-    PXENVIF_FRONTEND            Frontend;
-    PCHAR                       Buffer;
-    ULONG                       OffloadIpLargePacket;
-    NTSTATUS                    status;
-
-    Frontend = Transmitter->Frontend;
-
-    if (Version == 4) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv4",
-                              &Buffer);
-    } else if (Version == 6) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv6",
-                              &Buffer);
-    } else {
-        Buffer = NULL;
-        status = STATUS_UNSUCCESSFUL;
-    }
-
-    if (!NT_SUCCESS(status)) {
-        OffloadIpLargePacket = 0;
-    } else {
-        OffloadIpLargePacket = (ULONG)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
+    UNREFERENCED_PARAMETER(Transmitter);
 
+    // Large packets the backend cannot segment are segmented by the
+    // transmitter, so the size does not depend on backend features.
     // The OffloadParity certification test requires that we have a single LSO size for IPv4 and IPv6 packets
-    *Size = (OffloadIpLargePacket) ?
+    *Size = (Version == 4 || Version == 6) ?
             __min(XENVIF_TRANSMITTER_MAXIMUM_TCPV4_PAYLOAD_SIZE,
                  XENVIF_TRANSMITTER_MAXIMUM_TCPV6_PAYLOAD_SIZE) :
             0;
@@ -0,0 +1,1157 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host test for the control ring in controller.c.
+//
+// A fake backend consumes the shared ring the controller grants it and
+// answers each request the way netback does, reading the hash key and
+// mapping out of the pages named by their grant references. The test
+// checks that a hash update goes out as one batch with one notification,
+// that responses are matched to their requests by id whatever order
+// they come back in, that the key and mapping pages are granted once at
+// connect and reused, that a ninth concurrent request is refused rather
+// than overwriting a slot, and that a batch in which one request fails
+// leaves hashing turned off rather than half configured.
+
+#include <ntddk.h>
+
+#include "dbg_print.h"
+#include "assert.h"
+
+// Keep the driver's own headers for the controller's neighbours out of
+// the way; the declarations controller.c needs are provided below.
+#define _XENVIF_PDO_H
+#define _XENVIF_FRONTEND_H
+#define _XENVIF_VIF_H
+#define _XENVIF_THREAD_H
+#define _XENVIF_REGISTRY_H
+
+#include <xen.h>
+#include <debug_interface.h>
+#include <store_interface.h>
+#include <cache_interface.h>
+#include <gnttab_interface.h>
+#include <evtchn_interface.h>
+
+typedef struct _XENVIF_FDO          XENVIF_FDO, *PXENVIF_FDO;
+typedef struct _XENVIF_PDO          XENVIF_PDO, *PXENVIF_PDO;
+typedef struct _XENVIF_FRONTEND     XENVIF_FRONTEND, *PXENVIF_FRONTEND;
+
+static PCHAR        FrontendGetPath(PXENVIF_FRONTEND);
+static PCHAR        FrontendGetBackendPath(PXENVIF_FRONTEND);
+static USHORT       FrontendGetBackendDomain(PXENVIF_FRONTEND);
+static PXENVIF_PDO  FrontendGetPdo(PXENVIF_FRONTEND);
+static PXENVIF_FDO  PdoGetFdo(PXENVIF_PDO);
+static VOID         FdoGetDebugInterface(PXENVIF_FDO, PXENBUS_DEBUG_INTERFACE);
+static VOID         FdoGetStoreInterface(PXENVIF_FDO, PXENBUS_STORE_INTERFACE);
+static VOID         FdoGetGnttabInterface(PXENVIF_FDO, PXENBUS_GNTTAB_INTERFACE);
+static VOID         FdoGetEvtchnInterface(PXENVIF_FDO, PXENBUS_EVTCHN_INTERFACE);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_GNTTAB
+#define XENBUS_GNTTAB(_Method, _Interface, ...)    \
+    (_Interface)->Gnttab ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_EVTCHN
+#define XENBUS_EVTCHN(_Method, _Interface, ...)    \
+    (_Interface)->Evtchn ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenvif/controller.c"
+
+#include "test.h"
+
+// Neighbours
+
+static PCHAR
+FrontendGetPath(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return "device/vif/0";
+}
+
+static PCHAR
+FrontendGetBackendPath(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return "backend/vif/1/0";
+}
+
+static USHORT
+FrontendGetBackendDomain(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return 0;
+}
+
+static PXENVIF_PDO
+FrontendGetPdo(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return NULL;
+}
+
+static PXENVIF_FDO
+PdoGetFdo(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    UNREFERENCED_PARAMETER(Pdo);
+    return NULL;
+}
+
+ULONG
+NTAPI
+RtlRandomEx(
+    IN OUT  PULONG  Seed
+    )
+{
+    // Start just below the wrap so that the zero id is skipped early
+    UNREFERENCED_PARAMETER(Seed);
+    return 0xfffd;
+}
+
+// Pages, as __AllocatePage() uses them
+
+PMDL
+MmAllocatePagesForMdlEx(
+    IN  PHYSICAL_ADDRESS    LowAddress,
+    IN  PHYSICAL_ADDRESS    HighAddress,
+    IN  PHYSICAL_ADDRESS    SkipBytes,
+    IN  SIZE_T              TotalBytes,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  ULONG               Flags
+    )
+{
+    PMDL                    Mdl;
+    PVOID                   Va;
+
+    Mdl = __AllocatePoolWithTag(NonPagedPool,
+                                sizeof (MDL) + sizeof (PFN_NUMBER),
+                                'TSET');
+    if (Mdl == NULL)
+        return NULL;
+
+    ASSERT3U(TotalBytes, ==, PAGE_SIZE);
+    if (posix_memalign(&Va, PAGE_SIZE, PAGE_SIZE) != 0) {
+        __FreePoolWithTag(Mdl, 'TSET');
+        return NULL;
+    }
+
+    RtlZeroMemory(Mdl, sizeof (MDL));
+    Mdl->StartVa = Va;
+    Mdl->ByteCount = PAGE_SIZE;
+    MmGetMdlPfnArray(Mdl)[0] = (PFN_NUMBER)((ULONG_PTR)Va >> PAGE_SHIFT);
+
+    return Mdl;
+}
+
+PVOID
+MmMapLockedPagesSpecifyCache(
+    IN  PMDL                Mdl,
+    IN  KPROCESSOR_MODE     AccessMode,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  PVOID               BaseAddress,
+    IN  ULONG               BugCheckOnFailure,
+    IN  ULONG               Priority
+    )
+{
+    Mdl->MdlFlags |= MDL_MAPPED_TO_SYSTEM_VA;
+    Mdl->MappedSystemVa = Mdl->StartVa;
+
+    return Mdl->MappedSystemVa;
+}
+
+VOID
+MmUnmapLockedPages(
+    IN  PVOID   BaseAddress,
+    IN  PMDL    Mdl
+    )
+{
+    ASSERT3P(BaseAddress, ==, Mdl->MappedSystemVa);
+
+    Mdl->MdlFlags &= ~MDL_MAPPED_TO_SYSTEM_VA;
+    Mdl->MappedSystemVa = NULL;
+}
+
+VOID
+MmFreePagesFromMdl(
+    IN  PMDL    Mdl
+    )
+{
+    free(Mdl->StartVa);
+}
+
+// Grant table: an entry remembers the frame it grants and the reference
+// is its index plus one
+
+#define GRANTS  8
+
+struct _XENBUS_GNTTAB_ENTRY {
+    BOOLEAN     Active;
+    BOOLEAN     ReadOnly;
+    PFN_NUMBER  Pfn;
+};
+
+struct _XENBUS_GNTTAB_CACHE {
+    ULONG       Unused;
+};
+
+static XENBUS_GNTTAB_ENTRY  Grant[GRANTS];
+static XENBUS_GNTTAB_CACHE  GrantCache;
+static ULONG                GrantsPermitted;
+static ULONG                GrantsRevoked;
+
+static NTSTATUS
+GnttabAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+GnttabRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+static NTSTATUS
+GnttabCreateCache(
+    IN  PINTERFACE                  Interface,
+    IN  const CHAR                  *Name,
+    IN  ULONG                       Reservation,
+    IN  XENBUS_CACHE_ACQUIRE_LOCK   AcquireLock,
+    IN  XENBUS_CACHE_RELEASE_LOCK   ReleaseLock,
+    IN  PVOID                       Argument,
+    OUT PXENBUS_GNTTAB_CACHE        *Cache
+    )
+{
+    *Cache = &GrantCache;
+    return STATUS_SUCCESS;
+}
+
+static VOID
+GnttabDestroyCache(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_GNTTAB_CACHE    Cache
+    )
+{
+    ASSERT3P(Cache, ==, &GrantCache);
+}
+
+static NTSTATUS
+GnttabPermitForeignAccess(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_GNTTAB_CACHE    Cache,
+    IN  BOOLEAN                 Locked,
+    IN  USHORT                  Domain,
+    IN  PFN_NUMBER              Pfn,
+    IN  BOOLEAN                 ReadOnly,
+    OUT PXENBUS_GNTTAB_ENTRY    *Entry
+    )
+{
+    ULONG                       Index;
+
+    for (Index = 0; Index < GRANTS; Index++) {
+        if (!Grant[Index].Active) {
+            Grant[Index].Active = TRUE;
+            Grant[Index].ReadOnly = ReadOnly;
+            Grant[Index].Pfn = Pfn;
+
+            GrantsPermitted++;
+
+            *Entry = &Grant[Index];
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+static NTSTATUS
+GnttabRevokeForeignAccess(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_GNTTAB_CACHE    Cache,
+    IN  BOOLEAN                 Locked,
+    IN  PXENBUS_GNTTAB_ENTRY    Entry
+    )
+{
+    ASSERT(Entry->Active);
+    RtlZeroMemory(Entry, sizeof (XENBUS_GNTTAB_ENTRY));
+
+    GrantsRevoked++;
+    return STATUS_SUCCESS;
+}
+
+static ULONG
+GnttabGetReference(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_GNTTAB_ENTRY    Entry
+    )
+{
+    return (ULONG)(Entry - &Grant[0]) + 1;
+}
+
+// What the backend sees through a grant reference
+static PVOID
+GrantMap(
+    IN  ULONG   Reference
+    )
+{
+    if (Reference == 0 || Reference > GRANTS || !Grant[Reference - 1].Active)
+        return NULL;
+
+    return (PVOID)(Grant[Reference - 1].Pfn << PAGE_SHIFT);
+}
+
+// The backend, modelled on netback's control ring handling
+
+#define BACKEND_KEY_SIZE        40
+#define BACKEND_MAPPING_SIZE    128
+#define BACKEND_QUEUES          4
+#define BACKEND_FLAGS           0x0f
+
+typedef struct _BACKEND {
+    xen_netif_ctrl_back_ring_t      Back;
+    BOOLEAN                         Attached;
+    ULONG                           Notifications;
+    ULONG                           Requests;
+    ULONG                           Algorithm;
+    ULONG                           Flags;
+    ULONG                           MappingSize;
+    ULONG                           Mapping[BACKEND_MAPPING_SIZE];
+    UCHAR                           Key[BACKEND_KEY_SIZE];
+    ULONG                           KeyReference;
+    ULONG                           MappingReference;
+    USHORT                          FailType;
+    BOOLEAN                         Reverse;
+    struct xen_netif_ctrl_response  Deferred[32];
+    ULONG                           DeferredCount;
+} BACKEND, *PBACKEND;
+
+static BACKEND  Backend;
+
+static ULONG
+BackendHandle(
+    IN  struct xen_netif_ctrl_request   *Request,
+    OUT PULONG                          Data
+    )
+{
+    PUCHAR                              Page;
+    ULONG                               Index;
+
+    *Data = 0;
+
+    if (Request->type == Backend.FailType)
+        return XEN_NETIF_CTRL_STATUS_NOT_SUPPORTED;
+
+    switch (Request->type) {
+    case XEN_NETIF_CTRL_TYPE_SET_HASH_ALGORITHM:
+        if (Request->data[0] != XEN_NETIF_CTRL_HASH_ALGORITHM_NONE &&
+            Request->data[0] != XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ)
+            return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        Backend.Algorithm = Request->data[0];
+        return XEN_NETIF_CTRL_STATUS_SUCCESS;
+
+    case XEN_NETIF_CTRL_TYPE_GET_HASH_FLAGS:
+        *Data = BACKEND_FLAGS;
+        return XEN_NETIF_CTRL_STATUS_SUCCESS;
+
+    case XEN_NETIF_CTRL_TYPE_SET_HASH_FLAGS:
+        if (Request->data[0] & ~BACKEND_FLAGS)
+            return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        Backend.Flags = Request->data[0];
+        return XEN_NETIF_CTRL_STATUS_SUCCESS;
+
+    case XEN_NETIF_CTRL_TYPE_SET_HASH_KEY:
+        if (Request->data[1] > BACKEND_KEY_SIZE)
+            return XEN_NETIF_CTRL_STATUS_BUFFER_OVERFLOW;
+
+        Page = GrantMap(Request->data[0]);
+        if (Page == NULL)
+            return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        RtlZeroMemory(Backend.Key, BACKEND_KEY_SIZE);
+        RtlCopyMemory(Backend.Key, Page, Request->data[1]);
+        Backend.KeyReference = Request->data[0];
+        return XEN_NETIF_CTRL_STATUS_SUCCESS;
+
+    case XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING_SIZE:
+        if (Request->data[0] == 0 ||
+            Request->data[0] > BACKEND_MAPPING_SIZE)
+            return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        Backend.MappingSize = Request->data[0];
+        RtlZeroMemory(Backend.Mapping, sizeof (Backend.Mapping));
+        return XEN_NETIF_CTRL_STATUS_SUCCESS;
+
+    case XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING:
+        if (Request->data[2] + Request->data[1] > Backend.MappingSize)
+            return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        Page = GrantMap(Request->data[0]);
+        if (Page == NULL)
+            return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        for (Index = 0; Index < Request->data[1]; Index++)
+            if (((PULONG)Page)[Index] >= BACKEND_QUEUES)
+                return XEN_NETIF_CTRL_STATUS_INVALID_PARAMETER;
+
+        RtlCopyMemory(&Backend.Mapping[Request->data[2]], Page,
+                      Request->data[1] * sizeof (ULONG));
+        Backend.MappingReference = Request->data[0];
+        return XEN_NETIF_CTRL_STATUS_SUCCESS;
+
+    default:
+        return XEN_NETIF_CTRL_STATUS_NOT_SUPPORTED;
+    }
+}
+
+static VOID
+BackendRespond(
+    IN  struct xen_netif_ctrl_response  *Response
+    )
+{
+    BOOLEAN                             Notify;
+
+    *RING_GET_RESPONSE(&Backend.Back, Backend.Back.rsp_prod_pvt) = *Response;
+    Backend.Back.rsp_prod_pvt++;
+
+    RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&Backend.Back, Notify);
+}
+
+static VOID
+BackendProcess(
+    VOID
+    )
+{
+    int More;
+
+    do {
+        while (RING_HAS_UNCONSUMED_REQUESTS(&Backend.Back)) {
+            struct xen_netif_ctrl_request   Request;
+            struct xen_netif_ctrl_response  Response;
+
+            Request = *RING_GET_REQUEST(&Backend.Back, Backend.Back.req_cons);
+            Backend.Back.req_cons++;
+            Backend.Requests++;
+
+            Response.id = Request.id;
+            Response.type = Request.type;
+            Response.status = BackendHandle(&Request, &Response.data);
+
+            if (Backend.Reverse) {
+                ASSERT3U(Backend.DeferredCount, <, ARRAYSIZE(Backend.Deferred));
+                Backend.Deferred[Backend.DeferredCount++] = Response;
+            } else {
+                BackendRespond(&Response);
+            }
+        }
+
+        RING_FINAL_CHECK_FOR_REQUESTS(&Backend.Back, More);
+    } while (More);
+}
+
+// Deferred responses go back last first, when the frontend waits
+static VOID
+BackendFlush(
+    VOID
+    )
+{
+    while (Backend.DeferredCount != 0)
+        BackendRespond(&Backend.Deferred[--Backend.DeferredCount]);
+}
+
+// Event channel
+
+struct _XENBUS_EVTCHN_CHANNEL {
+    ULONG   Port;
+};
+
+static XENBUS_EVTCHN_CHANNEL    Channel;
+static ULONG                    ChannelPriority;
+
+static NTSTATUS
+EvtchnAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+EvtchnRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+static PXENBUS_EVTCHN_CHANNEL
+EvtchnOpen(
+    IN  PINTERFACE          Interface,
+    IN  XENBUS_EVTCHN_TYPE  Type,
+    IN  PKSERVICE_ROUTINE   Function,
+    IN  PVOID               Argument,
+    ...
+    )
+{
+    xen_netif_ctrl_sring_t  *Shared = NULL;
+    ULONG                   Index;
+
+    ASSERT3U(Type, ==, XENBUS_EVTCHN_TYPE_UNBOUND);
+
+    // The ring is the one page granted writable
+    for (Index = 0; Index < GRANTS; Index++)
+        if (Grant[Index].Active && !Grant[Index].ReadOnly)
+            Shared = GrantMap(Index + 1);
+
+    ASSERT(Shared != NULL);
+    BACK_RING_INIT(&Backend.Back, Shared, PAGE_SIZE);
+    Backend.Attached = TRUE;
+
+    Channel.Port = 42;
+    return &Channel;
+}
+
+static NTSTATUS
+EvtchnSetPriority(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel,
+    IN  XENBUS_EVTCHN_PRIORITY  Priority
+    )
+{
+    ChannelPriority = Priority;
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN
+EvtchnUnmask(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel,
+    IN  BOOLEAN                 InCallback,
+    IN  BOOLEAN                 Force
+    )
+{
+    return FALSE;
+}
+
+static VOID
+EvtchnSend(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel
+    )
+{
+    ASSERT(Backend.Attached);
+
+    Backend.Notifications++;
+    BackendProcess();
+}
+
+static ULONG
+EvtchnGetCount(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel
+    )
+{
+    return 0;
+}
+
+static NTSTATUS
+EvtchnWait(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel,
+    IN  ULONG                   Count,
+    IN  PLARGE_INTEGER          Timeout
+    )
+{
+    // Nothing else will ever answer
+    ASSERT(Backend.DeferredCount != 0);
+
+    BackendFlush();
+    return STATUS_SUCCESS;
+}
+
+static VOID
+EvtchnClose(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_EVTCHN_CHANNEL  Channel
+    )
+{
+    Backend.Attached = FALSE;
+}
+
+// Store and debug
+
+static NTSTATUS
+StoreAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+StoreRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+static NTSTATUS
+StoreRead(
+    IN  PINTERFACE                  Interface,
+    IN  PXENBUS_STORE_TRANSACTION   Transaction,
+    IN  PCHAR                       Prefix,
+    IN  PCHAR                       Node,
+    OUT PCHAR                       *Buffer
+    )
+{
+    if (strcmp(Node, "feature-ctrl-ring") != 0)
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+
+    *Buffer = strdup("1");
+    return STATUS_SUCCESS;
+}
+
+static VOID
+StoreFree(
+    IN  PINTERFACE  Interface,
+    IN  PCHAR       Buffer
+    )
+{
+    free(Buffer);
+}
+
+struct _XENBUS_DEBUG_CALLBACK {
+    ULONG   Unused;
+};
+
+static XENBUS_DEBUG_CALLBACK    DebugCallback;
+
+static NTSTATUS
+DebugAcquire(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+    return STATUS_SUCCESS;
+}
+
+static VOID
+DebugRelease(
+    IN  PINTERFACE  Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Interface);
+}
+
+static NTSTATUS
+DebugRegister(
+    IN  PINTERFACE              Interface,
+    IN  PCHAR                   Prefix,
+    IN  XENBUS_DEBUG_FUNCTION   Function,
+    IN  PVOID                   Argument,
+    OUT PXENBUS_DEBUG_CALLBACK  *Callback
+    )
+{
+    *Callback = &DebugCallback;
+    return STATUS_SUCCESS;
+}
+
+static VOID
+DebugDeregister(
+    IN  PINTERFACE              Interface,
+    IN  PXENBUS_DEBUG_CALLBACK  Callback
+    )
+{
+    ASSERT3P(Callback, ==, &DebugCallback);
+}
+
+static VOID
+FdoGetDebugInterface(
+    IN  PXENVIF_FDO             Fdo,
+    OUT PXENBUS_DEBUG_INTERFACE Interface
+    )
+{
+    RtlZeroMemory(Interface, sizeof (XENBUS_DEBUG_INTERFACE));
+    Interface->DebugAcquire = DebugAcquire;
+    Interface->DebugRelease = DebugRelease;
+    Interface->DebugRegister = DebugRegister;
+    Interface->DebugDeregister = DebugDeregister;
+}
+
+static VOID
+FdoGetStoreInterface(
+    IN  PXENVIF_FDO             Fdo,
+    OUT PXENBUS_STORE_INTERFACE Interface
+    )
+{
+    RtlZeroMemory(Interface, sizeof (XENBUS_STORE_INTERFACE));
+    Interface->StoreAcquire = StoreAcquire;
+    Interface->StoreRelease = StoreRelease;
+    Interface->StoreRead = StoreRead;
+    Interface->StoreFree = StoreFree;
+}
+
+static VOID
+FdoGetGnttabInterface(
+    IN  PXENVIF_FDO                 Fdo,
+    OUT PXENBUS_GNTTAB_INTERFACE    Interface
+    )
+{
+    RtlZeroMemory(Interface, sizeof (XENBUS_GNTTAB_INTERFACE));
+    Interface->GnttabAcquire = GnttabAcquire;
+    Interface->GnttabRelease = GnttabRelease;
+    Interface->GnttabCreateCache = GnttabCreateCache;
+    Interface->GnttabPermitForeignAccess = GnttabPermitForeignAccess;
+    Interface->GnttabRevokeForeignAccess = GnttabRevokeForeignAccess;
+    Interface->GnttabGetReference = GnttabGetReference;
+    Interface->GnttabDestroyCache = GnttabDestroyCache;
+}
+
+static VOID
+FdoGetEvtchnInterface(
+    IN  PXENVIF_FDO                 Fdo,
+    OUT PXENBUS_EVTCHN_INTERFACE    Interface
+    )
+{
+    RtlZeroMemory(Interface, sizeof (XENBUS_EVTCHN_INTERFACE));
+    Interface->Interface.Version = 9;
+    Interface->EvtchnAcquire = EvtchnAcquire;
+    Interface->EvtchnRelease = EvtchnRelease;
+    Interface->EvtchnOpen = EvtchnOpen;
+    Interface->EvtchnSetPriority = EvtchnSetPriority;
+    Interface->EvtchnUnmask = EvtchnUnmask;
+    Interface->EvtchnSend = EvtchnSend;
+    Interface->EvtchnGetCount = EvtchnGetCount;
+    Interface->EvtchnWait = EvtchnWait;
+    Interface->EvtchnClose = EvtchnClose;
+}
+
+// Tests
+
+// One byte more than the backend takes, to offer it too much
+static UCHAR    TestKey[BACKEND_KEY_SIZE + 1];
+static ULONG    TestMapping[BACKEND_MAPPING_SIZE];
+
+static VOID
+TestFill(
+    IN  ULONG   Seed
+    )
+{
+    ULONG       Index;
+
+    for (Index = 0; Index < BACKEND_KEY_SIZE; Index++)
+        TestKey[Index] = (UCHAR)(Seed + Index);
+
+    for (Index = 0; Index < BACKEND_MAPPING_SIZE; Index++)
+        TestMapping[Index] = (Seed + Index) % BACKEND_QUEUES;
+}
+
+static PXENVIF_CONTROLLER
+TestConnect(
+    VOID
+    )
+{
+    PXENVIF_CONTROLLER  Controller;
+    NTSTATUS            status;
+
+    RtlZeroMemory(&Backend, sizeof (Backend));
+    Backend.FailType = (USHORT)~0;
+
+    status = ControllerInitialize(NULL, &Controller);
+    CHECK_EQ(status, STATUS_SUCCESS);
+
+    status = ControllerConnect(Controller);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK(Controller->Connected);
+    CHECK(Backend.Attached);
+    CHECK_EQ(ChannelPriority, XENBUS_EVTCHN_PRIORITY_HIGH);
+
+    return Controller;
+}
+
+static VOID
+TestDisconnect(
+    IN  PXENVIF_CONTROLLER  Controller
+    )
+{
+    ULONG                   Index;
+
+    CHECK_EQ(Controller->Outstanding, 0);
+    for (Index = 0; Index < XENVIF_CONTROLLER_MAXIMUM_SLOTS; Index++)
+        CHECK_EQ(Controller->Slot[Index].Id, 0);
+
+    ControllerDisconnect(Controller);
+    CHECK(!Backend.Attached);
+
+    HostIrql = PASSIVE_LEVEL;
+    ControllerTeardown(Controller);
+    HostIrql = DISPATCH_LEVEL;
+
+    for (Index = 0; Index < GRANTS; Index++)
+        CHECK(!Grant[Index].Active);
+}
+
+// A full update is one batch and one notification, and the key and
+// mapping travel in the pages granted at connect
+static VOID
+TestSetHash(
+    VOID
+    )
+{
+    PXENVIF_CONTROLLER  Controller;
+    ULONG               Permitted;
+    ULONG               KeyReference;
+    ULONG               MappingReference;
+    ULONG               Flags;
+    ULONG               Round;
+    NTSTATUS            status;
+
+    Controller = TestConnect();
+
+    // The ring, the key and the mapping
+    CHECK_EQ(GrantsPermitted, 3);
+    Permitted = GrantsPermitted;
+
+    KeyReference = 0;
+    MappingReference = 0;
+
+    for (Round = 0; Round < 4; Round++) {
+        ULONG   Notifications = Backend.Notifications;
+        ULONG   Requests = Backend.Requests;
+        ULONG   Batches = Controller->Batches;
+        ULONG   Size = 16 << Round;
+
+        // The last rounds answer in reverse order
+        Backend.Reverse = (Round >= 2) ? TRUE : FALSE;
+
+        TestFill(Round);
+
+        status = ControllerSetHash(Controller,
+                                   XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ,
+                                   TestMapping,
+                                   Size,
+                                   TestKey,
+                                   BACKEND_KEY_SIZE,
+                                   Round + 1);
+        CHECK_EQ(status, STATUS_SUCCESS);
+
+        CHECK_EQ(Backend.Notifications - Notifications, 1);
+        CHECK_EQ(Backend.Requests - Requests, 5);
+        CHECK_EQ(Controller->Batches - Batches, 1);
+
+        CHECK_EQ(Backend.Algorithm, XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ);
+        CHECK_EQ(Backend.Flags, Round + 1);
+        CHECK_EQ(Backend.MappingSize, Size);
+        CHECK(memcmp(Backend.Mapping, TestMapping, Size * sizeof (ULONG)) == 0);
+        CHECK(memcmp(Backend.Key, TestKey, BACKEND_KEY_SIZE) == 0);
+
+        // No grant operations on the update path
+        CHECK_EQ(GrantsPermitted, Permitted);
+        CHECK_EQ(GrantsRevoked, 0);
+
+        if (Round == 0) {
+            KeyReference = Backend.KeyReference;
+            MappingReference = Backend.MappingReference;
+            CHECK(KeyReference != MappingReference);
+        }
+
+        CHECK_EQ(Backend.KeyReference, KeyReference);
+        CHECK_EQ(Backend.MappingReference, MappingReference);
+        CHECK(Grant[KeyReference - 1].ReadOnly);
+        CHECK(Grant[MappingReference - 1].ReadOnly);
+    }
+
+    // Turning hashing off is a single request
+    status = ControllerSetHash(Controller,
+                               XEN_NETIF_CTRL_HASH_ALGORITHM_NONE,
+                               NULL,
+                               0,
+                               NULL,
+                               0,
+                               0);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(Backend.Algorithm, XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
+
+    Backend.Reverse = FALSE;
+
+    status = ControllerGetHashFlags(Controller, &Flags);
+    CHECK_EQ(status, STATUS_SUCCESS);
+    CHECK_EQ(Flags, BACKEND_FLAGS);
+
+    // The request id wrapped past zero along the way
+    CHECK(Controller->RequestId < 0xfffd);
+
+    TestDisconnect(Controller);
+
+    CHECK_EQ(GrantsRevoked, 3);
+    GrantsPermitted = GrantsRevoked = 0;
+}
+
+// Each request stands alone, so a failure part way through a batch can
+// leave the others applied; the controller must then turn hashing off
+static VOID
+TestSetHashFailure(
+    VOID
+    )
+{
+    static const USHORT Type[] = {
+        XEN_NETIF_CTRL_TYPE_SET_HASH_ALGORITHM,
+        XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING_SIZE,
+        XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING,
+        XEN_NETIF_CTRL_TYPE_SET_HASH_KEY,
+        XEN_NETIF_CTRL_TYPE_SET_HASH_FLAGS,
+    };
+    PXENVIF_CONTROLLER  Controller;
+    ULONG               Index;
+    NTSTATUS            status;
+
+    Controller = TestConnect();
+
+    for (Index = 0; Index < ARRAYSIZE(Type); Index++) {
+        Backend.Algorithm = XEN_NETIF_CTRL_HASH_ALGORITHM_NONE;
+        Backend.Flags = 0;
+        Backend.FailType = Type[Index];
+        Backend.Reverse = (Index & 1) ? TRUE : FALSE;
+
+        TestFill(Index);
+
+        status = ControllerSetHash(Controller,
+                                   XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ,
+                                   TestMapping,
+                                   64,
+                                   TestKey,
+                                   BACKEND_KEY_SIZE,
+                                   BACKEND_FLAGS);
+        CHECK_EQ(status, STATUS_NOT_SUPPORTED);
+
+        // The requests after the failure were still applied...
+        if (Type[Index] != XEN_NETIF_CTRL_TYPE_SET_HASH_FLAGS)
+            CHECK_EQ(Backend.Flags, BACKEND_FLAGS);
+
+        // ...but hashing is off
+        CHECK_EQ(Backend.Algorithm, XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
+        CHECK_EQ(Controller->Outstanding, 0);
+    }
+
+    // A key the backend cannot take fails the same way
+    Backend.FailType = (USHORT)~0;
+    Backend.Reverse = FALSE;
+
+    status = ControllerSetHash(Controller,
+                               XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ,
+                               TestMapping,
+                               64,
+                               TestKey,
+                               BACKEND_KEY_SIZE + 1,
+                               BACKEND_FLAGS);
+    CHECK_EQ(status, STATUS_BUFFER_OVERFLOW);
+    CHECK_EQ(Backend.Algorithm, XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
+
+    TestDisconnect(Controller);
+    GrantsPermitted = GrantsRevoked = 0;
+}
+
+// A batch that cannot be queued in full is flushed and undone
+static VOID
+TestSetHashNoSlot(
+    VOID
+    )
+{
+    PXENVIF_CONTROLLER  Controller;
+    ULONG               Busy;
+    ULONG               Requests;
+    NTSTATUS            status;
+
+    Controller = TestConnect();
+
+    // Leave room for only the first four requests of the batch
+    for (Busy = 0; Busy < XENVIF_CONTROLLER_MAXIMUM_SLOTS - 4; Busy++)
+        Controller->Slot[Busy].Id = 0xff00 + (USHORT)Busy;
+
+    Backend.Algorithm = XEN_NETIF_CTRL_HASH_ALGORITHM_NONE;
+    Requests = Backend.Requests;
+
+    TestFill(7);
+
+    status = ControllerSetHash(Controller,
+                               XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ,
+                               TestMapping,
+                               64,
+                               TestKey,
+                               BACKEND_KEY_SIZE,
+                               BACKEND_FLAGS);
+    CHECK_EQ(status, STATUS_INSUFFICIENT_RESOURCES);
+
+    // Four requests went out, then the one turning hashing off
+    CHECK_EQ(Backend.Requests - Requests, 5);
+    CHECK_EQ(Backend.Algorithm, XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
+    CHECK_EQ(Controller->Outstanding, 0);
+
+    for (Busy = 0; Busy < XENVIF_CONTROLLER_MAXIMUM_SLOTS; Busy++) {
+        if (Busy < XENVIF_CONTROLLER_MAXIMUM_SLOTS - 4)
+            RtlZeroMemory(&Controller->Slot[Busy], sizeof (XENVIF_CONTROLLER_SLOT));
+        else
+            CHECK_EQ(Controller->Slot[Busy].Id, 0);
+    }
+
+    TestDisconnect(Controller);
+    GrantsPermitted = GrantsRevoked = 0;
+}
+
+typedef struct _TEST_COMPLETION {
+    ULONG       Count;
+    NTSTATUS    Status;
+    ULONG       Data;
+} TEST_COMPLETION, *PTEST_COMPLETION;
+
+static VOID
+TestComplete(
+    IN  PVOID           Argument,
+    IN  NTSTATUS        Status,
+    IN  ULONG           Data
+    )
+{
+    PTEST_COMPLETION    Completion = Argument;
+
+    Completion->Count++;
+    Completion->Status = Status;
+    Completion->Data = Data;
+}
+
+// No more requests than slots may be in flight, each completion goes to
+// its own request, and a response nobody asked for is ignored
+static VOID
+TestSlots(
+    VOID
+    )
+{
+    PXENVIF_CONTROLLER              Controller;
+    TEST_COMPLETION                 Completion[XENVIF_CONTROLLER_MAXIMUM_SLOTS + 1];
+    struct xen_netif_ctrl_response  Stray;
+    ULONG                           Index;
+    NTSTATUS                        status;
+
+    Controller = TestConnect();
+
+    RtlZeroMemory(Completion, sizeof (Completion));
+    Backend.Reverse = TRUE;
+
+    for (Index = 0; Index < ARRAYSIZE(Completion); Index++) {
+        // Even requests are ones the backend refuses
+        status = ControllerPutRequest(Controller,
+                                      (Index & 1) ?
+                                      XEN_NETIF_CTRL_TYPE_GET_HASH_FLAGS :
+                                      XEN_NETIF_CTRL_TYPE_INVALID,
+                                      0,
+                                      0,
+                                      0,
+                                      TestComplete,
+                                      &Completion[Index]);
+        if (Index < XENVIF_CONTROLLER_MAXIMUM_SLOTS)
+            CHECK_EQ(status, STATUS_SUCCESS);
+        else
+            CHECK_EQ(status, STATUS_INSUFFICIENT_RESOURCES);
+    }
+
+    CHECK_EQ(Controller->Outstanding, XENVIF_CONTROLLER_MAXIMUM_SLOTS);
+
+    ControllerPushRequests(Controller);
+
+    // A response with an id that is not outstanding
+    Stray.id = 0x1234;
+    Stray.type = XEN_NETIF_CTRL_TYPE_GET_HASH_FLAGS;
+    Stray.status = XEN_NETIF_CTRL_STATUS_SUCCESS;
+    Stray.data = 0;
+    BackendRespond(&Stray);
+
+    ControllerWaitForResponses(Controller);
+
+    for (Index = 0; Index < ARRAYSIZE(Completion); Index++) {
+        if (Index == XENVIF_CONTROLLER_MAXIMUM_SLOTS) {
+            CHECK_EQ(Completion[Index].Count, 0);
+        } else if (Index & 1) {
+            CHECK_EQ(Completion[Index].Count, 1);
+            CHECK_EQ(Completion[Index].Status, STATUS_SUCCESS);
+            CHECK_EQ(Completion[Index].Data, BACKEND_FLAGS);
+        } else {
+            CHECK_EQ(Completion[Index].Count, 1);
+            CHECK_EQ(Completion[Index].Status, STATUS_NOT_SUPPORTED);
+        }
+    }
+
+    TestDisconnect(Controller);
+    GrantsPermitted = GrantsRevoked = 0;
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    UNREFERENCED_PARAMETER(argc);
+    UNREFERENCED_PARAMETER(argv);
+
+    HostIrql = DISPATCH_LEVEL;
+
+    TestSetHash();
+    TestSetHashFailure();
+    TestSetHashNoSlot();
+    TestSlots();
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("controller");
+}
@@ -0,0 +1,865 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host test and microbenchmark for the multicast table in mac.c.
+//
+// A reference set is kept alongside the MAC and every list update is
+// checked against it: the addresses reported back, the receive filter
+// decision for members and non-members, and the multicast control
+// requests queued for the backend. Reader threads apply the filter
+// concurrently, each standing in for a processor, with KeGenericCallDpc()
+// running its routine on a reader only once that reader has dropped
+// below DISPATCH_LEVEL, so that a table freed too early shows up under
+// -fsanitize=address. A further reader then stops part way through a
+// lookup while its table is retired, to check that the table outlives
+// it.
+//
+// The benchmark then times list updates and lookups at 1, 64 and 1024
+// groups, both as a single update of the whole list and as the sequence
+// of one-address-at-a-time updates that each add or remove used to cost.
+
+#include <ntddk.h>
+#include <pthread.h>
+
+#include "dbg_print.h"
+#include "assert.h"
+
+// Keep the driver's own headers for the MAC's neighbours out of the way;
+// the declarations mac.c needs are provided below.
+#define _XENVIF_DRIVER_H
+#define _XENVIF_FDO_H
+#define _XENVIF_PDO_H
+#define _XENVIF_FRONTEND_H
+#define _XENVIF_TRANSMITTER_H
+#define _XENVIF_THREAD_H
+#define _XENVIF_VIF_H
+
+#include <ethernet.h>
+#include <debug_interface.h>
+#include <store_interface.h>
+#include <vif_interface.h>
+
+typedef struct _XENVIF_FDO          XENVIF_FDO, *PXENVIF_FDO;
+typedef struct _XENVIF_PDO          XENVIF_PDO, *PXENVIF_PDO;
+typedef struct _XENVIF_FRONTEND     XENVIF_FRONTEND, *PXENVIF_FRONTEND;
+typedef struct _XENVIF_TRANSMITTER  XENVIF_TRANSMITTER, *PXENVIF_TRANSMITTER;
+typedef struct _XENVIF_VIF_CONTEXT  XENVIF_VIF_CONTEXT, *PXENVIF_VIF_CONTEXT;
+typedef struct _XENVIF_THREAD       XENVIF_THREAD, *PXENVIF_THREAD;
+
+typedef NTSTATUS (*XENVIF_THREAD_FUNCTION)(PXENVIF_THREAD, PVOID);
+
+static PXENVIF_PDO          FrontendGetPdo(PXENVIF_FRONTEND);
+static PCHAR                FrontendGetPrefix(PXENVIF_FRONTEND);
+static PCHAR                FrontendGetPath(PXENVIF_FRONTEND);
+static PXENVIF_TRANSMITTER  FrontendGetTransmitter(PXENVIF_FRONTEND);
+static PXENVIF_FDO          PdoGetFdo(PXENVIF_PDO);
+static PETHERNET_ADDRESS    PdoGetPermanentAddress(PXENVIF_PDO);
+static PETHERNET_ADDRESS    PdoGetCurrentAddress(PXENVIF_PDO);
+static PXENVIF_VIF_CONTEXT  PdoGetVifContext(PXENVIF_PDO);
+static PXENVIF_THREAD       VifGetMacThread(PXENVIF_VIF_CONTEXT);
+static VOID                 FdoGetDebugInterface(PXENVIF_FDO, PXENBUS_DEBUG_INTERFACE);
+static VOID                 FdoGetStoreInterface(PXENVIF_FDO, PXENBUS_STORE_INTERFACE);
+static BOOLEAN              TransmitterHasMulticastControl(PXENVIF_TRANSMITTER);
+static NTSTATUS             TransmitterQueueMulticastControl(PXENVIF_TRANSMITTER,
+                                                             PETHERNET_ADDRESS,
+                                                             BOOLEAN);
+static NTSTATUS             ThreadCreate(XENVIF_THREAD_FUNCTION, PVOID, PXENVIF_THREAD *);
+static PKEVENT              ThreadGetEvent(PXENVIF_THREAD);
+static BOOLEAN              ThreadIsAlerted(PXENVIF_THREAD);
+static VOID                 ThreadWake(PXENVIF_THREAD);
+static VOID                 ThreadAlert(PXENVIF_THREAD);
+static VOID                 ThreadJoin(PXENVIF_THREAD);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+// MacApplyFilters() issues a barrier between picking up the table and
+// looking in it, which is where a reader can be made to stop
+static VOID TestBarrier(VOID);
+
+#undef  KeMemoryBarrier
+#define KeMemoryBarrier()   TestBarrier()
+
+#include "../src/xenvif/mac.c"
+
+#include "test.h"
+
+// Neighbours
+
+static ULONG    ControlAdded;
+static ULONG    ControlRemoved;
+
+static PXENVIF_PDO
+FrontendGetPdo(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return NULL;
+}
+
+static PCHAR
+FrontendGetPrefix(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return "device/vif/0";
+}
+
+static PCHAR
+FrontendGetPath(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return "backend/vif/0/0";
+}
+
+static PXENVIF_TRANSMITTER
+FrontendGetTransmitter(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    UNREFERENCED_PARAMETER(Frontend);
+    return NULL;
+}
+
+static PXENVIF_FDO
+PdoGetFdo(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    UNREFERENCED_PARAMETER(Pdo);
+    return NULL;
+}
+
+static PETHERNET_ADDRESS
+PdoGetPermanentAddress(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    UNREFERENCED_PARAMETER(Pdo);
+    abort();
+}
+
+static PETHERNET_ADDRESS
+PdoGetCurrentAddress(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    UNREFERENCED_PARAMETER(Pdo);
+    abort();
+}
+
+static PXENVIF_VIF_CONTEXT
+PdoGetVifContext(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    UNREFERENCED_PARAMETER(Pdo);
+    abort();
+}
+
+static PXENVIF_THREAD
+VifGetMacThread(
+    IN  PXENVIF_VIF_CONTEXT Context
+    )
+{
+    UNREFERENCED_PARAMETER(Context);
+    abort();
+}
+
+static VOID
+FdoGetDebugInterface(
+    IN  PXENVIF_FDO             Fdo,
+    OUT PXENBUS_DEBUG_INTERFACE Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    RtlZeroMemory(Interface, sizeof (XENBUS_DEBUG_INTERFACE));
+}
+
+static VOID
+FdoGetStoreInterface(
+    IN  PXENVIF_FDO             Fdo,
+    OUT PXENBUS_STORE_INTERFACE Interface
+    )
+{
+    UNREFERENCED_PARAMETER(Fdo);
+    RtlZeroMemory(Interface, sizeof (XENBUS_STORE_INTERFACE));
+}
+
+static BOOLEAN
+TransmitterHasMulticastControl(
+    IN  PXENVIF_TRANSMITTER Transmitter
+    )
+{
+    UNREFERENCED_PARAMETER(Transmitter);
+    return FALSE;
+}
+
+static NTSTATUS
+TransmitterQueueMulticastControl(
+    IN  PXENVIF_TRANSMITTER Transmitter,
+    IN  PETHERNET_ADDRESS   Address,
+    IN  BOOLEAN             Add
+    )
+{
+    UNREFERENCED_PARAMETER(Transmitter);
+
+    ASSERT(Address->Byte[0] & 0x01);
+
+    if (Add)
+        ControlAdded++;
+    else
+        ControlRemoved++;
+
+    return STATUS_SUCCESS;
+}
+
+// Threads
+
+struct _XENVIF_THREAD {
+    XENVIF_THREAD_FUNCTION  Function;
+    PVOID                   Context;
+    KEVENT                  Event;
+    BOOLEAN                 Alerted;
+    pthread_t               Thread;
+};
+
+static PVOID
+ThreadStart(
+    IN  PVOID       Argument
+    )
+{
+    PXENVIF_THREAD  Thread = Argument;
+
+    (VOID) Thread->Function(Thread, Thread->Context);
+    return NULL;
+}
+
+static NTSTATUS
+ThreadCreate(
+    IN  XENVIF_THREAD_FUNCTION  Function,
+    IN  PVOID                   Context,
+    OUT PXENVIF_THREAD          *Thread
+    )
+{
+    *Thread = calloc(1, sizeof (XENVIF_THREAD));
+    if (*Thread == NULL)
+        return STATUS_NO_MEMORY;
+
+    (*Thread)->Function = Function;
+    (*Thread)->Context = Context;
+    KeInitializeEvent(&(*Thread)->Event, NotificationEvent, FALSE);
+
+    if (pthread_create(&(*Thread)->Thread, NULL, ThreadStart, *Thread) != 0) {
+        free(*Thread);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static PKEVENT
+ThreadGetEvent(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    return &Thread->Event;
+}
+
+static BOOLEAN
+ThreadIsAlerted(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    return __atomic_load_n(&Thread->Alerted, __ATOMIC_SEQ_CST);
+}
+
+static VOID
+ThreadWake(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    KeSetEvent(&Thread->Event, IO_NO_INCREMENT, FALSE);
+}
+
+static VOID
+ThreadAlert(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    __atomic_store_n(&Thread->Alerted, TRUE, __ATOMIC_SEQ_CST);
+    ThreadWake(Thread);
+}
+
+static VOID
+ThreadJoin(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    (VOID) pthread_join(Thread->Thread, NULL);
+    free(Thread);
+}
+
+// Receive side readers. Each reader spends most of its time at
+// DISPATCH_LEVEL applying the filter and drops to PASSIVE_LEVEL between
+// batches, which is the only point at which a DPC could run on it. The
+// last one is the reader that holds on to a table.
+
+#define READERS 2
+#define HOLDER  READERS
+
+typedef struct _READER {
+    LONG        Dispatch;
+    ULONGLONG   Epoch;
+    ULONGLONG   Lookups;
+} READER, *PREADER;
+
+static READER       Reader[READERS + 1];
+static LONG         ReaderStop;
+static PXENVIF_MAC  ReaderMac;
+
+static LONG         CallDpcPending;
+
+VOID
+KeGenericCallDpc(
+    IN  PKDEFERRED_ROUTINE  Routine,
+    IN  PVOID               Context
+    )
+{
+    ULONGLONG               Epoch[READERS + 1];
+    KDPC                    Dpc;
+    ULONG                   Index;
+
+    for (Index = 0; Index <= READERS; Index++)
+        Epoch[Index] = __atomic_load_n(&Reader[Index].Epoch, __ATOMIC_SEQ_CST);
+
+    CallDpcPending = READERS + 1;
+    Dpc.DeferredRoutine = Routine;
+
+    for (Index = 0; Index <= READERS; Index++) {
+        KIRQL   Irql;
+
+        while (__atomic_load_n(&Reader[Index].Dispatch, __ATOMIC_SEQ_CST) &&
+               __atomic_load_n(&Reader[Index].Epoch, __ATOMIC_SEQ_CST) == Epoch[Index])
+            sched_yield();
+
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+        Routine(&Dpc, Context, &CallDpcPending, &CallDpcPending);
+        KeLowerIrql(Irql);
+    }
+
+    CHECK_EQ(CallDpcPending, 0);
+}
+
+LOGICAL
+KeSignalCallDpcSynchronize(
+    IN  PVOID   SystemArgument2
+    )
+{
+    ASSERT3P(SystemArgument2, ==, &CallDpcPending);
+    ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
+    return FALSE;
+}
+
+VOID
+KeSignalCallDpcDone(
+    IN  PVOID   SystemArgument1
+    )
+{
+    ASSERT3P(SystemArgument1, ==, &CallDpcPending);
+    ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
+    CallDpcPending--;
+}
+
+// The holder stops at the barrier until told to go on
+static __thread BOOLEAN HolderThread;
+static LONG             HolderState;
+
+#define HOLDER_IDLE     0
+#define HOLDER_HOLDING  1
+#define HOLDER_RELEASED 2
+
+static VOID
+TestBarrier(
+    VOID
+    )
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!HolderThread)
+        return;
+
+    __atomic_store_n(&HolderState, HOLDER_HOLDING, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&HolderState, __ATOMIC_SEQ_CST) != HOLDER_RELEASED)
+        sched_yield();
+}
+
+static VOID
+MakeAddress(
+    IN  ULONG               Value,
+    OUT PETHERNET_ADDRESS   Address
+    )
+{
+    // 01:00:5e:xx:xx:xx is the IPv4 multicast range
+    Address->Byte[0] = 0x01;
+    Address->Byte[1] = 0x00;
+    Address->Byte[2] = 0x5e;
+    Address->Byte[3] = (UCHAR)(Value >> 16) & 0x7f;
+    Address->Byte[4] = (UCHAR)(Value >> 8);
+    Address->Byte[5] = (UCHAR)Value;
+}
+
+static PVOID
+ReaderThread(
+    IN  PVOID   Argument
+    )
+{
+    PREADER     Self = Argument;
+    ULONGLONG   State = (ULONG_PTR)Argument;
+
+    while (!__atomic_load_n(&ReaderStop, __ATOMIC_SEQ_CST)) {
+        ULONG   Index;
+
+        HostIrql = DISPATCH_LEVEL;
+        __atomic_store_n(&Self->Dispatch, 1, __ATOMIC_SEQ_CST);
+
+        for (Index = 0; Index < 64; Index++) {
+            ETHERNET_ADDRESS    Address;
+
+            MakeAddress(TestRandom(&State) % 4096, &Address);
+            (VOID) MacApplyFilters(ReaderMac, &Address);
+            Self->Lookups++;
+        }
+
+        __atomic_store_n(&Self->Dispatch, 0, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&Self->Epoch, 1, __ATOMIC_SEQ_CST);
+        HostIrql = PASSIVE_LEVEL;
+    }
+
+    return NULL;
+}
+
+// Differential test
+
+#define POOL    4096
+
+typedef struct _MODEL {
+    BOOLEAN Present[POOL];
+    ULONG   Count;
+} MODEL, *PMODEL;
+
+static VOID
+Check(
+    IN  PXENVIF_MAC     Mac,
+    IN  PMODEL          Model
+    )
+{
+    static ETHERNET_ADDRESS Address[POOL];
+    ULONG                   Count;
+    ULONG                   Index;
+    KIRQL                   Irql;
+    NTSTATUS                status;
+
+    Count = 0;
+    status = MacQueryMulticastAddresses(Mac, NULL, &Count);
+    CHECK_EQ(status, STATUS_BUFFER_OVERFLOW);
+    CHECK_EQ(Count, Model->Count);
+
+    Count = POOL;
+    status = MacQueryMulticastAddresses(Mac, Address, &Count);
+    CHECK(NT_SUCCESS(status));
+    CHECK_EQ(Count, Model->Count);
+
+    for (Index = 0; Index < Count; Index++) {
+        ULONG   Value = ((ULONG)Address[Index].Byte[3] << 16) |
+                        ((ULONG)Address[Index].Byte[4] << 8) |
+                        Address[Index].Byte[5];
+
+        CHECK(Value < POOL && Model->Present[Value]);
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+
+    for (Index = 0; Index < POOL; Index++) {
+        ETHERNET_ADDRESS    Address;
+
+        MakeAddress(Index, &Address);
+        CHECK_EQ(MacApplyFilters(Mac, &Address), Model->Present[Index]);
+    }
+
+    KeLowerIrql(Irql);
+}
+
+static VOID
+RunSeed(
+    IN  PXENVIF_MAC     Mac,
+    IN  ULONGLONG       Seed
+    )
+{
+    static ETHERNET_ADDRESS List[POOL * 2];
+    MODEL                   Model;
+    ULONG                   Update;
+
+    RtlZeroMemory(&Model, sizeof (MODEL));
+
+    for (Update = 0; Update < 64; Update++) {
+        MODEL       Next;
+        ULONG       Count;
+        ULONG       Target;
+        ULONG       Added;
+        ULONG       Removed;
+        ULONG       Index;
+        NTSTATUS    status;
+
+        // Mostly small changes to the current list, sometimes a
+        // completely new one, with the odd duplicate thrown in.
+        RtlZeroMemory(&Next, sizeof (MODEL));
+        Target = TestRandom(&Seed) % ((Update % 8 == 0) ? POOL / 2 : 64);
+
+        if (TestRandom(&Seed) % 4 != 0) {
+            Next = Model;
+            for (Index = 0; Index < Target; Index++) {
+                ULONG   Value = TestRandom(&Seed) % POOL;
+
+                if (Next.Present[Value]) {
+                    Next.Present[Value] = FALSE;
+                    Next.Count--;
+                } else {
+                    Next.Present[Value] = TRUE;
+                    Next.Count++;
+                }
+            }
+        } else {
+            for (Index = 0; Index < Target; Index++) {
+                ULONG   Value = TestRandom(&Seed) % POOL;
+
+                if (!Next.Present[Value]) {
+                    Next.Present[Value] = TRUE;
+                    Next.Count++;
+                }
+            }
+        }
+
+        Count = 0;
+        for (Index = 0; Index < POOL; Index++) {
+            if (!Next.Present[Index])
+                continue;
+
+            MakeAddress(Index, &List[Count++]);
+            if (TestRandom(&Seed) % 16 == 0)
+                MakeAddress(Index, &List[Count++]);
+        }
+
+        // Shuffle so that the insertion order varies
+        for (Index = Count; Index > 1; Index--) {
+            ULONG               Other = TestRandom(&Seed) % Index;
+            ETHERNET_ADDRESS    Temp = List[Index - 1];
+
+            List[Index - 1] = List[Other];
+            List[Other] = Temp;
+        }
+
+        Added = Removed = 0;
+        for (Index = 0; Index < POOL; Index++) {
+            if (Next.Present[Index] && !Model.Present[Index])
+                Added++;
+            if (!Next.Present[Index] && Model.Present[Index])
+                Removed++;
+        }
+
+        ControlAdded = ControlRemoved = 0;
+
+        // Now and then the table allocation fails, which must leave
+        // everything as it was
+        if (TestRandom(&Seed) % 8 == 0 && Count != 0) {
+            HostPoolFailCount = 1;
+            status = MacSetMulticastAddresses(Mac, List, Count);
+            HostPoolFailCount = 0;
+
+            CHECK(!NT_SUCCESS(status));
+            CHECK_EQ(ControlAdded, 0);
+            CHECK_EQ(ControlRemoved, 0);
+            Check(Mac, &Model);
+        }
+
+        status = MacSetMulticastAddresses(Mac, List, Count);
+        CHECK(NT_SUCCESS(status));
+        CHECK_EQ(ControlAdded, Added);
+        CHECK_EQ(ControlRemoved, Removed);
+
+        Model = Next;
+        Check(Mac, &Model);
+
+        if (TestFailures != 0) {
+            fprintf(stderr, "failed at update %u\n", Update);
+            break;
+        }
+    }
+
+    ControlAdded = ControlRemoved = 0;
+
+    CHECK(NT_SUCCESS(MacSetMulticastAddresses(Mac, NULL, 0)));
+    CHECK_EQ(ControlAdded, 0);
+    CHECK_EQ(ControlRemoved, Model.Count);
+    CHECK(Mac->MulticastTable == NULL);
+}
+
+// A table that is replaced while a reader is part way through a lookup
+// in it must not be freed until that reader is done
+
+static PVOID
+HolderThreadFunction(
+    IN  PVOID           Argument
+    )
+{
+    PETHERNET_ADDRESS   Address = Argument;
+    PREADER             Self = &Reader[HOLDER];
+    KIRQL               Irql;
+    BOOLEAN             Allow;
+
+    // A thread that raises itself, as the receiver does, rather than a DPC
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    __atomic_store_n(&Self->Dispatch, 1, __ATOMIC_SEQ_CST);
+
+    HolderThread = TRUE;
+    Allow = MacApplyFilters(ReaderMac, Address);
+    HolderThread = FALSE;
+
+    __atomic_store_n(&Self->Dispatch, 0, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&Self->Epoch, 1, __ATOMIC_SEQ_CST);
+    KeLowerIrql(Irql);
+
+    return (PVOID)(ULONG_PTR)Allow;
+}
+
+static ULONG
+RetiredCount(
+    IN  PXENVIF_MAC Mac
+    )
+{
+    KIRQL           Irql;
+    ULONG           Count;
+
+    KeAcquireSpinLock(&Mac->Lock, &Irql);
+    Count = Mac->MulticastRetired;
+    KeReleaseSpinLock(&Mac->Lock, Irql);
+
+    return Count;
+}
+
+static VOID
+WaitForReap(
+    IN  PXENVIF_MAC Mac,
+    IN  ULONGLONG   Timeout
+    )
+{
+    ULONGLONG       Start = TestNow();
+
+    while (RetiredCount(Mac) != 0 && TestNow() - Start < Timeout)
+        sched_yield();
+}
+
+static VOID
+RetireHeld(
+    IN  PXENVIF_MAC     Mac
+    )
+{
+    ETHERNET_ADDRESS    Address[2];
+    pthread_t           Thread;
+    PVOID               Allow;
+    NTSTATUS            status;
+
+    MakeAddress(1, &Address[0]);
+    MakeAddress(2, &Address[1]);
+
+    status = MacSetMulticastAddresses(Mac, &Address[0], 1);
+    CHECK(NT_SUCCESS(status));
+
+    WaitForReap(Mac, 10000000000ull);
+    CHECK_EQ(RetiredCount(Mac), 0);
+
+    ReaderMac = Mac;
+    HolderState = HOLDER_IDLE;
+    (VOID) pthread_create(&Thread, NULL, HolderThreadFunction, &Address[0]);
+
+    while (__atomic_load_n(&HolderState, __ATOMIC_SEQ_CST) != HOLDER_HOLDING)
+        sched_yield();
+
+    // Replace the table the holder has picked up and give the retire
+    // thread ample time to free it if it is going to
+    status = MacSetMulticastAddresses(Mac, &Address[1], 1);
+    CHECK(NT_SUCCESS(status));
+
+    WaitForReap(Mac, 100000000ull);
+    CHECK_EQ(RetiredCount(Mac), 1);
+
+    __atomic_store_n(&HolderState, HOLDER_RELEASED, __ATOMIC_SEQ_CST);
+    (VOID) pthread_join(Thread, &Allow);
+
+    // The holder saw the old list
+    CHECK(Allow != NULL);
+
+    WaitForReap(Mac, 10000000000ull);
+    CHECK_EQ(RetiredCount(Mac), 0);
+
+    CHECK(NT_SUCCESS(MacSetMulticastAddresses(Mac, NULL, 0)));
+}
+
+// Benchmark
+
+static VOID
+Benchmark(
+    IN  PXENVIF_MAC     Mac,
+    IN  ULONG           Groups
+    )
+{
+    static ETHERNET_ADDRESS List[1024];
+    ULONGLONG               Start;
+    ULONGLONG               Whole;
+    ULONGLONG               Incremental;
+    ULONGLONG               Lookup;
+    ULONG                   Rounds;
+    ULONG                   Round;
+    ULONG                   Index;
+    KIRQL                   Irql;
+    ULONG                   Hits;
+
+    ASSERT3U(Groups, <=, ARRAYSIZE(List));
+
+    for (Index = 0; Index < Groups; Index++)
+        MakeAddress(Index * 7919, &List[Index]);
+
+    Rounds = (Groups >= 1024) ? 16 : 256;
+
+    // The whole list as one update, as the stack hands it down
+    Start = TestNow();
+    for (Round = 0; Round < Rounds; Round++) {
+        (VOID) MacSetMulticastAddresses(Mac, List, Groups);
+        (VOID) MacSetMulticastAddresses(Mac, NULL, 0);
+    }
+    Whole = (TestNow() - Start) / Rounds;
+
+    // One address at a time, each change being its own update
+    Start = TestNow();
+    for (Round = 0; Round < Rounds; Round++) {
+        for (Index = 1; Index <= Groups; Index++)
+            (VOID) MacSetMulticastAddresses(Mac, List, Index);
+        (VOID) MacSetMulticastAddresses(Mac, NULL, 0);
+    }
+    Incremental = (TestNow() - Start) / Rounds;
+
+    (VOID) MacSetMulticastAddresses(Mac, List, Groups);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+
+    Hits = 0;
+    Start = TestNow();
+    for (Round = 0; Round < 1000000; Round++) {
+        ETHERNET_ADDRESS    Address;
+
+        // Alternate between members and non-members
+        MakeAddress((Round / 2) % Groups * 7919 + (Round & 1), &Address);
+        Hits += MacApplyFilters(Mac, &Address);
+    }
+    Lookup = TestNow() - Start;
+
+    KeLowerIrql(Irql);
+
+    CHECK_EQ(Hits, 500000);
+
+    (VOID) MacSetMulticastAddresses(Mac, NULL, 0);
+
+    printf("%5u groups: update %9llu ns  one-at-a-time %11llu ns  lookup %3llu.%llu ns\n",
+           Groups,
+           Whole,
+           Incremental,
+           Lookup / 1000000,
+           (Lookup / 100000) % 10);
+}
+
+int
+main(
+    int         argc,
+    char        **argv
+    )
+{
+    PXENVIF_MAC Mac;
+    pthread_t   Thread[READERS];
+    ULONG       Seeds;
+    ULONGLONG   Seed;
+    ULONG       Index;
+    BOOLEAN     Bench;
+    NTSTATUS    status;
+
+    Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+    Seeds = (argc > 1 && !Bench) ? (ULONG)strtoul(argv[1], NULL, 0) : 50;
+
+    status = MacInitialize(NULL, &Mac);
+    CHECK(NT_SUCCESS(status));
+
+    Mac->FilterLevel[ETHERNET_ADDRESS_MULTICAST] = XENVIF_MAC_FILTER_MATCHING;
+
+    ReaderMac = Mac;
+    for (Index = 0; Index < READERS; Index++)
+        (VOID) pthread_create(&Thread[Index], NULL, ReaderThread, &Reader[Index]);
+
+    for (Seed = 1; Seed <= Seeds && TestFailures == 0; Seed++)
+        RunSeed(Mac, Seed);
+
+    __atomic_store_n(&ReaderStop, 1, __ATOMIC_SEQ_CST);
+    for (Index = 0; Index < READERS; Index++)
+        (VOID) pthread_join(Thread[Index], NULL);
+
+    if (TestFailures == 0)
+        RetireHeld(Mac);
+
+    if (Bench) {
+        Benchmark(Mac, 1);
+        Benchmark(Mac, 64);
+        Benchmark(Mac, 1024);
+    }
+
+    Mac->FilterLevel[ETHERNET_ADDRESS_MULTICAST] = XENVIF_MAC_FILTER_NONE;
+    MacTeardown(Mac);
+
+    CHECK_EQ(HostPoolAllocations, 0);
+
+    return TEST_RESULT("mac");
+}
@@ -0,0 +1,1062 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host test for the header split in receiver.c.
+//
+// Random Ethernet frames, over IPv4 (with options) and IPv6 (with
+// destination options of up to 320 bytes), carrying TCP (with options)
+// or UDP, are laid out in a chain of receive fragments cut at random
+// points, often inside the headers. __ReceiverRingSplitHeader() must
+// either copy the headers into a small header buffer, trimming the
+// fragments in place without moving any payload, or give up with the
+// fragment chain exactly as it was so that the full-page pullup can
+// still parse the frame. Headers that do not fit the header buffer,
+// LLC/SNAP frames and a large IP alignment offset must take the second
+// path. Every packet is returned to its cache at the end so that leaks
+// and double frees show up in the pool count or under -fsanitize=address.
+
+#include <ntddk.h>
+
+#include "dbg_print.h"
+#include "assert.h"
+
+// Keep the driver's own headers for the receiver's neighbours out of
+// the way; the declarations receiver.c needs are provided below.
+#define _XENVIF_DRIVER_H
+#define _XENVIF_PDO_H
+#define _XENVIF_FRONTEND_H
+#define _XENVIF_MAC_H
+#define _XENVIF_TRANSMITTER_H
+#define _XENVIF_VIF_H
+#define _XENVIF_THREAD_H
+#define _XENVIF_REGISTRY_H
+
+#include <ethernet.h>
+#include <tcpip.h>
+#include <debug_interface.h>
+#include <store_interface.h>
+#include <cache_interface.h>
+#include <gnttab_interface.h>
+#include <vif_interface.h>
+
+typedef struct _XENVIF_FDO          XENVIF_FDO, *PXENVIF_FDO;
+typedef struct _XENVIF_PDO          XENVIF_PDO, *PXENVIF_PDO;
+typedef struct _XENVIF_FRONTEND     XENVIF_FRONTEND, *PXENVIF_FRONTEND;
+typedef struct _XENVIF_MAC          XENVIF_MAC, *PXENVIF_MAC;
+typedef struct _XENVIF_VIF_CONTEXT  XENVIF_VIF_CONTEXT, *PXENVIF_VIF_CONTEXT;
+typedef struct _XENVIF_THREAD       XENVIF_THREAD, *PXENVIF_THREAD;
+
+typedef NTSTATUS (*XENVIF_THREAD_FUNCTION)(PXENVIF_THREAD, PVOID);
+
+#include "poller.h"
+
+static HANDLE               DriverGetParametersKey(VOID);
+static VOID                 FdoGetDebugInterface(PXENVIF_FDO, PXENBUS_DEBUG_INTERFACE);
+static VOID                 FdoGetStoreInterface(PXENVIF_FDO, PXENBUS_STORE_INTERFACE);
+static VOID                 FdoGetCacheInterface(PXENVIF_FDO, PXENBUS_CACHE_INTERFACE);
+static VOID                 FdoGetGnttabInterface(PXENVIF_FDO, PXENBUS_GNTTAB_INTERFACE);
+static PCHAR                FrontendFormatPath(PXENVIF_FRONTEND, ULONG);
+static VOID                 FrontendFreePath(PXENVIF_FRONTEND, PCHAR);
+static USHORT               FrontendGetBackendDomain(PXENVIF_FRONTEND);
+static PXENVIF_MAC          FrontendGetMac(PXENVIF_FRONTEND);
+static ULONG                FrontendGetMaxQueues(PXENVIF_FRONTEND);
+static ULONG                FrontendGetNumQueues(PXENVIF_FRONTEND);
+static PCHAR                FrontendGetPath(PXENVIF_FRONTEND);
+static PXENVIF_PDO          FrontendGetPdo(PXENVIF_FRONTEND);
+static PXENVIF_POLLER       FrontendGetPoller(PXENVIF_FRONTEND);
+static VOID                 FrontendIncrementStatistic(PXENVIF_FRONTEND,
+                                                       XENVIF_VIF_STATISTIC,
+                                                       ULONGLONG);
+static NTSTATUS             FrontendQueryHashTypes(PXENVIF_FRONTEND, PULONG);
+static NTSTATUS             FrontendSetHashAlgorithm(PXENVIF_FRONTEND,
+                                                     XENVIF_PACKET_HASH_ALGORITHM);
+static NTSTATUS             FrontendSetHashKey(PXENVIF_FRONTEND, PUCHAR);
+static NTSTATUS             FrontendSetHashMapping(PXENVIF_FRONTEND, PULONG, ULONG);
+static NTSTATUS             FrontendSetHashTypes(PXENVIF_FRONTEND, ULONG);
+static BOOLEAN              MacApplyFilters(PXENVIF_MAC, PETHERNET_ADDRESS);
+static VOID                 MacQueryMaximumFrameSize(PXENVIF_MAC, PULONG);
+static PXENVIF_FDO          PdoGetFdo(PXENVIF_PDO);
+static PXENVIF_VIF_CONTEXT  PdoGetVifContext(PXENVIF_PDO);
+static NTSTATUS             RegistryQueryDwordValue(HANDLE, PCHAR, PULONG);
+static NTSTATUS             ThreadCreate(XENVIF_THREAD_FUNCTION, PVOID, PXENVIF_THREAD *);
+static PKEVENT              ThreadGetEvent(PXENVIF_THREAD);
+static BOOLEAN              ThreadIsAlerted(PXENVIF_THREAD);
+static VOID                 ThreadAlert(PXENVIF_THREAD);
+static VOID                 ThreadJoin(PXENVIF_THREAD);
+static VOID                 VifReceiverQueuePacket(PXENVIF_VIF_CONTEXT,
+                                                   ULONG,
+                                                   PMDL,
+                                                   ULONG,
+                                                   ULONG,
+                                                   XENVIF_PACKET_CHECKSUM_FLAGS,
+                                                   USHORT,
+                                                   USHORT,
+                                                   PXENVIF_PACKET_INFO,
+                                                   PXENVIF_PACKET_HASH,
+                                                   BOOLEAN,
+                                                   PVOID);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_CACHE
+#define XENBUS_CACHE(_Method, _Interface, ...)    \
+    (_Interface)->Cache ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_GNTTAB
+#define XENBUS_GNTTAB(_Method, _Interface, ...)    \
+    (_Interface)->Gnttab ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenvif/checksum.c"
+#include "../src/xenvif/parse.c"
+#include "../src/xenvif/receiver.c"
+
+#include "test.h"
+
+// Neighbours; nothing on the header split path reaches these
+
+static HANDLE
+DriverGetParametersKey(
+    VOID
+    )
+{
+    abort();
+}
+
+#define DEFINE_FDO_GET_INTERFACE(_Interface, _Type) \
+static VOID                                         \
+FdoGet ## _Interface ## Interface(                  \
+    IN  PXENVIF_FDO Fdo,                            \
+    OUT _Type       Interface                       \
+    )                                               \
+{                                                   \
+    UNREFERENCED_PARAMETER(Fdo);                    \
+    UNREFERENCED_PARAMETER(Interface);              \
+    abort();                                        \
+}
+
+DEFINE_FDO_GET_INTERFACE(Debug, PXENBUS_DEBUG_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(Store, PXENBUS_STORE_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(Cache, PXENBUS_CACHE_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(Gnttab, PXENBUS_GNTTAB_INTERFACE)
+
+static PCHAR
+FrontendFormatPath(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Index
+    )
+{
+    abort();
+}
+
+static VOID
+FrontendFreePath(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  PCHAR               Path
+    )
+{
+    abort();
+}
+
+static USHORT
+FrontendGetBackendDomain(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PXENVIF_MAC
+FrontendGetMac(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static ULONG
+FrontendGetMaxQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static ULONG
+FrontendGetNumQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PCHAR
+FrontendGetPath(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PXENVIF_PDO
+FrontendGetPdo(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PXENVIF_POLLER
+FrontendGetPoller(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static VOID
+FrontendIncrementStatistic(
+    IN  PXENVIF_FRONTEND        Frontend,
+    IN  XENVIF_VIF_STATISTIC    Index,
+    IN  ULONGLONG               Delta
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+FrontendQueryHashTypes(
+    IN  PXENVIF_FRONTEND    Frontend,
+    OUT PULONG              Types
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+FrontendSetHashAlgorithm(
+    IN  PXENVIF_FRONTEND                Frontend,
+    IN  XENVIF_PACKET_HASH_ALGORITHM    Algorithm
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+FrontendSetHashKey(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  PUCHAR              Key
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+FrontendSetHashMapping(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  PULONG              Mapping,
+    IN  ULONG               Order
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+FrontendSetHashTypes(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Types
+    )
+{
+    abort();
+}
+
+static BOOLEAN
+MacApplyFilters(
+    IN  PXENVIF_MAC         Mac,
+    IN  PETHERNET_ADDRESS   DestinationAddress
+    )
+{
+    abort();
+}
+
+static VOID
+MacQueryMaximumFrameSize(
+    IN  PXENVIF_MAC Mac,
+    OUT PULONG      Size
+    )
+{
+    abort();
+}
+
+static PXENVIF_FDO
+PdoGetFdo(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    abort();
+}
+
+static PXENVIF_VIF_CONTEXT
+PdoGetVifContext(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    abort();
+}
+
+NTSTATUS
+PollerSend(
+    IN  PXENVIF_POLLER              Poller,
+    IN  ULONG                       Index,
+    IN  XENVIF_POLLER_EVENT_TYPE    Event
+    )
+{
+    abort();
+}
+
+NTSTATUS
+PollerTrigger(
+    IN  PXENVIF_POLLER              Poller,
+    IN  ULONG                       Index,
+    IN  XENVIF_POLLER_EVENT_TYPE    Event
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+RegistryQueryDwordValue(
+    IN  HANDLE  Key,
+    IN  PCHAR   Name,
+    OUT PULONG  Value
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+ThreadCreate(
+    IN  XENVIF_THREAD_FUNCTION  Function,
+    IN  PVOID                   Context,
+    OUT PXENVIF_THREAD          *Thread
+    )
+{
+    abort();
+}
+
+static PKEVENT
+ThreadGetEvent(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static BOOLEAN
+ThreadIsAlerted(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static VOID
+ThreadAlert(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static VOID
+ThreadJoin(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static VOID
+VifReceiverQueuePacket(
+    IN  PXENVIF_VIF_CONTEXT             Context,
+    IN  ULONG                           Index,
+    IN  PMDL                            Mdl,
+    IN  ULONG                           Offset,
+    IN  ULONG                           Length,
+    IN  XENVIF_PACKET_CHECKSUM_FLAGS    Flags,
+    IN  USHORT                          MaximumSegmentSize,
+    IN  USHORT                          TagControlInformation,
+    IN  PXENVIF_PACKET_INFO             Info,
+    IN  PXENVIF_PACKET_HASH             Hash,
+    IN  BOOLEAN                         More,
+    IN  PVOID                           Cookie
+    )
+{
+    abort();
+}
+
+// Every unused driver entry point above must still link
+BOOLEAN RtlIsNtDdiVersionAvailable(ULONG Version) { abort(); }
+NTSTATUS KeGetProcessorNumberFromIndex(ULONG Index, PPROCESSOR_NUMBER Number) { abort(); }
+ULONG KeGetProcessorIndexFromNumber(PPROCESSOR_NUMBER Number) { abort(); }
+VOID KeSetSystemGroupAffinityThread(PGROUP_AFFINITY New, PGROUP_AFFINITY Old) { abort(); }
+
+// Pages and MDLs, as the packet and header constructors use them
+
+PMDL
+MmAllocatePagesForMdlEx(
+    IN  PHYSICAL_ADDRESS    LowAddress,
+    IN  PHYSICAL_ADDRESS    HighAddress,
+    IN  PHYSICAL_ADDRESS    SkipBytes,
+    IN  SIZE_T              TotalBytes,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  ULONG               Flags
+    )
+{
+    PMDL                    Mdl;
+    PVOID                   Va;
+
+    Mdl = __AllocatePoolWithTag(NonPagedPool,
+                                sizeof (MDL) + sizeof (PFN_NUMBER),
+                                'TSET');
+    if (Mdl == NULL)
+        return NULL;
+
+    ASSERT3U(TotalBytes, ==, PAGE_SIZE);
+    if (posix_memalign(&Va, PAGE_SIZE, PAGE_SIZE) != 0) {
+        __FreePoolWithTag(Mdl, 'TSET');
+        return NULL;
+    }
+
+    Mdl->StartVa = Va;
+    Mdl->ByteCount = PAGE_SIZE;
+    MmGetMdlPfnArray(Mdl)[0] = (PFN_NUMBER)((ULONG_PTR)Va >> PAGE_SHIFT);
+
+    return Mdl;
+}
+
+PVOID
+MmMapLockedPagesSpecifyCache(
+    IN  PMDL                Mdl,
+    IN  KPROCESSOR_MODE     AccessMode,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  PVOID               BaseAddress,
+    IN  ULONG               BugCheckOnFailure,
+    IN  ULONG               Priority
+    )
+{
+    Mdl->MdlFlags |= MDL_MAPPED_TO_SYSTEM_VA;
+    Mdl->MappedSystemVa = Mdl->StartVa;
+
+    return Mdl->MappedSystemVa;
+}
+
+VOID
+MmUnmapLockedPages(
+    IN  PVOID   BaseAddress,
+    IN  PMDL    Mdl
+    )
+{
+    ASSERT3P(BaseAddress, ==, Mdl->MappedSystemVa);
+
+    Mdl->MdlFlags &= ~MDL_MAPPED_TO_SYSTEM_VA;
+    Mdl->MappedSystemVa = NULL;
+}
+
+VOID
+MmFreePagesFromMdl(
+    IN  PMDL    Mdl
+    )
+{
+    free(Mdl->StartVa);
+}
+
+PMDL
+IoAllocateMdl(
+    IN  PVOID   VirtualAddress,
+    IN  ULONG   Length,
+    IN  BOOLEAN SecondaryBuffer,
+    IN  BOOLEAN ChargeQuota,
+    IN  PVOID   Irp
+    )
+{
+    PMDL        Mdl;
+
+    // A single page is all the header buffers need
+    ASSERT3U(BYTE_OFFSET(VirtualAddress) + Length, <=, PAGE_SIZE);
+
+    Mdl = __AllocatePoolWithTag(NonPagedPool,
+                                sizeof (MDL) + sizeof (PFN_NUMBER),
+                                'TSET');
+    if (Mdl == NULL)
+        return NULL;
+
+    Mdl->StartVa = PAGE_ALIGN(VirtualAddress);
+    Mdl->ByteOffset = BYTE_OFFSET(VirtualAddress);
+    Mdl->ByteCount = Length;
+
+    return Mdl;
+}
+
+VOID
+MmBuildMdlForNonPagedPool(
+    IN  PMDL    Mdl
+    )
+{
+    Mdl->MdlFlags |= MDL_SOURCE_IS_NONPAGED_POOL;
+    Mdl->MappedSystemVa = (PUCHAR)Mdl->StartVa + Mdl->ByteOffset;
+    MmGetMdlPfnArray(Mdl)[0] = (PFN_NUMBER)((ULONG_PTR)Mdl->StartVa >> PAGE_SHIFT);
+}
+
+VOID
+IoFreeMdl(
+    IN  PMDL    Mdl
+    )
+{
+    __FreePoolWithTag(Mdl, 'TSET');
+}
+
+// The packet and header caches: objects are built and destroyed by the
+// real constructors on every Get and Put, and counted.
+
+static XENVIF_RECEIVER      Receiver;
+static XENVIF_RECEIVER_RING Ring;
+
+static LONG                 PacketsOutstanding;
+static LONG                 HeadersOutstanding;
+
+static PVOID
+CacheGet(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache,
+    IN  BOOLEAN         Locked
+    )
+{
+    BOOLEAN             Header = (Cache == Ring.HeaderCache);
+    PVOID               Object;
+    NTSTATUS            status;
+
+    Object = __ReceiverAllocate(sizeof (XENVIF_RECEIVER_PACKET));
+    if (Object == NULL)
+        return NULL;
+
+    status = (Header) ?
+             ReceiverHeaderCtor(&Ring, Object) :
+             ReceiverPacketCtor(&Ring, Object);
+    if (!NT_SUCCESS(status)) {
+        __ReceiverFree(Object);
+        return NULL;
+    }
+
+    if (Header)
+        HeadersOutstanding++;
+    else
+        PacketsOutstanding++;
+
+    return Object;
+}
+
+static VOID
+CachePut(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache,
+    IN  PVOID           Object,
+    IN  BOOLEAN         Locked
+    )
+{
+    if (Cache == Ring.HeaderCache) {
+        ReceiverHeaderDtor(&Ring, Object);
+        --HeadersOutstanding;
+    } else {
+        ReceiverPacketDtor(&Ring, Object);
+        --PacketsOutstanding;
+    }
+
+    __ReceiverFree(Object);
+}
+
+static VOID
+Setup(
+    VOID
+    )
+{
+    Receiver.CacheInterface.CacheGet = CacheGet;
+    Receiver.CacheInterface.CachePut = CachePut;
+    Receiver.SplitHeaders = 1;
+
+    Ring.Receiver = &Receiver;
+
+    // Only the handles are compared
+    Ring.PacketCache = (PXENBUS_CACHE)&Ring.PacketCache;
+    Ring.HeaderCache = (PXENBUS_CACHE)&Ring.HeaderCache;
+}
+
+// Frame construction
+
+static VOID
+PutShort(
+    IN  PUCHAR  Va,
+    IN  ULONG   Value
+    )
+{
+    Va[0] = (UCHAR)(Value >> 8);
+    Va[1] = (UCHAR)Value;
+}
+
+#define ETH_LENGTH      14
+#define FRAME_SIZE      (3 * PAGE_SIZE)
+
+typedef struct _FRAME {
+    UCHAR   Data[FRAME_SIZE];
+    ULONG   Length;
+    ULONG   HeaderLength;
+    BOOLEAN LLC;
+} FRAME, *PFRAME;
+
+static VOID
+BuildFrame(
+    IN OUT  PULONGLONG  Seed,
+    OUT     PFRAME      Frame
+    )
+{
+    PUCHAR              Va = Frame->Data;
+    UCHAR               IpVersion;
+    UCHAR               Protocol;
+    ULONG               IpOffset;
+    ULONG               Offset;
+    ULONG               Options;
+    ULONG               PayloadLength;
+    ULONG               Index;
+
+    memset(Frame, 0, sizeof (FRAME));
+
+    IpVersion = (TestRandom(Seed) & 1) ? 6 : 4;
+    Protocol = (TestRandom(Seed) & 1) ? IPPROTO_UDP : IPPROTO_TCP;
+    Frame->LLC = (IpVersion == 4 && TestRandom(Seed) % 16 == 0);
+
+    for (Index = 0; Index < 12; Index++)
+        Va[Index] = (UCHAR)TestRandom(Seed);
+    Offset = ETH_LENGTH;
+
+    if (Frame->LLC) {
+        // 802.3 length rather than a type, then LLC/SNAP
+        Va[Offset++] = 0xAA;
+        Va[Offset++] = 0xAA;
+        Va[Offset++] = 0x03;
+        Va[Offset++] = 0;
+        Va[Offset++] = 0;
+        Va[Offset++] = 0;
+        PutShort(Va + Offset, ETHERTYPE_IPV4);
+        Offset += 2;
+    } else {
+        PutShort(Va + 12, (IpVersion == 4) ? ETHERTYPE_IPV4 : ETHERTYPE_IPV6);
+    }
+
+    IpOffset = Offset;
+
+    if (IpVersion == 4) {
+        Options = (TestRandom(Seed) % 2 == 0) ? (TestRandom(Seed) % 11) * 4 : 0;
+
+        Va[Offset] = 0x40 | (UCHAR)((20 + Options) / 4);
+        Va[Offset + 8] = 64;
+        Va[Offset + 9] = Protocol;
+        for (Index = 12; Index < 20; Index++)
+            Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+        memset(Va + Offset + 20, 0x01, Options);        // NOPs
+
+        Offset += 20 + Options;
+    } else {
+        ULONG   Extension;
+
+        // Up to 320 bytes, enough to overflow the header buffer
+        Extension = (TestRandom(Seed) % 2 == 0) ? 8 * (1 + TestRandom(Seed) % 40) : 0;
+
+        Va[Offset] = 0x60;
+        Va[Offset + 6] = (Extension != 0) ? IPPROTO_DSTOPTS : Protocol;
+        Va[Offset + 7] = 64;
+        for (Index = 8; Index < 40; Index++)
+            Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+        Offset += 40;
+
+        if (Extension != 0) {
+            Va[Offset] = Protocol;
+            Va[Offset + 1] = (UCHAR)(Extension / 8 - 1);
+            Va[Offset + 2] = 1;                         // PadN
+            Va[Offset + 3] = (UCHAR)(Extension - 4);
+            Offset += Extension;
+        }
+    }
+
+    if (Protocol == IPPROTO_TCP) {
+        Options = (TestRandom(Seed) % 2 == 0) ? (TestRandom(Seed) % 11) * 4 : 0;
+
+        for (Index = 0; Index < 12; Index++)
+            Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+        Va[Offset + 12] = (UCHAR)(((20 + Options) / 4) << 4);
+        Va[Offset + 13] = 0x10;                         // ACK
+        memset(Va + Offset + 20, 0x01, Options);
+
+        Offset += 20 + Options;
+    } else {
+        for (Index = 0; Index < 8; Index++)
+            Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+
+        Offset += 8;
+    }
+
+    // The parser stops at an LLC/SNAP header
+    Frame->HeaderLength = (Frame->LLC) ? ETH_LENGTH + sizeof (LLC_SNAP_HEADER) : Offset;
+
+    PayloadLength = TestRandom(Seed) % ((TestRandom(Seed) & 1 || Frame->LLC) ? 64 : 2 * PAGE_SIZE);
+    for (Index = 0; Index < PayloadLength; Index++)
+        Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+
+    Frame->Length = Offset + PayloadLength;
+
+    if (Frame->LLC)
+        PutShort(Va + 12, Frame->Length - ETH_LENGTH);
+
+    if (IpVersion == 4)
+        PutShort(Va + IpOffset + 2, Frame->Length - IpOffset);
+    else
+        PutShort(Va + IpOffset + 4, Frame->Length - IpOffset - 40);
+}
+
+// Lay the frame out as the ring would: a packet for the first fragment
+// and the MDLs of further packets for the rest, each at the start of its
+// own page.
+
+#define MAXIMUM_FRAGMENTS   64
+
+typedef struct _FRAGMENTS {
+    PXENVIF_RECEIVER_PACKET Packet[MAXIMUM_FRAGMENTS];
+    ULONG                   Start[MAXIMUM_FRAGMENTS];
+    MDL                     Mdl[MAXIMUM_FRAGMENTS];
+    UCHAR                   Data[MAXIMUM_FRAGMENTS][PAGE_SIZE];
+    ULONG                   Count;
+} FRAGMENTS, *PFRAGMENTS;
+
+static VOID
+BuildFragments(
+    IN OUT  PULONGLONG  Seed,
+    IN      PFRAME      Frame,
+    OUT     PFRAGMENTS  Fragments
+    )
+{
+    ULONG               Start;
+    ULONG               Index;
+
+    Start = 0;
+    Index = 0;
+
+    while (Start < Frame->Length) {
+        PXENVIF_RECEIVER_PACKET Packet;
+        ULONG                   Size;
+
+        ASSERT3U(Index, <, MAXIMUM_FRAGMENTS);
+
+        // Cut the headers into small pieces and the rest at random
+        if (Start < Frame->HeaderLength && TestRandom(Seed) % 4 != 0)
+            Size = 1 + TestRandom(Seed) % 24;
+        else if (TestRandom(Seed) % 4 == 0)
+            Size = (Start < Frame->HeaderLength) ?
+                   Frame->HeaderLength - Start :
+                   1 + TestRandom(Seed) % PAGE_SIZE;
+        else
+            Size = PAGE_SIZE;
+
+        Size = __min(Size, Frame->Length - Start);
+
+        Packet = __ReceiverRingGetPacket(&Ring, TRUE);
+        ASSERT(Packet != NULL);
+
+        memcpy(Packet->Mdl.MappedSystemVa, Frame->Data + Start, Size);
+        Packet->Mdl.ByteCount = Size;
+
+        if (Index != 0)
+            Fragments->Packet[Index - 1]->Mdl.Next = &Packet->Mdl;
+
+        Fragments->Packet[Index] = Packet;
+        Fragments->Start[Index] = Start;
+
+        Start += Size;
+        Index++;
+    }
+
+    Fragments->Count = Index;
+    Fragments->Packet[0]->Length = Frame->Length;
+}
+
+// Remember each fragment's MDL and data to show later that nothing moved
+static VOID
+SnapshotFragments(
+    IN  PFRAGMENTS  Fragments
+    )
+{
+    ULONG           Index;
+
+    for (Index = 0; Index < Fragments->Count; Index++) {
+        PMDL    Mdl = &Fragments->Packet[Index]->Mdl;
+
+        Fragments->Mdl[Index] = *Mdl;
+        memcpy(Fragments->Data[Index], Mdl->MappedSystemVa, Mdl->ByteCount);
+    }
+}
+
+static VOID
+CheckPayload(
+    IN  PFRAME                  Frame,
+    IN  PXENVIF_PACKET_PAYLOAD  Payload,
+    IN  ULONG                   Start
+    )
+{
+    PMDL                        Mdl = Payload->Mdl;
+    ULONG                       Offset = Payload->Offset;
+    ULONG                       Length = Payload->Length;
+
+    CHECK_EQ(Start + Length, Frame->Length);
+
+    while (Length != 0) {
+        ULONG   Size;
+
+        if (Mdl == NULL) {
+            CHECK(Mdl != NULL);
+            return;
+        }
+
+        Size = __min(Mdl->ByteCount - Offset, Length);
+
+        CHECK(memcmp((PUCHAR)Mdl->MappedSystemVa + Offset,
+                     Frame->Data + Start,
+                     Size) == 0);
+
+        Start += Size;
+        Length -= Size;
+
+        Mdl = Mdl->Next;
+        Offset = 0;
+    }
+
+    CHECK(Mdl == NULL);
+}
+
+static VOID
+PutChain(
+    IN  PMDL    Mdl
+    )
+{
+    while (Mdl != NULL) {
+        PMDL    Next;
+
+        Next = Mdl->Next;
+        Mdl->Next = NULL;
+
+        __ReceiverRingPutMdl(&Ring, Mdl, TRUE);
+
+        Mdl = Next;
+    }
+}
+
+static VOID
+TestSplit(
+    IN  ULONG       Iterations,
+    IN  ULONG       IpAlignOffset
+    )
+{
+    static FRAME        Frame;
+    static FRAGMENTS    Fragments;
+    ULONGLONG           Seed = 0x5b1 + IpAlignOffset;
+    LONG                Allocations;
+    ULONG               Split;
+    ULONG               PulledUp;
+    ULONG               Iteration;
+
+    Receiver.IpAlignOffset = IpAlignOffset;
+
+    Allocations = HostPoolAllocations;
+    Split = PulledUp = 0;
+
+    for (Iteration = 0; Iteration < Iterations; Iteration++) {
+        PXENVIF_RECEIVER_PACKET Packet;
+        PXENVIF_RECEIVER_PACKET Header;
+        XENVIF_PACKET_PAYLOAD   Payload;
+        BOOLEAN                 Expected;
+        ULONG                   Index;
+
+        BuildFrame(&Seed, &Frame);
+        BuildFragments(&Seed, &Frame, &Fragments);
+        SnapshotFragments(&Fragments);
+
+        Packet = Fragments.Packet[0];
+
+        Payload.Mdl = &Packet->Mdl;
+        Payload.Offset = 0;
+        Payload.Length = Frame.Length;
+
+        Expected = !Frame.LLC &&
+                   IpAlignOffset + Frame.HeaderLength <= XENVIF_RECEIVER_HEADER_SIZE;
+
+        Header = __ReceiverRingSplitHeader(&Ring, Packet, &Payload);
+
+        CHECK_EQ(Header != NULL, Expected);
+        CHECK_EQ(HeadersOutstanding, (Header != NULL) ? 1 : 0);
+
+        if (Header != NULL) {
+            PUCHAR  BaseVa = Header->Mdl.MappedSystemVa;
+            ULONG   Remaining;
+
+            Split++;
+
+            CHECK(Header->Header);
+            CHECK_EQ(Header->Offset, IpAlignOffset);
+            CHECK_EQ(Header->Length, Frame.Length);
+            CHECK_EQ(Header->Info.Length, Frame.HeaderLength);
+            CHECK_EQ(Header->Mdl.ByteCount, IpAlignOffset + Frame.HeaderLength);
+            CHECK(memcmp(BaseVa + IpAlignOffset, Frame.Data, Frame.HeaderLength) == 0);
+
+            CHECK_EQ(Payload.Offset, 0);
+            CheckPayload(&Frame, &Payload, Frame.HeaderLength);
+
+            // Fragments wholly within the headers are back in the cache,
+            // the rest are where the backend left them
+            Remaining = 0;
+            for (Index = 0; Index < Fragments.Count; Index++) {
+                ULONG   Start = Fragments.Start[Index];
+                ULONG   End = Start + Fragments.Mdl[Index].ByteCount;
+                PMDL    Mdl = &Fragments.Packet[Index]->Mdl;
+                ULONG   Skip;
+
+                if (End <= Frame.HeaderLength)
+                    continue;
+
+                Remaining++;
+
+                Skip = (Start < Frame.HeaderLength) ? Frame.HeaderLength - Start : 0;
+
+                if (Remaining == 1)
+                    CHECK(Payload.Mdl == Mdl);
+
+                CHECK_EQ(Mdl->ByteOffset, Fragments.Mdl[Index].ByteOffset + Skip);
+                CHECK(Mdl->MappedSystemVa ==
+                      (PUCHAR)Fragments.Mdl[Index].MappedSystemVa + Skip);
+                CHECK_EQ(Mdl->ByteCount, Fragments.Mdl[Index].ByteCount - Skip);
+                CHECK(memcmp(Fragments.Mdl[Index].MappedSystemVa,
+                             Fragments.Data[Index],
+                             Fragments.Mdl[Index].ByteCount) == 0);
+            }
+
+            if (Remaining == 0)
+                CHECK(Payload.Mdl == NULL);
+
+            CHECK_EQ(PacketsOutstanding, Remaining);
+
+            __ReceiverRingPutPacket(&Ring, Header, TRUE);
+        } else {
+            PXENVIF_RECEIVER_PACKET New;
+            PUCHAR                  BaseVa;
+            NTSTATUS                status;
+
+            PulledUp++;
+
+            // Nothing may have been consumed or trimmed
+            CHECK(Payload.Mdl == &Packet->Mdl);
+            CHECK_EQ(Payload.Offset, 0);
+            CHECK_EQ(Payload.Length, Frame.Length);
+
+            for (Index = 0; Index < Fragments.Count; Index++) {
+                PMDL    Mdl = &Fragments.Packet[Index]->Mdl;
+
+                CHECK(memcmp(Mdl, &Fragments.Mdl[Index], sizeof (MDL)) == 0);
+                CHECK(memcmp(Mdl->MappedSystemVa,
+                             Fragments.Data[Index],
+                             Mdl->ByteCount) == 0);
+            }
+
+            // So the full page parse, as ReceiverRingProcessPacket()
+            // falls back to, still sees the whole frame
+            New = __ReceiverRingGetPacket(&Ring, TRUE);
+            ASSERT(New != NULL);
+
+            RtlCopyMemory(New, Packet, FIELD_OFFSET(XENVIF_RECEIVER_PACKET, Mdl));
+            New->Offset = IpAlignOffset;
+
+            BaseVa = New->Mdl.MappedSystemVa;
+            New->Mdl.ByteCount = New->Offset;
+
+            status = ParsePacket(BaseVa + New->Offset,
+                                 ReceiverRingPullup,
+                                 &Ring,
+                                 &Payload,
+                                 &New->Info);
+            CHECK(NT_SUCCESS(status));
+            CHECK_EQ(New->Info.Length, Frame.HeaderLength);
+            CHECK(memcmp(BaseVa + New->Offset, Frame.Data, Frame.HeaderLength) == 0);
+            CheckPayload(&Frame, &Payload, Frame.HeaderLength);
+
+            __ReceiverRingPutPacket(&Ring, New, TRUE);
+        }
+
+        if (Payload.Length != 0)
+            PutChain(Payload.Mdl);
+
+        CHECK_EQ(PacketsOutstanding, 0);
+        CHECK_EQ(HeadersOutstanding, 0);
+    }
+
+    CHECK_EQ(HostPoolAllocations, Allocations);
+
+    // Both paths must have been exercised
+    CHECK(IpAlignOffset >= XENVIF_RECEIVER_HEADER_SIZE || Split != 0);
+    CHECK(PulledUp != 0);
+
+    printf("IpAlignOffset %u: %u split, %u pulled up\n",
+           IpAlignOffset,
+           Split,
+           PulledUp);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    Setup();
+
+    TestSplit(20000, 0);
+    TestSplit(20000, 2);
+    TestSplit(1000, XENVIF_RECEIVER_HEADER_SIZE);
+
+    return TEST_RESULT("receiver_test");
+}
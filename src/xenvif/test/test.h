@@ -0,0 +1,87 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HOST_TEST_H
+#define _HOST_TEST_H
+
+#include <ntddk.h>
+#include <time.h>
+
+extern ULONG    TestFailures;
+
+#define CHECK(_EXP)                                             \
+        do {                                                    \
+            if (!(_EXP)) {                                      \
+                fprintf(stderr, "%s:%u: CHECK FAILED: %s\n",    \
+                        __FILE__, __LINE__, #_EXP);             \
+                TestFailures++;                                 \
+            }                                                   \
+        } while (FALSE)
+
+#define CHECK_EQ(_X, _Y)                                        \
+        do {                                                    \
+            ULONGLONG   _Lval = (ULONGLONG)(_X);                \
+            ULONGLONG   _Rval = (ULONGLONG)(_Y);                \
+            if (_Lval != _Rval) {                               \
+                fprintf(stderr, "%s:%u: CHECK FAILED: %s (%llu) == %s (%llu)\n", \
+                        __FILE__, __LINE__, #_X, _Lval, #_Y, _Rval); \
+                TestFailures++;                                 \
+            }                                                   \
+        } while (FALSE)
+
+#define TEST_RESULT(_Name)                                      \
+        ((TestFailures == 0) ?                                  \
+         (printf("PASS: %s\n", (_Name)), 0) :                   \
+         (printf("FAIL: %s (%u failures)\n", (_Name), TestFailures), 1))
+
+// Deterministic generator so that a failing seed can be replayed
+static inline ULONG
+TestRandom(
+    IN OUT  PULONGLONG  State
+    )
+{
+    *State = *State * 6364136223846793005ull + 1442695040888963407ull;
+    return (ULONG)(*State >> 33);
+}
+
+// Monotonic time in nanoseconds for the benchmarks
+static inline ULONGLONG
+TestNow(
+    VOID
+    )
+{
+    struct timespec Now;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (ULONGLONG)Now.tv_sec * 1000000000ull + Now.tv_nsec;
+}
+
+#endif  // _HOST_TEST_H
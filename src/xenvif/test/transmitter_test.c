@@ -0,0 +1,1169 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host differential test for the software segmentation in transmitter.c.
+//
+// Random TCP and UDP large packets, over IPv4 and IPv6 and with or
+// without IP and TCP options, are queued in an MDL chain split at
+// random points and handed to __TransmitterRingSegmentPacket(). Each
+// segment it produces has any checksum that it left to the backend
+// filled in here, as a backend would, and is then compared byte for
+// byte with the frame built by an independent reference segmenter
+// working on the flat original. Allocation failures are injected part
+// way through to check that nothing is left queued or referenced.
+
+#include <ntddk.h>
+
+#include "dbg_print.h"
+#include "assert.h"
+
+// Keep the driver's own headers for the transmitter's neighbours out of
+// the way; the declarations transmitter.c needs are provided below.
+#define _XENVIF_DRIVER_H
+#define _XENVIF_FDO_H
+#define _XENVIF_PDO_H
+#define _XENVIF_FRONTEND_H
+#define _XENVIF_MAC_H
+#define _XENVIF_VIF_H
+#define _XENVIF_THREAD_H
+#define _XENVIF_REGISTRY_H
+
+#include <ethernet.h>
+#include <tcpip.h>
+#include <debug_interface.h>
+#include <store_interface.h>
+#include <cache_interface.h>
+#include <gnttab_interface.h>
+#include <range_set_interface.h>
+#include <vif_interface.h>
+
+typedef struct _XENVIF_FDO          XENVIF_FDO, *PXENVIF_FDO;
+typedef struct _XENVIF_PDO          XENVIF_PDO, *PXENVIF_PDO;
+typedef struct _XENVIF_FRONTEND     XENVIF_FRONTEND, *PXENVIF_FRONTEND;
+typedef struct _XENVIF_MAC          XENVIF_MAC, *PXENVIF_MAC;
+typedef struct _XENVIF_VIF_CONTEXT  XENVIF_VIF_CONTEXT, *PXENVIF_VIF_CONTEXT;
+typedef struct _XENVIF_THREAD       XENVIF_THREAD, *PXENVIF_THREAD;
+
+typedef NTSTATUS (*XENVIF_THREAD_FUNCTION)(PXENVIF_THREAD, PVOID);
+
+#include "poller.h"
+
+static HANDLE               DriverGetParametersKey(VOID);
+static VOID                 FdoGetDebugInterface(PXENVIF_FDO, PXENBUS_DEBUG_INTERFACE);
+static VOID                 FdoGetStoreInterface(PXENVIF_FDO, PXENBUS_STORE_INTERFACE);
+static VOID                 FdoGetCacheInterface(PXENVIF_FDO, PXENBUS_CACHE_INTERFACE);
+static VOID                 FdoGetGnttabInterface(PXENVIF_FDO, PXENBUS_GNTTAB_INTERFACE);
+static VOID                 FdoGetRangeSetInterface(PXENVIF_FDO, PXENBUS_RANGE_SET_INTERFACE);
+static PCHAR                FrontendFormatPath(PXENVIF_FRONTEND, ULONG);
+static VOID                 FrontendFreePath(PXENVIF_FRONTEND, PCHAR);
+static USHORT               FrontendGetBackendDomain(PXENVIF_FRONTEND);
+static PCHAR                FrontendGetBackendPath(PXENVIF_FRONTEND);
+static PXENVIF_MAC          FrontendGetMac(PXENVIF_FRONTEND);
+static ULONG                FrontendGetMaxQueues(PXENVIF_FRONTEND);
+static ULONG                FrontendGetNumQueues(PXENVIF_FRONTEND);
+static PCHAR                FrontendGetPath(PXENVIF_FRONTEND);
+static PXENVIF_PDO          FrontendGetPdo(PXENVIF_FRONTEND);
+static PXENVIF_POLLER       FrontendGetPoller(PXENVIF_FRONTEND);
+static ULONG                FrontendGetQueue(PXENVIF_FRONTEND,
+                                             XENVIF_PACKET_HASH_ALGORITHM,
+                                             ULONG);
+static VOID                 FrontendIncrementStatistic(PXENVIF_FRONTEND,
+                                                       XENVIF_VIF_STATISTIC,
+                                                       ULONGLONG);
+static VOID                 MacQueryBroadcastAddress(PXENVIF_MAC, PETHERNET_ADDRESS);
+static VOID                 MacQueryCurrentAddress(PXENVIF_MAC, PETHERNET_ADDRESS);
+static VOID                 MacQueryMaximumFrameSize(PXENVIF_MAC, PULONG);
+static PXENVIF_FDO          PdoGetFdo(PXENVIF_PDO);
+static PXENVIF_VIF_CONTEXT  PdoGetVifContext(PXENVIF_PDO);
+static NTSTATUS             RegistryQueryDwordValue(HANDLE, PCHAR, PULONG);
+static NTSTATUS             ThreadCreate(XENVIF_THREAD_FUNCTION, PVOID, PXENVIF_THREAD *);
+static PKEVENT              ThreadGetEvent(PXENVIF_THREAD);
+static BOOLEAN              ThreadIsAlerted(PXENVIF_THREAD);
+static VOID                 ThreadAlert(PXENVIF_THREAD);
+static VOID                 ThreadJoin(PXENVIF_THREAD);
+static VOID                 VifTransmitterReturnPacket(PXENVIF_VIF_CONTEXT,
+                                                       PVOID,
+                                                       PXENVIF_TRANSMITTER_PACKET_COMPLETION_INFO);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_CACHE
+#define XENBUS_CACHE(_Method, _Interface, ...)    \
+    (_Interface)->Cache ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_GNTTAB
+#define XENBUS_GNTTAB(_Method, _Interface, ...)    \
+    (_Interface)->Gnttab ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_RANGE_SET
+#define XENBUS_RANGE_SET(_Method, _Interface, ...)    \
+    (_Interface)->RangeSet ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "../src/xenvif/checksum.c"
+#include "../src/xenvif/parse.c"
+#include "../src/xenvif/transmitter.c"
+
+#include "test.h"
+
+// Neighbours; nothing on the segmentation path reaches these
+
+static HANDLE
+DriverGetParametersKey(
+    VOID
+    )
+{
+    abort();
+}
+
+#define DEFINE_FDO_GET_INTERFACE(_Interface, _Type) \
+static VOID                                         \
+FdoGet ## _Interface ## Interface(                  \
+    IN  PXENVIF_FDO Fdo,                            \
+    OUT _Type       Interface                       \
+    )                                               \
+{                                                   \
+    UNREFERENCED_PARAMETER(Fdo);                    \
+    UNREFERENCED_PARAMETER(Interface);              \
+    abort();                                        \
+}
+
+DEFINE_FDO_GET_INTERFACE(Debug, PXENBUS_DEBUG_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(Store, PXENBUS_STORE_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(Cache, PXENBUS_CACHE_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(Gnttab, PXENBUS_GNTTAB_INTERFACE)
+DEFINE_FDO_GET_INTERFACE(RangeSet, PXENBUS_RANGE_SET_INTERFACE)
+
+static PCHAR
+FrontendFormatPath(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Index
+    )
+{
+    abort();
+}
+
+static VOID
+FrontendFreePath(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  PCHAR               Path
+    )
+{
+    abort();
+}
+
+static USHORT
+FrontendGetBackendDomain(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PCHAR
+FrontendGetBackendPath(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PXENVIF_MAC
+FrontendGetMac(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static ULONG
+FrontendGetMaxQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static ULONG
+FrontendGetNumQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PCHAR
+FrontendGetPath(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PXENVIF_PDO
+FrontendGetPdo(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static PXENVIF_POLLER
+FrontendGetPoller(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    abort();
+}
+
+static ULONG
+FrontendGetQueue(
+    IN  PXENVIF_FRONTEND                Frontend,
+    IN  XENVIF_PACKET_HASH_ALGORITHM    Algorithm,
+    IN  ULONG                           Index
+    )
+{
+    abort();
+}
+
+static VOID
+FrontendIncrementStatistic(
+    IN  PXENVIF_FRONTEND        Frontend,
+    IN  XENVIF_VIF_STATISTIC    Index,
+    IN  ULONGLONG               Delta
+    )
+{
+    abort();
+}
+
+static VOID
+MacQueryBroadcastAddress(
+    IN  PXENVIF_MAC         Mac,
+    OUT PETHERNET_ADDRESS   Address
+    )
+{
+    abort();
+}
+
+static VOID
+MacQueryCurrentAddress(
+    IN  PXENVIF_MAC         Mac,
+    OUT PETHERNET_ADDRESS   Address
+    )
+{
+    abort();
+}
+
+static VOID
+MacQueryMaximumFrameSize(
+    IN  PXENVIF_MAC Mac,
+    OUT PULONG      Size
+    )
+{
+    abort();
+}
+
+static PXENVIF_FDO
+PdoGetFdo(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    abort();
+}
+
+static PXENVIF_VIF_CONTEXT
+PdoGetVifContext(
+    IN  PXENVIF_PDO Pdo
+    )
+{
+    abort();
+}
+
+NTSTATUS
+PollerSend(
+    IN  PXENVIF_POLLER              Poller,
+    IN  ULONG                       Index,
+    IN  XENVIF_POLLER_EVENT_TYPE    Event
+    )
+{
+    abort();
+}
+
+NTSTATUS
+PollerTrigger(
+    IN  PXENVIF_POLLER              Poller,
+    IN  ULONG                       Index,
+    IN  XENVIF_POLLER_EVENT_TYPE    Event
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+RegistryQueryDwordValue(
+    IN  HANDLE  Key,
+    IN  PCHAR   Name,
+    OUT PULONG  Value
+    )
+{
+    abort();
+}
+
+static NTSTATUS
+ThreadCreate(
+    IN  XENVIF_THREAD_FUNCTION  Function,
+    IN  PVOID                   Context,
+    OUT PXENVIF_THREAD          *Thread
+    )
+{
+    abort();
+}
+
+static PKEVENT
+ThreadGetEvent(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static BOOLEAN
+ThreadIsAlerted(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static VOID
+ThreadAlert(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static VOID
+ThreadJoin(
+    IN  PXENVIF_THREAD  Thread
+    )
+{
+    abort();
+}
+
+static VOID
+VifTransmitterReturnPacket(
+    IN  PXENVIF_VIF_CONTEXT                         Context,
+    IN  PVOID                                       Cookie,
+    IN  PXENVIF_TRANSMITTER_PACKET_COMPLETION_INFO  Completion
+    )
+{
+    abort();
+}
+
+// Every unused driver entry point above must still link
+BOOLEAN RtlIsNtDdiVersionAvailable(ULONG Version) { abort(); }
+NTSTATUS KeGetProcessorNumberFromIndex(ULONG Index, PPROCESSOR_NUMBER Number) { abort(); }
+VOID KeSetSystemGroupAffinityThread(PGROUP_AFFINITY New, PGROUP_AFFINITY Old) { abort(); }
+PMDL MmAllocatePagesForMdlEx(PHYSICAL_ADDRESS Low, PHYSICAL_ADDRESS High,
+                             PHYSICAL_ADDRESS Skip, SIZE_T Length,
+                             MEMORY_CACHING_TYPE Type, ULONG Flags) { abort(); }
+PVOID MmMapLockedPagesSpecifyCache(PMDL Mdl, KPROCESSOR_MODE Mode,
+                                   MEMORY_CACHING_TYPE Type, PVOID Address,
+                                   ULONG BugCheck, ULONG Priority) { abort(); }
+VOID MmUnmapLockedPages(PVOID Address, PMDL Mdl) { abort(); }
+VOID MmFreePagesFromMdl(PMDL Mdl) { abort(); }
+
+// The packet cache: objects come straight from the (counted) pool, and
+// Get can be made to fail after a given number of successes.
+
+static LONG     CacheGetBudget = -1;
+
+static PVOID
+CacheGet(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache,
+    IN  BOOLEAN         Locked
+    )
+{
+    PVOID               Object;
+
+    if (CacheGetBudget == 0)
+        return NULL;
+    if (CacheGetBudget > 0)
+        --CacheGetBudget;
+
+    Object = __TransmitterAllocate(sizeof (XENVIF_TRANSMITTER_PACKET));
+    if (Object == NULL)
+        return NULL;
+
+    if (!NT_SUCCESS(TransmitterPacketCtor(NULL, Object))) {
+        __TransmitterFree(Object);
+        return NULL;
+    }
+
+    return Object;
+}
+
+static VOID
+CachePut(
+    IN  PINTERFACE      Interface,
+    IN  PXENBUS_CACHE   Cache,
+    IN  PVOID           Object,
+    IN  BOOLEAN         Locked
+    )
+{
+    TransmitterPacketDtor(NULL, Object);
+    __TransmitterFree(Object);
+}
+
+// Frame construction, as the stack would hand a large packet over
+
+#define ETH_LENGTH  14
+
+typedef struct _FRAME {
+    UCHAR   Data[65536 + 256];
+    ULONG   Length;
+    ULONG   IpOffset;
+    ULONG   IpHeaderLength;     // Including IPv4 options or IPv6 extension headers
+    UCHAR   IpVersion;
+    UCHAR   Protocol;
+    ULONG   L4Offset;
+    ULONG   L4HeaderLength;
+    ULONG   PayloadLength;
+} FRAME, *PFRAME;
+
+static VOID
+PutShort(
+    IN  PUCHAR  Va,
+    IN  ULONG   Value
+    )
+{
+    Va[0] = (UCHAR)(Value >> 8);
+    Va[1] = (UCHAR)Value;
+}
+
+static ULONG
+GetShort(
+    IN  PUCHAR  Va
+    )
+{
+    return ((ULONG)Va[0] << 8) | Va[1];
+}
+
+static VOID
+PutLong(
+    IN  PUCHAR  Va,
+    IN  ULONG   Value
+    )
+{
+    PutShort(Va, Value >> 16);
+    PutShort(Va + 2, Value & 0xFFFF);
+}
+
+static ULONG
+GetLong(
+    IN  PUCHAR  Va
+    )
+{
+    return (GetShort(Va) << 16) | GetShort(Va + 2);
+}
+
+static VOID
+BuildFrame(
+    IN OUT  PULONGLONG  Seed,
+    IN      UCHAR       IpVersion,
+    IN      UCHAR       Protocol,
+    IN      BOOLEAN     ZeroLength,
+    IN      ULONG       PayloadLength,
+    OUT     PFRAME      Frame
+    )
+{
+    PUCHAR              Va = Frame->Data;
+    ULONG               Offset;
+    ULONG               Index;
+    ULONG               Options;
+
+    memset(Frame, 0, sizeof (FRAME));
+
+    for (Index = 0; Index < 12; Index++)
+        Va[Index] = (UCHAR)TestRandom(Seed);
+    Va[0] &= ~0x01;
+    PutShort(Va + 12, (IpVersion == 4) ? 0x0800 : 0x86DD);
+
+    Offset = ETH_LENGTH;
+    Frame->IpOffset = Offset;
+    Frame->IpVersion = IpVersion;
+    Frame->Protocol = Protocol;
+
+    if (IpVersion == 4) {
+        Options = (TestRandom(Seed) % 4 == 0) ? (TestRandom(Seed) % 11) * 4 : 0;
+
+        Va[Offset] = 0x40 | (UCHAR)((20 + Options) / 4);
+        Va[Offset + 1] = (UCHAR)TestRandom(Seed);
+        PutShort(Va + Offset + 4, TestRandom(Seed));    // Packet ID
+        Va[Offset + 6] = (TestRandom(Seed) & 1) ? 0x40 : 0x00;  // DF
+        Va[Offset + 8] = 64;
+        Va[Offset + 9] = Protocol;
+        PutShort(Va + Offset + 10, TestRandom(Seed));   // Stale checksum
+        for (Index = 12; Index < 20; Index++)
+            Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+        memset(Va + Offset + 20, 0x01, Options);        // NOPs
+
+        Frame->IpHeaderLength = 20 + Options;
+    } else {
+        ULONG   Extension;
+
+        Extension = (TestRandom(Seed) % 4 == 0) ? 8 * (1 + TestRandom(Seed) % 3) : 0;
+
+        Va[Offset] = 0x60;
+        Va[Offset + 6] = (Extension != 0) ? IPPROTO_DSTOPTS : Protocol;
+        Va[Offset + 7] = 64;
+        for (Index = 8; Index < 40; Index++)
+            Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+
+        if (Extension != 0) {
+            PUCHAR  Option = Va + Offset + 40;
+
+            Option[0] = Protocol;
+            Option[1] = (UCHAR)(Extension / 8 - 1);
+            Option[2] = 1;                              // PadN
+            Option[3] = (UCHAR)(Extension - 4);
+        }
+
+        Frame->IpHeaderLength = 40 + Extension;
+    }
+
+    Offset += Frame->IpHeaderLength;
+    Frame->L4Offset = Offset;
+
+    if (Protocol == IPPROTO_TCP) {
+        UCHAR   Flags;
+
+        Options = (TestRandom(Seed) % 2 == 0) ? (TestRandom(Seed) % 11) * 4 : 0;
+
+        PutShort(Va + Offset, TestRandom(Seed));
+        PutShort(Va + Offset + 2, TestRandom(Seed));
+        PutLong(Va + Offset + 4, TestRandom(Seed));     // Seq
+        PutLong(Va + Offset + 8, TestRandom(Seed));     // Ack
+        Va[Offset + 12] = (UCHAR)(((20 + Options) / 4) << 4);
+
+        Flags = TCP_ACK;
+        if (TestRandom(Seed) & 1)
+            Flags |= TCP_FIN;
+        if (TestRandom(Seed) & 1)
+            Flags |= TCP_PSH;
+        if (TestRandom(Seed) & 1)
+            Flags |= TCP_CWR;
+        if (TestRandom(Seed) & 1)
+            Flags |= 0x40;                              // ECE
+        Va[Offset + 13] = Flags;
+
+        PutShort(Va + Offset + 14, TestRandom(Seed));   // Window
+        PutShort(Va + Offset + 16, TestRandom(Seed));   // Pseudo-header sum
+        memset(Va + Offset + 20, 0x01, Options);
+
+        Frame->L4HeaderLength = 20 + Options;
+    } else {
+        PutShort(Va + Offset, TestRandom(Seed));
+        PutShort(Va + Offset + 2, TestRandom(Seed));
+        PutShort(Va + Offset + 6, TestRandom(Seed));
+
+        Frame->L4HeaderLength = 8;
+    }
+
+    Offset += Frame->L4HeaderLength;
+
+    for (Index = 0; Index < PayloadLength; Index++)
+        Va[Offset + Index] = (UCHAR)TestRandom(Seed);
+
+    Frame->PayloadLength = PayloadLength;
+    Frame->Length = Offset + PayloadLength;
+
+    if (Protocol == IPPROTO_UDP)
+        PutShort(Va + Frame->L4Offset + 4,
+                 Frame->L4HeaderLength + PayloadLength);
+
+    // An LSO packet may leave the IP length for the miniport to fill in
+    if (!ZeroLength) {
+        if (IpVersion == 4)
+            PutShort(Va + Frame->IpOffset + 2,
+                     Frame->Length - Frame->IpOffset);
+        else
+            PutShort(Va + Frame->IpOffset + 4,
+                     Frame->Length - Frame->IpOffset - 40);
+    }
+}
+
+// Reference segmentation, on the flat frame
+
+static ULONG
+Accumulate(
+    IN  ULONG   Sum,
+    IN  PUCHAR  Va,
+    IN  ULONG   Length
+    )
+{
+    ULONG       Index;
+
+    for (Index = 0; Index + 1 < Length; Index += 2)
+        Sum += GetShort(Va + Index);
+    if (Length & 1)
+        Sum += (ULONG)Va[Length - 1] << 8;
+
+    return Sum;
+}
+
+static USHORT
+Fold(
+    IN  ULONG   Sum
+    )
+{
+    while (Sum >> 16)
+        Sum = (Sum & 0xFFFF) + (Sum >> 16);
+
+    return (USHORT)~Sum;
+}
+
+// Fill in the IPv4 header checksum and the transport checksum of a
+// complete frame laid out as described by Frame.
+static VOID
+ReferenceChecksums(
+    IN  PFRAME  Frame,
+    IN  PUCHAR  Va,
+    IN  ULONG   Length,
+    IN  BOOLEAN Ip,
+    IN  BOOLEAN Transport
+    )
+{
+    PUCHAR      IpHeader = Va + Frame->IpOffset;
+    PUCHAR      L4Header = Va + Frame->L4Offset;
+    ULONG       L4Length = Length - Frame->L4Offset;
+    ULONG       ChecksumOffset;
+    ULONG       Sum;
+    USHORT      Checksum;
+
+    if (Frame->IpVersion == 4 && Ip) {
+        PutShort(IpHeader + 10, 0);
+        PutShort(IpHeader + 10,
+                 Fold(Accumulate(0, IpHeader, (IpHeader[0] & 0x0F) * 4)));
+    }
+
+    if (!Transport)
+        return;
+
+    ChecksumOffset = (Frame->Protocol == IPPROTO_TCP) ? 16 : 6;
+    PutShort(L4Header + ChecksumOffset, 0);
+
+    if (Frame->IpVersion == 4)
+        Sum = Accumulate(0, IpHeader + 12, 8);
+    else
+        Sum = Accumulate(0, IpHeader + 8, 32);
+
+    Sum += Frame->Protocol;
+    Sum += L4Length;
+
+    Checksum = Fold(Accumulate(Sum, L4Header, L4Length));
+    if (Frame->Protocol == IPPROTO_UDP && Checksum == 0)
+        Checksum = 0xFFFF;
+
+    PutShort(L4Header + ChecksumOffset, Checksum);
+}
+
+static ULONG
+ReferenceSegment(
+    IN  PFRAME  Frame,
+    IN  ULONG   MaximumSegmentSize,
+    IN  ULONG   Index,
+    OUT PUCHAR  Va
+    )
+{
+    ULONG       HeaderLength = Frame->L4Offset + Frame->L4HeaderLength;
+    ULONG       Offset = Index * MaximumSegmentSize;
+    ULONG       Length;
+    BOOLEAN     Last;
+    PUCHAR      IpHeader = Va + Frame->IpOffset;
+    PUCHAR      L4Header = Va + Frame->L4Offset;
+
+    Length = Frame->PayloadLength - Offset;
+    if (Length > MaximumSegmentSize)
+        Length = MaximumSegmentSize;
+    Last = (Offset + Length == Frame->PayloadLength) ? TRUE : FALSE;
+
+    memcpy(Va, Frame->Data, HeaderLength);
+    memcpy(Va + HeaderLength, Frame->Data + HeaderLength + Offset, Length);
+
+    if (Frame->IpVersion == 4) {
+        PutShort(IpHeader + 2, HeaderLength + Length - Frame->IpOffset);
+        PutShort(IpHeader + 4, GetShort(Frame->Data + Frame->IpOffset + 4) + Index);
+    } else {
+        PutShort(IpHeader + 4, HeaderLength + Length - Frame->IpOffset - 40);
+    }
+
+    if (Frame->Protocol == IPPROTO_TCP) {
+        PutLong(L4Header + 4, GetLong(L4Header + 4) + Offset);
+
+        if (!Last)
+            L4Header[13] &= ~(TCP_FIN | TCP_PSH);
+        if (Index != 0)
+            L4Header[13] &= ~TCP_CWR;
+    } else {
+        PutShort(L4Header + 4, Frame->L4HeaderLength + Length);
+    }
+
+    ReferenceChecksums(Frame, Va, HeaderLength + Length, TRUE, TRUE);
+
+    return HeaderLength + Length;
+}
+
+// The frame as the driver would see it: an MDL chain, split at random
+// points, with the frame starting part way into the first buffer.
+
+#define MAXIMUM_MDLS    16
+
+typedef struct _CHAIN {
+    MDL     Mdl[MAXIMUM_MDLS];
+    PUCHAR  Buffer[MAXIMUM_MDLS];
+    ULONG   Count;
+    ULONG   Offset;
+} CHAIN, *PCHAIN;
+
+static VOID
+BuildChain(
+    IN OUT  PULONGLONG  Seed,
+    IN      PFRAME      Frame,
+    OUT     PCHAIN      Chain
+    )
+{
+    ULONG               Cut[MAXIMUM_MDLS + 1];
+    ULONG               Count;
+    ULONG               Index;
+
+    memset(Chain, 0, sizeof (CHAIN));
+
+    Count = 1 + TestRandom(Seed) % MAXIMUM_MDLS;
+    Chain->Offset = TestRandom(Seed) % 64;
+
+    Cut[0] = 0;
+    for (Index = 1; Index < Count; Index++)
+        Cut[Index] = TestRandom(Seed) % (Frame->Length + 1);
+    Cut[Count] = Frame->Length;
+
+    // Sort the cut points; empty buffers are allowed
+    for (Index = 1; Index < Count; Index++) {
+        ULONG   Value = Cut[Index];
+        ULONG   Slot = Index;
+
+        while (Slot > 1 && Cut[Slot - 1] > Value) {
+            Cut[Slot] = Cut[Slot - 1];
+            --Slot;
+        }
+        Cut[Slot] = Value;
+    }
+
+    for (Index = 0; Index < Count; Index++) {
+        PMDL    Mdl = &Chain->Mdl[Index];
+        ULONG   Skip = (Index == 0) ? Chain->Offset : 0;
+        ULONG   Length = Cut[Index + 1] - Cut[Index];
+
+        Chain->Buffer[Index] = malloc(Skip + Length + 1);
+        memset(Chain->Buffer[Index], 0xEE, Skip);
+        memcpy(Chain->Buffer[Index] + Skip, Frame->Data + Cut[Index], Length);
+
+        Mdl->MappedSystemVa = Chain->Buffer[Index];
+        Mdl->StartVa = Chain->Buffer[Index];
+        Mdl->ByteCount = Skip + Length;
+        Mdl->MdlFlags = MDL_MAPPED_TO_SYSTEM_VA;
+        Mdl->Next = (Index + 1 < Count) ? &Chain->Mdl[Index + 1] : NULL;
+    }
+
+    Chain->Count = Count;
+}
+
+static VOID
+DestroyChain(
+    IN  PCHAIN  Chain
+    )
+{
+    ULONG       Index;
+
+    for (Index = 0; Index < Chain->Count; Index++)
+        free(Chain->Buffer[Index]);
+}
+
+// Flatten a segment as the ring would post it: the header buffer
+// followed by the payload fragments.
+static ULONG
+FlattenSegment(
+    IN  PXENVIF_TRANSMITTER_PACKET  Segment,
+    OUT PUCHAR                      Va
+    )
+{
+    XENVIF_PACKET_PAYLOAD           Payload = Segment->Payload;
+    ULONG                           Length;
+
+    Length = Segment->Info.Length;
+    memcpy(Va, Segment->Header, Length);
+
+    (VOID) TransmitterPullup(NULL, Va + Length, &Payload, Segment->Payload.Length);
+    Length += Segment->Payload.Length;
+
+    return Length;
+}
+
+static XENVIF_TRANSMITTER       Transmitter;
+static XENVIF_TRANSMITTER_RING  Ring;
+
+static VOID
+Setup(
+    VOID
+    )
+{
+    Transmitter.CacheInterface.CacheGet = CacheGet;
+    Transmitter.CacheInterface.CachePut = CachePut;
+
+    Ring.Transmitter = &Transmitter;
+    InitializeListHead(&Ring.PacketQueue);
+}
+
+// Queue a large packet as TransmitterQueuePacket() would.
+static PXENVIF_TRANSMITTER_PACKET
+QueueLargePacket(
+    IN  PCHAIN                      Chain,
+    IN  PFRAME                      Frame,
+    IN  XENVIF_VIF_OFFLOAD_OPTIONS  OffloadOptions,
+    IN  USHORT                      MaximumSegmentSize
+    )
+{
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+
+    Packet = __TransmitterGetPacket(&Transmitter);
+    if (Packet == NULL)
+        abort();
+
+    Packet->Mdl = &Chain->Mdl[0];
+    Packet->Offset = Chain->Offset;
+    Packet->Length = Frame->Length;
+    Packet->OffloadOptions = OffloadOptions;
+    Packet->MaximumSegmentSize = MaximumSegmentSize;
+
+    Packet->Payload.Mdl = Packet->Mdl;
+    Packet->Payload.Offset = Packet->Offset;
+    Packet->Payload.Length = Packet->Length;
+
+    (VOID) ParsePacket(Packet->Header,
+                       TransmitterPullup,
+                       &Transmitter,
+                       &Packet->Payload,
+                       &Packet->Info);
+
+    return Packet;
+}
+
+static VOID
+ReturnSegments(
+    IN  PXENVIF_TRANSMITTER_PACKET  Packet
+    )
+{
+    while (!IsListEmpty(&Ring.PacketQueue)) {
+        PLIST_ENTRY                 ListEntry;
+        PXENVIF_TRANSMITTER_PACKET  Segment;
+
+        ListEntry = RemoveHeadList(&Ring.PacketQueue);
+        RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+
+        Segment = CONTAINING_RECORD(ListEntry,
+                                    XENVIF_TRANSMITTER_PACKET,
+                                    ListEntry);
+
+        CHECK(Segment->Parent == Packet);
+        Segment->Parent = NULL;
+
+        CHECK(Packet->Reference != 0);
+        --Packet->Reference;
+
+        __TransmitterPutPacket(&Transmitter, Segment);
+    }
+}
+
+static UCHAR    Expected[65536 + 256];
+static UCHAR    Actual[65536 + 256];
+
+static VOID
+TestSegmentation(
+    IN  ULONG   Iterations
+    )
+{
+    ULONGLONG   Seed = 0x5e9;
+    ULONG       Iteration;
+    PFRAME      Frame;
+
+    Frame = malloc(sizeof (FRAME));
+
+    for (Iteration = 0; Iteration < Iterations; Iteration++) {
+        UCHAR                       IpVersion;
+        UCHAR                       Protocol;
+        ULONG                       PayloadLength;
+        USHORT                      MaximumSegmentSize;
+        XENVIF_VIF_OFFLOAD_OPTIONS  OffloadOptions;
+        BOOLEAN                     TransportOffload;
+        CHAIN                       Chain;
+        PXENVIF_TRANSMITTER_PACKET  Packet;
+        ULONG                       Count;
+        ULONG                       Index;
+        PLIST_ENTRY                 ListEntry;
+        LONG                        Allocations;
+        ULONG                       PacketsQueued;
+        NTSTATUS                    status;
+
+        IpVersion = (TestRandom(&Seed) & 1) ? 4 : 6;
+        Protocol = (TestRandom(&Seed) & 1) ? IPPROTO_TCP : IPPROTO_UDP;
+
+        MaximumSegmentSize = (USHORT)(1 + TestRandom(&Seed) % 1500);
+        switch (TestRandom(&Seed) % 4) {
+        case 0:     // A single segment
+            PayloadLength = 1 + TestRandom(&Seed) % MaximumSegmentSize;
+            break;
+        case 1:     // An exact multiple
+            PayloadLength = MaximumSegmentSize * (1 + TestRandom(&Seed) % 8);
+            break;
+        default:
+            PayloadLength = 1 + TestRandom(&Seed) % 30000;
+            break;
+        }
+
+        BuildFrame(&Seed,
+                   IpVersion,
+                   Protocol,
+                   (Protocol == IPPROTO_TCP && (TestRandom(&Seed) & 1)) ? TRUE : FALSE,
+                   PayloadLength,
+                   Frame);
+        BuildChain(&Seed, Frame, &Chain);
+
+        // The transport checksum may or may not be left to the backend,
+        // whatever the IP version
+        TransportOffload = (TestRandom(&Seed) & 1) ? TRUE : FALSE;
+
+        OffloadOptions.Value = 0;
+        if (IpVersion == 4) {
+            if (TestRandom(&Seed) & 1)
+                OffloadOptions.OffloadIpVersion4HeaderChecksum = 1;
+
+            if (Protocol == IPPROTO_TCP) {
+                OffloadOptions.OffloadIpVersion4LargePacket = 1;
+                OffloadOptions.OffloadIpVersion4TcpChecksum = TransportOffload;
+            } else {
+                OffloadOptions.OffloadIpVersion4UdpLargePacket = 1;
+                OffloadOptions.OffloadIpVersion4UdpChecksum = TransportOffload;
+            }
+        } else {
+            if (Protocol == IPPROTO_TCP) {
+                OffloadOptions.OffloadIpVersion6LargePacket = 1;
+                OffloadOptions.OffloadIpVersion6TcpChecksum = TransportOffload;
+            } else {
+                OffloadOptions.OffloadIpVersion6UdpLargePacket = 1;
+                OffloadOptions.OffloadIpVersion6UdpChecksum = TransportOffload;
+            }
+        }
+
+        Allocations = HostPoolAllocations;
+
+        Packet = QueueLargePacket(&Chain, Frame, OffloadOptions, MaximumSegmentSize);
+
+        CHECK_EQ(Packet->Info.Length, Frame->L4Offset + Frame->L4HeaderLength);
+        CHECK_EQ(Packet->Payload.Length, PayloadLength);
+        CHECK(__TransmitterRingSegmentationRequired(&Ring, Packet));
+
+        Count = (PayloadLength + MaximumSegmentSize - 1) / MaximumSegmentSize;
+
+        // Sometimes run out of packets part way through
+        if (Count > 1 && TestRandom(&Seed) % 8 == 0) {
+            CacheGetBudget = TestRandom(&Seed) % Count;
+
+            PacketsQueued = Ring.PacketsQueued;
+            status = __TransmitterRingSegmentPacket(&Ring, Packet);
+            CacheGetBudget = -1;
+
+            CHECK_EQ(status, STATUS_NO_MEMORY);
+            CHECK_EQ(Packet->Reference, 0);
+            CHECK(IsListEmpty(&Ring.PacketQueue));
+            CHECK_EQ(Ring.PacketsQueued, PacketsQueued);
+
+            __TransmitterPutPacket(&Transmitter, Packet);
+            CHECK_EQ(HostPoolAllocations, Allocations);
+
+            DestroyChain(&Chain);
+            continue;
+        }
+
+        PacketsQueued = Ring.PacketsQueued;
+        status = __TransmitterRingSegmentPacket(&Ring, Packet);
+        CHECK_EQ(status, STATUS_SUCCESS);
+        CHECK_EQ(Packet->Reference, Count);
+        CHECK_EQ(Ring.PacketsQueued, PacketsQueued + Count - 1);
+
+        Index = 0;
+        for (ListEntry = Ring.PacketQueue.Flink;
+             ListEntry != &Ring.PacketQueue;
+             ListEntry = ListEntry->Flink) {
+            PXENVIF_TRANSMITTER_PACKET  Segment;
+            ULONG                       ExpectedLength;
+            ULONG                       ActualLength;
+            BOOLEAN                     SegmentTransportOffload;
+
+            Segment = CONTAINING_RECORD(ListEntry,
+                                        XENVIF_TRANSMITTER_PACKET,
+                                        ListEntry);
+
+            CHECK(!Segment->OffloadOptions.OffloadIpVersion4LargePacket);
+            CHECK(!Segment->OffloadOptions.OffloadIpVersion6LargePacket);
+            CHECK(!Segment->OffloadOptions.OffloadIpVersion4UdpLargePacket);
+            CHECK(!Segment->OffloadOptions.OffloadIpVersion6UdpLargePacket);
+
+            if (IpVersion == 4)
+                CHECK(Segment->OffloadOptions.OffloadIpVersion4HeaderChecksum);
+
+            SegmentTransportOffload =
+                (Segment->OffloadOptions.OffloadIpVersion4TcpChecksum ||
+                 Segment->OffloadOptions.OffloadIpVersion4UdpChecksum ||
+                 Segment->OffloadOptions.OffloadIpVersion6TcpChecksum ||
+                 Segment->OffloadOptions.OffloadIpVersion6UdpChecksum) ?
+                TRUE : FALSE;
+            CHECK_EQ(SegmentTransportOffload, TransportOffload);
+
+            ExpectedLength = ReferenceSegment(Frame,
+                                              MaximumSegmentSize,
+                                              Index,
+                                              Expected);
+
+            ActualLength = FlattenSegment(Segment, Actual);
+            CHECK_EQ(ActualLength, ExpectedLength);
+            CHECK_EQ(Segment->Length, ExpectedLength);
+
+            // Complete whatever was left to the backend
+            ReferenceChecksums(Frame,
+                               Actual,
+                               ActualLength,
+                               Segment->OffloadOptions.OffloadIpVersion4HeaderChecksum,
+                               SegmentTransportOffload);
+
+            if (ActualLength == ExpectedLength &&
+                memcmp(Actual, Expected, ActualLength) != 0) {
+                ULONG   Byte;
+
+                for (Byte = 0; Byte < ActualLength; Byte++)
+                    if (Actual[Byte] != Expected[Byte])
+                        break;
+
+                fprintf(stderr,
+                        "iteration %u: IPv%u %s segment %u/%u differs at byte %u\n",
+                        Iteration,
+                        IpVersion,
+                        (Protocol == IPPROTO_TCP) ? "TCP" : "UDP",
+                        Index,
+                        Count,
+                        Byte);
+                TestFailures++;
+            }
+
+            Index++;
+        }
+        CHECK_EQ(Index, Count);
+
+        ReturnSegments(Packet);
+        CHECK_EQ(Packet->Reference, 0);
+
+        __TransmitterPutPacket(&Transmitter, Packet);
+        CHECK_EQ(HostPoolAllocations, Allocations);
+
+        DestroyChain(&Chain);
+
+        if (TestFailures != 0)
+            break;
+    }
+
+    free(Frame);
+}
+
+// A large packet with nothing to segment must be refused, rather than
+// replaced by no segments at all and so never completed.
+static VOID
+TestEmptyPayload(
+    VOID
+    )
+{
+    ULONGLONG                   Seed = 0xe;
+    PFRAME                      Frame;
+    CHAIN                       Chain;
+    XENVIF_VIF_OFFLOAD_OPTIONS  OffloadOptions;
+    PXENVIF_TRANSMITTER_PACKET  Packet;
+    LONG                        Allocations;
+    NTSTATUS                    status;
+
+    Frame = malloc(sizeof (FRAME));
+
+    BuildFrame(&Seed, 4, IPPROTO_UDP, FALSE, 0, Frame);
+    BuildChain(&Seed, Frame, &Chain);
+
+    OffloadOptions.Value = 0;
+    OffloadOptions.OffloadIpVersion4UdpLargePacket = 1;
+
+    Allocations = HostPoolAllocations;
+
+    Packet = QueueLargePacket(&Chain, Frame, OffloadOptions, 1000);
+
+    status = __TransmitterRingSegmentPacket(&Ring, Packet);
+    CHECK_EQ(status, STATUS_INVALID_PARAMETER);
+    CHECK_EQ(Packet->Reference, 0);
+    CHECK(IsListEmpty(&Ring.PacketQueue));
+
+    __TransmitterPutPacket(&Transmitter, Packet);
+    CHECK_EQ(HostPoolAllocations, Allocations);
+
+    DestroyChain(&Chain);
+    free(Frame);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    Setup();
+
+    TestSegmentation(20000);
+    TestEmptyPayload();
+
+    return TEST_RESULT("transmitter_test");
+}
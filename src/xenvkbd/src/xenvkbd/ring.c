@@ -55,6 +55,20 @@
 
 #define MAXNAMELEN  128
 
+#define XENVKBD_REPORT_QUEUE_SIZE   64
+
+typedef union _XENVKBD_HID_REPORT {
+    UCHAR                   ReportId;
+    XENVKBD_HID_KEYBOARD    Keyboard;
+    XENVKBD_HID_ABSMOUSE    AbsMouse;
+} XENVKBD_HID_REPORT, *PXENVKBD_HID_REPORT;
+
+typedef struct _XENVKBD_RING_REPORT {
+    XENVKBD_HID_REPORT      Report;
+    ULONG                   Length;
+    BOOLEAN                 Motion;     // pointer movement only, no button change
+} XENVKBD_RING_REPORT, *PXENVKBD_RING_REPORT;
+
 struct _XENVKBD_RING {
     PXENVKBD_FRONTEND       Frontend;
     PXENVKBD_HID_CONTEXT    Hid;
@@ -82,8 +96,17 @@ struct _XENVKBD_RING {
 
     XENVKBD_HID_KEYBOARD    KeyboardReport;
     XENVKBD_HID_ABSMOUSE    AbsMouseReport;
-    BOOLEAN                 KeyboardPending;
-    BOOLEAN                 AbsMousePending;
+
+    KSPIN_LOCK              ReportLock;
+    XENVKBD_RING_REPORT     Reports[XENVKBD_REPORT_QUEUE_SIZE];
+    ULONG                   ReportHead;
+    ULONG                   ReportCount;
+    BOOLEAN                 ReportDraining;
+    BOOLEAN                 ReportRetry;
+    LONG                    ReportWheel;    // from a dropped report, for the next mouse report
+    ULONG                   ReportsCoalesced;
+    ULONG                   ReportsMotionDropped;
+    ULONG                   ReportsTransitionsDropped;
 };
 
 #define XENVKBD_RING_TAG    'gniR'
@@ -196,6 +219,198 @@ KeyCodeToUsage(
     return 0;
 }
 
+static VOID
+RingDrainReports(
+    IN  PXENVKBD_RING   Ring
+    )
+{
+    KIRQL               Irql;
+
+    KeAcquireSpinLock(&Ring->ReportLock, &Irql);
+
+    // Only one drainer at a time so reports are delivered in order. A
+    // read IRP arriving while draining (possibly from within the
+    // completion of the previous one) just asks the drainer to go again.
+    if (Ring->ReportDraining) {
+        Ring->ReportRetry = TRUE;
+        goto done;
+    }
+
+    Ring->ReportDraining = TRUE;
+
+    do {
+        Ring->ReportRetry = FALSE;
+
+        while (Ring->ReportCount != 0) {
+            XENVKBD_RING_REPORT Entry;
+            BOOLEAN             Pending;
+
+            Entry = Ring->Reports[Ring->ReportHead];
+            Ring->ReportHead = (Ring->ReportHead + 1) % XENVKBD_REPORT_QUEUE_SIZE;
+            --Ring->ReportCount;
+
+            KeReleaseSpinLock(&Ring->ReportLock, Irql);
+
+            Pending = HidSendReadReport(Ring->Hid,
+                                        &Entry.Report,
+                                        Entry.Length);
+
+            KeAcquireSpinLock(&Ring->ReportLock, &Irql);
+
+            if (Pending) {
+                // No read IRP available, put the report back at the head.
+                // RingQueueReport keeps a slot free while draining.
+                Ring->ReportHead = (Ring->ReportHead + XENVKBD_REPORT_QUEUE_SIZE - 1) % XENVKBD_REPORT_QUEUE_SIZE;
+                Ring->Reports[Ring->ReportHead] = Entry;
+                ++Ring->ReportCount;
+                break;
+            }
+        }
+    } while (Ring->ReportRetry);
+
+    Ring->ReportDraining = FALSE;
+
+done:
+    KeReleaseSpinLock(&Ring->ReportLock, Irql);
+}
+
+static FORCEINLINE PXENVKBD_RING_REPORT
+__RingGetReport(
+    IN  PXENVKBD_RING   Ring,
+    IN  ULONG           Index
+    )
+{
+    // Index 0 is the oldest queued report
+    return &Ring->Reports[(Ring->ReportHead + Index) % XENVKBD_REPORT_QUEUE_SIZE];
+}
+
+static FORCEINLINE BOOLEAN
+__RingIsMouseReport(
+    IN  PXENVKBD_RING           Ring,
+    IN  PXENVKBD_RING_REPORT    Entry
+    )
+{
+    return (Entry->Report.ReportId == Ring->AbsMouseReport.ReportId) ? TRUE : FALSE;
+}
+
+static FORCEINLINE VOID
+__RingAddWheel(
+    IN  PXENVKBD_RING_REPORT    Entry,
+    IN  LONG                    dZ
+    )
+{
+    Entry->Report.AbsMouse.dZ = (CHAR)Constrain(Entry->Report.AbsMouse.dZ + dZ, -127, 127);
+}
+
+static VOID
+RingDropReport(
+    IN  PXENVKBD_RING   Ring
+    )
+{
+    PXENVKBD_RING_REPORT    Entry;
+    ULONG                   Index;
+    ULONG                   Victim;
+    LONG                    dZ;
+
+    // Make room by discarding the oldest movement, a later report
+    // carries a newer position.
+    for (Victim = 0; Victim < Ring->ReportCount; ++Victim) {
+        if (__RingGetReport(Ring, Victim)->Motion)
+            break;
+    }
+
+    if (Victim < Ring->ReportCount) {
+        ++Ring->ReportsMotionDropped;
+    } else {
+        // Only key and button transitions are queued. Each report carries
+        // the whole keyboard or button state so later reports still bring
+        // the state up to date, but the oldest transition (e.g. a short
+        // click) is lost.
+        Victim = 0;
+        ++Ring->ReportsTransitionsDropped;
+    }
+
+    Entry = __RingGetReport(Ring, Victim);
+    dZ = __RingIsMouseReport(Ring, Entry) ? Entry->Report.AbsMouse.dZ : 0;
+
+    for (Index = Victim; Index + 1 < Ring->ReportCount; ++Index)
+        *__RingGetReport(Ring, Index) = *__RingGetReport(Ring, Index + 1);
+
+    --Ring->ReportCount;
+
+    if (dZ == 0)
+        return;
+
+    // The wheel is relative, so hand it on to the next mouse report, or
+    // to the next one queued if there is none
+    for (Index = Victim; Index < Ring->ReportCount; ++Index) {
+        Entry = __RingGetReport(Ring, Index);
+
+        if (__RingIsMouseReport(Ring, Entry)) {
+            __RingAddWheel(Entry, dZ);
+            return;
+        }
+    }
+
+    Ring->ReportWheel += dZ;
+}
+
+static VOID
+RingQueueReport(
+    IN  PXENVKBD_RING   Ring,
+    IN  PVOID           Report,
+    IN  ULONG           Length,
+    IN  BOOLEAN         Motion
+    )
+{
+    PXENVKBD_RING_REPORT    Entry;
+    ULONG                   Limit;
+    KIRQL                   Irql;
+
+    ASSERT3U(Length, <=, sizeof(XENVKBD_HID_REPORT));
+
+    KeAcquireSpinLock(&Ring->ReportLock, &Irql);
+
+    if (Ring->ReportCount != 0) {
+        Entry = __RingGetReport(Ring, Ring->ReportCount - 1);
+
+        // Consecutive movement collapses into a single report: the position
+        // is absolute so the latest wins, the wheel is relative so it adds up
+        if (Motion && Entry->Motion) {
+            CHAR    dZ = Entry->Report.AbsMouse.dZ;
+
+            RtlCopyMemory(&Entry->Report, Report, Length);
+            __RingAddWheel(Entry, dZ);
+
+            ++Ring->ReportsCoalesced;
+            goto queued;
+        }
+    }
+
+    // Keep a slot free for a drainer that has to put a report back
+    Limit = XENVKBD_REPORT_QUEUE_SIZE - (Ring->ReportDraining ? 1 : 0);
+
+    if (Ring->ReportCount >= Limit)
+        RingDropReport(Ring);
+
+    Entry = __RingGetReport(Ring, Ring->ReportCount);
+    RtlZeroMemory(&Entry->Report, sizeof(XENVKBD_HID_REPORT));
+    RtlCopyMemory(&Entry->Report, Report, Length);
+    Entry->Length = Length;
+    Entry->Motion = Motion;
+    ++Ring->ReportCount;
+
+queued:
+    if (Ring->ReportWheel != 0 && __RingIsMouseReport(Ring, Entry)) {
+        __RingAddWheel(Entry, Ring->ReportWheel);
+        Ring->ReportWheel = 0;
+    }
+
+    KeReleaseSpinLock(&Ring->ReportLock, Irql);
+
+    RingDrainReports(Ring);
+}
+
 static FORCEINLINE VOID
 __RingEventMotion(
     IN  PXENVKBD_RING   Ring,
@@ -208,9 +423,13 @@ __RingEventMotion(
     Ring->AbsMouseReport.Y = (USHORT)Constrain(Ring->AbsMouseReport.Y + dY, 0, 32767);
     Ring->AbsMouseReport.dZ = -(CHAR)Constrain(dZ, -127, 127);
 
-    Ring->AbsMousePending = HidSendReadReport(Ring->Hid,
-                                              &Ring->AbsMouseReport,
-                                              sizeof(XENVKBD_HID_ABSMOUSE));
+    RingQueueReport(Ring,
+                    &Ring->AbsMouseReport,
+                    sizeof(XENVKBD_HID_ABSMOUSE),
+                    TRUE);
+
+    // the wheel is relative, don't repeat it in the next report
+    Ring->AbsMouseReport.dZ = 0;
 }
 
 static FORCEINLINE VOID
@@ -226,9 +445,10 @@ __RingEventKeypress(
                                               (UCHAR)(KeyCode - 0x110),
                                               Pressed);
 
-        Ring->AbsMousePending = HidSendReadReport(Ring->Hid,
-                                                  &Ring->AbsMouseReport,
-                                                  sizeof(XENVKBD_HID_ABSMOUSE));
+        RingQueueReport(Ring,
+                        &Ring->AbsMouseReport,
+                        sizeof(XENVKBD_HID_ABSMOUSE),
+                        FALSE);
 
     } else {
         // map KeyCode to Usage
@@ -248,9 +468,10 @@ __RingEventKeypress(
                      (UCHAR)Usage,
                      Pressed);
         }
-        Ring->KeyboardPending = HidSendReadReport(Ring->Hid,
-                                                  &Ring->KeyboardReport,
-                                                  sizeof(XENVKBD_HID_KEYBOARD));
+        RingQueueReport(Ring,
+                        &Ring->KeyboardReport,
+                        sizeof(XENVKBD_HID_KEYBOARD),
+                        FALSE);
 
     }
 }
@@ -267,9 +488,13 @@ __RingEventPosition(
     Ring->AbsMouseReport.Y = (USHORT)Constrain(Y, 0, 32767);
     Ring->AbsMouseReport.dZ = -(CHAR)Constrain(dZ, -127, 127);
 
-    Ring->AbsMousePending = HidSendReadReport(Ring->Hid,
-                                              &Ring->AbsMouseReport,
-                                              sizeof(XENVKBD_HID_ABSMOUSE));
+    RingQueueReport(Ring,
+                    &Ring->AbsMouseReport,
+                    sizeof(XENVKBD_HID_ABSMOUSE),
+                    TRUE);
+
+    // the wheel is relative, don't repeat it in the next report
+    Ring->AbsMouseReport.dZ = 0;
 }
 
 __drv_functionClass(KDEFERRED_ROUTINE)
@@ -415,7 +640,7 @@ RingDebugCallback(
 
     XENBUS_DEBUG(Printf,
                  &Ring->DebugInterface,
-                 "KBD: %02x %02x %02x %02x %02x %02x %02x %02x%s\n",
+                 "KBD: %02x %02x %02x %02x %02x %02x %02x %02x\n",
                  Ring->KeyboardReport.ReportId,
                  Ring->KeyboardReport.Modifiers,
                  Ring->KeyboardReport.Keys[0],
@@ -423,18 +648,25 @@ RingDebugCallback(
                  Ring->KeyboardReport.Keys[2],
                  Ring->KeyboardReport.Keys[3],
                  Ring->KeyboardReport.Keys[4],
-                 Ring->KeyboardReport.Keys[5],
-                 Ring->KeyboardPending ? " PENDING" : "");
+                 Ring->KeyboardReport.Keys[5]);
 
     XENBUS_DEBUG(Printf,
                  &Ring->DebugInterface,
-                 "MOU: %02x %02x %04x %04x %02x%s\n",
+                 "MOU: %02x %02x %04x %04x %02x\n",
                  Ring->AbsMouseReport.ReportId,
                  Ring->AbsMouseReport.Buttons,
                  Ring->AbsMouseReport.X,
                  Ring->AbsMouseReport.Y,
-                 Ring->AbsMouseReport.dZ,
-                 Ring->AbsMousePending ? " PENDING" : "");
+                 Ring->AbsMouseReport.dZ);
+
+    XENBUS_DEBUG(Printf,
+                 &Ring->DebugInterface,
+                 "REPORTS: %u queued (%u coalesced, %u motion dropped, %u transitions dropped)%s\n",
+                 Ring->ReportCount,
+                 Ring->ReportsCoalesced,
+                 Ring->ReportsMotionDropped,
+                 Ring->ReportsTransitionsDropped,
+                 Ring->ReportDraining ? " DRAINING" : "");
 }
 
 NTSTATUS
@@ -455,6 +687,7 @@ RingInitialize(
     (*Ring)->Hid = PdoGetHidContext(FrontendGetPdo(Frontend));
     KeInitializeDpc(&(*Ring)->Dpc, RingDpc, *Ring);
     KeInitializeSpinLock(&(*Ring)->Lock);
+    KeInitializeSpinLock(&(*Ring)->ReportLock);
 
     FdoGetDebugInterface(PdoGetFdo(FrontendGetPdo(Frontend)),
                          &(*Ring)->DebugInterface);
@@ -828,8 +1061,11 @@ RingDisconnect(
                   sizeof(XENVKBD_HID_KEYBOARD));
     RtlZeroMemory(&Ring->AbsMouseReport,
                   sizeof(XENVKBD_HID_ABSMOUSE));
-    Ring->KeyboardPending = FALSE;
-    Ring->AbsMousePending = FALSE;
+    RtlZeroMemory(Ring->Reports,
+                  sizeof(Ring->Reports));
+    Ring->ReportHead = 0;
+    Ring->ReportCount = 0;
+    Ring->ReportWheel = 0;
 
     XENBUS_GNTTAB(DestroyCache,
                   &Ring->GnttabInterface,
@@ -860,6 +1096,12 @@ RingTeardown(
     RtlZeroMemory(&Ring->Lock,
                   sizeof (KSPIN_LOCK));
 
+    RtlZeroMemory(&Ring->ReportLock,
+                  sizeof (KSPIN_LOCK));
+    Ring->ReportsCoalesced = 0;
+    Ring->ReportsMotionDropped = 0;
+    Ring->ReportsTransitionsDropped = 0;
+
     RtlZeroMemory(&Ring->GnttabInterface,
                   sizeof (XENBUS_GNTTAB_INTERFACE));
 
@@ -921,13 +1163,6 @@ RingReadReport(
     IN  PXENVKBD_RING   Ring
     )
 {
-    // Check for pending reports, push 1 pending report to subscriber
-    if (Ring->KeyboardPending)
-        Ring->KeyboardPending = HidSendReadReport(Ring->Hid,
-                                                  &Ring->KeyboardReport,
-                                                  sizeof(XENVKBD_HID_KEYBOARD));
-    else if (Ring->AbsMousePending)
-        Ring->AbsMousePending = HidSendReadReport(Ring->Hid,
-                                                  &Ring->AbsMouseReport,
-                                                  sizeof(XENVKBD_HID_ABSMOUSE));
+    // A read IRP has been queued, push queued reports to the subscriber
+    RingDrainReports(Ring);
 }
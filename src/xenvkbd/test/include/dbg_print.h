@@ -0,0 +1,71 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host replacement for src/xenvkbd/dbg_print.h. Output is suppressed
+// unless HOST_VERBOSE is set in the environment because many tests
+// deliberately drive the drivers down their failure paths.
+
+#ifndef _XENVKBD_DBG_PRINT_H
+#define _XENVKBD_DBG_PRINT_H
+
+#include <ntddk.h>
+#include <stdarg.h>
+
+#ifndef __MODULE__
+#define __MODULE__ "HOST"
+#endif
+
+static inline VOID
+__HostPrint(
+    IN  const CHAR  *Level,
+    IN  const CHAR  *Function,
+    IN  const CHAR  *Format,
+    ...
+    )
+{
+    va_list         Arguments;
+
+    if (getenv("HOST_VERBOSE") == NULL)
+        return;
+
+    fprintf(stderr, "%s|%s|%s: ", __MODULE__, Level, Function);
+
+    va_start(Arguments, Format);
+    vfprintf(stderr, Format, Arguments);
+    va_end(Arguments);
+}
+
+#define Error(...)      __HostPrint("ERROR", __FUNCTION__, __VA_ARGS__)
+#define Warning(...)    __HostPrint("WARNING", __FUNCTION__, __VA_ARGS__)
+#define Info(...)       __HostPrint("INFO", __FUNCTION__, __VA_ARGS__)
+#define Trace(...)      __HostPrint("TRACE", __FUNCTION__, __VA_ARGS__)
+
+#endif  // _XENVKBD_DBG_PRINT_H
@@ -0,0 +1,555 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// Host test for the report queue in ring.c.
+//
+// Reports are queued with RingQueueReport() and handed to a fake HID
+// context that only accepts them while it holds read IRPs. The test
+// checks that consecutive movement is coalesced, that a full queue drops
+// the oldest movement first and passes its relative wheel movement on to
+// a later mouse report, that key and button transitions are only dropped
+// (and counted separately) when nothing else is queued, and that the
+// queue drains in order, putting a report back when no read IRP is left
+// and going round again when one arrives during the drain.
+
+#include <ntddk.h>
+
+#include "dbg_print.h"
+#include "assert.h"
+
+// Keep the driver's own headers for the ring's neighbours out of the
+// way; the declarations ring.c needs are provided below.
+#define _XENVKBD_PDO_H
+#define _XENVKBD_FRONTEND_H
+#define _XENVKBD_HID_H
+#define _XENVKBD_THREAD_H
+#define _XENVKBD_REGISTRY_H
+
+#include <debug_interface.h>
+#include <store_interface.h>
+#include <gnttab_interface.h>
+#include <evtchn_interface.h>
+
+typedef struct _XENVKBD_PDO         XENVKBD_PDO, *PXENVKBD_PDO;
+typedef struct _XENVKBD_FDO         XENVKBD_FDO, *PXENVKBD_FDO;
+typedef struct _XENVKBD_FRONTEND    XENVKBD_FRONTEND, *PXENVKBD_FRONTEND;
+typedef struct _XENVKBD_HID_CONTEXT XENVKBD_HID_CONTEXT, *PXENVKBD_HID_CONTEXT;
+
+static PXENVKBD_FDO         PdoGetFdo(PXENVKBD_PDO);
+static PXENVKBD_HID_CONTEXT PdoGetHidContext(PXENVKBD_PDO);
+static PXENVKBD_PDO         FrontendGetPdo(PXENVKBD_FRONTEND);
+static PCHAR                FrontendGetPath(PXENVKBD_FRONTEND);
+static PCHAR                FrontendGetBackendPath(PXENVKBD_FRONTEND);
+static USHORT               FrontendGetBackendDomain(PXENVKBD_FRONTEND);
+static VOID                 FdoGetDebugInterface(PXENVKBD_FDO, PXENBUS_DEBUG_INTERFACE);
+static VOID                 FdoGetStoreInterface(PXENVKBD_FDO, PXENBUS_STORE_INTERFACE);
+static VOID                 FdoGetGnttabInterface(PXENVKBD_FDO, PXENBUS_GNTTAB_INTERFACE);
+static VOID                 FdoGetEvtchnInterface(PXENVKBD_FDO, PXENBUS_EVTCHN_INTERFACE);
+static BOOLEAN              HidSendReadReport(PXENVKBD_HID_CONTEXT, PVOID, ULONG);
+
+// gcc does not elide the trailing comma of an empty __VA_ARGS__
+#undef  XENBUS_DEBUG
+#define XENBUS_DEBUG(_Method, _Interface, ...)    \
+    (_Interface)->Debug ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_STORE
+#define XENBUS_STORE(_Method, _Interface, ...)    \
+    (_Interface)->Store ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_GNTTAB
+#define XENBUS_GNTTAB(_Method, _Interface, ...)    \
+    (_Interface)->Gnttab ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+#undef  XENBUS_EVTCHN
+#define XENBUS_EVTCHN(_Method, _Interface, ...)    \
+    (_Interface)->Evtchn ## _Method((PINTERFACE)(_Interface), ##__VA_ARGS__)
+
+#include "ring.c"
+
+#include "test.h"
+
+#define TEST_MAX_DELIVERED  256
+
+// Stands in for the HID context: a report is taken if a read IRP is
+// available, otherwise the ring is told it is still pending
+struct _XENVKBD_HID_CONTEXT {
+    PXENVKBD_RING       Ring;
+    ULONG               ReadIrps;
+    ULONG               Depth;
+    ULONG               MaxDepth;
+    XENVKBD_HID_REPORT  Delivered[TEST_MAX_DELIVERED];
+    ULONG               Length[TEST_MAX_DELIVERED];
+    ULONG               Count;
+    ULONG               Attempts;
+
+    // A read IRP arrives just after a report has been found pending
+    BOOLEAN             ArriveDuringSend;
+
+    // A key is queued while the next report is being offered
+    BOOLEAN             QueueDuringSend;
+    UCHAR               QueueKey;
+};
+
+static XENVKBD_HID_CONTEXT  TestHid;
+
+static VOID
+TestQueueKey(
+    IN  PXENVKBD_RING   Ring,
+    IN  UCHAR           Key
+    )
+{
+    XENVKBD_HID_KEYBOARD    Report;
+
+    RtlZeroMemory(&Report, sizeof (Report));
+    Report.ReportId = 1;
+    Report.Keys[0] = Key;
+
+    RingQueueReport(Ring, &Report, sizeof (Report), FALSE);
+}
+
+static VOID
+TestQueueMouse(
+    IN  PXENVKBD_RING   Ring,
+    IN  UCHAR           Buttons,
+    IN  USHORT          X,
+    IN  USHORT          Y,
+    IN  CHAR            dZ,
+    IN  BOOLEAN         Motion
+    )
+{
+    XENVKBD_HID_ABSMOUSE    Report;
+
+    RtlZeroMemory(&Report, sizeof (Report));
+    Report.ReportId = 2;
+    Report.Buttons = Buttons;
+    Report.X = X;
+    Report.Y = Y;
+    Report.dZ = dZ;
+
+    RingQueueReport(Ring, &Report, sizeof (Report), Motion);
+}
+
+static BOOLEAN
+HidSendReadReport(
+    IN  PXENVKBD_HID_CONTEXT    Context,
+    IN  PVOID                   Buffer,
+    IN  ULONG                   Length
+    )
+{
+    BOOLEAN                     Pending;
+
+    Context->Attempts++;
+
+    // The ring must not offer reports from two places at once
+    if (++Context->Depth > Context->MaxDepth)
+        Context->MaxDepth = Context->Depth;
+
+    if (Context->QueueDuringSend) {
+        Context->QueueDuringSend = FALSE;
+        TestQueueKey(Context->Ring, Context->QueueKey);
+    }
+
+    if (Context->ReadIrps == 0 || Context->Count == TEST_MAX_DELIVERED) {
+        Pending = TRUE;
+    } else {
+        --Context->ReadIrps;
+
+        RtlZeroMemory(&Context->Delivered[Context->Count],
+                      sizeof (XENVKBD_HID_REPORT));
+        RtlCopyMemory(&Context->Delivered[Context->Count], Buffer, Length);
+        Context->Length[Context->Count] = Length;
+        Context->Count++;
+
+        Pending = FALSE;
+    }
+
+    if (Pending && Context->ArriveDuringSend) {
+        Context->ArriveDuringSend = FALSE;
+        Context->ReadIrps++;
+        RingReadReport(Context->Ring);
+    }
+
+    --Context->Depth;
+    return Pending;
+}
+
+static PXENVKBD_HID_CONTEXT
+PdoGetHidContext(
+    IN  PXENVKBD_PDO    Pdo
+    )
+{
+    return &TestHid;
+}
+
+static PXENVKBD_PDO
+FrontendGetPdo(
+    IN  PXENVKBD_FRONTEND   Frontend
+    )
+{
+    return NULL;
+}
+
+static PXENVKBD_FDO
+PdoGetFdo(
+    IN  PXENVKBD_PDO    Pdo
+    )
+{
+    return NULL;
+}
+
+static VOID
+FdoGetDebugInterface(
+    IN  PXENVKBD_FDO            Fdo,
+    OUT PXENBUS_DEBUG_INTERFACE Interface
+    )
+{
+}
+
+static VOID
+FdoGetStoreInterface(
+    IN  PXENVKBD_FDO            Fdo,
+    OUT PXENBUS_STORE_INTERFACE Interface
+    )
+{
+}
+
+static VOID
+FdoGetGnttabInterface(
+    IN  PXENVKBD_FDO                Fdo,
+    OUT PXENBUS_GNTTAB_INTERFACE    Interface
+    )
+{
+}
+
+static VOID
+FdoGetEvtchnInterface(
+    IN  PXENVKBD_FDO                Fdo,
+    OUT PXENBUS_EVTCHN_INTERFACE    Interface
+    )
+{
+}
+
+static PCHAR
+FrontendGetPath(
+    IN  PXENVKBD_FRONTEND   Frontend
+    )
+{
+    abort();
+}
+
+static PCHAR
+FrontendGetBackendPath(
+    IN  PXENVKBD_FRONTEND   Frontend
+    )
+{
+    abort();
+}
+
+static USHORT
+FrontendGetBackendDomain(
+    IN  PXENVKBD_FRONTEND   Frontend
+    )
+{
+    abort();
+}
+
+// The ring is never connected, so it has no shared page and no DPC
+
+BOOLEAN
+KeInsertQueueDpc(
+    IN  PKDPC   Dpc,
+    IN  PVOID   Argument1,
+    IN  PVOID   Argument2
+    )
+{
+    abort();
+}
+
+VOID
+MmUnmapLockedPages(
+    IN  PVOID   BaseAddress,
+    IN  PMDL    Mdl
+    )
+{
+    abort();
+}
+
+VOID
+MmFreePagesFromMdl(
+    IN  PMDL    Mdl
+    )
+{
+    abort();
+}
+
+static PXENVKBD_RING
+TestRingCreate(
+    VOID
+    )
+{
+    PXENVKBD_RING   Ring;
+    NTSTATUS        status;
+
+    RtlZeroMemory(&TestHid, sizeof (TestHid));
+
+    status = RingInitialize(NULL, &Ring);
+    CHECK(NT_SUCCESS(status));
+
+    // As RingConnect() does
+    Ring->KeyboardReport.ReportId = 1;
+    Ring->AbsMouseReport.ReportId = 2;
+
+    TestHid.Ring = Ring;
+    return Ring;
+}
+
+static VOID
+TestRingDestroy(
+    IN  PXENVKBD_RING   Ring
+    )
+{
+    CHECK_EQ(TestHid.MaxDepth, 1);
+
+    // As RingDisconnect() does
+    RtlZeroMemory(&Ring->KeyboardReport, sizeof (XENVKBD_HID_KEYBOARD));
+    RtlZeroMemory(&Ring->AbsMouseReport, sizeof (XENVKBD_HID_ABSMOUSE));
+    RtlZeroMemory(Ring->Reports, sizeof (Ring->Reports));
+    Ring->ReportHead = 0;
+    Ring->ReportCount = 0;
+    Ring->ReportWheel = 0;
+
+    RingTeardown(Ring);
+    CHECK_EQ(HostPoolAllocations, 0);
+}
+
+static PXENVKBD_HID_REPORT
+TestPeek(
+    IN  PXENVKBD_RING   Ring,
+    IN  ULONG           Index
+    )
+{
+    CHECK(Index < Ring->ReportCount);
+    return &__RingGetReport(Ring, Index)->Report;
+}
+
+static VOID
+TestCoalesce(
+    VOID
+    )
+{
+    PXENVKBD_RING   Ring = TestRingCreate();
+
+    // Position is absolute, the wheel adds up and saturates
+    TestQueueMouse(Ring, 0, 10, 20, 100, TRUE);
+    TestQueueMouse(Ring, 0, 30, 40, 100, TRUE);
+    CHECK_EQ(Ring->ReportCount, 1);
+    CHECK_EQ(Ring->ReportsCoalesced, 1);
+    CHECK_EQ(TestPeek(Ring, 0)->AbsMouse.X, 30);
+    CHECK_EQ(TestPeek(Ring, 0)->AbsMouse.Y, 40);
+    CHECK_EQ(TestPeek(Ring, 0)->AbsMouse.dZ, 127);
+
+    TestQueueMouse(Ring, 0, 31, 41, -100, TRUE);
+    TestQueueMouse(Ring, 0, 32, 42, -100, TRUE);
+    CHECK_EQ(Ring->ReportCount, 1);
+    CHECK_EQ(TestPeek(Ring, 0)->AbsMouse.dZ, (CHAR)-73);
+
+    // A button transition is never merged, nor is movement merged across it
+    TestQueueMouse(Ring, 1, 32, 42, 0, FALSE);
+    TestQueueMouse(Ring, 1, 50, 60, -5, TRUE);
+    TestQueueMouse(Ring, 1, 51, 61, -7, TRUE);
+    CHECK_EQ(Ring->ReportCount, 3);
+    CHECK_EQ(TestPeek(Ring, 1)->AbsMouse.Buttons, 1);
+    CHECK_EQ(TestPeek(Ring, 2)->AbsMouse.X, 51);
+    CHECK_EQ(TestPeek(Ring, 2)->AbsMouse.dZ, (CHAR)-12);
+
+    // Nor is movement merged across a key
+    TestQueueKey(Ring, 4);
+    TestQueueMouse(Ring, 1, 70, 80, 1, TRUE);
+    CHECK_EQ(Ring->ReportCount, 5);
+    CHECK_EQ(Ring->ReportsCoalesced, 4);
+
+    TestHid.ReadIrps = 8;
+    RingReadReport(Ring);
+    CHECK_EQ(Ring->ReportCount, 0);
+    CHECK_EQ(TestHid.Count, 5);
+    CHECK_EQ(TestHid.Delivered[0].AbsMouse.X, 32);
+    CHECK_EQ(TestHid.Delivered[1].AbsMouse.Buttons, 1);
+    CHECK_EQ(TestHid.Delivered[2].AbsMouse.X, 51);
+    CHECK_EQ(TestHid.Delivered[3].Keyboard.Keys[0], 4);
+    CHECK_EQ(TestHid.Length[3], sizeof (XENVKBD_HID_KEYBOARD));
+    CHECK_EQ(TestHid.Delivered[4].AbsMouse.X, 70);
+
+    TestRingDestroy(Ring);
+}
+
+static VOID
+TestEvictMotion(
+    VOID
+    )
+{
+    PXENVKBD_RING   Ring = TestRingCreate();
+    ULONG           Index;
+
+    // The oldest movement goes first and its wheel moves on to the next
+    // mouse report, here a button transition
+    TestQueueKey(Ring, 1);
+    TestQueueMouse(Ring, 0, 100, 100, 3, TRUE);
+    TestQueueKey(Ring, 2);
+    TestQueueMouse(Ring, 0, 200, 200, 40, TRUE);
+    TestQueueMouse(Ring, 1, 200, 200, 0, FALSE);
+    TestQueueMouse(Ring, 1, 300, 300, -2, TRUE);
+    while (Ring->ReportCount < XENVKBD_REPORT_QUEUE_SIZE)
+        TestQueueKey(Ring, 3);
+
+    TestQueueKey(Ring, 5);
+    CHECK_EQ(Ring->ReportCount, XENVKBD_REPORT_QUEUE_SIZE);
+    CHECK_EQ(Ring->ReportsMotionDropped, 1);
+    CHECK_EQ(Ring->ReportsTransitionsDropped, 0);
+    CHECK_EQ(Ring->ReportWheel, 0);
+    CHECK_EQ(TestPeek(Ring, 0)->Keyboard.Keys[0], 1);
+    CHECK_EQ(TestPeek(Ring, 1)->Keyboard.Keys[0], 2);
+    CHECK_EQ(TestPeek(Ring, 2)->AbsMouse.X, 200);
+    CHECK_EQ(TestPeek(Ring, 2)->AbsMouse.dZ, 43);
+    CHECK_EQ(TestPeek(Ring, 3)->AbsMouse.Buttons, 1);
+    CHECK_EQ(TestPeek(Ring, 3)->AbsMouse.dZ, 0);
+    CHECK_EQ(TestPeek(Ring, XENVKBD_REPORT_QUEUE_SIZE - 1)->Keyboard.Keys[0], 5);
+
+    // Twice more: the second movement's wheel goes to the button report,
+    // then the third has no mouse report after it and is carried
+    TestQueueKey(Ring, 6);
+    CHECK_EQ(TestPeek(Ring, 2)->AbsMouse.Buttons, 1);
+    CHECK_EQ(TestPeek(Ring, 2)->AbsMouse.dZ, 43);
+    CHECK_EQ(Ring->ReportWheel, 0);
+
+    TestQueueKey(Ring, 7);
+    CHECK_EQ(Ring->ReportsMotionDropped, 3);
+    CHECK_EQ(Ring->ReportWheel, -2);
+    CHECK_EQ(TestPeek(Ring, 3)->Keyboard.Keys[0], 3);
+
+    // Only transitions are left, so the oldest one goes, and the carried
+    // wheel waits for the next mouse report
+    TestQueueKey(Ring, 8);
+    CHECK_EQ(Ring->ReportsTransitionsDropped, 1);
+    CHECK_EQ(Ring->ReportCount, XENVKBD_REPORT_QUEUE_SIZE);
+    CHECK_EQ(TestPeek(Ring, 0)->Keyboard.Keys[0], 2);
+    CHECK_EQ(Ring->ReportWheel, -2);
+
+    TestQueueMouse(Ring, 0, 400, 400, 0, FALSE);
+    CHECK_EQ(Ring->ReportsTransitionsDropped, 2);
+    CHECK_EQ(Ring->ReportWheel, 0);
+    CHECK_EQ(TestPeek(Ring, 0)->AbsMouse.Buttons, 1);
+    CHECK_EQ(TestPeek(Ring, XENVKBD_REPORT_QUEUE_SIZE - 1)->AbsMouse.X, 400);
+    CHECK_EQ(TestPeek(Ring, XENVKBD_REPORT_QUEUE_SIZE - 1)->AbsMouse.dZ, (CHAR)-2);
+
+    // Dropping a mouse transition keeps its wheel too: it moves on to the
+    // newest report
+    TestQueueKey(Ring, 9);
+    CHECK_EQ(Ring->ReportsTransitionsDropped, 3);
+    CHECK_EQ(TestPeek(Ring, 0)->Keyboard.Keys[0], 3);
+    CHECK_EQ(TestPeek(Ring, XENVKBD_REPORT_QUEUE_SIZE - 2)->AbsMouse.dZ, 41);
+
+    TestHid.ReadIrps = XENVKBD_REPORT_QUEUE_SIZE;
+    RingReadReport(Ring);
+    CHECK_EQ(Ring->ReportCount, 0);
+    CHECK_EQ(TestHid.Count, XENVKBD_REPORT_QUEUE_SIZE);
+
+    for (Index = 0; Index < XENVKBD_REPORT_QUEUE_SIZE - 2; Index++)
+        CHECK_EQ(TestHid.Delivered[Index].ReportId, 1);
+    CHECK_EQ(TestHid.Delivered[Index].AbsMouse.X, 400);
+    CHECK_EQ(TestHid.Delivered[Index + 1].Keyboard.Keys[0], 9);
+
+    TestRingDestroy(Ring);
+}
+
+static VOID
+TestDrain(
+    VOID
+    )
+{
+    PXENVKBD_RING   Ring = TestRingCreate();
+    UCHAR           Key;
+
+    // Nothing is taken without a read IRP
+    for (Key = 1; Key <= 5; Key++)
+        TestQueueKey(Ring, Key);
+    CHECK_EQ(Ring->ReportCount, 5);
+    CHECK_EQ(TestHid.Count, 0);
+
+    // Each read IRP takes the oldest report, the rest is put back in order
+    TestHid.ReadIrps = 2;
+    RingReadReport(Ring);
+    CHECK_EQ(TestHid.Count, 2);
+    CHECK_EQ(Ring->ReportCount, 3);
+    CHECK_EQ(TestHid.Delivered[0].Keyboard.Keys[0], 1);
+    CHECK_EQ(TestHid.Delivered[1].Keyboard.Keys[0], 2);
+    CHECK_EQ(TestPeek(Ring, 0)->Keyboard.Keys[0], 3);
+
+    // A read IRP that arrives just after the drainer found none does not
+    // send a report itself but makes the drainer go round again
+    TestHid.ArriveDuringSend = TRUE;
+    RingReadReport(Ring);
+    CHECK_EQ(TestHid.Count, 3);
+    CHECK_EQ(TestHid.Delivered[2].Keyboard.Keys[0], 3);
+    CHECK_EQ(Ring->ReportCount, 2);
+    CHECK(!Ring->ReportDraining);
+
+    // A report queued while the drainer is offering one goes behind it,
+    // and a full queue keeps a slot for the report being offered
+    while (Ring->ReportCount < XENVKBD_REPORT_QUEUE_SIZE)
+        TestQueueKey(Ring, 6);
+    TestHid.QueueDuringSend = TRUE;
+    TestHid.QueueKey = 7;
+    RingReadReport(Ring);
+    CHECK_EQ(Ring->ReportCount, XENVKBD_REPORT_QUEUE_SIZE);
+    CHECK_EQ(Ring->ReportsTransitionsDropped, 1);
+    CHECK_EQ(TestPeek(Ring, 0)->Keyboard.Keys[0], 4);
+    CHECK_EQ(TestPeek(Ring, 1)->Keyboard.Keys[0], 6);
+    CHECK_EQ(TestPeek(Ring, XENVKBD_REPORT_QUEUE_SIZE - 1)->Keyboard.Keys[0], 7);
+
+    TestHid.ReadIrps = XENVKBD_REPORT_QUEUE_SIZE;
+    RingReadReport(Ring);
+    CHECK_EQ(Ring->ReportCount, 0);
+    CHECK_EQ(TestHid.Count, 3 + XENVKBD_REPORT_QUEUE_SIZE);
+    CHECK_EQ(TestHid.Delivered[3].Keyboard.Keys[0], 4);
+    CHECK_EQ(TestHid.Delivered[TestHid.Count - 1].Keyboard.Keys[0], 7);
+
+    TestRingDestroy(Ring);
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    TestCoalesce();
+    TestEvictMotion();
+    TestDrain();
+
+    return TEST_RESULT("ring_test");
+}